@@ -25,6 +25,7 @@
 #include <uuid/uuid.h>
 #include <time.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "bitlk.h"
 #include "internal.h"
@@ -437,7 +438,7 @@ int BITLK_read_sb(struct crypt_device *cd, struct bitlk_metadata *params)
 	}
 
 	/* read and check the signature */
-	if (read_lseek_blockwise(devfd, device_block_size(cd, device),
+	if (pread_blockwise(devfd, device_block_size(cd, device),
 		device_alignment(device), &sig, sizeof(sig), 0) != sizeof(sig)) {
 		log_dbg(cd, "Failed to read BITLK signature from %s.", device_path(device));
 		r = -EIO;
@@ -481,7 +482,7 @@ int BITLK_read_sb(struct crypt_device *cd, struct bitlk_metadata *params)
 	}
 
 	/* read GUID and FVE metadata offsets */
-	if (read_lseek_blockwise(devfd, device_block_size(cd, device),
+	if (pread_blockwise(devfd, device_block_size(cd, device),
 		device_alignment(device), &sb, sizeof(sb), fve_offset) != sizeof(sb)) {
 		log_err(cd, _("Failed to read BITLK header from %s."), device_path(device));
 		r = -EINVAL;
@@ -504,7 +505,7 @@ int BITLK_read_sb(struct crypt_device *cd, struct bitlk_metadata *params)
 		sizeof(fve), device_path(device), params->metadata_offset[0]);
 
 	/* read FVE metadata from the first metadata area */
-	if (read_lseek_blockwise(devfd, device_block_size(cd, device),
+	if (pread_blockwise(devfd, device_block_size(cd, device),
 		device_alignment(device), &fve, sizeof(fve), params->metadata_offset[0]) != sizeof(fve) ||
 		memcmp(fve.signature, BITLK_SIGNATURE, sizeof(fve.signature)) ||
 		le16_to_cpu(fve.fve_version) != 2) {
@@ -596,7 +597,7 @@ int BITLK_read_sb(struct crypt_device *cd, struct bitlk_metadata *params)
 	log_dbg(cd, "Reading BITLK FVE metadata entries of size %zu on device %s, offset %" PRIu64 ".",
 		fve_entries_size, device_path(device), params->metadata_offset[0] + BITLK_FVE_METADATA_HEADERS_LEN);
 
-	if (read_lseek_blockwise(devfd, device_block_size(cd, device),
+	if (pread_blockwise(devfd, device_block_size(cd, device),
 		device_alignment(device), fve_entries, fve_entries_size,
 		params->metadata_offset[0] + BITLK_FVE_METADATA_HEADERS_LEN) != (ssize_t)fve_entries_size) {
 		log_err(cd, _("Failed to read BITLK metadata entries from %s."), device_path(device));
@@ -998,6 +999,14 @@ static int bitlk_kdf(struct crypt_device *cd,
 
 	memcpy(kdf.salt, salt, 16);
 
+	if (!crypt_derived_key_cache_get(cd, recovery ? "bitlk-recovery" : "bitlk", BITLK_KDF_HASH,
+			password, passwordLen, kdf.salt, sizeof(kdf.salt),
+			kdf.last_sha256, sizeof(kdf.last_sha256), BITLK_KDF_ITERATION_COUNT, 0, 0)) {
+		*vk = crypt_alloc_volume_key(sizeof(kdf.last_sha256), kdf.last_sha256);
+		crypt_safe_memzero(&kdf, sizeof(kdf));
+		return *vk ? 0 : -ENOMEM;
+	}
+
 	r = crypt_hash_init(&hd, BITLK_KDF_HASH);
 	if (r < 0)
 		return r;
@@ -1035,17 +1044,27 @@ static int bitlk_kdf(struct crypt_device *cd,
 			goto out;
 	}
 
-	for (i = 0; i < BITLK_KDF_ITERATION_COUNT; i++) {
-		crypt_hash_write(hd, (const char*) &kdf, sizeof(kdf));
-		r = crypt_hash_final(hd, kdf.last_sha256, len);
-		if (r < 0)
-			goto out;
-		kdf.count = cpu_to_le64(le64_to_cpu(kdf.count) + 1);
-	}
+	/* CPU accelerated loop over the fixed structure, hash API otherwise */
+	r = crypt_bitlk_stretch_key(kdf.initial_sha256, kdf.salt,
+				    BITLK_KDF_ITERATION_COUNT, kdf.last_sha256);
+	if (r == -ENOTSUP) {
+		for (i = 0; i < BITLK_KDF_ITERATION_COUNT; i++) {
+			crypt_hash_write(hd, (const char*) &kdf, sizeof(kdf));
+			r = crypt_hash_final(hd, kdf.last_sha256, len);
+			if (r < 0)
+				goto out;
+			kdf.count = cpu_to_le64(le64_to_cpu(kdf.count) + 1);
+		}
+	} else if (r < 0)
+		goto out;
 
 	*vk = crypt_alloc_volume_key(len, kdf.last_sha256);
 
+	crypt_derived_key_cache_put(cd, recovery ? "bitlk-recovery" : "bitlk", BITLK_KDF_HASH,
+			password, passwordLen, kdf.salt, sizeof(kdf.salt),
+			kdf.last_sha256, sizeof(kdf.last_sha256), BITLK_KDF_ITERATION_COUNT, 0, 0);
 out:
+	crypt_safe_memzero(&kdf, sizeof(kdf));
 	crypt_safe_free(utf16Password);
 	if (hd)
 		crypt_hash_destroy(hd);
@@ -1105,14 +1124,250 @@ out:
 	return r;
 }
 
-int BITLK_get_volume_key(struct crypt_device *cd,
-			 const char *password,
-			 size_t passwordLen,
-			 const struct bitlk_metadata *params,
-			 struct volume_key **open_fvek_key)
+/*
+ * Passphrase and recovery passphrase protectors need the expensive key
+ * stretch, each with its own salt. With more of them, stretching runs in
+ * worker threads while VMKs are still tried in metadata order by the
+ * calling thread. Once the FVEK is decrypted no new stretch is started;
+ * running ones cannot be interrupted and are waited for and discarded.
+ */
+struct bitlk_kdf_job {
+	const struct bitlk_vmk *vmk;
+	const char *password;
+	size_t password_len;
+	bool recovery;
+	bool taken;
+	bool done;
+	int r;
+	struct volume_key *key;
+};
+
+struct bitlk_kdf_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct crypt_device *cd;
+	/* decoded recovery passwords, owned by the pool */
+	struct volume_key **recovery_keys;
+	size_t recovery_count;
+	struct bitlk_kdf_job *jobs;
+	unsigned count;
+	unsigned next;
+	bool cancel;
+	pthread_t *threads;
+	unsigned started;
+};
+
+static void bitlk_kdf_job_run(struct bitlk_kdf_pool *pool, struct bitlk_kdf_job *job)
+{
+	struct volume_key *key = NULL;
+	int r;
+
+	r = bitlk_kdf(pool->cd, job->password, job->password_len,
+		      job->recovery, job->vmk->salt, &key);
+
+	pthread_mutex_lock(&pool->lock);
+	job->r = r;
+	job->key = key;
+	job->done = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void *bitlk_kdf_thread(void *arg)
+{
+	struct bitlk_kdf_pool *pool = arg;
+	struct bitlk_kdf_job *job;
+
+	pthread_mutex_lock(&pool->lock);
+	while (true) {
+		while (pool->next < pool->count && pool->jobs[pool->next].taken)
+			pool->next++;
+		if (pool->cancel || pool->next >= pool->count)
+			break;
+		job = &pool->jobs[pool->next++];
+		job->taken = true;
+		pthread_mutex_unlock(&pool->lock);
+
+		bitlk_kdf_job_run(pool, job);
+		pthread_mutex_lock(&pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+static void bitlk_kdf_pool_add(struct bitlk_kdf_pool *pool, const struct bitlk_vmk *vmk,
+			       const char *password, size_t password_len, bool recovery)
+{
+	struct bitlk_kdf_job *job = &pool->jobs[pool->count++];
+
+	job->vmk = vmk;
+	job->password = password;
+	job->password_len = password_len;
+	job->recovery = recovery;
+}
+
+/* Start threads for added jobs, the calling thread stretches keys too while waiting. */
+static void bitlk_kdf_pool_run(struct bitlk_kdf_pool *pool)
+{
+	unsigned threads = crypt_cpusonline();
+
+	if (threads > pool->count)
+		threads = pool->count;
+	if (threads < 2)
+		return;
+
+	pool->threads = calloc(threads - 1, sizeof(*pool->threads));
+	if (!pool->threads)
+		return;
+
+	for (pool->started = 0; pool->started < threads - 1; pool->started++)
+		if (pthread_create(&pool->threads[pool->started], NULL, bitlk_kdf_thread, pool))
+			break;
+
+	log_dbg(pool->cd, "Stretching %u VMK keys with %u threads.", pool->count, pool->started + 1);
+}
+
+static void bitlk_kdf_pool_start(struct crypt_device *cd, struct bitlk_kdf_pool *pool,
+				 const char *password, size_t passwordLen,
+				 const struct bitlk_metadata *params)
+{
+	struct volume_key *recovery_key = NULL;
+	const struct bitlk_vmk *vmk;
+	unsigned count = 0;
+
+	pool->cd = cd;
+
+	if (crypt_cpusonline() < 2)
+		return;
+
+	for (vmk = params->vmks; vmk; vmk = vmk->next) {
+		if (vmk->protection == BITLK_PROTECTION_PASSPHRASE)
+			count++;
+		else if (vmk->protection == BITLK_PROTECTION_RECOVERY_PASSPHRASE) {
+			if (!recovery_key && get_recovery_key(cd, password, passwordLen, &recovery_key))
+				recovery_key = NULL;
+			if (recovery_key)
+				count++;
+		}
+	}
+
+	if (count < 2) {
+		crypt_free_volume_key(recovery_key);
+		return;
+	}
+
+	pool->jobs = calloc(count, sizeof(*pool->jobs));
+	pool->recovery_keys = calloc(1, sizeof(*pool->recovery_keys));
+	if (!pool->jobs || !pool->recovery_keys) {
+		crypt_free_volume_key(recovery_key);
+		return;
+	}
+	pool->recovery_keys[0] = recovery_key;
+	pool->recovery_count = 1;
+
+	for (vmk = params->vmks; vmk; vmk = vmk->next) {
+		if (vmk->protection == BITLK_PROTECTION_PASSPHRASE)
+			bitlk_kdf_pool_add(pool, vmk, password, passwordLen, false);
+		else if (vmk->protection == BITLK_PROTECTION_RECOVERY_PASSPHRASE && recovery_key)
+			bitlk_kdf_pool_add(pool, vmk, recovery_key->key, recovery_key->keylength, true);
+	}
+
+	bitlk_kdf_pool_run(pool);
+}
+
+/* Stretched key for the VMK, computed here if no thread took it (or no pool). */
+static int bitlk_kdf_pool_get(struct bitlk_kdf_pool *pool, const struct bitlk_vmk *vmk,
+			      const char *password, size_t passwordLen, bool recovery,
+			      struct volume_key **vk)
+{
+	struct bitlk_kdf_job *job = NULL;
+	bool run = false;
+	unsigned i;
+	int r;
+
+	for (i = 0; i < pool->count && !job; i++)
+		if (pool->jobs[i].vmk == vmk && pool->jobs[i].recovery == recovery &&
+		    pool->jobs[i].password_len == passwordLen &&
+		    !crypt_backend_memeq(pool->jobs[i].password, password, passwordLen))
+			job = &pool->jobs[i];
+
+	if (!job)
+		return bitlk_kdf(pool->cd, password, passwordLen, recovery, vmk->salt, vk);
+
+	pthread_mutex_lock(&pool->lock);
+	if (!job->taken)
+		run = job->taken = true;
+	else while (!job->done)
+		pthread_cond_wait(&pool->cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	if (run)
+		bitlk_kdf_job_run(pool, job);
+
+	r = job->r;
+	*vk = job->key;
+	job->key = NULL;
+	return r;
+}
+
+static void bitlk_kdf_pool_stop(struct bitlk_kdf_pool *pool)
+{
+	unsigned i;
+
+	pthread_mutex_lock(&pool->lock);
+	pool->cancel = true;
+	pthread_mutex_unlock(&pool->lock);
+
+	while (pool->started)
+		pthread_join(pool->threads[--pool->started], NULL);
+
+	for (i = 0; i < pool->count; i++)
+		crypt_free_volume_key(pool->jobs[i].key);
+	for (i = 0; i < pool->recovery_count; i++)
+		crypt_free_volume_key(pool->recovery_keys[i]);
+	free(pool->recovery_keys);
+	free(pool->jobs);
+	free(pool->threads);
+	pthread_cond_destroy(&pool->cond);
+	pthread_mutex_destroy(&pool->lock);
+}
+
+/* Decrypt VMK with the key from protector, then FVEK with the VMK. */
+static int bitlk_open_fvek(struct crypt_device *cd, const struct bitlk_metadata *params,
+			   const struct bitlk_vmk *vmk, struct volume_key *vmk_dec_key,
+			   struct volume_key **open_fvek_key)
 {
-	int r = 0;
 	struct volume_key *open_vmk_key = NULL;
+	int r;
+
+	log_dbg(cd, "Trying to decrypt %s.", get_vmk_protection_string(vmk->protection));
+	r = decrypt_key(cd, &open_vmk_key, vmk->vk, vmk_dec_key,
+			vmk->mac_tag, BITLK_VMK_MAC_TAG_SIZE,
+			vmk->nonce, BITLK_NONCE_SIZE, false);
+	if (r < 0) {
+		log_dbg(cd, "Failed to decrypt VMK using provided passphrase.");
+		return r;
+	}
+
+	r = decrypt_key(cd, open_fvek_key, params->fvek->vk, open_vmk_key,
+			params->fvek->mac_tag, BITLK_VMK_MAC_TAG_SIZE,
+			params->fvek->nonce, BITLK_NONCE_SIZE, true);
+	if (r < 0)
+		log_dbg(cd, "Failed to decrypt FVEK using VMK.");
+
+	crypt_free_volume_key(open_vmk_key);
+	return r;
+}
+
+static int bitlk_get_volume_key(struct crypt_device *cd,
+				const char *password,
+				size_t passwordLen,
+				const struct bitlk_metadata *params,
+				struct bitlk_kdf_pool *pool,
+				struct volume_key **open_fvek_key)
+{
+	int r = 0;
 	struct volume_key *vmk_dec_key = NULL;
 	struct volume_key *recovery_key = NULL;
 	const struct bitlk_vmk *next_vmk = NULL;
@@ -1120,7 +1375,7 @@ int BITLK_get_volume_key(struct crypt_device *cd,
 	next_vmk = params->vmks;
 	while (next_vmk) {
 		if (next_vmk->protection == BITLK_PROTECTION_PASSPHRASE) {
-			r = bitlk_kdf(cd, password, passwordLen, false, next_vmk->salt, &vmk_dec_key);
+			r = bitlk_kdf_pool_get(pool, next_vmk, password, passwordLen, false, &vmk_dec_key);
 			if (r) {
 				/* something wrong happened, but we still want to check other key slots */
 				next_vmk = next_vmk->next;
@@ -1140,8 +1395,8 @@ int BITLK_get_volume_key(struct crypt_device *cd,
 				continue;
 			}
 			log_dbg(cd, "Trying to use given password as a recovery key.");
-			r = bitlk_kdf(cd, recovery_key->key, recovery_key->keylength,
-				      true, next_vmk->salt, &vmk_dec_key);
+			r = bitlk_kdf_pool_get(pool, next_vmk, recovery_key->key, recovery_key->keylength,
+					       true, &vmk_dec_key);
 			crypt_free_volume_key(recovery_key);
 			if (r)
 				return r;
@@ -1162,32 +1417,12 @@ int BITLK_get_volume_key(struct crypt_device *cd,
 			continue;
 		}
 
-		log_dbg(cd, "Trying to decrypt %s.", get_vmk_protection_string(next_vmk->protection));
-		r = decrypt_key(cd, &open_vmk_key, next_vmk->vk, vmk_dec_key,
-				next_vmk->mac_tag, BITLK_VMK_MAC_TAG_SIZE,
-				next_vmk->nonce, BITLK_NONCE_SIZE, false);
-		if (r < 0) {
-			log_dbg(cd, "Failed to decrypt VMK using provided passphrase.");
-			crypt_free_volume_key(vmk_dec_key);
-			if (r == -ENOTSUP)
-				return r;
-			next_vmk = next_vmk->next;
-			continue;
-		}
+		r = bitlk_open_fvek(cd, params, next_vmk, vmk_dec_key, open_fvek_key);
 		crypt_free_volume_key(vmk_dec_key);
-
-		r = decrypt_key(cd, open_fvek_key, params->fvek->vk, open_vmk_key,
-				params->fvek->mac_tag, BITLK_VMK_MAC_TAG_SIZE,
-				params->fvek->nonce, BITLK_NONCE_SIZE, true);
-		if (r < 0) {
-			log_dbg(cd, "Failed to decrypt FVEK using VMK.");
-			crypt_free_volume_key(open_vmk_key);
-			if (r == -ENOTSUP)
-				return r;
-		} else {
-			crypt_free_volume_key(open_vmk_key);
+		if (!r)
 			break;
-		}
+		if (r == -ENOTSUP)
+			return r;
 
 		next_vmk = next_vmk->next;
 	}
@@ -1200,6 +1435,107 @@ int BITLK_get_volume_key(struct crypt_device *cd,
 	return 0;
 }
 
+/*
+ * Try all recovery passwords against all recovery passphrase protected VMKs,
+ * stretching runs for all combinations in the pool. Returns index of the
+ * first (in the given order) recovery password that decrypts the FVEK.
+ */
+int BITLK_find_recovery_key(struct crypt_device *cd,
+			    const struct bitlk_metadata *params,
+			    const char *const *recovery_keys,
+			    size_t count)
+{
+	struct bitlk_kdf_pool pool = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+		.cd = cd,
+	};
+	struct volume_key *vmk_dec_key = NULL, *fvek = NULL, *key;
+	const struct bitlk_vmk *vmk;
+	size_t i, vmks = 0;
+	int r;
+
+	for (vmk = params->vmks; vmk; vmk = vmk->next)
+		if (vmk->protection == BITLK_PROTECTION_RECOVERY_PASSPHRASE)
+			vmks++;
+	if (!vmks) {
+		log_dbg(cd, "No VMK protected with recovery passphrase.");
+		return -ENOENT;
+	}
+
+	if (count > INT_MAX || count > UINT_MAX / vmks)
+		return -EINVAL;
+
+	pool.recovery_keys = calloc(count, sizeof(*pool.recovery_keys));
+	pool.jobs = calloc(count * vmks, sizeof(*pool.jobs));
+	if (!pool.recovery_keys || !pool.jobs) {
+		r = -ENOMEM;
+		goto out;
+	}
+	pool.recovery_count = count;
+
+	for (i = 0; i < count; i++) {
+		if (!recovery_keys[i] ||
+		    get_recovery_key(cd, recovery_keys[i], strlen(recovery_keys[i]), &pool.recovery_keys[i]))
+			pool.recovery_keys[i] = NULL;
+		if (!(key = pool.recovery_keys[i])) {
+			log_dbg(cd, "Recovery key %zu has invalid format, skipped.", i);
+			continue;
+		}
+		for (vmk = params->vmks; vmk; vmk = vmk->next)
+			if (vmk->protection == BITLK_PROTECTION_RECOVERY_PASSPHRASE)
+				bitlk_kdf_pool_add(&pool, vmk, key->key, key->keylength, true);
+	}
+
+	bitlk_kdf_pool_run(&pool);
+
+	r = -EPERM;
+	for (i = 0; i < count; i++) {
+		if (!(key = pool.recovery_keys[i]))
+			continue;
+		for (vmk = params->vmks; vmk; vmk = vmk->next) {
+			if (vmk->protection != BITLK_PROTECTION_RECOVERY_PASSPHRASE)
+				continue;
+			if (bitlk_kdf_pool_get(&pool, vmk, key->key, key->keylength, true, &vmk_dec_key))
+				continue;
+			r = bitlk_open_fvek(cd, params, vmk, vmk_dec_key, &fvek);
+			crypt_free_volume_key(vmk_dec_key);
+			crypt_free_volume_key(fvek);
+			fvek = NULL;
+			if (!r) {
+				log_dbg(cd, "Recovery key %zu matches.", i);
+				r = (int)i;
+				goto out;
+			}
+			if (r == -ENOTSUP)
+				goto out;
+			r = -EPERM;
+		}
+	}
+out:
+	bitlk_kdf_pool_stop(&pool);
+	return r;
+}
+
+int BITLK_get_volume_key(struct crypt_device *cd,
+			 const char *password,
+			 size_t passwordLen,
+			 const struct bitlk_metadata *params,
+			 struct volume_key **open_fvek_key)
+{
+	struct bitlk_kdf_pool pool = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+	};
+	int r;
+
+	bitlk_kdf_pool_start(cd, &pool, password, passwordLen, params);
+	r = bitlk_get_volume_key(cd, password, passwordLen, params, &pool, open_fvek_key);
+	bitlk_kdf_pool_stop(&pool);
+
+	return r;
+}
+
 static int _activate_check(struct crypt_device *cd,
 		           const struct bitlk_metadata *params)
 {
@@ -1227,76 +1563,54 @@ static int _activate_check(struct crypt_device *cd,
 	return 0;
 }
 
-static int _activate(struct crypt_device *cd,
-		     const char *name,
-		     struct volume_key *open_fvek_key,
-		     const struct bitlk_metadata *params,
-		     uint32_t flags)
+/*
+ * Map of the decrypted volume to the underlying device in 512-byte sectors,
+ * sorted by offset. Crypt segments read from device sector iv_offset.
+ */
+static int _calc_segments(struct crypt_device *cd,
+			  const struct bitlk_metadata *params,
+			  uint64_t size,
+			  struct segment *segments,
+			  int *num_segments)
 {
-	int r = 0;
-	int i = 0;
-	int j = 0;
-	int min = 0;
-	int num_segments = 0;
-	struct crypt_dm_active_device dmd = {
-		.flags = flags,
-	};
-	struct dm_target *next_segment = NULL;
-	struct segment segments[MAX_BITLK_SEGMENTS] = {};
+	int i, j, min, n = 0;
 	struct segment temp;
-	uint64_t next_start = 0;
-	uint64_t next_end = 0;
-	uint64_t last_segment = 0;
-	uint32_t dmt_flags = 0;
-
-	r = _activate_check(cd, params);
-	if (r)
-		return r;
-
-	r = device_block_adjust(cd, crypt_data_device(cd), DEV_EXCL,
-				0, &dmd.size, &dmd.flags);
-	if (r)
-		return r;
-
-	if (dmd.size * SECTOR_SIZE != params->volume_size)
-		log_std(cd, _("WARNING: BitLocker volume size %" PRIu64 " does not match the underlying device size %" PRIu64 ""),
-			params->volume_size,
-			dmd.size * SECTOR_SIZE);
+	uint64_t next_start, next_end, last_segment;
 
 	/* there will be always 4 dm-zero segments: 3x metadata, 1x FS header */
 	for (i = 0; i < 3; i++) {
-		segments[num_segments].offset = params->metadata_offset[i] / SECTOR_SIZE;
-		segments[num_segments].length = BITLK_FVE_METADATA_SIZE / SECTOR_SIZE;
-		segments[num_segments].iv_offset = 0;
-		segments[num_segments].type = BITLK_SEGTYPE_ZERO;
-		num_segments++;
+		segments[n].offset = params->metadata_offset[i] / SECTOR_SIZE;
+		segments[n].length = BITLK_FVE_METADATA_SIZE / SECTOR_SIZE;
+		segments[n].iv_offset = 0;
+		segments[n].type = BITLK_SEGTYPE_ZERO;
+		n++;
 	}
-	segments[num_segments].offset = params->volume_header_offset / SECTOR_SIZE;
-	segments[num_segments].length = params->volume_header_size / SECTOR_SIZE;
-	segments[num_segments].iv_offset = 0;
-	segments[num_segments].type = BITLK_SEGTYPE_ZERO;
-	num_segments++;
+	segments[n].offset = params->volume_header_offset / SECTOR_SIZE;
+	segments[n].length = params->volume_header_size / SECTOR_SIZE;
+	segments[n].iv_offset = 0;
+	segments[n].type = BITLK_SEGTYPE_ZERO;
+	n++;
 
 	/* filesystem header (moved from the special location) */
-	segments[num_segments].offset = 0;
-	segments[num_segments].length = params->volume_header_size / SECTOR_SIZE;
-	segments[num_segments].iv_offset = params->volume_header_offset / SECTOR_SIZE;
-	segments[num_segments].type = BITLK_SEGTYPE_CRYPT;
-	num_segments++;
+	segments[n].offset = 0;
+	segments[n].length = params->volume_header_size / SECTOR_SIZE;
+	segments[n].iv_offset = params->volume_header_offset / SECTOR_SIZE;
+	segments[n].type = BITLK_SEGTYPE_CRYPT;
+	n++;
 
 	/* now fill gaps between the dm-zero segments with dm-crypt */
 	last_segment = params->volume_header_size / SECTOR_SIZE;
 	while (true) {
-		next_start = dmd.size;
-		next_end = dmd.size;
+		next_start = size;
+		next_end = size;
 
 		/* start of the next segment: end of the first existing segment after the last added */
-		for (i = 0; i < num_segments; i++)
+		for (i = 0; i < n; i++)
 			if (segments[i].offset + segments[i].length < next_start && segments[i].offset + segments[i].length >= last_segment)
 				next_start = segments[i].offset + segments[i].length;
 
 		/* end of the next segment: start of the next segment after start we found above */
-		for (i = 0; i < num_segments; i++)
+		for (i = 0; i < n; i++)
 			if (segments[i].offset < next_end && segments[i].offset >= next_start)
 				next_end = segments[i].offset;
 
@@ -1307,27 +1621,26 @@ static int _activate(struct crypt_device *cd,
 			continue;
 		}
 
-		segments[num_segments].offset = next_start;
-		segments[num_segments].length = next_end - next_start;
-		segments[num_segments].iv_offset = next_start;
-		segments[num_segments].type = BITLK_SEGTYPE_CRYPT;
+		segments[n].offset = next_start;
+		segments[n].length = next_end - next_start;
+		segments[n].iv_offset = next_start;
+		segments[n].type = BITLK_SEGTYPE_CRYPT;
 		last_segment = next_end;
-		num_segments++;
+		n++;
 
-		if (next_end == dmd.size)
+		if (next_end == size)
 			break;
 
-		if (num_segments == 10) {
+		if (n == 10) {
 			log_dbg(cd, "Failed to calculate number of dm-crypt segments for open.");
-			r = -EINVAL;
-			goto out;
+			return -EINVAL;
 		}
 	}
 
 	/* device mapper needs the segment sorted */
-	for (i = 0; i < num_segments - 1; i++) {
+	for (i = 0; i < n - 1; i++) {
 		min = i;
-		for (j = i + 1; j < num_segments; j++)
+		for (j = i + 1; j < n; j++)
 			if (segments[j].offset < segments[min].offset)
 				min = j;
 
@@ -1349,6 +1662,44 @@ static int _activate(struct crypt_device *cd,
 		}
 	}
 
+	*num_segments = n;
+	return 0;
+}
+
+static int _activate(struct crypt_device *cd,
+		     const char *name,
+		     struct volume_key *open_fvek_key,
+		     const struct bitlk_metadata *params,
+		     uint32_t flags)
+{
+	int r = 0;
+	int i = 0;
+	int num_segments = 0;
+	struct crypt_dm_active_device dmd = {
+		.flags = flags,
+	};
+	struct dm_target *next_segment = NULL;
+	struct segment segments[MAX_BITLK_SEGMENTS] = {};
+	uint32_t dmt_flags = 0;
+
+	r = _activate_check(cd, params);
+	if (r)
+		return r;
+
+	r = device_block_adjust(cd, crypt_data_device(cd), DEV_EXCL,
+				0, &dmd.size, &dmd.flags);
+	if (r)
+		return r;
+
+	if (dmd.size * SECTOR_SIZE != params->volume_size)
+		log_std(cd, _("WARNING: BitLocker volume size %" PRIu64 " does not match the underlying device size %" PRIu64 ""),
+			params->volume_size,
+			dmd.size * SECTOR_SIZE);
+
+	r = _calc_segments(cd, params, dmd.size, segments, &num_segments);
+	if (r)
+		goto out;
+
 	if (params->sector_size != SECTOR_SIZE)
 		dmd.flags |= CRYPT_ACTIVATE_IV_LARGE_SECTORS;
 
@@ -1458,3 +1809,91 @@ int BITLK_activate_by_volume_key(struct crypt_device *cd,
 	crypt_free_volume_key(open_fvek_key);
 	return r;
 }
+
+/*
+ * Decrypt range of the volume in userspace, following the same segment map
+ * as activation (relocated filesystem header, zeroed metadata areas).
+ */
+int BITLK_read_decrypt(struct crypt_device *cd,
+		       const struct bitlk_metadata *params,
+		       const char *volume_key,
+		       size_t volume_key_size,
+		       uint64_t offset,
+		       char *buffer,
+		       size_t length)
+{
+	int i, r, num_segments = 0;
+	struct segment segments[MAX_BITLK_SEGMENTS] = {};
+	struct crypt_storage_wrapper *cw = NULL;
+	struct volume_key *open_fvek_key = NULL;
+	struct device *device = crypt_data_device(cd);
+	uint64_t size, seg_start, seg_end, chunk;
+	uint32_t wrapper_flags = DISABLE_DMCRYPT | OPEN_READONLY;
+
+	r = _activate_check(cd, params);
+	if (r)
+		return r;
+
+	if (!strcmp(params->cipher_mode, "cbc-elephant")) {
+		log_err(cd, _("Userspace decryption of BITLK device with Elephant diffuser is not supported."));
+		return -ENOTSUP;
+	}
+
+	if (MISALIGNED(offset, params->sector_size) || MISALIGNED(length, params->sector_size))
+		return -EINVAL;
+
+	r = device_size(device, &size);
+	if (r)
+		return r;
+	size /= SECTOR_SIZE;
+
+	if (offset + length < offset || offset + length > size * SECTOR_SIZE)
+		return -EINVAL;
+
+	r = _calc_segments(cd, params, size, segments, &num_segments);
+	if (r)
+		return r;
+
+	open_fvek_key = crypt_alloc_volume_key(volume_key_size, volume_key);
+	if (!open_fvek_key)
+		return -ENOMEM;
+
+	if (params->sector_size != SECTOR_SIZE)
+		wrapper_flags |= LARGE_IV;
+
+	/* crypt segments use the device sector as IV, no data or IV shift needed */
+	r = crypt_storage_wrapper_init(cd, &cw, device, 0, 0, params->sector_size,
+				       crypt_get_cipher_spec(cd), open_fvek_key, wrapper_flags);
+	if (r) {
+		log_err(cd, _("Cannot initialize userspace decryption for %s."), crypt_get_cipher_spec(cd));
+		goto out;
+	}
+
+	for (i = 0; i < num_segments && length; i++) {
+		seg_start = segments[i].offset * SECTOR_SIZE;
+		seg_end = seg_start + segments[i].length * SECTOR_SIZE;
+		if (offset >= seg_end)
+			continue;
+
+		chunk = seg_end - offset;
+		if (chunk > length)
+			chunk = length;
+
+		if (segments[i].type == BITLK_SEGTYPE_ZERO)
+			memset(buffer, 0, chunk);
+		else if (crypt_storage_wrapper_read_decrypt(cw,
+				segments[i].iv_offset * SECTOR_SIZE + (offset - seg_start),
+				buffer, chunk) != (ssize_t)chunk) {
+			r = -EIO;
+			goto out;
+		}
+
+		buffer += chunk;
+		offset += chunk;
+		length -= chunk;
+	}
+out:
+	crypt_storage_wrapper_destroy(cw);
+	crypt_free_volume_key(open_fvek_key);
+	return r;
+}
@@ -127,6 +127,11 @@ int BITLK_get_volume_key(struct crypt_device *cd,
 			 const struct bitlk_metadata *params,
 			 struct volume_key **open_fvek_key);
 
+int BITLK_find_recovery_key(struct crypt_device *cd,
+			    const struct bitlk_metadata *params,
+			    const char *const *recovery_keys,
+			    size_t count);
+
 int BITLK_activate_by_passphrase(struct crypt_device *cd,
 				 const char *name,
 				 const char *password,
@@ -141,6 +146,14 @@ int BITLK_activate_by_volume_key(struct crypt_device *cd,
 				 const struct bitlk_metadata *params,
 				 uint32_t flags);
 
+int BITLK_read_decrypt(struct crypt_device *cd,
+		       const struct bitlk_metadata *params,
+		       const char *volume_key,
+		       size_t volume_key_size,
+		       uint64_t offset,
+		       char *buffer,
+		       size_t length);
+
 void BITLK_bitlk_fvek_free(struct bitlk_fvek *fvek);
 void BITLK_bitlk_vmk_free(struct bitlk_vmk *vmk);
 void BITLK_bitlk_metadata_free(struct bitlk_metadata *params);
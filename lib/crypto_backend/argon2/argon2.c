@@ -92,6 +92,8 @@ int argon2_ctx(argon2_context *context, argon2_type type) {
     result = fill_memory_blocks(&instance);
 
     if (ARGON2_OK != result) {
+        free_memory(context, (uint8_t *)instance.memory,
+                    instance.memory_blocks, sizeof(block));
         return result;
     }
     /* 5. Finalization */
@@ -443,6 +445,8 @@ const char *argon2_error_message(int error_code) {
         return "Some of encoded parameters are too long or too short";
     case ARGON2_VERIFY_MISMATCH:
         return "The password does not match the supplied hash";
+    case ARGON2_ABORTED:
+        return "Hashing was aborted";
     default:
         return "Unknown error code";
     }
@@ -154,13 +154,18 @@ typedef enum Argon2_ErrorCodes {
 
     ARGON2_DECODING_LENGTH_FAIL = -34,
 
-    ARGON2_VERIFY_MISMATCH = -35
+    ARGON2_VERIFY_MISMATCH = -35,
+
+    ARGON2_ABORTED = -36
 } argon2_error_codes;
 
 /* Memory allocator types --- for external allocation */
 typedef int (*allocate_fptr)(uint8_t **memory, size_t bytes_to_allocate);
 typedef void (*deallocate_fptr)(uint8_t *memory, size_t bytes_to_allocate);
 
+/* Abort check between slices, non-zero stops hashing with ARGON2_ABORTED */
+typedef int (*abort_fptr)(void *abort_arg);
+
 /* Argon2 external data structures */
 
 /*
@@ -215,6 +220,9 @@ typedef struct Argon2_Context {
     deallocate_fptr free_cbk;   /* pointer to memory deallocator */
 
     uint32_t flags; /* array of bool options */
+
+    abort_fptr abort_cbk; /* optional, called from the calling thread only */
+    void *abort_arg;      /* argument of abort_cbk */
 } argon2_context;
 
 /* Argon2 primitive type */
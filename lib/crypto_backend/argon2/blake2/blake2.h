@@ -74,6 +74,10 @@ ARGON2_LOCAL int blake2b_init_param(blake2b_state *S, const blake2b_param *P);
 ARGON2_LOCAL int blake2b_update(blake2b_state *S, const void *in, size_t inlen);
 ARGON2_LOCAL int blake2b_final(blake2b_state *S, void *out, size_t outlen);
 
+/* SIMD compression variants, selected at runtime */
+ARGON2_LOCAL void blake2b_compress_sse41(blake2b_state *S, const uint8_t *block);
+ARGON2_LOCAL void blake2b_compress_avx2(blake2b_state *S, const uint8_t *block);
+
 /* Simple API */
 ARGON2_LOCAL int blake2b(void *out, size_t outlen, const void *in, size_t inlen,
                          const void *key, size_t keylen);
@@ -0,0 +1,116 @@
+/*
+ * Argon2 reference source code package - reference C implementations
+ *
+ * Copyright 2015
+ * Daniel Dinu, Dmitry Khovratovich, Jean-Philippe Aumasson, and Samuel Neves
+ *
+ * You may use this work under the terms of a Creative Commons CC0 1.0
+ * License/Waiver or the Apache Public License 2.0, at your option. The terms of
+ * these licenses can be found at:
+ *
+ * - CC0 1.0 Universal : https://creativecommons.org/publicdomain/zero/1.0
+ * - Apache 2.0        : https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * You should have received a copy of both of these licenses along with this
+ * software. If not, they may be obtained at the above URLs.
+ */
+
+/*
+ * BLAKE2b compression with AVX2, every state row is one 256-bit register.
+ * Selected at runtime by blake2b.c.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include <immintrin.h>
+
+#include "blake2.h"
+#include "blake2-impl.h"
+
+static const uint64_t blake2b_IV_avx2[8] = {
+    UINT64_C(0x6a09e667f3bcc908), UINT64_C(0xbb67ae8584caa73b),
+    UINT64_C(0x3c6ef372fe94f82b), UINT64_C(0xa54ff53a5f1d36f1),
+    UINT64_C(0x510e527fade682d1), UINT64_C(0x9b05688c2b3e6c1f),
+    UINT64_C(0x1f83d9abfb41bd6b), UINT64_C(0x5be0cd19137e2179)};
+
+static const unsigned int blake2b_sigma_avx2[12][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+};
+
+#define MSG(r, a, b, c, d) \
+    _mm256_set_epi64x((int64_t)m[blake2b_sigma_avx2[r][d]], \
+                      (int64_t)m[blake2b_sigma_avx2[r][c]], \
+                      (int64_t)m[blake2b_sigma_avx2[r][b]], \
+                      (int64_t)m[blake2b_sigma_avx2[r][a]])
+
+#define ROTR32(x) _mm256_shuffle_epi32((x), _MM_SHUFFLE(2, 3, 0, 1))
+#define ROTR24(x) _mm256_shuffle_epi8((x), r24)
+#define ROTR16(x) _mm256_shuffle_epi8((x), r16)
+#define ROTR63(x) _mm256_xor_si256(_mm256_srli_epi64((x), 63), _mm256_add_epi64((x), (x)))
+
+#define G_HALF(m0, ROTD, ROTB)                                                 \
+    do {                                                                       \
+        a = _mm256_add_epi64(_mm256_add_epi64(a, m0), b);                      \
+        d = ROTD(_mm256_xor_si256(d, a));                                      \
+        c = _mm256_add_epi64(c, d);                                            \
+        b = ROTB(_mm256_xor_si256(b, c));                                      \
+    } while ((void)0, 0)
+
+#define ROUND(r)                                                               \
+    do {                                                                       \
+        G_HALF(MSG(r, 0, 2, 4, 6), ROTR32, ROTR24);                            \
+        G_HALF(MSG(r, 1, 3, 5, 7), ROTR16, ROTR63);                            \
+        b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(0, 3, 2, 1));              \
+        c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));              \
+        d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(2, 1, 0, 3));              \
+        G_HALF(MSG(r, 8, 10, 12, 14), ROTR32, ROTR24);                         \
+        G_HALF(MSG(r, 9, 11, 13, 15), ROTR16, ROTR63);                         \
+        b = _mm256_permute4x64_epi64(b, _MM_SHUFFLE(2, 1, 0, 3));              \
+        c = _mm256_permute4x64_epi64(c, _MM_SHUFFLE(1, 0, 3, 2));              \
+        d = _mm256_permute4x64_epi64(d, _MM_SHUFFLE(0, 3, 2, 1));              \
+    } while ((void)0, 0)
+
+void blake2b_compress_avx2(blake2b_state *S, const uint8_t *block) {
+    const __m256i r16 = _mm256_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1,
+                                         10, 11, 12, 13, 14, 15, 8, 9,
+                                         2, 3, 4, 5, 6, 7, 0, 1,
+                                         10, 11, 12, 13, 14, 15, 8, 9);
+    const __m256i r24 = _mm256_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2,
+                                         11, 12, 13, 14, 15, 8, 9, 10,
+                                         3, 4, 5, 6, 7, 0, 1, 2,
+                                         11, 12, 13, 14, 15, 8, 9, 10);
+    __m256i a, b, c, d, h0, h1;
+    uint64_t m[16];
+    unsigned int i, r;
+
+    for (i = 0; i < 16; ++i) {
+        m[i] = load64(block + i * sizeof(m[i]));
+    }
+
+    h0 = _mm256_loadu_si256((const __m256i *)&S->h[0]);
+    h1 = _mm256_loadu_si256((const __m256i *)&S->h[4]);
+    a = h0;
+    b = h1;
+    c = _mm256_loadu_si256((const __m256i *)&blake2b_IV_avx2[0]);
+    d = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&blake2b_IV_avx2[4]),
+                         _mm256_set_epi64x((int64_t)S->f[1], (int64_t)S->f[0],
+                                           (int64_t)S->t[1], (int64_t)S->t[0]));
+
+    for (r = 0; r < 12; ++r) {
+        ROUND(r);
+    }
+
+    _mm256_storeu_si256((__m256i *)&S->h[0], _mm256_xor_si256(h0, _mm256_xor_si256(a, c)));
+    _mm256_storeu_si256((__m256i *)&S->h[4], _mm256_xor_si256(h1, _mm256_xor_si256(b, d)));
+}
@@ -0,0 +1,153 @@
+/*
+ * Argon2 reference source code package - reference C implementations
+ *
+ * Copyright 2015
+ * Daniel Dinu, Dmitry Khovratovich, Jean-Philippe Aumasson, and Samuel Neves
+ *
+ * You may use this work under the terms of a Creative Commons CC0 1.0
+ * License/Waiver or the Apache Public License 2.0, at your option. The terms of
+ * these licenses can be found at:
+ *
+ * - CC0 1.0 Universal : https://creativecommons.org/publicdomain/zero/1.0
+ * - Apache 2.0        : https://www.apache.org/licenses/LICENSE-2.0
+ *
+ * You should have received a copy of both of these licenses along with this
+ * software. If not, they may be obtained at the above URLs.
+ */
+
+/*
+ * BLAKE2b compression with SSSE3/SSE4.1, state rows are kept in pairs
+ * of 128-bit registers. Selected at runtime by blake2b.c.
+ */
+#include <stdint.h>
+#include <string.h>
+
+#include <smmintrin.h>
+
+#include "blake2.h"
+#include "blake2-impl.h"
+
+static const uint64_t blake2b_IV_sse41[8] = {
+    UINT64_C(0x6a09e667f3bcc908), UINT64_C(0xbb67ae8584caa73b),
+    UINT64_C(0x3c6ef372fe94f82b), UINT64_C(0xa54ff53a5f1d36f1),
+    UINT64_C(0x510e527fade682d1), UINT64_C(0x9b05688c2b3e6c1f),
+    UINT64_C(0x1f83d9abfb41bd6b), UINT64_C(0x5be0cd19137e2179)};
+
+static const unsigned int blake2b_sigma_sse41[12][16] = {
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+    {11, 8, 12, 0, 5, 2, 15, 13, 10, 14, 3, 6, 7, 1, 9, 4},
+    {7, 9, 3, 1, 13, 12, 11, 14, 2, 6, 5, 10, 4, 0, 15, 8},
+    {9, 0, 5, 7, 2, 4, 10, 15, 14, 1, 11, 12, 6, 8, 3, 13},
+    {2, 12, 6, 10, 0, 11, 8, 3, 4, 13, 7, 5, 15, 14, 1, 9},
+    {12, 5, 1, 15, 14, 13, 4, 10, 0, 7, 6, 3, 9, 2, 8, 11},
+    {13, 11, 7, 14, 12, 1, 3, 9, 5, 0, 15, 4, 8, 6, 2, 10},
+    {6, 15, 14, 9, 11, 3, 0, 8, 12, 2, 13, 7, 1, 4, 10, 5},
+    {10, 2, 8, 4, 7, 6, 1, 5, 15, 11, 9, 14, 3, 12, 13, 0},
+    {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15},
+    {14, 10, 4, 8, 9, 15, 13, 6, 1, 12, 0, 2, 11, 7, 5, 3},
+};
+
+#define MSG(r, a, b) \
+    _mm_set_epi64x((int64_t)m[blake2b_sigma_sse41[r][b]], \
+                   (int64_t)m[blake2b_sigma_sse41[r][a]])
+
+#define ROTR32(x) _mm_shuffle_epi32((x), _MM_SHUFFLE(2, 3, 0, 1))
+#define ROTR24(x) _mm_shuffle_epi8((x), r24)
+#define ROTR16(x) _mm_shuffle_epi8((x), r16)
+#define ROTR63(x) _mm_xor_si128(_mm_srli_epi64((x), 63), _mm_add_epi64((x), (x)))
+
+#define G_HALF(b0l, b0h, ROTD, ROTB)                                           \
+    do {                                                                       \
+        row1l = _mm_add_epi64(_mm_add_epi64(row1l, b0l), row2l);               \
+        row1h = _mm_add_epi64(_mm_add_epi64(row1h, b0h), row2h);               \
+        row4l = ROTD(_mm_xor_si128(row4l, row1l));                             \
+        row4h = ROTD(_mm_xor_si128(row4h, row1h));                             \
+        row3l = _mm_add_epi64(row3l, row4l);                                   \
+        row3h = _mm_add_epi64(row3h, row4h);                                   \
+        row2l = ROTB(_mm_xor_si128(row2l, row3l));                             \
+        row2h = ROTB(_mm_xor_si128(row2h, row3h));                             \
+    } while ((void)0, 0)
+
+#define DIAGONALIZE()                                                          \
+    do {                                                                       \
+        t0 = _mm_alignr_epi8(row2h, row2l, 8);                                 \
+        t1 = _mm_alignr_epi8(row2l, row2h, 8);                                 \
+        row2l = t0;                                                            \
+        row2h = t1;                                                            \
+        t0 = row3l;                                                            \
+        row3l = row3h;                                                         \
+        row3h = t0;                                                            \
+        t0 = _mm_alignr_epi8(row4h, row4l, 8);                                 \
+        t1 = _mm_alignr_epi8(row4l, row4h, 8);                                 \
+        row4l = t1;                                                            \
+        row4h = t0;                                                            \
+    } while ((void)0, 0)
+
+#define UNDIAGONALIZE()                                                        \
+    do {                                                                       \
+        t0 = _mm_alignr_epi8(row2l, row2h, 8);                                 \
+        t1 = _mm_alignr_epi8(row2h, row2l, 8);                                 \
+        row2l = t0;                                                            \
+        row2h = t1;                                                            \
+        t0 = row3l;                                                            \
+        row3l = row3h;                                                         \
+        row3h = t0;                                                            \
+        t0 = _mm_alignr_epi8(row4l, row4h, 8);                                 \
+        t1 = _mm_alignr_epi8(row4h, row4l, 8);                                 \
+        row4l = t1;                                                            \
+        row4h = t0;                                                            \
+    } while ((void)0, 0)
+
+#define ROUND(r)                                                               \
+    do {                                                                       \
+        G_HALF(MSG(r, 0, 2), MSG(r, 4, 6), ROTR32, ROTR24);                    \
+        G_HALF(MSG(r, 1, 3), MSG(r, 5, 7), ROTR16, ROTR63);                    \
+        DIAGONALIZE();                                                         \
+        G_HALF(MSG(r, 8, 10), MSG(r, 12, 14), ROTR32, ROTR24);                 \
+        G_HALF(MSG(r, 9, 11), MSG(r, 13, 15), ROTR16, ROTR63);                 \
+        UNDIAGONALIZE();                                                       \
+    } while ((void)0, 0)
+
+void blake2b_compress_sse41(blake2b_state *S, const uint8_t *block) {
+    const __m128i r16 = _mm_setr_epi8(2, 3, 4, 5, 6, 7, 0, 1,
+                                      10, 11, 12, 13, 14, 15, 8, 9);
+    const __m128i r24 = _mm_setr_epi8(3, 4, 5, 6, 7, 0, 1, 2,
+                                      11, 12, 13, 14, 15, 8, 9, 10);
+    __m128i row1l, row1h, row2l, row2h, row3l, row3h, row4l, row4h;
+    __m128i t0, t1;
+    uint64_t m[16];
+    unsigned int i, r;
+
+    for (i = 0; i < 16; ++i) {
+        m[i] = load64(block + i * sizeof(m[i]));
+    }
+
+    row1l = _mm_loadu_si128((const __m128i *)&S->h[0]);
+    row1h = _mm_loadu_si128((const __m128i *)&S->h[2]);
+    row2l = _mm_loadu_si128((const __m128i *)&S->h[4]);
+    row2h = _mm_loadu_si128((const __m128i *)&S->h[6]);
+    row3l = _mm_loadu_si128((const __m128i *)&blake2b_IV_sse41[0]);
+    row3h = _mm_loadu_si128((const __m128i *)&blake2b_IV_sse41[2]);
+    row4l = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&blake2b_IV_sse41[4]),
+                          _mm_loadu_si128((const __m128i *)&S->t[0]));
+    row4h = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&blake2b_IV_sse41[6]),
+                          _mm_loadu_si128((const __m128i *)&S->f[0]));
+
+    for (r = 0; r < 12; ++r) {
+        ROUND(r);
+    }
+
+    row1l = _mm_xor_si128(row1l, row3l);
+    row1h = _mm_xor_si128(row1h, row3h);
+    row2l = _mm_xor_si128(row2l, row4l);
+    row2h = _mm_xor_si128(row2h, row4h);
+    _mm_storeu_si128((__m128i *)&S->h[0],
+        _mm_xor_si128(_mm_loadu_si128((const __m128i *)&S->h[0]), row1l));
+    _mm_storeu_si128((__m128i *)&S->h[2],
+        _mm_xor_si128(_mm_loadu_si128((const __m128i *)&S->h[2]), row1h));
+    _mm_storeu_si128((__m128i *)&S->h[4],
+        _mm_xor_si128(_mm_loadu_si128((const __m128i *)&S->h[4]), row2l));
+    _mm_storeu_si128((__m128i *)&S->h[6],
+        _mm_xor_si128(_mm_loadu_si128((const __m128i *)&S->h[6]), row2h));
+}
@@ -165,7 +165,7 @@ int blake2b_init_key(blake2b_state *S, size_t outlen, const void *key,
     return 0;
 }
 
-static void blake2b_compress(blake2b_state *S, const uint8_t *block) {
+static void blake2b_compress_ref(blake2b_state *S, const uint8_t *block) {
     uint64_t m[16];
     uint64_t v[16];
     unsigned int i, r;
@@ -223,6 +223,34 @@ static void blake2b_compress(blake2b_state *S, const uint8_t *block) {
 #undef ROUND
 }
 
+/*
+ * With runtime dispatch, SSE4.1 and AVX2 compression (blake2b-sse41.c,
+ * blake2b-avx2.c) is used if the CPU supports it.
+ */
+#if defined(USE_INTERNAL_AVX_ARGON2)
+#include <pthread.h>
+
+static void (*blake2b_compress_impl)(blake2b_state *S,
+                                     const uint8_t *block) = blake2b_compress_ref;
+static pthread_once_t blake2b_compress_once = PTHREAD_ONCE_INIT;
+
+static void blake2b_compress_select(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        blake2b_compress_impl = blake2b_compress_avx2;
+    } else if (__builtin_cpu_supports("sse4.1")) {
+        blake2b_compress_impl = blake2b_compress_sse41;
+    }
+}
+
+static void blake2b_compress(blake2b_state *S, const uint8_t *block) {
+    pthread_once(&blake2b_compress_once, blake2b_compress_select);
+    blake2b_compress_impl(S, block);
+}
+#else
+#define blake2b_compress blake2b_compress_ref
+#endif
+
 int blake2b_update(blake2b_state *S, const void *in, size_t inlen) {
     const uint8_t *pin = (const uint8_t *)in;
 
@@ -29,6 +29,10 @@
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
 #include "core.h"
 #include "thread.h"
 #include "blake2/blake2.h"
@@ -83,6 +87,54 @@ static void store_block(void *output, const block *src) {
 
 /***************Memory functions*****************/
 
+#if defined(__linux__) && defined(MAP_ANONYMOUS)
+/*
+ * Large block areas are mapped directly, preferably backed by huge pages
+ * and pre-faulted, so the first pass does not pay a page fault (and later
+ * a TLB miss) for every 4 KiB page. Length is rounded to the (x86, arm64
+ * default) 2 MiB huge page size, smaller areas use malloc.
+ */
+#define ARGON2_HUGE_PAGE_SIZE (2 * 1024 * 1024)
+#define ARGON2_USE_MMAP(size) ((size) >= ARGON2_HUGE_PAGE_SIZE)
+
+static size_t mmap_length(size_t size) {
+    return (size + ARGON2_HUGE_PAGE_SIZE - 1) & ~((size_t)ARGON2_HUGE_PAGE_SIZE - 1);
+}
+
+static uint8_t *mmap_memory(size_t size) {
+    size_t length = mmap_length(size);
+    void *p = MAP_FAILED;
+
+    if (length < size) {
+        return NULL;
+    }
+
+#if defined(MAP_HUGETLB) && defined(MAP_POPULATE)
+    /* Reserved hugetlbfs pages, usually not configured */
+    p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+#endif
+    if (p != MAP_FAILED) {
+        return p;
+    }
+
+    p = mmap(NULL, length, PROT_READ | PROT_WRITE,
+             MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        return NULL;
+    }
+
+    /* Transparent huge pages must be requested before the area is faulted in */
+#ifdef MADV_HUGEPAGE
+    (void)madvise(p, length, MADV_HUGEPAGE);
+#endif
+#ifdef MADV_POPULATE_WRITE
+    (void)madvise(p, length, MADV_POPULATE_WRITE);
+#endif
+    return p;
+}
+#endif
+
 int allocate_memory(const argon2_context *context, uint8_t **memory,
                     size_t num, size_t size) {
     size_t memory_size = num*size;
@@ -98,6 +150,10 @@ int allocate_memory(const argon2_context *context, uint8_t **memory,
     /* 2. Try to allocate with appropriate allocator */
     if (context->allocate_cbk) {
         (context->allocate_cbk)(memory, memory_size);
+#ifdef ARGON2_USE_MMAP
+    } else if (ARGON2_USE_MMAP(memory_size)) {
+        *memory = mmap_memory(memory_size);
+#endif
     } else {
         *memory = malloc(memory_size);
     }
@@ -115,6 +171,10 @@ void free_memory(const argon2_context *context, uint8_t *memory,
     clear_internal_memory(memory, memory_size);
     if (context->free_cbk) {
         (context->free_cbk)(memory, memory_size);
+#ifdef ARGON2_USE_MMAP
+    } else if (ARGON2_USE_MMAP(memory_size)) {
+        munmap(memory, mmap_length(memory_size));
+#endif
     } else {
         free(memory);
     }
@@ -251,6 +311,13 @@ uint32_t index_alpha(const argon2_instance_t *instance,
     return absolute_position;
 }
 
+static int fill_memory_aborted(const argon2_instance_t *instance) {
+    const argon2_context *context = instance->context_ptr;
+
+    return context && context->abort_cbk &&
+           context->abort_cbk(context->abort_arg);
+}
+
 /* Single-threaded version for p=1 case */
 static int fill_memory_blocks_st(argon2_instance_t *instance) {
     uint32_t r, s, l;
@@ -261,6 +328,9 @@ static int fill_memory_blocks_st(argon2_instance_t *instance) {
                 argon2_position_t position = {r, l, (uint8_t)s, 0};
                 fill_segment(instance, position);
             }
+            if (fill_memory_aborted(instance)) {
+                return ARGON2_ABORTED;
+            }
         }
 #ifdef GENKAT
         internal_kat(instance, r); /* Print all memory blocks */
@@ -271,97 +341,123 @@ static int fill_memory_blocks_st(argon2_instance_t *instance) {
 
 #if !defined(ARGON2_NO_THREADS)
 
+/*
+ * Worker pool for one derivation: workers are created once and process
+ * lanes l % workers == index of every slice, synchronizing on a barrier
+ * between slices instead of creating and joining threads for each of them.
+ * Worker 0 (the caller) checks for abort before each barrier, the others
+ * read the decision after it. Flags alternate by slice parity, so worker 0
+ * never writes the one a slower worker may still be reading.
+ */
+typedef struct Argon2_pool {
+    argon2_instance_t *instance;
+    argon2_barrier_t barrier;
+    uint32_t workers;
+    int aborted[2];
+} argon2_pool;
+
+typedef struct Argon2_worker {
+    argon2_pool *pool;
+    uint32_t index;
+} argon2_worker;
+
+static void fill_memory_blocks_worker(argon2_worker *worker) {
+    argon2_pool *pool = worker->pool;
+    argon2_instance_t *instance = pool->instance;
+    uint32_t r, s, l;
+
+    /* Wait until the number of running workers is known */
+    argon2_barrier_wait(&pool->barrier);
+
+    for (r = 0; r < instance->passes; ++r) {
+        for (s = 0; s < ARGON2_SYNC_POINTS; ++s) {
+            for (l = worker->index; l < instance->lanes; l += pool->workers) {
+                argon2_position_t position = {r, l, (uint8_t)s, 0};
+                fill_segment(instance, position);
+            }
+            if (worker->index == 0) {
+                pool->aborted[s & 1] = fill_memory_aborted(instance);
+            }
+            argon2_barrier_wait(&pool->barrier);
+            if (pool->aborted[s & 1]) {
+                return;
+            }
+        }
+#ifdef GENKAT
+        if (worker->index == 0) {
+            internal_kat(instance, r); /* Print all memory blocks */
+        }
+        argon2_barrier_wait(&pool->barrier);
+#endif
+    }
+}
+
 #ifdef _WIN32
-static unsigned __stdcall fill_segment_thr(void *thread_data)
+static unsigned __stdcall fill_memory_blocks_thr(void *thread_data)
 #else
-static void *fill_segment_thr(void *thread_data)
+static void *fill_memory_blocks_thr(void *thread_data)
 #endif
 {
-    argon2_thread_data *my_data = thread_data;
-    fill_segment(my_data->instance_ptr, my_data->pos);
+    fill_memory_blocks_worker(thread_data);
     return 0;
 }
 
 /* Multi-threaded version for p > 1 case */
 static int fill_memory_blocks_mt(argon2_instance_t *instance) {
-    uint32_t r, s;
     argon2_thread_handle_t *thread = NULL;
-    argon2_thread_data *thr_data = NULL;
+    argon2_worker *worker = NULL;
+    argon2_pool pool;
+    uint32_t l, created;
     int rc = ARGON2_OK;
 
-    /* 1. Allocating space for threads */
-    thread = calloc(instance->lanes, sizeof(argon2_thread_handle_t));
-    if (thread == NULL) {
+    /* 1. Allocating space for threads, the caller is worker 0 */
+    thread = calloc(instance->threads, sizeof(argon2_thread_handle_t));
+    worker = calloc(instance->threads, sizeof(argon2_worker));
+    if (thread == NULL || worker == NULL) {
         rc = ARGON2_MEMORY_ALLOCATION_ERROR;
         goto fail;
     }
 
-    thr_data = calloc(instance->lanes, sizeof(argon2_thread_data));
-    if (thr_data == NULL) {
-        rc = ARGON2_MEMORY_ALLOCATION_ERROR;
+    pool.instance = instance;
+    pool.workers = instance->threads;
+    pool.aborted[0] = pool.aborted[1] = 0;
+    if (argon2_barrier_init(&pool.barrier, pool.workers)) {
+        rc = ARGON2_THREAD_FAIL;
         goto fail;
     }
 
-    for (r = 0; r < instance->passes; ++r) {
-        for (s = 0; s < ARGON2_SYNC_POINTS; ++s) {
-            uint32_t l, ll;
+    /* 2. Starting workers, run with fewer if thread creation fails */
+    for (created = 1; created < instance->threads; ++created) {
+        worker[created].pool = &pool;
+        worker[created].index = created;
+        if (argon2_thread_create(&thread[created], &fill_memory_blocks_thr,
+                                 (void *)&worker[created])) {
+            break;
+        }
+    }
+    if (created < pool.workers) {
+        pool.workers = created;
+        argon2_barrier_resize(&pool.barrier, created);
+    }
 
-            /* 2. Calling threads */
-            for (l = 0; l < instance->lanes; ++l) {
-                argon2_position_t position;
-
-                /* 2.1 Join a thread if limit is exceeded */
-                if (l >= instance->threads) {
-                    if (argon2_thread_join(thread[l - instance->threads])) {
-                        rc = ARGON2_THREAD_FAIL;
-                        goto fail;
-                    }
-                }
-
-                /* 2.2 Create thread */
-                position.pass = r;
-                position.lane = l;
-                position.slice = (uint8_t)s;
-                position.index = 0;
-                thr_data[l].instance_ptr =
-                    instance; /* preparing the thread input */
-                memcpy(&(thr_data[l].pos), &position,
-                       sizeof(argon2_position_t));
-                if (argon2_thread_create(&thread[l], &fill_segment_thr,
-                                         (void *)&thr_data[l])) {
-                    /* Wait for already running threads */
-                    for (ll = 0; ll < l; ++ll)
-                        argon2_thread_join(thread[ll]);
-                    rc = ARGON2_THREAD_FAIL;
-                    goto fail;
-                }
-
-                /* fill_segment(instance, position); */
-                /*Non-thread equivalent of the lines above */
-            }
+    worker[0].pool = &pool;
+    worker[0].index = 0;
+    fill_memory_blocks_worker(&worker[0]);
 
-            /* 3. Joining remaining threads */
-            for (l = instance->lanes - instance->threads; l < instance->lanes;
-                 ++l) {
-                if (argon2_thread_join(thread[l])) {
-                    rc = ARGON2_THREAD_FAIL;
-                    goto fail;
-                }
-            }
+    /* 3. Joining workers */
+    for (l = 1; l < created; ++l) {
+        if (argon2_thread_join(thread[l])) {
+            rc = ARGON2_THREAD_FAIL;
         }
-
-#ifdef GENKAT
-        internal_kat(instance, r); /* Print all memory blocks */
-#endif
+    }
+    if (rc == ARGON2_OK && (pool.aborted[0] || pool.aborted[1])) {
+        rc = ARGON2_ABORTED;
     }
 
+    argon2_barrier_destroy(&pool.barrier);
 fail:
-    if (thread != NULL) {
-        free(thread);
-    }
-    if (thr_data != NULL) {
-        free(thr_data);
-    }
+    free(thread);
+    free(worker);
     return rc;
 }
 
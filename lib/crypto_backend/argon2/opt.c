@@ -19,6 +19,16 @@
 #include <string.h>
 #include <stdlib.h>
 
+/*
+ * With runtime dispatch this file is built once more for AVX2 and AVX-512
+ * (opt_avx2.c, opt_avx512.c rename fill_segment) and the baseline SSE build
+ * provides fill_segment() selecting the best variant the CPU supports.
+ */
+#if defined(USE_INTERNAL_AVX_ARGON2) && !defined(fill_segment)
+#define ARGON2_OPT_DISPATCH
+#define fill_segment fill_segment_sse
+#endif
+
 #include "argon2.h"
 #include "core.h"
 
@@ -281,3 +291,32 @@ void fill_segment(const argon2_instance_t *instance,
         }
     }
 }
+
+#if defined(ARGON2_OPT_DISPATCH)
+#undef fill_segment
+#include <pthread.h>
+
+void fill_segment_avx2(const argon2_instance_t *instance,
+                       argon2_position_t position);
+void fill_segment_avx512(const argon2_instance_t *instance,
+                         argon2_position_t position);
+
+static void (*fill_segment_impl)(const argon2_instance_t *instance,
+                                 argon2_position_t position) = fill_segment_sse;
+static pthread_once_t fill_segment_once = PTHREAD_ONCE_INIT;
+
+static void fill_segment_select(void) {
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        fill_segment_impl = fill_segment_avx512;
+    } else if (__builtin_cpu_supports("avx2")) {
+        fill_segment_impl = fill_segment_avx2;
+    }
+}
+
+void fill_segment(const argon2_instance_t *instance,
+                  argon2_position_t position) {
+    pthread_once(&fill_segment_once, fill_segment_select);
+    fill_segment_impl(instance, position);
+}
+#endif
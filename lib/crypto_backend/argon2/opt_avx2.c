@@ -0,0 +1,8 @@
+/*
+ * Argon2 AVX2 block fill, selected at runtime by opt.c
+ *
+ * Compiled with -mavx2, the code must only run on CPUs supporting AVX2.
+ */
+
+#define fill_segment fill_segment_avx2
+#include "opt.c"
@@ -0,0 +1,8 @@
+/*
+ * Argon2 AVX-512 block fill, selected at runtime by opt.c
+ *
+ * Compiled with -mavx512f, the code must only run on CPUs supporting AVX-512.
+ */
+
+#define fill_segment fill_segment_avx512
+#include "opt.c"
@@ -46,4 +46,81 @@ int argon2_thread_join(argon2_thread_handle_t handle) {
 #endif
 }
 
+int argon2_barrier_init(argon2_barrier_t *barrier, unsigned count) {
+    if (NULL == barrier || count == 0) {
+        return -1;
+    }
+    barrier->count = count;
+    barrier->waiting = 0;
+    barrier->generation = 0;
+#if defined(_WIN32)
+    InitializeCriticalSection(&barrier->lock);
+    InitializeConditionVariable(&barrier->cond);
+    return 0;
+#else
+    if (pthread_mutex_init(&barrier->lock, NULL)) {
+        return -1;
+    }
+    if (pthread_cond_init(&barrier->cond, NULL)) {
+        pthread_mutex_destroy(&barrier->lock);
+        return -1;
+    }
+    return 0;
+#endif
+}
+
+void argon2_barrier_resize(argon2_barrier_t *barrier, unsigned count) {
+#if defined(_WIN32)
+    EnterCriticalSection(&barrier->lock);
+    barrier->count = count;
+    LeaveCriticalSection(&barrier->lock);
+#else
+    pthread_mutex_lock(&barrier->lock);
+    barrier->count = count;
+    pthread_mutex_unlock(&barrier->lock);
+#endif
+}
+
+void argon2_barrier_wait(argon2_barrier_t *barrier) {
+    unsigned generation;
+
+#if defined(_WIN32)
+    EnterCriticalSection(&barrier->lock);
+#else
+    pthread_mutex_lock(&barrier->lock);
+#endif
+    generation = barrier->generation;
+    if (++barrier->waiting >= barrier->count) {
+        barrier->waiting = 0;
+        barrier->generation++;
+#if defined(_WIN32)
+        WakeAllConditionVariable(&barrier->cond);
+#else
+        pthread_cond_broadcast(&barrier->cond);
+#endif
+    } else {
+        while (generation == barrier->generation) {
+#if defined(_WIN32)
+            SleepConditionVariableCS(&barrier->cond, &barrier->lock, INFINITE);
+#else
+            pthread_cond_wait(&barrier->cond, &barrier->lock);
+#endif
+        }
+    }
+#if defined(_WIN32)
+    LeaveCriticalSection(&barrier->lock);
+#else
+    pthread_mutex_unlock(&barrier->lock);
+#endif
+}
+
+void argon2_barrier_destroy(argon2_barrier_t *barrier) {
+#if defined(_WIN32)
+    DeleteCriticalSection(&barrier->lock);
+#else
+    pthread_cond_destroy(&barrier->cond);
+    pthread_mutex_destroy(&barrier->lock);
+#endif
+}
+
 #endif /* ARGON2_NO_THREADS */
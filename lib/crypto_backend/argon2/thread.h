@@ -31,6 +31,7 @@
         and the type of the thread handle---argon2_thread_handle_t.
 */
 #if defined(_WIN32)
+#include <windows.h>
 #include <process.h>
 typedef unsigned(__stdcall *argon2_thread_func_t)(void *);
 typedef uintptr_t argon2_thread_handle_t;
@@ -40,6 +41,24 @@ typedef void *(*argon2_thread_func_t)(void *);
 typedef pthread_t argon2_thread_handle_t;
 #endif
 
+/*
+        Reusable barrier for worker threads synchronizing between slices.
+        The participant count may be lowered before anybody waits on it
+        (worker creation failed), so a fixed pthread_barrier_t is not used.
+*/
+typedef struct Argon2_barrier {
+#if defined(_WIN32)
+    CRITICAL_SECTION lock;
+    CONDITION_VARIABLE cond;
+#else
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+#endif
+    unsigned count;
+    unsigned waiting;
+    unsigned generation;
+} argon2_barrier_t;
+
 /* Creates a thread
  * @param handle pointer to a thread handle, which is the output of this
  * function. Must not be NULL.
@@ -58,5 +77,19 @@ int argon2_thread_create(argon2_thread_handle_t *handle,
 */
 int argon2_thread_join(argon2_thread_handle_t handle);
 
+/* Initializes a barrier for @count participants
+ * @return 0 on success
+ */
+int argon2_barrier_init(argon2_barrier_t *barrier, unsigned count);
+
+/* Lowers the participant count, only before the first wait completes
+ * with the new count (i.e. before the last participant arrives). */
+void argon2_barrier_resize(argon2_barrier_t *barrier, unsigned count);
+
+/* Blocks until all participants arrive, the barrier is then reused */
+void argon2_barrier_wait(argon2_barrier_t *barrier);
+
+void argon2_barrier_destroy(argon2_barrier_t *barrier);
+
 #endif /* ARGON2_NO_THREADS */
 #endif
@@ -29,6 +29,14 @@
 
 #define CONST_CAST(x) (x)(uintptr_t)
 
+#if USE_INTERNAL_ARGON2
+static int argon2_abort(void *arg __attribute__((unused)))
+{
+	/* worker 0 of bundled Argon2 is the calling thread */
+	return crypt_pbkdf_cancelled() < 0;
+}
+#endif
+
 int argon2(const char *type, const char *password, size_t password_length,
 	   const char *salt, size_t salt_length,
 	   char *key, size_t key_length,
@@ -51,6 +59,9 @@ int argon2(const char *type, const char *password, size_t password_length,
 		.pwdlen = (uint32_t)password_length,
 		.salt = CONST_CAST(uint8_t *)salt,
 		.saltlen = (uint32_t)salt_length,
+#if USE_INTERNAL_ARGON2
+		.abort_cbk = argon2_abort,
+#endif
 	};
 	int r;
 
@@ -70,6 +81,11 @@ int argon2(const char *type, const char *password, size_t password_length,
 	case ARGON2_ALLOCATE_MEMORY_CBK_NULL:
 		r = -ENOMEM;
 		break;
+#if USE_INTERNAL_ARGON2
+	case ARGON2_ABORTED:
+		r = -ECANCELED;
+		break;
+#endif
 	default:
 		r = -EINVAL;
 	}
@@ -0,0 +1,395 @@
+/*
+ * Native (CPU accelerated) AES-XTS and AES-CBC for storage sectors
+ *
+ * Copyright (C) 2023 Red Hat, Inc. All rights reserved.
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this file; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <strings.h>
+#include "crypto_backend_internal.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define AES_NATIVE_X86 1
+#include <emmintrin.h>
+#include <wmmintrin.h>
+#endif
+
+#define AES_BLOCK_SIZE 16
+#define AES_MAX_ROUNDS 14
+
+/*
+ * Only the key schedule is computed in plain C (once per context),
+ * all data processing uses CPU AES instructions.
+ */
+static const uint8_t aes_sbox[256] = {
+	0x63, 0x7c, 0x77, 0x7b, 0xf2, 0x6b, 0x6f, 0xc5, 0x30, 0x01, 0x67, 0x2b, 0xfe, 0xd7, 0xab, 0x76,
+	0xca, 0x82, 0xc9, 0x7d, 0xfa, 0x59, 0x47, 0xf0, 0xad, 0xd4, 0xa2, 0xaf, 0x9c, 0xa4, 0x72, 0xc0,
+	0xb7, 0xfd, 0x93, 0x26, 0x36, 0x3f, 0xf7, 0xcc, 0x34, 0xa5, 0xe5, 0xf1, 0x71, 0xd8, 0x31, 0x15,
+	0x04, 0xc7, 0x23, 0xc3, 0x18, 0x96, 0x05, 0x9a, 0x07, 0x12, 0x80, 0xe2, 0xeb, 0x27, 0xb2, 0x75,
+	0x09, 0x83, 0x2c, 0x1a, 0x1b, 0x6e, 0x5a, 0xa0, 0x52, 0x3b, 0xd6, 0xb3, 0x29, 0xe3, 0x2f, 0x84,
+	0x53, 0xd1, 0x00, 0xed, 0x20, 0xfc, 0xb1, 0x5b, 0x6a, 0xcb, 0xbe, 0x39, 0x4a, 0x4c, 0x58, 0xcf,
+	0xd0, 0xef, 0xaa, 0xfb, 0x43, 0x4d, 0x33, 0x85, 0x45, 0xf9, 0x02, 0x7f, 0x50, 0x3c, 0x9f, 0xa8,
+	0x51, 0xa3, 0x40, 0x8f, 0x92, 0x9d, 0x38, 0xf5, 0xbc, 0xb6, 0xda, 0x21, 0x10, 0xff, 0xf3, 0xd2,
+	0xcd, 0x0c, 0x13, 0xec, 0x5f, 0x97, 0x44, 0x17, 0xc4, 0xa7, 0x7e, 0x3d, 0x64, 0x5d, 0x19, 0x73,
+	0x60, 0x81, 0x4f, 0xdc, 0x22, 0x2a, 0x90, 0x88, 0x46, 0xee, 0xb8, 0x14, 0xde, 0x5e, 0x0b, 0xdb,
+	0xe0, 0x32, 0x3a, 0x0a, 0x49, 0x06, 0x24, 0x5c, 0xc2, 0xd3, 0xac, 0x62, 0x91, 0x95, 0xe4, 0x79,
+	0xe7, 0xc8, 0x37, 0x6d, 0x8d, 0xd5, 0x4e, 0xa9, 0x6c, 0x56, 0xf4, 0xea, 0x65, 0x7a, 0xae, 0x08,
+	0xba, 0x78, 0x25, 0x2e, 0x1c, 0xa6, 0xb4, 0xc6, 0xe8, 0xdd, 0x74, 0x1f, 0x4b, 0xbd, 0x8b, 0x8a,
+	0x70, 0x3e, 0xb5, 0x66, 0x48, 0x03, 0xf6, 0x0e, 0x61, 0x35, 0x57, 0xb9, 0x86, 0xc1, 0x1d, 0x9e,
+	0xe1, 0xf8, 0x98, 0x11, 0x69, 0xd9, 0x8e, 0x94, 0x9b, 0x1e, 0x87, 0xe9, 0xce, 0x55, 0x28, 0xdf,
+	0x8c, 0xa1, 0x89, 0x0d, 0xbf, 0xe6, 0x42, 0x68, 0x41, 0x99, 0x2d, 0x0f, 0xb0, 0x54, 0xbb, 0x16
+};
+
+struct aes_key {
+	uint8_t enc[(AES_MAX_ROUNDS + 1) * AES_BLOCK_SIZE];
+	uint8_t dec[(AES_MAX_ROUNDS + 1) * AES_BLOCK_SIZE];
+	int rounds;
+};
+
+struct crypt_aes_native {
+	enum { AES_NATIVE_CBC, AES_NATIVE_XTS } mode;
+	struct aes_key key1;	/* data key */
+	struct aes_key key2;	/* XTS tweak key */
+};
+
+/* FIPS-197 key expansion, byte oriented (round keys stored as in memory) */
+static int aes_expand_key(struct aes_key *k, const uint8_t *key, size_t key_length)
+{
+	uint8_t *w = k->enc, t[4], rcon = 1, tmp;
+	size_t nk = key_length / 4, i, total;
+
+	if (key_length != 16 && key_length != 24 && key_length != 32)
+		return -EINVAL;
+
+	k->rounds = (int)nk + 6;
+	total = 4 * ((size_t)k->rounds + 1);
+	memcpy(w, key, key_length);
+
+	for (i = nk; i < total; i++) {
+		memcpy(t, &w[(i - 1) * 4], 4);
+		if (i % nk == 0) {
+			tmp = t[0];
+			t[0] = aes_sbox[t[1]] ^ rcon;
+			t[1] = aes_sbox[t[2]];
+			t[2] = aes_sbox[t[3]];
+			t[3] = aes_sbox[tmp];
+			rcon = (uint8_t)((rcon << 1) ^ ((rcon & 0x80) ? 0x1b : 0));
+		} else if (nk > 6 && i % nk == 4) {
+			t[0] = aes_sbox[t[0]];
+			t[1] = aes_sbox[t[1]];
+			t[2] = aes_sbox[t[2]];
+			t[3] = aes_sbox[t[3]];
+		}
+		w[i * 4 + 0] = w[(i - nk) * 4 + 0] ^ t[0];
+		w[i * 4 + 1] = w[(i - nk) * 4 + 1] ^ t[1];
+		w[i * 4 + 2] = w[(i - nk) * 4 + 2] ^ t[2];
+		w[i * 4 + 3] = w[(i - nk) * 4 + 3] ^ t[3];
+	}
+
+	crypt_backend_memzero(t, sizeof(t));
+	return 0;
+}
+
+#ifdef AES_NATIVE_X86
+#define AESNI __attribute__((target("aes,sse2")))
+
+static bool aes_native_supported(void)
+{
+	return __builtin_cpu_supports("aes") && __builtin_cpu_supports("sse2");
+}
+
+/* Equivalent inverse cipher round keys */
+AESNI static void aes_prepare_dec_key(struct aes_key *k)
+{
+	__m128i *ek = (__m128i *)k->enc, *dk = (__m128i *)k->dec;
+	int i;
+
+	_mm_storeu_si128(&dk[0], _mm_loadu_si128(&ek[k->rounds]));
+	for (i = 1; i < k->rounds; i++)
+		_mm_storeu_si128(&dk[i], _mm_aesimc_si128(_mm_loadu_si128(&ek[k->rounds - i])));
+	_mm_storeu_si128(&dk[k->rounds], _mm_loadu_si128(&ek[0]));
+}
+
+AESNI static inline __m128i aes_enc1(const struct aes_key *k, __m128i b)
+{
+	const __m128i *rk = (const __m128i *)k->enc;
+	int i;
+
+	b = _mm_xor_si128(b, _mm_loadu_si128(&rk[0]));
+	for (i = 1; i < k->rounds; i++)
+		b = _mm_aesenc_si128(b, _mm_loadu_si128(&rk[i]));
+	return _mm_aesenclast_si128(b, _mm_loadu_si128(&rk[k->rounds]));
+}
+
+AESNI static inline __m128i aes_dec1(const struct aes_key *k, __m128i b)
+{
+	const __m128i *rk = (const __m128i *)k->dec;
+	int i;
+
+	b = _mm_xor_si128(b, _mm_loadu_si128(&rk[0]));
+	for (i = 1; i < k->rounds; i++)
+		b = _mm_aesdec_si128(b, _mm_loadu_si128(&rk[i]));
+	return _mm_aesdeclast_si128(b, _mm_loadu_si128(&rk[k->rounds]));
+}
+
+/* Four independent blocks interleaved to hide AES instruction latency */
+AESNI static inline void aes_crypt4(const struct aes_key *k, bool enc, __m128i *b)
+{
+	const __m128i *rk = (const __m128i *)(enc ? k->enc : k->dec);
+	__m128i r = _mm_loadu_si128(&rk[0]);
+	int i;
+
+	b[0] = _mm_xor_si128(b[0], r);
+	b[1] = _mm_xor_si128(b[1], r);
+	b[2] = _mm_xor_si128(b[2], r);
+	b[3] = _mm_xor_si128(b[3], r);
+
+	for (i = 1; i < k->rounds; i++) {
+		r = _mm_loadu_si128(&rk[i]);
+		if (enc) {
+			b[0] = _mm_aesenc_si128(b[0], r);
+			b[1] = _mm_aesenc_si128(b[1], r);
+			b[2] = _mm_aesenc_si128(b[2], r);
+			b[3] = _mm_aesenc_si128(b[3], r);
+		} else {
+			b[0] = _mm_aesdec_si128(b[0], r);
+			b[1] = _mm_aesdec_si128(b[1], r);
+			b[2] = _mm_aesdec_si128(b[2], r);
+			b[3] = _mm_aesdec_si128(b[3], r);
+		}
+	}
+
+	r = _mm_loadu_si128(&rk[k->rounds]);
+	if (enc) {
+		b[0] = _mm_aesenclast_si128(b[0], r);
+		b[1] = _mm_aesenclast_si128(b[1], r);
+		b[2] = _mm_aesenclast_si128(b[2], r);
+		b[3] = _mm_aesenclast_si128(b[3], r);
+	} else {
+		b[0] = _mm_aesdeclast_si128(b[0], r);
+		b[1] = _mm_aesdeclast_si128(b[1], r);
+		b[2] = _mm_aesdeclast_si128(b[2], r);
+		b[3] = _mm_aesdeclast_si128(b[3], r);
+	}
+}
+
+/* Multiply XTS tweak by x in GF(2^128), little-endian convention (IEEE P1619) */
+AESNI static inline __m128i xts_mul_x(__m128i t)
+{
+	const __m128i poly = _mm_set_epi32(0, 1, 0, 0x87);
+	__m128i carry;
+
+	/* sign of the top dword of each 64-bit half, swapped into the other half */
+	carry = _mm_shuffle_epi32(_mm_srai_epi32(t, 31), 0x13);
+	t = _mm_add_epi64(t, t);
+	return _mm_xor_si128(t, _mm_and_si128(carry, poly));
+}
+
+AESNI static void xts_crypt_sector(const struct crypt_aes_native *ctx, bool enc,
+				   const uint8_t *in, uint8_t *out, size_t length,
+				   const uint8_t *iv)
+{
+	__m128i t[4], b[4];
+	size_t i, j;
+
+	t[0] = aes_enc1(&ctx->key2, _mm_loadu_si128((const __m128i *)iv));
+
+	for (i = 0; i + 4 * AES_BLOCK_SIZE <= length; i += 4 * AES_BLOCK_SIZE) {
+		t[1] = xts_mul_x(t[0]);
+		t[2] = xts_mul_x(t[1]);
+		t[3] = xts_mul_x(t[2]);
+
+		for (j = 0; j < 4; j++)
+			b[j] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&in[i + j * AES_BLOCK_SIZE]), t[j]);
+
+		aes_crypt4(&ctx->key1, enc, b);
+
+		for (j = 0; j < 4; j++)
+			_mm_storeu_si128((__m128i *)&out[i + j * AES_BLOCK_SIZE], _mm_xor_si128(b[j], t[j]));
+
+		t[0] = xts_mul_x(t[3]);
+	}
+
+	for (; i < length; i += AES_BLOCK_SIZE) {
+		b[0] = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&in[i]), t[0]);
+		b[0] = enc ? aes_enc1(&ctx->key1, b[0]) : aes_dec1(&ctx->key1, b[0]);
+		_mm_storeu_si128((__m128i *)&out[i], _mm_xor_si128(b[0], t[0]));
+		t[0] = xts_mul_x(t[0]);
+	}
+}
+
+AESNI static void cbc_encrypt_sector(const struct crypt_aes_native *ctx,
+				     const uint8_t *in, uint8_t *out, size_t length,
+				     const uint8_t *iv)
+{
+	__m128i c = _mm_loadu_si128((const __m128i *)iv);
+	size_t i;
+
+	/* CBC encryption is inherently serial */
+	for (i = 0; i < length; i += AES_BLOCK_SIZE) {
+		c = aes_enc1(&ctx->key1, _mm_xor_si128(c, _mm_loadu_si128((const __m128i *)&in[i])));
+		_mm_storeu_si128((__m128i *)&out[i], c);
+	}
+}
+
+AESNI static void cbc_decrypt_sector(const struct crypt_aes_native *ctx,
+				     const uint8_t *in, uint8_t *out, size_t length,
+				     const uint8_t *iv)
+{
+	__m128i prev = _mm_loadu_si128((const __m128i *)iv), c[4], b[4];
+	size_t i, j;
+
+	for (i = 0; i + 4 * AES_BLOCK_SIZE <= length; i += 4 * AES_BLOCK_SIZE) {
+		for (j = 0; j < 4; j++)
+			b[j] = c[j] = _mm_loadu_si128((const __m128i *)&in[i + j * AES_BLOCK_SIZE]);
+
+		aes_crypt4(&ctx->key1, false, b);
+
+		_mm_storeu_si128((__m128i *)&out[i], _mm_xor_si128(b[0], prev));
+		for (j = 1; j < 4; j++)
+			_mm_storeu_si128((__m128i *)&out[i + j * AES_BLOCK_SIZE], _mm_xor_si128(b[j], c[j - 1]));
+		prev = c[3];
+	}
+
+	for (; i < length; i += AES_BLOCK_SIZE) {
+		c[0] = _mm_loadu_si128((const __m128i *)&in[i]);
+		_mm_storeu_si128((__m128i *)&out[i], _mm_xor_si128(aes_dec1(&ctx->key1, c[0]), prev));
+		prev = c[0];
+	}
+}
+
+static void aes_native_crypt_sector(const struct crypt_aes_native *ctx, bool enc,
+				    const uint8_t *in, uint8_t *out, size_t length,
+				    const uint8_t *iv)
+{
+	if (ctx->mode == AES_NATIVE_XTS)
+		xts_crypt_sector(ctx, enc, in, out, length, iv);
+	else if (enc)
+		cbc_encrypt_sector(ctx, in, out, length, iv);
+	else
+		cbc_decrypt_sector(ctx, in, out, length, iv);
+}
+#else
+/*
+ * No native implementation for this architecture (yet),
+ * crypt_storage then uses the crypto backend.
+ */
+static bool aes_native_supported(void)
+{
+	return false;
+}
+
+static void aes_prepare_dec_key(struct aes_key *k __attribute__((unused)))
+{
+}
+
+static void aes_native_crypt_sector(const struct crypt_aes_native *ctx __attribute__((unused)),
+				    bool enc __attribute__((unused)),
+				    const uint8_t *in __attribute__((unused)),
+				    uint8_t *out __attribute__((unused)),
+				    size_t length __attribute__((unused)),
+				    const uint8_t *iv __attribute__((unused)))
+{
+}
+#endif
+
+int crypt_aes_native_init(struct crypt_aes_native **ctx, const char *name,
+			  const char *mode, const void *key, size_t key_length)
+{
+	struct crypt_aes_native *h;
+	int xts, r;
+
+	if (strcasecmp(name, "aes") || crypt_fips_mode() || !aes_native_supported())
+		return -ENOTSUP;
+
+	if (!strcasecmp(mode, "xts"))
+		xts = 1;
+	else if (!strcasecmp(mode, "cbc"))
+		xts = 0;
+	else
+		return -ENOTSUP;
+
+	h = malloc(sizeof(*h));
+	if (!h)
+		return -ENOMEM;
+
+	if (xts) {
+		h->mode = AES_NATIVE_XTS;
+		r = aes_expand_key(&h->key1, key, key_length / 2);
+		if (!r)
+			r = aes_expand_key(&h->key2, (const uint8_t *)key + key_length / 2, key_length / 2);
+	} else {
+		h->mode = AES_NATIVE_CBC;
+		r = aes_expand_key(&h->key1, key, key_length);
+	}
+
+	if (r || (xts && (key_length & 1))) {
+		crypt_aes_native_destroy(h);
+		return -ENOTSUP;
+	}
+
+	aes_prepare_dec_key(&h->key1);
+
+	*ctx = h;
+	return 0;
+}
+
+void crypt_aes_native_destroy(struct crypt_aes_native *ctx)
+{
+	if (!ctx)
+		return;
+
+	crypt_backend_memzero(ctx, sizeof(*ctx));
+	free(ctx);
+}
+
+static int aes_native_crypt_sectors(struct crypt_aes_native *ctx, bool enc,
+				    const char *in, char *out,
+				    size_t sector_size, size_t sectors,
+				    const char *iv, size_t iv_length)
+{
+	size_t i;
+
+	if (!iv || iv_length != AES_BLOCK_SIZE || !sector_size ||
+	    (sector_size & (AES_BLOCK_SIZE - 1)))
+		return -EINVAL;
+
+	for (i = 0; i < sectors; i++)
+		aes_native_crypt_sector(ctx, enc,
+					(const uint8_t *)&in[i * sector_size],
+					(uint8_t *)&out[i * sector_size], sector_size,
+					(const uint8_t *)&iv[i * iv_length]);
+
+	return 0;
+}
+
+int crypt_aes_native_encrypt_sectors(struct crypt_aes_native *ctx,
+				     const char *in, char *out,
+				     size_t sector_size, size_t sectors,
+				     const char *iv, size_t iv_length)
+{
+	return aes_native_crypt_sectors(ctx, true, in, out, sector_size, sectors, iv, iv_length);
+}
+
+int crypt_aes_native_decrypt_sectors(struct crypt_aes_native *ctx,
+				     const char *in, char *out,
+				     size_t sector_size, size_t sectors,
+				     const char *iv, size_t iv_length)
+{
+	return aes_native_crypt_sectors(ctx, false, in, out, sector_size, sectors, iv, iv_length);
+}
@@ -20,7 +20,9 @@
  */
 
 #include <errno.h>
+#include <stdlib.h>
 #include <time.h>
+#include <pthread.h>
 #include "crypto_backend_internal.h"
 
 #ifndef CLOCK_MONOTONIC_RAW
@@ -159,3 +161,192 @@ int crypt_cipher_perf_kernel(const char *name, const char *mode, char *buffer, s
 
 	return  0;
 }
+
+struct cipher_perf_start {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	bool go;
+};
+
+struct cipher_perf_thread {
+	pthread_t thread;
+	struct cipher_perf_start *start;
+	const char *name, *mode, *key, *iv;
+	size_t key_size, iv_size, buffer_size;
+	int cpu;
+	double encryption_mbs, decryption_mbs;
+	int r;
+};
+
+static void *cipher_perf_thread(void *arg)
+{
+	struct cipher_perf_thread *t = arg;
+	cpu_set_t cpus;
+	void *buffer = NULL;
+
+	if (t->cpu >= 0) {
+		CPU_ZERO(&cpus);
+		CPU_SET(t->cpu, &cpus);
+		(void)pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+	}
+
+	if (posix_memalign(&buffer, 4096, t->buffer_size))
+		buffer = NULL;
+	else
+		memset(buffer, 0, t->buffer_size);
+
+	/* all threads measure at the same time */
+	pthread_mutex_lock(&t->start->lock);
+	while (!t->start->go)
+		pthread_cond_wait(&t->start->cond, &t->start->lock);
+	pthread_mutex_unlock(&t->start->lock);
+
+	if (buffer)
+		t->r = crypt_cipher_perf_kernel(t->name, t->mode, buffer, t->buffer_size,
+						t->key, t->key_size, t->iv, t->iv_size,
+						&t->encryption_mbs, &t->decryption_mbs);
+	else
+		t->r = -ENOMEM;
+
+	free(buffer);
+	return NULL;
+}
+
+/*
+ * The same measurement running in @threads threads at once, each one pinned
+ * to one CPU of the process affinity mask (wrapping around if there are less
+ * CPUs) and with its own buffer. Per-thread speeds are returned in arrays.
+ */
+int crypt_cipher_perf_kernel_threads(const char *name, const char *mode, size_t buffer_size,
+				     const char *key, size_t key_size, const char *iv, size_t iv_size,
+				     unsigned threads, double *encryption_mbs, double *decryption_mbs)
+{
+	struct cipher_perf_start start = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+	};
+	struct cipher_perf_thread *t;
+	cpu_set_t cpus;
+	int cpu_count = 0, cpu = -1;
+	unsigned i, started;
+	int r = 0;
+
+	if (!threads || !buffer_size || !encryption_mbs || !decryption_mbs)
+		return -EINVAL;
+
+	t = calloc(threads, sizeof(*t));
+	if (!t)
+		return -ENOMEM;
+
+	if (!sched_getaffinity(0, sizeof(cpus), &cpus))
+		cpu_count = CPU_COUNT(&cpus);
+
+	for (i = 0; i < threads; i++) {
+		/* next CPU from the mask, wrap around */
+		if (cpu_count) {
+			do
+				cpu = (cpu + 1) % CPU_SETSIZE;
+			while (!CPU_ISSET(cpu, &cpus));
+		}
+		t[i] = (struct cipher_perf_thread) {
+			.start = &start, .name = name, .mode = mode,
+			.key = key, .key_size = key_size, .iv = iv, .iv_size = iv_size,
+			.buffer_size = buffer_size, .cpu = cpu,
+		};
+	}
+
+	for (started = 0; started < threads; started++)
+		if (pthread_create(&t[started].thread, NULL, cipher_perf_thread, &t[started]))
+			break;
+
+	pthread_mutex_lock(&start.lock);
+	start.go = true;
+	pthread_cond_broadcast(&start.cond);
+	pthread_mutex_unlock(&start.lock);
+
+	for (i = 0; i < started; i++)
+		pthread_join(t[i].thread, NULL);
+
+	if (started < threads)
+		r = -ENOMEM;
+
+	for (i = 0; i < started && !r; i++) {
+		r = t[i].r;
+		encryption_mbs[i] = t[i].encryption_mbs;
+		decryption_mbs[i] = t[i].decryption_mbs;
+	}
+
+	free(t);
+	return r;
+}
+
+static int storage_measure(struct crypt_storage *s, char *buffer, size_t buffer_size,
+			   int encrypt, double *ms)
+{
+	struct timespec start, end;
+	int r;
+
+	if (clock_gettime(CLOCK_MONOTONIC_RAW, &start) < 0)
+		return -EINVAL;
+
+	if (encrypt)
+		r = crypt_storage_encrypt(s, 0, buffer_size, buffer);
+	else
+		r = crypt_storage_decrypt(s, 0, buffer_size, buffer);
+	if (r < 0)
+		return r;
+
+	if (clock_gettime(CLOCK_MONOTONIC_RAW, &end) < 0)
+		return -EINVAL;
+
+	r = time_ms(&start, &end, ms);
+	if (r < 0)
+		return r;
+
+	if (*ms < CIPHER_TIME_MIN_MS)
+		return -ERANGE;
+
+	return 0;
+}
+
+/*
+ * Per-sector encryption through storage wrapper, including IV generator,
+ * as done in userspace reencryption (@mode with IV, e.g. "cbc-essiv:sha256").
+ */
+int crypt_storage_perf(const char *name, const char *mode, size_t sector_size,
+		       char *buffer, size_t buffer_size, const char *key, size_t key_size,
+		       double *encryption_mbs, double *decryption_mbs)
+{
+	struct crypt_storage *s;
+	double ms_enc = 0.0, ms_dec = 0.0, ms;
+	int r, repeat_enc = 0, repeat_dec = 0;
+
+	if (!buffer_size || buffer_size % sector_size)
+		return -EINVAL;
+
+	r = crypt_storage_init(&s, sector_size, name, mode, key, key_size, false);
+	if (r < 0)
+		return r;
+
+	while (ms_enc < 1000.0) {
+		r = storage_measure(s, buffer, buffer_size, 1, &ms);
+		if (r < 0)
+			goto out;
+		ms_enc += ms;
+		repeat_enc++;
+	}
+
+	while (ms_dec < 1000.0) {
+		r = storage_measure(s, buffer, buffer_size, 0, &ms);
+		if (r < 0)
+			goto out;
+		ms_dec += ms;
+		repeat_dec++;
+	}
+
+	*encryption_mbs = speed_mbs(buffer_size * repeat_enc, ms_enc);
+	*decryption_mbs = speed_mbs(buffer_size * repeat_dec, ms_dec);
+out:
+	crypt_storage_destroy(s);
+	return r;
+}
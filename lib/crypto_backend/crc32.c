@@ -39,6 +39,7 @@
  */
 
 #include <stdio.h>
+#include <string.h>
 
 #include "crypto_backend.h"
 
@@ -172,12 +173,141 @@ static uint32_t compute_crc32(
 	return crc;
 }
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+
+#define CRC32_X86 1
+#define CRC32_PCLMUL_MIN 64
+
+/*
+ * CRC32 folding with carry-less multiply, four 128-bit lanes at once,
+ * "Fast CRC Computation Using PCLMULQDQ Instruction" (Intel).
+ * Requires at least 64 bytes, length must be a multiple of 16.
+ */
+__attribute__((target("pclmul,sse4.1")))
+static uint32_t crc32_pclmul(uint32_t crc, const unsigned char *buf, size_t len)
+{
+	const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+	const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+	const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+	const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+	const __m128i mask32 = _mm_setr_epi32(~0, 0, ~0, 0);
+	__m128i x0, x1, x2, x3, x4, x5, x6, x7, x8;
+
+	x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+	x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+	x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+	x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+	x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+	buf += 64;
+	len -= 64;
+
+	for (; len >= 64; buf += 64, len -= 64) {
+		x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+		x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+		x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+		x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+		x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+		x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+		x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)(buf + 0x00)));
+		x2 = _mm_xor_si128(_mm_xor_si128(x2, x6), _mm_loadu_si128((const __m128i *)(buf + 0x10)));
+		x3 = _mm_xor_si128(_mm_xor_si128(x3, x7), _mm_loadu_si128((const __m128i *)(buf + 0x20)));
+		x4 = _mm_xor_si128(_mm_xor_si128(x4, x8), _mm_loadu_si128((const __m128i *)(buf + 0x30)));
+	}
+
+	/* fold lanes into 128 bits, then the remaining 16 byte blocks */
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x2), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x3), x5);
+	x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+	x1 = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x1, k3k4, 0x11), x4), x5);
+
+	for (; len >= 16; buf += 16, len -= 16) {
+		x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+		x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+		x1 = _mm_xor_si128(_mm_xor_si128(x1, x5), _mm_loadu_si128((const __m128i *)buf));
+	}
+
+	/* 128 to 64 bits */
+	x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+	x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+	x2 = _mm_srli_si128(x1, 4);
+	x1 = _mm_and_si128(x1, mask32);
+	x1 = _mm_xor_si128(_mm_clmulepi64_si128(x1, k5k0, 0x00), x2);
+
+	/* Barrett reduction to 32 bits */
+	x0 = _mm_and_si128(x1, mask32);
+	x0 = _mm_clmulepi64_si128(x0, poly, 0x10);
+	x0 = _mm_and_si128(x0, mask32);
+	x0 = _mm_clmulepi64_si128(x0, poly, 0x00);
+	x1 = _mm_xor_si128(x1, x0);
+
+	return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+/* CRC32C instruction, 8 bytes per step */
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char *buf, size_t len)
+{
+	uint64_t crc64 = crc, v;
+
+	for (; len >= 8; buf += 8, len -= 8) {
+		memcpy(&v, buf, sizeof(v));
+		crc64 = _mm_crc32_u64(crc64, v);
+	}
+	crc = (uint32_t)crc64;
+	while (len--)
+		crc = _mm_crc32_u8(crc, *buf++);
+
+	return crc;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+
+#define CRC32_ARM 1
+
+static uint32_t crc32_arm(uint32_t crc, const unsigned char *buf, size_t len, bool castagnoli)
+{
+	uint64_t v;
+
+	for (; len >= 8; buf += 8, len -= 8) {
+		memcpy(&v, buf, sizeof(v));
+		crc = castagnoli ? __crc32cd(crc, v) : __crc32d(crc, v);
+	}
+	while (len--)
+		crc = castagnoli ? __crc32cb(crc, *buf++) : __crc32b(crc, *buf++);
+
+	return crc;
+}
+#endif
+
 uint32_t crypt_crc32(uint32_t seed, const unsigned char *buf, size_t len)
 {
+#if defined(CRC32_X86)
+	size_t fold = len & ~(size_t)15;
+
+	if (fold >= CRC32_PCLMUL_MIN && __builtin_cpu_supports("pclmul") &&
+	    __builtin_cpu_supports("sse4.1")) {
+		seed = crc32_pclmul(seed, buf, fold);
+		buf += fold;
+		len -= fold;
+	}
+#elif defined(CRC32_ARM)
+	return crc32_arm(seed, buf, len, false);
+#endif
 	return compute_crc32(crc32_tab, seed, buf, len);
 }
 
 uint32_t crypt_crc32c(uint32_t seed, const unsigned char *buf, size_t len)
 {
+#if defined(CRC32_X86)
+	if (__builtin_cpu_supports("sse4.2"))
+		return crc32c_sse42(seed, buf, len);
+#elif defined(CRC32_ARM)
+	return crc32_arm(seed, buf, len, true);
+#endif
 	return compute_crc32(crc32c_tab, seed, buf, len);
 }
@@ -26,6 +26,7 @@
 #include <stdbool.h>
 #include <stddef.h>
 #include <string.h>
+#include <sched.h>
 #ifdef HAVE_UCHAR_H
 #include <uchar.h>
 #else
@@ -37,6 +38,7 @@ struct crypt_hash;
 struct crypt_hmac;
 struct crypt_cipher;
 struct crypt_storage;
+struct crypt_storage_parallel;
 
 int crypt_backend_init(bool fips);
 void crypt_backend_destroy(void);
@@ -51,15 +53,52 @@ const char *crypt_backend_version(void);
 int crypt_hash_size(const char *name);
 int crypt_hash_init(struct crypt_hash **ctx, const char *name);
 int crypt_hash_write(struct crypt_hash *ctx, const char *buffer, size_t length);
+/* Copy hash state (e.g. with absorbed prefix) to another context of the same hash */
+int crypt_hash_copy(struct crypt_hash *dst, struct crypt_hash *src);
 int crypt_hash_final(struct crypt_hash *ctx, char *buffer, size_t length);
+/* Discard written data, context can be used for a new message (final resets it too) */
+int crypt_hash_reset(struct crypt_hash *ctx);
+/* Allocate a new context with the same algorithm and current state */
+int crypt_hash_clone(struct crypt_hash **dst, struct crypt_hash *src);
 void crypt_hash_destroy(struct crypt_hash *ctx);
 
+/* Hash every block of buffer separately, digests are stored consecutively */
+int crypt_hash_blocks(const char *name, unsigned threads,
+		      const void *buffer, size_t length, size_t block_size,
+		      void *digests, size_t digest_size);
+
+/* Hash count blocks, each one with the same salt prepended (or appended) */
+int crypt_hash_salted_blocks(const char *name,
+			     const void *salt, size_t salt_size, bool salt_first,
+			     const void *blocks, size_t block_size, size_t count,
+			     void *digests, size_t digest_size);
+
+/*
+ * Hash count blocks in reused context, each one prefixed by its big-endian
+ * 32-bit index counted from first. Digest is truncated to block_size.
+ */
+int crypt_hash_indexed_blocks(struct crypt_hash *ctx, const char *name, uint32_t first,
+			      const void *blocks, size_t block_size, size_t count,
+			      void *digests);
+
+/*
+ * Hash count blocks in reused context, each one prefixed by salt and
+ * little-endian 64-bit sector number (sector + i * sector_step).
+ */
+int crypt_hash_sector_blocks(struct crypt_hash *ctx, const char *name,
+			     const void *salt, size_t salt_size,
+			     uint64_t sector, uint64_t sector_step,
+			     const void *blocks, size_t block_size, size_t count,
+			     void *digests, size_t digest_size);
+
 /* HMAC */
 int crypt_hmac_size(const char *name);
 int crypt_hmac_init(struct crypt_hmac **ctx, const char *name,
 		    const void *key, size_t key_length);
 int crypt_hmac_write(struct crypt_hmac *ctx, const char *buffer, size_t length);
 int crypt_hmac_final(struct crypt_hmac *ctx, char *buffer, size_t length);
+int crypt_hmac_reset(struct crypt_hmac *ctx);
+int crypt_hmac_clone(struct crypt_hmac **dst, struct crypt_hmac *src);
 void crypt_hmac_destroy(struct crypt_hmac *ctx);
 
 /* RNG (if fips parameter set, must provide FIPS compliance) */
@@ -80,6 +119,34 @@ int crypt_pbkdf(const char *kdf, const char *hash,
 		const char *salt, size_t salt_length,
 		char *key, size_t key_length,
 		uint32_t iterations, uint32_t memory, uint32_t parallel);
+
+/*
+ * KDF cancellation bound to the calling thread, check returns 0 to continue
+ * or negative errno. It is polled between Argon2 slices (bundled Argon2 only)
+ * and PBKDF2 iteration chunks (internal PBKDF2 only), other KDFs are checked
+ * only before they start.
+ */
+struct crypt_pbkdf_cancel {
+	int (*check)(void *usrptr);
+	void *usrptr;
+};
+void crypt_pbkdf_set_cancel(const struct crypt_pbkdf_cancel *cancel);
+const struct crypt_pbkdf_cancel *crypt_pbkdf_get_cancel(void);
+int crypt_pbkdf_cancelled(void);
+
+/* One PBKDF2 derivation of a batch, key has key_length of the batch */
+struct crypt_pbkdf2_job {
+	const char *password;
+	size_t password_length;
+	const char *salt;
+	size_t salt_length;
+	char *key;
+};
+
+/* PBKDF2 of independent jobs with the same hash, iterations and key length */
+int crypt_pbkdf2_batch(const char *hash, unsigned threads, uint32_t iterations,
+		       size_t key_length, struct crypt_pbkdf2_job *jobs, size_t count);
+
 int crypt_pbkdf_perf(const char *kdf, const char *hash,
 		const char *password, size_t password_size,
 		const char *salt, size_t salt_size,
@@ -114,10 +181,29 @@ int crypt_cipher_decrypt(struct crypt_cipher *ctx,
 			 const char *iv, size_t iv_length);
 bool crypt_cipher_kernel_only(struct crypt_cipher *ctx);
 
+/*
+ * Multi-sector variants: process sectors * sector_size bytes, each sector
+ * with its own IV taken from the iv array (sectors * iv_length bytes).
+ */
+int crypt_cipher_encrypt_sectors(struct crypt_cipher *ctx,
+				 const char *in, char *out,
+				 size_t sector_size, size_t sectors,
+				 const char *iv, size_t iv_length);
+int crypt_cipher_decrypt_sectors(struct crypt_cipher *ctx,
+				 const char *in, char *out,
+				 size_t sector_size, size_t sectors,
+				 const char *iv, size_t iv_length);
+
 /* Benchmark of kernel cipher performance */
 int crypt_cipher_perf_kernel(const char *name, const char *mode, char *buffer, size_t buffer_size,
 			     const char *key, size_t key_size, const char *iv, size_t iv_size,
 			     double *encryption_mbs, double *decryption_mbs);
+int crypt_cipher_perf_kernel_threads(const char *name, const char *mode, size_t buffer_size,
+				     const char *key, size_t key_size, const char *iv, size_t iv_size,
+				     unsigned threads, double *encryption_mbs, double *decryption_mbs);
+int crypt_storage_perf(const char *name, const char *mode, size_t sector_size,
+		       char *buffer, size_t buffer_size, const char *key, size_t key_size,
+		       double *encryption_mbs, double *decryption_mbs);
 
 /* Check availability of a cipher (in kernel only) */
 int crypt_cipher_check_kernel(const char *name, const char *mode,
@@ -135,12 +221,33 @@ int crypt_storage_encrypt(struct crypt_storage *ctx, uint64_t iv_offset,
 
 bool crypt_storage_kernel_only(struct crypt_storage *ctx);
 
+/* Storage encryption split across worker threads */
+int crypt_storage_parallel_init(struct crypt_storage_parallel **ctx, unsigned threads,
+				size_t sector_size, const char *cipher, const char *cipher_mode,
+				const void *key, size_t key_length, bool large_iv);
+void crypt_storage_parallel_destroy(struct crypt_storage_parallel *ctx);
+int crypt_storage_parallel_decrypt(struct crypt_storage_parallel *ctx, uint64_t iv_offset,
+				   uint64_t length, char *buffer);
+int crypt_storage_parallel_encrypt(struct crypt_storage_parallel *ctx, uint64_t iv_offset,
+				   uint64_t length, char *buffer);
+int crypt_storage_parallel_reencrypt(struct crypt_storage_parallel *dec, uint64_t dec_iv_offset,
+				     struct crypt_storage_parallel *enc, uint64_t enc_iv_offset,
+				     uint64_t length, char *buffer);
+
+bool crypt_storage_parallel_kernel_only(struct crypt_storage_parallel *ctx);
+unsigned crypt_storage_parallel_threads(struct crypt_storage_parallel *ctx);
+int crypt_storage_parallel_set_affinity(struct crypt_storage_parallel *ctx, const cpu_set_t *cpus);
+
 /* Temporary Bitlk helper */
 int crypt_bitlk_decrypt_key(const void *key, size_t key_length,
 			    const char *in, char *out, size_t length,
 			    const char *iv, size_t iv_length,
 			    const char *tag, size_t tag_length);
 
+/* Bitlk SHA-256 key stretching, -ENOTSUP if generic hash API should be used */
+int crypt_bitlk_stretch_key(const char *initial, const char *salt,
+			    uint32_t iterations, char *key);
+
 /* Memzero helper (memset on stack can be optimized out) */
 static inline void crypt_backend_memzero(void *s, size_t n)
 {
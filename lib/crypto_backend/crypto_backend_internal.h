@@ -37,11 +37,29 @@ int argon2(const char *type, const char *password, size_t password_length,
 	   char *key, size_t key_length,
 	   uint32_t iterations, uint32_t memory, uint32_t parallel);
 
+/* Backend PBKDF, called through crypt_pbkdf() */
+int crypt_backend_pbkdf(const char *kdf, const char *hash,
+			const char *password, size_t password_length,
+			const char *salt, size_t salt_length,
+			char *key, size_t key_length,
+			uint32_t iterations, uint32_t memory, uint32_t parallel);
+
 /* Block ciphers: fallback to kernel crypto API */
 
+struct crypt_cipher_kernel_aio;
+
 struct crypt_cipher_kernel {
 	int tfmfd;
 	int opfd;
+	/* pipe for zero-copy input, created on first use */
+	int pipefd[2];
+	/* async submission queue for sector runs, created on first use */
+	struct crypt_cipher_kernel_aio *aio;
+	bool aio_disabled;
+	/* bound algorithm, empty if tfmfd cannot be returned to the socket pool */
+	char salg_type[14];
+	char salg_name[64];
+	size_t key_length;
 };
 
 int crypt_cipher_init_kernel(struct crypt_cipher_kernel *ctx, const char *name,
@@ -52,12 +70,55 @@ int crypt_cipher_encrypt_kernel(struct crypt_cipher_kernel *ctx,
 int crypt_cipher_decrypt_kernel(struct crypt_cipher_kernel *ctx,
 				const char *in, char *out, size_t length,
 				const char *iv, size_t iv_length);
+int crypt_cipher_encrypt_sectors_kernel(struct crypt_cipher_kernel *ctx,
+					const char *in, char *out,
+					size_t sector_size, size_t sectors,
+					const char *iv, size_t iv_length);
+int crypt_cipher_decrypt_sectors_kernel(struct crypt_cipher_kernel *ctx,
+					const char *in, char *out,
+					size_t sector_size, size_t sectors,
+					const char *iv, size_t iv_length);
 void crypt_cipher_destroy_kernel(struct crypt_cipher_kernel *ctx);
+int crypt_cipher_ivsize_kernel(const char *name, const char *mode);
 int crypt_bitlk_decrypt_key_kernel(const void *key, size_t key_length,
 				   const char *in, char *out, size_t length,
 				   const char *iv, size_t iv_length,
 				   const char *tag, size_t tag_length);
 
+/* Native CPU accelerated AES-XTS and AES-CBC for storage sectors */
+struct crypt_aes_native;
+
+int crypt_aes_native_init(struct crypt_aes_native **ctx, const char *name,
+			  const char *mode, const void *key, size_t key_length);
+int crypt_aes_native_encrypt_sectors(struct crypt_aes_native *ctx,
+				     const char *in, char *out,
+				     size_t sector_size, size_t sectors,
+				     const char *iv, size_t iv_length);
+int crypt_aes_native_decrypt_sectors(struct crypt_aes_native *ctx,
+				     const char *in, char *out,
+				     size_t sector_size, size_t sectors,
+				     const char *iv, size_t iv_length);
+void crypt_aes_native_destroy(struct crypt_aes_native *ctx);
+
+/* SHA-256 round constants and initial state */
+extern const uint32_t crypt_sha256_k[64];
+extern const uint32_t crypt_sha256_iv[8];
+
+/* Multi-buffer SHA-256 of salted blocks */
+int crypt_sha256_multi(const void *salt, size_t salt_size, bool salt_first,
+		       const void *blocks, size_t block_size, size_t count,
+		       void *digests);
+int crypt_sha256_sector_multi(const void *salt, size_t salt_size,
+			      uint64_t sector, uint64_t sector_step,
+			      const void *blocks, size_t block_size, size_t count,
+			      void *digests);
+int crypt_sha256_indexed_multi(uint32_t first, const void *blocks, size_t count,
+			       void *digests);
+
+/* Multi-buffer PBKDF2-HMAC-SHA256 */
+int crypt_pbkdf2_sha256_multi(struct crypt_pbkdf2_job *jobs, size_t count,
+			      uint32_t iterations, size_t key_length);
+
 /* Internal implementation for constant time memory comparison */
 static inline int crypt_internal_memeq(const void *m1, const void *m2, size_t n)
 {
@@ -24,14 +24,19 @@
 #include <stdio.h>
 #include <stdbool.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <unistd.h>
+#include <pthread.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
 #include "crypto_backend_internal.h"
 
 #ifdef ENABLE_AF_ALG
 
 #include <linux/if_alg.h>
+#include <linux/aio_abi.h>
 
 #ifndef AF_ALG
 #define AF_ALG 38
@@ -44,6 +49,117 @@
 #define ALG_SET_AEAD_AUTHSIZE 5
 #endif
 
+/*
+ * Process-wide pool of idle, already bound AF_ALG transformation sockets.
+ *
+ * Binding (algorithm lookup, possibly a module load) is the expensive
+ * part of the setup, so sockets of released skcipher contexts are kept
+ * and reused for the same algorithm and key size. A socket is owned
+ * by exactly one context while in use. Before a socket is returned
+ * to the pool, it is re-keyed with a dummy key, no key material is kept.
+ */
+#define TFM_POOL_SIZE 16
+
+struct tfm_pool_entry {
+	int tfmfd;
+	size_t key_length;
+	char salg_type[14];
+	char salg_name[64];
+};
+
+static struct tfm_pool_entry tfm_pool[TFM_POOL_SIZE];
+static unsigned tfm_pool_count;
+static pid_t tfm_pool_pid;
+static pthread_mutex_t tfm_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Any key works here, tweak the first part if it is split key (XTS). */
+static void dummy_key(char *key, size_t key_length)
+{
+	if (!key_length)
+		return;
+
+	memset(key, 0xab, key_length);
+	*key = 0xef;
+}
+
+/* Pool must be locked. Sockets inherited over fork() must not be shared. */
+static void tfm_pool_check_pid(void)
+{
+	unsigned i;
+
+	if (tfm_pool_pid == getpid())
+		return;
+
+	for (i = 0; i < tfm_pool_count; i++)
+		close(tfm_pool[i].tfmfd);
+
+	tfm_pool_count = 0;
+	tfm_pool_pid = getpid();
+}
+
+static int tfm_pool_get(const struct sockaddr_alg *sa, size_t key_length)
+{
+	unsigned i;
+	int fd = -1;
+
+	pthread_mutex_lock(&tfm_pool_lock);
+	tfm_pool_check_pid();
+
+	for (i = 0; i < tfm_pool_count; i++) {
+		if (tfm_pool[i].key_length != key_length ||
+		    strncmp(tfm_pool[i].salg_type, (const char *)sa->salg_type, sizeof(tfm_pool[i].salg_type)) ||
+		    strncmp(tfm_pool[i].salg_name, (const char *)sa->salg_name, sizeof(tfm_pool[i].salg_name)))
+			continue;
+
+		fd = tfm_pool[i].tfmfd;
+		tfm_pool[i] = tfm_pool[--tfm_pool_count];
+		break;
+	}
+
+	pthread_mutex_unlock(&tfm_pool_lock);
+
+	return fd;
+}
+
+static void tfm_pool_put(struct crypt_cipher_kernel *ctx)
+{
+	char key[256];
+	bool pooled = false;
+
+	if (!*ctx->salg_name || ctx->key_length > sizeof(key))
+		goto out;
+
+	dummy_key(key, ctx->key_length);
+	if (setsockopt(ctx->tfmfd, SOL_ALG, ALG_SET_KEY, key, ctx->key_length) < 0)
+		goto out;
+
+	pthread_mutex_lock(&tfm_pool_lock);
+	tfm_pool_check_pid();
+
+	if (tfm_pool_count < TFM_POOL_SIZE) {
+		tfm_pool[tfm_pool_count].tfmfd = ctx->tfmfd;
+		tfm_pool[tfm_pool_count].key_length = ctx->key_length;
+		memcpy(tfm_pool[tfm_pool_count].salg_type, ctx->salg_type, sizeof(ctx->salg_type));
+		memcpy(tfm_pool[tfm_pool_count].salg_name, ctx->salg_name, sizeof(ctx->salg_name));
+		tfm_pool_count++;
+		pooled = true;
+	}
+
+	pthread_mutex_unlock(&tfm_pool_lock);
+out:
+	if (!pooled)
+		close(ctx->tfmfd);
+}
+
+static void __attribute__((destructor)) tfm_pool_exit(void)
+{
+	pthread_mutex_lock(&tfm_pool_lock);
+	tfm_pool_check_pid();
+	while (tfm_pool_count)
+		close(tfm_pool[--tfm_pool_count].tfmfd);
+	pthread_mutex_unlock(&tfm_pool_lock);
+}
+
 /*
  * ciphers
  *
@@ -59,15 +175,26 @@ static int _crypt_cipher_init(struct crypt_cipher_kernel *ctx,
 		return -EINVAL;
 
 	ctx->opfd = -1;
-	ctx->tfmfd = socket(AF_ALG, SOCK_SEQPACKET, 0);
+	ctx->pipefd[0] = ctx->pipefd[1] = -1;
+	ctx->aio = NULL;
+	ctx->aio_disabled = false;
+	ctx->key_length = key_length;
+	memset(ctx->salg_type, 0, sizeof(ctx->salg_type));
+	memset(ctx->salg_name, 0, sizeof(ctx->salg_name));
+
+	/* AEAD with authsize set on transformation socket is never pooled */
+	ctx->tfmfd = tag_length ? -1 : tfm_pool_get(sa, key_length);
 	if (ctx->tfmfd < 0) {
-		crypt_cipher_destroy_kernel(ctx);
-		return -ENOTSUP;
-	}
+		ctx->tfmfd = socket(AF_ALG, SOCK_SEQPACKET, 0);
+		if (ctx->tfmfd < 0) {
+			crypt_cipher_destroy_kernel(ctx);
+			return -ENOTSUP;
+		}
 
-	if (bind(ctx->tfmfd, (struct sockaddr *)sa, sizeof(*sa)) < 0) {
-		crypt_cipher_destroy_kernel(ctx);
-		return -ENOENT;
+		if (bind(ctx->tfmfd, (struct sockaddr *)sa, sizeof(*sa)) < 0) {
+			crypt_cipher_destroy_kernel(ctx);
+			return -ENOENT;
+		}
 	}
 
 	if (setsockopt(ctx->tfmfd, SOL_ALG, ALG_SET_KEY, key, key_length) < 0) {
@@ -86,6 +213,11 @@ static int _crypt_cipher_init(struct crypt_cipher_kernel *ctx,
 		return -EINVAL;
 	}
 
+	if (!tag_length) {
+		memcpy(ctx->salg_type, sa->salg_type, sizeof(ctx->salg_type));
+		memcpy(ctx->salg_name, sa->salg_name, sizeof(ctx->salg_name));
+	}
+
 	return 0;
 }
 
@@ -108,6 +240,263 @@ int crypt_cipher_init_kernel(struct crypt_cipher_kernel *ctx, const char *name,
 	return _crypt_cipher_init(ctx, key, key_length, 0, &sa);
 }
 
+/*
+ * Zero-copy input path: page aligned input is queued into the socket
+ * through a pipe (vmsplice + splice), the kernel references user pages
+ * instead of copying them as sendmsg() does. Only the result is copied
+ * back by read().
+ *
+ * The operation and IV are set by the control message with MSG_MORE.
+ * Returns -ENOTSUP if the zero-copy path cannot be used and no data was
+ * queued yet; the caller then sends data through sendmsg().
+ *
+ * In-place operation (in == out) is never zero-copy, the kernel could
+ * still reference pages that read() is filling with the result.
+ */
+#define ZEROCOPY_MAX_BYTES 65536 /* default pipe capacity */
+
+static size_t kernel_pagesize(void)
+{
+	static size_t pagesize = 0;
+	long r;
+
+	if (!pagesize) {
+		r = sysconf(_SC_PAGESIZE);
+		pagesize = r <= 0 ? 4096 : (size_t)r;
+	}
+
+	return pagesize;
+}
+
+static int _crypt_cipher_send_zerocopy(struct crypt_cipher_kernel *ctx, int opfd,
+				       struct msghdr *msg, const char *in, const char *out,
+				       size_t length)
+{
+	struct iovec iov;
+	size_t done = 0, pagesize = kernel_pagesize();
+	ssize_t len, spliced;
+
+	if (in == out || ((uintptr_t)in & (pagesize - 1)) || (length & (pagesize - 1)) ||
+	    length > ZEROCOPY_MAX_BYTES)
+		return -ENOTSUP;
+
+	if (ctx->pipefd[0] < 0 && pipe2(ctx->pipefd, O_CLOEXEC) < 0) {
+		ctx->pipefd[0] = ctx->pipefd[1] = -1;
+		return -ENOTSUP;
+	}
+
+	msg->msg_iov = NULL;
+	msg->msg_iovlen = 0;
+	if (sendmsg(opfd, msg, MSG_MORE) < 0)
+		return -ENOTSUP;
+
+	while (done < length) {
+		iov.iov_base = (void*)(uintptr_t)&in[done];
+		iov.iov_len = length - done;
+
+		len = vmsplice(ctx->pipefd[1], &iov, 1, 0);
+		if (len <= 0) {
+			/* Operation is already set, finish the request by copying */
+			if (!done)
+				return send(opfd, in, length, 0) == (ssize_t)length ? 0 : -EIO;
+			return -EIO;
+		}
+
+		spliced = splice(ctx->pipefd[0], NULL, opfd, NULL, len,
+				 (done + len) < length ? SPLICE_F_MORE : 0);
+		if (spliced != len)
+			return -EIO;
+
+		done += len;
+	}
+
+	return 0;
+}
+
+/*
+ * Failed request can be left half queued (control message sent with MSG_MORE,
+ * data partially spliced). Such operation socket cannot be used anymore,
+ * replace it by a new one and drop the pipe with possible leftover data.
+ */
+static void _crypt_cipher_reset(struct crypt_cipher_kernel *ctx, int *opfd)
+{
+	if (*opfd >= 0)
+		close(*opfd);
+	*opfd = accept(ctx->tfmfd, NULL, 0);
+
+	if (ctx->pipefd[0] >= 0)
+		close(ctx->pipefd[0]);
+	if (ctx->pipefd[1] >= 0)
+		close(ctx->pipefd[1]);
+	ctx->pipefd[0] = ctx->pipefd[1] = -1;
+}
+
+static int _crypt_cipher_send(struct crypt_cipher_kernel *ctx, int opfd,
+			      struct msghdr *msg, const char *in, const char *out,
+			      size_t length)
+{
+	struct iovec iov = {
+		.iov_base = (void*)(uintptr_t)in,
+		.iov_len = length,
+	};
+	int r;
+
+	r = _crypt_cipher_send_zerocopy(ctx, opfd, msg, in, out, length);
+	if (r != -ENOTSUP)
+		return r;
+
+	msg->msg_iov = &iov;
+	msg->msg_iovlen = 1;
+
+	return sendmsg(opfd, msg, 0) == (ssize_t)length ? 0 : -EIO;
+}
+
+/*
+ * Async submission queue.
+ *
+ * IV is a property of the operation socket, so requests with different
+ * IVs cannot be queued on one socket. The queue uses several operation
+ * sockets accepted from the same (keyed) transformation socket, every
+ * socket carries one request. Results are collected by AIO reads
+ * (io_submit), so up to AIO_QUEUE_DEPTH sectors are in flight to
+ * asynchronous crypto drivers (hardware engines) at the same time.
+ */
+#define AIO_QUEUE_DEPTH 8
+
+struct crypt_cipher_kernel_aio {
+	aio_context_t aio_ctx;
+	int opfd[AIO_QUEUE_DEPTH];
+};
+
+static void _crypt_cipher_aio_destroy(struct crypt_cipher_kernel *ctx)
+{
+	int i;
+
+	if (!ctx->aio)
+		return;
+
+	/* io_destroy() cancels and waits for all requests still in flight */
+	if (ctx->aio->aio_ctx)
+		(void)syscall(SYS_io_destroy, ctx->aio->aio_ctx);
+
+	for (i = 0; i < AIO_QUEUE_DEPTH; i++)
+		if (ctx->aio->opfd[i] >= 0)
+			close(ctx->aio->opfd[i]);
+
+	free(ctx->aio);
+	ctx->aio = NULL;
+}
+
+static int _crypt_cipher_aio_init(struct crypt_cipher_kernel *ctx)
+{
+	int i;
+
+	if (ctx->aio)
+		return 0;
+	if (ctx->aio_disabled)
+		return -ENOTSUP;
+
+	ctx->aio = malloc(sizeof(*ctx->aio));
+	if (!ctx->aio)
+		return -ENOMEM;
+
+	ctx->aio->aio_ctx = 0;
+	for (i = 0; i < AIO_QUEUE_DEPTH; i++)
+		ctx->aio->opfd[i] = -1;
+
+	if (syscall(SYS_io_setup, AIO_QUEUE_DEPTH, &ctx->aio->aio_ctx) < 0) {
+		ctx->aio->aio_ctx = 0;
+		goto err;
+	}
+
+	/* The first slot reuses the context operation socket */
+	for (i = 1; i < AIO_QUEUE_DEPTH; i++) {
+		ctx->aio->opfd[i] = accept(ctx->tfmfd, NULL, 0);
+		if (ctx->aio->opfd[i] < 0)
+			goto err;
+	}
+
+	return 0;
+err:
+	_crypt_cipher_aio_destroy(ctx);
+	ctx->aio_disabled = true;
+	return -ENOTSUP;
+}
+
+static int _crypt_cipher_crypt_sectors_aio(struct crypt_cipher_kernel *ctx,
+					   struct msghdr *msg, struct af_alg_iv *alg_iv,
+					   const char *in, char *out,
+					   size_t sector_size, size_t sectors,
+					   const char *iv, size_t iv_length)
+{
+	struct iocb cb[AIO_QUEUE_DEPTH], *cbs[AIO_QUEUE_DEPTH];
+	struct io_event events[AIO_QUEUE_DEPTH];
+	size_t i, j, n;
+	long submitted, done, k;
+	int opfd, r = 0;
+
+	for (i = 0; i < sectors && !r; i += n) {
+		n = sectors - i;
+		if (n > AIO_QUEUE_DEPTH)
+			n = AIO_QUEUE_DEPTH;
+
+		for (j = 0; j < n; j++) {
+			opfd = j ? ctx->aio->opfd[j] : ctx->opfd;
+
+			if (alg_iv)
+				memcpy(alg_iv->iv, &iv[(i + j) * iv_length], iv_length);
+
+			r = _crypt_cipher_send(ctx, opfd, msg, &in[(i + j) * sector_size],
+					       &out[(i + j) * sector_size], sector_size);
+			if (r)
+				goto out;
+
+			memset(&cb[j], 0, sizeof(cb[j]));
+			cb[j].aio_fildes = opfd;
+			cb[j].aio_lio_opcode = IOCB_CMD_PREAD;
+			cb[j].aio_buf = (uint64_t)(uintptr_t)&out[(i + j) * sector_size];
+			cb[j].aio_nbytes = sector_size;
+			cbs[j] = &cb[j];
+		}
+
+		submitted = syscall(SYS_io_submit, ctx->aio->aio_ctx, (long)n, cbs);
+		if (submitted != (long)n)
+			r = -EIO;
+		if (submitted < 0)
+			submitted = 0;
+
+		/* Always collect everything submitted, buffers are still referenced */
+		for (done = 0; done < submitted; done += k) {
+			k = syscall(SYS_io_getevents, ctx->aio->aio_ctx, 1L,
+				    submitted - done, events, NULL);
+			if (k < 0 && errno == EINTR) {
+				k = 0;
+				continue;
+			}
+			if (k <= 0) {
+				r = -EIO;
+				goto out;
+			}
+
+			for (j = 0; j < (size_t)k; j++)
+				if (events[j].res != (int64_t)sector_size)
+					r = -EIO;
+		}
+	}
+out:
+	/*
+	 * Sockets can hold queued requests that were never submitted or
+	 * collected. Drop the whole queue (waits for requests in flight),
+	 * it is allocated again with fresh sockets on the next call.
+	 */
+	if (r) {
+		_crypt_cipher_aio_destroy(ctx);
+		_crypt_cipher_reset(ctx, &ctx->opfd);
+	}
+
+	return r;
+}
+
 /* The in/out should be aligned to page boundary */
 static int _crypt_cipher_crypt(struct crypt_cipher_kernel *ctx,
 			       const char *in, size_t in_length,
@@ -120,17 +509,11 @@ static int _crypt_cipher_crypt(struct crypt_cipher_kernel *ctx,
 	struct af_alg_iv *alg_iv;
 	struct cmsghdr *header;
 	uint32_t *type;
-	struct iovec iov = {
-		.iov_base = (void*)(uintptr_t)in,
-		.iov_len = in_length,
-	};
 	int iv_msg_size = iv ? CMSG_SPACE(sizeof(*alg_iv) + iv_length) : 0;
 	char buffer[CMSG_SPACE(sizeof(*type)) + iv_msg_size];
 	struct msghdr msg = {
 		.msg_control = buffer,
 		.msg_controllen = sizeof(buffer),
-		.msg_iov = &iov,
-		.msg_iovlen = 1,
 	};
 
 	if (!in || !out || !in_length)
@@ -166,14 +549,127 @@ static int _crypt_cipher_crypt(struct crypt_cipher_kernel *ctx,
 		memcpy(alg_iv->iv, iv, iv_length);
 	}
 
-	len = sendmsg(ctx->opfd, &msg, 0);
-	if (len != (ssize_t)(in_length))
-		r = -EIO;
-	else {
+	r = _crypt_cipher_send(ctx, ctx->opfd, &msg, in, out, in_length);
+	if (!r) {
 		len = read(ctx->opfd, out, out_length);
 		if (len != (ssize_t)out_length)
 			r = -EIO;
 	}
+	if (r)
+		_crypt_cipher_reset(ctx, &ctx->opfd);
+
+	crypt_backend_memzero(buffer, sizeof(buffer));
+	return r;
+}
+
+/*
+ * Process a run of sectors, each with its own IV. The control message
+ * is built only once, only the IV payload is replaced for every sector.
+ *
+ * An AF_ALG request takes exactly one IV (ALG_SET_IV applies to the whole
+ * sendmsg() payload), so only a run without IVs (ECB) is batched into one
+ * request. Sectors with IVs (all storage IV modes) still need one request
+ * per sector, these are only queued in parallel if AIO is available.
+ * The batch must fit into socket send buffer, sendmsg() would block
+ * otherwise, use the pipe capacity as the limit.
+ */
+static int _crypt_cipher_crypt_sectors(struct crypt_cipher_kernel *ctx,
+				       const char *in, char *out,
+				       size_t sector_size, size_t sectors,
+				       const char *iv, size_t iv_length,
+				       uint32_t direction)
+{
+	int r = 0;
+	size_t i, n;
+	ssize_t len;
+	struct af_alg_iv *alg_iv = NULL;
+	struct cmsghdr *header;
+	uint32_t *type;
+	int iv_msg_size = iv ? CMSG_SPACE(sizeof(*alg_iv) + iv_length) : 0;
+	char buffer[CMSG_SPACE(sizeof(*type)) + iv_msg_size];
+	struct msghdr msg = {
+		.msg_control = buffer,
+		.msg_controllen = sizeof(buffer),
+	};
+
+	if (!in || !out || !sector_size || !sectors)
+		return -EINVAL;
+
+	if ((!iv && iv_length) || (iv && !iv_length))
+		return -EINVAL;
+
+	memset(buffer, 0, sizeof(buffer));
+
+	header = CMSG_FIRSTHDR(&msg);
+	if (!header)
+		return -EINVAL;
+
+	header->cmsg_level = SOL_ALG;
+	header->cmsg_type = ALG_SET_OP;
+	header->cmsg_len = CMSG_LEN(sizeof(*type));
+	type = (void*)CMSG_DATA(header);
+	*type = direction;
+
+	if (iv) {
+		header = CMSG_NXTHDR(&msg, header);
+		if (!header)
+			return -EINVAL;
+
+		header->cmsg_level = SOL_ALG;
+		header->cmsg_type = ALG_SET_IV;
+		header->cmsg_len = iv_msg_size;
+		alg_iv = (void*)CMSG_DATA(header);
+		alg_iv->ivlen = iv_length;
+	}
+
+	if (!iv) {
+		n = ZEROCOPY_MAX_BYTES / sector_size;
+		if (!n)
+			n = 1;
+
+		for (i = 0; i < sectors && !r; i += n) {
+			if (n > sectors - i)
+				n = sectors - i;
+
+			r = _crypt_cipher_send(ctx, ctx->opfd, &msg, &in[i * sector_size],
+					       &out[i * sector_size], n * sector_size);
+			if (!r) {
+				len = read(ctx->opfd, &out[i * sector_size], n * sector_size);
+				if (len != (ssize_t)(n * sector_size))
+					r = -EIO;
+			}
+		}
+
+		if (r)
+			_crypt_cipher_reset(ctx, &ctx->opfd);
+		crypt_backend_memzero(buffer, sizeof(buffer));
+		return r;
+	}
+
+	if (sectors > 1 && !_crypt_cipher_aio_init(ctx)) {
+		r = _crypt_cipher_crypt_sectors_aio(ctx, &msg, alg_iv, in, out,
+						    sector_size, sectors, iv, iv_length);
+		crypt_backend_memzero(buffer, sizeof(buffer));
+		return r;
+	}
+
+	for (i = 0; i < sectors; i++) {
+		if (alg_iv)
+			memcpy(alg_iv->iv, &iv[i * iv_length], iv_length);
+
+		r = _crypt_cipher_send(ctx, ctx->opfd, &msg, &in[i * sector_size],
+				       &out[i * sector_size], sector_size);
+		if (r)
+			break;
+
+		len = read(ctx->opfd, &out[i * sector_size], sector_size);
+		if (len != (ssize_t)sector_size) {
+			r = -EIO;
+			break;
+		}
+	}
+	if (r)
+		_crypt_cipher_reset(ctx, &ctx->opfd);
 
 	crypt_backend_memzero(buffer, sizeof(buffer));
 	return r;
@@ -195,15 +691,39 @@ int crypt_cipher_decrypt_kernel(struct crypt_cipher_kernel *ctx,
 				   iv, iv_length, ALG_OP_DECRYPT);
 }
 
+int crypt_cipher_encrypt_sectors_kernel(struct crypt_cipher_kernel *ctx,
+					const char *in, char *out,
+					size_t sector_size, size_t sectors,
+					const char *iv, size_t iv_length)
+{
+	return _crypt_cipher_crypt_sectors(ctx, in, out, sector_size, sectors,
+					   iv, iv_length, ALG_OP_ENCRYPT);
+}
+
+int crypt_cipher_decrypt_sectors_kernel(struct crypt_cipher_kernel *ctx,
+					const char *in, char *out,
+					size_t sector_size, size_t sectors,
+					const char *iv, size_t iv_length)
+{
+	return _crypt_cipher_crypt_sectors(ctx, in, out, sector_size, sectors,
+					   iv, iv_length, ALG_OP_DECRYPT);
+}
+
 void crypt_cipher_destroy_kernel(struct crypt_cipher_kernel *ctx)
 {
-	if (ctx->tfmfd >= 0)
-		close(ctx->tfmfd);
+	_crypt_cipher_aio_destroy(ctx);
+	if (ctx->pipefd[0] >= 0)
+		close(ctx->pipefd[0]);
+	if (ctx->pipefd[1] >= 0)
+		close(ctx->pipefd[1]);
 	if (ctx->opfd >= 0)
 		close(ctx->opfd);
+	if (ctx->tfmfd >= 0)
+		tfm_pool_put(ctx);
 
 	ctx->tfmfd = -1;
 	ctx->opfd = -1;
+	ctx->pipefd[0] = ctx->pipefd[1] = -1;
 }
 
 int crypt_cipher_check_kernel(const char *name, const char *mode,
@@ -257,9 +777,8 @@ int crypt_cipher_check_kernel(const char *name, const char *mode,
 	if (!key)
 		return -ENOMEM;
 
-	/* We cannot use RNG yet, any key works here, tweak the first part if it is split key (XTS). */
-	memset(key, 0xab, key_length);
-	*key = 0xef;
+	/* We cannot use RNG yet. */
+	dummy_key(key, key_length);
 
 	r = _crypt_cipher_init(&c, key, key_length, 0, &sa);
 	crypt_cipher_destroy_kernel(&c);
@@ -268,6 +787,44 @@ int crypt_cipher_check_kernel(const char *name, const char *mode,
 	return r;
 }
 
+/*
+ * IV size of a skcipher already instantiated in kernel (e.g. by previous
+ * crypt_cipher_init_kernel), for ciphers not known to the library.
+ */
+int crypt_cipher_ivsize_kernel(const char *name, const char *mode)
+{
+	char alg[128], line[256], *value;
+	bool match = false;
+	int ivsize, r = -ENOENT;
+	FILE *f;
+
+	if (!mode)
+		r = snprintf(alg, sizeof(alg), "%s", name);
+	else
+		r = snprintf(alg, sizeof(alg), "%s(%s)", mode, name);
+	if (r < 0 || (size_t)r >= sizeof(alg))
+		return -EINVAL;
+
+	f = fopen("/proc/crypto", "r");
+	if (!f)
+		return -ENOENT;
+
+	r = -ENOENT;
+	while (fgets(line, sizeof(line), f)) {
+		if (!strncmp(line, "name", 4) && (value = strchr(line, ':'))) {
+			value += strspn(value + 1, " ") + 1;
+			value[strcspn(value, "\n")] = '\0';
+			match = !strcmp(value, alg);
+		} else if (match && sscanf(line, "ivsize : %d", &ivsize) == 1) {
+			r = ivsize;
+			break;
+		}
+	}
+
+	fclose(f);
+	return r;
+}
+
 int crypt_bitlk_decrypt_key_kernel(const void *key, size_t key_length,
 				   const char *in, char *out, size_t length,
 				   const char *iv, size_t iv_length,
@@ -335,12 +892,30 @@ int crypt_cipher_decrypt_kernel(struct crypt_cipher_kernel *ctx,
 {
 	return -EINVAL;
 }
+int crypt_cipher_encrypt_sectors_kernel(struct crypt_cipher_kernel *ctx,
+					const char *in, char *out,
+					size_t sector_size, size_t sectors,
+					const char *iv, size_t iv_length)
+{
+	return -EINVAL;
+}
+int crypt_cipher_decrypt_sectors_kernel(struct crypt_cipher_kernel *ctx,
+					const char *in, char *out,
+					size_t sector_size, size_t sectors,
+					const char *iv, size_t iv_length)
+{
+	return -EINVAL;
+}
 int crypt_cipher_check_kernel(const char *name, const char *mode,
 			      const char *integrity, size_t key_length)
 {
 	/* Cannot check, expect success. */
 	return 0;
 }
+int crypt_cipher_ivsize_kernel(const char *name, const char *mode)
+{
+	return -ENOTSUP;
+}
 int crypt_bitlk_decrypt_key_kernel(const void *key, size_t key_length,
 				   const char *in, char *out, size_t length,
 				   const char *iv, size_t iv_length,
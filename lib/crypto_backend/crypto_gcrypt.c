@@ -235,9 +235,28 @@ int crypt_hash_init(struct crypt_hash **ctx, const char *name)
 	return 0;
 }
 
-static void crypt_hash_restart(struct crypt_hash *ctx)
+int crypt_hash_reset(struct crypt_hash *ctx)
 {
 	gcry_md_reset(ctx->hd);
+	return 0;
+}
+
+int crypt_hash_clone(struct crypt_hash **dst, struct crypt_hash *src)
+{
+	struct crypt_hash *h;
+
+	h = malloc(sizeof(*h));
+	if (!h)
+		return -ENOMEM;
+
+	*h = *src;
+	if (gcry_md_copy(&h->hd, src->hd)) {
+		free(h);
+		return -EINVAL;
+	}
+
+	*dst = h;
+	return 0;
 }
 
 int crypt_hash_write(struct crypt_hash *ctx, const char *buffer, size_t length)
@@ -246,6 +265,21 @@ int crypt_hash_write(struct crypt_hash *ctx, const char *buffer, size_t length)
 	return 0;
 }
 
+int crypt_hash_copy(struct crypt_hash *dst, struct crypt_hash *src)
+{
+	gcry_md_hd_t hd;
+
+	if (dst->hash_id != src->hash_id)
+		return -EINVAL;
+
+	if (gcry_md_copy(&hd, src->hd))
+		return -EINVAL;
+
+	gcry_md_close(dst->hd);
+	dst->hd = hd;
+	return 0;
+}
+
 int crypt_hash_final(struct crypt_hash *ctx, char *buffer, size_t length)
 {
 	unsigned char *hash;
@@ -258,7 +292,7 @@ int crypt_hash_final(struct crypt_hash *ctx, char *buffer, size_t length)
 		return -EINVAL;
 
 	memcpy(buffer, hash, length);
-	crypt_hash_restart(ctx);
+	crypt_hash_reset(ctx);
 
 	return 0;
 }
@@ -310,9 +344,29 @@ int crypt_hmac_init(struct crypt_hmac **ctx, const char *name,
 	return 0;
 }
 
-static void crypt_hmac_restart(struct crypt_hmac *ctx)
+int crypt_hmac_reset(struct crypt_hmac *ctx)
 {
 	gcry_md_reset(ctx->hd);
+	return 0;
+}
+
+/* HMAC handle copy includes the key */
+int crypt_hmac_clone(struct crypt_hmac **dst, struct crypt_hmac *src)
+{
+	struct crypt_hmac *h;
+
+	h = malloc(sizeof(*h));
+	if (!h)
+		return -ENOMEM;
+
+	*h = *src;
+	if (gcry_md_copy(&h->hd, src->hd)) {
+		free(h);
+		return -EINVAL;
+	}
+
+	*dst = h;
+	return 0;
 }
 
 int crypt_hmac_write(struct crypt_hmac *ctx, const char *buffer, size_t length)
@@ -333,7 +387,7 @@ int crypt_hmac_final(struct crypt_hmac *ctx, char *buffer, size_t length)
 		return -EINVAL;
 
 	memcpy(buffer, hash, length);
-	crypt_hmac_restart(ctx);
+	crypt_hmac_reset(ctx);
 
 	return 0;
 }
@@ -387,11 +441,11 @@ static int pbkdf2(const char *hash,
 }
 
 /* PBKDF */
-int crypt_pbkdf(const char *kdf, const char *hash,
-		const char *password, size_t password_length,
-		const char *salt, size_t salt_length,
-		char *key, size_t key_length,
-		uint32_t iterations, uint32_t memory, uint32_t parallel)
+int crypt_backend_pbkdf(const char *kdf, const char *hash,
+			const char *password, size_t password_length,
+			const char *salt, size_t salt_length,
+			char *key, size_t key_length,
+			uint32_t iterations, uint32_t memory, uint32_t parallel)
 {
 	if (!kdf)
 		return -EINVAL;
@@ -505,6 +559,52 @@ int crypt_cipher_decrypt(struct crypt_cipher *ctx,
 	return 0;
 }
 
+int crypt_cipher_encrypt_sectors(struct crypt_cipher *ctx,
+				 const char *in, char *out,
+				 size_t sector_size, size_t sectors,
+				 const char *iv, size_t iv_length)
+{
+	size_t i;
+
+	if (ctx->use_kernel)
+		return crypt_cipher_encrypt_sectors_kernel(&ctx->u.kernel, in, out, sector_size,
+							   sectors, iv, iv_length);
+
+	for (i = 0; i < sectors; i++) {
+		if (iv && gcry_cipher_setiv(ctx->u.hd, &iv[i * iv_length], iv_length))
+			return -EINVAL;
+
+		if (gcry_cipher_encrypt(ctx->u.hd, &out[i * sector_size], sector_size,
+					&in[i * sector_size], sector_size))
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
+int crypt_cipher_decrypt_sectors(struct crypt_cipher *ctx,
+				 const char *in, char *out,
+				 size_t sector_size, size_t sectors,
+				 const char *iv, size_t iv_length)
+{
+	size_t i;
+
+	if (ctx->use_kernel)
+		return crypt_cipher_decrypt_sectors_kernel(&ctx->u.kernel, in, out, sector_size,
+							   sectors, iv, iv_length);
+
+	for (i = 0; i < sectors; i++) {
+		if (iv && gcry_cipher_setiv(ctx->u.hd, &iv[i * iv_length], iv_length))
+			return -EINVAL;
+
+		if (gcry_cipher_decrypt(ctx->u.hd, &out[i * sector_size], sector_size,
+					&in[i * sector_size], sector_size))
+			return -EINVAL;
+	}
+
+	return 0;
+}
+
 bool crypt_cipher_kernel_only(struct crypt_cipher *ctx)
 {
 	return ctx->use_kernel;
@@ -0,0 +1,224 @@
+/*
+ * Hashing of fixed size blocks split across worker threads
+ *
+ * Copyright (C) 2023 Red Hat, Inc. All rights reserved.
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this file; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <endian.h>
+#include <pthread.h>
+#include "crypto_backend_internal.h"
+
+/* Upper limit of worker threads (including the calling thread) */
+#define HASH_MAX_THREADS	64
+
+/* Do not start another thread for less data than this */
+#define HASH_MIN_CHUNK		(1024 * 1024)
+
+struct hash_job {
+	const char *name;
+	const char *buffer;
+	size_t blocks;
+	size_t block_size;
+	char *digests;
+	size_t digest_size;
+	pthread_t thread;
+	int r;
+};
+
+static void *hash_blocks_thread(void *arg)
+{
+	struct hash_job *job = arg;
+	struct crypt_hash *h;
+	size_t i;
+
+	/* every thread needs its own hash context */
+	job->r = crypt_hash_init(&h, job->name);
+	if (job->r)
+		return NULL;
+
+	for (i = 0; i < job->blocks && !job->r; i++) {
+		job->r = crypt_hash_write(h, job->buffer + i * job->block_size, job->block_size);
+		if (!job->r)
+			job->r = crypt_hash_final(h, job->digests + i * job->digest_size, job->digest_size);
+	}
+
+	crypt_hash_destroy(h);
+	return NULL;
+}
+
+int crypt_hash_blocks(const char *name, unsigned threads,
+		      const void *buffer, size_t length, size_t block_size,
+		      void *digests, size_t digest_size)
+{
+	struct hash_job jobs[HASH_MAX_THREADS];
+	size_t blocks, chunk, done;
+	unsigned i, started;
+	int r = 0;
+
+	if (!block_size || length % block_size)
+		return -EINVAL;
+
+	blocks = length / block_size;
+	if (!blocks)
+		return 0;
+
+	if (threads > HASH_MAX_THREADS)
+		threads = HASH_MAX_THREADS;
+	if (threads > length / HASH_MIN_CHUNK)
+		threads = length / HASH_MIN_CHUNK;
+	if (!threads)
+		threads = 1;
+
+	chunk = (blocks + threads - 1) / threads;
+
+	for (i = 0, done = 0; i < threads && done < blocks; i++, done += chunk) {
+		jobs[i].name = name;
+		jobs[i].buffer = (const char *)buffer + done * block_size;
+		jobs[i].blocks = blocks - done < chunk ? blocks - done : chunk;
+		jobs[i].block_size = block_size;
+		jobs[i].digests = (char *)digests + done * digest_size;
+		jobs[i].digest_size = digest_size;
+		jobs[i].r = 0;
+	}
+	threads = i;
+
+	/* Job 0 runs in the calling thread, fall back to it if thread creation fails. */
+	for (started = 1; started < threads; started++)
+		if (pthread_create(&jobs[started].thread, NULL, hash_blocks_thread, &jobs[started]))
+			break;
+
+	for (i = started; i < threads; i++)
+		(void)hash_blocks_thread(&jobs[i]);
+	(void)hash_blocks_thread(&jobs[0]);
+
+	for (i = 1; i < started; i++)
+		pthread_join(jobs[i].thread, NULL);
+
+	for (i = 0; i < threads && !r; i++)
+		r = jobs[i].r;
+
+	return r;
+}
+
+int crypt_hash_salted_blocks(const char *name,
+			     const void *salt, size_t salt_size, bool salt_first,
+			     const void *blocks, size_t block_size, size_t count,
+			     void *digests, size_t digest_size)
+{
+	struct crypt_hash *h, *prefix = NULL;
+	const char *block = blocks;
+	size_t i;
+	int r = 0;
+
+	if (!count)
+		return 0;
+
+	/* Short independent messages, run them in parallel CPU lanes if possible. */
+	if (digest_size == 32 && !strcmp(name, "sha256") &&
+	    !crypt_sha256_multi(salt, salt_size, salt_first, blocks, block_size, count, digests))
+		return 0;
+
+	if (crypt_hash_init(&h, name))
+		return -EINVAL;
+
+	/* Absorb salt prefix once, every block then starts from a copy of that state. */
+	if (salt_first && salt_size) {
+		if (crypt_hash_init(&prefix, name)) {
+			crypt_hash_destroy(h);
+			return -EINVAL;
+		}
+		r = crypt_hash_write(prefix, salt, salt_size);
+	}
+
+	for (i = 0; i < count && !r; i++, block += block_size) {
+		if (prefix)
+			r = crypt_hash_copy(h, prefix);
+		if (!r)
+			r = crypt_hash_write(h, block, block_size);
+		if (!r && !salt_first && salt_size)
+			r = crypt_hash_write(h, salt, salt_size);
+		if (!r)
+			r = crypt_hash_final(h, (char *)digests + i * digest_size, digest_size);
+	}
+
+	if (prefix)
+		crypt_hash_destroy(prefix);
+	crypt_hash_destroy(h);
+	return r;
+}
+
+int crypt_hash_indexed_blocks(struct crypt_hash *ctx, const char *name, uint32_t first,
+			      const void *blocks, size_t block_size, size_t count,
+			      void *digests)
+{
+	const char *block = blocks;
+	uint32_t n;
+	char index[4];
+	size_t i;
+	int r = 0;
+
+	if (block_size == 32 && !strcmp(name, "sha256") &&
+	    !crypt_sha256_indexed_multi(first, blocks, count, digests))
+		return 0;
+
+	/* block and digest may share memory, block is absorbed before its digest is written */
+	for (i = 0; i < count && !r; i++, block += block_size) {
+		n = first + (uint32_t)i;
+		index[0] = (char)(n >> 24); index[1] = (char)(n >> 16);
+		index[2] = (char)(n >> 8); index[3] = (char)n;
+		r = crypt_hash_write(ctx, index, sizeof(index));
+		if (!r)
+			r = crypt_hash_write(ctx, block, block_size);
+		if (!r)
+			r = crypt_hash_final(ctx, (char *)digests + i * block_size, block_size);
+	}
+
+	return r;
+}
+
+int crypt_hash_sector_blocks(struct crypt_hash *ctx, const char *name,
+			     const void *salt, size_t salt_size,
+			     uint64_t sector, uint64_t sector_step,
+			     const void *blocks, size_t block_size, size_t count,
+			     void *digests, size_t digest_size)
+{
+	const char *block = blocks;
+	uint64_t le_sector;
+	size_t i;
+	int r = 0;
+
+	if (digest_size == 32 && !strcmp(name, "sha256") &&
+	    !crypt_sha256_sector_multi(salt, salt_size, sector, sector_step,
+				       blocks, block_size, count, digests))
+		return 0;
+
+	for (i = 0; i < count && !r; i++, block += block_size) {
+		le_sector = htole64(sector + i * sector_step);
+		if (salt_size)
+			r = crypt_hash_write(ctx, salt, salt_size);
+		if (!r)
+			r = crypt_hash_write(ctx, (const char *)&le_sector, sizeof(le_sector));
+		if (!r)
+			r = crypt_hash_write(ctx, block, block_size);
+		if (!r)
+			r = crypt_hash_final(ctx, (char *)digests + i * digest_size, digest_size);
+	}
+
+	return r;
+}
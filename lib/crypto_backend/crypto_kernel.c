@@ -225,6 +225,23 @@ int crypt_hash_write(struct crypt_hash *ctx, const char *buffer, size_t length)
 	return 0;
 }
 
+/* accept() on operation socket clones its current hash state */
+int crypt_hash_copy(struct crypt_hash *dst, struct crypt_hash *src)
+{
+	int opfd;
+
+	if (dst->hash_len != src->hash_len)
+		return -EINVAL;
+
+	opfd = accept(src->opfd, NULL, 0);
+	if (opfd < 0)
+		return -EINVAL;
+
+	close(dst->opfd);
+	dst->opfd = opfd;
+	return 0;
+}
+
 int crypt_hash_final(struct crypt_hash *ctx, char *buffer, size_t length)
 {
 	ssize_t r;
@@ -239,6 +256,59 @@ int crypt_hash_final(struct crypt_hash *ctx, char *buffer, size_t length)
 	return 0;
 }
 
+/* New operation socket from the tfm starts with empty state */
+static int kernel_op_reset(int tfmfd, int *opfd)
+{
+	int fd;
+
+	fd = accept(tfmfd, NULL, 0);
+	if (fd < 0)
+		return -EINVAL;
+
+	close(*opfd);
+	*opfd = fd;
+	return 0;
+}
+
+/* Shares the tfm (and HMAC key), operation socket clones the state */
+static int kernel_op_clone(int tfmfd, int opfd, int *r_tfmfd, int *r_opfd)
+{
+	*r_tfmfd = dup(tfmfd);
+	if (*r_tfmfd < 0)
+		return -EINVAL;
+
+	*r_opfd = accept(opfd, NULL, 0);
+	if (*r_opfd < 0) {
+		close(*r_tfmfd);
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int crypt_hash_reset(struct crypt_hash *ctx)
+{
+	return kernel_op_reset(ctx->tfmfd, &ctx->opfd);
+}
+
+int crypt_hash_clone(struct crypt_hash **dst, struct crypt_hash *src)
+{
+	struct crypt_hash *h;
+
+	h = malloc(sizeof(*h));
+	if (!h)
+		return -ENOMEM;
+
+	h->hash_len = src->hash_len;
+	if (kernel_op_clone(src->tfmfd, src->opfd, &h->tfmfd, &h->opfd)) {
+		free(h);
+		return -EINVAL;
+	}
+
+	*dst = h;
+	return 0;
+}
+
 void crypt_hash_destroy(struct crypt_hash *ctx)
 {
 	if (ctx->tfmfd >= 0)
@@ -318,6 +388,29 @@ int crypt_hmac_final(struct crypt_hmac *ctx, char *buffer, size_t length)
 	return 0;
 }
 
+int crypt_hmac_reset(struct crypt_hmac *ctx)
+{
+	return kernel_op_reset(ctx->tfmfd, &ctx->opfd);
+}
+
+int crypt_hmac_clone(struct crypt_hmac **dst, struct crypt_hmac *src)
+{
+	struct crypt_hmac *h;
+
+	h = malloc(sizeof(*h));
+	if (!h)
+		return -ENOMEM;
+
+	h->hash_len = src->hash_len;
+	if (kernel_op_clone(src->tfmfd, src->opfd, &h->tfmfd, &h->opfd)) {
+		free(h);
+		return -EINVAL;
+	}
+
+	*dst = h;
+	return 0;
+}
+
 void crypt_hmac_destroy(struct crypt_hmac *ctx)
 {
 	if (ctx->tfmfd >= 0)
@@ -336,11 +429,11 @@ int crypt_backend_rng(char *buffer __attribute__((unused)), size_t length __attr
 }
 
 /* PBKDF */
-int crypt_pbkdf(const char *kdf, const char *hash,
-		const char *password, size_t password_length,
-		const char *salt, size_t salt_length,
-		char *key, size_t key_length,
-		uint32_t iterations, uint32_t memory, uint32_t parallel)
+int crypt_backend_pbkdf(const char *kdf, const char *hash,
+			const char *password, size_t password_length,
+			const char *salt, size_t salt_length,
+			char *key, size_t key_length,
+			uint32_t iterations, uint32_t memory, uint32_t parallel)
 {
 	struct hash_alg *ha;
 
@@ -403,6 +496,24 @@ int crypt_cipher_decrypt(struct crypt_cipher *ctx,
 	return crypt_cipher_decrypt_kernel(&ctx->ck, in, out, length, iv, iv_length);
 }
 
+int crypt_cipher_encrypt_sectors(struct crypt_cipher *ctx,
+				 const char *in, char *out,
+				 size_t sector_size, size_t sectors,
+				 const char *iv, size_t iv_length)
+{
+	return crypt_cipher_encrypt_sectors_kernel(&ctx->ck, in, out, sector_size, sectors,
+						   iv, iv_length);
+}
+
+int crypt_cipher_decrypt_sectors(struct crypt_cipher *ctx,
+				 const char *in, char *out,
+				 size_t sector_size, size_t sectors,
+				 const char *iv, size_t iv_length)
+{
+	return crypt_cipher_decrypt_sectors_kernel(&ctx->ck, in, out, sector_size, sectors,
+						   iv, iv_length);
+}
+
 bool crypt_cipher_kernel_only(struct crypt_cipher *ctx __attribute__((unused)))
 {
 	return true;
@@ -257,9 +257,23 @@ int crypt_hash_init(struct crypt_hash **ctx, const char *name)
 	return 0;
 }
 
-static void crypt_hash_restart(struct crypt_hash *ctx)
+int crypt_hash_reset(struct crypt_hash *ctx)
 {
 	ctx->hash->init(&ctx->nettle_ctx);
+	return 0;
+}
+
+int crypt_hash_clone(struct crypt_hash **dst, struct crypt_hash *src)
+{
+	struct crypt_hash *h;
+
+	h = malloc(sizeof(*h));
+	if (!h)
+		return -ENOMEM;
+
+	memcpy(h, src, sizeof(*h));
+	*dst = h;
+	return 0;
 }
 
 int crypt_hash_write(struct crypt_hash *ctx, const char *buffer, size_t length)
@@ -268,13 +282,22 @@ int crypt_hash_write(struct crypt_hash *ctx, const char *buffer, size_t length)
 	return 0;
 }
 
+int crypt_hash_copy(struct crypt_hash *dst, struct crypt_hash *src)
+{
+	if (dst->hash != src->hash)
+		return -EINVAL;
+
+	memcpy(&dst->nettle_ctx, &src->nettle_ctx, sizeof(dst->nettle_ctx));
+	return 0;
+}
+
 int crypt_hash_final(struct crypt_hash *ctx, char *buffer, size_t length)
 {
 	if (length > (size_t)ctx->hash->length)
 		return -EINVAL;
 
 	ctx->hash->digest(&ctx->nettle_ctx, length, (uint8_t *)buffer);
-	crypt_hash_restart(ctx);
+	crypt_hash_reset(ctx);
 	return 0;
 }
 
@@ -323,9 +346,31 @@ int crypt_hmac_init(struct crypt_hmac **ctx, const char *name,
 	return 0;
 }
 
-static void crypt_hmac_restart(struct crypt_hmac *ctx)
+int crypt_hmac_reset(struct crypt_hmac *ctx)
 {
 	ctx->hash->hmac_set_key(&ctx->nettle_ctx, ctx->key_length, ctx->key);
+	return 0;
+}
+
+int crypt_hmac_clone(struct crypt_hmac **dst, struct crypt_hmac *src)
+{
+	struct crypt_hmac *h;
+
+	h = malloc(sizeof(*h));
+	if (!h)
+		return -ENOMEM;
+
+	memcpy(h, src, sizeof(*h));
+	h->key = malloc(src->key_length);
+	if (!h->key) {
+		memset(h, 0, sizeof(*h));
+		free(h);
+		return -ENOMEM;
+	}
+	memcpy(h->key, src->key, src->key_length);
+
+	*dst = h;
+	return 0;
 }
 
 int crypt_hmac_write(struct crypt_hmac *ctx, const char *buffer, size_t length)
@@ -340,7 +385,7 @@ int crypt_hmac_final(struct crypt_hmac *ctx, char *buffer, size_t length)
 		return -EINVAL;
 
 	ctx->hash->hmac_digest(&ctx->nettle_ctx, length, (uint8_t *)buffer);
-	crypt_hmac_restart(ctx);
+	crypt_hmac_reset(ctx);
 	return 0;
 }
 
@@ -362,11 +407,11 @@ int crypt_backend_rng(char *buffer __attribute__((unused)),
 }
 
 /* PBKDF */
-int crypt_pbkdf(const char *kdf, const char *hash,
-		const char *password, size_t password_length,
-		const char *salt, size_t salt_length,
-		char *key, size_t key_length,
-		uint32_t iterations, uint32_t memory, uint32_t parallel)
+int crypt_backend_pbkdf(const char *kdf, const char *hash,
+			const char *password, size_t password_length,
+			const char *salt, size_t salt_length,
+			char *key, size_t key_length,
+			uint32_t iterations, uint32_t memory, uint32_t parallel)
 {
 	struct crypt_hmac *h;
 	int r;
@@ -434,6 +479,24 @@ int crypt_cipher_decrypt(struct crypt_cipher *ctx,
 	return crypt_cipher_decrypt_kernel(&ctx->ck, in, out, length, iv, iv_length);
 }
 
+int crypt_cipher_encrypt_sectors(struct crypt_cipher *ctx,
+				 const char *in, char *out,
+				 size_t sector_size, size_t sectors,
+				 const char *iv, size_t iv_length)
+{
+	return crypt_cipher_encrypt_sectors_kernel(&ctx->ck, in, out, sector_size, sectors,
+						   iv, iv_length);
+}
+
+int crypt_cipher_decrypt_sectors(struct crypt_cipher *ctx,
+				 const char *in, char *out,
+				 size_t sector_size, size_t sectors,
+				 const char *iv, size_t iv_length)
+{
+	return crypt_cipher_decrypt_sectors_kernel(&ctx->ck, in, out, sector_size, sectors,
+						   iv, iv_length);
+}
+
 bool crypt_cipher_kernel_only(struct crypt_cipher *ctx __attribute__((unused)))
 {
 	return true;
@@ -150,7 +150,7 @@ int crypt_hash_init(struct crypt_hash **ctx, const char *name)
 	return 0;
 }
 
-static int crypt_hash_restart(struct crypt_hash *ctx)
+int crypt_hash_reset(struct crypt_hash *ctx)
 {
 	if (PK11_DigestBegin(ctx->md) != SECSuccess)
 		return -EINVAL;
@@ -158,6 +158,25 @@ static int crypt_hash_restart(struct crypt_hash *ctx)
 	return 0;
 }
 
+int crypt_hash_clone(struct crypt_hash **dst, struct crypt_hash *src)
+{
+	struct crypt_hash *h;
+
+	h = malloc(sizeof(*h));
+	if (!h)
+		return -ENOMEM;
+
+	h->hash = src->hash;
+	h->md = PK11_CloneContext(src->md);
+	if (!h->md) {
+		free(h);
+		return -EINVAL;
+	}
+
+	*dst = h;
+	return 0;
+}
+
 int crypt_hash_write(struct crypt_hash *ctx, const char *buffer, size_t length)
 {
 	if (PK11_DigestOp(ctx->md, CONST_CAST(unsigned char *)buffer, length) != SECSuccess)
@@ -166,6 +185,22 @@ int crypt_hash_write(struct crypt_hash *ctx, const char *buffer, size_t length)
 	return 0;
 }
 
+int crypt_hash_copy(struct crypt_hash *dst, struct crypt_hash *src)
+{
+	PK11Context *md;
+
+	if (dst->hash != src->hash)
+		return -EINVAL;
+
+	md = PK11_CloneContext(src->md);
+	if (!md)
+		return -EINVAL;
+
+	PK11_DestroyContext(dst->md, PR_TRUE);
+	dst->md = md;
+	return 0;
+}
+
 int crypt_hash_final(struct crypt_hash *ctx, char *buffer, size_t length)
 {
 	unsigned char tmp[64];
@@ -183,7 +218,7 @@ int crypt_hash_final(struct crypt_hash *ctx, char *buffer, size_t length)
 	if (tmp_len < length)
 		return -EINVAL;
 
-	if (crypt_hash_restart(ctx))
+	if (crypt_hash_reset(ctx))
 		return -EINVAL;
 
 	return 0;
@@ -251,7 +286,7 @@ err:
 	return -EINVAL;
 }
 
-static int crypt_hmac_restart(struct crypt_hmac *ctx)
+int crypt_hmac_reset(struct crypt_hmac *ctx)
 {
 	if (PK11_DigestBegin(ctx->md) != SECSuccess)
 		return -EINVAL;
@@ -259,6 +294,29 @@ static int crypt_hmac_restart(struct crypt_hmac *ctx)
 	return 0;
 }
 
+int crypt_hmac_clone(struct crypt_hmac **dst, struct crypt_hmac *src)
+{
+	struct crypt_hmac *h;
+
+	h = malloc(sizeof(*h));
+	if (!h)
+		return -ENOMEM;
+	memset(h, 0, sizeof(*h));
+
+	h->hash = src->hash;
+	h->slot = PK11_ReferenceSlot(src->slot);
+	h->key = PK11_ReferenceSymKey(src->key);
+	/* softoken cannot save MAC operation state */
+	h->md = PK11_CloneContext(src->md);
+	if (!h->md) {
+		crypt_hmac_destroy(h);
+		return -ENOTSUP;
+	}
+
+	*dst = h;
+	return 0;
+}
+
 int crypt_hmac_write(struct crypt_hmac *ctx, const char *buffer, size_t length)
 {
 	if (PK11_DigestOp(ctx->md, CONST_CAST(unsigned char *)buffer, length) != SECSuccess)
@@ -284,7 +342,7 @@ int crypt_hmac_final(struct crypt_hmac *ctx, char *buffer, size_t length)
 	if (tmp_len < length)
 		return -EINVAL;
 
-	if (crypt_hmac_restart(ctx))
+	if (crypt_hmac_reset(ctx))
 		return -EINVAL;
 
 	return 0;
@@ -315,11 +373,11 @@ int crypt_backend_rng(char *buffer, size_t length, int quality __attribute__((un
 }
 
 /* PBKDF */
-int crypt_pbkdf(const char *kdf, const char *hash,
-		const char *password, size_t password_length,
-		const char *salt, size_t salt_length,
-		char *key, size_t key_length,
-		uint32_t iterations, uint32_t memory, uint32_t parallel)
+int crypt_backend_pbkdf(const char *kdf, const char *hash,
+			const char *password, size_t password_length,
+			const char *salt, size_t salt_length,
+			char *key, size_t key_length,
+			uint32_t iterations, uint32_t memory, uint32_t parallel)
 {
 	struct hash_alg *ha;
 
@@ -382,6 +440,24 @@ int crypt_cipher_decrypt(struct crypt_cipher *ctx,
 	return crypt_cipher_decrypt_kernel(&ctx->ck, in, out, length, iv, iv_length);
 }
 
+int crypt_cipher_encrypt_sectors(struct crypt_cipher *ctx,
+				 const char *in, char *out,
+				 size_t sector_size, size_t sectors,
+				 const char *iv, size_t iv_length)
+{
+	return crypt_cipher_encrypt_sectors_kernel(&ctx->ck, in, out, sector_size, sectors,
+						   iv, iv_length);
+}
+
+int crypt_cipher_decrypt_sectors(struct crypt_cipher *ctx,
+				 const char *in, char *out,
+				 size_t sector_size, size_t sectors,
+				 const char *iv, size_t iv_length)
+{
+	return crypt_cipher_decrypt_sectors_kernel(&ctx->ck, in, out, sector_size, sectors,
+						   iv, iv_length);
+}
+
 bool crypt_cipher_kernel_only(struct crypt_cipher *ctx __attribute__((unused)))
 {
 	return true;
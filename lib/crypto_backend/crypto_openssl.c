@@ -37,6 +37,8 @@
 #include <openssl/rand.h>
 #include "crypto_backend_internal.h"
 #if OPENSSL_VERSION_MAJOR >= 3
+#include <pthread.h>
+#include <strings.h>
 #include <openssl/provider.h>
 #include <openssl/kdf.h>
 #include <openssl/core_names.h>
@@ -44,6 +46,21 @@ static OSSL_PROVIDER *ossl_legacy = NULL;
 static OSSL_PROVIDER *ossl_default = NULL;
 static OSSL_LIB_CTX  *ossl_ctx = NULL;
 static char backend_version[256] = "OpenSSL";
+
+/*
+ * Fetching algorithm in OpenSSL 3 takes provider store locks and is expensive,
+ * AF diffuse or verity hash a block with a new context many times.
+ * Fetched algorithms are cached by name and shared through reference count.
+ */
+enum alg_type { ALG_MD, ALG_CIPHER, ALG_MAC, ALG_KDF };
+
+#define ALG_CACHE_SIZE 32
+static struct alg_cache_entry {
+	enum alg_type type;
+	char name[64];
+	void *alg;
+} alg_cache[ALG_CACHE_SIZE];
+static pthread_mutex_t alg_cache_lock = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
 #define CONST_CAST(x) (x)(uintptr_t)
@@ -139,9 +156,94 @@ static void HMAC_CTX_free(HMAC_CTX *md)
 	free(md);
 }
 #else
+#if OPENSSL_VERSION_MAJOR >= 3
+static void *alg_fetch(enum alg_type type, const char *name)
+{
+	switch (type) {
+	case ALG_MD:	 return EVP_MD_fetch(ossl_ctx, name, NULL);
+	case ALG_CIPHER: return EVP_CIPHER_fetch(ossl_ctx, name, NULL);
+	case ALG_MAC:	 return EVP_MAC_fetch(ossl_ctx, name, NULL);
+	case ALG_KDF:	 return EVP_KDF_fetch(ossl_ctx, name, NULL);
+	}
+	return NULL;
+}
+
+static int alg_up_ref(enum alg_type type, void *alg)
+{
+	switch (type) {
+	case ALG_MD:	 return EVP_MD_up_ref(alg);
+	case ALG_CIPHER: return EVP_CIPHER_up_ref(alg);
+	case ALG_MAC:	 return EVP_MAC_up_ref(alg);
+	case ALG_KDF:	 return EVP_KDF_up_ref(alg);
+	}
+	return 0;
+}
+
+static void alg_free(enum alg_type type, void *alg)
+{
+	switch (type) {
+	case ALG_MD:	 EVP_MD_free(alg); break;
+	case ALG_CIPHER: EVP_CIPHER_free(alg); break;
+	case ALG_MAC:	 EVP_MAC_free(alg); break;
+	case ALG_KDF:	 EVP_KDF_free(alg); break;
+	}
+}
+
+/* Returns referenced algorithm, caller releases it with alg_free() */
+static void *alg_get(enum alg_type type, const char *name)
+{
+	struct alg_cache_entry *e, *free_e = NULL;
+	void *alg = NULL;
+	int i;
+
+	if (!name)
+		return NULL;
+
+	pthread_mutex_lock(&alg_cache_lock);
+	for (i = 0; i < ALG_CACHE_SIZE && !alg; i++) {
+		e = &alg_cache[i];
+		if (!e->alg) {
+			if (!free_e)
+				free_e = e;
+		} else if (e->type == type && !strcasecmp(e->name, name) && alg_up_ref(type, e->alg) == 1)
+			alg = e->alg;
+	}
+	if (alg) {
+		pthread_mutex_unlock(&alg_cache_lock);
+		return alg;
+	}
+
+	/* Unknown names are not cached, cache full or long name just means fetching again next time */
+	alg = alg_fetch(type, name);
+	if (alg && free_e && strlen(name) < sizeof(free_e->name) && alg_up_ref(type, alg) == 1) {
+		free_e->type = type;
+		strcpy(free_e->name, name);
+		free_e->alg = alg;
+	}
+	pthread_mutex_unlock(&alg_cache_lock);
+
+	return alg;
+}
+
+static void alg_cache_flush(void)
+{
+	int i;
+
+	pthread_mutex_lock(&alg_cache_lock);
+	for (i = 0; i < ALG_CACHE_SIZE; i++) {
+		if (alg_cache[i].alg)
+			alg_free(alg_cache[i].type, alg_cache[i].alg);
+		memset(&alg_cache[i], 0, sizeof(alg_cache[i]));
+	}
+	pthread_mutex_unlock(&alg_cache_lock);
+}
+#endif
+
 static void openssl_backend_exit(void)
 {
 #if OPENSSL_VERSION_MAJOR >= 3
+	alg_cache_flush();
+
 	if (ossl_legacy)
 		OSSL_PROVIDER_unload(ossl_legacy);
 	if (ossl_default)
@@ -271,12 +373,21 @@ static const char *crypt_hash_compat_name(const char *name)
 static const EVP_MD *hash_id_get(const char *name)
 {
 #if OPENSSL_VERSION_MAJOR >= 3
-	return EVP_MD_fetch(ossl_ctx, crypt_hash_compat_name(name), NULL);
+	return alg_get(ALG_MD, crypt_hash_compat_name(name));
 #else
 	return EVP_get_digestbyname(crypt_hash_compat_name(name));
 #endif
 }
 
+static int hash_id_ref(const EVP_MD *hash_id)
+{
+#if OPENSSL_VERSION_MAJOR >= 3
+	return EVP_MD_up_ref(CONST_CAST(EVP_MD*)hash_id) == 1 ? 0 : -EINVAL;
+#else
+	return 0;
+#endif
+}
+
 static void hash_id_free(const EVP_MD *hash_id)
 {
 #if OPENSSL_VERSION_MAJOR >= 3
@@ -287,7 +398,7 @@ static void hash_id_free(const EVP_MD *hash_id)
 static const EVP_CIPHER *cipher_type_get(const char *name)
 {
 #if OPENSSL_VERSION_MAJOR >= 3
-	return EVP_CIPHER_fetch(ossl_ctx, name, NULL);
+	return alg_get(ALG_CIPHER, name);
 #else
 	return EVP_get_cipherbyname(name);
 #endif
@@ -348,7 +459,7 @@ int crypt_hash_init(struct crypt_hash **ctx, const char *name)
 	return 0;
 }
 
-static int crypt_hash_restart(struct crypt_hash *ctx)
+int crypt_hash_reset(struct crypt_hash *ctx)
 {
 	if (EVP_DigestInit_ex(ctx->md, ctx->hash_id, NULL) != 1)
 		return -EINVAL;
@@ -356,6 +467,32 @@ static int crypt_hash_restart(struct crypt_hash *ctx)
 	return 0;
 }
 
+int crypt_hash_clone(struct crypt_hash **dst, struct crypt_hash *src)
+{
+	struct crypt_hash *h;
+
+	h = malloc(sizeof(*h));
+	if (!h)
+		return -ENOMEM;
+
+	h->md = EVP_MD_CTX_new();
+	if (!h->md) {
+		free(h);
+		return -ENOMEM;
+	}
+
+	if (EVP_MD_CTX_copy_ex(h->md, src->md) != 1 || hash_id_ref(src->hash_id)) {
+		EVP_MD_CTX_free(h->md);
+		free(h);
+		return -EINVAL;
+	}
+
+	h->hash_id = src->hash_id;
+	h->hash_len = src->hash_len;
+	*dst = h;
+	return 0;
+}
+
 int crypt_hash_write(struct crypt_hash *ctx, const char *buffer, size_t length)
 {
 	if (EVP_DigestUpdate(ctx->md, buffer, length) != 1)
@@ -364,6 +501,17 @@ int crypt_hash_write(struct crypt_hash *ctx, const char *buffer, size_t length)
 	return 0;
 }
 
+int crypt_hash_copy(struct crypt_hash *dst, struct crypt_hash *src)
+{
+	if (dst->hash_id != src->hash_id && EVP_MD_type(dst->hash_id) != EVP_MD_type(src->hash_id))
+		return -EINVAL;
+
+	if (EVP_MD_CTX_copy_ex(dst->md, src->md) != 1)
+		return -EINVAL;
+
+	return 0;
+}
+
 int crypt_hash_final(struct crypt_hash *ctx, char *buffer, size_t length)
 {
 	unsigned char tmp[EVP_MAX_MD_SIZE];
@@ -381,7 +529,7 @@ int crypt_hash_final(struct crypt_hash *ctx, char *buffer, size_t length)
 	if (tmp_len < length)
 		return -EINVAL;
 
-	if (crypt_hash_restart(ctx))
+	if (crypt_hash_reset(ctx))
 		return -EINVAL;
 
 	return 0;
@@ -415,7 +563,7 @@ int crypt_hmac_init(struct crypt_hmac **ctx, const char *name,
 	if (!h)
 		return -ENOMEM;
 
-	h->mac = EVP_MAC_fetch(ossl_ctx, OSSL_MAC_NAME_HMAC, NULL);
+	h->mac = alg_get(ALG_MAC, OSSL_MAC_NAME_HMAC);
 	if (!h->mac) {
 		free(h);
 		return -EINVAL;
@@ -463,9 +611,13 @@ int crypt_hmac_init(struct crypt_hmac **ctx, const char *name,
 	return 0;
 }
 
-static int crypt_hmac_restart(struct crypt_hmac *ctx)
+int crypt_hmac_reset(struct crypt_hmac *ctx)
 {
 #if OPENSSL_VERSION_MAJOR >= 3
+	/* HMAC provider reinitializes context with the previous key if key is NULL */
+	if (EVP_MAC_init(ctx->md, NULL, 0, NULL) == 1)
+		return 0;
+
 	EVP_MAC_CTX_free(ctx->md);
 	ctx->md = EVP_MAC_CTX_dup(ctx->md_org);
 	if (!ctx->md)
@@ -511,12 +663,49 @@ int crypt_hmac_final(struct crypt_hmac *ctx, char *buffer, size_t length)
 	if (tmp_len < length)
 		return -EINVAL;
 
-	if (crypt_hmac_restart(ctx))
+	if (crypt_hmac_reset(ctx))
 		return -EINVAL;
 
 	return 0;
 }
 
+int crypt_hmac_clone(struct crypt_hmac **dst, struct crypt_hmac *src)
+{
+	struct crypt_hmac *h;
+
+	h = malloc(sizeof(*h));
+	if (!h)
+		return -ENOMEM;
+	memset(h, 0, sizeof(*h));
+	h->hash_len = src->hash_len;
+#if OPENSSL_VERSION_MAJOR >= 3
+	if (EVP_MAC_up_ref(src->mac) != 1) {
+		free(h);
+		return -EINVAL;
+	}
+	h->mac = src->mac;
+	h->md = EVP_MAC_CTX_dup(src->md);
+	h->md_org = src->md_org ? EVP_MAC_CTX_dup(src->md_org) : NULL;
+	if (!h->md || (src->md_org && !h->md_org)) {
+		crypt_hmac_destroy(h);
+		return -EINVAL;
+	}
+#else
+	h->hash_id = src->hash_id;
+	h->md = HMAC_CTX_new();
+	if (!h->md) {
+		free(h);
+		return -ENOMEM;
+	}
+	if (HMAC_CTX_copy(h->md, src->md) != 1) {
+		crypt_hmac_destroy(h);
+		return -EINVAL;
+	}
+#endif
+	*dst = h;
+	return 0;
+}
+
 void crypt_hmac_destroy(struct crypt_hmac *ctx)
 {
 #if OPENSSL_VERSION_MAJOR >= 3
@@ -560,7 +749,7 @@ static int openssl_pbkdf2(const char *password, size_t password_length,
 		OSSL_PARAM_END
 	};
 
-	pbkdf2 = EVP_KDF_fetch(ossl_ctx, "pbkdf2", NULL);
+	pbkdf2 = alg_get(ALG_KDF, OSSL_KDF_NAME_PBKDF2);
 	if (!pbkdf2)
 		return -EINVAL;
 
@@ -598,11 +787,11 @@ static int openssl_argon2(const char *type, const char *password, size_t passwor
 }
 
 /* PBKDF */
-int crypt_pbkdf(const char *kdf, const char *hash,
-		const char *password, size_t password_length,
-		const char *salt, size_t salt_length,
-		char *key, size_t key_length,
-		uint32_t iterations, uint32_t memory, uint32_t parallel)
+int crypt_backend_pbkdf(const char *kdf, const char *hash,
+			const char *password, size_t password_length,
+			const char *salt, size_t salt_length,
+			char *key, size_t key_length,
+			uint32_t iterations, uint32_t memory, uint32_t parallel)
 {
 	if (!kdf)
 		return -EINVAL;
@@ -778,6 +967,52 @@ int crypt_cipher_decrypt(struct crypt_cipher *ctx,
 			       (unsigned char *)out, length, (const unsigned char*)iv, iv_length);
 }
 
+int crypt_cipher_encrypt_sectors(struct crypt_cipher *ctx,
+				 const char *in, char *out,
+				 size_t sector_size, size_t sectors,
+				 const char *iv, size_t iv_length)
+{
+	size_t i;
+	int r;
+
+	if (ctx->use_kernel)
+		return crypt_cipher_encrypt_sectors_kernel(&ctx->u.kernel, in, out, sector_size,
+							   sectors, iv, iv_length);
+
+	for (i = 0; i < sectors; i++) {
+		r = _cipher_encrypt(ctx, (const unsigned char*)&in[i * sector_size],
+				    (unsigned char *)&out[i * sector_size], sector_size,
+				    iv ? (const unsigned char*)&iv[i * iv_length] : NULL, iv_length);
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+
+int crypt_cipher_decrypt_sectors(struct crypt_cipher *ctx,
+				 const char *in, char *out,
+				 size_t sector_size, size_t sectors,
+				 const char *iv, size_t iv_length)
+{
+	size_t i;
+	int r;
+
+	if (ctx->use_kernel)
+		return crypt_cipher_decrypt_sectors_kernel(&ctx->u.kernel, in, out, sector_size,
+							   sectors, iv, iv_length);
+
+	for (i = 0; i < sectors; i++) {
+		r = _cipher_decrypt(ctx, (const unsigned char*)&in[i * sector_size],
+				    (unsigned char *)&out[i * sector_size], sector_size,
+				    iv ? (const unsigned char*)&iv[i * iv_length] : NULL, iv_length);
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+
 bool crypt_cipher_kernel_only(struct crypt_cipher *ctx)
 {
 	return ctx->use_kernel;
@@ -23,20 +23,36 @@
 #include <errno.h>
 #include <strings.h>
 #include "bitops.h"
-#include "crypto_backend.h"
+#include "crypto_backend_internal.h"
 
 #define SECTOR_SHIFT	9
 
+/* Maximal number of sectors (and IVs) passed to cipher backend in one call */
+#define SECTORS_PER_BATCH 256
+
+/* loop-AES compatible LMK IV (MD5 state without final padding) */
+#define LMK_IV_SIZE	16
+#define LMK_SEED_SIZE	64
+
 /*
  * Internal IV helper
  * IV documentation: https://gitlab.com/cryptsetup/cryptsetup/wikis/DMCrypt
  */
 struct crypt_sector_iv {
-	enum { IV_NONE, IV_NULL, IV_PLAIN, IV_PLAIN64, IV_ESSIV, IV_BENBI, IV_PLAIN64BE, IV_EBOIV } type;
+	enum { IV_NONE, IV_NULL, IV_PLAIN, IV_PLAIN64, IV_ESSIV, IV_BENBI, IV_PLAIN64BE, IV_EBOIV, IV_LMK } type;
 	int iv_size;
-	char *iv;
 	struct crypt_cipher *cipher;
 	int shift;
+	bool lmk_seed;
+	uint8_t seed[LMK_SEED_SIZE];
+	int (*run)(struct crypt_sector_iv *ctx, uint64_t sector,
+		   unsigned step, size_t sectors, char *ivs);
+};
+
+/* One of multiple keys (dm-crypt "cipher:keycount" spec), selected by sector number */
+struct crypt_storage_key {
+	struct crypt_cipher *cipher;
+	struct crypt_aes_native *aes;
 };
 
 /* Block encryption storage context */
@@ -44,9 +60,111 @@ struct crypt_storage {
 	size_t sector_size;
 	unsigned iv_shift;
 	struct crypt_cipher *cipher;
+	struct crypt_aes_native *aes;
 	struct crypt_sector_iv cipher_iv;
+	char *iv_batch;
+	/* multi-key or LMK mode, all key schedules are kept expanded */
+	unsigned keys_count;
+	struct crypt_storage_key *keys;
+};
+
+static const uint32_t md5_k[64] = {
+	0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
+	0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+	0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
+	0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+	0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
+	0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+	0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
+	0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+	0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
+	0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+	0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
+	0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+	0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
+	0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+	0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
+	0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const uint8_t md5_r[64] = {
+	7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+	5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+	4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+	6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
 };
 
+/* MD5 compression of one 64 bytes block, crypto backends do not export it */
+static void md5_block(uint32_t s[4], const uint8_t *block)
+{
+	uint32_t m[16], a = s[0], b = s[1], c = s[2], d = s[3], f, t;
+	int i, g;
+
+	for (i = 0; i < 16; i++)
+		m[i] = (uint32_t)block[4 * i] | (uint32_t)block[4 * i + 1] << 8 |
+		       (uint32_t)block[4 * i + 2] << 16 | (uint32_t)block[4 * i + 3] << 24;
+
+	for (i = 0; i < 64; i++) {
+		if (i < 16) {
+			f = (b & c) | (~b & d);
+			g = i;
+		} else if (i < 32) {
+			f = (d & b) | (~d & c);
+			g = (5 * i + 1) & 15;
+		} else if (i < 48) {
+			f = b ^ c ^ d;
+			g = (3 * i + 5) & 15;
+		} else {
+			f = c ^ (b | ~d);
+			g = (7 * i) & 15;
+		}
+		t = a + f + md5_k[i] + m[g];
+		a = d;
+		d = c;
+		c = b;
+		b += (t << md5_r[i]) | (t >> (32 - md5_r[i]));
+	}
+
+	s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+}
+
+/*
+ * LMK IV of 512 bytes sector: MD5 over optional seed, plaintext blocks 1-31
+ * and the sector number, exactly 8 (9 with seed) blocks, so no padding.
+ */
+static void crypt_sector_iv_lmk(struct crypt_sector_iv *ctx, uint64_t sector,
+				const char *data, char *iv)
+{
+	uint32_t s[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 }, v;
+	uint8_t last[64];
+	int i;
+
+	if (ctx->lmk_seed)
+		md5_block(s, ctx->seed);
+
+	for (i = 0; i < 7; i++)
+		md5_block(s, (const uint8_t *)data + 16 + 64 * i);
+
+	memcpy(last, data + 16 + 64 * 7, 48);
+	/* sector is cropped to 56 bits */
+	v = cpu_to_le32(sector & 0xFFFFFFFF);
+	memcpy(&last[48], &v, 4);
+	v = cpu_to_le32(((sector >> 32) & 0x00FFFFFF) | 0x80000000);
+	memcpy(&last[52], &v, 4);
+	v = cpu_to_le32(4024);
+	memcpy(&last[56], &v, 4);
+	memset(&last[60], 0, 4);
+	md5_block(s, last);
+
+	for (i = 0; i < 4; i++) {
+		v = cpu_to_le32(s[i]);
+		memcpy(iv + 4 * i, &v, 4);
+	}
+
+	crypt_backend_memzero(last, sizeof(last));
+	crypt_backend_memzero(s, sizeof(s));
+}
+
 static int int_log2(unsigned int x)
 {
 	int r = 0;
@@ -65,6 +183,9 @@ static int crypt_sector_iv_init(struct crypt_sector_iv *ctx,
 	memset(ctx, 0, sizeof(*ctx));
 
 	ctx->iv_size = crypt_cipher_ivsize(cipher_name, mode_name);
+	/* cipher not in library table, kernel instantiated it when cipher was initialized */
+	if (ctx->iv_size < 0)
+		ctx->iv_size = crypt_cipher_ivsize_kernel(cipher_name, mode_name);
 	if (ctx->iv_size < 0 || (strcmp(mode_name, "ecb") && ctx->iv_size < 8))
 		return -ENOENT;
 
@@ -139,67 +260,143 @@ static int crypt_sector_iv_init(struct crypt_sector_iv *ctx,
 
 		ctx->type = IV_EBOIV;
 		ctx->shift = int_log2(sector_size);
+	} else if (!strcasecmp(iv_name, "lmk")) {
+		if (ctx->iv_size != LMK_IV_SIZE || sector_size != (1 << SECTOR_SHIFT))
+			return -EINVAL;
+		/* seed (key after all cipher keys) is set by crypt_storage_init */
+		ctx->type = IV_LMK;
 	} else
 		return -ENOENT;
 
-	ctx->iv = malloc(ctx->iv_size);
-	if (!ctx->iv)
-		return -ENOMEM;
+	return 0;
+}
+
+/*
+ * Fill IVs for a run of sectors, sector numbers start at sector
+ * and are incremented by step.
+ *
+ * Counter based IVs are written directly to the zeroed IV array,
+ * only the per-sector store remains in the loop. Every IV type is
+ * instantiated for step 1 (512 bytes or large IV sectors), step 8
+ * (4096 bytes sectors with 512 bytes IV) and a runtime step, so with
+ * the constant ones the sector loop has no multiplication by a variable.
+ * The variant is selected once by crypt_sector_iv_select().
+ */
+typedef int (*crypt_sector_iv_run_fn)(struct crypt_sector_iv *ctx, uint64_t sector,
+				      unsigned step, size_t sectors, char *ivs);
+
+enum { IV_STEP_1 = 0, IV_STEP_8, IV_STEP_ANY, IV_STEP_VARIANTS };
+
+#define IV_RUN_PLAIN(ctx, s)		cpu_to_le32((s) & 0xffffffff)
+#define IV_RUN_PLAIN64(ctx, s)		cpu_to_le64(s)
+#define IV_RUN_PLAIN64BE(ctx, s)	cpu_to_be64(s)
+#define IV_RUN_BENBI(ctx, s)		cpu_to_be64(((s) << (ctx)->shift) + 1)
+#define IV_RUN_EBOIV(ctx, s)		cpu_to_le64((s) << (ctx)->shift)
+
+/* IV is one cipher block, so encrypt all sector numbers of the run in a single ECB call */
+#define IV_RUN_STORE_ONLY(ctx, ivs, len)	0
+#define IV_RUN_ENCRYPT(ctx, ivs, len)		crypt_cipher_encrypt((ctx)->cipher, ivs, ivs, len, NULL, 0)
+
+#define IV_RUN_DEFINE(name, type, value, at_end, finish)				\
+static inline __attribute__((always_inline))						\
+int iv_run_##name(struct crypt_sector_iv *ctx, uint64_t sector,				\
+		  unsigned step, size_t sectors, char *ivs)				\
+{											\
+	size_t i, iv_size = ctx->iv_size;						\
+	type val;									\
+	char *p;									\
+											\
+	memset(ivs, 0, sectors * iv_size);						\
+	for (i = 0, p = ivs + (at_end ? iv_size - sizeof(val) : 0);			\
+	     i < sectors; i++, p += iv_size) {						\
+		val = value(ctx, sector + i * step);					\
+		memcpy(p, &val, sizeof(val));						\
+	}										\
+	return finish(ctx, ivs, sectors * iv_size);					\
+}											\
+static int iv_run_##name##_1(struct crypt_sector_iv *ctx, uint64_t sector,		\
+			     unsigned step __attribute__((unused)),			\
+			     size_t sectors, char *ivs)					\
+{											\
+	return iv_run_##name(ctx, sector, 1, sectors, ivs);				\
+}											\
+static int iv_run_##name##_8(struct crypt_sector_iv *ctx, uint64_t sector,		\
+			     unsigned step __attribute__((unused)),			\
+			     size_t sectors, char *ivs)					\
+{											\
+	return iv_run_##name(ctx, sector, 8, sectors, ivs);				\
+}											\
+static int iv_run_##name##_any(struct crypt_sector_iv *ctx, uint64_t sector,		\
+			       unsigned step, size_t sectors, char *ivs)		\
+{											\
+	return iv_run_##name(ctx, sector, step, sectors, ivs);				\
+}
+
+IV_RUN_DEFINE(plain, uint32_t, IV_RUN_PLAIN, false, IV_RUN_STORE_ONLY)
+IV_RUN_DEFINE(plain64, uint64_t, IV_RUN_PLAIN64, false, IV_RUN_STORE_ONLY)
+IV_RUN_DEFINE(plain64be, uint64_t, IV_RUN_PLAIN64BE, true, IV_RUN_STORE_ONLY)
+IV_RUN_DEFINE(benbi, uint64_t, IV_RUN_BENBI, true, IV_RUN_STORE_ONLY)
+IV_RUN_DEFINE(essiv, uint64_t, IV_RUN_PLAIN64, false, IV_RUN_ENCRYPT)
+IV_RUN_DEFINE(eboiv, uint64_t, IV_RUN_EBOIV, false, IV_RUN_ENCRYPT)
 
+#define IV_RUN_VARIANTS(name) { iv_run_##name##_1, iv_run_##name##_8, iv_run_##name##_any }
+
+static int iv_run_none(struct crypt_sector_iv *ctx __attribute__((unused)),
+		       uint64_t sector __attribute__((unused)),
+		       unsigned step __attribute__((unused)),
+		       size_t sectors __attribute__((unused)),
+		       char *ivs __attribute__((unused)))
+{
+	return 0;
+}
+
+static int iv_run_null(struct crypt_sector_iv *ctx, uint64_t sector __attribute__((unused)),
+		       unsigned step __attribute__((unused)), size_t sectors, char *ivs)
+{
+	memset(ivs, 0, sectors * ctx->iv_size);
 	return 0;
 }
 
-static int crypt_sector_iv_generate(struct crypt_sector_iv *ctx, uint64_t sector)
+static int iv_run_invalid(struct crypt_sector_iv *ctx __attribute__((unused)),
+			  uint64_t sector __attribute__((unused)),
+			  unsigned step __attribute__((unused)),
+			  size_t sectors __attribute__((unused)),
+			  char *ivs __attribute__((unused)))
+{
+	return -EINVAL;
+}
+
+static void crypt_sector_iv_select(struct crypt_sector_iv *ctx, unsigned step)
 {
-	uint64_t val, *u64_iv;
-	uint32_t *u32_iv;
+	static const crypt_sector_iv_run_fn runs[][IV_STEP_VARIANTS] = {
+		[IV_PLAIN]	= IV_RUN_VARIANTS(plain),
+		[IV_PLAIN64]	= IV_RUN_VARIANTS(plain64),
+		[IV_PLAIN64BE]	= IV_RUN_VARIANTS(plain64be),
+		[IV_BENBI]	= IV_RUN_VARIANTS(benbi),
+		[IV_ESSIV]	= IV_RUN_VARIANTS(essiv),
+		[IV_EBOIV]	= IV_RUN_VARIANTS(eboiv),
+	};
+	unsigned variant = step == 1 ? IV_STEP_1 : step == 8 ? IV_STEP_8 : IV_STEP_ANY;
 
 	switch (ctx->type) {
 	case IV_NONE:
+		ctx->run = iv_run_none;
 		break;
 	case IV_NULL:
-		memset(ctx->iv, 0, ctx->iv_size);
+		ctx->run = iv_run_null;
 		break;
 	case IV_PLAIN:
-		memset(ctx->iv, 0, ctx->iv_size);
-		u32_iv = (void *)ctx->iv;
-		*u32_iv = cpu_to_le32(sector & 0xffffffff);
-		break;
 	case IV_PLAIN64:
-		memset(ctx->iv, 0, ctx->iv_size);
-		u64_iv = (void *)ctx->iv;
-		*u64_iv = cpu_to_le64(sector);
-		break;
 	case IV_PLAIN64BE:
-		memset(ctx->iv, 0, ctx->iv_size);
-		/* iv_size is at least of size u64; usually it is 16 bytes */
-		u64_iv = (void *)&ctx->iv[ctx->iv_size - sizeof(uint64_t)];
-		*u64_iv = cpu_to_be64(sector);
-		break;
-	case IV_ESSIV:
-		memset(ctx->iv, 0, ctx->iv_size);
-		u64_iv = (void *)ctx->iv;
-		*u64_iv = cpu_to_le64(sector);
-		return crypt_cipher_encrypt(ctx->cipher,
-			ctx->iv, ctx->iv, ctx->iv_size, NULL, 0);
-		break;
 	case IV_BENBI:
-		memset(ctx->iv, 0, ctx->iv_size);
-		val = cpu_to_be64((sector << ctx->shift) + 1);
-		memcpy(ctx->iv + ctx->iv_size - sizeof(val), &val, sizeof(val));
-		break;
+	case IV_ESSIV:
 	case IV_EBOIV:
-		memset(ctx->iv, 0, ctx->iv_size);
-		u64_iv = (void *)ctx->iv;
-		*u64_iv = cpu_to_le64(sector << ctx->shift);
-		return crypt_cipher_encrypt(ctx->cipher,
-			ctx->iv, ctx->iv, ctx->iv_size, NULL, 0);
+		ctx->run = runs[ctx->type][variant];
 		break;
 	default:
-		return -EINVAL;
+		/* LMK IV depends on sector data, it is generated per sector */
+		ctx->run = iv_run_invalid;
 	}
-
-	return 0;
 }
 
 static void crypt_sector_iv_destroy(struct crypt_sector_iv *ctx)
@@ -207,12 +404,52 @@ static void crypt_sector_iv_destroy(struct crypt_sector_iv *ctx)
 	if (ctx->type == IV_ESSIV || ctx->type == IV_EBOIV)
 		crypt_cipher_destroy(ctx->cipher);
 
-	if (ctx->iv) {
-		memset(ctx->iv, 0, ctx->iv_size);
-		free(ctx->iv);
+	crypt_backend_memzero(ctx, sizeof(*ctx));
+}
+
+/*
+ * Multiple keys (loop-AES "aes:64-cbc-lmk"), key is split to keys_count parts
+ * (plus LMK seed if it does not divide), 512 bytes sector number selects the part.
+ */
+static int crypt_storage_keys_init(struct crypt_storage *s, unsigned keys_count,
+				   const char *cipher, const char *mode_name,
+				   const char *key, size_t key_length)
+{
+	size_t subkey_length = key_length / keys_count, seed_length = 0;
+	unsigned i;
+	int r;
+
+	if (keys_count & (keys_count - 1) || s->sector_size != (1 << SECTOR_SHIFT))
+		return -EINVAL;
+
+	if (key_length % keys_count) {
+		if (s->cipher_iv.type != IV_LMK || key_length % (keys_count + 1))
+			return -EINVAL;
+		subkey_length = seed_length = key_length / (keys_count + 1);
+		if (seed_length < LMK_IV_SIZE)
+			return -EINVAL;
 	}
 
-	memset(ctx, 0, sizeof(*ctx));
+	s->keys = calloc(keys_count, sizeof(*s->keys));
+	if (!s->keys)
+		return -ENOMEM;
+	s->keys_count = keys_count;
+
+	for (i = 0; i < keys_count; i++, key += subkey_length) {
+		if (crypt_aes_native_init(&s->keys[i].aes, cipher, mode_name, key, subkey_length)) {
+			r = crypt_cipher_init(&s->keys[i].cipher, cipher, mode_name, key, subkey_length);
+			if (r)
+				return r;
+		}
+	}
+
+	/* seed is MD5 size prefix of the extra key, zero padded */
+	if (seed_length) {
+		memcpy(s->cipher_iv.seed, key, LMK_IV_SIZE);
+		s->cipher_iv.lmk_seed = true;
+	}
+
+	return 0;
 }
 
 /* Block encryption storage wrappers */
@@ -225,8 +462,9 @@ int crypt_storage_init(struct crypt_storage **ctx,
 		       bool large_iv)
 {
 	struct crypt_storage *s;
-	char mode_name[64];
-	char *cipher_iv = NULL;
+	char mode_name[64], cipher_name[64];
+	char *cipher_iv = NULL, *keys_str;
+	unsigned keys_count = 1;
 	int r = -EIO;
 
 	if (sector_size < (1 << SECTOR_SHIFT) ||
@@ -248,7 +486,43 @@ int crypt_storage_init(struct crypt_storage **ctx,
 		cipher_iv++;
 	}
 
-	r = crypt_cipher_init(&s->cipher, cipher, mode_name, key, key_length);
+	/* Remove key count if present */
+	strncpy(cipher_name, cipher, sizeof(cipher_name));
+	cipher_name[sizeof(cipher_name) - 1] = 0;
+	keys_str = strchr(cipher_name, ':');
+	if (keys_str) {
+		*keys_str++ = '\0';
+		keys_count = atoi(keys_str);
+		if (!keys_count) {
+			crypt_storage_destroy(s);
+			return -EINVAL;
+		}
+	}
+	cipher = cipher_name;
+
+	if (keys_count > 1 || (cipher_iv && !strcasecmp(cipher_iv, "lmk"))) {
+		s->sector_size = sector_size;
+		r = crypt_sector_iv_init(&s->cipher_iv, cipher, mode_name, cipher_iv,
+					 key, key_length, sector_size);
+		if (!r)
+			r = crypt_storage_keys_init(s, keys_count, cipher, mode_name,
+						    key, key_length);
+		if (!r)
+			crypt_sector_iv_select(&s->cipher_iv, 1);
+		if (r) {
+			crypt_storage_destroy(s);
+			return r;
+		}
+
+		*ctx = s;
+		return 0;
+	}
+
+	/* Prefer AES CPU instructions directly, for kernel-only backends it also avoids AF_ALG */
+	if (!cipher_iv || crypt_aes_native_init(&s->aes, cipher, mode_name, key, key_length))
+		r = crypt_cipher_init(&s->cipher, cipher, mode_name, key, key_length);
+	else
+		r = 0;
 	if (r) {
 		crypt_storage_destroy(s);
 		return r;
@@ -260,48 +534,87 @@ int crypt_storage_init(struct crypt_storage **ctx,
 		return r;
 	}
 
+	if (s->cipher_iv.iv_size) {
+		s->iv_batch = malloc(SECTORS_PER_BATCH * s->cipher_iv.iv_size);
+		if (!s->iv_batch) {
+			crypt_storage_destroy(s);
+			return -ENOMEM;
+		}
+	}
+
 	s->sector_size = sector_size;
 	s->iv_shift = large_iv ? int_log2(sector_size) - SECTOR_SHIFT : 0;
+	crypt_sector_iv_select(&s->cipher_iv, (sector_size >> SECTOR_SHIFT) >> s->iv_shift);
 
 	*ctx = s;
 	return 0;
 }
 
-int crypt_storage_decrypt(struct crypt_storage *ctx,
-		       uint64_t iv_offset,
-		       uint64_t length, char *buffer)
+static int crypt_storage_key_crypt(struct crypt_storage_key *k, char *sector, size_t sector_size,
+				   const char *iv, size_t iv_size, bool encrypt)
 {
-	uint64_t i;
-	int r = 0;
+	if (k->aes && encrypt)
+		return crypt_aes_native_encrypt_sectors(k->aes, sector, sector, sector_size, 1, iv, iv_size);
+	if (k->aes)
+		return crypt_aes_native_decrypt_sectors(k->aes, sector, sector, sector_size, 1, iv, iv_size);
+	if (encrypt)
+		return crypt_cipher_encrypt_sectors(k->cipher, sector, sector, sector_size, 1, iv, iv_size);
+	return crypt_cipher_decrypt_sectors(k->cipher, sector, sector, sector_size, 1, iv, iv_size);
+}
 
-	if (length & (ctx->sector_size - 1))
-		return -EINVAL;
+/*
+ * Sectors are processed grouped by key, the key schedule is switched only
+ * keys_count times per call. LMK IV on decryption is applied after decrypting
+ * with zero IV, only the first cipher block depends on it in CBC mode.
+ */
+static int crypt_storage_crypt_keys(struct crypt_storage *ctx, uint64_t iv_offset,
+				    uint64_t length, char *buffer, bool encrypt)
+{
+	uint64_t sector, sectors = length >> SECTOR_SHIFT;
+	unsigned key, mask = ctx->keys_count - 1;
+	size_t i, j, iv_size = ctx->cipher_iv.iv_size;
+	char iv[64], *p;
+	int r = 0;
 
-	if (iv_offset & ((ctx->sector_size >> SECTOR_SHIFT) - 1))
+	if (iv_size > sizeof(iv))
 		return -EINVAL;
 
-	for (i = 0; i < length; i += ctx->sector_size) {
-		r = crypt_sector_iv_generate(&ctx->cipher_iv, (iv_offset + (i >> SECTOR_SHIFT)) >> ctx->iv_shift);
-		if (r)
-			break;
-		r = crypt_cipher_decrypt(ctx->cipher,
-					 &buffer[i],
-					 &buffer[i],
-					 ctx->sector_size,
-					 ctx->cipher_iv.iv,
-					 ctx->cipher_iv.iv_size);
-		if (r)
-			break;
+	for (key = 0; key < ctx->keys_count && !r; key++) {
+		for (i = (key - iv_offset) & mask; i < sectors && !r; i += ctx->keys_count) {
+			sector = iv_offset + i;
+			p = &buffer[i << SECTOR_SHIFT];
+			if (ctx->cipher_iv.type != IV_LMK) {
+				r = ctx->cipher_iv.run(&ctx->cipher_iv, sector, 1, 1, iv);
+				if (!r)
+					r = crypt_storage_key_crypt(&ctx->keys[key], p, ctx->sector_size,
+								    iv, iv_size, encrypt);
+			} else if (encrypt) {
+				crypt_sector_iv_lmk(&ctx->cipher_iv, sector, p, iv);
+				r = crypt_storage_key_crypt(&ctx->keys[key], p, ctx->sector_size,
+							    iv, iv_size, true);
+			} else {
+				memset(iv, 0, iv_size);
+				r = crypt_storage_key_crypt(&ctx->keys[key], p, ctx->sector_size,
+							    iv, iv_size, false);
+				if (r)
+					break;
+				crypt_sector_iv_lmk(&ctx->cipher_iv, sector, p, iv);
+				for (j = 0; j < LMK_IV_SIZE; j++)
+					p[j] ^= iv[j];
+			}
+		}
 	}
 
+	crypt_backend_memzero(iv, sizeof(iv));
 	return r;
 }
 
-int crypt_storage_encrypt(struct crypt_storage *ctx,
-		       uint64_t iv_offset,
-		       uint64_t length, char *buffer)
+static int crypt_storage_crypt(struct crypt_storage *ctx, uint64_t iv_offset,
+			       uint64_t length, char *buffer, bool encrypt)
 {
-	uint64_t i;
+	uint64_t i, sectors;
+	unsigned step;
+	char *ivs;
 	int r = 0;
 
 	if (length & (ctx->sector_size - 1))
@@ -310,16 +623,39 @@ int crypt_storage_encrypt(struct crypt_storage *ctx,
 	if (iv_offset & ((ctx->sector_size >> SECTOR_SHIFT) - 1))
 		return -EINVAL;
 
-	for (i = 0; i < length; i += ctx->sector_size) {
-		r = crypt_sector_iv_generate(&ctx->cipher_iv, (iv_offset + (i >> SECTOR_SHIFT)) >> ctx->iv_shift);
+	if (ctx->keys)
+		return crypt_storage_crypt_keys(ctx, iv_offset, length, buffer, encrypt);
+
+	ivs = ctx->cipher_iv.iv_size ? ctx->iv_batch : NULL;
+	step = (ctx->sector_size >> SECTOR_SHIFT) >> ctx->iv_shift;
+
+	for (i = 0; i < length; i += sectors * ctx->sector_size) {
+		sectors = (length - i) / ctx->sector_size;
+		if (sectors > SECTORS_PER_BATCH)
+			sectors = SECTORS_PER_BATCH;
+
+		r = ctx->cipher_iv.run(&ctx->cipher_iv,
+				       (iv_offset + (i >> SECTOR_SHIFT)) >> ctx->iv_shift,
+				       step, sectors, ivs);
 		if (r)
 			break;
-		r = crypt_cipher_encrypt(ctx->cipher,
-					 &buffer[i],
-					 &buffer[i],
-					 ctx->sector_size,
-					 ctx->cipher_iv.iv,
-					 ctx->cipher_iv.iv_size);
+
+		if (ctx->aes && encrypt)
+			r = crypt_aes_native_encrypt_sectors(ctx->aes, &buffer[i], &buffer[i],
+							     ctx->sector_size, sectors,
+							     ivs, ctx->cipher_iv.iv_size);
+		else if (ctx->aes)
+			r = crypt_aes_native_decrypt_sectors(ctx->aes, &buffer[i], &buffer[i],
+							     ctx->sector_size, sectors,
+							     ivs, ctx->cipher_iv.iv_size);
+		else if (encrypt)
+			r = crypt_cipher_encrypt_sectors(ctx->cipher, &buffer[i], &buffer[i],
+							 ctx->sector_size, sectors,
+							 ivs, ctx->cipher_iv.iv_size);
+		else
+			r = crypt_cipher_decrypt_sectors(ctx->cipher, &buffer[i], &buffer[i],
+							 ctx->sector_size, sectors,
+							 ivs, ctx->cipher_iv.iv_size);
 		if (r)
 			break;
 	}
@@ -327,21 +663,57 @@ int crypt_storage_encrypt(struct crypt_storage *ctx,
 	return r;
 }
 
+int crypt_storage_decrypt(struct crypt_storage *ctx,
+		       uint64_t iv_offset,
+		       uint64_t length, char *buffer)
+{
+	return crypt_storage_crypt(ctx, iv_offset, length, buffer, false);
+}
+
+int crypt_storage_encrypt(struct crypt_storage *ctx,
+		       uint64_t iv_offset,
+		       uint64_t length, char *buffer)
+{
+	return crypt_storage_crypt(ctx, iv_offset, length, buffer, true);
+}
+
 void crypt_storage_destroy(struct crypt_storage *ctx)
 {
+	unsigned i;
+
 	if (!ctx)
 		return;
 
+	if (ctx->iv_batch) {
+		crypt_backend_memzero(ctx->iv_batch, SECTORS_PER_BATCH * ctx->cipher_iv.iv_size);
+		free(ctx->iv_batch);
+	}
+
 	crypt_sector_iv_destroy(&ctx->cipher_iv);
 
 	if (ctx->cipher)
 		crypt_cipher_destroy(ctx->cipher);
 
+	for (i = 0; ctx->keys && i < ctx->keys_count; i++) {
+		if (ctx->keys[i].cipher)
+			crypt_cipher_destroy(ctx->keys[i].cipher);
+		crypt_aes_native_destroy(ctx->keys[i].aes);
+	}
+	free(ctx->keys);
+
+	crypt_aes_native_destroy(ctx->aes);
+
 	memset(ctx, 0, sizeof(*ctx));
 	free(ctx);
 }
 
 bool crypt_storage_kernel_only(struct crypt_storage *ctx)
 {
+	if (ctx->keys)
+		return !ctx->keys[0].aes && crypt_cipher_kernel_only(ctx->keys[0].cipher);
+
+	if (ctx->aes)
+		return false;
+
 	return crypt_cipher_kernel_only(ctx->cipher);
 }
@@ -0,0 +1,405 @@
+/*
+ * Storage encryption split across worker threads
+ *
+ * Copyright (C) 2023 Red Hat, Inc. All rights reserved.
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this file; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "crypto_backend.h"
+
+#define SECTOR_SHIFT	9
+
+/* Upper limit of worker threads (including the calling thread) */
+#define STORAGE_MAX_THREADS	64
+
+/* Do not wake up another thread for less data than this */
+#define STORAGE_MIN_CHUNK	(64 * 1024)
+
+struct storage_worker {
+	struct crypt_storage_parallel *p;
+	struct crypt_storage *s;
+	unsigned id;
+	pthread_t thread;
+	bool running;
+	unsigned generation;
+
+	/* current job */
+	uint64_t iv_offset;
+	uint64_t iv_offset_enc;
+	uint64_t length;
+	char *buffer;
+	int r;
+};
+
+/*
+ * Every worker owns its own crypt_storage context (cipher and IV scratch
+ * buffers are not thread safe), all initialized from the same key.
+ * Worker 0 is always run in the calling thread, other workers are started
+ * with the first request large enough to be split.
+ */
+struct crypt_storage_parallel {
+	size_t sector_size;
+	unsigned threads;
+	unsigned max_threads;
+	struct storage_worker *workers;
+
+	/* for lazy start of workers */
+	bool started;
+	char *cipher;
+	char *cipher_mode;
+	void *key;
+	size_t key_length;
+	bool large_iv;
+	bool affinity;
+	cpu_set_t cpus;
+
+	pthread_mutex_t lock;
+	pthread_cond_t start;
+	pthread_cond_t done;
+	unsigned generation;
+	unsigned pending;
+	bool encrypt;
+	struct crypt_storage_parallel *enc;	/* reencryption: encrypt with this after decrypt */
+	bool exit;
+};
+
+static void storage_worker_run(struct crypt_storage_parallel *p, struct storage_worker *w)
+{
+	if (!w->length)
+		w->r = 0;
+	else if (p->enc) {
+		w->r = crypt_storage_decrypt(w->s, w->iv_offset, w->length, w->buffer);
+		if (!w->r)
+			w->r = crypt_storage_encrypt(p->enc->workers[w->id].s, w->iv_offset_enc,
+						     w->length, w->buffer);
+	} else if (p->encrypt)
+		w->r = crypt_storage_encrypt(w->s, w->iv_offset, w->length, w->buffer);
+	else
+		w->r = crypt_storage_decrypt(w->s, w->iv_offset, w->length, w->buffer);
+}
+
+static void *storage_worker_thread(void *arg)
+{
+	struct storage_worker *w = arg;
+	struct crypt_storage_parallel *p = w->p;
+	unsigned generation = w->generation;
+
+	pthread_mutex_lock(&p->lock);
+	while (1) {
+		while (!p->exit && generation == p->generation)
+			pthread_cond_wait(&p->start, &p->lock);
+		if (p->exit)
+			break;
+		generation = p->generation;
+		pthread_mutex_unlock(&p->lock);
+
+		storage_worker_run(p, w);
+
+		pthread_mutex_lock(&p->lock);
+		if (!--p->pending)
+			pthread_cond_signal(&p->done);
+	}
+	pthread_mutex_unlock(&p->lock);
+
+	return NULL;
+}
+
+static unsigned storage_cpus_online(void)
+{
+	long r = sysconf(_SC_NPROCESSORS_ONLN);
+
+	return r < 1 ? 1 : (unsigned)r;
+}
+
+/*
+ * Start other workers, if the system refuses to create more threads,
+ * run with fewer ones.
+ */
+static void storage_workers_start(struct crypt_storage_parallel *p)
+{
+	struct storage_worker *w;
+	unsigned i;
+
+	if (p->started)
+		return;
+	p->started = true;
+
+	for (i = 1; i < p->max_threads; i++) {
+		w = &p->workers[i];
+		w->p = p;
+		w->id = i;
+		w->generation = p->generation;
+		if (crypt_storage_init(&w->s, p->sector_size, p->cipher, p->cipher_mode,
+				       p->key, p->key_length, p->large_iv))
+			break;
+
+		if (pthread_create(&w->thread, NULL, storage_worker_thread, w)) {
+			crypt_storage_destroy(w->s);
+			w->s = NULL;
+			break;
+		}
+		w->running = true;
+		p->threads++;
+
+		if (p->affinity)
+			(void)pthread_setaffinity_np(w->thread, sizeof(p->cpus), &p->cpus);
+	}
+
+	/* key is not needed anymore */
+	crypt_backend_memzero(p->key, p->key_length);
+	free(p->key);
+	p->key = NULL;
+}
+
+int crypt_storage_parallel_init(struct crypt_storage_parallel **ctx,
+				unsigned threads,
+				size_t sector_size,
+				const char *cipher,
+				const char *cipher_mode,
+				const void *key, size_t key_length,
+				bool large_iv)
+{
+	struct crypt_storage_parallel *p;
+	unsigned cpus = storage_cpus_online();
+	int r;
+
+	if (!threads)
+		threads = 1;
+	if (threads > cpus)
+		threads = cpus;
+	if (threads > STORAGE_MAX_THREADS)
+		threads = STORAGE_MAX_THREADS;
+
+	p = malloc(sizeof(*p));
+	if (!p)
+		return -ENOMEM;
+	memset(p, 0, sizeof(*p));
+
+	p->workers = calloc(threads, sizeof(*p->workers));
+	if (!p->workers) {
+		free(p);
+		return -ENOMEM;
+	}
+
+	if (pthread_mutex_init(&p->lock, NULL)) {
+		free(p->workers);
+		free(p);
+		return -ENOMEM;
+	}
+	pthread_cond_init(&p->start, NULL);
+	pthread_cond_init(&p->done, NULL);
+	p->sector_size = sector_size;
+	p->max_threads = threads;
+	p->large_iv = large_iv;
+
+	p->workers[0].p = p;
+	r = crypt_storage_init(&p->workers[0].s, sector_size, cipher, cipher_mode,
+			       key, key_length, large_iv);
+	if (r) {
+		crypt_storage_parallel_destroy(p);
+		return r;
+	}
+	p->threads = 1;
+
+	if (threads == 1)
+		p->started = true;
+	else {
+		p->cipher = strdup(cipher);
+		p->cipher_mode = strdup(cipher_mode);
+		p->key = malloc(key_length);
+		if (!p->cipher || !p->cipher_mode || !p->key) {
+			crypt_storage_parallel_destroy(p);
+			return -ENOMEM;
+		}
+		memcpy(p->key, key, key_length);
+		p->key_length = key_length;
+	}
+
+	*ctx = p;
+	return 0;
+}
+
+/*
+ * Run one job over the whole buffer, sliced into sector-aligned chunks.
+ * If enc is set, each chunk is decrypted with ctx and then encrypted
+ * with enc context of the same worker, so data stays in the CPU cache.
+ */
+static int crypt_storage_parallel_crypt(struct crypt_storage_parallel *ctx,
+					uint64_t iv_offset,
+					struct crypt_storage_parallel *enc,
+					uint64_t iv_offset_enc,
+					uint64_t length, char *buffer, bool encrypt)
+{
+	uint64_t sectors, chunk, offset;
+	size_t align = ctx->sector_size;
+	unsigned i, threads;
+	int r;
+
+	if (length > STORAGE_MIN_CHUNK) {
+		storage_workers_start(ctx);
+		if (enc)
+			storage_workers_start(enc);
+	}
+
+	threads = ctx->threads;
+	if (enc && enc->threads < threads)
+		threads = enc->threads;
+
+	/* sector sizes are powers of two, chunks must fit both contexts */
+	if (enc && enc->sector_size > align)
+		align = enc->sector_size;
+
+	if (length & (align - 1))
+		return -EINVAL;
+
+	sectors = length / align;
+	chunk = (sectors + threads - 1) / threads * align;
+	if (chunk < STORAGE_MIN_CHUNK)
+		chunk = (STORAGE_MIN_CHUNK + align - 1) / align * align;
+
+	for (i = 0, offset = 0; i < ctx->threads; i++) {
+		ctx->workers[i].iv_offset = iv_offset + (offset >> SECTOR_SHIFT);
+		ctx->workers[i].iv_offset_enc = iv_offset_enc + (offset >> SECTOR_SHIFT);
+		ctx->workers[i].buffer = &buffer[offset];
+		if (i < threads)
+			ctx->workers[i].length = length - offset < chunk ? length - offset : chunk;
+		else
+			ctx->workers[i].length = 0;
+		offset += ctx->workers[i].length;
+	}
+
+	ctx->encrypt = encrypt;
+	ctx->enc = enc;
+
+	if (threads == 1 || length <= chunk) {
+		storage_worker_run(ctx, &ctx->workers[0]);
+		return ctx->workers[0].r;
+	}
+
+	pthread_mutex_lock(&ctx->lock);
+	ctx->pending = ctx->threads - 1;
+	ctx->generation++;
+	pthread_cond_broadcast(&ctx->start);
+	pthread_mutex_unlock(&ctx->lock);
+
+	storage_worker_run(ctx, &ctx->workers[0]);
+
+	pthread_mutex_lock(&ctx->lock);
+	while (ctx->pending)
+		pthread_cond_wait(&ctx->done, &ctx->lock);
+	pthread_mutex_unlock(&ctx->lock);
+
+	for (i = 0, r = 0; i < threads && !r; i++)
+		r = ctx->workers[i].r;
+
+	return r;
+}
+
+int crypt_storage_parallel_decrypt(struct crypt_storage_parallel *ctx,
+				   uint64_t iv_offset,
+				   uint64_t length, char *buffer)
+{
+	return crypt_storage_parallel_crypt(ctx, iv_offset, NULL, 0, length, buffer, false);
+}
+
+int crypt_storage_parallel_encrypt(struct crypt_storage_parallel *ctx,
+				   uint64_t iv_offset,
+				   uint64_t length, char *buffer)
+{
+	return crypt_storage_parallel_crypt(ctx, iv_offset, NULL, 0, length, buffer, true);
+}
+
+int crypt_storage_parallel_reencrypt(struct crypt_storage_parallel *dec,
+				     uint64_t dec_iv_offset,
+				     struct crypt_storage_parallel *enc,
+				     uint64_t enc_iv_offset,
+				     uint64_t length, char *buffer)
+{
+	return crypt_storage_parallel_crypt(dec, dec_iv_offset, enc, enc_iv_offset, length, buffer, false);
+}
+
+void crypt_storage_parallel_destroy(struct crypt_storage_parallel *ctx)
+{
+	unsigned i;
+
+	if (!ctx)
+		return;
+
+	pthread_mutex_lock(&ctx->lock);
+	ctx->exit = true;
+	pthread_cond_broadcast(&ctx->start);
+	pthread_mutex_unlock(&ctx->lock);
+
+	for (i = 0; i < ctx->threads; i++) {
+		if (ctx->workers[i].running)
+			pthread_join(ctx->workers[i].thread, NULL);
+		crypt_storage_destroy(ctx->workers[i].s);
+	}
+
+	if (ctx->key) {
+		crypt_backend_memzero(ctx->key, ctx->key_length);
+		free(ctx->key);
+	}
+	free(ctx->cipher);
+	free(ctx->cipher_mode);
+
+	pthread_cond_destroy(&ctx->done);
+	pthread_cond_destroy(&ctx->start);
+	pthread_mutex_destroy(&ctx->lock);
+
+	free(ctx->workers);
+	memset(ctx, 0, sizeof(*ctx));
+	free(ctx);
+}
+
+bool crypt_storage_parallel_kernel_only(struct crypt_storage_parallel *ctx)
+{
+	return crypt_storage_kernel_only(ctx->workers[0].s);
+}
+
+/* Upper limit, workers are started with the first large request */
+unsigned crypt_storage_parallel_threads(struct crypt_storage_parallel *ctx)
+{
+	return ctx->started ? ctx->threads : ctx->max_threads;
+}
+
+/*
+ * Pin worker threads (the calling thread is left alone) to CPU set,
+ * e.g. CPUs local to the device NUMA node. Best effort, workers started
+ * later are pinned when created.
+ */
+int crypt_storage_parallel_set_affinity(struct crypt_storage_parallel *ctx, const cpu_set_t *cpus)
+{
+	unsigned i;
+	int r = 0;
+
+	if (!ctx || !cpus)
+		return -EINVAL;
+
+	ctx->cpus = *cpus;
+	ctx->affinity = true;
+
+	for (i = 1; i < ctx->threads; i++)
+		if (ctx->workers[i].running &&
+		    pthread_setaffinity_np(ctx->workers[i].thread, sizeof(*cpus), cpus))
+			r = -EINVAL;
+
+	return r;
+}
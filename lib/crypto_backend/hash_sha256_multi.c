@@ -0,0 +1,604 @@
+/*
+ * Multi-buffer SHA-256 for many short messages sharing a salt
+ *
+ * Copyright (C) 2023 Red Hat, Inc. All rights reserved.
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this file; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <endian.h>
+#include "crypto_backend_internal.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SHA256_MULTI_X86 1
+#include <immintrin.h>
+#include <cpuid.h>
+#endif
+
+#define SHA256_BLOCK	64
+#define SHA256_DIGEST	32
+#define SHA256_LANES	8
+#define SHA256_SECTOR_SALT_MAX	32
+
+/* Shared with the other internal SHA-256 code */
+const uint32_t crypt_sha256_k[64] = {
+	0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+	0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+	0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+	0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+	0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+	0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+	0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+	0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+const uint32_t crypt_sha256_iv[8] = {
+	0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+};
+
+#ifdef SHA256_MULTI_X86
+
+static inline uint32_t load_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline uint32_t ror32(uint32_t x, unsigned n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+/* Plain compression, used only for the salt midstate shared by all lanes */
+static void sha256_compress(uint32_t s[8], const uint8_t *block)
+{
+	uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+
+	for (i = 0; i < 16; i++)
+		w[i] = load_be32(block + 4 * i);
+	for (; i < 64; i++)
+		w[i] = (ror32(w[i - 2], 17) ^ ror32(w[i - 2], 19) ^ (w[i - 2] >> 10)) + w[i - 7] +
+		       (ror32(w[i - 15], 7) ^ ror32(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 16];
+
+	a = s[0]; b = s[1]; c = s[2]; d = s[3];
+	e = s[4]; f = s[5]; g = s[6]; h = s[7];
+
+	for (i = 0; i < 64; i++) {
+		t1 = h + (ror32(e, 6) ^ ror32(e, 11) ^ ror32(e, 25)) + ((e & f) ^ (~e & g)) + crypt_sha256_k[i] + w[i];
+		t2 = (ror32(a, 2) ^ ror32(a, 13) ^ ror32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+	s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+}
+
+static void store_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+
+/* One message: salt and block concatenated in the requested order */
+struct sha256_msg {
+	const uint8_t *first, *second;
+	size_t first_size, second_size;
+	uint64_t length;
+};
+
+/*
+ * Return 64 bytes of padded message at chunk offset. Chunks inside one
+ * part are used in place, the rest is assembled in tmp.
+ */
+static const uint8_t *msg_chunk(const struct sha256_msg *m, uint64_t off, uint8_t *tmp)
+{
+	uint64_t p, padded = (m->length + 8) / SHA256_BLOCK * SHA256_BLOCK + SHA256_BLOCK;
+	size_t n = 0, len;
+	int i;
+
+	if (off + SHA256_BLOCK <= m->first_size)
+		return m->first + off;
+	if (off >= m->first_size && off + SHA256_BLOCK <= m->length)
+		return m->second + (off - m->first_size);
+
+	/* chunk crossing the parts (short prefix of long block) */
+	if (off < m->first_size) {
+		n = m->first_size - off;
+		memcpy(tmp, m->first + off, n);
+	}
+	if (off + n < m->length) {
+		len = m->length - (off + n);
+		if (len > SHA256_BLOCK - n)
+			len = SHA256_BLOCK - n;
+		memcpy(tmp + n, m->second + (off + n - m->first_size), len);
+		n += len;
+	}
+
+	for (i = n; i < SHA256_BLOCK; i++) {
+		p = off + i;
+		if (p == m->length)
+			tmp[i] = 0x80;
+		else if (p >= padded - 8)
+			tmp[i] = (uint8_t)((m->length * 8) >> (8 * (padded - 1 - p)));
+		else
+			tmp[i] = 0;
+	}
+
+	return tmp;
+}
+
+#define AVX2 __attribute__((target("avx2")))
+
+/*
+ * With SHA extensions the crypto backend single buffer code is already
+ * faster than eight AVX2 lanes.
+ */
+static bool sha256_multi_supported(void)
+{
+	unsigned a, b, c, d;
+
+	if (!__builtin_cpu_supports("avx2"))
+		return false;
+
+	if (__get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1U << 29)))
+		return false;
+
+	return true;
+}
+
+#define ROR(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define ADD(x, y) _mm256_add_epi32(x, y)
+#define XOR3(x, y, z) _mm256_xor_si256(_mm256_xor_si256(x, y), z)
+
+/* Eight independent compressions of message words w (overwritten) */
+AVX2 static inline void sha256_transform_x8(__m256i s[8], __m256i w[16])
+{
+	__m256i a, b, c, d, e, f, g, h, t1, t2, s0, s1;
+	int i;
+
+	a = s[0]; b = s[1]; c = s[2]; d = s[3];
+	e = s[4]; f = s[5]; g = s[6]; h = s[7];
+
+	for (i = 0; i < 64; i++) {
+		if (i >= 16) {
+			s0 = XOR3(ROR(w[(i + 1) & 15], 7), ROR(w[(i + 1) & 15], 18),
+				  _mm256_srli_epi32(w[(i + 1) & 15], 3));
+			s1 = XOR3(ROR(w[(i + 14) & 15], 17), ROR(w[(i + 14) & 15], 19),
+				  _mm256_srli_epi32(w[(i + 14) & 15], 10));
+			w[i & 15] = ADD(ADD(w[i & 15], s0), ADD(w[(i + 9) & 15], s1));
+		}
+
+		t1 = ADD(ADD(h, XOR3(ROR(e, 6), ROR(e, 11), ROR(e, 25))),
+			 ADD(_mm256_xor_si256(_mm256_and_si256(e, f), _mm256_andnot_si256(e, g)),
+			     ADD(_mm256_set1_epi32((int)crypt_sha256_k[i]), w[i & 15])));
+		t2 = ADD(XOR3(ROR(a, 2), ROR(a, 13), ROR(a, 22)),
+			 XOR3(_mm256_and_si256(a, b), _mm256_and_si256(a, c), _mm256_and_si256(b, c)));
+		h = g; g = f; f = e; e = ADD(d, t1);
+		d = c; c = b; b = a; a = ADD(t1, t2);
+	}
+
+	s[0] = ADD(s[0], a); s[1] = ADD(s[1], b); s[2] = ADD(s[2], c); s[3] = ADD(s[3], d);
+	s[4] = ADD(s[4], e); s[5] = ADD(s[5], f); s[6] = ADD(s[6], g); s[7] = ADD(s[7], h);
+}
+
+/* Eight independent compressions, lane l of every vector belongs to message l */
+AVX2 static void sha256_compress_x8(__m256i s[8], const uint8_t *chunk[SHA256_LANES])
+{
+	__m256i w[16];
+	int i, l;
+	uint32_t x[SHA256_LANES];
+
+	for (i = 0; i < 16; i++) {
+		for (l = 0; l < SHA256_LANES; l++)
+			x[l] = load_be32(chunk[l] + 4 * i);
+		w[i] = _mm256_loadu_si256((const __m256i *)x);
+	}
+
+	sha256_transform_x8(s, w);
+}
+
+/* Hash up to eight messages from state mid after start bytes, writes lanes digests */
+AVX2 static void sha256_lanes_avx2(const uint32_t mid[8], uint64_t start,
+				   const struct sha256_msg m[SHA256_LANES], size_t lanes,
+				   uint8_t *digests)
+{
+	const uint8_t *chunk[SHA256_LANES];
+	uint8_t tmp[SHA256_LANES][SHA256_BLOCK];
+	uint32_t out[8][SHA256_LANES];
+	uint64_t off, padded = (m[0].length + 8) / SHA256_BLOCK * SHA256_BLOCK + SHA256_BLOCK;
+	__m256i s[8];
+	int i, l;
+
+	for (i = 0; i < 8; i++)
+		s[i] = _mm256_set1_epi32((int)mid[i]);
+
+	for (off = start; off < padded; off += SHA256_BLOCK) {
+		for (l = 0; l < SHA256_LANES; l++)
+			chunk[l] = msg_chunk(&m[l], off, tmp[l]);
+		sha256_compress_x8(s, chunk);
+	}
+
+	for (i = 0; i < 8; i++)
+		_mm256_storeu_si256((__m256i *)out[i], s[i]);
+
+	for (l = 0; (size_t)l < lanes; l++)
+		for (i = 0; i < 8; i++) {
+			digests[l * SHA256_DIGEST + 4 * i + 0] = (uint8_t)(out[i][l] >> 24);
+			digests[l * SHA256_DIGEST + 4 * i + 1] = (uint8_t)(out[i][l] >> 16);
+			digests[l * SHA256_DIGEST + 4 * i + 2] = (uint8_t)(out[i][l] >> 8);
+			digests[l * SHA256_DIGEST + 4 * i + 3] = (uint8_t)out[i][l];
+		}
+
+	crypt_backend_memzero(out, sizeof(out));
+	crypt_backend_memzero(tmp, sizeof(tmp));
+}
+
+AVX2 static void sha256_multi_avx2(const uint8_t *salt, size_t salt_size, bool salt_first,
+				   const uint8_t *blocks, size_t block_size, size_t count,
+				   uint8_t *digests)
+{
+	struct sha256_msg m[SHA256_LANES];
+	uint32_t mid[8];
+	uint64_t start = 0;
+	size_t n, lanes;
+	int l;
+
+	/* Salt prefix chunks are the same for every message, hash them once. */
+	memcpy(mid, crypt_sha256_iv, sizeof(mid));
+	if (salt_first)
+		for (; start + SHA256_BLOCK <= salt_size; start += SHA256_BLOCK)
+			sha256_compress(mid, salt + start);
+
+	for (n = 0; n < count; n += SHA256_LANES) {
+		lanes = count - n < SHA256_LANES ? count - n : SHA256_LANES;
+
+		/* Unused lanes repeat the last message, their result is dropped. */
+		for (l = 0; l < SHA256_LANES; l++) {
+			const uint8_t *block = blocks + (n + ((size_t)l < lanes ? (size_t)l : lanes - 1)) * block_size;
+
+			m[l].first = salt_first ? salt : block;
+			m[l].first_size = salt_first ? salt_size : block_size;
+			m[l].second = salt_first ? block : salt;
+			m[l].second_size = salt_first ? block_size : salt_size;
+			m[l].length = salt_size + block_size;
+		}
+
+		sha256_lanes_avx2(mid, start, m, lanes, digests + n * SHA256_DIGEST);
+	}
+
+	crypt_backend_memzero(mid, sizeof(mid));
+}
+
+/* Every block is hashed as salt || le64(sector) || block, dm-integrity tags */
+AVX2 static void sha256_sector_avx2(const uint8_t *salt, size_t salt_size,
+				    uint64_t sector, uint64_t sector_step,
+				    const uint8_t *blocks, size_t block_size, size_t count,
+				    uint8_t *digests)
+{
+	struct sha256_msg m[SHA256_LANES];
+	uint8_t prefix[SHA256_LANES][SHA256_SECTOR_SALT_MAX + 8];
+	uint64_t le_sector;
+	size_t n, lanes, b;
+	int l;
+
+	for (l = 0; l < SHA256_LANES; l++)
+		memcpy(prefix[l], salt, salt_size);
+
+	for (n = 0; n < count; n += SHA256_LANES) {
+		lanes = count - n < SHA256_LANES ? count - n : SHA256_LANES;
+
+		for (l = 0; l < SHA256_LANES; l++) {
+			b = n + ((size_t)l < lanes ? (size_t)l : lanes - 1);
+			le_sector = htole64(sector + b * sector_step);
+			memcpy(prefix[l] + salt_size, &le_sector, sizeof(le_sector));
+			m[l].first = prefix[l];
+			m[l].first_size = salt_size + sizeof(le_sector);
+			m[l].second = blocks + b * block_size;
+			m[l].second_size = block_size;
+			m[l].length = m[l].first_size + block_size;
+		}
+
+		sha256_lanes_avx2(crypt_sha256_iv, 0, m, lanes, digests + n * SHA256_DIGEST);
+	}
+}
+
+/* Every block is hashed as be32(index) || block, used by LUKS1 AF diffuse */
+AVX2 static void sha256_indexed_avx2(uint32_t first, const uint8_t *blocks, size_t count,
+				     uint8_t *digests)
+{
+	struct sha256_msg m[SHA256_LANES];
+	uint8_t index[SHA256_LANES][4];
+	size_t n, lanes, b;
+	int l;
+
+	for (n = 0; n < count; n += SHA256_LANES) {
+		lanes = count - n < SHA256_LANES ? count - n : SHA256_LANES;
+
+		for (l = 0; l < SHA256_LANES; l++) {
+			b = n + ((size_t)l < lanes ? (size_t)l : lanes - 1);
+			store_be32(index[l], first + (uint32_t)b);
+			m[l].first = index[l];
+			m[l].first_size = sizeof(index[l]);
+			m[l].second = blocks + b * SHA256_DIGEST;
+			m[l].second_size = SHA256_DIGEST;
+			m[l].length = sizeof(index[l]) + SHA256_DIGEST;
+		}
+
+		/* in place operation is fine, lanes read their blocks before digests are stored */
+		sha256_lanes_avx2(crypt_sha256_iv, 0, m, lanes, digests + n * SHA256_DIGEST);
+	}
+}
+
+/* Finish hash from state s after prefix bytes, over d1 || d2 */
+static void sha256_finish(uint32_t s[8], uint64_t prefix,
+			  const uint8_t *d1, size_t l1, const uint8_t *d2, size_t l2)
+{
+	uint8_t buf[SHA256_BLOCK];
+	uint64_t bits = (prefix + l1 + l2) * 8;
+	size_t fill = 0, i;
+
+	for (i = 0; i < l1 + l2; i++) {
+		buf[fill++] = i < l1 ? d1[i] : d2[i - l1];
+		if (fill == SHA256_BLOCK) {
+			sha256_compress(s, buf);
+			fill = 0;
+		}
+	}
+
+	buf[fill++] = 0x80;
+	if (fill > SHA256_BLOCK - 8) {
+		memset(buf + fill, 0, SHA256_BLOCK - fill);
+		sha256_compress(s, buf);
+		fill = 0;
+	}
+	memset(buf + fill, 0, SHA256_BLOCK - 8 - fill);
+	store_be32(buf + 56, (uint32_t)(bits >> 32));
+	store_be32(buf + 60, (uint32_t)bits);
+	sha256_compress(s, buf);
+
+	crypt_backend_memzero(buf, sizeof(buf));
+}
+
+/* HMAC inner and outer states after the key block */
+static void hmac_sha256_init(const char *password, size_t password_length,
+			     uint32_t inner[8], uint32_t outer[8])
+{
+	uint8_t key[SHA256_BLOCK] = {}, pad[SHA256_BLOCK];
+	uint32_t s[8];
+	int i;
+
+	if (password_length > SHA256_BLOCK) {
+		memcpy(s, crypt_sha256_iv, sizeof(s));
+		sha256_finish(s, 0, (const uint8_t *)password, password_length, NULL, 0);
+		for (i = 0; i < 8; i++)
+			store_be32(key + 4 * i, s[i]);
+	} else if (password_length)
+		memcpy(key, password, password_length);
+
+	for (i = 0; i < SHA256_BLOCK; i++)
+		pad[i] = key[i] ^ 0x36;
+	memcpy(inner, crypt_sha256_iv, sizeof(s));
+	sha256_compress(inner, pad);
+
+	for (i = 0; i < SHA256_BLOCK; i++)
+		pad[i] = key[i] ^ 0x5c;
+	memcpy(outer, crypt_sha256_iv, sizeof(s));
+	sha256_compress(outer, pad);
+
+	crypt_backend_memzero(key, sizeof(key));
+	crypt_backend_memzero(pad, sizeof(pad));
+	crypt_backend_memzero(s, sizeof(s));
+}
+
+/* Padded block of 32 byte message x following the 64 byte HMAC key block */
+AVX2 static inline void hmac_msg_words(__m256i w[16], const __m256i x[8])
+{
+	int i;
+
+	for (i = 0; i < 8; i++)
+		w[i] = x[i];
+	w[8] = _mm256_set1_epi32((int)0x80000000);
+	for (i = 9; i < 15; i++)
+		w[i] = _mm256_setzero_si256();
+	w[15] = _mm256_set1_epi32((SHA256_BLOCK + SHA256_DIGEST) * 8);
+}
+
+AVX2 static void pbkdf2_sha256_x8(struct crypt_pbkdf2_job *jobs, size_t lanes,
+				  uint32_t iterations, size_t key_length)
+{
+	uint32_t inner[8][SHA256_LANES], outer[8][SHA256_LANES], u[8][SHA256_LANES];
+	uint32_t is[8], os[8], st[8];
+	uint8_t index[4], digest[SHA256_DIGEST];
+	__m256i vi[8], vo[8], s[8], t[8], x[8], w[16];
+	size_t l, block, blocks = (key_length + SHA256_DIGEST - 1) / SHA256_DIGEST, n;
+	uint32_t c;
+	int i;
+
+	/* Unused lanes repeat the first job, their result is dropped. */
+	for (l = 0; l < SHA256_LANES; l++) {
+		struct crypt_pbkdf2_job *job = &jobs[l < lanes ? l : 0];
+
+		hmac_sha256_init(job->password, job->password_length, is, os);
+		for (i = 0; i < 8; i++) {
+			inner[i][l] = is[i];
+			outer[i][l] = os[i];
+		}
+	}
+
+	for (i = 0; i < 8; i++) {
+		vi[i] = _mm256_loadu_si256((const __m256i *)inner[i]);
+		vo[i] = _mm256_loadu_si256((const __m256i *)outer[i]);
+	}
+
+	for (block = 1; block <= blocks; block++) {
+		store_be32(index, (uint32_t)block);
+
+		/* U1 = HMAC(P, S || INT(block)), salts differ in length per lane */
+		for (l = 0; l < SHA256_LANES; l++) {
+			struct crypt_pbkdf2_job *job = &jobs[l < lanes ? l : 0];
+
+			for (i = 0; i < 8; i++)
+				st[i] = inner[i][l];
+			sha256_finish(st, SHA256_BLOCK, (const uint8_t *)job->salt, job->salt_length, index, 4);
+			for (i = 0; i < 8; i++)
+				store_be32(digest + 4 * i, st[i]);
+			for (i = 0; i < 8; i++)
+				st[i] = outer[i][l];
+			sha256_finish(st, SHA256_BLOCK, digest, SHA256_DIGEST, NULL, 0);
+			for (i = 0; i < 8; i++)
+				u[i][l] = st[i];
+		}
+
+		for (i = 0; i < 8; i++)
+			t[i] = x[i] = _mm256_loadu_si256((const __m256i *)u[i]);
+
+		/* U2..Uc, two compressions per iteration in all lanes at once */
+		for (c = 1; c < iterations; c++) {
+			hmac_msg_words(w, x);
+			for (i = 0; i < 8; i++)
+				s[i] = vi[i];
+			sha256_transform_x8(s, w);
+
+			hmac_msg_words(w, s);
+			for (i = 0; i < 8; i++)
+				x[i] = vo[i];
+			sha256_transform_x8(x, w);
+
+			for (i = 0; i < 8; i++)
+				t[i] = _mm256_xor_si256(t[i], x[i]);
+		}
+
+		for (i = 0; i < 8; i++)
+			_mm256_storeu_si256((__m256i *)u[i], t[i]);
+
+		n = key_length - (block - 1) * SHA256_DIGEST;
+		if (n > SHA256_DIGEST)
+			n = SHA256_DIGEST;
+		for (l = 0; l < lanes; l++) {
+			for (i = 0; i < 8; i++)
+				store_be32(digest + 4 * i, u[i][l]);
+			memcpy(jobs[l].key + (block - 1) * SHA256_DIGEST, digest, n);
+		}
+	}
+
+	crypt_backend_memzero(inner, sizeof(inner));
+	crypt_backend_memzero(outer, sizeof(outer));
+	crypt_backend_memzero(u, sizeof(u));
+	crypt_backend_memzero(is, sizeof(is));
+	crypt_backend_memzero(os, sizeof(os));
+	crypt_backend_memzero(st, sizeof(st));
+	crypt_backend_memzero(digest, sizeof(digest));
+	crypt_backend_memzero(vi, sizeof(vi));
+	crypt_backend_memzero(vo, sizeof(vo));
+	crypt_backend_memzero(s, sizeof(s));
+	crypt_backend_memzero(t, sizeof(t));
+	crypt_backend_memzero(x, sizeof(x));
+	crypt_backend_memzero(w, sizeof(w));
+}
+#endif /* SHA256_MULTI_X86 */
+
+/*
+ * SHA-256 of count blocks, each hashed as salt || block (or block || salt).
+ * Returns -ENOTSUP if there is no vectorized implementation for this CPU.
+ */
+int crypt_sha256_multi(const void *salt, size_t salt_size, bool salt_first,
+		       const void *blocks, size_t block_size, size_t count,
+		       void *digests)
+{
+#ifdef SHA256_MULTI_X86
+	/* Not worth it for a few lanes, generic code is faster there. */
+	if (count < SHA256_LANES / 2 || !sha256_multi_supported())
+		return -ENOTSUP;
+
+	sha256_multi_avx2(salt, salt_size, salt_first, blocks, block_size, count, digests);
+	return 0;
+#else
+	(void)salt; (void)salt_size; (void)salt_first;
+	(void)blocks; (void)block_size; (void)count; (void)digests;
+	return -ENOTSUP;
+#endif
+}
+
+/*
+ * SHA-256 of count blocks, each hashed as salt || le64(sector + i * sector_step) || block.
+ * Returns -ENOTSUP if there is no vectorized implementation for this CPU.
+ */
+int crypt_sha256_sector_multi(const void *salt, size_t salt_size,
+			      uint64_t sector, uint64_t sector_step,
+			      const void *blocks, size_t block_size, size_t count,
+			      void *digests)
+{
+#ifdef SHA256_MULTI_X86
+	if (count < SHA256_LANES / 2 || salt_size > SHA256_SECTOR_SALT_MAX ||
+	    !sha256_multi_supported())
+		return -ENOTSUP;
+
+	sha256_sector_avx2(salt, salt_size, sector, sector_step, blocks, block_size, count, digests);
+	return 0;
+#else
+	(void)salt; (void)salt_size; (void)sector; (void)sector_step;
+	(void)blocks; (void)block_size; (void)count; (void)digests;
+	return -ENOTSUP;
+#endif
+}
+
+/*
+ * SHA-256 of count 32 byte blocks, each hashed as be32(first + i) || block.
+ * Returns -ENOTSUP if there is no vectorized implementation for this CPU.
+ */
+int crypt_sha256_indexed_multi(uint32_t first, const void *blocks, size_t count,
+			       void *digests)
+{
+#ifdef SHA256_MULTI_X86
+	if (count < SHA256_LANES / 2 || !sha256_multi_supported())
+		return -ENOTSUP;
+
+	sha256_indexed_avx2(first, blocks, count, digests);
+	return 0;
+#else
+	(void)first; (void)blocks; (void)count; (void)digests;
+	return -ENOTSUP;
+#endif
+}
+
+/*
+ * PBKDF2-HMAC-SHA256 of count independent jobs with the same iteration
+ * count and key length, eight jobs at once.
+ * Returns -ENOTSUP if there is no vectorized implementation for this CPU.
+ */
+int crypt_pbkdf2_sha256_multi(struct crypt_pbkdf2_job *jobs, size_t count,
+			      uint32_t iterations, size_t key_length)
+{
+#ifdef SHA256_MULTI_X86
+	size_t n;
+
+	/*
+	 * Unlike plain hashing, backend PBKDF2 pays HMAC context overhead for
+	 * every iteration, so eight lanes win even with SHA extensions.
+	 */
+	if (count < 2 || !__builtin_cpu_supports("avx2"))
+		return -ENOTSUP;
+
+	for (n = 0; n < count; n += SHA256_LANES)
+		pbkdf2_sha256_x8(jobs + n, count - n < SHA256_LANES ? count - n : SHA256_LANES,
+				 iterations, key_length);
+	return 0;
+#else
+	(void)jobs; (void)count; (void)iterations; (void)key_length;
+	return -ENOTSUP;
+#endif
+}
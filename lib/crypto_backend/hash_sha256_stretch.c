@@ -0,0 +1,222 @@
+/*
+ * BitLocker SHA-256 key stretching loop
+ *
+ * Copyright (C) 2023 Red Hat, Inc. All rights reserved.
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this file; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include "crypto_backend_internal.h"
+
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define SHA256_STRETCH_X86 1
+#include <immintrin.h>
+#include <cpuid.h>
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_SHA2)
+#define SHA256_STRETCH_ARM 1
+#include <arm_neon.h>
+#endif
+
+/*
+ * Every round hashes the fixed 88 bytes {last digest, initial digest,
+ * salt, le64 count}, i.e. two blocks. The first block is the previous
+ * digest and the initial digest, the second one salt, count and padding.
+ * The message is built directly in words, no hash context is needed.
+ */
+#define STRETCH_MSG_LEN	88
+
+typedef void (*sha256_words_fn)(uint32_t s[8], const uint32_t w[16]);
+
+static inline uint32_t load_be32(const uint8_t *p)
+{
+	return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+}
+
+static inline void store_be32(uint8_t *p, uint32_t v)
+{
+	p[0] = (uint8_t)(v >> 24); p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8); p[3] = (uint8_t)v;
+}
+
+static inline uint32_t ror32(uint32_t x, unsigned n)
+{
+	return (x >> n) | (x << (32 - n));
+}
+
+static void sha256_words_generic(uint32_t s[8], const uint32_t m[16])
+{
+	uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+	int i;
+
+	memcpy(w, m, 16 * sizeof(*w));
+	for (i = 16; i < 64; i++)
+		w[i] = (ror32(w[i - 2], 17) ^ ror32(w[i - 2], 19) ^ (w[i - 2] >> 10)) + w[i - 7] +
+		       (ror32(w[i - 15], 7) ^ ror32(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 16];
+
+	a = s[0]; b = s[1]; c = s[2]; d = s[3];
+	e = s[4]; f = s[5]; g = s[6]; h = s[7];
+
+	for (i = 0; i < 64; i++) {
+		t1 = h + (ror32(e, 6) ^ ror32(e, 11) ^ ror32(e, 25)) + ((e & f) ^ (~e & g)) + crypt_sha256_k[i] + w[i];
+		t2 = (ror32(a, 2) ^ ror32(a, 13) ^ ror32(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+		h = g; g = f; f = e; e = d + t1;
+		d = c; c = b; b = a; a = t1 + t2;
+	}
+
+	s[0] += a; s[1] += b; s[2] += c; s[3] += d;
+	s[4] += e; s[5] += f; s[6] += g; s[7] += h;
+
+	crypt_backend_memzero(w, sizeof(w));
+}
+
+#ifdef SHA256_STRETCH_X86
+#define SHANI __attribute__((target("sha,sse4.1")))
+
+static bool sha256_shani_supported(void)
+{
+	unsigned a, b, c, d;
+
+	if (!__builtin_cpu_supports("sse4.1"))
+		return false;
+
+	return __get_cpuid_count(7, 0, &a, &b, &c, &d) && (b & (1U << 29));
+}
+
+SHANI static void sha256_words_shani(uint32_t s[8], const uint32_t w[16])
+{
+	__m128i state0, state1, save0, save1, tmp, k, m[4];
+	int g;
+
+	/* ABCD, EFGH -> ABEF, CDGH */
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&s[0]), 0xB1);
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i *)&s[4]), 0x1B);
+	state0 = _mm_alignr_epi8(tmp, state1, 8);
+	state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+	save0 = state0;
+	save1 = state1;
+
+	for (g = 0; g < 16; g++) {
+		if (g < 4)
+			m[g] = _mm_loadu_si128((const __m128i *)&w[4 * g]);
+		else {
+			tmp = _mm_sha256msg1_epu32(m[g & 3], m[(g + 1) & 3]);
+			tmp = _mm_add_epi32(tmp, _mm_alignr_epi8(m[(g + 3) & 3], m[(g + 2) & 3], 4));
+			m[g & 3] = _mm_sha256msg2_epu32(tmp, m[(g + 3) & 3]);
+		}
+		k = _mm_add_epi32(m[g & 3], _mm_loadu_si128((const __m128i *)&crypt_sha256_k[4 * g]));
+		state1 = _mm_sha256rnds2_epu32(state1, state0, k);
+		state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(k, 0x0E));
+	}
+
+	state0 = _mm_add_epi32(state0, save0);
+	state1 = _mm_add_epi32(state1, save1);
+
+	/* ABEF, CDGH -> ABCD, EFGH */
+	tmp = _mm_shuffle_epi32(state0, 0x1B);
+	state1 = _mm_shuffle_epi32(state1, 0xB1);
+	_mm_storeu_si128((__m128i *)&s[0], _mm_blend_epi16(tmp, state1, 0xF0));
+	_mm_storeu_si128((__m128i *)&s[4], _mm_alignr_epi8(state1, tmp, 8));
+}
+#endif /* SHA256_STRETCH_X86 */
+
+#ifdef SHA256_STRETCH_ARM
+static void sha256_words_arm(uint32_t s[8], const uint32_t w[16])
+{
+	uint32x4_t abcd, efgh, abcd0, efgh0, tmp, k, m[4];
+	int g;
+
+	abcd = abcd0 = vld1q_u32(&s[0]);
+	efgh = efgh0 = vld1q_u32(&s[4]);
+
+	for (g = 0; g < 16; g++) {
+		if (g < 4)
+			m[g] = vld1q_u32(&w[4 * g]);
+		else
+			m[g & 3] = vsha256su1q_u32(vsha256su0q_u32(m[g & 3], m[(g + 1) & 3]),
+						   m[(g + 2) & 3], m[(g + 3) & 3]);
+		k = vaddq_u32(m[g & 3], vld1q_u32(&crypt_sha256_k[4 * g]));
+		tmp = abcd;
+		abcd = vsha256hq_u32(abcd, efgh, k);
+		efgh = vsha256h2q_u32(efgh, tmp, k);
+	}
+
+	vst1q_u32(&s[0], vaddq_u32(abcd, abcd0));
+	vst1q_u32(&s[4], vaddq_u32(efgh, efgh0));
+}
+#endif /* SHA256_STRETCH_ARM */
+
+/*
+ * Accelerated compression if the CPU has SHA-256 instructions. Without them
+ * the crypto library code is faster, except kernel backend where every
+ * hash call costs syscalls; plain C is used there.
+ */
+static sha256_words_fn sha256_words_select(void)
+{
+#ifdef SHA256_STRETCH_X86
+	if (sha256_shani_supported())
+		return sha256_words_shani;
+#endif
+#ifdef SHA256_STRETCH_ARM
+	return sha256_words_arm;
+#endif
+	if (crypt_backend_flags() & CRYPT_BACKEND_KERNEL)
+		return sha256_words_generic;
+
+	return NULL;
+}
+
+int crypt_bitlk_stretch_key(const char *initial, const char *salt,
+			    uint32_t iterations, char *key)
+{
+	sha256_words_fn compress = sha256_words_select();
+	uint32_t s[8], last[8] = {}, w1[16], w2[16];
+	uint64_t count;
+	int i;
+
+	if (!compress)
+		return -ENOTSUP;
+
+	for (i = 0; i < 8; i++)
+		w1[8 + i] = load_be32((const uint8_t *)initial + 4 * i);
+
+	memset(w2, 0, sizeof(w2));
+	for (i = 0; i < 4; i++)
+		w2[i] = load_be32((const uint8_t *)salt + 4 * i);
+	w2[6] = 0x80000000;
+	w2[15] = STRETCH_MSG_LEN * 8;
+
+	for (count = 0; count < iterations; count++) {
+		memcpy(w1, last, sizeof(last));
+		/* count is stored little endian, message words are big endian */
+		w2[4] = __builtin_bswap32((uint32_t)count);
+		w2[5] = __builtin_bswap32((uint32_t)(count >> 32));
+
+		memcpy(s, crypt_sha256_iv, sizeof(s));
+		compress(s, w1);
+		compress(s, w2);
+		memcpy(last, s, sizeof(last));
+	}
+
+	for (i = 0; i < 8; i++)
+		store_be32((uint8_t *)key + 4 * i, last[i]);
+
+	crypt_backend_memzero(s, sizeof(s));
+	crypt_backend_memzero(last, sizeof(last));
+	crypt_backend_memzero(w1, sizeof(w1));
+	crypt_backend_memzero(w2, sizeof(w2));
+	return 0;
+}
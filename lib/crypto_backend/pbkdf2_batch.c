@@ -0,0 +1,109 @@
+/*
+ * PBKDF2 of many independent passwords split across CPU lanes and threads
+ *
+ * Copyright (C) 2023 Red Hat, Inc. All rights reserved.
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this file; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <string.h>
+#include <pthread.h>
+#include "crypto_backend_internal.h"
+
+/* Upper limit of worker threads (including the calling thread) */
+#define PBKDF2_MAX_THREADS	64
+
+/* Lanes of multi-buffer code, threads get multiples of it */
+#define PBKDF2_LANES		8
+
+struct pbkdf2_thread {
+	const char *hash;
+	struct crypt_pbkdf2_job *jobs;
+	size_t count;
+	uint32_t iterations;
+	size_t key_length;
+	pthread_t thread;
+	int r;
+};
+
+static void *pbkdf2_batch_thread(void *arg)
+{
+	struct pbkdf2_thread *t = arg;
+	size_t i;
+
+	if (!strcmp(t->hash, "sha256") &&
+	    !crypt_pbkdf2_sha256_multi(t->jobs, t->count, t->iterations, t->key_length)) {
+		t->r = 0;
+		return NULL;
+	}
+
+	for (i = 0, t->r = 0; i < t->count && !t->r; i++)
+		t->r = crypt_pbkdf("pbkdf2", t->hash,
+				   t->jobs[i].password, t->jobs[i].password_length,
+				   t->jobs[i].salt, t->jobs[i].salt_length,
+				   t->jobs[i].key, t->key_length, t->iterations, 0, 0);
+	return NULL;
+}
+
+int crypt_pbkdf2_batch(const char *hash, unsigned threads, uint32_t iterations,
+		       size_t key_length, struct crypt_pbkdf2_job *jobs, size_t count)
+{
+	struct pbkdf2_thread t[PBKDF2_MAX_THREADS];
+	size_t chunk, done;
+	unsigned i, started;
+	int r = 0;
+
+	if (!hash || !iterations || !key_length || (count && !jobs))
+		return -EINVAL;
+	if (!count)
+		return 0;
+
+	if (threads > PBKDF2_MAX_THREADS)
+		threads = PBKDF2_MAX_THREADS;
+	if (!threads)
+		threads = 1;
+
+	/* whole lane groups per thread, the last one may be partial */
+	chunk = (count + threads - 1) / threads;
+	chunk = (chunk + PBKDF2_LANES - 1) / PBKDF2_LANES * PBKDF2_LANES;
+
+	for (i = 0, done = 0; i < threads && done < count; i++, done += chunk) {
+		t[i].hash = hash;
+		t[i].jobs = jobs + done;
+		t[i].count = count - done < chunk ? count - done : chunk;
+		t[i].iterations = iterations;
+		t[i].key_length = key_length;
+		t[i].r = 0;
+	}
+	threads = i;
+
+	/* Job 0 runs in the calling thread, fall back to it if thread creation fails. */
+	for (started = 1; started < threads; started++)
+		if (pthread_create(&t[started].thread, NULL, pbkdf2_batch_thread, &t[started]))
+			break;
+
+	for (i = started; i < threads; i++)
+		(void)pbkdf2_batch_thread(&t[i]);
+	(void)pbkdf2_batch_thread(&t[0]);
+
+	for (i = 1; i < started; i++)
+		pthread_join(t[i].thread, NULL);
+
+	for (i = 0; i < threads && !r; i++)
+		r = t[i].r;
+
+	return r;
+}
@@ -217,6 +217,9 @@ int pkcs5_pbkdf2(const char *hash,
 
 			for (k = 0; (unsigned int) k < hLen; k++)
 				T[k] ^= U[k];
+
+			if (!(u & 0x3ff) && crypt_pbkdf_cancelled())
+				goto out;
 		}
 
 		memcpy(DK + (i - 1) * hLen, T, (unsigned int) i == l ? r : hLen);
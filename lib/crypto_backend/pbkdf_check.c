@@ -25,19 +25,65 @@
 #include <time.h>
 #include <sys/time.h>
 #include <sys/resource.h>
-#include "crypto_backend.h"
+#include "crypto_backend_internal.h"
+#include "utils_trace.h"
 
 #ifndef CLOCK_MONOTONIC_RAW
 #define CLOCK_MONOTONIC_RAW CLOCK_MONOTONIC
 #endif
 
-#define BENCH_MIN_MS 250
+#define BENCH_PROBE_MS 50
 #define BENCH_MIN_MS_FAST 10
 #define BENCH_PERCENT_ATLEAST 95
 #define BENCH_PERCENT_ATMOST 110
-#define BENCH_SAMPLES_FAST 3
+#define BENCH_SAMPLES_PROBE 1
 #define BENCH_SAMPLES_SLOW 1
 
+static __thread const struct crypt_pbkdf_cancel *pbkdf_cancel;
+
+void crypt_pbkdf_set_cancel(const struct crypt_pbkdf_cancel *cancel)
+{
+	pbkdf_cancel = cancel;
+}
+
+const struct crypt_pbkdf_cancel *crypt_pbkdf_get_cancel(void)
+{
+	return pbkdf_cancel;
+}
+
+int crypt_pbkdf_cancelled(void)
+{
+	int r;
+
+	if (!pbkdf_cancel || !pbkdf_cancel->check)
+		return 0;
+
+	r = pbkdf_cancel->check(pbkdf_cancel->usrptr);
+	return r < 0 ? r : 0;
+}
+
+int crypt_pbkdf(const char *kdf, const char *hash,
+		const char *password, size_t password_length,
+		const char *salt, size_t salt_length,
+		char *key, size_t key_length,
+		uint32_t iterations, uint32_t memory, uint32_t parallel)
+{
+	int r, r_cancel;
+
+	if ((r = crypt_pbkdf_cancelled()))
+		return r;
+
+	CRYPT_TRACE(pbkdf__start, kdf, hash, iterations, memory, parallel);
+	r = crypt_backend_pbkdf(kdf, hash, password, password_length, salt, salt_length,
+				key, key_length, iterations, memory, parallel);
+	/* KDF aborted from inside reports only a generic error */
+	if (r < 0 && (r_cancel = crypt_pbkdf_cancelled()))
+		r = r_cancel;
+	CRYPT_TRACE(pbkdf__done, kdf, r);
+
+	return r;
+}
+
 /* These PBKDF2 limits must be never violated */
 int crypt_pbkdf_get_limits(const char *kdf, struct crypt_pbkdf_limits *limits)
 {
@@ -205,6 +251,51 @@ static int next_argon2_params(uint32_t *t_cost, uint32_t *m_cost,
 	return CONTINUE;
 }
 
+/*
+ * Linear model from two probes: ms = overhead + work / rate, work = t_cost * m_cost.
+ * Prefer memory cost up to maximum, then raise time cost (as next_argon2_params).
+ * Returns CONTINUE if new params need to be measured, FINAL if the prediction
+ * cannot be done (noisy probes) or params are at limits already.
+ */
+static int predict_argon2_params(uint32_t *t_cost, uint32_t *m_cost,
+				 uint32_t probe_t_cost, uint32_t probe_m_cost, long probe_ms,
+				 uint32_t min_t_cost, uint32_t min_m_cost,
+				 uint32_t max_m_cost, long ms, uint32_t target_ms)
+{
+	double work1 = (double)probe_t_cost * probe_m_cost, work2 = (double)*t_cost * *m_cost;
+	double ms_per_work, overhead, work;
+
+	if (ms <= probe_ms || work2 <= work1)
+		return FINAL;
+
+	ms_per_work = (double)(ms - probe_ms) / (work2 - work1);
+	overhead = probe_ms - ms_per_work * work1;
+	if (overhead < 0)
+		overhead = 0;
+	if (overhead >= target_ms)
+		return FINAL;
+
+	work = (target_ms - overhead) / ms_per_work;
+
+	if (work / min_t_cost <= min_m_cost) {
+		*t_cost = min_t_cost;
+		*m_cost = min_m_cost;
+		return FINAL;
+	} else if (work / min_t_cost <= max_m_cost) {
+		*t_cost = min_t_cost;
+		*m_cost = (uint32_t)(work / min_t_cost);
+	} else {
+		*m_cost = max_m_cost;
+		if (work / max_m_cost <= min_t_cost) {
+			*t_cost = min_t_cost;
+			return FINAL;
+		}
+		*t_cost = work / max_m_cost < UINT32_MAX ? (uint32_t)(work / max_m_cost) : UINT32_MAX;
+	}
+
+	return CONTINUE;
+}
+
 static int crypt_argon2_check(const char *kdf, const char *password,
 			      size_t password_length, const char *salt,
 			      size_t salt_length, size_t key_length,
@@ -216,8 +307,8 @@ static int crypt_argon2_check(const char *kdf, const char *password,
 {
 	int r = 0;
 	char *key = NULL;
-	uint32_t t_cost, m_cost;
-	long ms;
+	uint32_t t_cost, m_cost, probe_t_cost, probe_m_cost;
+	long ms, probe_ms;
 	long ms_atleast = (long)target_ms * BENCH_PERCENT_ATLEAST / 100;
 	long ms_atmost = (long)target_ms * BENCH_PERCENT_ATMOST / 100;
 
@@ -237,11 +328,11 @@ static int crypt_argon2_check(const char *kdf, const char *password,
 	t_cost = min_t_cost;
 	m_cost = min_m_cost;
 
-	/* 1. Find some small parameters, s. t. ms >= BENCH_MIN_MS: */
+	/* 1. Find some small parameters, s. t. ms >= BENCH_PROBE_MS: */
 	while (1) {
 		r = measure_argon2(kdf, password, password_length, salt, salt_length,
 		                   key, key_length, t_cost, m_cost, parallel,
-		                   BENCH_SAMPLES_FAST, BENCH_MIN_MS, &ms);
+		                   BENCH_SAMPLES_PROBE, BENCH_PROBE_MS, &ms);
 		if (!r) {
 			/* Update parameters to actual measurement */
 			*out_t_cost = t_cost;
@@ -253,14 +344,14 @@ static int crypt_argon2_check(const char *kdf, const char *password,
 		if (r < 0)
 			goto out;
 
-		if (ms >= BENCH_MIN_MS)
+		if (ms >= BENCH_PROBE_MS)
 			break;
 
 		if (m_cost == max_m_cost) {
 			if (ms < BENCH_MIN_MS_FAST)
 				t_cost *= 16;
 			else {
-				uint32_t new = (t_cost * BENCH_MIN_MS) / (uint32_t)ms;
+				uint32_t new = (t_cost * BENCH_PROBE_MS) / (uint32_t)ms;
 				if (new == t_cost)
 					break;
 
@@ -270,7 +361,7 @@ static int crypt_argon2_check(const char *kdf, const char *password,
 			if (ms < BENCH_MIN_MS_FAST)
 				m_cost *= 16;
 			else {
-				uint32_t new = (m_cost * BENCH_MIN_MS) / (uint32_t)ms;
+				uint32_t new = (m_cost * BENCH_PROBE_MS) / (uint32_t)ms;
 				if (new == m_cost)
 					break;
 
@@ -281,10 +372,62 @@ static int crypt_argon2_check(const char *kdf, const char *password,
 			}
 		}
 	}
+
+	/*
+	 * 2. Measure doubled work with the same threads to separate fixed
+	 * overhead (threads, allocation, H0 and final hashing) from block fill
+	 * throughput and predict the target params analytically.
+	 */
+	if (ms < (long)target_ms) {
+		probe_t_cost = t_cost;
+		probe_m_cost = m_cost;
+		probe_ms = ms;
+
+		if (m_cost <= max_m_cost / 2)
+			m_cost *= 2;
+		else
+			t_cost *= 2;
+
+		r = measure_argon2(kdf, password, password_length, salt, salt_length,
+		                   key, key_length, t_cost, m_cost, parallel,
+		                   BENCH_SAMPLES_PROBE, BENCH_PROBE_MS, &ms);
+		if (!r) {
+			*out_t_cost = t_cost;
+			*out_m_cost = m_cost;
+			if (progress && progress((uint32_t)ms, usrptr))
+				r = -EINTR;
+		}
+		if (r < 0)
+			goto out;
+
+		if (predict_argon2_params(&t_cost, &m_cost, probe_t_cost, probe_m_cost, probe_ms,
+					  min_t_cost, min_m_cost, max_m_cost, ms, target_ms)) {
+			/* Params at limits, no measurement needed (unchanged if probes are noisy) */
+			if (t_cost != *out_t_cost || m_cost != *out_m_cost) {
+				*out_t_cost = t_cost;
+				*out_m_cost = m_cost;
+				goto out;
+			}
+		} else {
+			/* 3. Confirm prediction with one full-size run */
+			r = measure_argon2(kdf, password, password_length, salt, salt_length,
+			                   key, key_length, t_cost, m_cost, parallel,
+			                   BENCH_SAMPLES_SLOW, ms_atleast, &ms);
+			if (!r) {
+				*out_t_cost = t_cost;
+				*out_m_cost = m_cost;
+				if (progress && progress((uint32_t)ms, usrptr))
+					r = -EINTR;
+			}
+			if (r < 0 || (ms >= ms_atleast && ms <= ms_atmost))
+				goto out;
+		}
+	}
+
 	/*
-	 * 2. Use the params obtained in (1.) to estimate the target params.
-	 * 3. Then repeatedly measure the candidate params and if they fall out of
-	 * the acceptance range (+-5 %), try to improve the estimate:
+	 * 4. If the prediction misses, use the last measurement to estimate
+	 * the target params and repeatedly measure the candidate params until
+	 * they fall into the acceptance range (-5 %, +10 %):
 	 */
 	do {
 		if (next_argon2_params(&t_cost, &m_cost, min_t_cost, min_m_cost,
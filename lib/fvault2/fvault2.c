@@ -626,7 +626,7 @@ static int _read_disklabel(
 	}
 	size = FVAULT2_MD_BLOCK_SIZE;
 	log_dbg(cd, "Reading FVAULT2 disk label header of size %zu bytes.", size);
-	if (read_lseek_blockwise(devfd, device_block_size(cd, dev),
+	if (pread_blockwise(devfd, device_block_size(cd, dev),
 			device_alignment(dev), md_block, size, off) != size) {
 		r = -EIO;
 		goto out;
@@ -653,7 +653,7 @@ static int _read_disklabel(
 	}
 	size = sizeof(struct volume_groups_descriptor);
 	log_dbg(cd, "Reading FVAULT2 volume groups descriptor of size %zu bytes.", size);
-	if (read_lseek_blockwise(devfd, device_block_size(cd, dev),
+	if (pread_blockwise(devfd, device_block_size(cd, dev),
 			device_alignment(dev), vol_gr_des, size, off) != size) {
 		r = -EIO;
 		goto out;
@@ -669,6 +669,8 @@ out:
 
 /**
  * Extract info from relevant encrypted metadata blocks.
+ * Blocks are read and decrypted one by one, the scan stops as soon as
+ * all needed blocks are parsed (or on the first unused, zeroed block).
  * @param[in] devfd opened device file descriptor
  * @param[in] cd crypt_device passed into FVAULT2_read_metadata
  * @param[in] block_size used to compute byte-offsets from block-offsets
@@ -729,14 +731,14 @@ static int _read_encrypted_metadata(
 	}
 
 	log_dbg(cd, "Reading FVAULT2 encrypted metadata blocks.");
-	for (i = 0; i < blocks_n; i++) {
+	for (i = 0; i < blocks_n && status != FVAULT2_ENC_MD_PARSED_ALL; i++) {
 		off = start_off + i * FVAULT2_MD_BLOCK_SIZE;
 		if (off > FVAULT2_MAX_OFF) {
 			log_dbg(cd, "Device offset overflow.");
 			r = -EINVAL;
 			goto out;
 		}
-		if (read_lseek_blockwise(devfd, device_block_size(cd, dev),
+		if (pread_blockwise(devfd, device_block_size(cd, dev),
 				device_alignment(dev), md_block_enc,
 				FVAULT2_MD_BLOCK_SIZE, off)
 				!= FVAULT2_MD_BLOCK_SIZE) {
@@ -1055,3 +1057,50 @@ int FVAULT2_activate_by_volume_key(
 	crypt_free_volume_key(vol_key);
 	return r;
 }
+
+int FVAULT2_read_decrypt(
+	struct crypt_device *cd,
+	const struct fvault2_params *params,
+	const char *key,
+	size_t key_size,
+	uint64_t offset,
+	char *buffer,
+	size_t length)
+{
+	int r;
+	char *cipher = NULL;
+	struct volume_key *vol_key = NULL;
+	struct crypt_storage_wrapper *cw = NULL;
+
+	if (key_size != FVAULT2_XTS_KEY_SIZE)
+		return -EINVAL;
+
+	if (MISALIGNED_512(offset) || MISALIGNED_512(length) ||
+	    offset + length < offset || offset + length > params->log_vol_size)
+		return -EINVAL;
+
+	if (asprintf(&cipher, "%s-%s", params->cipher, params->cipher_mode) < 0)
+		return -ENOMEM;
+
+	vol_key = crypt_alloc_volume_key(FVAULT2_XTS_KEY_SIZE, key);
+	if (vol_key == NULL) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	r = crypt_storage_wrapper_init(cd, &cw, crypt_data_device(cd),
+		params->log_vol_off, 0, SECTOR_SIZE, cipher, vol_key,
+		DISABLE_DMCRYPT | OPEN_READONLY);
+	if (r < 0) {
+		log_err(cd, _("Cannot initialize userspace decryption for %s."), cipher);
+		goto out;
+	}
+
+	if (crypt_storage_wrapper_read_decrypt(cw, offset, buffer, length) != (ssize_t)length)
+		r = -EIO;
+out:
+	crypt_storage_wrapper_destroy(cw);
+	crypt_free_volume_key(vol_key);
+	free(cipher);
+	return r;
+}
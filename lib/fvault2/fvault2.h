@@ -77,4 +77,13 @@ int FVAULT2_activate_by_volume_key(
 	const struct fvault2_params *params,
 	uint32_t flags);
 
+int FVAULT2_read_decrypt(
+	struct crypt_device *cd,
+	const struct fvault2_params *params,
+	const char *key,
+	size_t key_size,
+	uint64_t offset,
+	char *buffer,
+	size_t length);
+
 #endif
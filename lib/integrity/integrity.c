@@ -22,6 +22,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 #include <uuid/uuid.h>
 
 #include "integrity.h"
@@ -48,7 +49,7 @@ static int INTEGRITY_read_superblock(struct crypt_device *cd,
 	if(devfd < 0)
 		return -EINVAL;
 
-	if (read_lseek_blockwise(devfd, device_block_size(cd, device),
+	if (pread_blockwise(devfd, device_block_size(cd, device),
 	    device_alignment(device), sb, sizeof(*sb), offset) != sizeof(*sb) ||
 	    memcmp(sb->magic, SB_MAGIC, sizeof(sb->magic))) {
 		log_dbg(cd, "No kernel dm-integrity metadata detected on %s.", device_path(device));
@@ -400,3 +401,884 @@ int INTEGRITY_format(struct crypt_device *cd,
 
 	return dm_remove_device(cd, tmp_name, CRYPT_DEACTIVATE_FORCE);
 }
+
+/*
+ * Kernel dm-integrity layout: superblock, journal sections and then, without
+ * a separate metadata device, areas of metadata run (packed tags, padded)
+ * each followed by interleave sectors of data. With a metadata device all
+ * tags are packed after the journal there.
+ */
+#define SB_SECTORS			8
+#define JOURNAL_BLOCK_SECTORS		8
+#define JOURNAL_SECTOR_DATA		(SECTOR_SIZE - 8)
+#define JOURNAL_MAC_PER_SECTOR		8
+#define JOURNAL_ENTRY_ROUNDUP		8
+#define METADATA_PADDING_SECTORS	8
+#define METADATA_BUFFER_SECTORS		128	/* kernel default buffer_sectors */
+#define DEFAULT_JOURNAL_SIZE_FACTOR	7	/* kernel default journal, 1/128 of device */
+#define DEFAULT_MAX_JOURNAL_SECTORS	131072
+#define TAGS_DIGEST_MAX			64
+#define TAGS_BUFFER_SIZE		(1024 * 1024)
+#define TAGS_RECALC_UNIT_SECTORS	32768
+#define TAGS_RECALC_THREADS_MAX		16
+
+/*
+ * Estimate size of separate metadata device for data device of @data_size
+ * bytes: superblock, journal (kernel default if not set) and packed tags.
+ */
+int INTEGRITY_metadata_size(const struct crypt_params_integrity *params,
+			    uint64_t data_size, uint64_t *metadata_size)
+{
+	uint64_t journal_size;
+	uint32_t sector_size;
+	int tag_size;
+
+	tag_size = params->tag_size ?: INTEGRITY_hash_tag_size(params->integrity);
+	sector_size = params->sector_size ?: SECTOR_SIZE;
+	if (tag_size <= 0 || sector_size < SECTOR_SIZE || data_size < sector_size)
+		return -EINVAL;
+
+	journal_size = params->journal_size;
+	if (!journal_size) {
+		journal_size = (data_size >> SECTOR_SHIFT) >> DEFAULT_JOURNAL_SIZE_FACTOR;
+		if (journal_size > DEFAULT_MAX_JOURNAL_SECTORS)
+			journal_size = DEFAULT_MAX_JOURNAL_SECTORS;
+		journal_size <<= SECTOR_SHIFT;
+	}
+
+	*metadata_size = ((uint64_t)SB_SECTORS << SECTOR_SHIFT) + journal_size +
+			 data_size / sector_size * tag_size;
+	*metadata_size = (*metadata_size + 4095) / 4096 * 4096;
+
+	return 0;
+}
+
+struct integrity_layout {
+	struct device *meta_device;
+	struct device *data_device;
+	bool meta;
+	uint64_t initial;	/* sectors before tags */
+	uint64_t run;		/* metadata run sectors */
+	uint64_t interleave;
+	uint64_t provided;
+	unsigned log2_spb;
+	unsigned log2_interleave;
+	size_t tag_size;
+};
+
+struct integrity_tags {
+	struct crypt_hash *hd;	/* plain hash */
+	const char *hash;
+	struct crypt_hmac *hmac;/* keyed hash */
+	bool crc32c;		/* crc32c or crc32 if no hash */
+	const char *salt;
+	size_t salt_size;
+	char *zero;		/* zeroed block */
+	size_t block_size;
+	size_t digest_size;
+	size_t tag_size;
+	char *basis;		/* crc only, tag of sector 0 then difference per sector bit */
+	char *tag;
+	uint64_t sector;
+};
+
+struct integrity_tags_stream {
+	int devfd;
+	size_t bsize, alignment;
+	char *buf;
+	size_t len;
+	uint64_t offset;
+};
+
+struct integrity_tags_progress {
+	int (*progress)(uint64_t size, uint64_t offset, void *usrptr);
+	void *usrptr;
+	uint64_t size;
+	uint64_t start;
+};
+
+static int integrity_layout_init(struct crypt_device *cd, struct superblock *sb,
+				 struct integrity_layout *l)
+{
+	size_t entry_size, sector_space, padding, spb;
+	int r;
+
+	memset(l, 0, sizeof(*l));
+	l->meta_device = INTEGRITY_metadata_device(cd);
+	l->data_device = crypt_data_device(cd);
+	l->meta = l->meta_device != l->data_device;
+
+	if (crypt_get_data_offset(cd))
+		return -ENOTSUP;
+
+	r = INTEGRITY_read_superblock(cd, l->meta_device, 0, sb);
+	if (r)
+		return r;
+
+	if (!sb->integrity_tag_size || sb->integrity_tag_size > TAGS_DIGEST_MAX ||
+	    !sb->provided_data_sectors ||
+	    (!l->meta && sb->log2_interleave_sectors < sb->log2_sectors_per_block))
+		return -ENOTSUP;
+
+	spb = 1U << sb->log2_sectors_per_block;
+	entry_size = 8 + 8 * spb + sb->integrity_tag_size;
+	entry_size = (entry_size + JOURNAL_ENTRY_ROUNDUP - 1) / JOURNAL_ENTRY_ROUNDUP * JOURNAL_ENTRY_ROUNDUP;
+	sector_space = JOURNAL_SECTOR_DATA;
+	if (sb->flags & SB_FLAG_HAVE_JOURNAL_MAC)
+		sector_space -= JOURNAL_MAC_PER_SECTOR;
+	if (sector_space < entry_size)
+		return -EINVAL;
+
+	l->log2_spb = sb->log2_sectors_per_block;
+	l->tag_size = sb->integrity_tag_size;
+	l->provided = sb->provided_data_sectors;
+	l->initial = SB_SECTORS + (uint64_t)sb->journal_sections *
+		     (((uint64_t)(sector_space / entry_size) * JOURNAL_BLOCK_SECTORS << l->log2_spb) +
+		      JOURNAL_BLOCK_SECTORS);
+
+	if (l->meta)
+		return 0;
+
+	l->log2_interleave = sb->log2_interleave_sectors;
+	l->interleave = UINT64_C(1) << l->log2_interleave;
+	padding = (sb->flags & SB_FLAG_FIXED_PADDING) ? METADATA_PADDING_SECTORS << SECTOR_SHIFT :
+		  SECTOR_SIZE << METADATA_PADDING_SECTORS;
+	l->run = (uint64_t)l->tag_size << (l->log2_interleave - l->log2_spb);
+	l->run = (l->run + padding - 1) / padding * padding >> SECTOR_SHIFT;
+
+	return 0;
+}
+
+/* Byte offset of the tag of data sector */
+static uint64_t integrity_tag_offset(const struct integrity_layout *l, uint64_t sector)
+{
+	uint64_t area;
+
+	if (l->meta)
+		return (l->initial << SECTOR_SHIFT) + (sector >> l->log2_spb) * l->tag_size;
+
+	area = sector >> l->log2_interleave;
+	return ((l->initial + area * (l->interleave + l->run)) << SECTOR_SHIFT) +
+	       ((sector & (l->interleave - 1)) >> l->log2_spb) * l->tag_size;
+}
+
+/* Byte offset of data sector on data device */
+static uint64_t integrity_data_offset(const struct integrity_layout *l, uint64_t sector)
+{
+	uint64_t area;
+
+	if (l->meta)
+		return sector << SECTOR_SHIFT;
+
+	area = sector >> l->log2_interleave;
+	return (l->initial + area * (l->interleave + l->run) + l->run +
+		(sector & (l->interleave - 1))) << SECTOR_SHIFT;
+}
+
+/* Tag of data block, kernel hashes [salt] | le64 sector | data */
+static int integrity_tag_calc(struct integrity_tags *t, uint64_t sector,
+			      const char *data, char *tag)
+{
+	uint64_t le_sector = htole64(sector);
+	char digest[TAGS_DIGEST_MAX];
+	uint32_t crc;
+	int r = 0;
+
+	if (t->hmac) {
+		if (t->salt_size)
+			r = crypt_hmac_write(t->hmac, t->salt, t->salt_size);
+		if (!r)
+			r = crypt_hmac_write(t->hmac, (const char *)&le_sector, sizeof(le_sector));
+		if (!r)
+			r = crypt_hmac_write(t->hmac, data, t->block_size);
+		if (!r)
+			r = crypt_hmac_final(t->hmac, digest, t->digest_size);
+	} else if (t->hd) {
+		if (t->salt_size)
+			r = crypt_hash_write(t->hd, t->salt, t->salt_size);
+		if (!r)
+			r = crypt_hash_write(t->hd, (const char *)&le_sector, sizeof(le_sector));
+		if (!r)
+			r = crypt_hash_write(t->hd, data, t->block_size);
+		if (!r)
+			r = crypt_hash_final(t->hd, digest, t->digest_size);
+	} else {
+		crc = t->crc32c ? ~UINT32_C(0) : 0;
+		crc = (t->crc32c ? crypt_crc32c : crypt_crc32)(crc, (const unsigned char *)t->salt, t->salt_size);
+		crc = (t->crc32c ? crypt_crc32c : crypt_crc32)(crc, (const unsigned char *)&le_sector, sizeof(le_sector));
+		crc = (t->crc32c ? crypt_crc32c : crypt_crc32)(crc, (const unsigned char *)data, t->block_size);
+		crc = htole32(t->crc32c ? ~crc : crc);
+		memcpy(digest, &crc, sizeof(crc));
+	}
+	if (r)
+		return r;
+
+	memset(tag, 0, t->tag_size);
+	memcpy(tag, digest, t->digest_size < t->tag_size ? t->digest_size : t->tag_size);
+	return 0;
+}
+
+/*
+ * CRC of fixed length data is affine in the input bits, so the tag of
+ * a zeroed block is the tag of sector 0 xored with the precomputed difference
+ * of each set bit of the sector number. Sequential sectors flip only a few bits.
+ */
+static int integrity_zero_tag_get(struct integrity_tags *t, uint64_t sector, char *tag)
+{
+	uint64_t diff;
+	unsigned bit;
+	size_t i;
+
+	if (!t->basis)
+		return integrity_tag_calc(t, sector, t->zero, tag);
+
+	for (diff = sector ^ t->sector; diff; diff &= diff - 1) {
+		bit = __builtin_ctzll(diff);
+		for (i = 0; i < t->tag_size; i++)
+			t->tag[i] ^= t->basis[(bit + 1) * t->tag_size + i];
+	}
+	t->sector = sector;
+
+	memcpy(tag, t->tag, t->tag_size);
+	return 0;
+}
+
+static int integrity_tags_init(struct integrity_tags *t, const char *integrity,
+			       const char *key, size_t key_size,
+			       const struct superblock *sb, bool zero_basis)
+{
+	char hash[MAX_CIPHER_LEN];
+	unsigned bit;
+	size_t i;
+	int r;
+
+	memset(t, 0, sizeof(*t));
+	t->block_size = SECTOR_SIZE << sb->log2_sectors_per_block;
+	t->tag_size = sb->integrity_tag_size;
+	if (sb->version >= SB_VERSION_5 && (sb->flags & SB_FLAG_FIXED_HMAC)) {
+		t->salt = (const char *)sb->salt;
+		t->salt_size = sizeof(sb->salt);
+	}
+
+	if (!strcmp(integrity, "crc32") || !strcmp(integrity, "crc32c")) {
+		t->crc32c = !strcmp(integrity, "crc32c");
+		t->digest_size = 4;
+	} else if (sscanf(integrity, "hmac(%" MAX_CIPHER_LEN_STR "[^)]s", hash) == 1) {
+		r = crypt_hmac_size(hash);
+		if (!key || r <= 0 || r > TAGS_DIGEST_MAX || crypt_hmac_init(&t->hmac, hash, key, key_size))
+			return -ENOTSUP;
+		t->digest_size = r;
+	} else {
+		r = crypt_hash_size(integrity);
+		if (r <= 0 || r > TAGS_DIGEST_MAX || crypt_hash_init(&t->hd, integrity))
+			return -ENOTSUP;
+		t->hash = integrity;
+		t->digest_size = r;
+	}
+
+	t->zero = calloc(1, t->block_size);
+	t->tag = malloc(t->tag_size);
+	if (!t->zero || !t->tag)
+		return -ENOMEM;
+
+	if (!zero_basis || t->hd || t->hmac)
+		return 0;
+
+	t->basis = malloc(65 * t->tag_size);
+	if (!t->basis)
+		return -ENOMEM;
+
+	r = integrity_tag_calc(t, 0, t->zero, t->basis);
+	for (bit = 0; bit < 64 && !r; bit++) {
+		r = integrity_tag_calc(t, UINT64_C(1) << bit, t->zero, &t->basis[(bit + 1) * t->tag_size]);
+		for (i = 0; i < t->tag_size; i++)
+			t->basis[(bit + 1) * t->tag_size + i] ^= t->basis[i];
+	}
+	memcpy(t->tag, t->basis, t->tag_size);
+
+	return r;
+}
+
+static void integrity_tags_destroy(struct integrity_tags *t)
+{
+	if (t->hd)
+		crypt_hash_destroy(t->hd);
+	if (t->hmac)
+		crypt_hmac_destroy(t->hmac);
+	free(t->zero);
+	free(t->tag);
+	free(t->basis);
+}
+
+static int integrity_tags_flush(struct integrity_tags_stream *s)
+{
+	if (!s->len)
+		return 0;
+
+	if (write_lseek_blockwise(s->devfd, s->bsize, s->alignment, s->buf,
+				  s->len, s->offset) != (ssize_t)s->len)
+		return -EIO;
+
+	s->offset += s->len;
+	s->len = 0;
+	return 0;
+}
+
+static int integrity_tags_put(struct integrity_tags_stream *s, const char *tag, size_t tag_size)
+{
+	size_t len;
+	int r;
+
+	while (tag_size) {
+		len = TAGS_BUFFER_SIZE - s->len;
+		if (len > tag_size)
+			len = tag_size;
+		memcpy(s->buf + s->len, tag, len);
+		s->len += len;
+		tag += len;
+		tag_size -= len;
+
+		if (s->len == TAGS_BUFFER_SIZE && (r = integrity_tags_flush(s)))
+			return r;
+	}
+
+	return 0;
+}
+
+static int integrity_tags_zero_progress(uint64_t size __attribute__((unused)),
+					uint64_t offset, void *usrptr)
+{
+	struct integrity_tags_progress *p = usrptr;
+
+	return p->progress ? p->progress(p->size, offset - p->start, p->usrptr) : 0;
+}
+
+/*
+ * Initialize tags of not yet used device without dm-integrity mapping.
+ * Data area is zeroed (offloaded to device if possible) and tags of zeroed
+ * blocks are written directly. Only unkeyed internal hash is possible.
+ */
+/*
+ * First sector of range that does not share kernel metadata buffer (bufio
+ * block of buffer_sectors, counted from the end of journal) with tags of
+ * sectors before it. Such a buffer may be cached in active device.
+ */
+static uint64_t integrity_range_safe_start(const struct integrity_layout *l,
+					   uint32_t buffer_sectors, uint64_t start)
+{
+	uint64_t buffer_size, offset, block;
+
+	if (!l->meta)
+		return (start + l->interleave - 1) & ~(l->interleave - 1);
+
+	buffer_size = SECTOR_SIZE;
+	while ((buffer_size << 1) <= ((uint64_t)(buffer_sectors ?: METADATA_BUFFER_SECTORS) << SECTOR_SHIFT))
+		buffer_size <<= 1;
+
+	offset = integrity_tag_offset(l, start) - (l->initial << SECTOR_SHIFT);
+	offset = (offset + buffer_size - 1) / buffer_size * buffer_size;
+	block = (offset + l->tag_size - 1) / l->tag_size;
+
+	return block << l->log2_spb;
+}
+
+/*
+ * Zero data and write precomputed tags of sectors [start, end). If @skipped
+ * is set, the range is shortened at the start to sectors not sharing any
+ * metadata buffer with the rest of (active) device.
+ */
+int INTEGRITY_wipe_tags_range(struct crypt_device *cd,
+			      const struct crypt_params_integrity *params,
+			      uint64_t start, uint64_t end, uint64_t *skipped,
+			      size_t wipe_block_size,
+			      int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+			      void *usrptr)
+{
+	struct integrity_tags_stream s = {};
+	struct integrity_tags_progress p = { .progress = progress, .usrptr = usrptr };
+	struct integrity_tags t = {};
+	struct integrity_layout l;
+	struct superblock sb;
+	uint64_t zero_offset, zero_length, sector, tags_size, safe_start, device_bytes;
+	char tag[TAGS_DIGEST_MAX];
+	int r;
+
+	if (!params || !params->integrity || params->integrity_key_size ||
+	    INTEGRITY_key_size(params->integrity) > 0)
+		return -ENOTSUP;
+
+	r = integrity_layout_init(cd, &sb, &l);
+	if (r)
+		return r;
+
+	if (!end)
+		end = l.provided;
+	if (start >= end || (start | end) & ((UINT64_C(1) << l.log2_spb) - 1))
+		return -EINVAL;
+
+	if (skipped) {
+		safe_start = integrity_range_safe_start(&l, params->buffer_sectors, start);
+		*skipped = (safe_start < end ? safe_start : end) - start;
+		log_dbg(cd, "Tags of %" PRIu64 " sectors share metadata buffer with active area.", *skipped);
+		if (safe_start >= end)
+			return 0;
+		start = safe_start;
+	}
+
+	tags_size = ((end - start) >> l.log2_spb) * l.tag_size;
+	zero_offset = start ? integrity_data_offset(&l, start) : (l.meta ? 0 : l.initial << SECTOR_SHIFT);
+	zero_length = integrity_data_offset(&l, end - 1) + SECTOR_SIZE - zero_offset;
+
+	/* superblock need not be updated yet for the new size */
+	r = device_size(l.data_device, &device_bytes);
+	if (!r && (zero_offset + zero_length > device_bytes ||
+	    (l.meta && !device_size(l.meta_device, &device_bytes) &&
+	     integrity_tag_offset(&l, end - 1) + l.tag_size > device_bytes)))
+		r = -EINVAL;
+	if (r)
+		return r;
+
+	r = integrity_tags_init(&t, params->integrity, NULL, 0, &sb, true);
+	if (r) {
+		if (r == -ENOTSUP)
+			log_dbg(cd, "Cannot precompute %s tags in userspace.", params->integrity);
+		integrity_tags_destroy(&t);
+		return r;
+	}
+
+	log_dbg(cd, "Initializing %s tags directly, journal ends at sector %" PRIu64
+		", metadata run %" PRIu64 " sectors.", params->integrity, l.initial, l.run);
+
+	p.size = zero_length + tags_size;
+	p.start = zero_offset;
+	r = crypt_wipe_device(cd, l.data_device, CRYPT_WIPE_ZERO, zero_offset, zero_length,
+			      wipe_block_size, integrity_tags_zero_progress, &p);
+	if (r)
+		goto out;
+
+	s.devfd = device_open(cd, l.meta_device, O_RDWR);
+	if (s.devfd < 0) {
+		r = -EINVAL;
+		goto out;
+	}
+	s.bsize = device_block_size(cd, l.meta_device);
+	s.alignment = device_alignment(l.meta_device);
+	s.offset = integrity_tag_offset(&l, start);
+	if (posix_memalign((void **)&s.buf, s.alignment, TAGS_BUFFER_SIZE)) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	for (sector = start; sector < end && !r; sector += (UINT64_C(1) << l.log2_spb)) {
+		if (!l.meta && !(sector & (l.interleave - 1))) {
+			r = integrity_tags_flush(&s);
+			s.offset = integrity_tag_offset(&l, sector);
+		}
+
+		/* after each written buffer and at area start */
+		if (!r && !s.len && progress && progress(p.size, zero_length +
+		    ((sector - start) >> l.log2_spb) * l.tag_size, usrptr))
+			r = -EINTR;
+		if (!r)
+			r = integrity_zero_tag_get(&t, sector, tag);
+		if (!r)
+			r = integrity_tags_put(&s, tag, l.tag_size);
+	}
+
+	if (!r)
+		r = integrity_tags_flush(&s);
+	if (r == -EIO)
+		log_err(cd, _("Device wipe error, offset %" PRIu64 "."), s.offset);
+
+	device_sync(cd, l.meta_device);
+	if (!r && progress)
+		progress(p.size, p.size, usrptr);
+out:
+	free(s.buf);
+	integrity_tags_destroy(&t);
+	return r;
+}
+
+int INTEGRITY_wipe_tags(struct crypt_device *cd,
+		       const struct crypt_params_integrity *params,
+		       size_t wipe_block_size,
+		       int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+		       void *usrptr)
+{
+	return INTEGRITY_wipe_tags_range(cd, params, 0, 0, NULL, wipe_block_size, progress, usrptr);
+}
+
+struct integrity_recalc {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	const struct integrity_layout *l;
+	int data_fd, meta_fd;
+	size_t data_bsize, data_alignment;
+	size_t meta_bsize, meta_alignment;
+	uint64_t unit_sectors;
+	uint64_t end;		/* first sector not processed */
+	uint64_t next;		/* first sector of next unit */
+	uint64_t done;		/* sectors recalculated */
+	uint64_t error_offset;
+	unsigned running;
+	bool stop;
+	int r;
+	/* verify only, stored tags are compared and never written */
+	bool verify;
+	int (*mismatch)(uint64_t sector, uint64_t count, void *usrptr);
+	void *usrptr;
+	uint64_t mismatched;	/* sectors with wrong tag */
+};
+
+struct integrity_recalc_thread {
+	pthread_t thread;
+	struct integrity_recalc *rc;
+	struct integrity_tags t;
+	char *data;
+	char *digests;
+	char *tags;
+	char *stored;		/* verify only */
+};
+
+/* Compare calculated tags of a unit with stored ones, report ranges of mismatches. */
+static int integrity_verify_unit(struct integrity_recalc_thread *w, uint64_t start,
+				 size_t blocks)
+{
+	struct integrity_recalc *rc = w->rc;
+	size_t block, first, tag_size = rc->l->tag_size;
+	unsigned log2_spb = rc->l->log2_spb;
+	int r = 0;
+
+	if (!memcmp(w->tags, w->stored, blocks * tag_size))
+		return 0;
+
+	pthread_mutex_lock(&rc->lock);
+	for (block = 0; block < blocks && !r; block++) {
+		if (!memcmp(w->tags + block * tag_size, w->stored + block * tag_size, tag_size))
+			continue;
+		for (first = block; block + 1 < blocks; block++)
+			if (!memcmp(w->tags + (block + 1) * tag_size,
+				    w->stored + (block + 1) * tag_size, tag_size))
+				break;
+		rc->mismatched += (block - first + 1) << log2_spb;
+		if (rc->mismatch && rc->mismatch(start + (first << log2_spb),
+						 (block - first + 1) << log2_spb, rc->usrptr))
+			r = -EINTR;
+	}
+	pthread_mutex_unlock(&rc->lock);
+
+	return r;
+}
+
+/* Read one unit (never crossing an area), compute tags and write them at once. */
+static int integrity_recalc_unit(struct integrity_recalc_thread *w, uint64_t start,
+				 uint64_t count, uint64_t *error_offset)
+{
+	const struct integrity_layout *l = w->rc->l;
+	uint64_t sector, offset, len, chunk_sectors = TAGS_BUFFER_SIZE >> SECTOR_SHIFT;
+	size_t block, blocks = 0;
+	int r;
+
+	for (sector = start; sector < start + count; sector += len) {
+		len = (start + count - sector > chunk_sectors) ? chunk_sectors : start + count - sector;
+		offset = integrity_data_offset(l, sector);
+		if (pread_blockwise(w->rc->data_fd, w->rc->data_bsize, w->rc->data_alignment,
+				    w->data, len << SECTOR_SHIFT, offset) != (ssize_t)(len << SECTOR_SHIFT)) {
+			*error_offset = offset;
+			return -EIO;
+		}
+
+		/* plain hash in multi-buffer lanes, then truncated or padded to tags */
+		if (w->t.hd) {
+			r = crypt_hash_sector_blocks(w->t.hd, w->t.hash, w->t.salt, w->t.salt_size,
+						     sector, UINT64_C(1) << l->log2_spb, w->data,
+						     w->t.block_size, len >> l->log2_spb,
+						     w->digests, w->t.digest_size);
+			if (r)
+				return r;
+			for (block = 0; block < (len >> l->log2_spb); block++, blocks++) {
+				memset(w->tags + blocks * l->tag_size, 0, l->tag_size);
+				memcpy(w->tags + blocks * l->tag_size, w->digests + block * w->t.digest_size,
+				       w->t.digest_size < l->tag_size ? w->t.digest_size : l->tag_size);
+			}
+			continue;
+		}
+
+		for (block = 0; block < (len >> l->log2_spb); block++, blocks++) {
+			r = integrity_tag_calc(&w->t, sector + (block << l->log2_spb),
+					       w->data + block * w->t.block_size,
+					       w->tags + blocks * l->tag_size);
+			if (r)
+				return r;
+		}
+	}
+
+	offset = integrity_tag_offset(l, start);
+	if (w->rc->verify) {
+		if (pread_blockwise(w->rc->meta_fd, w->rc->meta_bsize, w->rc->meta_alignment,
+				    w->stored, blocks * l->tag_size, offset) != (ssize_t)(blocks * l->tag_size)) {
+			*error_offset = offset;
+			return -EIO;
+		}
+		return integrity_verify_unit(w, start, blocks);
+	}
+
+	if (pwrite_blockwise(w->rc->meta_fd, w->rc->meta_bsize, w->rc->meta_alignment,
+			     w->tags, blocks * l->tag_size, offset) != (ssize_t)(blocks * l->tag_size)) {
+		*error_offset = offset;
+		return -EIO;
+	}
+
+	return 0;
+}
+
+static void *integrity_recalc_thread(void *arg)
+{
+	struct integrity_recalc_thread *w = arg;
+	struct integrity_recalc *rc = w->rc;
+	uint64_t start, count, error_offset = 0;
+	int r = 0;
+
+	pthread_mutex_lock(&rc->lock);
+	while (!rc->stop && rc->next < rc->end) {
+		start = rc->next;
+		count = (rc->end - start > rc->unit_sectors) ? rc->unit_sectors : rc->end - start;
+		rc->next += count;
+		pthread_mutex_unlock(&rc->lock);
+
+		r = integrity_recalc_unit(w, start, count, &error_offset);
+
+		pthread_mutex_lock(&rc->lock);
+		if (r) {
+			if (!rc->r) {
+				rc->r = r;
+				rc->error_offset = error_offset;
+			}
+			rc->stop = true;
+		} else
+			rc->done += count;
+		pthread_cond_signal(&rc->cond);
+	}
+	rc->running--;
+	pthread_cond_signal(&rc->cond);
+	pthread_mutex_unlock(&rc->lock);
+
+	return NULL;
+}
+
+/* Mark the whole device as recalculated if kernel recalculation was started before */
+static int integrity_recalc_sb_update(struct crypt_device *cd, const struct integrity_layout *l,
+				      const struct superblock *sb)
+{
+	struct superblock *raw;
+	size_t bsize = device_block_size(cd, l->meta_device);
+	int devfd, r = 0;
+
+	if (!(sb->flags & SB_FLAG_RECALCULATING))
+		return 0;
+
+	devfd = device_open(cd, l->meta_device, O_RDWR);
+	if (devfd < 0)
+		return -EINVAL;
+
+	if (posix_memalign((void **)&raw, device_alignment(l->meta_device), SECTOR_SIZE))
+		return -ENOMEM;
+
+	if (pread_blockwise(devfd, bsize, device_alignment(l->meta_device), raw, SECTOR_SIZE, 0) != SECTOR_SIZE)
+		r = -EIO;
+	else {
+		raw->flags = htole32(sb->flags & ~SB_FLAG_RECALCULATING);
+		raw->recalc_sector = htole64(sb->provided_data_sectors);
+		if (pwrite_blockwise(devfd, bsize, device_alignment(l->meta_device), raw, SECTOR_SIZE, 0) != SECTOR_SIZE)
+			r = -EIO;
+	}
+
+	free(raw);
+	return r;
+}
+
+/*
+ * Common part of recalculation and verification. Data are read in large
+ * chunks by several threads, each one processing tags of a whole unit at once.
+ */
+static int integrity_recalc_run(struct crypt_device *cd,
+				const struct crypt_params_integrity *params,
+				const char *integrity_key, size_t integrity_key_size,
+				struct integrity_recalc *rc_verify,
+				int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+				void *usrptr)
+{
+	struct integrity_recalc_thread w[TAGS_RECALC_THREADS_MAX] = {};
+	struct integrity_recalc rc = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+	};
+	struct integrity_layout l;
+	struct superblock sb;
+	unsigned i, n, started, threads = crypt_cpusonline();
+	uint64_t done;
+	int r;
+
+	if (!params || !params->integrity)
+		return -EINVAL;
+
+	r = integrity_layout_init(cd, &sb, &l);
+	if (r)
+		return r;
+
+	/* superblock with journal MAC is authenticated, only kernel can update it */
+	if (!rc_verify && (sb.flags & SB_FLAG_RECALCULATING) &&
+	    (sb.flags & (SB_FLAG_FIXED_HMAC | SB_FLAG_HAVE_JOURNAL_MAC)) ==
+	    (SB_FLAG_FIXED_HMAC | SB_FLAG_HAVE_JOURNAL_MAC))
+		return -ENOTSUP;
+
+	rc.l = &l;
+	rc.end = l.provided;
+	if (rc_verify) {
+		rc.verify = true;
+		rc.mismatch = rc_verify->mismatch;
+		rc.usrptr = rc_verify->usrptr;
+		/* tags after the recalculation checkpoint are not valid yet */
+		if ((sb.flags & SB_FLAG_RECALCULATING) && sb.recalc_sector < l.provided) {
+			rc.end = sb.recalc_sector & ~((UINT64_C(1) << l.log2_spb) - 1);
+			log_dbg(cd, "Device is being recalculated, verifying only %" PRIu64 " sectors.", rc.end);
+		}
+	}
+	rc.unit_sectors = (l.meta || l.interleave > TAGS_RECALC_UNIT_SECTORS) ?
+			  TAGS_RECALC_UNIT_SECTORS : l.interleave;
+	if (rc.unit_sectors < (UINT64_C(1) << l.log2_spb))
+		return -ENOTSUP;
+
+	if (threads > TAGS_RECALC_THREADS_MAX)
+		threads = TAGS_RECALC_THREADS_MAX;
+	if (!threads)
+		threads = 1;
+
+	for (n = 0; n < threads; n++) {
+		w[n].rc = &rc;
+		r = integrity_tags_init(&w[n].t, params->integrity, integrity_key,
+					integrity_key_size, &sb, false);
+		if (!r && (posix_memalign((void **)&w[n].data, device_alignment(l.data_device), TAGS_BUFFER_SIZE) ||
+		    !(w[n].digests = malloc((TAGS_BUFFER_SIZE >> SECTOR_SHIFT) * TAGS_DIGEST_MAX)) ||
+		    !(w[n].tags = malloc((rc.unit_sectors >> l.log2_spb) * l.tag_size)) ||
+		    (rc.verify && !(w[n].stored = malloc((rc.unit_sectors >> l.log2_spb) * l.tag_size)))))
+			r = -ENOMEM;
+		if (r) {
+			if (r == -ENOTSUP)
+				log_dbg(cd, "Cannot calculate %s tags in userspace.", params->integrity);
+			n++;
+			goto out;
+		}
+	}
+
+	rc.data_fd = device_open(cd, l.data_device, rc.verify ? O_RDONLY : O_RDWR);
+	rc.meta_fd = device_open(cd, l.meta_device, rc.verify ? O_RDONLY : O_RDWR);
+	if (rc.data_fd < 0 || rc.meta_fd < 0) {
+		r = -EINVAL;
+		goto out;
+	}
+	rc.data_bsize = device_block_size(cd, l.data_device);
+	rc.data_alignment = device_alignment(l.data_device);
+	rc.meta_bsize = device_block_size(cd, l.meta_device);
+	rc.meta_alignment = device_alignment(l.meta_device);
+
+	log_dbg(cd, "%s %s tags in %u threads, %" PRIu64 " sectors per unit.",
+		rc.verify ? "Verifying" : "Recalculating", params->integrity, n, rc.unit_sectors);
+
+	rc.running = n;
+	for (started = 0; started < n; started++)
+		if (pthread_create(&w[started].thread, NULL, integrity_recalc_thread, &w[started]))
+			break;
+
+	pthread_mutex_lock(&rc.lock);
+	rc.running = started ? rc.running - (n - started) : 1;
+	pthread_mutex_unlock(&rc.lock);
+	/* no thread could be created, calculate everything here */
+	if (!started)
+		integrity_recalc_thread(&w[0]);
+
+	pthread_mutex_lock(&rc.lock);
+	while (rc.running) {
+		pthread_cond_wait(&rc.cond, &rc.lock);
+		done = rc.done;
+		if (progress && !rc.stop) {
+			pthread_mutex_unlock(&rc.lock);
+			if (progress(rc.end << SECTOR_SHIFT, done << SECTOR_SHIFT, usrptr))
+				r = -EINTR;
+			pthread_mutex_lock(&rc.lock);
+			if (r)
+				rc.stop = true;
+		}
+	}
+	pthread_mutex_unlock(&rc.lock);
+
+	for (i = 0; i < started; i++)
+		pthread_join(w[i].thread, NULL);
+
+	if (rc.r) {
+		r = rc.r;
+		if (r == -EIO && rc.verify)
+			log_err(cd, _("IO error while verifying integrity tags, offset %" PRIu64 "."),
+				rc.error_offset);
+		else if (r == -EIO)
+			log_err(cd, _("IO error while recalculating integrity tags, offset %" PRIu64 "."),
+				rc.error_offset);
+	}
+
+	if (rc.verify)
+		rc_verify->mismatched = rc.mismatched;
+	else {
+		device_sync(cd, l.meta_device);
+		if (!r)
+			r = integrity_recalc_sb_update(cd, &l, &sb);
+	}
+out:
+	for (i = 0; i < n; i++) {
+		integrity_tags_destroy(&w[i].t);
+		free(w[i].data);
+		free(w[i].digests);
+		free(w[i].tags);
+		free(w[i].stored);
+	}
+	return r;
+}
+
+/*
+ * Calculate tags of existing data in userspace on not yet used device.
+ * Tags of a whole unit are written at once; no journal is involved.
+ */
+int INTEGRITY_recalculate_tags(struct crypt_device *cd,
+			       const struct crypt_params_integrity *params,
+			       const char *integrity_key, size_t integrity_key_size,
+			       int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+			       void *usrptr)
+{
+	return integrity_recalc_run(cd, params, integrity_key, integrity_key_size,
+				    NULL, progress, usrptr);
+}
+
+/*
+ * Compare stored tags of inactive device with tags calculated from data.
+ * Mismatch callback is called (serialized, units in no particular order)
+ * for every contiguous range of sectors with wrong tags inside a unit.
+ */
+int INTEGRITY_verify_tags(struct crypt_device *cd,
+			  const struct crypt_params_integrity *params,
+			  const char *integrity_key, size_t integrity_key_size,
+			  int (*mismatch)(uint64_t sector, uint64_t count, void *usrptr),
+			  int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+			  void *usrptr, uint64_t *mismatched_sectors)
+{
+	struct integrity_recalc rc = {
+		.mismatch = mismatch,
+		.usrptr = usrptr,
+	};
+	int r;
+
+	r = integrity_recalc_run(cd, params, integrity_key, integrity_key_size,
+				 &rc, progress, usrptr);
+	if (mismatched_sectors)
+		*mismatched_sectors = rc.mismatched;
+
+	return r;
+}
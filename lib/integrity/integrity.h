@@ -55,6 +55,8 @@ struct superblock {
 	uint8_t log2_blocks_per_bitmap_bit; /* V3 only */
 	uint8_t pad[2];
 	uint64_t recalc_sector; /* V2 only */
+	uint8_t pad2[8];
+	uint8_t salt[16]; /* V5 only */
 } __attribute__ ((packed));
 
 int INTEGRITY_read_sb(struct crypt_device *cd,
@@ -66,6 +68,9 @@ int INTEGRITY_dump(struct crypt_device *cd, struct device *device, uint64_t offs
 int INTEGRITY_data_sectors(struct crypt_device *cd,
 			   struct device *device, uint64_t offset,
 			   uint64_t *data_sectors);
+int INTEGRITY_metadata_size(const struct crypt_params_integrity *params,
+			    uint64_t data_size, uint64_t *metadata_size);
+
 int INTEGRITY_key_size(const char *integrity);
 int INTEGRITY_tag_size(const char *integrity,
 		       const char *cipher,
@@ -77,6 +82,32 @@ int INTEGRITY_format(struct crypt_device *cd,
 		     struct volume_key *journal_crypt_key,
 		     struct volume_key *journal_mac_key);
 
+int INTEGRITY_wipe_tags(struct crypt_device *cd,
+		       const struct crypt_params_integrity *params,
+		       size_t wipe_block_size,
+		       int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+		       void *usrptr);
+
+int INTEGRITY_wipe_tags_range(struct crypt_device *cd,
+			      const struct crypt_params_integrity *params,
+			      uint64_t start, uint64_t end, uint64_t *skipped,
+			      size_t wipe_block_size,
+			      int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+			      void *usrptr);
+
+int INTEGRITY_recalculate_tags(struct crypt_device *cd,
+			       const struct crypt_params_integrity *params,
+			       const char *integrity_key, size_t integrity_key_size,
+			       int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+			       void *usrptr);
+
+int INTEGRITY_verify_tags(struct crypt_device *cd,
+			  const struct crypt_params_integrity *params,
+			  const char *integrity_key, size_t integrity_key_size,
+			  int (*mismatch)(uint64_t sector, uint64_t count, void *usrptr),
+			  int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+			  void *usrptr, uint64_t *mismatched_sectors);
+
 int INTEGRITY_activate(struct crypt_device *cd,
 		       const char *name,
 		       const struct crypt_params_integrity *params,
@@ -41,6 +41,7 @@
 #include "utils_dm.h"
 #include "utils_keyring.h"
 #include "utils_io.h"
+#include "utils_trace.h"
 #include "crypto_backend/crypto_backend.h"
 #include "utils_storage_wrappers.h"
 
@@ -65,6 +66,7 @@ struct volume_key {
 	int id;
 	size_t keylength;
 	const char *key_description;
+	char *key_hex;
 	struct volume_key *next;
 	char key[];
 };
@@ -73,6 +75,7 @@ struct volume_key *crypt_alloc_volume_key(size_t keylength, const char *key);
 struct volume_key *crypt_generate_volume_key(struct crypt_device *cd, size_t keylength);
 void crypt_free_volume_key(struct volume_key *vk);
 int crypt_volume_key_set_description(struct volume_key *key, const char *key_description);
+const char *crypt_volume_key_hex(struct volume_key *vk);
 void crypt_volume_key_set_id(struct volume_key *vk, int id);
 int crypt_volume_key_get_id(const struct volume_key *vk);
 void crypt_volume_key_add_next(struct volume_key **vks, struct volume_key *vk);
@@ -85,9 +88,60 @@ int init_pbkdf_type(struct crypt_device *cd,
 		    const char *dev_type);
 int verify_pbkdf_params(struct crypt_device *cd,
 			const struct crypt_pbkdf_type *pbkdf);
+uint32_t adjusted_phys_memory(void);
+const char *crypt_get_pbkdf_cache(struct crypt_device *cd);
+uint32_t crypt_get_derived_key_cache_timeout(struct crypt_device *cd);
+unsigned crypt_get_wipe_queue_depth(struct crypt_device *cd);
+const char *crypt_get_wipe_checkpoint(struct crypt_device *cd);
+
+/* Wrapper of user progress callback, see crypt_set_progress_interval() */
+struct crypt_progress_throttle {
+	struct crypt_device *cd;
+	int (*progress)(uint64_t size, uint64_t offset, void *usrptr);
+	void *usrptr;
+};
+void crypt_progress_init(struct crypt_device *cd, struct crypt_progress_throttle *pt,
+			 int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+			 void *usrptr);
+int crypt_progress_throttled(uint64_t size, uint64_t offset, void *usrptr);
+bool crypt_get_sector_size_benchmark(struct crypt_device *cd);
+unsigned crypt_get_keyslot_parallel_unlock(struct crypt_device *cd);
+const char *crypt_get_keyslot_hint(struct crypt_device *cd);
+bool crypt_get_header_cache(struct crypt_device *cd);
+bool crypt_get_token_parallel_open(struct crypt_device *cd);
+void crypt_token_cd_lock(struct crypt_device *cd);
+void crypt_token_cd_unlock(struct crypt_device *cd);
+void *crypt_get_token_open_batch(struct crypt_device *cd);
+void crypt_set_token_open_batch(struct crypt_device *cd, void *batch);
+bool crypt_header_transaction_active(struct crypt_device *cd);
+uint64_t crypt_time_us(void);
+void crypt_timing_add(struct crypt_device *cd, crypt_timing_phase phase, uint64_t start_us);
+void crypt_memory_kdf(struct crypt_device *cd, uint64_t memory_kb);
+void crypt_memory_io_get(struct crypt_device *cd, size_t size);
+void crypt_memory_io_put(struct crypt_device *cd, size_t size);
+void crypt_safe_memory_usage(uint64_t *current, uint64_t *peak);
+#define VERIFIED_KEY_TAGS 8
+#define VERIFIED_KEY_TAG_SIZE 32
+int crypt_verified_key_lookup(struct crypt_device *cd, const char *params,
+			      const char *key, size_t key_length, char *tag);
+void crypt_verified_key_store(struct crypt_device *cd, const char *tag);
+int crypt_derived_key_cache_get(struct crypt_device *cd, const char *kdf, const char *hash,
+				const char *password, size_t password_length,
+				const char *salt, size_t salt_length,
+				char *key, size_t key_length,
+				uint32_t iterations, uint32_t memory, uint32_t parallel);
+void crypt_derived_key_cache_put(struct crypt_device *cd, const char *kdf, const char *hash,
+				 const char *password, size_t password_length,
+				 const char *salt, size_t salt_length,
+				 const char *key, size_t key_length,
+				 uint32_t iterations, uint32_t memory, uint32_t parallel);
+void crypt_derived_key_cache_flush(bool all);
 int crypt_benchmark_pbkdf_internal(struct crypt_device *cd,
 				   struct crypt_pbkdf_type *pbkdf,
 				   size_t volume_key_size);
+int crypt_benchmark_sector_size(struct crypt_device *cd, struct device *device,
+				const char *cipher, const char *cipher_mode,
+				size_t volume_key_size, uint32_t *sector_size);
 const char *crypt_get_cipher_spec(struct crypt_device *cd);
 
 /* Device backend */
@@ -113,14 +167,23 @@ void device_release_excl(struct crypt_device *cd, struct device *device);
 void device_disable_direct_io(struct device *device);
 int device_is_identical(struct device *device1, struct device *device2);
 int device_is_rotational(struct device *device);
+void device_invalidate_properties(struct device *device);
+void device_hint_sequential(int fd, uint64_t offset, uint64_t length);
+void device_hint_drop(int fd, uint64_t offset, uint64_t length);
+uint64_t device_inline_crypto_sizes(struct device *device, const char *mode);
+uint64_t device_zone_size(struct device *device);
+uint64_t device_write_zeroes_max_bytes(struct device *device);
 size_t device_alignment(struct device *device);
 int device_direct_io(const struct device *device);
 int device_fallocate(struct device *device, uint64_t size);
+int device_next_data(struct device *device, uint64_t offset, uint64_t *data_offset);
+int device_discard(struct device *device, uint64_t offset, uint64_t length);
 void device_sync(struct crypt_device *cd, struct device *device);
 int device_check_size(struct crypt_device *cd,
 		      struct device *device,
 		      uint64_t req_offset, int falloc);
 void device_set_block_size(struct device *device, size_t size);
+bool crypt_loop_direct_io(struct crypt_device *cd);
 size_t device_optimal_encryption_sector_size(struct crypt_device *cd, struct device *device);
 
 int device_open_locked(struct crypt_device *cd, struct device *device, int flags);
@@ -129,6 +192,8 @@ int device_write_lock(struct crypt_device *cd, struct device *device);
 void device_read_unlock(struct crypt_device *cd, struct device *device);
 void device_write_unlock(struct crypt_device *cd, struct device *device);
 bool device_is_locked(struct device *device);
+bool device_get_lock_hold(struct device *device);
+void device_set_lock_hold(struct crypt_device *cd, struct device *device, bool hold);
 
 enum devcheck { DEV_OK = 0, DEV_EXCL = 1 };
 int device_check_access(struct crypt_device *cd,
@@ -158,9 +223,19 @@ int crypt_confirm(struct crypt_device *cd, const char *msg);
 char *crypt_lookup_dev(const char *dev_id);
 int crypt_dev_is_rotational(int major, int minor);
 int crypt_dev_is_partition(const char *dev_path);
+uint64_t crypt_dev_inline_crypto_sizes(int major, int minor, const char *mode);
+uint64_t crypt_dev_zone_sectors(int major, int minor);
+uint64_t crypt_dev_write_zeroes_max_bytes(int major, int minor);
 char *crypt_get_partition_device(const char *dev_path, uint64_t offset, uint64_t size);
 char *crypt_get_base_device(const char *dev_path);
 uint64_t crypt_dev_partition_offset(const char *dev_path);
+int crypt_dev_get_stat(const char *dev_path, uint64_t *ios, uint64_t *ticks, uint64_t *in_flight);
+#define CRYPT_SYSFS_STAT_MIN	11
+int crypt_sysfs_get_stat(int major, int minor, const char *slave, uint64_t *val, unsigned count);
+int crypt_dev_get_slaves(int major, int minor, char **names, size_t names_length);
+int crypt_dev_numa_node(const char *dev_path);
+void crypt_numa_bind_buffer(void *buffer, size_t length, int node);
+int crypt_numa_node_cpus(int node, cpu_set_t *set);
 int lookup_by_disk_id(const char *dm_uuid);
 int lookup_by_sysfs_uuid_field(const char *dm_uuid);
 int crypt_uuid_cmp(const char *dm_uuid, const char *hdr_uuid);
@@ -181,6 +256,7 @@ int crypt_get_debug_level(void);
 void crypt_process_priority(struct crypt_device *cd, int *priority, bool raise);
 
 int crypt_metadata_locking_enabled(void);
+int crypt_metadata_read_optimistic_enabled(void);
 
 int crypt_random_init(struct crypt_device *ctx);
 int crypt_random_get(struct crypt_device *ctx, char *buf, size_t len, int quality);
@@ -213,6 +289,18 @@ int crypt_wipe_device(struct crypt_device *cd,
 	int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
 	void *usrptr);
 
+struct crypt_wipe_area {
+	uint64_t offset;
+	uint64_t length;
+	crypt_wipe_pattern pattern;
+};
+
+int crypt_wipe_device_areas(struct crypt_device *cd,
+	struct device *device,
+	const struct crypt_wipe_area *areas,
+	unsigned count,
+	size_t wipe_block_size);
+
 /* Internal integrity helpers */
 const char *crypt_get_integrity(struct crypt_device *cd);
 int crypt_get_integrity_key_size(struct crypt_device *cd);
@@ -232,7 +320,7 @@ static inline uint64_t compact_version(uint16_t major, uint16_t minor, uint16_t
 
 int kernel_version(uint64_t *kversion);
 
-int crypt_serialize_lock(struct crypt_device *cd);
+int crypt_serialize_lock(struct crypt_device *cd, uint32_t memory_kb);
 void crypt_serialize_unlock(struct crypt_device *cd);
 
 bool crypt_string_in(const char *str, char **list, size_t list_size);
@@ -25,6 +25,174 @@
 #include "luks2/luks2.h"
 #include "keyslot_context.h"
 
+static void key_cache_drop(struct crypt_keyslot_context *kc)
+{
+	crypt_safe_free(kc->i_key);
+	kc->i_key = NULL;
+	kc->i_key_size = 0;
+}
+
+/*
+ * Every keyslot write (change, destroy and add into the same slot) generates
+ * new KDF salt and usually moves keyslot area, cached key is bound to both.
+ */
+static int key_cache_keyslot_id(struct crypt_device *cd, int keyslot,
+				char *salt, size_t *salt_size, uint64_t *offset)
+{
+	struct luks2_hdr *hdr2;
+	struct luks_phdr *hdr1;
+	const char *salt2;
+	uint64_t length;
+	size_t len;
+
+	if ((hdr2 = crypt_get_hdr(cd, CRYPT_LUKS2))) {
+		if (!(salt2 = LUKS2_keyslot_salt(hdr2, keyslot)) ||
+		    LUKS2_keyslot_area(hdr2, keyslot, offset, &length))
+			return -ENOENT;
+		len = strlen(salt2);
+		if (len > KC_KEYSLOT_SALT_MAX)
+			return -EINVAL;
+		memcpy(salt, salt2, len);
+		*salt_size = len;
+		return 0;
+	}
+
+	if ((hdr1 = crypt_get_hdr(cd, CRYPT_LUKS1))) {
+		if (keyslot < 0 || keyslot >= LUKS_NUMKEYS)
+			return -ENOENT;
+		memcpy(salt, hdr1->keyblock[keyslot].passwordSalt, LUKS_SALTSIZE);
+		*salt_size = LUKS_SALTSIZE;
+		*offset = hdr1->keyblock[keyslot].keyMaterialOffset;
+		return 0;
+	}
+
+	return -EINVAL;
+}
+
+static bool key_cache_keyslot_match(struct crypt_device *cd, struct crypt_keyslot_context *kc)
+{
+	char salt[KC_KEYSLOT_SALT_MAX];
+	size_t salt_size;
+	uint64_t offset;
+
+	if (key_cache_keyslot_id(cd, kc->i_keyslot, salt, &salt_size, &offset))
+		return false;
+
+	return salt_size == kc->i_keyslot_salt_size && offset == kc->i_keyslot_offset &&
+	       !memcmp(salt, kc->i_keyslot_salt, salt_size);
+}
+
+/* Remember volume key unlocked by keyslot (or by token if keyslot is -1). */
+static void key_cache_store(struct crypt_device *cd, struct crypt_keyslot_context *kc,
+			    int keyslot, int r, const struct volume_key *vk)
+{
+	if (!kc->key_cache || r < 0 || !vk)
+		return;
+
+	key_cache_drop(kc);
+	if (keyslot >= 0 && key_cache_keyslot_id(cd, keyslot, kc->i_keyslot_salt,
+			&kc->i_keyslot_salt_size, &kc->i_keyslot_offset))
+		return;
+
+	if (!(kc->i_key = crypt_safe_alloc(vk->keylength)))
+		return;
+
+	memcpy(kc->i_key, vk->key, vk->keylength);
+	kc->i_key_size = vk->keylength;
+	kc->i_key_id = crypt_volume_key_get_id(vk);
+	kc->i_keyslot = keyslot;
+	kc->i_key_r = r;
+}
+
+static struct volume_key *key_cache_alloc(struct crypt_keyslot_context *kc)
+{
+	struct volume_key *vk;
+
+	vk = crypt_alloc_volume_key(kc->i_key_size, kc->i_key);
+	if (vk)
+		crypt_volume_key_set_id(vk, kc->i_key_id);
+
+	return vk;
+}
+
+/*
+ * Cached key is used only if it still matches the header, so a changed
+ * or another device just falls back to a regular keyslot open.
+ */
+static int key_cache_get_luks2(struct crypt_device *cd,
+	struct crypt_keyslot_context *kc,
+	int keyslot,
+	int segment,
+	struct volume_key **r_vk)
+{
+	struct luks2_hdr *hdr;
+	struct volume_key *vk;
+	int digest, r;
+
+	if (!kc->i_key || !(hdr = crypt_get_hdr(cd, CRYPT_LUKS2)))
+		return -ENOENT;
+
+	if (kc->i_keyslot >= 0) {
+		if ((keyslot != CRYPT_ANY_SLOT && keyslot != kc->i_keyslot) ||
+		    !key_cache_keyslot_match(cd, kc))
+			return -ENOENT;
+		digest = LUKS2_digest_by_keyslot(hdr, kc->i_keyslot);
+		if (digest < 0 || (segment != CRYPT_ANY_SEGMENT &&
+		    digest != LUKS2_digest_by_segment(hdr, segment)))
+			return -ENOENT;
+	} else if (segment == CRYPT_ANY_SEGMENT)
+		return -ENOENT;
+
+	if (!(vk = key_cache_alloc(kc)))
+		return -ENOMEM;
+
+	if (kc->i_keyslot >= 0)
+		r = LUKS2_digest_verify(cd, hdr, vk, kc->i_keyslot);
+	else
+		r = LUKS2_digest_verify_by_segment(cd, hdr, segment, vk);
+	if (r < 0) {
+		crypt_free_volume_key(vk);
+		return -ENOENT;
+	}
+
+	log_dbg(cd, "Using volume key cached in %s keyslot context.", keyslot_context_type_string(kc));
+	*r_vk = vk;
+	return kc->i_key_r;
+}
+
+static int key_cache_get_luks1(struct crypt_device *cd,
+	struct crypt_keyslot_context *kc,
+	int keyslot,
+	struct volume_key **r_vk)
+{
+	struct luks_phdr *hdr;
+	struct volume_key *vk;
+	crypt_keyslot_info ki;
+
+	if (!kc->i_key || kc->i_keyslot < 0 || !(hdr = crypt_get_hdr(cd, CRYPT_LUKS1)))
+		return -ENOENT;
+
+	if (keyslot != CRYPT_ANY_SLOT && keyslot != kc->i_keyslot)
+		return -ENOENT;
+
+	ki = LUKS_keyslot_info(hdr, kc->i_keyslot);
+	if ((ki != CRYPT_SLOT_ACTIVE && ki != CRYPT_SLOT_ACTIVE_LAST) ||
+	    !key_cache_keyslot_match(cd, kc))
+		return -ENOENT;
+
+	if (!(vk = key_cache_alloc(kc)))
+		return -ENOMEM;
+
+	if (LUKS_verify_volume_key(hdr, vk)) {
+		crypt_free_volume_key(vk);
+		return -ENOENT;
+	}
+
+	log_dbg(cd, "Using volume key cached in %s keyslot context.", keyslot_context_type_string(kc));
+	*r_vk = vk;
+	return kc->i_key_r;
+}
+
 static int get_luks2_key_by_passphrase(struct crypt_device *cd,
 	struct crypt_keyslot_context *kc,
 	int keyslot,
@@ -37,9 +205,15 @@ static int get_luks2_key_by_passphrase(struct crypt_device *cd,
 	assert(kc && kc->type == CRYPT_KC_TYPE_PASSPHRASE);
 	assert(r_vk);
 
+	r = key_cache_get_luks2(cd, kc, keyslot, segment, r_vk);
+	if (r >= 0 || r == -ENOMEM)
+		return r;
+
 	r = LUKS2_keyslot_open(cd, keyslot, segment, kc->u.p.passphrase, kc->u.p.passphrase_size, r_vk);
 	if (r < 0)
 		kc->error = r;
+	else
+		key_cache_store(cd, kc, r, r, *r_vk);
 
 	return r;
 }
@@ -55,10 +229,16 @@ static int get_luks1_volume_key_by_passphrase(struct crypt_device *cd,
 	assert(kc && kc->type == CRYPT_KC_TYPE_PASSPHRASE);
 	assert(r_vk);
 
+	r = key_cache_get_luks1(cd, kc, keyslot, r_vk);
+	if (r >= 0 || r == -ENOMEM)
+		return r;
+
 	r = LUKS_open_key_with_hdr(keyslot, kc->u.p.passphrase, kc->u.p.passphrase_size,
 				   crypt_get_hdr(cd, CRYPT_LUKS1), r_vk, cd);
 	if (r < 0)
 		kc->error = r;
+	else
+		key_cache_store(cd, kc, r, r, *r_vk);
 
 	return r;
 }
@@ -129,6 +309,10 @@ static int get_luks2_key_by_keyfile(struct crypt_device *cd,
 	assert(kc && kc->type == CRYPT_KC_TYPE_KEYFILE);
 	assert(r_vk);
 
+	r = key_cache_get_luks2(cd, kc, keyslot, segment, r_vk);
+	if (r >= 0 || r == -ENOMEM)
+		return r;
+
 	r = get_passphrase_by_keyfile(cd, kc, &passphrase, &passphrase_size);
 	if (r)
 		return r;
@@ -136,6 +320,8 @@ static int get_luks2_key_by_keyfile(struct crypt_device *cd,
 	r = LUKS2_keyslot_open(cd, keyslot, segment, passphrase, passphrase_size, r_vk);
 	if (r < 0)
 		kc->error = r;
+	else
+		key_cache_store(cd, kc, r, r, *r_vk);
 
 	return r;
 }
@@ -161,6 +347,10 @@ static int get_luks1_volume_key_by_keyfile(struct crypt_device *cd,
 	assert(kc && kc->type == CRYPT_KC_TYPE_KEYFILE);
 	assert(r_vk);
 
+	r = key_cache_get_luks1(cd, kc, keyslot, r_vk);
+	if (r >= 0 || r == -ENOMEM)
+		return r;
+
 	r = get_passphrase_by_keyfile(cd, kc, &passphrase, &passphrase_size);
 	if (r)
 		return r;
@@ -169,6 +359,8 @@ static int get_luks1_volume_key_by_keyfile(struct crypt_device *cd,
 				   crypt_get_hdr(cd, CRYPT_LUKS1), r_vk, cd);
 	if (r < 0)
 		kc->error = r;
+	else
+		key_cache_store(cd, kc, r, r, *r_vk);
 
 	return r;
 }
@@ -216,10 +408,16 @@ static int get_luks2_key_by_token(struct crypt_device *cd,
 	assert(kc && kc->type == CRYPT_KC_TYPE_TOKEN);
 	assert(r_vk);
 
+	r = key_cache_get_luks2(cd, kc, CRYPT_ANY_SLOT, segment, r_vk);
+	if (r >= 0 || r == -ENOMEM)
+		return r;
+
 	r = LUKS2_token_unlock_key(cd, crypt_get_hdr(cd, CRYPT_LUKS2), kc->u.t.id, kc->u.t.type,
 				   kc->u.t.pin, kc->u.t.pin_size, segment, kc->u.t.usrptr, r_vk);
 	if (r < 0)
 		kc->error = r;
+	else
+		key_cache_store(cd, kc, -1, r, *r_vk);
 
 	return r;
 }
@@ -268,6 +466,12 @@ static void unlock_method_init_internal(struct crypt_keyslot_context *kc)
 	kc->error = 0;
 	kc->i_passphrase = NULL;
 	kc->i_passphrase_size = 0;
+	kc->key_cache = false;
+	kc->i_key = NULL;
+	kc->i_key_size = 0;
+	kc->i_key_id = -1;
+	kc->i_keyslot = -1;
+	kc->i_key_r = -1;
 }
 
 void crypt_keyslot_unlock_by_key_init_internal(struct crypt_keyslot_context *kc,
@@ -350,6 +554,7 @@ void crypt_keyslot_context_destroy_internal(struct crypt_keyslot_context *kc)
 	crypt_safe_free(kc->i_passphrase);
 	kc->i_passphrase = NULL;
 	kc->i_passphrase_size = 0;
+	key_cache_drop(kc);
 }
 
 void crypt_keyslot_context_free(struct crypt_keyslot_context *kc)
@@ -464,6 +669,23 @@ int crypt_keyslot_context_set_pin(struct crypt_device *cd,
 	return 0;
 }
 
+int crypt_keyslot_context_set_key_cache(struct crypt_device *cd,
+	int enable,
+	struct crypt_keyslot_context *kc)
+{
+	if (!kc || kc->type == CRYPT_KC_TYPE_KEY)
+		return -EINVAL;
+
+	kc->key_cache = enable ? true : false;
+	if (!kc->key_cache)
+		key_cache_drop(kc);
+
+	log_dbg(cd, "Volume key cache in %s keyslot context %s.",
+		keyslot_context_type_string(kc), enable ? "enabled" : "disabled");
+
+	return 0;
+}
+
 int crypt_keyslot_context_get_type(const struct crypt_keyslot_context *kc)
 {
 	return kc ? kc->type : -EINVAL;
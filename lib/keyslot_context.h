@@ -46,7 +46,10 @@ typedef int (*keyslot_context_get_passphrase) (
 	const char **r_passphrase,
 	size_t *r_passphrase_size);
 
+#define KC_KEYSLOT_SALT_MAX 64
+
 /* crypt_keyslot_context */
+
 struct crypt_keyslot_context {
 	int type;
 
@@ -78,6 +81,18 @@ struct crypt_keyslot_context {
 	char *i_passphrase;
 	size_t i_passphrase_size;
 
+	/* unlocked volume key kept for next use when key cache is enabled */
+	bool key_cache;
+	char *i_key;
+	size_t i_key_size;
+	int i_key_id;
+	int i_keyslot;
+	int i_key_r;
+	/* identity (KDF salt and area) of the keyslot that unlocked cached key */
+	char i_keyslot_salt[KC_KEYSLOT_SALT_MAX];
+	size_t i_keyslot_salt_size;
+	uint64_t i_keyslot_offset;
+
 	keyslot_context_get_key		get_luks2_key;
 	keyslot_context_get_volume_key	get_luks1_volume_key;
 	keyslot_context_get_volume_key	get_luks2_volume_key;
@@ -41,6 +41,16 @@ extern "C" {
 /**
  * @defgroup crypt-init Cryptsetup device context initialization
  * Set of functions for creating and destroying @e crypt_device context
+ *
+ * Thread safety: different @e crypt_device contexts can be used
+ * concurrently from different threads of one process (e.g. activation,
+ * status query and reencryption each on its own context). One context
+ * must not be used from several threads at once. Library-wide settings
+ * (@link crypt_set_debug_level @endlink, default log callback, metadata
+ * locking and keyring switches) should be set before worker threads start.
+ * Device-mapper calls are serialized internally, metadata locking still
+ * applies between contexts accessing the same device.
+ *
  * @addtogroup crypt-init
  * @{
  */
@@ -173,6 +183,24 @@ int crypt_set_data_device(struct crypt_device *cd, const char *device);
  */
 int crypt_set_data_offset(struct crypt_device *cd, uint64_t data_offset);
 
+/**
+ * Set direct-io mode of loop devices allocated for image files.
+ *
+ * Loop devices created for regular files are configured with direct-io
+ * by default (the block size matches the encryption sector size), so that
+ * the image file content is not cached again below dm-crypt.
+ * Kernel silently uses buffered I/O if the backing filesystem
+ * does not support direct-io.
+ *
+ * @param cd crypt device handle
+ * @param enable 0 to use buffered I/O, 1 to request direct-io (default)
+ *
+ * @returns 0 on success or negative errno value otherwise.
+ *
+ * @note It applies only to loop devices attached after this call.
+ */
+int crypt_set_loop_direct_io(struct crypt_device *cd, int enable);
+
 /** @} */
 
 /**
@@ -298,6 +326,125 @@ struct crypt_pbkdf_type {
 int crypt_set_pbkdf_type(struct crypt_device *cd,
 	 const struct crypt_pbkdf_type *pbkdf);
 
+/**
+ * Set file with cache of PBKDF benchmark (calibration) results.
+ *
+ * Benchmarked PBKDF costs are stored in the file keyed by PBKDF type, hash,
+ * requested time, memory and threads limits, volume key size and host
+ * identity (CPU model, number of online CPUs, physical memory and crypto
+ * backend). Next keyslot with the same parameters on the same host class
+ * reuses the stored costs instead of running the benchmark.
+ *
+ * @param cd crypt device handle
+ * @param path cache file path (e.g. in /var/cache), @e NULL disables cache
+ *
+ * @return 0 on success or negative errno value otherwise.
+ *
+ * @note The file must be owned by root or current user and must not be
+ *	 writable by group or others, otherwise it is ignored.
+ */
+int crypt_set_pbkdf_cache(struct crypt_device *cd, const char *path);
+
+/** Maximal lifetime of derived key cache entry in milliseconds */
+#define CRYPT_DERIVED_KEY_CACHE_MAX_MS 60000
+
+/**
+ * Enable shared in-process cache of keyslot derived keys.
+ *
+ * Keyslots with the same PBKDF parameters and salt (cloned headers) unlocked
+ * by the same passphrase in one process then run the PBKDF only once.
+ * The cache is shared by all contexts in the process that enabled it,
+ * keys are kept in locked memory and wiped after @e timeout_ms.
+ *
+ * @param cd crypt device handle
+ * @param timeout_ms lifetime of cached keys, 0 disables the cache for @e cd
+ *
+ * @return 0 on success or negative errno value otherwise.
+ *
+ * @note Expired keys are wiped on next cache use or on crypt_free()
+ *	 of a context with the cache enabled.
+ */
+int crypt_set_derived_key_cache(struct crypt_device *cd, uint32_t timeout_ms);
+
+/**
+ * Unlock LUKS2 keyslots of the same priority in parallel.
+ *
+ * If a passphrase is not bound to a specific keyslot, PBKDF of up to
+ * @e max_parallel keyslots runs concurrently in separate threads, limited
+ * also by available physical memory for memory-hard PBKDFs.
+ * The first keyslot that unlocks the volume key wins; derivations already
+ * running are waited for, no new ones are started. Keyslot area decryption
+ * and AF merge run in the calling thread after each derivation finishes.
+ *
+ * @param cd crypt device handle
+ * @param max_parallel maximal number of concurrent keyslot derivations,
+ *	  0 or 1 means sequential unlock (default)
+ *
+ * @return 0 on success or negative errno value otherwise.
+ *
+ * @note Peak memory is the sum of all concurrently running memory-hard PBKDFs.
+ */
+int crypt_set_keyslot_parallel_unlock(struct crypt_device *cd, unsigned max_parallel);
+
+/**
+ * Set keyslot hint label used to order LUKS2 keyslot unlock attempts.
+ *
+ * If a passphrase is not bound to a specific keyslot, keyslots tagged with
+ * the same label by @link crypt_keyslot_set_hint @endlink are tried first,
+ * before all others in usual priority order.
+ *
+ * @param cd crypt device handle
+ * @param hint non-secret label (e.g. user name), @e NULL to clear it
+ *
+ * @return 0 on success or negative errno value otherwise.
+ */
+int crypt_set_keyslot_hint(struct crypt_device *cd, const char *hint);
+
+/**
+ * Enable shared in-process cache of parsed LUKS2 headers.
+ *
+ * Intended for long-running processes that load the same devices repeatedly.
+ * With the cache enabled, @link crypt_load @endlink reads only the primary
+ * binary header and, if it is unchanged since the header was last fully read
+ * in this process, uses the cached metadata instead of reading, checksumming
+ * and parsing both header copies.
+ *
+ * @param cd crypt device handle
+ * @param enable 0 to disable (default), any other value to enable
+ *
+ * @return 0 on success or negative errno value otherwise.
+ *
+ * @note Damage of the secondary header (or of the JSON area of an unchanged
+ *	 primary one) is not detected while the cached header is used.
+ *	 Header repair never uses the cache.
+ * @note Cached headers are released and wiped when the last crypt device
+ *	 context in the process is freed.
+ */
+int crypt_set_header_cache(struct crypt_device *cd, int enable);
+
+/**
+ * Enable concurrent open of LUKS2 tokens.
+ *
+ * With @link crypt_activate_by_token @endlink and CRYPT_ANY_TOKEN (and no pin),
+ * open callbacks of all usable tokens with the same keyslot priority run
+ * in parallel threads. Token passphrases are used in token order as in
+ * sequential open; the call returns once a token unlocks a keyslot, results
+ * of tokens still running are discarded.
+ *
+ * @param cd crypt device handle
+ * @param enable 0 to disable (default), any other value to enable
+ *
+ * @return 0 on success or negative errno value otherwise.
+ *
+ * @note Token handlers must tolerate concurrent open calls on the same
+ *	 device context. Their @link crypt_token_json_get @endlink and logging
+ *	 calls are serialized with the token open code of the library.
+ *	 Running callbacks cannot be interrupted, callbacks left running are
+ *	 waited for in the next token open or in @link crypt_free @endlink,
+ *	 the @e usrptr passed to them must stay valid until then.
+ */
+int crypt_set_token_parallel_open(struct crypt_device *cd, int enable);
+
 /**
  * Get PBKDF (Password-Based Key Derivation Algorithm) parameters.
  *
@@ -371,6 +518,48 @@ int crypt_memory_lock(struct crypt_device *cd, int lock) __attribute__((deprecat
  */
 int crypt_metadata_locking(struct crypt_device *cd, int enable);
 
+/**
+ * Set global optimistic (lock-free) read of on-disk metadata.
+ *
+ * If enabled, LUKS2 header load first reads both header copies without
+ * taking the metadata lock. The result is used only if both copies have
+ * valid checksums and the same sequence id (no concurrent update was
+ * in progress), otherwise the header is read again under read lock.
+ * Intended for monitoring tools that only inspect metadata (status, dump),
+ * so they do not contend on the locking directory.
+ *
+ * @param cd crypt device handle, can be @e NULL
+ * @param enable 0 to disable (default) otherwise enable optimistic read
+ *
+ * @returns @e 0 on success or negative errno value otherwise.
+ *
+ * @note The switch is global on the library level.
+ * @note Metadata updates still verify the sequence id under write lock,
+ *	 so a concurrently changed header is never written back.
+ */
+int crypt_metadata_read_optimistic(struct crypt_device *cd, int enable);
+
+/**
+ * Keep metadata lock handle of crypt device context between operations.
+ *
+ * Every metadata access opens, locks, verifies and finally unlinks
+ * the on-disk metadata lock file (several system calls each time). With
+ * lock hold enabled, the opened lock handle is kept after its last user
+ * releases the lock and following accesses only lock and verify it again
+ * (sequence id of metadata in context is verified as with a new write lock).
+ *
+ * @param cd crypt device handle
+ * @param enable 0 to disable and release kept lock handle, otherwise enable it
+ *
+ * @returns @e 0 on success or negative errno value otherwise.
+ *
+ * @note The lock itself is still released after each metadata access, so
+ *	 the kept handle never blocks other contexts or processes (also while
+ *	 the caller waits for a passphrase or a key is derived).
+ *	 @link crypt_free @endlink releases the kept handle.
+ */
+int crypt_metadata_lock_hold(struct crypt_device *cd, int enable);
+
 /**
  * Set metadata header area sizes. This applies only to LUKS2.
  * These values limit amount of metadata anf number of supportable keyslots.
@@ -450,6 +639,15 @@ const char *crypt_get_type(struct crypt_device *cd);
  */
 const char *crypt_get_default_type(void);
 
+/**
+ * Get description of crypto backend used by the library
+ *
+ * @param cd crypt device handle, can be @e NULL
+ * @return backend name and version (e.g. "OpenSSL 3.0.8 7 Feb 2023")
+ *	   or @e NULL if the backend cannot be initialized.
+ */
+const char *crypt_get_crypto_backend(struct crypt_device *cd);
+
 /**
  *
  * Structure used as parameter for PLAIN device type.
@@ -524,6 +722,8 @@ struct crypt_params_verity {
 #define CRYPT_VERITY_CREATE_HASH (UINT32_C(1) << 2)
 /** Root hash signature required for activation */
 #define CRYPT_VERITY_ROOT_HASH_SIGNATURE (UINT32_C(1) << 3)
+/** Prefetch upper hash tree levels after activation */
+#define CRYPT_VERITY_PREFETCH_HASH (UINT32_C(1) << 4)
 
 /**
  *
@@ -648,6 +848,57 @@ int crypt_format(struct crypt_device *cd,
 	size_t volume_key_size,
 	void *params);
 
+/**
+ * Create LUKS2 header describing existing TCRYPT or FVAULT2 encrypted data.
+ *
+ * The only segment uses the cipher, data offset, IV offset and size of the
+ * source device, so the data is accessible through LUKS2 unchanged.
+ * After adding a keyslot for @e volume_key, standard LUKS2 reencryption
+ * (@link crypt_reencrypt_init_by_passphrase @endlink) converts data in place
+ * to a new volume key and cipher in one pass, without activating the source.
+ *
+ * @param cd crypt device handle initialized with detached header
+ *	  device and the source data device (@link crypt_init_data_device @endlink)
+ * @param cd_src crypt device handle with loaded TCRYPT or FVAULT2 metadata
+ * @param volume_key volume key of the source device
+ *	  (@link crypt_volume_key_get @endlink for @e cd_src)
+ * @param volume_key_size size of @e volume_key
+ * @param params LUKS2 format parameters or @e NULL, data alignment, data device,
+ *	  integrity and sector size are not used
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note LUKS2 keyslots area is limited by the data offset of the source device,
+ *	 it must be large enough for keyslots of both old and new volume key.
+ *	 The segment has fixed size of the source volume, set the same
+ *	 @e device_size in @ref crypt_params_reencrypt, otherwise reencryption
+ *	 continues up to the end of the data device. BITLK, TCRYPT system encryption and TCRYPT cipher chains are
+ *	 not supported.
+ */
+int crypt_format_luks2_adopt(struct crypt_device *cd,
+	struct crypt_device *cd_src,
+	const char *volume_key,
+	size_t volume_key_size,
+	const struct crypt_params_luks2 *params);
+
+/**
+ * Enable measurement of encryption sector size in LUKS2 format.
+ *
+ * If the sector size is auto-detected (@e 0 in LUKS2 params), @ref crypt_format
+ * measures userspace encryption throughput and direct-io random read latency
+ * of the data device for 512 to 4096 bytes sectors. The fastest size that
+ * the device does not penalize is used, subject to the same alignment
+ * constraints as auto-detection. Measured values are in debug output.
+ *
+ * @param cd crypt device handle
+ * @param enable @e 1 to enable, @e 0 to use only device block sizes (default)
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note Only reads from the device, writes are not measured.
+ */
+int crypt_set_sector_size_benchmark(struct crypt_device *cd, int enable);
+
 /**
  * Set format compatibility flags.
  *
@@ -759,6 +1010,25 @@ const char *crypt_get_subsystem(struct crypt_device *cd);
  */
 int crypt_volume_key_keyring(struct crypt_device *cd, int enable);
 
+/**
+ * Enable or disable udev synchronization of device-mapper devices.
+ *
+ * If disabled, device nodes are created and removed directly by the library
+ * and no udev cookies or semaphores are used. This is intended for
+ * environments without running udev (containers, minimal initramfs),
+ * where waiting for udev can only time out.
+ *
+ * @param cd crypt device handle, can be @e NULL
+ * @param enable 0 to disable udev synchronization, otherwise enable it (default)
+ *
+ * @returns @e 0 on success or negative errno value otherwise.
+ *
+ * @note The switch is global on the library level.
+ * @note With udev running, udev rules are still processed for created
+ * 	 devices, but callers are not synchronized with them.
+ */
+int crypt_set_udev_sync(struct crypt_device *cd, int enable);
+
 /**
  * Load crypt device parameters from on-disk header.
  *
@@ -833,6 +1103,49 @@ int crypt_resize(struct crypt_device *cd,
 int crypt_suspend(struct crypt_device *cd,
 	const char *name);
 
+/**
+ * Suspend crypt device and hold its volume key in kernel keyring.
+ *
+ * Volume key is stored as user type key (described by the LUKS UUID and
+ * the device name) in user keyring and expires after @e timeout seconds.
+ * The device can be resumed without passphrase (and KDF)
+ * by @link crypt_resume_by_held_key @endlink until then.
+ *
+ * @param cd crypt device handle
+ * @param name name of device to suspend
+ * @param volume_key verified volume key or @e NULL to use the key from active table
+ * @param volume_key_size size of @e volume_key
+ * @param timeout held key lifetime in seconds (must be non-zero)
+ *
+ * @return 0 on success or negative errno value otherwise,
+ * 	   @e -ENOKEY if @e volume_key is @e NULL and active table references
+ * 	   kernel keyring key (the key must be provided then).
+ *
+ * @note Only LUKS device type is supported
+ */
+int crypt_suspend_with_held_key(struct crypt_device *cd,
+	const char *name,
+	const char *volume_key,
+	size_t volume_key_size,
+	unsigned int timeout);
+
+/**
+ * Resume crypt device using volume key held in kernel keyring.
+ *
+ * @param cd crypt device handle
+ * @param name name of device to resume
+ *
+ * @return 0 on success, @e -ENOKEY if there is no (or expired) held key,
+ * 	   @e -EPERM if the held key does not match the volume
+ * 	   or negative errno value otherwise.
+ *
+ * @note The held key is verified against the volume key digest and
+ *	 revoked after successful resume (or if it does not match).
+ * @note Only LUKS device type is supported
+ */
+int crypt_resume_by_held_key(struct crypt_device *cd,
+	const char *name);
+
 /**
  * Resume crypt device using passphrase.
  *
@@ -996,6 +1309,39 @@ int crypt_keyslot_change_by_passphrase(struct crypt_device *cd,
 	const char *new_passphrase,
 	size_t new_passphrase_size);
 
+/**
+ * Convert several LUKS2 keyslots to the PBKDF and keyslot
+ * encryption currently set in context, each keeping its passphrase.
+ *
+ * The PBKDF is benchmarked once for all keyslots, old and new key
+ * derivations of different keyslots run in parallel (limited by
+ * @link crypt_set_keyslot_parallel_unlock @endlink, or by online CPUs
+ * if it is not set, and by available memory). If any keyslot cannot be
+ * unlocked, nothing is changed.
+ *
+ * Keyslots are then committed one by one, each is stored to a free keyslot
+ * area and its old area is wiped after the commit. An interruption leaves
+ * every keyslot either converted or untouched.
+ *
+ * @pre @e cd contains initialized and formatted LUKS2 device context
+ *
+ * @param cd crypt device handle
+ * @param keyslots array of keyslots to be converted
+ * @param passphrases array of passphrases, one for each keyslot
+ * @param passphrase_sizes array of passphrase sizes
+ * @param count number of keyslots to convert
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note Without a free keyslot area a keyslot is overwritten in place,
+ *	 as in single keyslot conversion. A header backup is recommended.
+ */
+int crypt_keyslot_convert_by_passphrases(struct crypt_device *cd,
+	const int *keyslots,
+	const char *const *passphrases,
+	const size_t *passphrase_sizes,
+	size_t count);
+
 /**
 * Add key slot using provided key file path.
  *
@@ -1224,6 +1570,28 @@ int crypt_keyslot_context_set_pin(struct crypt_device *cd,
 	const char *pin, size_t pin_size,
 	struct crypt_keyslot_context *kc);
 
+/**
+ * Keep volume key unlocked by keyslot context for its next use.
+ *
+ * Subsequent operations with the same context (e.g. passphrase check,
+ * keyslot add and reencryption initialization) then do not run keyslot
+ * PBKDF again. Cached key is used only if it still matches the device
+ * header digest and the keyslot that unlocked it was not rewritten since
+ * (changed, destroyed or added again), otherwise keyslot is opened as usual.
+ *
+ * @param cd crypt device handle (used for logging only)
+ * @param enable 1 to enable, 0 to disable and wipe cached key
+ * @param kc keyslot context (@link CRYPT_KC_TYPE_KEY @endlink is not allowed)
+ *
+ * @return zero on success or negative errno otherwise
+ *
+ * @note The key is stored in locked memory and wiped in
+ * 	 @link crypt_keyslot_context_free @endlink.
+ */
+int crypt_keyslot_context_set_key_cache(struct crypt_device *cd,
+	int enable,
+	struct crypt_keyslot_context *kc);
+
 /**
  * @defgroup crypt-keyslot-context-types Crypt keyslot context
  * @addtogroup crypt-keyslot-context-types
@@ -1304,6 +1672,24 @@ int crypt_keyslot_add_by_keyslot_context(struct crypt_device *cd,
  * @note Note that there is no passphrase verification used.
  */
 int crypt_keyslot_destroy(struct crypt_device *cd, int keyslot);
+
+/**
+ * Destroy (and disable) all active key slots in one operation.
+ *
+ * Keyslot areas are wiped first (adjacent areas as one extent),
+ * metadata is then written only once.
+ *
+ * @pre @e cd contains initialized and formatted LUKS device context
+ *
+ * @param cd crypt device handle
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note Only keyslots assigned to a volume key digest are destroyed,
+ * 	 LUKS2 unbound and reencryption keyslots are kept.
+ * @note Note that there is no passphrase verification used.
+ */
+int crypt_keyslot_destroy_all(struct crypt_device *cd);
 /** @} */
 
 /**
@@ -1351,7 +1737,7 @@ int crypt_keyslot_destroy(struct crypt_device *cd, int keyslot);
 #define CRYPT_ACTIVATE_RECALCULATE (UINT32_C(1) << 17)
 /** reactivate existing and update flags, input only */
 #define CRYPT_ACTIVATE_REFRESH	(UINT32_C(1) << 18)
-/** Use global lock to serialize memory hard KDF on activation (OOM workaround) */
+/** Admit memory hard KDF on activation only if it fits into memory (OOM workaround) */
 #define CRYPT_ACTIVATE_SERIALIZE_MEMORY_HARD_PBKDF (UINT32_C(1) << 19)
 /** dm-integrity: direct writes, use bitmap to track dirty sectors */
 #define CRYPT_ACTIVATE_NO_JOURNAL_BITMAP (UINT32_C(1) << 20)
@@ -1394,6 +1780,33 @@ int crypt_get_active_device(struct crypt_device *cd,
 	const char *name,
 	struct crypt_active_device *cad);
 
+/**
+ * Active device entry returned by @link crypt_get_active_devices @endlink.
+ */
+struct crypt_active_device_entry {
+	char name[128];	/**< device-mapper device name */
+	char type[16];	/**< device type from dm uuid (e.g. LUKS2, PLAIN, VERITY) */
+	char uuid[129];	/**< dm uuid without CRYPT- prefix */
+	struct crypt_active_device info; /**< runtime attributes */
+};
+
+/**
+ * Receive runtime attributes of all active devices created by libcryptsetup.
+ *
+ * @param cd crypt device handle (can be @e NULL)
+ * @param entries allocated array of active devices, caller must free() it
+ * @param count number of entries in array
+ *
+ * @return @e 0 on success or negative errno value otherwise
+ *
+ * @note Only device-mapper tables are read, on-disk metadata is never loaded.
+ *	 The offsets are read from the dm table directly, for TCRYPT devices
+ *	 they may differ from @link crypt_get_active_device @endlink output.
+ */
+int crypt_get_active_devices(struct crypt_device *cd,
+	struct crypt_active_device_entry **entries,
+	size_t *count);
+
 /**
  * Get detected number of integrity failures.
  *
@@ -1405,6 +1818,83 @@ int crypt_get_active_device(struct crypt_device *cd,
  */
 uint64_t crypt_get_active_integrity_failures(struct crypt_device *cd,
 	const char *name);
+
+/**
+ * Wait for device-mapper event of active device and get its failure counter.
+ *
+ * Blocks until the device event counter differs from @e event_nr, returns
+ * immediately if it already differs. Monitoring can start with @e event_nr 0
+ * and pass the updated value back, each call then waits for the next event.
+ *
+ * dm-integrity and dm-verity do not raise a dm event on detected corruption,
+ * for these targets the status is polled (twice per second) and the call
+ * also returns when the failure counter changes during the call.
+ *
+ * @param cd crypt device handle (can be @e NULL)
+ * @param name name of active device
+ * @param event_nr last seen event counter, updated to the current one
+ * @param failures number of integrity failures for dm-integrity device,
+ *	  1 if dm-verity device detected corruption, 0 otherwise
+ *
+ * @return @e 0 on success or negative errno value otherwise
+ *
+ * @note The call blocks the calling thread, use a thread per device
+ *	 to wait for several devices at once.
+ * @note For other targets only a change raising a dm event is reported,
+ *	 see the kernel documentation of the target.
+ */
+int crypt_wait_active_device_failures(struct crypt_device *cd,
+	const char *name,
+	uint32_t *event_nr,
+	uint64_t *failures);
+
+/**
+ * Block layer I/O counters of a device returned by
+ * @link crypt_get_active_device_io_stats @endlink.
+ *
+ * Counters are cumulative since the device was created,
+ * times are in milliseconds (see kernel Documentation/block/stat.rst).
+ */
+struct crypt_device_io_stats {
+	char name[128];		/**< device-mapper name or kernel name of lower block device */
+	char kernel_name[32];	/**< kernel block device name (e.g. dm-0, sda1) */
+	int dm;			/**< @e 1 for device-mapper device, @e 0 for other block device */
+	uint64_t read_ios;	/**< completed read requests */
+	uint64_t read_sectors;	/**< sectors (512 bytes) read */
+	uint64_t read_ticks;	/**< time spent by read requests */
+	uint64_t write_ios;	/**< completed write requests */
+	uint64_t write_sectors;	/**< sectors (512 bytes) written */
+	uint64_t write_ticks;	/**< time spent by write requests */
+	uint64_t in_flight;	/**< requests in flight now */
+	uint64_t io_ticks;	/**< time the device had requests in flight */
+	uint64_t time_in_queue;	/**< weighted time of all requests in flight */
+	uint64_t discard_ios;	/**< completed discard requests (@e 0 if not provided) */
+	uint64_t discard_sectors; /**< sectors discarded (@e 0 if not provided) */
+	uint64_t flush_ios;	/**< completed flush requests (@e 0 if not provided) */
+};
+
+/**
+ * Read I/O counters of active device and all devices it is stacked on.
+ *
+ * The first entry is the active device itself, followed by all its
+ * device-mapper dependencies (e.g. dm-integrity device) and then
+ * by other lower block devices (e.g. disk partition).
+ *
+ * @param cd crypt device handle (can be @e NULL)
+ * @param name name of active device
+ * @param stats allocated array of device counters, caller must free() it
+ * @param count number of entries in array
+ *
+ * @return @e 0 on success or negative errno value otherwise
+ *
+ * @note Counters are read at one moment, the caller computes rates
+ *	 from difference of two calls.
+ */
+int crypt_get_active_device_io_stats(struct crypt_device *cd,
+	const char *name,
+	struct crypt_device_io_stats **stats,
+	size_t *count);
+
 /** @} */
 
 /**
@@ -1453,6 +1943,56 @@ int crypt_persistent_flags_set(struct crypt_device *cd,
 	crypt_flags_type type,
 	uint32_t flags);
 
+/**
+ * Suggest dm-crypt performance activation flags for the data device.
+ *
+ * Bypassing dm-crypt read and write workqueues is suggested for
+ * non-rotational devices if the kernel supports it, no flags are suggested
+ * for rotational devices.
+ *
+ * @param cd crypt device handle
+ * @param flags suggested activation flags (@see aflags)
+ *
+ * @return @e 0 on success or negative errno value otherwise
+ *
+ * @note Flags can be stored in LUKS2 header with @link crypt_persistent_flags_set @endlink
+ *	 so later activations reuse them.
+ */
+int crypt_performance_flags_hint(struct crypt_device *cd, uint32_t *flags);
+
+/**
+ * Check if the data device hardware can do inline encryption (blk-crypto)
+ * with the device cipher, volume key size and encryption sector size.
+ *
+ * @param cd crypt device handle
+ *
+ * @return @e 1 if supported, @e 0 if not or negative errno value otherwise
+ *
+ * @note Only the hardware capability is reported, the dm-crypt target
+ *	 does not offload encryption to inline encryption hardware.
+ */
+int crypt_inline_crypto_supported(struct crypt_device *cd);
+
+/**
+ * Reload dm-crypt performance flags of an active device.
+ *
+ * The volume key is reused from the active mapping (including the kernel
+ * keyring reference), no passphrase or header access is needed.
+ *
+ * @param cd crypt device handle
+ * @param name name of active device
+ * @param flags new performance flags, combination of
+ *	  @e CRYPT_ACTIVATE_SAME_CPU_CRYPT, @e CRYPT_ACTIVATE_SUBMIT_FROM_CRYPT_CPUS,
+ *	  @e CRYPT_ACTIVATE_NO_READ_WORKQUEUE and @e CRYPT_ACTIVATE_NO_WRITE_WORKQUEUE
+ *
+ * @return @e 0 on success or negative errno value otherwise
+ *
+ * @note Flags not listed above are kept, parameters changing data layout
+ *	 (sector size, IV large sectors) cannot be changed on active device.
+ * @note Only a single dm-crypt segment without integrity is supported.
+ */
+int crypt_reload_performance_flags(struct crypt_device *cd, const char *name, uint32_t flags);
+
 /**
  * Get persistent flags stored in header.
  *
@@ -1465,25 +2005,72 @@ int crypt_persistent_flags_set(struct crypt_device *cd,
 int crypt_persistent_flags_get(struct crypt_device *cd,
 	crypt_flags_type type,
 	uint32_t *flags);
-/** @} */
 
 /**
- * @defgroup crypt-activation Device activation
- * @addtogroup crypt-activation
- * @{
+ * Start LUKS2 header transaction.
+ *
+ * Until @link crypt_header_transaction_commit @endlink or
+ * @link crypt_header_transaction_abort @endlink, operations that change
+ * LUKS2 metadata (like @link crypt_token_json_set @endlink,
+ * @link crypt_keyslot_add_by_key @endlink or
+ * @link crypt_persistent_flags_set @endlink) are validated and applied
+ * in memory only; the header is written once on commit.
+ *
+ * @param cd crypt device handle
+ *
+ * @return @e 0 on success or negative errno value otherwise
+ *	   (@e -EBUSY if a transaction is already active or reencryption runs
+ *	   or is initialized in metadata, reencryption and its crash recovery
+ *	   always commit directly).
+ *
+ * @note Binary keyslot area data is still written immediately, only
+ *	 metadata referencing it is deferred. Replacing or destroying an existing
+ *	 keyslot inside a transaction is therefore not crash-safe before commit.
+ * @note Uncommitted changes are lost on @link crypt_free @endlink.
  */
+int crypt_header_transaction_begin(struct crypt_device *cd);
 
 /**
- * Activate device or check passphrase.
+ * Write all LUKS2 metadata changes made since
+ * @link crypt_header_transaction_begin @endlink in a single header update.
  *
  * @param cd crypt device handle
- * @param name name of device to create, if @e NULL only check passphrase
- * @param keyslot requested keyslot to check or @e CRYPT_ANY_SLOT
- * @param passphrase passphrase used to unlock volume key
- * @param passphrase_size size of @e passphrase
- * @param flags activation flags
  *
- * @return unlocked key slot number or negative errno otherwise.
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note On failure (including detected concurrent metadata update)
+ *	 header is reloaded from the device and staged changes are lost.
+ */
+int crypt_header_transaction_commit(struct crypt_device *cd);
+
+/**
+ * Drop LUKS2 metadata changes made since
+ * @link crypt_header_transaction_begin @endlink and reload header from device.
+ *
+ * @param cd crypt device handle
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ */
+int crypt_header_transaction_abort(struct crypt_device *cd);
+/** @} */
+
+/**
+ * @defgroup crypt-activation Device activation
+ * @addtogroup crypt-activation
+ * @{
+ */
+
+/**
+ * Activate device or check passphrase.
+ *
+ * @param cd crypt device handle
+ * @param name name of device to create, if @e NULL only check passphrase
+ * @param keyslot requested keyslot to check or @e CRYPT_ANY_SLOT
+ * @param passphrase passphrase used to unlock volume key
+ * @param passphrase_size size of @e passphrase
+ * @param flags activation flags
+ *
+ * @return unlocked key slot number or negative errno otherwise.
  */
 int crypt_activate_by_passphrase(struct crypt_device *cd,
 	const char *name,
@@ -1492,6 +2079,109 @@ int crypt_activate_by_passphrase(struct crypt_device *cd,
 	size_t passphrase_size,
 	uint32_t flags);
 
+/**
+ * Asynchronous activation job.
+ * @see crypt_activate_by_passphrase_async
+ */
+struct crypt_activation_job;
+
+/**
+ * Start activation or passphrase check in a background thread.
+ *
+ * The job runs @link crypt_activate_by_passphrase @endlink on @e cd, the device
+ * handle must not be used by the caller until the job finished. Log callbacks
+ * are called from the job thread. Passphrase is copied.
+ *
+ * Cancel request and deadline abort key derivation between Argon2 slices
+ * (bundled Argon2), PBKDF2 iteration chunks (internal PBKDF2) or before the next
+ * keyslot is tried, and stop activation before the device-mapper device is
+ * created. Once the device is created, activation (including udev wait)
+ * finishes regardless of them.
+ *
+ * @param cd crypt device handle
+ * @param name name of device to create, if @e NULL only check passphrase
+ * @param keyslot requested keyslot to check or @e CRYPT_ANY_SLOT
+ * @param passphrase passphrase used to unlock volume key
+ * @param passphrase_size size of @e passphrase
+ * @param flags activation flags
+ * @param timeout_ms deadline in milliseconds from now, @e 0 means no deadline
+ * @param job on success, the started job, must be freed with
+ *	  @link crypt_activation_job_free @endlink
+ *
+ * @return @e 0 if the job was started or negative errno value otherwise.
+ */
+int crypt_activate_by_passphrase_async(struct crypt_device *cd,
+	const char *name,
+	int keyslot,
+	const char *passphrase,
+	size_t passphrase_size,
+	uint32_t flags,
+	uint32_t timeout_ms,
+	struct crypt_activation_job **job);
+
+/**
+ * Get file descriptor of activation job for poll(2).
+ *
+ * The descriptor (eventfd) becomes readable when the job finished,
+ * it is owned by the job.
+ *
+ * @param job activation job
+ *
+ * @return file descriptor or negative errno value otherwise.
+ */
+int crypt_activation_job_get_fd(struct crypt_activation_job *job);
+
+/**
+ * Request cancellation of activation job, returns immediately.
+ *
+ * @param job activation job
+ */
+void crypt_activation_job_cancel(struct crypt_activation_job *job);
+
+/**
+ * Get result of activation job.
+ *
+ * @param job activation job
+ *
+ * @return @e -EINPROGRESS while the job is running, otherwise the return value
+ *	   of @link crypt_activate_by_passphrase @endlink, @e -ECANCELED if the job
+ *	   was cancelled or @e -ETIMEDOUT if the deadline expired.
+ */
+int crypt_activation_job_result(struct crypt_activation_job *job);
+
+/**
+ * Cancel activation job if it is still running, wait for it and release it.
+ *
+ * @param job activation job
+ */
+void crypt_activation_job_free(struct crypt_activation_job *job);
+
+/**
+ * Check whether any of the given passphrases unlocks a keyslot.
+ *
+ * This is intended for auditing weak passphrases with a dictionary;
+ * for LUKS1 the candidates are derived in batches using @e threads threads,
+ * LUKS2 keyslots are tried one candidate after another.
+ *
+ * @param cd crypt device handle
+ * @param keyslot requested keyslot to check or @e CRYPT_ANY_SLOT
+ * @param passphrases array of @e count candidate passphrases
+ * @param passphrase_sizes sizes of passphrases in @e passphrases
+ * @param count number of candidates
+ * @param threads number of threads to use, 0 means number of online CPUs
+ * @param index on success, index of the matching passphrase
+ *
+ * @return unlocked key slot number, -EPERM if no candidate matches
+ *	   or negative errno otherwise.
+ */
+int crypt_keyslot_test_passphrases(struct crypt_device *cd,
+	int keyslot,
+	const char *const *passphrases,
+	const size_t *passphrase_sizes,
+	size_t count,
+	unsigned threads,
+	size_t *index);
+
 /**
  * Activate device or check using key file.
  *
@@ -1607,6 +2297,87 @@ int crypt_activate_by_keyring(struct crypt_device *cd,
 	int keyslot,
 	uint32_t flags);
 
+/**
+ * Stage verified volume key in the kernel session keyring, so that several
+ * dm-crypt mappings can reference it without loading the key again.
+ *
+ * @param cd crypt device handle
+ * @param volume_key volume key
+ * @param volume_key_size size of volume_key
+ * @param key_description logon key description (in "prefix:description" format)
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note Only LUKS2 devices (without reencryption in progress) are supported.
+ * @note Deactivation of a device referencing the staged key does not drop it
+ * 	 in this context, use @link crypt_volume_key_keyring_drop @endlink.
+ * 	 The key stays in the session keyring after the context is freed.
+ */
+int crypt_volume_key_keyring_stage(struct crypt_device *cd,
+	const char *volume_key,
+	size_t volume_key_size,
+	const char *key_description);
+
+/**
+ * Activate device referencing volume key already staged in kernel keyring.
+ *
+ * @param cd crypt device handle
+ * @param name name of device to create
+ * @param key_description staged logon key description or @e NULL to use
+ *        the key staged by @link crypt_volume_key_keyring_stage @endlink in this context
+ * @param flags activation flags
+ *
+ * @return @e 0 on success or negative errno value otherwise
+ *	   (@e -ENOENT if no key is staged, @e -EPERM if @e key_description
+ *	   differs from the staged key).
+ *
+ * @note Only the key staged and verified by
+ *	 @link crypt_volume_key_keyring_stage @endlink in this context is accepted,
+ *	 logon key content cannot be read back and verified here.
+ */
+int crypt_activate_by_staged_volume_key(struct crypt_device *cd,
+	const char *name,
+	const char *key_description,
+	uint32_t flags);
+
+/**
+ * Revoke and unlink volume key staged in kernel keyring by this context.
+ *
+ * @param cd crypt device handle
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ */
+int crypt_volume_key_keyring_drop(struct crypt_device *cd);
+
+/**
+ * Start batch of device activations sharing one udev synchronization.
+ *
+ * Devices created in the calling thread by any activation function
+ * (of any context) until
+ * @link crypt_activate_batch_end @endlink are not waited for one by one,
+ * the udev processing of all of them is waited for once at the batch end.
+ * Each activation still returns its own result.
+ *
+ * @param cd crypt device handle used for logging, can be @e NULL
+ *
+ * @return @e 0 on success or negative errno value otherwise
+ *	   (-EBUSY if another batch is already running in this thread).
+ *
+ * @note Device nodes of devices activated in the batch may not exist
+ * 	 before the batch end. The batch collects devices activated
+ * 	 by the calling thread only, other threads are not affected.
+ */
+int crypt_activate_batch_begin(struct crypt_device *cd);
+
+/**
+ * Finish batch of device activations and wait for udev to process them.
+ *
+ * @param cd crypt device handle used for logging, can be @e NULL
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ */
+int crypt_activate_batch_end(struct crypt_device *cd);
+
 /** lazy deactivation - remove once last user releases it */
 #define CRYPT_DEACTIVATE_DEFERRED (UINT32_C(1) << 0)
 /** force deactivation - if the device is busy, it is replaced by error device */
@@ -1634,6 +2405,30 @@ int crypt_deactivate_by_name(struct crypt_device *cd,
  * Deactivate crypt device. See @ref crypt_deactivate_by_name with empty @e flags.
  */
 int crypt_deactivate(struct crypt_device *cd, const char *name);
+
+/**
+ * Deactivate (remove) several devices at once.
+ *
+ * Unused devices are removed first, repeatedly while removing them releases
+ * other devices in the list (so stacked devices can be listed in any order),
+ * the remaining busy devices are then deactivated with @e flags. With
+ * @e CRYPT_DEACTIVATE_DEFERRED busy devices are scheduled for deferred removal.
+ * All udev events are waited for only once at the end.
+ *
+ * @param cd crypt device handle used for logging, can be @e NULL
+ * @param names array of active device names
+ * @param count number of names in array
+ * @param flags deactivation flags, @e CRYPT_DEACTIVATE_DEFERRED_CANCEL is not allowed
+ *
+ * @return @e 0 if all devices were deactivated, otherwise the first negative errno value
+ *
+ * @note Every device is deactivated in its own context, as with
+ *	 @link crypt_deactivate_by_name @endlink called with @e NULL @e cd.
+ */
+int crypt_deactivate_batch(struct crypt_device *cd,
+	const char * const *names,
+	size_t count,
+	uint32_t flags);
 /** @} */
 
 /**
@@ -1720,6 +2515,50 @@ int crypt_volume_key_get_by_keyslot_context(struct crypt_device *cd,
 int crypt_volume_key_verify(struct crypt_device *cd,
 	const char *volume_key,
 	size_t volume_key_size);
+
+/**
+ * Find which of the given recovery passwords unlocks BITLK device.
+ *
+ * @param cd crypt device handle with loaded BITLK metadata
+ * @param recovery_keys array of recovery passwords (48 digits in 8 groups)
+ * @param count number of recovery passwords in @e recovery_keys
+ *
+ * @return index of the first matching recovery password or negative errno value
+ *	   (@e -EPERM if none matches, @e -ENOENT if there is no recovery protector).
+ *
+ * @note Key stretching of all passwords and recovery protectors runs in
+ *	 parallel threads. With crypt_set_derived_key_cache() enabled, stretched
+ *	 keys are shared across contexts, so a recovery password is not stretched
+ *	 again for a protector with the same salt.
+ */
+int crypt_bitlk_find_recovery_key(struct crypt_device *cd,
+	const char *const *recovery_keys,
+	size_t count);
+
+/**
+ * Decrypt part of BITLK or FVAULT2 volume in userspace, without creating
+ * any device-mapper mapping.
+ *
+ * @param cd crypt device handle with loaded BITLK or FVAULT2 metadata
+ * @param volume_key volume key (e.g. from @link crypt_volume_key_get @endlink)
+ * @param volume_key_size size of @e volume_key
+ * @param offset offset in bytes in the decrypted volume
+ * @param buffer buffer for decrypted data
+ * @param length number of bytes to decrypt
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note Both @e offset and @e length must be aligned to the volume encryption
+ *	 sector size. Data is read and decrypted through the userspace crypto
+ *	 backend using all online CPUs, so large ranges should be preferred.
+ *	 Volume key is not verified, wrong key returns garbage.
+ */
+int crypt_volume_read_decrypt(struct crypt_device *cd,
+	const char *volume_key,
+	size_t volume_key_size,
+	uint64_t offset,
+	char *buffer,
+	size_t length);
 /** @} */
 
 /**
@@ -1758,14 +2597,24 @@ crypt_status_info crypt_status(struct crypt_device *cd, const char *name);
  */
 int crypt_dump(struct crypt_device *cd);
 
+/** Read LUKS2 JSON metadata directly from device, header need not be loaded */
+#define CRYPT_DUMP_JSON_UNLOCKED (UINT32_C(1) << 0)
+
 /**
  * Dump JSON-formatted information about LUKS2 device
  *
  * @param cd crypt device handle (only LUKS2 format supported)
  * @param json buffer with JSON, if NULL use log callback for output
- * @param flags dump flags (reserved)
+ * @param flags dump flags, @e CRYPT_DUMP_JSON_UNLOCKED for inspection
+ *	  without @link crypt_load @endlink
  *
  * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note With @e CRYPT_DUMP_JSON_UNLOCKED the header area is read at once
+ *	 without metadata locking, recovery or validation of its content
+ *	 (header checksums are verified). It is intended for read-only inventory
+ *	 and can race with concurrent header updates. Returned buffer is valid
+ *	 until next call or @link crypt_free @endlink.
  */
 int crypt_dump_json(struct crypt_device *cd, const char **json, uint32_t flags);
 
@@ -1888,6 +2737,100 @@ int crypt_header_is_detached(struct crypt_device *cd);
 int crypt_get_verity_info(struct crypt_device *cd,
 	struct crypt_params_verity *vp);
 
+/**
+ * Set directory for cache of successful VERITY userspace verification.
+ *
+ * With cache set, activation with @e CRYPT_VERITY_CHECK_HASH flag skips
+ * verification of images already verified with the same root hash and
+ * parameters. Images are identified by inode, size and modification
+ * times, so only regular files (images attached through loop devices)
+ * are cached.
+ *
+ * @param cd crypt device handle with VERITY device context
+ * @param path existing writable directory, @e NULL disables cache
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ */
+int crypt_verity_set_verify_cache(struct crypt_device *cd, const char *path);
+
+/**
+ * Cache root hash signatures for @link crypt_activate_by_signed_key @endlink.
+ *
+ * With cache set, the signature is kept in user keyring as a user key named
+ * by the signature digest and reused by later activations of images with
+ * the same signature (also from other processes) instead of being added
+ * and revoked on every activation. The kernel still verifies the signature
+ * on every activation.
+ *
+ * @param cd crypt device handle with VERITY device context
+ * @param timeout seconds the cached signature is kept, @e 0 disables cache
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ */
+int crypt_verity_set_signature_cache(struct crypt_device *cd, unsigned int timeout);
+
+/**
+ * Range of data blocks modified after the verity hash area was created.
+ */
+struct crypt_verity_range {
+	uint64_t offset; /**< first changed data block */
+	uint64_t length; /**< number of changed data blocks */
+};
+
+/**
+ * Recalculate verity hash area for modified data blocks.
+ *
+ * Only digests of changed data blocks and the hash blocks on their path
+ * to the root are recomputed and rewritten in the hash device.
+ *
+ * @param cd crypt device handle with VERITY device context
+ * @param ranges changed data block ranges (may overlap)
+ * @param count number of ranges
+ * @param root_hash buffer for the new root hash
+ * @param root_hash_size size of root hash buffer (digest size of used hash)
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note If FEC device is set, parity of RS blocks covering changed data
+ * 	 and changed hash blocks is recalculated as well.
+ */
+int crypt_verity_update(struct crypt_device *cd,
+	const struct crypt_verity_range *ranges, size_t count,
+	char *root_hash, size_t root_hash_size);
+
+/**
+ * Report of verity data verification.
+ */
+struct crypt_verity_report {
+	uint64_t *bad_blocks;      /**< caller allocated array for corrupted data block numbers or @e NULL */
+	size_t bad_blocks_size;    /**< capacity of bad_blocks array */
+	uint64_t bad_blocks_count; /**< number of corrupted data blocks found (can exceed capacity) */
+};
+
+/** Verify only root hash and hash area, skip data blocks */
+#define CRYPT_VERITY_VERIFY_HASH_ONLY (UINT32_C(1) << 0)
+
+/**
+ * Verify VERITY device in userspace and report all corrupted data blocks.
+ *
+ * Unlike the check on activation, verification does not stop on first
+ * corrupted data block. Root hash and the hash area levels are verified
+ * first (top down), data blocks only if the hash area is intact.
+ *
+ * @param cd crypt device handle with VERITY device context
+ * @param root_hash root hash
+ * @param root_hash_size size of root hash
+ * @param flags @e CRYPT_VERITY_VERIFY_* flags
+ * @param report verification report
+ *
+ * @return @e 0 if device is intact, @e -EFAULT if root hash or hash area
+ * 	   does not match, @e -EPERM if corrupted data blocks were found
+ * 	   or other negative errno value otherwise.
+ */
+int crypt_verity_verify_report(struct crypt_device *cd,
+	const char *root_hash, size_t root_hash_size,
+	uint32_t flags, struct crypt_verity_report *report);
+
 /**
  * Get device parameters for INTEGRITY device.
  *
@@ -1899,6 +2842,68 @@ int crypt_get_verity_info(struct crypt_device *cd,
  */
 int crypt_get_integrity_info(struct crypt_device *cd,
 	struct crypt_params_integrity *ip);
+
+/**
+ * Library operation phases measured in device context.
+ */
+typedef enum {
+	CRYPT_TIMING_LOAD = 0, /**< metadata load (crypt_load), including recovery */
+	CRYPT_TIMING_RECOVERY, /**< LUKS2 header recovery, including blkid probe */
+	CRYPT_TIMING_TOKEN,    /**< token activation, including keyslot unlock by token */
+	CRYPT_TIMING_KEYSLOT,  /**< keyslot unlock (mostly PBKDF) */
+	CRYPT_TIMING_DM,       /**< device-mapper device creation, including udev wait */
+	CRYPT_TIMING_UDEV,     /**< waiting for udev to process created device */
+	CRYPT_TIMING_COUNT     /**< number of phases, not a phase */
+} crypt_timing_phase;
+
+/**
+ * Timing of one phase.
+ */
+struct crypt_timing {
+	uint64_t start_us;    /**< first start, microseconds since context initialization */
+	uint64_t duration_us; /**< time spent in all runs of the phase in microseconds */
+	uint32_t count;       /**< number of runs, @e 0 if the phase did not run */
+};
+
+/**
+ * Get timing of a library operation phase in device context.
+ *
+ * Times are measured with monotonic clock and accumulated for
+ * the whole lifetime of the context.
+ *
+ * @param cd crypt device handle
+ * @param phase phase to query
+ * @param timing phase timing
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ */
+int crypt_get_timing(struct crypt_device *cd, crypt_timing_phase phase,
+	struct crypt_timing *timing);
+
+/**
+ * Memory used by library operations.
+ */
+struct crypt_memory_usage {
+	uint64_t safe_current; /**< safe memory (crypt_safe_alloc) allocated now, process-wide, bytes */
+	uint64_t safe_peak;    /**< peak of safe memory allocated, process-wide, bytes */
+	uint64_t kdf_peak;     /**< peak of memory cost of PBKDF running at once in the context, bytes */
+	uint64_t io_peak;      /**< peak of I/O buffers (reencryption hotzone, checksums) in the context, bytes */
+};
+
+/**
+ * Get memory usage accounting of device context.
+ *
+ * PBKDF memory is the memory cost of memory-hard PBKDF (Argon2) as stored
+ * in keyslots, summed for keyslots unlocked in parallel. Safe memory holds
+ * keys and passphrases, it is not bound to a context and it is accounted
+ * for the whole process.
+ *
+ * @param cd crypt device handle
+ * @param usage memory usage
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ */
+int crypt_get_memory_usage(struct crypt_device *cd, struct crypt_memory_usage *usage);
 /** @} */
 
 /**
@@ -1934,9 +2939,79 @@ int crypt_benchmark(struct crypt_device *cd,
 	double *encryption_mbs,
 	double *decryption_mbs);
 
+/** Maximal number of threads in @ref crypt_benchmark_threads */
+#define CRYPT_BENCHMARK_THREADS_MAX 1024
+
+/**
+ * Informational benchmark for ciphers running in several threads at once.
+ *
+ * Every thread is pinned to one CPU available to the process (wrapping
+ * around if there are less CPUs than threads) and runs the same measurement
+ * as @link crypt_benchmark @endlink on its own buffer. Aggregate throughput
+ * is the sum of per-thread values.
+ *
+ * @param cd crypt device handle
+ * @param cipher (e.g. "aes")
+ * @param cipher_mode (e.g. "xts"), IV generator is ignored
+ * @param volume_key_size size of volume key in bytes
+ * @param iv_size size of IV in bytes
+ * @param buffer_size size of encryption buffer (per thread) in bytes used in test
+ * @param threads number of threads
+ * @param encryption_mbs array of @e threads measured encryption speeds in MiB/s
+ * @param decryption_mbs array of @e threads measured decryption speeds in MiB/s
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note If any thread cannot properly measure encryption time, -ERANGE is returned.
+ */
+int crypt_benchmark_threads(struct crypt_device *cd,
+	const char *cipher,
+	const char *cipher_mode,
+	size_t volume_key_size,
+	size_t iv_size,
+	size_t buffer_size,
+	unsigned threads,
+	double *encryption_mbs,
+	double *decryption_mbs);
+
+/**
+ * Informational benchmark for per-sector encryption with IV generator.
+ *
+ * Unlike @link crypt_benchmark @endlink, the buffer is processed in
+ * @e sector_size units with IV generated for every sector, as in userspace
+ * (offline) reencryption. The cost of IV generation and of many small
+ * cipher calls is included in the result.
+ *
+ * @param cd crypt device handle
+ * @param cipher (e.g. "aes")
+ * @param cipher_mode including IV generator (e.g. "cbc-essiv:sha256")
+ * @param volume_key_size size of volume key in bytes
+ * @param sector_size encryption sector size in bytes
+ * @param buffer_size size of encryption buffer in bytes used in test
+ * @param encryption_mbs measured encryption speed in MiB/s
+ * @param decryption_mbs measured decryption speed in MiB/s
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note If encryption_buffer_size is too small and encryption time
+ *       cannot be properly measured, -ERANGE is returned.
+ */
+int crypt_benchmark_sectors(struct crypt_device *cd,
+	const char *cipher,
+	const char *cipher_mode,
+	size_t volume_key_size,
+	uint32_t sector_size,
+	size_t buffer_size,
+	double *encryption_mbs,
+	double *decryption_mbs);
+
 /**
  * Informational benchmark for PBKDF.
  *
+ * If @e CRYPT_PBKDF_NO_BENCHMARK flag is set, costs in @e pbkdf are not
+ * calibrated; PBKDF runs once with exactly these costs and its time
+ * is reported through @e progress callback.
+ *
  * @param cd crypt device handle
  * @param pbkdf PBKDF parameters
  * @param password password for benchmark
@@ -1958,6 +3033,27 @@ int crypt_benchmark_pbkdf(struct crypt_device *cd,
 	size_t volume_key_size,
 	int (*progress)(uint32_t time_ms, void *usrptr),
 	void *usrptr);
+
+/**
+ * Calibrate PBKDF costs set in crypt device context once for reuse.
+ *
+ * Runs the same PBKDF benchmark as keyslot creation in @e cd would
+ * do and returns resulting costs with @e CRYPT_PBKDF_NO_BENCHMARK flag set.
+ * These can be set through @link crypt_set_pbkdf_type @endlink in other
+ * contexts (formatted with the same parameters) to skip benchmark there.
+ *
+ * @param cd crypt device handle with PBKDF type set
+ * @param volume_key_size size of key derived by PBKDF (keyslot key size)
+ * @param pbkdf calibrated PBKDF parameters
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note String members of @e pbkdf are valid only until PBKDF type
+ *       in @e cd is changed or @e cd is freed.
+ */
+int crypt_benchmark_pbkdf_calibrate(struct crypt_device *cd,
+	size_t volume_key_size,
+	struct crypt_pbkdf_type *pbkdf);
 /** @} */
 
 /**
@@ -2020,6 +3116,22 @@ crypt_keyslot_priority crypt_keyslot_get_priority(struct crypt_device *cd, int k
  */
 int crypt_keyslot_set_priority(struct crypt_device *cd, int keyslot, crypt_keyslot_priority priority);
 
+/**
+ * Tag keyslot with hint label (LUKS2)
+ *
+ * Only a short tag of the label salted by keyslot salt is stored in metadata,
+ * it cannot be used to find the label and it is ignored if the keyslot
+ * is later rewritten with a new salt.
+ *
+ * @param cd crypt device handle
+ * @param keyslot keyslot number
+ * @param hint non-secret label (see @link crypt_set_keyslot_hint @endlink)
+ *        or @e NULL to remove the tag
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ */
+int crypt_keyslot_set_hint(struct crypt_device *cd, int keyslot, const char *hint);
+
 /**
  * Get number of keyslots supported for device type.
  *
@@ -2226,6 +3338,81 @@ typedef enum {
 	CRYPT_WIPE_SPECIAL,        /**< Compatibility only, do not use (Gutmann method) */
 } crypt_wipe_pattern;
 
+/** Maximal number of wipe writes in flight */
+#define CRYPT_WIPE_QUEUE_DEPTH_MAX 16
+
+/**
+ * Set number of wipe block writes kept in flight.
+ *
+ * With @e depth above 1, random wipes submit several blocks at once from
+ * separate threads. Zero wipes split the area into @e depth ranges, each
+ * written by its own thread, unless the block device offloads write zeroes.
+ *
+ * @param cd crypt device handle
+ * @param depth number of block writes in flight, 0 or 1 is sequential (default)
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note Progress callback is then called after each batch of blocks.
+ */
+int crypt_set_wipe_queue_depth(struct crypt_device *cd, unsigned depth);
+
+/**
+ * Set checkpoint file for resumable wipe.
+ *
+ * @ref crypt_wipe then records the wiped offset in @e path after each
+ * synced chunk of the device. If the wipe is interrupted, the next call
+ * with the same device, pattern, offset, length and block size continues
+ * from the recorded offset. The file is removed when the wipe finishes.
+ *
+ * @param cd crypt device handle
+ * @param path checkpoint file path, @e NULL disables checkpoints (default)
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note Checkpoint is matched by device path and size only, the caller
+ *       must not reuse the file for a different device image.
+ */
+int crypt_set_wipe_checkpoint(struct crypt_device *cd, const char *path);
+
+/**
+ * Set minimal interval between progress callback calls.
+ *
+ * Applies to @ref crypt_wipe and @ref crypt_reencrypt_run progress callbacks.
+ * The callback is called when at least @e msecs elapsed or @e bytes were
+ * processed since the last call, and always at the start and the end.
+ *
+ * @param cd crypt device handle
+ * @param bytes minimal processed bytes between calls, 0 to ignore
+ * @param msecs minimal time between calls in milliseconds, 0 to ignore
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note With both values 0 (default) the callback is called after every step.
+ * @note Interruption by callback return value is then checked only in the interval.
+ */
+int crypt_set_progress_interval(struct crypt_device *cd, uint64_t bytes, uint32_t msecs);
+
+/**
+ * Progress of running wipe or reencryption operation.
+ */
+struct crypt_progress_info {
+	uint64_t bytes;   /**< bytes processed since the operation started */
+	uint64_t time_ms; /**< time since the operation started */
+	uint64_t rate;    /**< smoothed (moving average) rate in bytes per second */
+	uint64_t eta_ms;  /**< estimated remaining time from smoothed rate */
+};
+
+/**
+ * Get progress of running operation, intended to be called from progress callback.
+ *
+ * @param cd crypt device handle
+ * @param info progress information
+ *
+ * @return @e 0 on success, @e -ENOENT if no operation with callback was started.
+ */
+int crypt_get_progress_info(struct crypt_device *cd, struct crypt_progress_info *info);
+
 /**
  * Wipe/Fill (part of) a device with the selected pattern.
  *
@@ -2259,6 +3446,137 @@ int crypt_wipe(struct crypt_device *cd,
 
 /** Use direct-io */
 #define CRYPT_WIPE_NO_DIRECT_IO (UINT32_C(1) << 0)
+
+/**
+ * Initialize tags of formatted standalone dm-integrity device directly.
+ *
+ * Instead of writing zeroes through the activated device (journal and
+ * kernel tag calculation for every sector), the data area is zeroed
+ * (offloaded by write zeroes if the device supports it) and tags of zeroed
+ * sectors are precomputed in userspace and written in sequential runs.
+ *
+ * @param cd crypt device handle with formatted @e CRYPT_INTEGRITY device
+ * @param wipe_block_size used block for zeroing data (in bytes), 0 for default
+ * @param progress callback function called after each written block or @e NULL
+ * @param usrptr provided identification in callback
+ *
+ * @return @e 0 on success, @e -ENOTSUP if tags cannot be precomputed (keyed
+ *         integrity algorithm, use @ref crypt_wipe over the activated device
+ *         then) or negative errno value otherwise.
+ *
+ * @note Only unkeyed internal hash (crc32, crc32c or a plain hash) is supported.
+ * @note The device must not be active.
+ */
+int crypt_wipe_integrity_tags(struct crypt_device *cd,
+	size_t wipe_block_size,
+	int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+	void *usrptr);
+
+/**
+ * Estimate size of separate metadata device for standalone dm-integrity.
+ *
+ * The size covers superblock, journal (kernel default size if
+ * @e journal_size is not set) and tags of all data sectors.
+ *
+ * @param params integrity parameters (@e integrity, optionally @e tag_size,
+ *        @e sector_size and @e journal_size)
+ * @param data_size size of data device in bytes
+ * @param metadata_size estimated metadata device size in bytes
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ */
+int crypt_integrity_metadata_size(const struct crypt_params_integrity *params,
+	uint64_t data_size,
+	uint64_t *metadata_size);
+
+/**
+ * Calculate integrity tags of existing data of standalone dm-integrity device.
+ *
+ * Replacement of kernel recalculation (@e CRYPT_ACTIVATE_RECALCULATE) for
+ * a device formatted without wipe. Data are read in large chunks and tags
+ * calculated by several threads, tag area is written directly without journal.
+ * If kernel recalculation was already started, the superblock is then marked
+ * as fully recalculated.
+ *
+ * @param cd crypt device handle with formatted @e CRYPT_INTEGRITY device
+ * @param integrity_key integrity key for keyed algorithm (hmac) or @e NULL
+ * @param integrity_key_size size of @e integrity_key
+ * @param progress callback function called after each processed chunk or @e NULL
+ * @param usrptr provided identification in callback
+ *
+ * @return @e 0 on success, @e -ENOTSUP if tags cannot be calculated in userspace
+ *         or negative errno value otherwise.
+ *
+ * @note The device must not be active.
+ */
+int crypt_recalculate_integrity_tags(struct crypt_device *cd,
+	const char *integrity_key,
+	size_t integrity_key_size,
+	int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+	void *usrptr);
+
+/**
+ * Initialize tags of a range of standalone dm-integrity device directly.
+ *
+ * Intended for newly added space of a grown active device. Data of the range
+ * are zeroed and precomputed tags written directly as in
+ * @link crypt_wipe_integrity_tags @endlink. Tags sharing kernel metadata buffer
+ * with sectors before the range are not written; these @e skipped sectors at
+ * the range start must be wiped through the active device.
+ *
+ * @param cd crypt device handle with active or formatted @e CRYPT_INTEGRITY device
+ * @param offset first sector of the range (in 512-byte sectors)
+ * @param length size of the range (in 512-byte sectors)
+ * @param skipped number of sectors at @e offset that were not initialized
+ * @param wipe_block_size used block for zeroing data (in bytes), 0 for default
+ * @param progress callback function called after each written block or @e NULL
+ * @param usrptr provided identification in callback
+ *
+ * @return @e 0 on success, @e -ENOTSUP if tags cannot be precomputed
+ *         or negative errno value otherwise.
+ *
+ * @note The range must not be in use (and must not be recalculated by kernel).
+ */
+int crypt_wipe_integrity_tags_range(struct crypt_device *cd,
+	uint64_t offset,
+	uint64_t length,
+	uint64_t *skipped,
+	size_t wipe_block_size,
+	int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+	void *usrptr);
+
+/**
+ * Verify integrity tags of standalone dm-integrity device offline.
+ *
+ * All data are read, tags calculated the same way as in
+ * @link crypt_recalculate_integrity_tags @endlink and compared with stored tags.
+ * Nothing is written. If kernel recalculation is in progress, only the already
+ * recalculated part is verified.
+ *
+ * @param cd crypt device handle with formatted @e CRYPT_INTEGRITY device
+ * @param integrity_key integrity key for keyed algorithm (hmac) or @e NULL
+ * @param integrity_key_size size of @e integrity_key
+ * @param mismatch callback function called for every range of sectors (in 512-byte
+ *        units) with wrong tags or @e NULL; ranges are not reported in order
+ *        and calls are serialized. Non-zero return value aborts verification.
+ * @param progress callback function called after each processed chunk or @e NULL
+ * @param usrptr provided identification in callbacks
+ * @param mismatched_sectors number of sectors with wrong tags or @e NULL
+ *
+ * @return @e 0 if verification finished (check @e mismatched_sectors),
+ *         @e -ENOTSUP if tags cannot be calculated in userspace
+ *         or negative errno value otherwise.
+ *
+ * @note The device must not be active and must be cleanly deactivated,
+ *       tags still waiting in the journal are not replayed.
+ */
+int crypt_verify_integrity_tags(struct crypt_device *cd,
+	const char *integrity_key,
+	size_t integrity_key_size,
+	int (*mismatch)(uint64_t sector, uint64_t count, void *usrptr),
+	int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+	void *usrptr,
+	uint64_t *mismatched_sectors);
 /** @} */
 
 /**
@@ -2810,6 +4128,209 @@ int crypt_reencrypt_run(struct crypt_device *cd,
 		    int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
 		    void *usrptr);
 
+/** Maximal latency target for adaptive hotzone size in milliseconds */
+#define CRYPT_REENCRYPT_HOTZONE_LATENCY_MAX_MS 10000
+
+/**
+ * Set latency target for adaptive hotzone size in online reencryption.
+ *
+ * Reencryption then changes hotzone size after every step so the time
+ * the hotzone device is suspended stays below @e target_ms, with
+ * the maximal hotzone size as computed in reencryption initialization
+ * (see @e max_hotzone_size in @link crypt_params_reencrypt @endlink)
+ * as the upper limit.
+ *
+ * @param cd crypt device handle with initialized reencryption context
+ * @param target_ms latency target in milliseconds (at most
+ *	  @e CRYPT_REENCRYPT_HOTZONE_LATENCY_MAX_MS), @e 0 disables adaptive mode
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note Only online reencryption (and not in datashift mode) uses the target.
+ */
+int crypt_reencrypt_set_hotzone_latency(struct crypt_device *cd, uint32_t target_ms);
+
+/**
+ * Online reencryption I/O throttle parameters.
+ *
+ * Structure used as parameter for @link crypt_reencrypt_set_throttle @endlink.
+ * Zero value in any field means no limit.
+ */
+struct crypt_params_reencrypt_throttle {
+	uint64_t max_rate;       /**< Maximal reencryption data rate (bytes per second). */
+	uint32_t max_iops;       /**< Maximal reencryption I/O requests per second. */
+	uint32_t max_latency_ms; /**< Back off while average latency of active device I/O is higher (milliseconds). */
+	uint32_t max_in_flight;  /**< Back off while active device has more I/O requests in flight. */
+};
+
+/**
+ * Set I/O throttle for reencryption.
+ *
+ * Reencryption waits before every hotzone step so data rate and I/O request
+ * rate stay below the configured limits (token bucket with one second burst).
+ * In online reencryption, it also backs off for a while if block layer statistics
+ * of the active device show higher latency or more requests in flight than the limits.
+ *
+ * @param cd crypt device handle with initialized reencryption context
+ * @param params throttle parameters or @e NULL to disable throttling
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note I/O requests are counted in blocks of up to 256 KiB for both read
+ *       and write of the hotzone.
+ */
+int crypt_reencrypt_set_throttle(struct crypt_device *cd,
+	const struct crypt_params_reencrypt_throttle *params);
+
+/** Maximal number of hotzones covered by one metadata commit */
+#define CRYPT_REENCRYPT_HOTZONE_BATCH_MAX 1024
+
+/**
+ * Cover several consecutive hotzones by one metadata commit.
+ *
+ * Reencryption with checksum resilience commits metadata twice per hotzone.
+ * With batching, one hotzone in metadata spans up to @e hotzones hotzones
+ * of the size as computed in reencryption initialization (and memory used
+ * for reencryption buffer stays the same). The batch is limited so the
+ * reencryption keyslot area can store checksums for all of it.
+ *
+ * @param cd crypt device handle with initialized reencryption context
+ * @param hotzones number of hotzones per metadata commit (at most
+ *	  @e CRYPT_REENCRYPT_HOTZONE_BATCH_MAX), @e 0 or @e 1 disables batching
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note Only offline reencryption with checksum resilience uses batching.
+ *       Data in the batch are read twice (once for checksums).
+ */
+int crypt_reencrypt_set_hotzone_batch(struct crypt_device *cd, uint32_t hotzones);
+
+/** Skip reencryption of unallocated areas of the data device */
+#define CRYPT_REENCRYPT_SPARSE_SKIP	(UINT32_C(1) << 0)
+/** Discard skipped unallocated areas (implies @e CRYPT_REENCRYPT_SPARSE_SKIP) */
+#define CRYPT_REENCRYPT_SPARSE_DISCARD	(UINT32_C(1) << 1)
+/** Caller asserts the data device holds no data, whole device is skipped
+ *  (implies @e CRYPT_REENCRYPT_SPARSE_SKIP) */
+#define CRYPT_REENCRYPT_SPARSE_UNUSED	(UINT32_C(1) << 2)
+
+/**
+ * Set sparse mode for offline reencryption.
+ *
+ * Hotzones that are not allocated on the data device (holes in image file
+ * or in file backing loop device) are only switched to the new segment
+ * in metadata, their content is not reencrypted. Holes have no meaningful
+ * content, so they read as random data after reencryption in both cases.
+ *
+ * With @e CRYPT_REENCRYPT_SPARSE_UNUSED (for example right after format) the
+ * whole device is treated as unallocated. All remaining data is switched
+ * to the new segment in one metadata commit without any data I/O. Existing
+ * data on the device becomes unreadable.
+ *
+ * Unallocated areas are never committed as a hotzone in reencryption,
+ * an interrupted run leaves nothing to recover there.
+ *
+ * @param cd crypt device handle with initialized reencryption context
+ * @param flags @e CRYPT_REENCRYPT_SPARSE_* flags, @e 0 disables sparse mode
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note Sparse mode is ignored for online reencryption (device can be written
+ *       during the allocation check) and for datashift resilience.
+ */
+int crypt_reencrypt_set_sparse(struct crypt_device *cd, uint32_t flags);
+
+/**
+ * Reencryption step statistics.
+ *
+ * Time spent in particular phases of one reencryption step (hotzone),
+ * all times are in microseconds.
+ */
+struct crypt_reencrypt_stats {
+	uint64_t offset;       /**< hotzone offset in bytes */
+	uint64_t length;       /**< hotzone length in bytes */
+	uint64_t read_us;      /**< reading hotzone data */
+	uint64_t protect_us;   /**< resilience data (checksums, journal) and first metadata commit */
+	uint64_t transform_us; /**< decryption and encryption in userspace */
+	uint64_t write_us;     /**< writing hotzone data (including encryption by dm-crypt if used) */
+	uint64_t datasync_us;  /**< data device sync */
+	uint64_t commit_us;    /**< final metadata commit */
+	uint64_t suspend_us;   /**< device suspend and overlay reload (online only) */
+	uint64_t resume_us;    /**< device resume (online only) */
+	uint64_t total_us;     /**< whole step */
+};
+
+/**
+ * Set callback providing statistics after every reencryption step.
+ *
+ * @param cd crypt device handle with initialized reencryption context
+ * @param stats user defined statistics callback reference; use
+ *        @p stats for collected statistics and
+ *        @p usrptr for identification in callback
+ * @param usrptr provided identification in callback
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ */
+int crypt_reencrypt_set_stats_callback(struct crypt_device *cd,
+	void (*stats)(const struct crypt_reencrypt_stats *stats, void *usrptr),
+	void *usrptr);
+
+/**
+ * Reencryption benchmark result.
+ *
+ * Structure used as parameter for @link crypt_reencrypt_benchmark @endlink.
+ */
+struct crypt_reencrypt_benchmark {
+	uint64_t data_size;    /**< data to be reencrypted in bytes */
+	uint64_t hotzone_size; /**< hotzone size in bytes */
+	uint64_t hotzones;     /**< number of hotzones (reencryption steps) */
+	uint64_t projected_us; /**< projected reencryption time in microseconds */
+	struct crypt_reencrypt_stats sample; /**< phases summed over measured hotzones,
+						  @e length is size of the sample */
+};
+
+/** Measure writes in reencryption benchmark by writing unchanged data back */
+#define CRYPT_REENCRYPT_BENCHMARK_WRITE	(UINT32_C(1) << 0)
+
+/**
+ * Estimate duration of offline reencryption or decryption.
+ *
+ * Hotzones spread over the data device are read, protected according to
+ * resilience mode in @e params, decrypted and encrypted with a new random key
+ * as reencryption would do. Neither metadata nor new ciphertext is written.
+ *
+ * @param cd crypt device handle (LUKS2 without reencryption in progress)
+ * @param passphrase passphrase used to unlock volume key
+ * @param passphrase_size size of @e passphrase (binary data)
+ * @param keyslot_old keyslot to unlock existing device or CRYPT_ANY_SLOT
+ * @param cipher new cipher specification (e.g. "aes"), ignored for decryption
+ * @param cipher_mode new cipher mode and IV (e.g. "xts-plain64"), ignored for decryption
+ * @param volume_key_size new volume key size in bytes, ignored for decryption
+ * @param params reencryption parameters (mode, resilience, hotzone size, device size
+ *        and LUKS2 sector size are used)
+ * @param sample_size amount of data to measure in bytes (rounded up to hotzone size)
+ * @param flags @e CRYPT_REENCRYPT_BENCHMARK_WRITE or @e 0
+ * @param result measured and projected values
+ *
+ * @return @e 0 on success or negative errno value otherwise.
+ *
+ * @note With @e CRYPT_REENCRYPT_BENCHMARK_WRITE, the data read are written back
+ *	 unchanged with data sync (twice with journal resilience), the data
+ *	 device must not be in use (block device is opened exclusively).
+ *	 Without it, write and sync times are zero. Metadata commits are not
+ *	 included in the projection.
+ */
+int crypt_reencrypt_benchmark(struct crypt_device *cd,
+	const char *passphrase,
+	size_t passphrase_size,
+	int keyslot_old,
+	const char *cipher,
+	const char *cipher_mode,
+	size_t volume_key_size,
+	const struct crypt_params_reencrypt *params,
+	uint64_t sample_size,
+	uint32_t flags,
+	struct crypt_reencrypt_benchmark *result);
+
 /**
  * Reencryption status info
  */
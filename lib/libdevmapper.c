@@ -48,12 +48,55 @@ static bool _dm_verity_checked = false;
 static bool _dm_integrity_checked = false;
 static bool _dm_zero_checked = false;
 
-static int _quiet_log = 0;
 static uint32_t _dm_flags = 0;
 
-static struct crypt_device *_context = NULL;
+/*
+ * libdevmapper logs through one global callback, so the context for log
+ * messages is set per thread for the duration of every DM call.
+ */
+static __thread int _quiet_log = 0;
+static __thread struct crypt_device *_context = NULL;
+
+static pthread_mutex_t _dm_use_lock = PTHREAD_MUTEX_INITIALIZER;
 static int _dm_use_count = 0;
 
+/* libdevmapper keeps global state (e.g. stacked node operations), serialize its calls */
+static pthread_mutex_t _dm_task_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Version probe can run from dm_prepare_start() thread. Flags are written
+ * under the lock before the checked flag is set (release), so a reader that
+ * sees the checked flag (acquire) sees the flags too.
+ */
+static pthread_mutex_t _dm_check_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Background probe started by this thread, joined before its first DM call */
+static __thread struct dm_prepare_job *_dm_prepare_job = NULL;
+
+static bool _dm_checked(const bool *checked)
+{
+	return __atomic_load_n(checked, __ATOMIC_ACQUIRE);
+}
+
+static void _dm_set_checked(bool *checked)
+{
+	__atomic_store_n(checked, true, __ATOMIC_RELEASE);
+}
+
+static uint32_t _dm_flags_get(void)
+{
+	return __atomic_load_n(&_dm_flags, __ATOMIC_ACQUIRE);
+}
+
+static void _dm_flags_set(uint32_t flags)
+{
+	__atomic_or_fetch(&_dm_flags, flags, __ATOMIC_RELEASE);
+}
+
+/* Shared udev cookie of devices created in activation batch of the thread */
+static __thread bool _dm_udev_batch = false;
+static __thread uint32_t _dm_udev_batch_cookie = 0;
+
 /* Check if we have DM flag to instruct kernel to force wipe buffers */
 #if !HAVE_DECL_DM_TASK_SECURE_DATA
 static int dm_task_secure_data(struct dm_task *dmt) { return 1; }
@@ -72,15 +115,58 @@ static int _dm_task_set_cookie(struct dm_task *dmt, uint32_t *cookie, uint16_t f
 static int _dm_udev_wait(uint32_t cookie) { return 0; };
 #endif
 
+static int _dm_task_run(struct dm_task *dmt)
+{
+	int r;
+
+	pthread_mutex_lock(&_dm_task_lock);
+	r = dm_task_run(dmt);
+	pthread_mutex_unlock(&_dm_task_lock);
+
+	return r;
+}
+
+/*
+ * Wait event ioctl may block for a long time and does not touch node or udev
+ * state, it must never hold the task lock other threads need.
+ */
+static int _dm_task_run_wait(struct dm_task *dmt)
+{
+	return dm_task_run(dmt);
+}
+
+static void _dm_update_nodes(void)
+{
+	pthread_mutex_lock(&_dm_task_lock);
+	dm_task_update_nodes();
+	pthread_mutex_unlock(&_dm_task_lock);
+}
+
+/* Set if udev synchronization was explicitly disabled, nodes are created directly */
+static bool _dm_udev_disabled = false;
+
 static int _dm_use_udev(void)
 {
 #ifdef USE_UDEV /* cannot be enabled if devmapper is too old */
-	return dm_udev_get_sync_support();
+	return !_dm_udev_disabled && dm_udev_get_sync_support();
 #else
 	return 0;
 #endif
 }
 
+/*
+ * Without udev sync libdevmapper creates and removes device nodes itself
+ * (in dm_task_update_nodes()); no cookies or semaphores are used at all.
+ */
+void dm_udev_sync_set(struct crypt_device *cd, bool enable)
+{
+	log_dbg(cd, "Device-mapper udev synchronization %sabled.", enable ? "en" : "dis");
+	_dm_udev_disabled = !enable;
+#ifdef USE_UDEV
+	dm_udev_set_sync_support(enable ? 1 : 0);
+#endif
+}
+
 __attribute__((format(printf, 4, 5)))
 static void set_dm_error(int level,
 			 const char *file __attribute__((unused)),
@@ -124,53 +210,53 @@ static void _dm_set_crypt_compat(struct crypt_device *cd,
 				 unsigned crypt_min,
 				 unsigned crypt_patch)
 {
-	if (_dm_crypt_checked || crypt_maj == 0)
+	if (_dm_checked(&_dm_crypt_checked) || crypt_maj == 0)
 		return;
 
 	log_dbg(cd, "Detected dm-crypt version %i.%i.%i.",
 		crypt_maj, crypt_min, crypt_patch);
 
 	if (_dm_satisfies_version(1, 2, 0, crypt_maj, crypt_min, crypt_patch))
-		_dm_flags |= DM_KEY_WIPE_SUPPORTED;
+		_dm_flags_set(DM_KEY_WIPE_SUPPORTED);
 	else
 		log_dbg(cd, "Suspend and resume disabled, no wipe key support.");
 
 	if (_dm_satisfies_version(1, 10, 0, crypt_maj, crypt_min, crypt_patch))
-		_dm_flags |= DM_LMK_SUPPORTED;
+		_dm_flags_set(DM_LMK_SUPPORTED);
 
 	/* not perfect, 2.6.33 supports with 1.7.0 */
 	if (_dm_satisfies_version(1, 8, 0, crypt_maj, crypt_min, crypt_patch))
-		_dm_flags |= DM_PLAIN64_SUPPORTED;
+		_dm_flags_set(DM_PLAIN64_SUPPORTED);
 
 	if (_dm_satisfies_version(1, 11, 0, crypt_maj, crypt_min, crypt_patch))
-		_dm_flags |= DM_DISCARDS_SUPPORTED;
+		_dm_flags_set(DM_DISCARDS_SUPPORTED);
 
 	if (_dm_satisfies_version(1, 13, 0, crypt_maj, crypt_min, crypt_patch))
-		_dm_flags |= DM_TCW_SUPPORTED;
+		_dm_flags_set(DM_TCW_SUPPORTED);
 
 	if (_dm_satisfies_version(1, 14, 0, crypt_maj, crypt_min, crypt_patch)) {
-		_dm_flags |= DM_SAME_CPU_CRYPT_SUPPORTED;
-		_dm_flags |= DM_SUBMIT_FROM_CRYPT_CPUS_SUPPORTED;
+		_dm_flags_set(DM_SAME_CPU_CRYPT_SUPPORTED);
+		_dm_flags_set(DM_SUBMIT_FROM_CRYPT_CPUS_SUPPORTED);
 	}
 
 	if (_dm_satisfies_version(1, 18, 1, crypt_maj, crypt_min, crypt_patch))
-		_dm_flags |= DM_KERNEL_KEYRING_SUPPORTED;
+		_dm_flags_set(DM_KERNEL_KEYRING_SUPPORTED);
 
 	if (_dm_satisfies_version(1, 17, 0, crypt_maj, crypt_min, crypt_patch)) {
-		_dm_flags |= DM_SECTOR_SIZE_SUPPORTED;
-		_dm_flags |= DM_CAPI_STRING_SUPPORTED;
+		_dm_flags_set(DM_SECTOR_SIZE_SUPPORTED);
+		_dm_flags_set(DM_CAPI_STRING_SUPPORTED);
 	}
 
 	if (_dm_satisfies_version(1, 19, 0, crypt_maj, crypt_min, crypt_patch))
-		_dm_flags |= DM_BITLK_EBOIV_SUPPORTED;
+		_dm_flags_set(DM_BITLK_EBOIV_SUPPORTED);
 
 	if (_dm_satisfies_version(1, 20, 0, crypt_maj, crypt_min, crypt_patch))
-		_dm_flags |= DM_BITLK_ELEPHANT_SUPPORTED;
+		_dm_flags_set(DM_BITLK_ELEPHANT_SUPPORTED);
 
 	if (_dm_satisfies_version(1, 22, 0, crypt_maj, crypt_min, crypt_patch))
-		_dm_flags |= DM_CRYPT_NO_WORKQUEUE_SUPPORTED;
+		_dm_flags_set(DM_CRYPT_NO_WORKQUEUE_SUPPORTED);
 
-	_dm_crypt_checked = true;
+	_dm_set_checked(&_dm_crypt_checked);
 }
 
 static void _dm_set_verity_compat(struct crypt_device *cd,
@@ -178,13 +264,13 @@ static void _dm_set_verity_compat(struct crypt_device *cd,
 				  unsigned verity_min,
 				  unsigned verity_patch)
 {
-	if (_dm_verity_checked || verity_maj == 0)
+	if (_dm_checked(&_dm_verity_checked) || verity_maj == 0)
 		return;
 
 	log_dbg(cd, "Detected dm-verity version %i.%i.%i.",
 		verity_maj, verity_min, verity_patch);
 
-	_dm_flags |= DM_VERITY_SUPPORTED;
+	_dm_flags_set(DM_VERITY_SUPPORTED);
 
 	/*
 	 * ignore_corruption, restart_on corruption is available since 1.2 (kernel 4.1)
@@ -194,20 +280,20 @@ static void _dm_set_verity_compat(struct crypt_device *cd,
 	 * Check at most once is added in 1.4 (kernel 4.17).
 	 */
 	if (_dm_satisfies_version(1, 3, 0, verity_maj, verity_min, verity_patch)) {
-		_dm_flags |= DM_VERITY_ON_CORRUPTION_SUPPORTED;
-		_dm_flags |= DM_VERITY_FEC_SUPPORTED;
+		_dm_flags_set(DM_VERITY_ON_CORRUPTION_SUPPORTED);
+		_dm_flags_set(DM_VERITY_FEC_SUPPORTED);
 	}
 
 	if (_dm_satisfies_version(1, 5, 0, verity_maj, verity_min, verity_patch))
-		_dm_flags |= DM_VERITY_SIGNATURE_SUPPORTED;
+		_dm_flags_set(DM_VERITY_SIGNATURE_SUPPORTED);
 
 	if (_dm_satisfies_version(1, 7, 0, verity_maj, verity_min, verity_patch))
-		_dm_flags |= DM_VERITY_PANIC_CORRUPTION_SUPPORTED;
+		_dm_flags_set(DM_VERITY_PANIC_CORRUPTION_SUPPORTED);
 
 	if (_dm_satisfies_version(1, 9, 0, verity_maj, verity_min, verity_patch))
-		_dm_flags |= DM_VERITY_TASKLETS_SUPPORTED;
+		_dm_flags_set(DM_VERITY_TASKLETS_SUPPORTED);
 
-	_dm_verity_checked = true;
+	_dm_set_checked(&_dm_verity_checked);
 }
 
 static void _dm_set_integrity_compat(struct crypt_device *cd,
@@ -215,33 +301,33 @@ static void _dm_set_integrity_compat(struct crypt_device *cd,
 				     unsigned integrity_min,
 				     unsigned integrity_patch)
 {
-	if (_dm_integrity_checked || integrity_maj == 0)
+	if (_dm_checked(&_dm_integrity_checked) || integrity_maj == 0)
 		return;
 
 	log_dbg(cd, "Detected dm-integrity version %i.%i.%i.",
 		integrity_maj, integrity_min, integrity_patch);
 
-	_dm_flags |= DM_INTEGRITY_SUPPORTED;
+	_dm_flags_set(DM_INTEGRITY_SUPPORTED);
 
 	if (_dm_satisfies_version(1, 2, 0, integrity_maj, integrity_min, integrity_patch))
-		_dm_flags |= DM_INTEGRITY_RECALC_SUPPORTED;
+		_dm_flags_set(DM_INTEGRITY_RECALC_SUPPORTED);
 
 	if (_dm_satisfies_version(1, 3, 0, integrity_maj, integrity_min, integrity_patch))
-		_dm_flags |= DM_INTEGRITY_BITMAP_SUPPORTED;
+		_dm_flags_set(DM_INTEGRITY_BITMAP_SUPPORTED);
 
 	if (_dm_satisfies_version(1, 4, 0, integrity_maj, integrity_min, integrity_patch))
-		_dm_flags |= DM_INTEGRITY_FIX_PADDING_SUPPORTED;
+		_dm_flags_set(DM_INTEGRITY_FIX_PADDING_SUPPORTED);
 
 	if (_dm_satisfies_version(1, 6, 0, integrity_maj, integrity_min, integrity_patch))
-		_dm_flags |= DM_INTEGRITY_DISCARDS_SUPPORTED;
+		_dm_flags_set(DM_INTEGRITY_DISCARDS_SUPPORTED);
 
 	if (_dm_satisfies_version(1, 7, 0, integrity_maj, integrity_min, integrity_patch))
-		_dm_flags |= DM_INTEGRITY_FIX_HMAC_SUPPORTED;
+		_dm_flags_set(DM_INTEGRITY_FIX_HMAC_SUPPORTED);
 
 	if (_dm_satisfies_version(1, 8, 0, integrity_maj, integrity_min, integrity_patch))
-		_dm_flags |= DM_INTEGRITY_RESET_RECALC_SUPPORTED;
+		_dm_flags_set(DM_INTEGRITY_RESET_RECALC_SUPPORTED);
 
-	_dm_integrity_checked = true;
+	_dm_set_checked(&_dm_integrity_checked);
 }
 
 static void _dm_set_zero_compat(struct crypt_device *cd,
@@ -249,13 +335,13 @@ static void _dm_set_zero_compat(struct crypt_device *cd,
 				unsigned zero_min,
 				unsigned zero_patch)
 {
-	if (_dm_zero_checked || zero_maj == 0)
+	if (_dm_checked(&_dm_zero_checked) || zero_maj == 0)
 		return;
 
 	log_dbg(cd, "Detected dm-zero version %i.%i.%i.",
 		zero_maj, zero_min, zero_patch);
 
-	_dm_zero_checked = true;
+	_dm_set_checked(&_dm_zero_checked);
 }
 
 /* We use this for loading target module */
@@ -265,7 +351,7 @@ static void _dm_check_target(dm_target_type target_type)
 	struct dm_task *dmt;
 	const char *target_name = NULL;
 
-	if (!(_dm_flags & DM_GET_TARGET_VERSION_SUPPORTED))
+	if (!(_dm_flags_get() & DM_GET_TARGET_VERSION_SUPPORTED))
 		return;
 
 	if (target_type == DM_CRYPT)
@@ -281,12 +367,32 @@ static void _dm_check_target(dm_target_type target_type)
 		return;
 
 	if (dm_task_set_name(dmt, target_name))
-		dm_task_run(dmt);
+		_dm_task_run(dmt);
 
 	dm_task_destroy(dmt);
 #endif
 }
 
+/*
+ * Versions are probed once per process. Only a request for a specific
+ * target that was missing in the last listing runs the probe again
+ * (it may load the target module), generic calls (DM_UNKNOWN) need
+ * just the dm-ioctl version.
+ */
+static bool _dm_versions_checked(dm_target_type target_type)
+{
+	bool crypt = _dm_checked(&_dm_crypt_checked), verity = _dm_checked(&_dm_verity_checked),
+	     integrity = _dm_checked(&_dm_integrity_checked), zero = _dm_checked(&_dm_zero_checked);
+
+	return (target_type == DM_CRYPT     && crypt) ||
+	       (target_type == DM_VERITY    && verity) ||
+	       (target_type == DM_INTEGRITY && integrity) ||
+	       (target_type == DM_ZERO      && zero) ||
+	       (target_type == DM_UNKNOWN   && _dm_checked(&_dm_ioctl_checked)) ||
+	       (target_type == DM_LINEAR) ||
+	       (crypt && verity && integrity && zero);
+}
+
 static int _dm_check_versions(struct crypt_device *cd, dm_target_type target_type)
 {
 	struct dm_task *dmt;
@@ -295,14 +401,20 @@ static int _dm_check_versions(struct crypt_device *cd, dm_target_type target_typ
 	unsigned dm_maj, dm_min, dm_patch;
 	int r = 0;
 
-	if ((target_type == DM_CRYPT     && _dm_crypt_checked) ||
-	    (target_type == DM_VERITY    && _dm_verity_checked) ||
-	    (target_type == DM_INTEGRITY && _dm_integrity_checked) ||
-	    (target_type == DM_ZERO      && _dm_zero_checked) ||
-	    (target_type == DM_LINEAR) ||
-	    (_dm_crypt_checked && _dm_verity_checked && _dm_integrity_checked && _dm_zero_checked))
+	if (_dm_prepare_job)
+		dm_prepare_wait(_dm_prepare_job);
+
+	if (_dm_versions_checked(target_type))
 		return 1;
 
+	pthread_mutex_lock(&_dm_check_lock);
+
+	/* probed by another thread in the meantime */
+	if (_dm_versions_checked(target_type)) {
+		pthread_mutex_unlock(&_dm_check_lock);
+		return 1;
+	}
+
 	/* Shut up DM while checking */
 	_quiet_log = 1;
 
@@ -311,26 +423,26 @@ static int _dm_check_versions(struct crypt_device *cd, dm_target_type target_typ
 	if (!(dmt = dm_task_create(DM_DEVICE_LIST_VERSIONS)))
 		goto out;
 
-	if (!dm_task_run(dmt))
+	if (!_dm_task_run(dmt))
 		goto out;
 
 	if (!dm_task_get_driver_version(dmt, dm_version, sizeof(dm_version)))
 		goto out;
 
-	if (!_dm_ioctl_checked) {
+	if (!_dm_checked(&_dm_ioctl_checked)) {
 		if (sscanf(dm_version, "%u.%u.%u", &dm_maj, &dm_min, &dm_patch) != 3)
 			goto out;
 		log_dbg(cd, "Detected dm-ioctl version %u.%u.%u.", dm_maj, dm_min, dm_patch);
 
 		if (_dm_satisfies_version(4, 20, 0, dm_maj, dm_min, dm_patch))
-			_dm_flags |= DM_SECURE_SUPPORTED;
+			_dm_flags_set(DM_SECURE_SUPPORTED);
 #if HAVE_DECL_DM_TASK_DEFERRED_REMOVE
 		if (_dm_satisfies_version(4, 27, 0, dm_maj, dm_min, dm_patch))
-			_dm_flags |= DM_DEFERRED_SUPPORTED;
+			_dm_flags_set(DM_DEFERRED_SUPPORTED);
 #endif
 #if HAVE_DECL_DM_DEVICE_GET_TARGET_VERSION
 		if (_dm_satisfies_version(4, 41, 0, dm_maj, dm_min, dm_patch))
-			_dm_flags |= DM_GET_TARGET_VERSION_SUPPORTED;
+			_dm_flags_set(DM_GET_TARGET_VERSION_SUPPORTED);
 #endif
 	}
 
@@ -358,59 +470,121 @@ static int _dm_check_versions(struct crypt_device *cd, dm_target_type target_typ
 	} while (last_target != target);
 
 	r = 1;
-	if (!_dm_ioctl_checked)
+	if (!_dm_checked(&_dm_ioctl_checked))
 		log_dbg(cd, "Device-mapper backend running with UDEV support %sabled.",
 			_dm_use_udev() ? "en" : "dis");
 
-	_dm_ioctl_checked = true;
+	_dm_set_checked(&_dm_ioctl_checked);
 out:
 	if (dmt)
 		dm_task_destroy(dmt);
 
 	_quiet_log = 0;
+	pthread_mutex_unlock(&_dm_check_lock);
 	return r;
 }
 
-int dm_flags(struct crypt_device *cd, dm_target_type target, uint32_t *flags)
+static void *_dm_prepare_thread(void *arg)
 {
-	_dm_check_versions(cd, target);
-	*flags = _dm_flags;
+	struct dm_prepare_job *job = arg;
 
-	if (target == DM_UNKNOWN &&
-	    _dm_crypt_checked && _dm_verity_checked && _dm_integrity_checked && _dm_zero_checked)
-		return 0;
+	(void)_dm_check_versions(job->cd, job->target);
+	return NULL;
+}
 
-	if ((target == DM_CRYPT     && _dm_crypt_checked) ||
-	    (target == DM_VERITY    && _dm_verity_checked) ||
-	    (target == DM_INTEGRITY && _dm_integrity_checked) ||
-	    (target == DM_ZERO      && _dm_zero_checked) ||
-	    (target == DM_LINEAR)) /* nothing to check */
-		return 0;
+/*
+ * Probe DM driver and target versions (may load target kernel module)
+ * in another thread. Versions are probed only once per process, so the
+ * activation later finds them ready. Failures are reported there.
+ * The starting thread joins the probe before its own first version check.
+ */
+void dm_prepare_start(struct crypt_device *cd, dm_target_type target, struct dm_prepare_job *job)
+{
+	job->cd = cd;
+	job->target = target;
+	job->threaded = false;
+
+	if (_dm_versions_checked(target))
+		return;
+
+	log_dbg(cd, "Probing device-mapper versions in background.");
+	job->threaded = !pthread_create(&job->thread, NULL, _dm_prepare_thread, job);
+	if (job->threaded)
+		_dm_prepare_job = job;
+}
+
+void dm_prepare_wait(struct dm_prepare_job *job)
+{
+	if (job->threaded)
+		pthread_join(job->thread, NULL);
+	job->threaded = false;
+	if (_dm_prepare_job == job)
+		_dm_prepare_job = NULL;
+}
+
+int dm_udev_batch_begin(struct crypt_device *cd)
+{
+	if (_dm_udev_batch)
+		return -EBUSY;
+
+	log_dbg(cd, "Starting device-mapper activation batch.");
+	_dm_udev_batch = true;
+	_dm_udev_batch_cookie = 0;
+	return 0;
+}
+
+int dm_udev_batch_end(struct crypt_device *cd)
+{
+	if (!_dm_udev_batch)
+		return -EINVAL;
+
+	_dm_udev_batch = false;
+	if (_dm_udev_batch_cookie && _dm_use_udev()) {
+		log_dbg(cd, "Waiting for udev to process activation batch.");
+		(void)_dm_udev_wait(_dm_udev_batch_cookie);
+		_dm_update_nodes();
+	}
+	_dm_udev_batch_cookie = 0;
+
+	return 0;
+}
+
+int dm_flags(struct crypt_device *cd, dm_target_type target, uint32_t *flags)
+{
+	_dm_check_versions(cd, target);
+	*flags = _dm_flags_get();
 
-	return -ENODEV;
+	/* DM_UNKNOWN asks for dm-ioctl flags only */
+	return _dm_versions_checked(target) ? 0 : -ENODEV;
 }
 
 /* This doesn't run any kernel checks, just set up userspace libdevmapper */
 void dm_backend_init(struct crypt_device *cd)
 {
+	pthread_mutex_lock(&_dm_use_lock);
 	if (!_dm_use_count++) {
 		log_dbg(cd, "Initialising device-mapper backend library.");
 		dm_log_init(set_dm_error);
 		dm_log_init_verbose(10);
 	}
+	pthread_mutex_unlock(&_dm_use_lock);
 }
 
 void dm_backend_exit(struct crypt_device *cd)
 {
+	pthread_mutex_lock(&_dm_use_lock);
 	if (_dm_use_count && (!--_dm_use_count)) {
 		log_dbg(cd, "Releasing device-mapper backend.");
 		dm_log_init_verbose(0);
 		dm_log_init(NULL);
+		pthread_mutex_lock(&_dm_task_lock);
 		dm_lib_release();
+		pthread_mutex_unlock(&_dm_task_lock);
 	}
+	pthread_mutex_unlock(&_dm_use_lock);
 }
 
-/* libdevmapper is not context friendly, switch context on every DM call. */
+/* libdevmapper is not context friendly, switch (thread) context on every DM call. */
 static int dm_init_context(struct crypt_device *cd, dm_target_type target)
 {
 	_context = cd;
@@ -443,7 +617,7 @@ char *dm_device_path(const char *prefix, int major, int minor)
 	if (!dm_task_set_minor(dmt, minor) ||
 	    !dm_task_set_major(dmt, major) ||
 	    !dm_task_no_flush(dmt) ||
-	    !dm_task_run(dmt) ||
+	    !_dm_task_run(dmt) ||
 	    !(name = dm_task_get_name(dmt))) {
 		dm_task_destroy(dmt);
 		return NULL;
@@ -549,6 +723,7 @@ static char *get_dm_crypt_params(const struct dm_target *tgt, uint32_t flags)
 {
 	int r, max_size, null_cipher = 0, num_options = 0, keystr_len = 0;
 	char *params = NULL, *hexkey = NULL;
+	const char *keystr;
 	char sector_feature[32], features[512], integrity_dm[256], cipher_dm[256];
 
 	if (!tgt)
@@ -596,22 +771,23 @@ static char *get_dm_crypt_params(const struct dm_target *tgt, uint32_t flags)
 		null_cipher = 1;
 
 	if (null_cipher)
-		hexkey = crypt_bytes_to_hex(0, NULL);
+		keystr = hexkey = crypt_bytes_to_hex(0, NULL);
 	else if (flags & CRYPT_ACTIVATE_KEYRING_KEY) {
 		keystr_len = strlen(tgt->u.crypt.vk->key_description) + int_log10(tgt->u.crypt.vk->keylength) + 10;
-		hexkey = crypt_safe_alloc(keystr_len);
+		keystr = hexkey = crypt_safe_alloc(keystr_len);
 		if (!hexkey)
 			goto out;
 		r = snprintf(hexkey, keystr_len, ":%zu:logon:%s", tgt->u.crypt.vk->keylength, tgt->u.crypt.vk->key_description);
 		if (r < 0 || r >= keystr_len)
 			goto out;
 	} else
-		hexkey = crypt_bytes_to_hex(tgt->u.crypt.vk->keylength, tgt->u.crypt.vk->key);
+		/* cached in volume key, not freed here */
+		keystr = crypt_volume_key_hex(tgt->u.crypt.vk);
 
-	if (!hexkey)
+	if (!keystr)
 		goto out;
 
-	max_size = strlen(hexkey) + strlen(cipher_dm) +
+	max_size = strlen(keystr) + strlen(cipher_dm) +
 		   strlen(device_block_path(tgt->data_device)) +
 		   strlen(features) + 64;
 	params = crypt_safe_alloc(max_size);
@@ -619,7 +795,7 @@ static char *get_dm_crypt_params(const struct dm_target *tgt, uint32_t flags)
 		goto out;
 
 	r = snprintf(params, max_size, "%s %s %" PRIu64 " %s %" PRIu64 "%s",
-		     cipher_dm, hexkey, tgt->u.crypt.iv_offset,
+		     cipher_dm, keystr, tgt->u.crypt.iv_offset,
 		     device_block_path(tgt->data_device), tgt->u.crypt.offset,
 		     features);
 	if (r < 0 || r >= max_size) {
@@ -948,10 +1124,12 @@ static int _dm_remove(const char *name, int udev_wait, int deferred)
 {
 	int r = 0;
 	struct dm_task *dmt;
-	uint32_t cookie = 0;
+	uint32_t cookie = 0, *cookie_ptr = &cookie;
 
 	if (!_dm_use_udev())
 		udev_wait = 0;
+	else if (udev_wait && _dm_udev_batch)
+		cookie_ptr = &_dm_udev_batch_cookie;
 
 	if (!(dmt = dm_task_create(DM_DEVICE_REMOVE)))
 		return 0;
@@ -967,12 +1145,12 @@ static int _dm_remove(const char *name, int udev_wait, int deferred)
 	if (deferred && !dm_task_deferred_remove(dmt))
 		goto out;
 #endif
-	if (udev_wait && !_dm_task_set_cookie(dmt, &cookie, DM_UDEV_DISABLE_LIBRARY_FALLBACK))
+	if (udev_wait && !_dm_task_set_cookie(dmt, cookie_ptr, DM_UDEV_DISABLE_LIBRARY_FALLBACK))
 		goto out;
 
-	r = dm_task_run(dmt);
+	r = _dm_task_run(dmt);
 
-	if (udev_wait)
+	if (udev_wait && cookie_ptr == &cookie)
 		(void)_dm_udev_wait(cookie);
 out:
 	dm_task_destroy(dmt);
@@ -998,7 +1176,7 @@ static int _dm_simple(int task, const char *name, uint32_t dmflags)
 	    (dmflags & DM_SUSPEND_NOFLUSH) && !dm_task_no_flush(dmt))
 		goto out;
 
-	r = dm_task_run(dmt);
+	r = _dm_task_run(dmt);
 out:
 	dm_task_destroy(dmt);
 	return r;
@@ -1026,7 +1204,7 @@ static int _error_device(const char *name, size_t size)
 	if (!dm_task_no_open_count(dmt))
 		goto out;
 
-	if (!dm_task_run(dmt))
+	if (!_dm_task_run(dmt))
 		goto out;
 
 	if (_dm_resume_device(name, 0)) {
@@ -1125,7 +1303,7 @@ int dm_remove_device(struct crypt_device *cd, const char *name, uint32_t flags)
 		}
 	} while (r == -EINVAL && retries);
 
-	dm_task_update_nodes();
+	_dm_update_nodes();
 	dm_exit_context();
 
 	return r;
@@ -1287,11 +1465,17 @@ static int _dm_create_device(struct crypt_device *cd, const char *name, const ch
 	struct dm_info dmi;
 	char dev_uuid[DM_UUID_LEN] = {0};
 	int r = -EINVAL;
-	uint32_t cookie = 0, read_ahead = 0;
+	uint32_t cookie = 0, read_ahead = 0, *cookie_ptr = &cookie;
 	uint16_t udev_flags = DM_UDEV_DISABLE_LIBRARY_FALLBACK;
+	uint64_t t = crypt_time_us(), t_udev;
+
+	CRYPT_TRACE(dm__create__start, name);
 
 	if (dmd->flags & CRYPT_ACTIVATE_PRIVATE)
 		udev_flags |= CRYPT_TEMP_UDEV_FLAGS;
+	else if (_dm_udev_batch)
+		/* private devices can be used by the next dm call, only public ones wait */
+		cookie_ptr = &_dm_udev_batch_cookie;
 
 	/* All devices must have DM_UUID, only resize on old device is exception */
 	if (!dm_prepare_uuid(cd, name, type, dmd->uuid, dev_uuid, sizeof(dev_uuid)))
@@ -1326,10 +1510,10 @@ static int _dm_create_device(struct crypt_device *cd, const char *name, const ch
 	    !dm_task_set_read_ahead(dmt, read_ahead, DM_READ_AHEAD_MINIMUM_FLAG))
 		goto out;
 #endif
-	if (_dm_use_udev() && !_dm_task_set_cookie(dmt, &cookie, udev_flags))
+	if (_dm_use_udev() && !_dm_task_set_cookie(dmt, cookie_ptr, udev_flags))
 		goto out;
 
-	if (!dm_task_run(dmt)) {
+	if (!_dm_task_run(dmt)) {
 		r = dm_status_device(cd, name);;
 		if (r >= 0)
 			r = -EEXIST;
@@ -1341,8 +1525,10 @@ static int _dm_create_device(struct crypt_device *cd, const char *name, const ch
 	if (dm_task_get_info(dmt, &dmi))
 		r = 0;
 
-	if (_dm_use_udev()) {
+	if (_dm_use_udev() && cookie_ptr == &cookie) {
+		t_udev = crypt_time_us();
 		(void)_dm_udev_wait(cookie);
+		crypt_timing_add(cd, CRYPT_TIMING_UDEV, t_udev);
 		cookie = 0;
 	}
 
@@ -1350,19 +1536,24 @@ static int _dm_create_device(struct crypt_device *cd, const char *name, const ch
 		_dm_remove(name, 1, 0);
 
 out:
-	if (cookie && _dm_use_udev())
+	if (cookie && _dm_use_udev()) {
+		t_udev = crypt_time_us();
 		(void)_dm_udev_wait(cookie);
+		crypt_timing_add(cd, CRYPT_TIMING_UDEV, t_udev);
+	}
 
 	if (dmt)
 		dm_task_destroy(dmt);
 
-	dm_task_update_nodes();
+	_dm_update_nodes();
 
 	/* If code just loaded target module, update versions */
 	_dm_check_versions(cd, dmd->segment.type);
 
 	_destroy_dm_targets_params(dmd);
 
+	crypt_timing_add(cd, CRYPT_TIMING_DM, t);
+	CRYPT_TRACE(dm__create__done, name, r);
 	return r;
 }
 
@@ -1376,8 +1567,10 @@ static int _dm_resume_device(const char *name, uint32_t dmflags)
 	if (dmflags & DM_RESUME_PRIVATE)
 		udev_flags |= CRYPT_TEMP_UDEV_FLAGS;
 
+	CRYPT_TRACE(dm__resume__start, name);
+
 	if (!(dmt = dm_task_create(DM_DEVICE_RESUME)))
-		return r;
+		goto out;
 
 	if (!dm_task_set_name(dmt, name))
 		goto out;
@@ -1391,16 +1584,18 @@ static int _dm_resume_device(const char *name, uint32_t dmflags)
 	if (_dm_use_udev() && !_dm_task_set_cookie(dmt, &cookie, udev_flags))
 		goto out;
 
-	if (dm_task_run(dmt))
+	if (_dm_task_run(dmt))
 		r = 0;
 out:
 	if (cookie && _dm_use_udev())
 		(void)_dm_udev_wait(cookie);
 
-	dm_task_destroy(dmt);
+	if (dmt)
+		dm_task_destroy(dmt);
 
-	dm_task_update_nodes();
+	_dm_update_nodes();
 
+	CRYPT_TRACE(dm__resume__done, name, r);
 	return r;
 }
 
@@ -1439,7 +1634,7 @@ static int _dm_reload_device(struct crypt_device *cd, const char *name,
 		goto out;
 #endif
 
-	if (dm_task_run(dmt))
+	if (_dm_task_run(dmt))
 		r = 0;
 out:
 	if (dmt)
@@ -1600,6 +1795,11 @@ int dm_create_device(struct crypt_device *cd, const char *name,
 	if (dm_init_context(cd, dmd->segment.type))
 		return -ENOTSUP;
 
+	/* Cancelled asynchronous activation stops here, udev wait is not interrupted */
+	r = crypt_pbkdf_cancelled();
+	if (r)
+		goto out;
+
 	r = _dm_create_device(cd, name, type, dmd);
 	if (!r || r == -EEXIST)
 		goto out;
@@ -1757,7 +1957,7 @@ static int dm_status_dmi(const char *name, struct dm_info *dmi,
 	if (!dm_task_set_name(dmt, name))
 		goto out;
 
-	if (!dm_task_run(dmt))
+	if (!_dm_task_run(dmt))
 		goto out;
 
 	if (!dm_task_get_info(dmt, dmi))
@@ -1890,6 +2090,52 @@ int dm_status_integrity_failures(struct crypt_device *cd, const char *name, uint
 	return 0;
 }
 
+static int _dm_event_nr(struct crypt_device *cd, const char *name, uint32_t *event_nr, bool wait)
+{
+	struct dm_task *dmt;
+	struct dm_info dmi;
+	int r = -EINVAL;
+
+	if (dm_init_context(cd, DM_UNKNOWN))
+		return -ENOTSUP;
+
+	if (!(dmt = dm_task_create(wait ? DM_DEVICE_WAITEVENT : DM_DEVICE_INFO)))
+		goto out;
+
+	if (!dm_task_set_name(dmt, name) || (wait && !dm_task_set_event_nr(dmt, *event_nr)))
+		goto out;
+
+	r = -ENODEV;
+	if (!(wait ? _dm_task_run_wait(dmt) : _dm_task_run(dmt)) ||
+	    !dm_task_get_info(dmt, &dmi) || !dmi.exists)
+		goto out;
+
+	if (wait)
+		log_dbg(cd, "Device %s event counter %" PRIu32 " -> %" PRIu32 ".", name, *event_nr, dmi.event_nr);
+	*event_nr = dmi.event_nr;
+	r = 0;
+out:
+	if (dmt)
+		dm_task_destroy(dmt);
+	dm_exit_context();
+	return r;
+}
+
+/*
+ * Block until device event counter differs from @event_nr (returns immediately
+ * if it already differs) and update it. Targets raise events on status change.
+ */
+int dm_wait_event(struct crypt_device *cd, const char *name, uint32_t *event_nr)
+{
+	return _dm_event_nr(cd, name, event_nr, true);
+}
+
+/* Get current device event counter without waiting. */
+int dm_get_event_nr(struct crypt_device *cd, const char *name, uint32_t *event_nr)
+{
+	return _dm_event_nr(cd, name, event_nr, false);
+}
+
 /* FIXME use hex wrapper, user val wrappers for line parsing */
 static int _dm_target_query_crypt(struct crypt_device *cd, uint32_t get_flags,
 				  char *params, struct dm_target *tgt,
@@ -2680,7 +2926,7 @@ static int _dm_query_device(struct crypt_device *cd, const char *name,
 	if (!dm_task_set_name(dmt, name))
 		goto out;
 	r = -ENODEV;
-	if (!dm_task_run(dmt))
+	if (!_dm_task_run(dmt))
 		goto out;
 
 	r = -EINVAL;
@@ -2779,51 +3025,146 @@ int dm_query_device(struct crypt_device *cd, const char *name,
 	return r;
 }
 
+/* Names of all active dm devices in NULL terminated array, free with dm_names_free() */
+int dm_list_devices(struct crypt_device *cd, char ***names)
+{
+	struct dm_task *dmt;
+	struct dm_names *nl;
+	char **list = NULL, **tmp;
+	size_t count = 0;
+	unsigned next = 0;
+	int r = -EINVAL;
+
+	*names = NULL;
+
+	if (dm_init_context(cd, DM_UNKNOWN))
+		return -ENOTSUP;
+
+	if (!(dmt = dm_task_create(DM_DEVICE_LIST)))
+		goto out;
+
+	if (!_dm_task_run(dmt) || !(nl = dm_task_get_names(dmt)))
+		goto out;
+
+	r = -ENOMEM;
+	if (!(list = calloc(1, sizeof(*list))))
+		goto out;
+
+	/* empty list has no device entry */
+	if (nl->dev) {
+		do {
+			nl = VOIDP_CAST(struct dm_names *)((char *)nl + next);
+			if (!(tmp = realloc(list, (count + 2) * sizeof(*list))))
+				goto out;
+			list = tmp;
+			if (!(list[count] = strdup(nl->name)))
+				goto out;
+			list[++count] = NULL;
+			next = nl->next;
+		} while (next);
+	}
+
+	*names = list;
+	list = NULL;
+	r = 0;
+out:
+	dm_names_free(list);
+	if (dmt)
+		dm_task_destroy(dmt);
+	dm_exit_context();
+	return r;
+}
+
+void dm_names_free(char **names)
+{
+	char **name = names;
+
+	while (name && *name)
+		free(*name++);
+	free(names);
+}
+
+/* Name and uuid of dm device by its number, one info ioctl without table parsing */
+static int _dm_info_by_devno(dev_t devno, char *name, size_t name_size,
+			     char *uuid, size_t uuid_size)
+{
+	struct dm_task *dmt;
+	struct dm_info dmi;
+	const char *tmp;
+	int r = -EINVAL;
+
+	if (!(dmt = dm_task_create(DM_DEVICE_INFO)))
+		return r;
+
+	if (!dm_task_set_major(dmt, major(devno)) || !dm_task_set_minor(dmt, minor(devno)))
+		goto out;
+
+	r = -ENODEV;
+	if (!_dm_task_run(dmt) || !dm_task_get_info(dmt, &dmi) || !dmi.exists)
+		goto out;
+
+	r = -EINVAL;
+	if (!(tmp = dm_task_get_name(dmt)) || strlen(tmp) >= name_size)
+		goto out;
+	strcpy(name, tmp);
+
+	tmp = dm_task_get_uuid(dmt);
+	if (!tmp || strlen(tmp) >= uuid_size)
+		*uuid = '\0';
+	else
+		strcpy(uuid, tmp);
+	r = 0;
+out:
+	dm_task_destroy(dmt);
+	return r;
+}
+
 static int _process_deps(struct crypt_device *cd, const char *prefix, struct dm_deps *deps,
-			 char **names, size_t names_offset, size_t names_length)
+			 char **names, size_t names_offset, size_t names_length,
+			 dev_t *seen, size_t *seen_count, size_t seen_length)
 {
-#if HAVE_DECL_DM_DEVICE_GET_NAME
-	struct crypt_dm_active_device dmd;
-	char dmname[PATH_MAX];
+	char dmname[PATH_MAX], dmuuid[DM_UUID_LEN];
 	unsigned i;
-	int r, major, minor, count = 0;
+	size_t j;
+	int count = 0;
 
-	if (!prefix || !deps)
+	if (!deps)
 		return -EINVAL;
 
 	for (i = 0; i < deps->count; i++) {
-		major = major(deps->device[i]);
-		if (!dm_is_dm_major(major))
+		if (!dm_is_dm_major(major(deps->device[i])))
 			continue;
 
-		minor = minor(deps->device[i]);
-		if (!dm_device_get_name(major, minor, 0, dmname, PATH_MAX))
-			return -EINVAL;
+		/* shared lower devices in the stack are resolved only once */
+		for (j = 0; j < *seen_count; j++)
+			if (seen[j] == deps->device[i])
+				break;
+		if (j < *seen_count)
+			continue;
+		if (*seen_count < seen_length)
+			seen[(*seen_count)++] = deps->device[i];
 
-		memset(&dmd, 0, sizeof(dmd));
-		r = _dm_query_device(cd, dmname, DM_ACTIVE_UUID, &dmd);
-		if (r < 0)
+		if (_dm_info_by_devno(deps->device[i], dmname, sizeof(dmname), dmuuid, sizeof(dmuuid)))
 			continue;
 
-		if (!dmd.uuid ||
-		    strncmp(prefix, dmd.uuid, strlen(prefix)) ||
+		/* without prefix all device-mapper dependencies are returned */
+		if ((prefix && (strncmp(dmuuid, DM_UUID_PREFIX, DM_UUID_PREFIX_LEN) ||
+		     strncmp(prefix, dmuuid + DM_UUID_PREFIX_LEN, strlen(prefix)))) ||
 		    crypt_string_in(dmname, names, names_length))
 			*dmname = '\0';
 
-		dm_targets_free(cd, &dmd);
-		free(CONST_CAST(void*)dmd.uuid);
-
 		if ((size_t)count >= (names_length - names_offset))
 			return -ENOMEM;
 
-		if (*dmname && !(names[names_offset + count++] = strdup(dmname)))
+		if (!*dmname)
+			continue;
+
+		log_dbg(cd, "Found dependency %s.", dmname);
+		if (!(names[names_offset + count++] = strdup(dmname)))
 			return -ENOMEM;
 	}
 
 	return count;
-#else
-	return -EINVAL;
-#endif
 }
 
 int dm_device_deps(struct crypt_device *cd, const char *name, const char *prefix,
@@ -2832,8 +3173,9 @@ int dm_device_deps(struct crypt_device *cd, const char *name, const char *prefix
 	struct dm_task *dmt;
 	struct dm_info dmi;
 	struct dm_deps *deps;
+	dev_t seen[64];
 	int r = -EINVAL;
-	size_t i, last = 0, offset = 0;
+	size_t i, last = 0, offset = 0, seen_count = 0;
 
 	if (!name || !names_length || !names)
 		return -EINVAL;
@@ -2848,7 +3190,7 @@ int dm_device_deps(struct crypt_device *cd, const char *name, const char *prefix
 			goto out;
 
 		r = -ENODEV;
-		if (!dm_task_run(dmt))
+		if (!_dm_task_run(dmt))
 			goto out;
 
 		r = -EINVAL;
@@ -2861,7 +3203,8 @@ int dm_device_deps(struct crypt_device *cd, const char *name, const char *prefix
 		if (!dmi.exists)
 			goto out;
 
-		r = _process_deps(cd, prefix, deps, names, offset, names_length - 1);
+		r = _process_deps(cd, prefix, deps, names, offset, names_length - 1,
+				  seen, &seen_count, ARRAY_SIZE(seen));
 		if (r < 0)
 			goto out;
 
@@ -2907,7 +3250,7 @@ static int _dm_message(const char *name, const char *msg)
 	if (!dm_task_set_message(dmt, msg))
 		goto out;
 
-	r = dm_task_run(dmt);
+	r = _dm_task_run(dmt);
 out:
 	dm_task_destroy(dmt);
 	return r;
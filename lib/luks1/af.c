@@ -29,71 +29,55 @@
 #include "internal.h"
 #include "af.h"
 
+/* dst may be the same buffer as src2, every word is read before it is written */
 static void XORblock(const char *src1, const char *src2, char *dst, size_t n)
 {
+	uint64_t a, b;
 	size_t j;
 
-	for (j = 0; j < n; j++)
+	for (j = 0; j + sizeof(a) <= n; j += sizeof(a)) {
+		memcpy(&a, src1 + j, sizeof(a));
+		memcpy(&b, src2 + j, sizeof(b));
+		a ^= b;
+		memcpy(dst + j, &a, sizeof(a));
+	}
+
+	for (; j < n; j++)
 		dst[j] = src1[j] ^ src2[j];
 }
 
-static int hash_buf(const char *src, char *dst, uint32_t iv,
-		    size_t len, const char *hash_name)
+/*
+ * diffuse: Information spreading over the whole dataset with
+ * the help of hash function.
+ * The hash context is reused for all blocks (and all rounds of split/merge).
+ */
+static int diffuse(struct crypt_hash *hd, char *src, char *dst, size_t size,
+		   const char *hash_name, unsigned int digest_size)
 {
-	struct crypt_hash *hd = NULL;
-	char *iv_char = (char *)&iv;
+	unsigned int blocks, padding;
 	int r;
 
-	iv = be32_to_cpu(iv);
-	if (crypt_hash_init(&hd, hash_name))
-		return -EINVAL;
+	blocks = size / digest_size;
+	padding = size % digest_size;
 
-	if ((r = crypt_hash_write(hd, iv_char, sizeof(uint32_t))))
-		goto out;
+	r = crypt_hash_indexed_blocks(hd, hash_name, 0, src, digest_size, blocks, dst);
 
-	if ((r = crypt_hash_write(hd, src, len)))
-		goto out;
+	if (!r && padding)
+		r = crypt_hash_indexed_blocks(hd, hash_name, blocks, src + digest_size * blocks,
+					      padding, 1, dst + digest_size * blocks);
 
-	r = crypt_hash_final(hd, dst, len);
-out:
-	crypt_hash_destroy(hd);
 	return r;
 }
 
-/*
- * diffuse: Information spreading over the whole dataset with
- * the help of hash function.
- */
-static int diffuse(char *src, char *dst, size_t size, const char *hash_name)
+static int diffuse_init(struct crypt_hash **hd, const char *hash_name, unsigned int *digest_size)
 {
-	int r, hash_size = crypt_hash_size(hash_name);
-	unsigned int digest_size;
-	unsigned int i, blocks, padding;
+	int hash_size = crypt_hash_size(hash_name);
 
 	if (hash_size <= 0)
 		return -EINVAL;
-	digest_size = hash_size;
-
-	blocks = size / digest_size;
-	padding = size % digest_size;
+	*digest_size = hash_size;
 
-	for (i = 0; i < blocks; i++) {
-		r = hash_buf(src + digest_size * i,
-			    dst + digest_size * i,
-			    i, (size_t)digest_size, hash_name);
-		if (r < 0)
-			return r;
-	}
-
-	if (padding) {
-		r = hash_buf(src + digest_size * i,
-			    dst + digest_size * i,
-			    i, (size_t)padding, hash_name);
-		if (r < 0)
-			return r;
-	}
-
-	return 0;
+	return crypt_hash_init(hd, hash_name) ? -EINVAL : 0;
 }
 
 /*
@@ -104,22 +88,30 @@ static int diffuse(char *src, char *dst, size_t size, const char *hash_name)
 int AF_split(struct crypt_device *ctx, const char *src, char *dst,
 	     size_t blocksize, unsigned int blocknumbers, const char *hash)
 {
-	unsigned int i;
+	struct crypt_hash *hd = NULL;
+	unsigned int i, digest_size;
 	char *bufblock;
 	int r;
 
+	r = diffuse_init(&hd, hash, &digest_size);
+	if (r < 0)
+		return r;
+
 	bufblock = crypt_safe_alloc(blocksize);
-	if (!bufblock)
+	if (!bufblock) {
+		crypt_hash_destroy(hd);
 		return -ENOMEM;
+	}
+
+	/* random fill of everything except the last block in one request */
+	r = crypt_random_get(ctx, dst, blocksize * (blocknumbers - 1), CRYPT_RND_NORMAL);
+	if (r < 0)
+		goto out;
 
 	/* process everything except the last block */
 	for (i = 0; i < blocknumbers - 1; i++) {
-		r = crypt_random_get(ctx, dst + blocksize * i, blocksize, CRYPT_RND_NORMAL);
-		if (r < 0)
-			goto out;
-
 		XORblock(dst + blocksize * i, bufblock, bufblock, blocksize);
-		r = diffuse(bufblock, bufblock, blocksize, hash);
+		r = diffuse(hd, bufblock, bufblock, blocksize, hash, digest_size);
 		if (r < 0)
 			goto out;
 	}
@@ -128,23 +120,37 @@ int AF_split(struct crypt_device *ctx, const char *src, char *dst,
 	r = 0;
 out:
 	crypt_safe_free(bufblock);
+	crypt_hash_destroy(hd);
 	return r;
 }
 
+/*
+ * Stripes form a chain (each round needs the diffused result of the previous
+ * one), so one merge always runs serially. LUKS1 batch unlock merges different
+ * keyslots in threads, LUKS2 parallel unlock runs only the PBKDF in threads
+ * and merges in the calling thread.
+ */
 int AF_merge(const char *src, char *dst,
 	     size_t blocksize, unsigned int blocknumbers, const char *hash)
 {
-	unsigned int i;
+	struct crypt_hash *hd = NULL;
+	unsigned int i, digest_size;
 	char *bufblock;
 	int r;
 
+	r = diffuse_init(&hd, hash, &digest_size);
+	if (r < 0)
+		return r;
+
 	bufblock = crypt_safe_alloc(blocksize);
-	if (!bufblock)
+	if (!bufblock) {
+		crypt_hash_destroy(hd);
 		return -ENOMEM;
+	}
 
 	for (i = 0; i < blocknumbers - 1; i++) {
 		XORblock(src + blocksize * i, bufblock, bufblock, blocksize);
-		r = diffuse(bufblock, bufblock, blocksize, hash);
+		r = diffuse(hd, bufblock, bufblock, blocksize, hash, digest_size);
 		if (r < 0)
 			goto out;
 	}
@@ -152,6 +158,7 @@ int AF_merge(const char *src, char *dst,
 	r = 0;
 out:
 	crypt_safe_free(bufblock);
+	crypt_hash_destroy(hd);
 	return r;
 }
 
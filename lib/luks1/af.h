@@ -64,4 +64,9 @@ int LUKS_decrypt_from_storage(
 	unsigned int sector,
 	struct crypt_device *ctx);
 
+int LUKS_read_from_storage(
+	char *dst, size_t dstLength,
+	unsigned int sector,
+	struct crypt_device *ctx);
+
 #endif
@@ -188,7 +188,7 @@ int LUKS_encrypt_to_storage(char *src, size_t srcLength,
 	if (devfd < 0)
 		goto out;
 
-	if (write_lseek_blockwise(devfd, device_block_size(ctx, device),
+	if (pwrite_blockwise(devfd, device_block_size(ctx, device),
 				  device_alignment(device), src, srcLength,
 				  sector * SECTOR_SIZE) < 0)
 		goto out;
@@ -202,6 +202,41 @@ out:
 	return r;
 }
 
+/* Read keyslot area as stored on device, still encrypted */
+int LUKS_read_from_storage(char *dst, size_t dstLength,
+			   unsigned int sector,
+			   struct crypt_device *ctx)
+{
+	struct device *device = crypt_metadata_device(ctx);
+	struct stat st;
+	int devfd;
+
+	/* Only whole sector reads supported */
+	if (MISALIGNED_512(dstLength))
+		return -EINVAL;
+
+	if (device_is_locked(device))
+		devfd = device_open_locked(ctx, device, O_RDONLY);
+	else
+		devfd = device_open(ctx, device, O_RDONLY);
+	if (devfd < 0) {
+		log_err(ctx, _("Cannot open device %s."), device_path(device));
+		return -EIO;
+	}
+
+	if (pread_blockwise(devfd, device_block_size(ctx, device),
+				 device_alignment(device), dst, dstLength,
+				 sector * SECTOR_SIZE) < 0) {
+		if (!fstat(devfd, &st) && (st.st_size < (off_t)dstLength))
+			log_err(ctx, _("Device %s is too small."), device_path(device));
+		else
+			log_err(ctx, _("IO error while decrypting keyslot."));
+		return -EIO;
+	}
+
+	return 0;
+}
+
 int LUKS_decrypt_from_storage(char *dst, size_t dstLength,
 			      const char *cipher,
 			      const char *cipher_mode,
@@ -211,8 +246,7 @@ int LUKS_decrypt_from_storage(char *dst, size_t dstLength,
 {
 	struct device *device = crypt_metadata_device(ctx);
 	struct crypt_storage *s;
-	struct stat st;
-	int devfd, r = 0;
+	int r = 0;
 
 	/* Only whole sector reads supported */
 	if (MISALIGNED_512(dstLength))
@@ -238,26 +272,10 @@ int LUKS_decrypt_from_storage(char *dst, size_t dstLength,
 	log_dbg(ctx, "Using userspace crypto wrapper to access keyslot area.");
 
 	/* Read buffer from device */
-	if (device_is_locked(device))
-		devfd = device_open_locked(ctx, device, O_RDONLY);
-	else
-		devfd = device_open(ctx, device, O_RDONLY);
-	if (devfd < 0) {
-		log_err(ctx, _("Cannot open device %s."), device_path(device));
-		crypt_storage_destroy(s);
-		return -EIO;
-	}
-
-	if (read_lseek_blockwise(devfd, device_block_size(ctx, device),
-				 device_alignment(device), dst, dstLength,
-				 sector * SECTOR_SIZE) < 0) {
-		if (!fstat(devfd, &st) && (st.st_size < (off_t)dstLength))
-			log_err(ctx, _("Device %s is too small."), device_path(device));
-		else
-			log_err(ctx, _("IO error while decrypting keyslot."));
-
+	r = LUKS_read_from_storage(dst, dstLength, sector, ctx);
+	if (r) {
 		crypt_storage_destroy(s);
-		return -EIO;
+		return r;
 	}
 
 	/* Decrypt buffer */
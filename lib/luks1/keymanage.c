@@ -30,6 +30,7 @@
 #include <ctype.h>
 #include <uuid/uuid.h>
 #include <limits.h>
+#include <pthread.h>
 
 #include "luks.h"
 #include "af.h"
@@ -251,7 +252,7 @@ int LUKS_hdr_backup(const char *backup_file, struct crypt_device *ctx)
 		goto out;
 	}
 
-	if (read_lseek_blockwise(devfd, device_block_size(ctx, device), device_alignment(device),
+	if (pread_blockwise(devfd, device_block_size(ctx, device), device_alignment(device),
 			   buffer, hdr_size, 0) < (ssize_t)hdr_size) {
 		r = -EIO;
 		goto out;
@@ -270,7 +271,8 @@ int LUKS_hdr_backup(const char *backup_file, struct crypt_device *ctx)
 		r = -EINVAL;
 		goto out;
 	}
-	ret = write_buffer(fd, buffer, buffer_size);
+	/* Unused keyslot area stays a hole in the backup file */
+	ret = write_buffer_sparse(fd, buffer, buffer_size);
 	close(fd);
 	if (ret < (ssize_t)buffer_size) {
 		log_err(ctx, _("Cannot write header backup file %s."), backup_file);
@@ -371,7 +373,7 @@ int LUKS_hdr_restore(
 		goto out;
 	}
 
-	if (write_lseek_blockwise(devfd, device_block_size(ctx, device), device_alignment(device),
+	if (pwrite_blockwise(devfd, device_block_size(ctx, device), device_alignment(device),
 			    buffer, buffer_size, 0) < buffer_size) {
 		r = -EIO;
 		goto out;
@@ -631,7 +633,7 @@ int LUKS_read_phdr(struct luks_phdr *hdr,
 		return -EINVAL;
 	}
 
-	if (read_lseek_blockwise(devfd, device_block_size(ctx, device), device_alignment(device),
+	if (pread_blockwise(devfd, device_block_size(ctx, device), device_alignment(device),
 			   hdr, hdr_size, 0) < hdr_size)
 		r = -EIO;
 	else
@@ -696,7 +698,7 @@ int LUKS_write_phdr(struct luks_phdr *hdr,
 		convHdr.keyblock[i].stripes            = cpu_to_be32(hdr->keyblock[i].stripes);
 	}
 
-	r = write_lseek_blockwise(devfd, device_block_size(ctx, device), device_alignment(device),
+	r = pwrite_blockwise(devfd, device_block_size(ctx, device), device_alignment(device),
 			    &convHdr, hdr_size, 0) < hdr_size ? -EIO : 0;
 	if (r)
 		log_err(ctx, _("Error during update of LUKS header on device %s."), device_path(device));
@@ -1032,13 +1034,23 @@ static int LUKS_open_key(unsigned int keyIndex,
 		goto out;
 	}
 
-	r = crypt_pbkdf(CRYPT_KDF_PBKDF2, hdr->hashSpec, password, passwordLen,
+	r = crypt_derived_key_cache_get(ctx, CRYPT_KDF_PBKDF2, hdr->hashSpec, password, passwordLen,
+			hdr->keyblock[keyIndex].passwordSalt, LUKS_SALTSIZE,
+			derived_key->key, hdr->keyBytes,
+			hdr->keyblock[keyIndex].passwordIterations, 0, 0);
+	if (r == -ENOENT) {
+		r = crypt_pbkdf(CRYPT_KDF_PBKDF2, hdr->hashSpec, password, passwordLen,
+				hdr->keyblock[keyIndex].passwordSalt, LUKS_SALTSIZE,
+				derived_key->key, hdr->keyBytes,
+				hdr->keyblock[keyIndex].passwordIterations, 0, 0);
+		if (r < 0) {
+			log_err(ctx, _("Cannot open keyslot (using hash %s)."), hdr->hashSpec);
+			goto out;
+		}
+		crypt_derived_key_cache_put(ctx, CRYPT_KDF_PBKDF2, hdr->hashSpec, password, passwordLen,
 			hdr->keyblock[keyIndex].passwordSalt, LUKS_SALTSIZE,
 			derived_key->key, hdr->keyBytes,
 			hdr->keyblock[keyIndex].passwordIterations, 0, 0);
-	if (r < 0) {
-		log_err(ctx, _("Cannot open keyslot (using hash %s)."), hdr->hashSpec);
-		goto out;
 	}
 
 	log_dbg(ctx, "Reading key slot %d area.", keyIndex);
@@ -1078,26 +1090,268 @@ int LUKS_open_key_with_hdr(int keyIndex,
 			   struct crypt_device *ctx)
 {
 	unsigned int i, tried = 0;
+	uint64_t t = crypt_time_us();
 	int r;
 
 	if (keyIndex >= 0) {
 		r = LUKS_open_key(keyIndex, password, passwordLen, hdr, vk, ctx);
+		crypt_timing_add(ctx, CRYPT_TIMING_KEYSLOT, t);
 		return (r < 0) ? r : keyIndex;
 	}
 
 	for (i = 0; i < LUKS_NUMKEYS; i++) {
 		r = LUKS_open_key(i, password, passwordLen, hdr, vk, ctx);
 		if (r == 0)
-			return i;
+			break;
 
 		/* Do not retry for errors that are no -EPERM or -ENOENT,
 		   former meaning password wrong, latter key slot inactive */
 		if ((r != -EPERM) && (r != -ENOENT))
-			return r;
+			break;
 		if (r == -EPERM)
 			tried++;
 	}
-	/* Warning, early returns above */
+	crypt_timing_add(ctx, CRYPT_TIMING_KEYSLOT, t);
+
+	if (i < LUKS_NUMKEYS)
+		return r ?: (int)i;
+	return tried ? -EPERM : -ENOENT;
+}
+
+/* Candidates derived at once, all keys of a batch are kept in safe memory */
+#define LUKS_TEST_BATCH 256
+#define LUKS_TEST_MAX_THREADS 64
+
+struct luks_merge_thread {
+	const struct luks_phdr *hdr;
+	unsigned int keyIndex;
+	const char *area;
+	size_t AFEKSize;
+	const char *keys;
+	char *vks;
+	size_t first, count;
+	pthread_t thread;
+	int r;
+};
+
+/* Decrypt copy of keyslot area with each derived key and merge AF stripes */
+static void *LUKS_merge_thread(void *arg)
+{
+	struct luks_merge_thread *t = arg;
+	const struct luks_phdr *hdr = t->hdr;
+	struct crypt_storage *s;
+	char *AfKey;
+	size_t j;
+
+	AfKey = crypt_safe_alloc(t->AFEKSize);
+	if (!AfKey) {
+		t->r = -ENOMEM;
+		return NULL;
+	}
+
+	for (j = t->first, t->r = 0; j < t->first + t->count && !t->r; j++) {
+		t->r = crypt_storage_init(&s, SECTOR_SIZE, hdr->cipherName, hdr->cipherMode,
+					  t->keys + j * hdr->keyBytes, hdr->keyBytes, false);
+		if (t->r)
+			break;
+
+		memcpy(AfKey, t->area, t->AFEKSize);
+		t->r = crypt_storage_decrypt(s, 0, t->AFEKSize, AfKey);
+		crypt_storage_destroy(s);
+		if (!t->r)
+			t->r = AF_merge(AfKey, t->vks + j * hdr->keyBytes, hdr->keyBytes,
+					hdr->keyblock[t->keyIndex].stripes, hdr->hashSpec);
+	}
+
+	crypt_safe_free(AfKey);
+	return NULL;
+}
+
+static int LUKS_merge_batch(struct luks_merge_thread *t, unsigned threads, size_t count)
+{
+	size_t chunk, done;
+	unsigned i, started;
+	int r = 0;
+
+	chunk = (count + threads - 1) / threads;
+	for (i = 0, done = 0; i < threads && done < count; i++, done += chunk) {
+		t[i] = t[0];
+		t[i].first = done;
+		t[i].count = count - done < chunk ? count - done : chunk;
+	}
+	threads = i;
+
+	/* Job 0 runs in the calling thread, fall back to it if thread creation fails. */
+	for (started = 1; started < threads; started++)
+		if (pthread_create(&t[started].thread, NULL, LUKS_merge_thread, &t[started]))
+			break;
+
+	for (i = started; i < threads; i++)
+		(void)LUKS_merge_thread(&t[i]);
+	(void)LUKS_merge_thread(&t[0]);
+
+	for (i = 1; i < started; i++)
+		pthread_join(t[i].thread, NULL);
+
+	for (i = 0; i < threads && !r; i++)
+		r = t[i].r;
+
+	return r;
+}
+
+/*
+ * The keyslot area is read once, both PBKDF2 runs (passphrase and volume key
+ * digest) and the AF merge are batched over candidates. Returns -ENOTSUP
+ * if the keyslot cipher is not available in userspace crypto.
+ */
+static int LUKS_test_passphrases_slot(unsigned int keyIndex,
+				      const char *const *passwords,
+				      const size_t *passwordLens,
+				      size_t count,
+				      unsigned threads,
+				      struct luks_phdr *hdr,
+				      size_t *found,
+				      struct crypt_device *ctx)
+{
+	struct luks_merge_thread t[LUKS_TEST_MAX_THREADS];
+	struct crypt_pbkdf2_job *jobs;
+	char *area = NULL, *keys = NULL, *vks = NULL, *digests = NULL;
+	size_t AFEKSize, i, j, n, keyBytes = hdr->keyBytes;
+	bool null_cipher = crypt_is_cipher_null(hdr->cipherName);
+	int r;
+
+	log_dbg(ctx, "Testing %zu passphrases on key slot %u.", count, keyIndex);
+
+	if (threads > LUKS_TEST_MAX_THREADS)
+		threads = LUKS_TEST_MAX_THREADS;
+
+	jobs = malloc(LUKS_TEST_BATCH * sizeof(*jobs));
+	AFEKSize = AF_split_sectors(keyBytes, hdr->keyblock[keyIndex].stripes) * SECTOR_SIZE;
+	area = crypt_safe_alloc(AFEKSize);
+	keys = crypt_safe_alloc(LUKS_TEST_BATCH * keyBytes);
+	vks = crypt_safe_alloc(LUKS_TEST_BATCH * keyBytes);
+	digests = crypt_safe_alloc(LUKS_TEST_BATCH * LUKS_DIGESTSIZE);
+	if (!jobs || !area || !keys || !vks || !digests) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	r = LUKS_read_from_storage(area, AFEKSize, hdr->keyblock[keyIndex].keyMaterialOffset, ctx);
+	if (r < 0)
+		goto out;
+
+	t[0] = (struct luks_merge_thread) {
+		.hdr = hdr,
+		.keyIndex = keyIndex,
+		.area = area,
+		.AFEKSize = AFEKSize,
+		.keys = keys,
+		.vks = vks,
+	};
+
+	for (i = 0; i < count; i += n) {
+		n = count - i < LUKS_TEST_BATCH ? count - i : LUKS_TEST_BATCH;
+
+		for (j = 0; j < n; j++) {
+			jobs[j].password = passwords[i + j];
+			jobs[j].password_length = passwordLens[i + j];
+			jobs[j].salt = hdr->keyblock[keyIndex].passwordSalt;
+			jobs[j].salt_length = LUKS_SALTSIZE;
+			jobs[j].key = keys + j * keyBytes;
+		}
+
+		r = crypt_pbkdf2_batch(hdr->hashSpec, threads, hdr->keyblock[keyIndex].passwordIterations,
+				       keyBytes, jobs, n);
+		if (r < 0) {
+			log_err(ctx, _("Cannot open keyslot (using hash %s)."), hdr->hashSpec);
+			goto out;
+		}
+
+		r = LUKS_merge_batch(t, threads, n);
+		if (r == -ENOTSUP || r == -ENOENT) {
+			log_dbg(ctx, "Userspace crypto wrapper cannot use %s-%s (%d).",
+				hdr->cipherName, hdr->cipherMode, r);
+			r = -ENOTSUP;
+		}
+		if (r < 0)
+			goto out;
+
+		for (j = 0; j < n; j++) {
+			jobs[j].password = vks + j * keyBytes;
+			jobs[j].password_length = keyBytes;
+			jobs[j].salt = hdr->mkDigestSalt;
+			jobs[j].salt_length = LUKS_SALTSIZE;
+			jobs[j].key = digests + j * LUKS_DIGESTSIZE;
+		}
+
+		r = crypt_pbkdf2_batch(hdr->hashSpec, threads, hdr->mkDigestIterations,
+				       LUKS_DIGESTSIZE, jobs, n);
+		if (r < 0) {
+			r = -EINVAL;
+			goto out;
+		}
+
+		for (j = 0; j < n; j++) {
+			if (crypt_backend_memeq(digests + j * LUKS_DIGESTSIZE, hdr->mkDigest, LUKS_DIGESTSIZE))
+				continue;
+			/* Allow only empty passphrase with null cipher */
+			if (null_cipher && passwordLens[i + j])
+				continue;
+			*found = i + j;
+			r = 0;
+			goto out;
+		}
+	}
+	r = -EPERM;
+out:
+	free(jobs);
+	crypt_safe_free(area);
+	crypt_safe_free(keys);
+	crypt_safe_free(vks);
+	crypt_safe_free(digests);
+	return r;
+}
+
+int LUKS_test_passphrases(int keyIndex,
+			  const char *const *passwords,
+			  const size_t *passwordLens,
+			  size_t count,
+			  unsigned threads,
+			  struct luks_phdr *hdr,
+			  size_t *found,
+			  struct crypt_device *ctx)
+{
+	struct volume_key *vk = NULL;
+	unsigned int i, tried = 0;
+	size_t j;
+	int r;
+
+	for (i = 0; i < LUKS_NUMKEYS; i++) {
+		if (keyIndex >= 0 && i != (unsigned)keyIndex)
+			continue;
+		if (LUKS_keyslot_info(hdr, i) < CRYPT_SLOT_ACTIVE)
+			continue;
+
+		r = LUKS_test_passphrases_slot(i, passwords, passwordLens, count, threads, hdr, found, ctx);
+
+		/* Keyslot cipher needs dm-crypt, one candidate at a time */
+		if (r == -ENOTSUP) {
+			for (j = 0, r = -EPERM; r == -EPERM && j < count; j++) {
+				r = LUKS_open_key(i, passwords[j], passwordLens[j], hdr, &vk, ctx);
+				crypt_free_volume_key(vk);
+				vk = NULL;
+				if (!r)
+					*found = j;
+			}
+		}
+
+		if (!r)
+			return i;
+		if (r != -EPERM)
+			return r;
+		tried++;
+	}
+
 	return tried ? -EPERM : -ENOENT;
 }
 
@@ -1147,6 +1401,51 @@ int LUKS_del_key(unsigned int keyIndex,
 	return r;
 }
 
+/* Wipe all active keyslots, the header is written only once */
+int LUKS_del_key_all(struct luks_phdr *hdr, struct crypt_device *ctx)
+{
+	struct device *device = crypt_metadata_device(ctx);
+	unsigned int i, startOffset, endOffset;
+	int r;
+
+	r = LUKS_read_phdr(hdr, 1, 0, ctx);
+	if (r)
+		return r;
+
+	for (i = 0; i < LUKS_NUMKEYS; i++) {
+		if (hdr->keyblock[i].active != LUKS_KEY_ENABLED)
+			continue;
+
+		r = LUKS_keyslot_set(hdr, i, 0, ctx);
+		if (r)
+			return r;
+
+		/* secure deletion of key material */
+		startOffset = hdr->keyblock[i].keyMaterialOffset;
+		endOffset = startOffset + AF_split_sectors(hdr->keyBytes, hdr->keyblock[i].stripes);
+
+		r = crypt_wipe_device(ctx, device, CRYPT_WIPE_SPECIAL, startOffset * SECTOR_SIZE,
+				      (endOffset - startOffset) * SECTOR_SIZE,
+				      (endOffset - startOffset) * SECTOR_SIZE, NULL, NULL);
+		if (r) {
+			if (r == -EACCES) {
+				log_err(ctx, _("Cannot write to device %s, permission denied."),
+					device_path(device));
+				r = -EINVAL;
+			} else
+				log_err(ctx, _("Cannot wipe device %s."),
+					device_path(device));
+			return r;
+		}
+
+		/* Wipe keyslot info */
+		memset(&hdr->keyblock[i].passwordSalt, 0, LUKS_SALTSIZE);
+		hdr->keyblock[i].passwordIterations = 0;
+	}
+
+	return LUKS_write_phdr(hdr, ctx);
+}
+
 crypt_keyslot_info LUKS_keyslot_info(struct luks_phdr *hdr, int keyslot)
 {
 	int i;
@@ -164,11 +164,25 @@ int LUKS_open_key_with_hdr(
 	struct volume_key **vk,
 	struct crypt_device *ctx);
 
+int LUKS_test_passphrases(
+	int keyIndex,
+	const char *const *passwords,
+	const size_t *passwordLens,
+	size_t count,
+	unsigned threads,
+	struct luks_phdr *hdr,
+	size_t *found,
+	struct crypt_device *ctx);
+
 int LUKS_del_key(
 	unsigned int keyIndex,
 	struct luks_phdr *hdr,
 	struct crypt_device *ctx);
 
+int LUKS_del_key_all(
+	struct luks_phdr *hdr,
+	struct crypt_device *ctx);
+
 int LUKS_wipe_header_areas(struct luks_phdr *hdr,
 	struct crypt_device *ctx);
 
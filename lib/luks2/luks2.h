@@ -122,6 +122,16 @@ struct luks2_hdr {
 	char		uuid[LUKS2_UUID_L];
 	void		*jobj;
 	void		*jobj_rollback;
+
+	/* JSON area stored in both on-disk copies at json_area_seqid */
+	char		*json_area;
+	uint64_t	json_area_seqid;
+
+	/* keyslot areas read ahead while keyslots are being opened */
+	struct luks2_area_prefetch *area_prefetch;
+
+	/* reencryption digest serialization buffer and verified data tags */
+	struct luks2_reencrypt_digest *reencrypt_digest;
 };
 
 struct luks2_keyslot_params {
@@ -162,6 +172,8 @@ struct luks2_keyslot_params {
 #define LUKS2_HDR2_OFFSETS { 0x04000, 0x008000, 0x010000, 0x020000, \
                              0x40000, 0x080000, 0x100000, 0x200000, LUKS2_HDR_OFFSET_MAX }
 
+int LUKS2_disk_hdr_read_json_unlocked(struct crypt_device *cd, struct device *device,
+				      struct luks2_hdr *hdr);
 int LUKS2_hdr_version_unlocked(struct crypt_device *cd,
 	const char *backup_file);
 
@@ -183,6 +195,7 @@ int LUKS2_hdr_labels(struct crypt_device *cd,
 	int commit);
 
 void LUKS2_hdr_free(struct crypt_device *cd, struct luks2_hdr *hdr);
+void LUKS2_hdr_cache_flush(void);
 
 int LUKS2_hdr_backup(struct crypt_device *cd,
 		     struct luks2_hdr *hdr,
@@ -227,6 +240,16 @@ int LUKS2_keyslot_wipe(struct crypt_device *cd,
 	int keyslot,
 	int wipe_area_only);
 
+int LUKS2_keyslot_wipe_all(struct crypt_device *cd,
+	struct luks2_hdr *hdr);
+
+int LUKS2_keyslot_convert(struct crypt_device *cd,
+	struct luks2_hdr *hdr,
+	const int *keyslots,
+	const char *const *passwords,
+	const size_t *password_lens,
+	int count);
+
 crypt_keyslot_priority LUKS2_keyslot_priority_get(struct luks2_hdr *hdr, int keyslot);
 
 int LUKS2_keyslot_priority_set(struct crypt_device *cd,
@@ -235,6 +258,12 @@ int LUKS2_keyslot_priority_set(struct crypt_device *cd,
 	crypt_keyslot_priority priority,
 	int commit);
 
+int LUKS2_keyslot_hint_set(struct crypt_device *cd,
+	struct luks2_hdr *hdr,
+	int keyslot,
+	const char *hint,
+	int commit);
+
 int LUKS2_keyslot_swap(struct crypt_device *cd,
 	struct luks2_hdr *hdr,
 	int keyslot,
@@ -314,6 +343,8 @@ int LUKS2_token_unlock_passphrase(struct crypt_device *cd,
 
 void crypt_token_unload_external_all(struct crypt_device *cd);
 
+void LUKS2_token_open_wait(struct crypt_device *cd);
+
 /*
  * Generic LUKS2 digest
  */
@@ -400,6 +431,8 @@ int LUKS2_get_data_size(struct luks2_hdr *hdr, uint64_t *size, bool *dynamic);
 uint32_t LUKS2_get_sector_size(struct luks2_hdr *hdr);
 const char *LUKS2_get_cipher(struct luks2_hdr *hdr, int segment);
 const char *LUKS2_get_integrity(struct luks2_hdr *hdr, int segment);
+int LUKS2_segment_set_iv_and_size(struct luks2_hdr *hdr, int segment,
+	uint64_t iv_offset, uint64_t size);
 int LUKS2_keyslot_params_default(struct crypt_device *cd, struct luks2_hdr *hdr,
 	 struct luks2_keyslot_params *params);
 int LUKS2_get_volume_key_size(struct luks2_hdr *hdr, int segment);
@@ -413,6 +446,7 @@ int LUKS2_keyslot_area(struct luks2_hdr *hdr,
 	uint64_t *offset,
 	uint64_t *length);
 int LUKS2_keyslot_pbkdf(struct luks2_hdr *hdr, int keyslot, struct crypt_pbkdf_type *pbkdf);
+const char *LUKS2_keyslot_salt(struct luks2_hdr *hdr, int keyslot);
 
 /*
  * Permanent activation flags stored in header
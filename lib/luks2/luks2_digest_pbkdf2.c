@@ -30,19 +30,27 @@ static int PBKDF2_digest_verify(struct crypt_device *cd,
 	const char *volume_key,
 	size_t volume_key_len)
 {
-	char checkHashBuf[64];
+	char checkHashBuf[64], tag[VERIFIED_KEY_TAG_SIZE];
 	json_object *jobj_digest, *jobj1;
 	const char *hashSpec;
 	char *mkDigest = NULL, *mkDigestSalt = NULL;
 	unsigned int mkDigestIterations;
 	size_t len;
-	int r = -EINVAL;
+	int r = -EINVAL, r_tag;
 
 	/* This can be done only for internally linked digests */
 	jobj_digest = LUKS2_get_digest_jobj(crypt_get_hdr(cd, CRYPT_LUKS2), digest);
 	if (!jobj_digest)
 		return -EINVAL;
 
+	/* Whole digest object is tagged, any change of it means a new verification */
+	r_tag = crypt_verified_key_lookup(cd, json_object_to_json_string_ext(jobj_digest,
+					  JSON_C_TO_STRING_PLAIN), volume_key, volume_key_len, tag);
+	if (r_tag == 1) {
+		log_dbg(cd, "Volume key already verified by digest %d.", digest);
+		return 0;
+	}
+
 	if (!json_object_object_get_ex(jobj_digest, "hash", &jobj1))
 		return -EINVAL;
 	hashSpec = json_object_get_string(jobj1);
@@ -81,9 +89,13 @@ static int PBKDF2_digest_verify(struct crypt_device *cd,
 		if (crypt_backend_memeq(checkHashBuf, mkDigest, len) == 0)
 			r = 0;
 	}
+
+	if (!r && !r_tag)
+		crypt_verified_key_store(cd, tag);
 out:
 	free(mkDigest);
 	free(mkDigestSalt);
+	crypt_safe_memzero(tag, sizeof(tag));
 	return r;
 }
 
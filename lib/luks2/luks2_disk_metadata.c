@@ -19,6 +19,9 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <pthread.h>
+#include <sys/stat.h>
+
 #include "luks2_internal.h"
 
 /*
@@ -232,31 +235,99 @@ static int hdr_disk_sanity_check_pre(struct crypt_device *cd,
 	return 0;
 }
 
+/*
+ * Header area read ahead in one I/O, so both header copies (and probing
+ * for the secondary one) are parsed from memory instead of issuing several
+ * small reads, each a full round trip on high-latency (network) storage.
+ */
+#define LUKS2_HDR_PREFETCH_LEN	0x10000 /* 64 KiB */
+
+struct hdr_prefetch {
+	char *buf;
+	size_t len;
+};
+
+/*
+ * Extend prefetched area to @len bytes from the device start (clamped
+ * to device size), reading only the missing part. Failure is not fatal,
+ * headers outside of the prefetched area are read directly.
+ */
+static void _hdr_prefetch(struct crypt_device *cd, struct device *device,
+			  struct hdr_prefetch *pf, uint64_t len, bool locked)
+{
+	uint64_t dev_size;
+	size_t alignment = device_alignment(device);
+	void *buf;
+	int devfd;
+
+	if (device_size(device, &dev_size) < 0)
+		return;
+	if (len > dev_size)
+		len = dev_size;
+	if (len <= pf->len)
+		return;
+
+	if (posix_memalign(&buf, alignment, len))
+		return;
+	if (pf->len)
+		memcpy(buf, pf->buf, pf->len);
+
+	devfd = locked ? device_open_locked(cd, device, O_RDONLY) : device_open(cd, device, O_RDONLY);
+	if (devfd < 0 ||
+	    pread_blockwise(devfd, device_block_size(cd, device), alignment,
+				 (char *)buf + pf->len, len - pf->len, pf->len) != (ssize_t)(len - pf->len)) {
+		log_dbg(cd, "Cannot prefetch LUKS2 header area (%" PRIu64 " bytes).", len);
+		free(buf);
+		return;
+	}
+
+	log_dbg(cd, "Prefetched %" PRIu64 " bytes of LUKS2 header area.", len);
+	free(pf->buf);
+	pf->buf = buf;
+	pf->len = len;
+}
+
+static void hdr_prefetch(struct crypt_device *cd, struct device *device,
+			 struct hdr_prefetch *pf, uint64_t len)
+{
+	_hdr_prefetch(cd, device, pf, len, true);
+}
+
+static bool hdr_prefetched(const struct hdr_prefetch *pf, uint64_t offset, uint64_t len)
+{
+	return pf && offset <= pf->len && len <= pf->len - offset;
+}
+
 /*
  * Read LUKS2 header from disk at specific offset.
  */
 static int hdr_read_disk(struct crypt_device *cd,
 			 struct device *device, struct luks2_hdr_disk *hdr_disk,
-			 char **json_area, uint64_t offset, int secondary)
+			 char **json_area, uint64_t offset, int secondary,
+			 const struct hdr_prefetch *pf)
 {
 	size_t hdr_json_size = 0;
-	int devfd, r;
+	int devfd = -1, r;
 
 	log_dbg(cd, "Trying to read %s LUKS2 header at offset 0x%" PRIx64 ".",
 		secondary ? "secondary" : "primary", offset);
 
-	devfd = device_open_locked(cd, device, O_RDONLY);
-	if (devfd < 0)
-		return devfd == -1 ? -EIO : devfd;
-
 	/*
 	 * Read binary header and run sanity check before reading
 	 * JSON area and validating checksum.
 	 */
-	if (read_lseek_blockwise(devfd, device_block_size(cd, device),
-				 device_alignment(device), hdr_disk,
-				 LUKS2_HDR_BIN_LEN, offset) != LUKS2_HDR_BIN_LEN) {
-		return -EIO;
+	if (hdr_prefetched(pf, offset, LUKS2_HDR_BIN_LEN))
+		memcpy(hdr_disk, pf->buf + offset, LUKS2_HDR_BIN_LEN);
+	else {
+		devfd = device_open_locked(cd, device, O_RDONLY);
+		if (devfd < 0)
+			return devfd == -1 ? -EIO : devfd;
+
+		if (pread_blockwise(devfd, device_block_size(cd, device),
+					 device_alignment(device), hdr_disk,
+					 LUKS2_HDR_BIN_LEN, offset) != LUKS2_HDR_BIN_LEN) {
+			return -EIO;
+		}
 	}
 
 	/*
@@ -273,12 +344,19 @@ static int hdr_read_disk(struct crypt_device *cd,
 	if (!*json_area)
 		return -ENOMEM;
 
-	if (read_lseek_blockwise(devfd, device_block_size(cd, device),
-				 device_alignment(device), *json_area, hdr_json_size,
-				 offset + LUKS2_HDR_BIN_LEN) != (ssize_t)hdr_json_size) {
-		free(*json_area);
-		*json_area = NULL;
-		return -EIO;
+	if (hdr_prefetched(pf, offset + LUKS2_HDR_BIN_LEN, hdr_json_size))
+		memcpy(*json_area, pf->buf + offset + LUKS2_HDR_BIN_LEN, hdr_json_size);
+	else {
+		if (devfd < 0)
+			devfd = device_open_locked(cd, device, O_RDONLY);
+		if (devfd < 0 ||
+		    pread_blockwise(devfd, device_block_size(cd, device),
+					 device_alignment(device), *json_area, hdr_json_size,
+					 offset + LUKS2_HDR_BIN_LEN) != (ssize_t)hdr_json_size) {
+			free(*json_area);
+			*json_area = NULL;
+			return devfd < -1 ? devfd : -EIO;
+		}
 	}
 
 	/*
@@ -297,19 +375,74 @@ static int hdr_read_disk(struct crypt_device *cd,
 }
 
 /*
- * Write LUKS2 header to disk at specific offset.
+ * Large JSON areas (up to 4 MiB) dominate header write time, checksums
+ * of both copies are then calculated at once in two threads.
+ */
+#define LUKS2_HDR_CSUM_PARALLEL_MIN	0x40000 /* 256 KiB */
+
+struct hdr_csum_job {
+	struct luks2_hdr_disk hdr_disk;
+	const char *json_area;
+	size_t json_len;
+	int r;
+};
+
+static void *hdr_csum_thread(void *arg)
+{
+	struct hdr_csum_job *job = arg;
+
+	job->r = hdr_checksum_calculate(job->hdr_disk.checksum_alg, &job->hdr_disk,
+					job->json_area, job->json_len);
+	return NULL;
+}
+
+static int hdr_checksums_calculate(struct luks2_hdr *hdr, const char *json_area,
+				   uint8_t csum[2][LUKS2_CHECKSUM_L])
+{
+	struct hdr_csum_job jobs[2];
+	pthread_t thread;
+	bool threaded;
+	int i;
+
+	for (i = 0; i < 2; i++) {
+		hdr_to_disk(hdr, &jobs[i].hdr_disk, i, i ? hdr->hdr_size : 0);
+		jobs[i].json_area = json_area;
+		jobs[i].json_len = hdr->hdr_size - LUKS2_HDR_BIN_LEN;
+	}
+
+	threaded = !pthread_create(&thread, NULL, hdr_csum_thread, &jobs[1]);
+	hdr_csum_thread(&jobs[0]);
+	if (threaded)
+		pthread_join(thread, NULL);
+	else
+		hdr_csum_thread(&jobs[1]);
+
+	for (i = 0; i < 2; i++) {
+		if (jobs[i].r < 0)
+			return jobs[i].r;
+		memcpy(csum[i], jobs[i].hdr_disk.csum, LUKS2_CHECKSUM_L);
+	}
+
+	return 0;
+}
+
+/*
+ * Write LUKS2 header to disk at specific offset. Checksum is calculated
+ * here unless already provided in @csum.
  */
 static int hdr_write_disk(struct crypt_device *cd,
 			  struct device *device, struct luks2_hdr *hdr,
-			  const char *json_area, int secondary)
+			  const char *json_area, int secondary,
+			  size_t json_dirty_offset, size_t json_dirty_len,
+			  const uint8_t *csum)
 {
 	struct luks2_hdr_disk hdr_disk;
 	uint64_t offset = secondary ? hdr->hdr_size : 0;
 	size_t hdr_json_len;
 	int devfd, r;
 
-	log_dbg(cd, "Trying to write LUKS2 header (%zu bytes) at offset %" PRIu64 ".",
-		hdr->hdr_size, offset);
+	log_dbg(cd, "Trying to write LUKS2 header (%zu bytes, %zu of JSON area) at offset %" PRIu64 ".",
+		hdr->hdr_size, json_dirty_len, offset);
 
 	devfd = device_open_locked(cd, device, O_RDWR);
 	if (devfd < 0)
@@ -322,33 +455,39 @@ static int hdr_write_disk(struct crypt_device *cd,
 	/*
 	 * Write header without checksum but with proper seqid.
 	 */
-	if (write_lseek_blockwise(devfd, device_block_size(cd, device),
+	if (pwrite_blockwise(devfd, device_block_size(cd, device),
 				  device_alignment(device), (char *)&hdr_disk,
 				  LUKS2_HDR_BIN_LEN, offset) < (ssize_t)LUKS2_HDR_BIN_LEN) {
 		return -EIO;
 	}
 
 	/*
-	 * Write json area.
+	 * Write json area (only the part that differs from what is on disk).
 	 */
-	if (write_lseek_blockwise(devfd, device_block_size(cd, device),
+	if (json_dirty_len &&
+	    pwrite_blockwise(devfd, device_block_size(cd, device),
 				  device_alignment(device),
-				  CONST_CAST(char*)json_area, hdr_json_len,
-				  LUKS2_HDR_BIN_LEN + offset) < (ssize_t)hdr_json_len) {
+				  CONST_CAST(char*)json_area + json_dirty_offset, json_dirty_len,
+				  LUKS2_HDR_BIN_LEN + offset + json_dirty_offset) < (ssize_t)json_dirty_len) {
 		return -EIO;
 	}
 
 	/*
 	 * Calculate checksum and write header with checksum.
 	 */
-	r = hdr_checksum_calculate(hdr_disk.checksum_alg, &hdr_disk,
-				   json_area, hdr_json_len);
-	if (r < 0) {
-		return r;
+	if (csum) {
+		memcpy(hdr_disk.csum, csum, LUKS2_CHECKSUM_L);
+		r = 0;
+	} else {
+		r = hdr_checksum_calculate(hdr_disk.checksum_alg, &hdr_disk,
+					   json_area, hdr_json_len);
+		if (r < 0) {
+			return r;
+		}
 	}
 	log_dbg_checksum(cd, hdr_disk.csum, hdr_disk.checksum_alg, "in-memory");
 
-	if (write_lseek_blockwise(devfd, device_block_size(cd, device),
+	if (pwrite_blockwise(devfd, device_block_size(cd, device),
 				  device_alignment(device), (char *)&hdr_disk,
 				  LUKS2_HDR_BIN_LEN, offset) < (ssize_t)LUKS2_HDR_BIN_LEN)
 		r = -EIO;
@@ -370,7 +509,7 @@ static int LUKS2_check_sequence_id(struct crypt_device *cd, struct luks2_hdr *hd
 		return devfd == -1 ? -EINVAL : devfd;
 
 	/* we need only first 512 bytes, see luks2_hdr_disk structure */
-	if ((read_lseek_blockwise(devfd, device_block_size(cd, device),
+	if ((pread_blockwise(devfd, device_block_size(cd, device),
 	     device_alignment(device), &dhdr, 512, 0) != 512))
 		return -EIO;
 
@@ -409,11 +548,78 @@ int LUKS2_device_write_lock(struct crypt_device *cd, struct luks2_hdr *hdr, stru
  * Convert in-memory LUKS2 header and write it to disk.
  * This will increase sequence id, write both header copies and calculate checksum.
  */
-int LUKS2_disk_hdr_write(struct crypt_device *cd, struct luks2_hdr *hdr, struct device *device, bool seqid_check)
+void LUKS2_disk_hdr_json_area_drop(struct luks2_hdr *hdr)
+{
+	free(hdr->json_area);
+	hdr->json_area = NULL;
+	hdr->json_area_seqid = 0;
+}
+
+/* Header copy on disk is still the one remembered JSON area belongs to. */
+static bool hdr_json_area_on_disk(struct crypt_device *cd, struct device *device,
+				  struct luks2_hdr *hdr, int secondary)
+{
+	struct luks2_hdr_disk dhdr;
+	uint64_t offset = secondary ? hdr->hdr_size : 0;
+	int devfd;
+
+	if (!hdr->json_area || hdr->json_area_seqid != hdr->seqid)
+		return false;
+
+	devfd = device_open_locked(cd, device, O_RDONLY);
+	if (devfd < 0)
+		return false;
+
+	/* we need only first 512 bytes, see luks2_hdr_disk structure */
+	if (pread_blockwise(devfd, device_block_size(cd, device),
+	    device_alignment(device), &dhdr, 512, offset) != 512)
+		return false;
+
+	return be16_to_cpu(dhdr.version) == 2 &&
+	       !memcmp(dhdr.magic, secondary ? LUKS2_MAGIC_2ND : LUKS2_MAGIC_1ST, LUKS2_MAGIC_L) &&
+	       !strncmp(dhdr.uuid, hdr->uuid, LUKS2_UUID_L) &&
+	       be64_to_cpu(dhdr.seqid) == hdr->seqid &&
+	       be64_to_cpu(dhdr.hdr_size) == hdr->hdr_size &&
+	       be64_to_cpu(dhdr.hdr_offset) == offset;
+}
+
+/*
+ * Range of the JSON area differing from the copy known to be on disk
+ * in the header copy, aligned to device block size. Whole area if unknown.
+ */
+static void hdr_json_dirty_range(struct crypt_device *cd, struct device *device,
+				 struct luks2_hdr *hdr, const char *json_area, size_t json_area_len,
+				 int secondary, size_t *offset, size_t *len)
+{
+	size_t bsize = device_block_size(cd, device), start, end;
+
+	*offset = 0;
+	*len = json_area_len;
+
+	if (!bsize || !hdr_json_area_on_disk(cd, device, hdr, secondary))
+		return;
+
+	for (start = 0; start < json_area_len && json_area[start] == hdr->json_area[start]; start++);
+	if (start == json_area_len) {
+		*len = 0;
+		return;
+	}
+	for (end = json_area_len; end > start && json_area[end - 1] == hdr->json_area[end - 1]; end--);
+
+	start -= start % bsize;
+	end = MIN(json_area_len, end + (bsize - end % bsize) % bsize);
+
+	*offset = start;
+	*len = end - start;
+}
+
+static int disk_hdr_write(struct crypt_device *cd, struct luks2_hdr *hdr, struct device *device, bool seqid_check)
 {
 	char *json_area;
 	const char *json_text;
-	size_t json_area_len;
+	size_t json_area_len, dirty_offset[2], dirty_len[2];
+	uint8_t csum[2][LUKS2_CHECKSUM_L];
+	bool have_csum = false;
 	int r;
 
 	if (hdr->version != 2) {
@@ -459,22 +665,56 @@ int LUKS2_disk_hdr_write(struct crypt_device *cd, struct luks2_hdr *hdr, struct
 		return r;
 	}
 
+	/*
+	 * Unchanged JSON blocks are not rewritten in a header copy on disk
+	 * that is still the one last read or written by this context.
+	 * Secondary copy with different seqid (interrupted write) is always
+	 * rewritten whole.
+	 */
+	hdr_json_dirty_range(cd, device, hdr, json_area, json_area_len, 0,
+			     &dirty_offset[0], &dirty_len[0]);
+	hdr_json_dirty_range(cd, device, hdr, json_area, json_area_len, 1,
+			     &dirty_offset[1], &dirty_len[1]);
+
 	/* Increase sequence id before writing it to disk. */
 	hdr->seqid++;
 
+	if (json_area_len >= LUKS2_HDR_CSUM_PARALLEL_MIN)
+		have_csum = !hdr_checksums_calculate(hdr, json_area, csum);
+
 	/* Write primary and secondary header */
-	r = hdr_write_disk(cd, device, hdr, json_area, 0);
+	r = hdr_write_disk(cd, device, hdr, json_area, 0, dirty_offset[0], dirty_len[0],
+			   have_csum ? csum[0] : NULL);
 	if (!r)
-		r = hdr_write_disk(cd, device, hdr, json_area, 1);
+		r = hdr_write_disk(cd, device, hdr, json_area, 1, dirty_offset[1], dirty_len[1],
+				   have_csum ? csum[1] : NULL);
 
+	LUKS2_disk_hdr_json_area_drop(hdr);
 	if (r)
 		log_dbg(cd, "LUKS2 header write failed (%d).", r);
+	else {
+		hdr->json_area = json_area;
+		hdr->json_area_seqid = hdr->seqid;
+		json_area = NULL;
+	}
 
 	device_write_unlock(cd, device);
 
 	free(json_area);
 	return r;
 }
+
+int LUKS2_disk_hdr_write(struct crypt_device *cd, struct luks2_hdr *hdr, struct device *device, bool seqid_check)
+{
+	int r;
+
+	CRYPT_TRACE(header__write__start, device_path(device), hdr->seqid);
+	r = disk_hdr_write(cd, hdr, device, seqid_check);
+	CRYPT_TRACE(header__write__done, device_path(device), r, hdr->seqid);
+
+	return r;
+}
+
 static int validate_json_area(struct crypt_device *cd, const char *json_area,
 			      uint64_t json_len, uint64_t max_length)
 {
@@ -509,10 +749,13 @@ static int validate_json_area(struct crypt_device *cd, const char *json_area,
 	return 0;
 }
 
-static int validate_luks2_json_object(struct crypt_device *cd, json_object *jobj_hdr, uint64_t length)
+static int validate_luks2_json_object(struct crypt_device *cd, json_object *jobj_hdr, uint64_t length,
+				      bool *repaired)
 {
 	int r;
 
+	*repaired = false;
+
 	/* we require top level object to be of json_type_object */
 	r = !json_object_is_type(jobj_hdr, json_type_object);
 	if (r) {
@@ -525,6 +768,7 @@ static int validate_luks2_json_object(struct crypt_device *cd, json_object *jobj
 		log_dbg(cd, "Repairing JSON metadata.");
 		/* try to correct known glitches */
 		LUKS2_hdr_repair(cd, jobj_hdr);
+		*repaired = true;
 
 		/* run validation again */
 		r = LUKS2_hdr_validate(cd, jobj_hdr, length);
@@ -536,9 +780,67 @@ static int validate_luks2_json_object(struct crypt_device *cd, json_object *jobj
 	return r;
 }
 
+/*
+ * Digests of JSON metadata that passed full validation (without repair)
+ * in this process. The same metadata loaded again (tools reloading header
+ * in a loop, several contexts on one device) skips LUKS2_hdr_validate().
+ * Only kept in memory, an on-disk cache could be used to bypass validation.
+ */
+#define JSON_VALIDATED_HASH	"sha256"
+#define JSON_VALIDATED_SIZE	32
+#define JSON_VALIDATED_ENTRIES	8
+
+static pthread_mutex_t json_validated_lock = PTHREAD_MUTEX_INITIALIZER;
+static char json_validated[JSON_VALIDATED_ENTRIES][JSON_VALIDATED_SIZE];
+static unsigned json_validated_count, json_validated_next;
+
+static int json_validated_digest(const char *json_area, int json_len,
+				 uint64_t max_length, char *digest)
+{
+	struct crypt_hash *hd = NULL;
+	int r;
+
+	if (crypt_hash_init(&hd, JSON_VALIDATED_HASH))
+		return -EINVAL;
+
+	r = crypt_hash_write(hd, (const char *)&max_length, sizeof(max_length));
+	if (!r)
+		r = crypt_hash_write(hd, json_area, json_len);
+	if (!r)
+		r = crypt_hash_final(hd, digest, JSON_VALIDATED_SIZE);
+
+	crypt_hash_destroy(hd);
+	return r;
+}
+
+static bool json_validated_check(const char *digest)
+{
+	unsigned i;
+	bool found = false;
+
+	pthread_mutex_lock(&json_validated_lock);
+	for (i = 0; i < json_validated_count && !found; i++)
+		found = !memcmp(json_validated[i], digest, JSON_VALIDATED_SIZE);
+	pthread_mutex_unlock(&json_validated_lock);
+
+	return found;
+}
+
+static void json_validated_store(const char *digest)
+{
+	pthread_mutex_lock(&json_validated_lock);
+	memcpy(json_validated[json_validated_next], digest, JSON_VALIDATED_SIZE);
+	json_validated_next = (json_validated_next + 1) % JSON_VALIDATED_ENTRIES;
+	if (json_validated_count < JSON_VALIDATED_ENTRIES)
+		json_validated_count++;
+	pthread_mutex_unlock(&json_validated_lock);
+}
+
 static json_object *parse_and_validate_json(struct crypt_device *cd,
 					    const char *json_area, uint64_t max_length)
 {
+	char digest[JSON_VALIDATED_SIZE];
+	bool cached, repaired = true;
 	int json_len, r;
 	json_object *jobj = parse_json_len(cd, json_area, max_length, &json_len);
 
@@ -549,8 +851,14 @@ static json_object *parse_and_validate_json(struct crypt_device *cd,
 	assert(json_len > 0);
 
 	r = validate_json_area(cd, json_area, json_len, max_length);
-	if (!r)
-		r = validate_luks2_json_object(cd, jobj, max_length);
+	if (!r) {
+		cached = !json_validated_digest(json_area, json_len, max_length, digest);
+		if (cached && json_validated_check(digest))
+			log_dbg(cd, "LUKS2 JSON metadata already validated.");
+		else if (!(r = validate_luks2_json_object(cd, jobj, max_length, &repaired)) &&
+			 cached && !repaired)
+			json_validated_store(digest);
+	}
 
 	if (r) {
 		json_object_put(jobj);
@@ -607,21 +915,161 @@ static int detect_device_signatures(struct crypt_device *cd, const char *path)
 	return r;
 }
 
+/*
+ * Opt-in process-wide cache of parsed headers for processes loading
+ * the same devices over and over (status polling daemons). An entry is
+ * used only if the primary binary header on disk is byte-identical to
+ * the cached one; it contains seqid, salt and checksum of the whole
+ * header, so a hit costs one binary header read instead of reading,
+ * checksumming and parsing both copies.
+ */
+#define HDR_CACHE_ENTRIES	16
+
+struct hdr_cache_entry {
+	dev_t dev;
+	ino_t ino;
+	uint64_t last_use;
+	struct luks2_hdr_disk hdr_disk;
+	struct luks2_hdr hdr;
+};
+
+static pthread_mutex_t hdr_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct hdr_cache_entry hdr_cache[HDR_CACHE_ENTRIES];
+static uint64_t hdr_cache_use;
+
+static int hdr_cache_device_id(struct device *device, dev_t *dev, ino_t *ino)
+{
+	struct stat st;
+
+	if (stat(device_path(device), &st) < 0)
+		return -EINVAL;
+
+	if (S_ISBLK(st.st_mode)) {
+		*dev = st.st_rdev;
+		*ino = 0;
+	} else if (S_ISREG(st.st_mode)) {
+		*dev = st.st_dev;
+		*ino = st.st_ino;
+	} else
+		return -ENOTSUP;
+
+	return 0;
+}
+
+static struct hdr_cache_entry *hdr_cache_find(dev_t dev, ino_t ino)
+{
+	int i;
+
+	for (i = 0; i < HDR_CACHE_ENTRIES; i++)
+		if (hdr_cache[i].hdr.jobj && hdr_cache[i].dev == dev && hdr_cache[i].ino == ino)
+			return &hdr_cache[i];
+
+	return NULL;
+}
+
+/* Fill @hdr from cache if @hdr_disk (raw primary binary header) is unchanged. */
+static int hdr_cache_get(struct crypt_device *cd, struct device *device,
+			 const struct luks2_hdr_disk *hdr_disk, struct luks2_hdr *hdr)
+{
+	struct hdr_cache_entry *e;
+	json_object *jobj = NULL;
+	void *jobj_rollback;
+	struct luks2_reencrypt_digest *reencrypt_digest;
+	dev_t dev;
+	ino_t ino;
+	int r = -ENOENT;
+
+	if (hdr_cache_device_id(device, &dev, &ino))
+		return -ENOENT;
+
+	pthread_mutex_lock(&hdr_cache_lock);
+	e = hdr_cache_find(dev, ino);
+	if (e && !memcmp(&e->hdr_disk, hdr_disk, LUKS2_HDR_BIN_LEN) &&
+	    !json_object_copy(e->hdr.jobj, &jobj)) {
+		e->last_use = ++hdr_cache_use;
+		jobj_rollback = hdr->jobj_rollback;
+		reencrypt_digest = hdr->reencrypt_digest;
+		memcpy(hdr, &e->hdr, sizeof(*hdr));
+		hdr->jobj = jobj;
+		hdr->jobj_rollback = jobj_rollback;
+		hdr->reencrypt_digest = reencrypt_digest;
+		log_dbg(cd, "Using cached LUKS2 header (seqid %" PRIu64 ").", hdr->seqid);
+		r = 0;
+	}
+	pthread_mutex_unlock(&hdr_cache_lock);
+
+	return r;
+}
+
+static void hdr_cache_put(struct crypt_device *cd, struct device *device,
+			  const struct luks2_hdr_disk *hdr_disk, struct luks2_hdr *hdr)
+{
+	struct hdr_cache_entry *e;
+	json_object *jobj = NULL;
+	dev_t dev;
+	ino_t ino;
+	int i;
+
+	if (hdr_cache_device_id(device, &dev, &ino) || json_object_copy(hdr->jobj, &jobj))
+		return;
+
+	pthread_mutex_lock(&hdr_cache_lock);
+	/* entry of the same device, otherwise free or least recently used one */
+	e = hdr_cache_find(dev, ino);
+	for (i = 0; !e && i < HDR_CACHE_ENTRIES; i++)
+		if (!hdr_cache[i].hdr.jobj)
+			e = &hdr_cache[i];
+	for (i = 0; !e && i < HDR_CACHE_ENTRIES; i++)
+		if (!e || hdr_cache[i].last_use < e->last_use)
+			e = &hdr_cache[i];
+
+	json_object_put(e->hdr.jobj);
+	memcpy(&e->hdr, hdr, sizeof(*hdr));
+	e->hdr.jobj = jobj;
+	e->hdr.jobj_rollback = NULL;
+	e->hdr.json_area = NULL;
+	e->hdr.reencrypt_digest = NULL;
+	memcpy(&e->hdr_disk, hdr_disk, LUKS2_HDR_BIN_LEN);
+	e->dev = dev;
+	e->ino = ino;
+	e->last_use = ++hdr_cache_use;
+	pthread_mutex_unlock(&hdr_cache_lock);
+
+	log_dbg(cd, "Cached LUKS2 header (seqid %" PRIu64 ").", hdr->seqid);
+}
+
+/* Release and wipe all cached headers. */
+void LUKS2_hdr_cache_flush(void)
+{
+	int i;
+
+	pthread_mutex_lock(&hdr_cache_lock);
+	for (i = 0; i < HDR_CACHE_ENTRIES; i++) {
+		json_object_put(hdr_cache[i].hdr.jobj);
+		crypt_safe_memzero(&hdr_cache[i], sizeof(hdr_cache[i]));
+	}
+	hdr_cache_use = 0;
+	pthread_mutex_unlock(&hdr_cache_lock);
+}
+
 /*
  * Read and convert on-disk LUKS2 header to in-memory representation..
  * Try to do recovery if on-disk state is not consistent.
  */
-int LUKS2_disk_hdr_read(struct crypt_device *cd, struct luks2_hdr *hdr,
-			struct device *device, int do_recovery, int do_blkprobe)
+static int disk_hdr_read(struct crypt_device *cd, struct luks2_hdr *hdr,
+			 struct device *device, int do_recovery, int do_blkprobe)
 {
 	enum { HDR_OK, HDR_OBSOLETE, HDR_FAIL, HDR_FAIL_IO } state_hdr1, state_hdr2;
 	struct luks2_hdr_disk hdr_disk1, hdr_disk2;
+	struct hdr_prefetch pf = {};
 	char *json_area1 = NULL, *json_area2 = NULL;
 	json_object *jobj_hdr1 = NULL, *jobj_hdr2 = NULL;
 	unsigned int i;
 	int r;
 	uint64_t hdr_size;
 	uint64_t hdr2_offsets[] = LUKS2_HDR2_OFFSETS;
+	bool use_cache = do_blkprobe && crypt_get_header_cache(cd);
+	uint64_t t_recovery = 0;
 
 	/* Skip auto-recovery if locks are disabled and we're not doing LUKS2 explicit repair */
 	if (do_recovery && do_blkprobe && !crypt_metadata_locking_enabled()) {
@@ -629,11 +1077,35 @@ int LUKS2_disk_hdr_read(struct crypt_device *cd, struct luks2_hdr *hdr,
 		log_dbg(cd, "Disabling header auto-recovery due to locking being disabled.");
 	}
 
+	/*
+	 * Unchanged primary binary header means the cached header is current.
+	 */
+	if (use_cache) {
+		hdr_prefetch(cd, device, &pf, LUKS2_HDR_BIN_LEN);
+		if (pf.len >= LUKS2_HDR_BIN_LEN) {
+			LUKS2_disk_hdr_json_area_drop(hdr);
+			if (!hdr_cache_get(cd, device, (struct luks2_hdr_disk *)pf.buf, hdr)) {
+				free(pf.buf);
+				r = device_check_size(cd, device, LUKS2_hdr_and_areas_size(hdr), 0);
+				if (r) {
+					json_object_put(hdr->jobj);
+					hdr->jobj = NULL;
+				}
+				return r;
+			}
+		}
+	}
+
+	/*
+	 * Both copies of header with default size fit into the first read.
+	 */
+	hdr_prefetch(cd, device, &pf, LUKS2_HDR_PREFETCH_LEN);
+
 	/*
 	 * Read primary LUKS2 header (offset 0).
 	 */
 	state_hdr1 = HDR_FAIL;
-	r = hdr_read_disk(cd, device, &hdr_disk1, &json_area1, 0, 0);
+	r = hdr_read_disk(cd, device, &hdr_disk1, &json_area1, 0, 0, &pf);
 	if (r == 0) {
 		jobj_hdr1 = parse_and_validate_json(cd, json_area1, be64_to_cpu(hdr_disk1.hdr_size) - LUKS2_HDR_BIN_LEN);
 		state_hdr1 = jobj_hdr1 ? HDR_OK : HDR_OBSOLETE;
@@ -645,7 +1117,8 @@ int LUKS2_disk_hdr_read(struct crypt_device *cd, struct luks2_hdr *hdr,
 	 */
 	state_hdr2 = HDR_FAIL;
 	if (state_hdr1 != HDR_FAIL && state_hdr1 != HDR_FAIL_IO) {
-		r = hdr_read_disk(cd, device, &hdr_disk2, &json_area2, be64_to_cpu(hdr_disk1.hdr_size), 1);
+		hdr_prefetch(cd, device, &pf, 2 * be64_to_cpu(hdr_disk1.hdr_size));
+		r = hdr_read_disk(cd, device, &hdr_disk2, &json_area2, be64_to_cpu(hdr_disk1.hdr_size), 1, &pf);
 		if (r == 0) {
 			jobj_hdr2 = parse_and_validate_json(cd, json_area2, be64_to_cpu(hdr_disk2.hdr_size) - LUKS2_HDR_BIN_LEN);
 			state_hdr2 = jobj_hdr2 ? HDR_OK : HDR_OBSOLETE;
@@ -653,10 +1126,14 @@ int LUKS2_disk_hdr_read(struct crypt_device *cd, struct luks2_hdr *hdr,
 			state_hdr2 = HDR_FAIL_IO;
 	} else {
 		/*
-		 * No header size, check all known offsets.
+		 * No header size, check all known offsets. Binary headers of all
+		 * of them are read at once if not found in the first read.
 		 */
-		for (r = -EINVAL,i = 0; r < 0 && i < ARRAY_SIZE(hdr2_offsets); i++)
-			r = hdr_read_disk(cd, device, &hdr_disk2, &json_area2, hdr2_offsets[i], 1);
+		for (r = -EINVAL,i = 0; r < 0 && i < ARRAY_SIZE(hdr2_offsets); i++) {
+			if (!hdr_prefetched(&pf, hdr2_offsets[i], LUKS2_HDR_BIN_LEN))
+				hdr_prefetch(cd, device, &pf, LUKS2_HDR_OFFSET_MAX + LUKS2_HDR_BIN_LEN);
+			r = hdr_read_disk(cd, device, &hdr_disk2, &json_area2, hdr2_offsets[i], 1, &pf);
+		}
 
 		if (r == 0) {
 			jobj_hdr2 = parse_and_validate_json(cd, json_area2, be64_to_cpu(hdr_disk2.hdr_size) - LUKS2_HDR_BIN_LEN);
@@ -692,6 +1169,9 @@ int LUKS2_disk_hdr_read(struct crypt_device *cd, struct luks2_hdr *hdr,
 	/*
 	 * Try to rewrite (recover) bad header. Always regenerate salt for bad header.
 	 */
+	if (state_hdr1 != state_hdr2)
+		t_recovery = crypt_time_us();
+
 	if (state_hdr1 == HDR_OK && state_hdr2 != HDR_OK) {
 		log_dbg(cd, "Secondary LUKS2 header requires recovery.");
 
@@ -708,7 +1188,8 @@ int LUKS2_disk_hdr_read(struct crypt_device *cd, struct luks2_hdr *hdr,
 				log_dbg(cd, "Cannot generate header salt.");
 			else {
 				hdr_from_disk(&hdr_disk1, &hdr_disk2, hdr, 0);
-				r = hdr_write_disk(cd, device, hdr, json_area1, 1);
+				r = hdr_write_disk(cd, device, hdr, json_area1, 1,
+						   0, hdr->hdr_size - LUKS2_HDR_BIN_LEN, NULL);
 			}
 			if (r)
 				log_dbg(cd, "Secondary LUKS2 header recovery failed.");
@@ -729,13 +1210,36 @@ int LUKS2_disk_hdr_read(struct crypt_device *cd, struct luks2_hdr *hdr,
 				log_dbg(cd, "Cannot generate header salt.");
 			else {
 				hdr_from_disk(&hdr_disk2, &hdr_disk1, hdr, 1);
-				r = hdr_write_disk(cd, device, hdr, json_area2, 0);
+				r = hdr_write_disk(cd, device, hdr, json_area2, 0,
+						   0, hdr->hdr_size - LUKS2_HDR_BIN_LEN, NULL);
 			}
 			if (r)
 				log_dbg(cd, "Primary LUKS2 header recovery failed.");
 		}
 	}
 
+	if (t_recovery)
+		crypt_timing_add(cd, CRYPT_TIMING_RECOVERY, t_recovery);
+
+	/* Cache only headers that needed no recovery */
+	if (use_cache && state_hdr1 == HDR_OK && state_hdr2 == HDR_OK && pf.len >= LUKS2_HDR_BIN_LEN) {
+		hdr_from_disk(&hdr_disk1, &hdr_disk2, hdr, 0);
+		hdr->jobj = jobj_hdr1;
+		hdr_cache_put(cd, device, (struct luks2_hdr_disk *)pf.buf, hdr);
+		hdr->jobj = NULL;
+	}
+
+	/* Both copies identical on disk, next write can skip unchanged JSON blocks */
+	LUKS2_disk_hdr_json_area_drop(hdr);
+	if (state_hdr1 == HDR_OK && state_hdr2 == HDR_OK &&
+	    !memcmp(json_area1, json_area2, be64_to_cpu(hdr_disk1.hdr_size) - LUKS2_HDR_BIN_LEN)) {
+		hdr->json_area = json_area1;
+		hdr->json_area_seqid = be64_to_cpu(hdr_disk1.seqid);
+		json_area1 = NULL;
+	}
+
+	free(pf.buf);
+	pf.buf = NULL;
 	free(json_area1);
 	json_area1 = NULL;
 	free(json_area2);
@@ -766,11 +1270,179 @@ int LUKS2_disk_hdr_read(struct crypt_device *cd, struct luks2_hdr *hdr,
 err:
 	log_dbg(cd, "LUKS2 header read failed (%d).", r);
 
+	free(pf.buf);
 	free(json_area1);
 	free(json_area2);
 	json_object_put(jobj_hdr1);
 	json_object_put(jobj_hdr2);
 	hdr->jobj = NULL;
+	LUKS2_disk_hdr_json_area_drop(hdr);
+	return r;
+}
+
+int LUKS2_disk_hdr_read(struct crypt_device *cd, struct luks2_hdr *hdr,
+			struct device *device, int do_recovery, int do_blkprobe)
+{
+	int r;
+
+	CRYPT_TRACE(header__read__start, device_path(device));
+	r = disk_hdr_read(cd, hdr, device, do_recovery, do_blkprobe);
+	CRYPT_TRACE(header__read__done, device_path(device), r, hdr->seqid);
+
+	return r;
+}
+
+/*
+ * Header copy fully inside unlocked prefetch, extending it to the size
+ * the binary header claims. Never reads the device through locked open.
+ */
+static int hdr_read_unlocked(struct crypt_device *cd, struct device *device,
+			     struct hdr_prefetch *pf, struct luks2_hdr_disk *hdr_disk,
+			     char **json_area, uint64_t offset, int secondary)
+{
+	uint64_t hdr_size;
+
+	_hdr_prefetch(cd, device, pf, offset + LUKS2_HDR_BIN_LEN, false);
+	if (!hdr_prefetched(pf, offset, LUKS2_HDR_BIN_LEN))
+		return -EIO;
+
+	hdr_size = be64_to_cpu(((struct luks2_hdr_disk *)(pf->buf + offset))->hdr_size);
+	if (hdr_size < LUKS2_HDR_16K_LEN || hdr_size > LUKS2_HDR_OFFSET_MAX)
+		return -EINVAL;
+
+	_hdr_prefetch(cd, device, pf, offset + hdr_size, false);
+	if (!hdr_prefetched(pf, offset, hdr_size))
+		return -EIO;
+
+	return hdr_read_disk(cd, device, hdr_disk, json_area, offset, secondary, pf);
+}
+
+/*
+ * Read-only inspection of JSON metadata for inventory tools: no locking,
+ * recovery or metadata validation, header area read at once. Checksums are
+ * verified and the correct copy with the higher seqid is parsed.
+ */
+int LUKS2_disk_hdr_read_json_unlocked(struct crypt_device *cd, struct device *device,
+				      struct luks2_hdr *hdr)
+{
+	struct luks2_hdr_disk hdr_disk1, hdr_disk2;
+	struct hdr_prefetch pf = {};
+	char *json_area1 = NULL, *json_area2 = NULL, *json_area;
+	uint64_t hdr2_offsets[] = LUKS2_HDR2_OFFSETS;
+	struct luks2_hdr_disk *hdr_disk;
+	unsigned int i;
+	int r1, r2 = -EINVAL, json_len;
+
+	_hdr_prefetch(cd, device, &pf, LUKS2_HDR_PREFETCH_LEN, false);
+
+	r1 = hdr_read_unlocked(cd, device, &pf, &hdr_disk1, &json_area1, 0, 0);
+	if (!r1)
+		r2 = hdr_read_unlocked(cd, device, &pf, &hdr_disk2, &json_area2,
+				       be64_to_cpu(hdr_disk1.hdr_size), 1);
+	else
+		for (i = 0; r2 < 0 && i < ARRAY_SIZE(hdr2_offsets); i++)
+			r2 = hdr_read_unlocked(cd, device, &pf, &hdr_disk2, &json_area2, hdr2_offsets[i], 1);
+
+	free(pf.buf);
+
+	if (!r1 && (r2 || be64_to_cpu(hdr_disk1.seqid) >= be64_to_cpu(hdr_disk2.seqid))) {
+		hdr_disk = &hdr_disk1;
+		json_area = json_area1;
+		hdr_from_disk(&hdr_disk1, &hdr_disk2, hdr, 0);
+	} else if (!r2) {
+		hdr_disk = &hdr_disk2;
+		json_area = json_area2;
+		hdr_from_disk(&hdr_disk2, &hdr_disk1, hdr, 1);
+	} else {
+		free(json_area1);
+		free(json_area2);
+		return r1 == -EIO && r2 == -EIO ? -EIO : -EINVAL;
+	}
+
+	hdr->jobj = parse_json_len(cd, json_area, be64_to_cpu(hdr_disk->hdr_size) - LUKS2_HDR_BIN_LEN, &json_len);
+
+	free(json_area1);
+	free(json_area2);
+	return hdr->jobj ? 0 : -EINVAL;
+}
+
+/*
+ * Optimistic header read without metadata lock. Writers update both
+ * copies (primary first) with the same new seqid under write lock, so
+ * both copies with valid checksums and equal seqid mean no write was in
+ * progress. Any other state (including a header needing recovery) fails
+ * with -EAGAIN and caller must read the header again under read lock.
+ */
+int LUKS2_disk_hdr_read_optimistic(struct crypt_device *cd, struct luks2_hdr *hdr,
+				   struct device *device)
+{
+	struct luks2_hdr_disk hdr_disk1, hdr_disk2;
+	struct hdr_prefetch pf = {};
+	char *json_area1 = NULL, *json_area2 = NULL;
+	json_object *jobj = NULL;
+	uint64_t json_len;
+	int r;
+
+	if (crypt_get_header_cache(cd)) {
+		_hdr_prefetch(cd, device, &pf, LUKS2_HDR_BIN_LEN, false);
+		if (pf.len >= LUKS2_HDR_BIN_LEN) {
+			LUKS2_disk_hdr_json_area_drop(hdr);
+			if (!hdr_cache_get(cd, device, (struct luks2_hdr_disk *)pf.buf, hdr)) {
+				free(pf.buf);
+				r = device_check_size(cd, device, LUKS2_hdr_and_areas_size(hdr), 0);
+				if (r) {
+					json_object_put(hdr->jobj);
+					hdr->jobj = NULL;
+				}
+				return r;
+			}
+		}
+	}
+
+	_hdr_prefetch(cd, device, &pf, LUKS2_HDR_PREFETCH_LEN, false);
+
+	r = hdr_read_unlocked(cd, device, &pf, &hdr_disk1, &json_area1, 0, 0);
+	if (!r)
+		r = hdr_read_unlocked(cd, device, &pf, &hdr_disk2, &json_area2,
+				      be64_to_cpu(hdr_disk1.hdr_size), 1);
+	if (r || be64_to_cpu(hdr_disk1.seqid) != be64_to_cpu(hdr_disk2.seqid)) {
+		r = -EAGAIN;
+		goto out;
+	}
+
+	json_len = be64_to_cpu(hdr_disk1.hdr_size) - LUKS2_HDR_BIN_LEN;
+	jobj = parse_and_validate_json(cd, json_area1, json_len);
+	if (!jobj) {
+		r = -EAGAIN;
+		goto out;
+	}
+
+	r = device_check_size(cd, device, LUKS2_hdr_and_areas_size_jobj(jobj), 0);
+	if (r) {
+		json_object_put(jobj);
+		goto out;
+	}
+
+	hdr_from_disk(&hdr_disk1, &hdr_disk2, hdr, 0);
+	hdr->jobj = jobj;
+
+	if (crypt_get_header_cache(cd))
+		hdr_cache_put(cd, device, (struct luks2_hdr_disk *)pf.buf, hdr);
+
+	LUKS2_disk_hdr_json_area_drop(hdr);
+	if (!memcmp(json_area1, json_area2, json_len)) {
+		hdr->json_area = json_area1;
+		hdr->json_area_seqid = be64_to_cpu(hdr_disk1.seqid);
+		json_area1 = NULL;
+	}
+
+	log_dbg(cd, "LUKS2 header read without lock (seqid %" PRIu64 ").", hdr->seqid);
+out:
+	if (r == -EAGAIN)
+		log_dbg(cd, "Optimistic LUKS2 header read found inconsistent state.");
+	free(pf.buf);
+	free(json_area1);
+	free(json_area2);
 	return r;
 }
 
@@ -796,7 +1468,7 @@ int LUKS2_hdr_version_unlocked(struct crypt_device *cd, const char *backup_file)
 		flags |= O_DIRECT;
 
 	devfd = open(device_path(device), flags);
-	if (devfd != -1 && (read_lseek_blockwise(devfd, device_block_size(cd, device),
+	if (devfd != -1 && (pread_blockwise(devfd, device_block_size(cd, device),
 	     device_alignment(device), &hdr, sizeof(hdr), 0) == sizeof(hdr)) &&
 	    !memcmp(hdr.magic, LUKS2_MAGIC_1ST, LUKS2_MAGIC_L))
 		r = (int)be16_to_cpu(hdr.version);
@@ -39,8 +39,11 @@
  */
 int LUKS2_disk_hdr_read(struct crypt_device *cd, struct luks2_hdr *hdr,
 			struct device *device, int do_recovery, int do_blkprobe);
+int LUKS2_disk_hdr_read_optimistic(struct crypt_device *cd, struct luks2_hdr *hdr,
+				   struct device *device);
 int LUKS2_disk_hdr_write(struct crypt_device *cd, struct luks2_hdr *hdr,
 			 struct device *device, bool seqid_check);
+void LUKS2_disk_hdr_json_area_drop(struct luks2_hdr *hdr);
 int LUKS2_device_write_lock(struct crypt_device *cd,
 	struct luks2_hdr *hdr, struct device *device);
 
@@ -119,6 +122,29 @@ typedef int (*keyslot_dump_func) (struct crypt_device *cd, int keyslot);
 typedef int (*keyslot_validate_func) (struct crypt_device *cd, json_object *jobj_keyslot);
 typedef void(*keyslot_repair_func) (json_object *jobj_keyslot);
 
+/* Serialize memory-hard keyslot access: optional workaround for parallel processing */
+#define MIN_MEMORY_FOR_SERIALIZE_LOCK_KB 32*1024 /* 32MB */
+
+/* Keyslot key derivation, it can run in a separate thread (parallel unlock) */
+struct luks2_keyslot_kdf {
+	struct crypt_pbkdf_type pbkdf;
+	char *salt;
+	size_t salt_length;
+	struct volume_key *derived_key;
+};
+typedef int (*keyslot_kdf_func) (struct crypt_device *cd, int keyslot,
+				 struct luks2_keyslot_kdf *kdf);
+typedef int (*keyslot_open_derived_func) (struct crypt_device *cd, int keyslot,
+					  struct volume_key *derived_key,
+					  char *volume_key, size_t volume_key_len);
+typedef int (*keyslot_store_derived_func) (struct crypt_device *cd, int keyslot,
+					   struct volume_key *derived_key,
+					   const char *volume_key, size_t volume_key_len);
+
+int LUKS2_keyslot_kdf_run(struct luks2_keyslot_kdf *kdf,
+	const char *password, size_t password_len);
+void LUKS2_keyslot_kdf_free(struct luks2_keyslot_kdf *kdf);
+
 /* see LUKS2_luks2_to_luks1 */
 int placeholder_keyslot_alloc(struct crypt_device *cd,
 	int keyslot,
@@ -138,6 +164,10 @@ typedef struct  {
 	keyslot_dump_func  dump;
 	keyslot_validate_func validate;
 	keyslot_repair_func repair;
+	/* optional, for parallel unlock and multi-keyslot convert */
+	keyslot_kdf_func kdf;
+	keyslot_open_derived_func open_derived;
+	keyslot_store_derived_func store_derived;
 } keyslot_handler;
 
 struct reenc_protection {
@@ -283,11 +313,16 @@ int LUKS2_keyslot_reencrypt_digest_create(struct crypt_device *cd,
 	uint8_t version,
 	struct volume_key *vks);
 
+void LUKS2_reencrypt_digest_cache_free(struct luks2_hdr *hdr);
+
 int LUKS2_keyslot_dump(struct crypt_device *cd,
 	int keyslot);
 
 int LUKS2_keyslot_jobj_area(json_object *jobj_keyslot, uint64_t *offset, uint64_t *length);
 
+int LUKS2_keyslot_area_prefetched(struct crypt_device *cd, struct luks2_hdr *hdr,
+	uint64_t offset, size_t length, char *dst);
+
 /* JSON helpers */
 uint64_t json_segment_get_offset(json_object *jobj_segment, unsigned blockwise);
 const char *json_segment_type(json_object *jobj_segment);
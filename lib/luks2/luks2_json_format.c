@@ -43,53 +43,46 @@ static size_t get_max_offset(struct luks2_hdr *hdr)
 	return LUKS2_hdr_and_areas_size(hdr);
 }
 
+static int area_cmp(const void *a, const void *b)
+{
+	const struct area *aa = a, *ab = b;
+
+	if (aa->offset == ab->offset)
+		return 0;
+	return aa->offset < ab->offset ? -1 : 1;
+}
+
+/* Fill @areas with used keyslot areas sorted by offset, returns their count. */
+static int sorted_keyslot_areas(struct luks2_hdr *hdr, struct area *areas)
+{
+	int i, count = 0;
+
+	for (i = 0; i < LUKS2_KEYSLOTS_MAX; i++)
+		if (!LUKS2_keyslot_area(hdr, i, &areas[count].offset, &areas[count].length) &&
+		    areas[count].offset && areas[count].length)
+			count++;
+
+	qsort(areas, count, sizeof(*areas), area_cmp);
+
+	return count;
+}
+
 int LUKS2_find_area_max_gap(struct crypt_device *cd, struct luks2_hdr *hdr,
 			uint64_t *area_offset, uint64_t *area_length)
 {
-	struct area areas[LUKS2_KEYSLOTS_MAX], sorted_areas[LUKS2_KEYSLOTS_MAX+1] = {};
-	int i, j, k, area_i;
+	struct area sorted_areas[LUKS2_KEYSLOTS_MAX+1];
+	int i, k;
 	size_t valid_offset, offset, length;
 
-	/* fill area offset + length table */
-	for (i = 0; i < LUKS2_KEYSLOTS_MAX; i++) {
-		if (!LUKS2_keyslot_area(hdr, i, &areas[i].offset, &areas[i].length))
-			continue;
-		areas[i].length = 0;
-		areas[i].offset = 0;
-	}
-
-	/* sort table */
-	k = 0; /* index in sorted table */
-	for (i = 0; i < LUKS2_KEYSLOTS_MAX; i++) {
-		offset = get_max_offset(hdr) ?: UINT64_MAX;
-		area_i = -1;
-		/* search for the smallest offset in table */
-		for (j = 0; j < LUKS2_KEYSLOTS_MAX; j++)
-			if (areas[j].offset && areas[j].offset <= offset) {
-				area_i = j;
-				offset = areas[j].offset;
-			}
-
-		if (area_i >= 0) {
-			sorted_areas[k].length = areas[area_i].length;
-			sorted_areas[k].offset = areas[area_i].offset;
-			areas[area_i].length = 0;
-			areas[area_i].offset = 0;
-			k++;
-		}
-	}
+	k = sorted_keyslot_areas(hdr, sorted_areas);
 
-	sorted_areas[LUKS2_KEYSLOTS_MAX].offset = get_max_offset(hdr);
-	sorted_areas[LUKS2_KEYSLOTS_MAX].length = 1;
+	sorted_areas[k].offset = get_max_offset(hdr);
+	sorted_areas[k].length = 1;
 
 	/* search for the gap we can use */
 	length = valid_offset = 0;
 	offset = get_min_offset(hdr);
-	for (i = 0; i < LUKS2_KEYSLOTS_MAX+1; i++) {
-		/* skip empty */
-		if (sorted_areas[i].offset == 0 || sorted_areas[i].length == 0)
-			continue;
-
+	for (i = 0; i <= k; i++) {
 		/* found bigger gap than the last one */
 		if ((offset < sorted_areas[i].offset) && (sorted_areas[i].offset - offset) > length) {
 			length = sorted_areas[i].offset - offset;
@@ -120,47 +113,16 @@ int LUKS2_find_area_max_gap(struct crypt_device *cd, struct luks2_hdr *hdr,
 int LUKS2_find_area_gap(struct crypt_device *cd, struct luks2_hdr *hdr,
 			size_t keylength, uint64_t *area_offset, uint64_t *area_length)
 {
-	struct area areas[LUKS2_KEYSLOTS_MAX], sorted_areas[LUKS2_KEYSLOTS_MAX] = {};
-	int i, j, k, area_i;
+	struct area sorted_areas[LUKS2_KEYSLOTS_MAX];
+	int i, k;
 	size_t offset, length;
 
-	/* fill area offset + length table */
-	for (i = 0; i < LUKS2_KEYSLOTS_MAX; i++) {
-		if (!LUKS2_keyslot_area(hdr, i, &areas[i].offset, &areas[i].length))
-			continue;
-		areas[i].length = 0;
-		areas[i].offset = 0;
-	}
-
-	/* sort table */
-	k = 0; /* index in sorted table */
-	for (i = 0; i < LUKS2_KEYSLOTS_MAX; i++) {
-		offset = get_max_offset(hdr) ?: UINT64_MAX;
-		area_i = -1;
-		/* search for the smallest offset in table */
-		for (j = 0; j < LUKS2_KEYSLOTS_MAX; j++)
-			if (areas[j].offset && areas[j].offset <= offset) {
-				area_i = j;
-				offset = areas[j].offset;
-			}
-
-		if (area_i >= 0) {
-			sorted_areas[k].length = areas[area_i].length;
-			sorted_areas[k].offset = areas[area_i].offset;
-			areas[area_i].length = 0;
-			areas[area_i].offset = 0;
-			k++;
-		}
-	}
+	k = sorted_keyslot_areas(hdr, sorted_areas);
 
 	/* search for the gap we can use */
 	offset = get_min_offset(hdr);
 	length = get_area_size(keylength);
-	for (i = 0; i < LUKS2_KEYSLOTS_MAX; i++) {
-		/* skip empty */
-		if (sorted_areas[i].offset == 0 || sorted_areas[i].length == 0)
-			continue;
-
+	for (i = 0; i < k; i++) {
 		/* enough space before the used area */
 		if ((offset < sorted_areas[i].offset) && ((offset + length) <= sorted_areas[i].offset))
 			break;
@@ -345,45 +307,46 @@ int LUKS2_wipe_header_areas(struct crypt_device *cd,
 	struct luks2_hdr *hdr, bool detached_header)
 {
 	int r;
-	uint64_t offset, length;
-	size_t wipe_block;
+	uint64_t length, keyslots_offset, keyslots_size;
+	struct crypt_wipe_area areas[3];
 
 	/* Wipe complete header, keyslots and padding areas with zeroes. */
-	offset = 0;
 	length = LUKS2_get_data_offset(hdr) * SECTOR_SIZE;
-	wipe_block = 1024 * 1024;
-
 	if (LUKS2_hdr_validate(cd, hdr->jobj, hdr->hdr_size - LUKS2_HDR_BIN_LEN))
 		return -EINVAL;
 
 	/* On detached header wipe at least the first 4k */
-	if (detached_header) {
+	if (detached_header)
 		length = 4096;
-		wipe_block = 4096;
-	}
 
 	r = device_check_size(cd, crypt_metadata_device(cd), length, 1);
 	if (r)
 		return r;
 
-	log_dbg(cd, "Wiping LUKS areas (0x%06" PRIx64 " - 0x%06" PRIx64") with zeroes.",
-		offset, length + offset);
-
-	r = crypt_wipe_device(cd, crypt_metadata_device(cd), CRYPT_WIPE_ZERO,
-			      offset, length, wipe_block, NULL, NULL);
-	if (r < 0)
-		return r;
-
-	/* Wipe keyslot area */
-	wipe_block = 1024 * 1024;
-	offset = get_min_offset(hdr);
-	length = LUKS2_keyslots_size(hdr);
+	keyslots_offset = get_min_offset(hdr);
+	keyslots_size = LUKS2_keyslots_size(hdr);
+
+	/*
+	 * Keyslots area gets random data, so the zeroed areas are only
+	 * around it (binary and JSON headers, padding up to data offset).
+	 */
+	areas[0] = (struct crypt_wipe_area) { 0, length, CRYPT_WIPE_ZERO };
+	areas[1] = (struct crypt_wipe_area) { keyslots_offset, keyslots_size, CRYPT_WIPE_RANDOM };
+	areas[2] = (struct crypt_wipe_area) { 0, 0, CRYPT_WIPE_ZERO };
+
+	if (!detached_header && length > keyslots_offset) {
+		areas[0].length = keyslots_offset;
+		if (length > keyslots_offset + keyslots_size) {
+			areas[2].offset = keyslots_offset + keyslots_size;
+			areas[2].length = length - areas[2].offset;
+		}
+	}
 
-	log_dbg(cd, "Wiping keyslots area (0x%06" PRIx64 " - 0x%06" PRIx64") with random data.",
-		offset, length + offset);
+	log_dbg(cd, "Wiping LUKS areas (0x%06" PRIx64 " - 0x%06" PRIx64") with zeroes, "
+		"keyslots area (0x%06" PRIx64 " - 0x%06" PRIx64") with random data.",
+		UINT64_C(0), length, keyslots_offset, keyslots_offset + keyslots_size);
 
-	return crypt_wipe_device(cd, crypt_metadata_device(cd), CRYPT_WIPE_RANDOM,
-				 offset, length, wipe_block, NULL, NULL);
+	return crypt_wipe_device_areas(cd, crypt_metadata_device(cd), areas, 3, 1024 * 1024);
 }
 
 int LUKS2_set_keyslots_size(struct luks2_hdr *hdr, uint64_t data_offset)
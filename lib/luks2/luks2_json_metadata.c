@@ -32,6 +32,15 @@ struct interval {
 	uint64_t length;
 };
 
+static int interval_cmp(const void *a, const void *b)
+{
+	const struct interval *ia = a, *ib = b;
+
+	if (ia->offset == ib->offset)
+		return 0;
+	return ia->offset < ib->offset ? -1 : 1;
+}
+
 void hexprint_base64(struct crypt_device *cd, json_object *jobj,
 		     const char *sep, const char *line_sep)
 {
@@ -201,16 +210,27 @@ int LUKS2_segments_count(struct luks2_hdr *hdr)
 	return json_segments_count(LUKS2_get_segments_jobj(hdr));
 }
 
+/*
+ * Called for every CRYPT_DEFAULT_SEGMENT lookup, so both the backup-final
+ * flag search and the non-backup segment count are done in one pass.
+ */
 int LUKS2_get_default_segment(struct luks2_hdr *hdr)
 {
-	int s = LUKS2_get_segment_id_by_flag(hdr, "backup-final");
-	if (s >= 0)
-		return s;
+	json_object *jobj_segments, *jobj_flags;
+	bool have_segment = false;
 
-	if (LUKS2_segments_count(hdr) >= 1)
-		return 0;
+	if (!hdr || !(jobj_segments = json_get_segments_jobj(hdr->jobj)))
+		return -EINVAL;
+
+	json_object_object_foreach(jobj_segments, key, val) {
+		if (json_object_object_get_ex(val, "flags", &jobj_flags) &&
+		    LUKS2_array_jobj(jobj_flags, "backup-final"))
+			return atoi(key);
+		if (!json_segment_is_backup(val))
+			have_segment = true;
+	}
 
-	return -EINVAL;
+	return have_segment ? 0 : -EINVAL;
 }
 
 /*
@@ -375,12 +395,12 @@ static bool segment_has_digest(const char *segment_name, json_object *jobj_diges
 
 
 static bool validate_intervals(struct crypt_device *cd,
-			       int length, const struct interval *ix,
+			       int length, struct interval *ix,
 			       uint64_t metadata_size, uint64_t keyslots_area_end)
 {
-	int j, i = 0;
+	int i, last = 0;
 
-	while (i < length) {
+	for (i = 0; i < length; i++) {
 		/* Offset cannot be inside primary or secondary JSON area */
 		if (ix[i].offset < 2 * metadata_size) {
 			log_dbg(cd, "Illegal area offset: %" PRIu64 ".", ix[i].offset);
@@ -402,25 +422,24 @@ static bool validate_intervals(struct crypt_device *cd,
 				ix[i].offset, ix[i].offset + ix[i].length, keyslots_area_end);
 			return false;
 		}
+	}
 
-		for (j = 0; j < length; j++) {
-			if (i == j)
-				continue;
-
-			if (ix[j].offset > (UINT64_MAX - ix[j].length)) {
-				log_dbg(cd, "Interval offset+length overflow.");
-				return false;
-			}
+	/*
+	 * Sorted by offset, an area overlaps some previous one iff it starts
+	 * before the furthest end seen so far (@last is the area reaching it).
+	 */
+	qsort(ix, length, sizeof(*ix), interval_cmp);
 
-			if ((ix[i].offset >= ix[j].offset) && (ix[i].offset < (ix[j].offset + ix[j].length))) {
-				log_dbg(cd, "Overlapping areas [%" PRIu64 ",%" PRIu64 "] and [%" PRIu64 ",%" PRIu64 "].",
-					ix[i].offset, ix[i].offset + ix[i].length,
-					ix[j].offset, ix[j].offset + ix[j].length);
-				return false;
-			}
+	for (i = 1; i < length; i++) {
+		if (ix[i].offset < (ix[last].offset + ix[last].length)) {
+			log_dbg(cd, "Overlapping areas [%" PRIu64 ",%" PRIu64 "] and [%" PRIu64 ",%" PRIu64 "].",
+				ix[i].offset, ix[i].offset + ix[i].length,
+				ix[last].offset, ix[last].offset + ix[last].length);
+			return false;
 		}
 
-		i++;
+		if ((ix[i].offset + ix[i].length) > (ix[last].offset + ix[last].length))
+			last = i;
 	}
 
 	return true;
@@ -589,34 +608,36 @@ static int hdr_validate_crypt_segment(struct crypt_device *cd, json_object *jobj
 }
 
 static bool validate_segment_intervals(struct crypt_device *cd,
-				    int length, const struct interval *ix)
+				    int length, struct interval *ix)
 {
-	int j, i = 0;
+	int i, last = 0;
 
-	while (i < length) {
+	for (i = 0; i < length; i++) {
 		if (ix[i].length == UINT64_MAX && (i != (length - 1))) {
 			log_dbg(cd, "Only last regular segment is allowed to have 'dynamic' size.");
 			return false;
 		}
 
-		for (j = 0; j < length; j++) {
-			if (i == j)
-				continue;
+		if (ix[i].length != UINT64_MAX && ix[i].offset > (UINT64_MAX - ix[i].length)) {
+			log_dbg(cd, "Interval offset+length overflow.");
+			return false;
+		}
+	}
 
-			if (ix[j].length != UINT64_MAX && ix[j].offset > (UINT64_MAX - ix[j].length)) {
-				log_dbg(cd, "Interval offset+length overflow.");
-				return false;
-			}
+	/* Same sweep as for keyslot areas, 'dynamic' segment reaches the device end. */
+	qsort(ix, length, sizeof(*ix), interval_cmp);
 
-			if ((ix[i].offset >= ix[j].offset) && (ix[j].length == UINT64_MAX || (ix[i].offset < (ix[j].offset + ix[j].length)))) {
-				log_dbg(cd, "Overlapping segments [%" PRIu64 ",%" PRIu64 "]%s and [%" PRIu64 ",%" PRIu64 "]%s.",
-					ix[i].offset, ix[i].offset + ix[i].length, ix[i].length == UINT64_MAX ? "(dynamic)" : "",
-					ix[j].offset, ix[j].offset + ix[j].length, ix[j].length == UINT64_MAX ? "(dynamic)" : "");
-				return false;
-			}
+	for (i = 1; i < length; i++) {
+		if (ix[last].length == UINT64_MAX || ix[i].offset < (ix[last].offset + ix[last].length)) {
+			log_dbg(cd, "Overlapping segments [%" PRIu64 ",%" PRIu64 "]%s and [%" PRIu64 ",%" PRIu64 "]%s.",
+				ix[i].offset, ix[i].offset + ix[i].length, ix[i].length == UINT64_MAX ? "(dynamic)" : "",
+				ix[last].offset, ix[last].offset + ix[last].length, ix[last].length == UINT64_MAX ? "(dynamic)" : "");
+			return false;
 		}
 
-		i++;
+		if (ix[i].length == UINT64_MAX ||
+		    (ix[i].offset + ix[i].length) > (ix[last].offset + ix[last].length))
+			last = i;
 	}
 
 	return true;
@@ -1141,6 +1162,13 @@ int LUKS2_hdr_read(struct crypt_device *cd, struct luks2_hdr *hdr, int repair)
 {
 	int r;
 
+	/* Lock (and possible recovery) is needed only if a write was in progress */
+	if (!repair && crypt_metadata_locking_enabled() && crypt_metadata_read_optimistic_enabled()) {
+		r = LUKS2_disk_hdr_read_optimistic(cd, hdr, crypt_metadata_device(cd));
+		if (r != -EAGAIN)
+			goto out;
+	}
+
 	r = device_read_lock(cd, crypt_metadata_device(cd));
 	if (r) {
 		log_err(cd, _("Failed to acquire read lock on device %s."),
@@ -1166,7 +1194,7 @@ int LUKS2_hdr_read(struct crypt_device *cd, struct luks2_hdr *hdr, int repair)
 		device_write_unlock(cd, crypt_metadata_device(cd));
 	} else
 		device_read_unlock(cd, crypt_metadata_device(cd));
-
+out:
 	if (!r && (r = hdr_update_copy_for_rollback(cd, hdr)))
 		log_dbg(cd, "Failed to update rollback LUKS2 metadata.");
 
@@ -1202,7 +1230,12 @@ int LUKS2_hdr_write(struct crypt_device *cd, struct luks2_hdr *hdr)
 	if (hdr_cleanup_and_validate(cd, hdr))
 		return -EINVAL;
 
-	r = LUKS2_disk_hdr_write(cd, hdr, crypt_metadata_device(cd), true);
+	/* Staged changes keep own rollback point, failed operation reverts only itself */
+	if (crypt_header_transaction_active(cd)) {
+		log_dbg(cd, "LUKS2 header write deferred to transaction commit.");
+		r = 0;
+	} else
+		r = LUKS2_disk_hdr_write(cd, hdr, crypt_metadata_device(cd), true);
 
 	if (!r && (r = hdr_update_copy_for_rollback(cd, hdr)))
 		log_dbg(cd, "Failed to update rollback LUKS2 metadata.");
@@ -1275,6 +1308,9 @@ void LUKS2_hdr_free(struct crypt_device *cd, struct luks2_hdr *hdr)
 
 	if (!hdr_json_free(jobj))
 		log_dbg(cd, "LUKS2 rollback metadata copy still in use");
+
+	LUKS2_disk_hdr_json_area_drop(hdr);
+	LUKS2_reencrypt_digest_cache_free(hdr);
 }
 
 static uint64_t LUKS2_keyslots_size_jobj(json_object *jobj)
@@ -1304,25 +1340,38 @@ uint64_t LUKS2_hdr_and_areas_size(struct luks2_hdr *hdr)
 	return LUKS2_hdr_and_areas_size_jobj(hdr->jobj);
 }
 
+/* Header is copied in chunks, it can be tens of MiB with large keyslot areas */
+#define LUKS2_BACKUP_CHUNK (1024 * 1024)
+
 int LUKS2_hdr_backup(struct crypt_device *cd, struct luks2_hdr *hdr,
 		     const char *backup_file)
 {
 	struct device *device = crypt_metadata_device(cd);
 	int fd, devfd, r = 0;
 	ssize_t hdr_size;
-	ssize_t ret, buffer_size;
-	char *buffer = NULL;
+	ssize_t buffer_size, chunk, offset;
+	void *buffer = NULL;
 
 	hdr_size = LUKS2_hdr_and_areas_size(hdr);
 	buffer_size = size_round_up(hdr_size, crypt_getpagesize());
 
-	buffer = malloc(buffer_size);
-	if (!buffer)
+	/* Page aligned, so direct-io reads need no bounce buffer */
+	if (posix_memalign(&buffer, crypt_getpagesize(), LUKS2_BACKUP_CHUNK))
 		return -ENOMEM;
 
 	log_dbg(cd, "Storing backup of header (%zu bytes).", hdr_size);
 	log_dbg(cd, "Output backup file size: %zu bytes.", buffer_size);
 
+	fd = open(backup_file, O_CREAT|O_EXCL|O_WRONLY, S_IRUSR);
+	if (fd == -1) {
+		if (errno == EEXIST)
+			log_err(cd, _("Requested header backup file %s already exists."), backup_file);
+		else
+			log_err(cd, _("Cannot create header backup file %s."), backup_file);
+		r = -EINVAL;
+		goto out;
+	}
+
 	r = device_read_lock(cd, device);
 	if (r) {
 		log_err(cd, _("Failed to acquire read lock on device %s."),
@@ -1338,33 +1387,40 @@ int LUKS2_hdr_backup(struct crypt_device *cd, struct luks2_hdr *hdr,
 		goto out;
 	}
 
-	if (read_lseek_blockwise(devfd, device_block_size(cd, device),
-			   device_alignment(device), buffer, hdr_size, 0) < hdr_size) {
-		device_read_unlock(cd, device);
-		r = -EIO;
-		goto out;
+	/*
+	 * Stream the header through one chunk buffer. Zero chunks (mostly unused
+	 * keyslot area) stay holes in the sparse backup file.
+	 */
+	for (offset = 0; offset < hdr_size; offset += chunk) {
+		chunk = hdr_size - offset > LUKS2_BACKUP_CHUNK ? LUKS2_BACKUP_CHUNK : hdr_size - offset;
+
+		if (pread_blockwise(devfd, device_block_size(cd, device),
+				   device_alignment(device), buffer, chunk, offset) < chunk) {
+			r = -EIO;
+			break;
+		}
+
+		if (write_buffer_sparse(fd, buffer, chunk) < chunk) {
+			log_err(cd, _("Cannot write header backup file %s."), backup_file);
+			r = -EIO;
+			break;
+		}
 	}
 
 	device_read_unlock(cd, device);
 
-	fd = open(backup_file, O_CREAT|O_EXCL|O_WRONLY, S_IRUSR);
-	if (fd == -1) {
-		if (errno == EEXIST)
-			log_err(cd, _("Requested header backup file %s already exists."), backup_file);
-		else
-			log_err(cd, _("Cannot create header backup file %s."), backup_file);
-		r = -EINVAL;
-		goto out;
-	}
-	ret = write_buffer(fd, buffer, buffer_size);
-	close(fd);
-	if (ret < buffer_size) {
+	if (!r && ftruncate(fd, buffer_size)) {
 		log_err(cd, _("Cannot write header backup file %s."), backup_file);
 		r = -EIO;
-	} else
-		r = 0;
+	}
 out:
-	crypt_safe_memzero(buffer, buffer_size);
+	if (fd != -1) {
+		close(fd);
+		/* Do not leave incomplete backup file behind, it was created here */
+		if (r)
+			unlink(backup_file);
+	}
+	crypt_safe_memzero(buffer, LUKS2_BACKUP_CHUNK);
 	free(buffer);
 	return r;
 }
@@ -1409,8 +1465,9 @@ int LUKS2_hdr_restore(struct crypt_device *cd, struct luks2_hdr *hdr,
 	}
 
 	buffer_size = LUKS2_hdr_and_areas_size(&hdr_file);
-	buffer = malloc(buffer_size);
-	if (!buffer) {
+	/* Page aligned, so direct-io write needs no bounce buffer */
+	if (posix_memalign((void **)&buffer, crypt_getpagesize(), buffer_size)) {
+		buffer = NULL;
 		r = -ENOMEM;
 		goto out;
 	}
@@ -1496,7 +1553,7 @@ int LUKS2_hdr_restore(struct crypt_device *cd, struct luks2_hdr *hdr,
 		goto out;
 	}
 
-	if (write_lseek_blockwise(devfd, device_block_size(cd, device),
+	if (pwrite_blockwise(devfd, device_block_size(cd, device),
 			    device_alignment(device), buffer, buffer_size, 0) < buffer_size)
 		r = -EIO;
 	else
@@ -2011,6 +2068,9 @@ static void hdr_dump_keyslots(struct crypt_device *cd, json_object *hdr_jobj)
 
 		log_std(cd, "\tPriority:   %s\n", get_priority_desc(val));
 
+		if (json_object_object_get_ex(val, "hint", &jobj2))
+			log_std(cd, "\tHint:       %s\n", json_object_get_string(jobj2));
+
 		LUKS2_keyslot_dump(cd, j);
 
 		json_object_object_get_ex(hdr_jobj, "digests", &digests_jobj);
@@ -19,6 +19,8 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <pthread.h>
+
 #include "luks2_internal.h"
 
 /* Internal implementations */
@@ -89,7 +91,7 @@ int LUKS2_keyslot_find_empty(struct crypt_device *cd, struct luks2_hdr *hdr, siz
 static int _keyslot_for_segment(struct luks2_hdr *hdr, int keyslot, int segment)
 {
 	int keyslot_digest, count = 0;
-	unsigned s;
+	unsigned s, segments;
 
 	keyslot_digest = LUKS2_digest_by_keyslot(hdr, keyslot);
 	if (keyslot_digest < 0)
@@ -98,7 +100,8 @@ static int _keyslot_for_segment(struct luks2_hdr *hdr, int keyslot, int segment)
 	if (segment >= 0)
 		return keyslot_digest == LUKS2_digest_by_segment(hdr, segment);
 
-	for (s = 0; s < json_segments_count(LUKS2_get_segments_jobj(hdr)); s++) {
+	segments = json_segments_count(LUKS2_get_segments_jobj(hdr));
+	for (s = 0; s < segments; s++) {
 		if (keyslot_digest == LUKS2_digest_by_segment(hdr, s))
 			count++;
 	}
@@ -252,6 +255,20 @@ int LUKS2_keyslot_pbkdf(struct luks2_hdr *hdr, int keyslot, struct crypt_pbkdf_t
 	return 0;
 }
 
+/* KDF salt is regenerated on every keyslot write, it identifies keyslot content */
+const char *LUKS2_keyslot_salt(struct luks2_hdr *hdr, int keyslot)
+{
+	json_object *jobj_keyslot, *jobj_kdf, *jobj;
+
+	jobj_keyslot = LUKS2_get_keyslot_jobj(hdr, keyslot);
+	if (!jobj_keyslot ||
+	    !json_object_object_get_ex(jobj_keyslot, "kdf", &jobj_kdf) ||
+	    !json_object_object_get_ex(jobj_kdf, "salt", &jobj))
+		return NULL;
+
+	return json_object_get_string(jobj);
+}
+
 static int LUKS2_keyslot_unbound(struct luks2_hdr *hdr, int keyslot)
 {
 	json_object *jobj_digest, *jobj_segments;
@@ -388,6 +405,30 @@ static int LUKS2_open_and_verify_by_digest(struct crypt_device *cd,
 	return _open_and_verify(cd, hdr, h, keyslot, password, password_len, vk);
 }
 
+static int LUKS2_keyslot_usable(struct crypt_device *cd,
+	struct luks2_hdr *hdr,
+	int keyslot,
+	int segment,
+	const keyslot_handler **h)
+{
+	int r;
+
+	if (!(*h = LUKS2_keyslot_handler(cd, keyslot)))
+		return -ENOENT;
+
+	r = (*h)->validate(cd, LUKS2_get_keyslot_jobj(hdr, keyslot));
+	if (r) {
+		log_dbg(cd, "Keyslot %d validation failed.", keyslot);
+		return r;
+	}
+
+	r = LUKS2_keyslot_for_segment(hdr, keyslot, segment);
+	if (r == -ENOENT)
+		log_dbg(cd, "Keyslot %d unusable for segment %d.", keyslot, segment);
+
+	return r;
+}
+
 static int LUKS2_open_and_verify(struct crypt_device *cd,
 	struct luks2_hdr *hdr,
 	int keyslot,
@@ -399,23 +440,280 @@ static int LUKS2_open_and_verify(struct crypt_device *cd,
 	const keyslot_handler *h;
 	int r;
 
-	if (!(h = LUKS2_keyslot_handler(cd, keyslot)))
-		return -ENOENT;
+	r = LUKS2_keyslot_usable(cd, hdr, keyslot, segment, &h);
+	if (r)
+		return r;
 
-	r = h->validate(cd, LUKS2_get_keyslot_jobj(hdr, keyslot));
-	if (r) {
-		log_dbg(cd, "Keyslot %d validation failed.", keyslot);
+	return _open_and_verify(cd, hdr, h, keyslot, password, password_len, vk);
+}
+
+int LUKS2_keyslot_kdf_run(struct luks2_keyslot_kdf *kdf,
+	const char *password, size_t password_len)
+{
+	return crypt_pbkdf(kdf->pbkdf.type, kdf->pbkdf.hash, password, password_len,
+			   kdf->salt, kdf->salt_length,
+			   kdf->derived_key->key, kdf->derived_key->keylength,
+			   kdf->pbkdf.iterations, kdf->pbkdf.max_memory_kb,
+			   kdf->pbkdf.parallel_threads);
+}
+
+void LUKS2_keyslot_kdf_free(struct luks2_keyslot_kdf *kdf)
+{
+	free(kdf->salt);
+	crypt_free_volume_key(kdf->derived_key);
+	memset(kdf, 0, sizeof(*kdf));
+}
+
+/*
+ * Parallel unlock: KDF of several keyslots runs in worker threads, bounded
+ * by the number of parallel keyslots set in context and by memory the KDFs
+ * need together. Keyslot area decryption and digest check stay in the calling
+ * thread. Once a keyslot is verified no other KDF is started; already running
+ * ones cannot be interrupted and are waited for.
+ */
+struct keyslot_kdf_job {
+	int keyslot;
+	const keyslot_handler *h;
+	struct luks2_keyslot_kdf kdf;
+	const char *password;
+	size_t password_len;
+	pthread_mutex_t *lock;
+	pthread_cond_t *done_cond;
+	pthread_t thread;
+	const struct crypt_pbkdf_cancel *cancel;
+	enum { KDF_JOB_QUEUED = 0, KDF_JOB_RUNNING, KDF_JOB_DONE, KDF_JOB_FINISHED } state;
+	bool threaded;
+	int r;
+};
+
+static void *keyslot_kdf_thread(void *arg)
+{
+	struct keyslot_kdf_job *job = arg;
+	int r;
+
+	crypt_pbkdf_set_cancel(job->cancel);
+	r = LUKS2_keyslot_kdf_run(&job->kdf, job->password, job->password_len);
+
+	pthread_mutex_lock(job->lock);
+	job->r = r;
+	job->state = KDF_JOB_DONE;
+	pthread_cond_signal(job->done_cond);
+	pthread_mutex_unlock(job->lock);
+
+	return NULL;
+}
+
+static void keyslot_kdf_start(struct crypt_device *cd, struct keyslot_kdf_job *job)
+{
+	struct luks2_keyslot_kdf *kdf = &job->kdf;
+
+	job->state = KDF_JOB_RUNNING;
+
+	if (!crypt_derived_key_cache_get(cd, kdf->pbkdf.type, kdf->pbkdf.hash,
+			job->password, job->password_len, kdf->salt, kdf->salt_length,
+			kdf->derived_key->key, kdf->derived_key->keylength,
+			kdf->pbkdf.iterations, kdf->pbkdf.max_memory_kb, kdf->pbkdf.parallel_threads)) {
+		job->r = 0;
+		job->state = KDF_JOB_DONE;
+		return;
+	}
+
+	log_dbg(cd, "Running keyslot %d key derivation in parallel.", job->keyslot);
+	job->cancel = crypt_pbkdf_get_cancel();
+	job->threaded = !pthread_create(&job->thread, NULL, keyslot_kdf_thread, job);
+	if (job->threaded)
+		return;
+
+	/* no thread, run it here */
+	job->r = LUKS2_keyslot_kdf_run(kdf, job->password, job->password_len);
+	job->state = KDF_JOB_DONE;
+}
+
+static void keyslot_kdf_join(struct keyslot_kdf_job *job)
+{
+	if (job->threaded)
+		pthread_join(job->thread, NULL);
+	job->state = KDF_JOB_FINISHED;
+}
+
+/* Returns keyslot on success, -EPERM/-ENOENT to try next or other error. */
+static int keyslot_kdf_verify(struct crypt_device *cd, struct luks2_hdr *hdr,
+	struct keyslot_kdf_job *job, struct volume_key **vk)
+{
+	struct luks2_keyslot_kdf *kdf = &job->kdf;
+	int r, key_size;
+
+	if (job->r < 0) {
+		log_dbg(cd, "Keyslot %d (%s) key derivation failed with %d.", job->keyslot, job->h->name, job->r);
+		return job->r;
+	}
+
+	crypt_derived_key_cache_put(cd, kdf->pbkdf.type, kdf->pbkdf.hash,
+		job->password, job->password_len, kdf->salt, kdf->salt_length,
+		kdf->derived_key->key, kdf->derived_key->keylength,
+		kdf->pbkdf.iterations, kdf->pbkdf.max_memory_kb, kdf->pbkdf.parallel_threads);
+
+	key_size = LUKS2_get_keyslot_stored_key_size(hdr, job->keyslot);
+	if (key_size < 0)
+		return -EINVAL;
+
+	*vk = crypt_alloc_volume_key(key_size, NULL);
+	if (!*vk)
+		return -ENOMEM;
+
+	r = job->h->open_derived(cd, job->keyslot, kdf->derived_key, (*vk)->key, (*vk)->keylength);
+	if (r < 0)
+		log_dbg(cd, "Keyslot %d (%s) open failed with %d.", job->keyslot, job->h->name, r);
+	else
+		r = LUKS2_digest_verify(cd, hdr, *vk, job->keyslot);
+
+	if (r < 0) {
+		crypt_free_volume_key(*vk);
+		*vk = NULL;
 		return r;
 	}
 
-	r = LUKS2_keyslot_for_segment(hdr, keyslot, segment);
-	if (r) {
-		if (r == -ENOENT)
-			log_dbg(cd, "Keyslot %d unusable for segment %d.", keyslot, segment);
+	crypt_volume_key_set_id(*vk, r);
+	return job->keyslot;
+}
+
+/*
+ * Memory reserved for KDFs running together: the max_parallel largest
+ * memory costs, bounded by available memory. Jobs are admitted only
+ * while they fit, so any running set stays within the reservation.
+ */
+static uint64_t keyslot_kdf_memory_limit(const struct keyslot_kdf_job *jobs,
+	int count, unsigned max_parallel, uint64_t budget_kb)
+{
+	uint32_t used = 0;
+	uint64_t limit_kb = 0;
+	unsigned n;
+	int i, max;
+
+	for (n = 0; n < max_parallel && n < (unsigned)count; n++) {
+		for (max = -1, i = 0; i < count; i++)
+			if (!(used & (UINT32_C(1) << i)) &&
+			    (max < 0 || jobs[i].kdf.pbkdf.max_memory_kb > jobs[max].kdf.pbkdf.max_memory_kb))
+				max = i;
+		used |= UINT32_C(1) << max;
+		limit_kb += jobs[max].kdf.pbkdf.max_memory_kb;
+	}
+
+	return limit_kb > budget_kb ? budget_kb : limit_kb;
+}
+
+/*
+ * Run KDF jobs in priority order, at most max_parallel at once and within
+ * the memory reservation. The done callback is called in the calling thread
+ * for every finished job until it asks to stop; no new job is started then,
+ * already running ones are only waited for.
+ */
+typedef bool (*keyslot_kdf_done_fn)(struct crypt_device *cd,
+	struct keyslot_kdf_job *job, void *usrptr);
+
+static int keyslot_kdf_schedule(struct crypt_device *cd,
+	struct keyslot_kdf_job *jobs,
+	int count,
+	unsigned max_parallel,
+	keyslot_kdf_done_fn done,
+	void *usrptr)
+{
+	pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+	uint64_t memory_kb = 0, lock_kb;
+	unsigned running = 0;
+	bool stop = false, serialize;
+	int i, r;
+
+	/* Memory of KDFs running together, admitted at once if serialization is requested */
+	lock_kb = keyslot_kdf_memory_limit(jobs, count, max_parallel, adjusted_phys_memory());
+	serialize = lock_kb > MIN_MEMORY_FOR_SERIALIZE_LOCK_KB;
+	if (serialize && (r = crypt_serialize_lock(cd, lock_kb)))
 		return r;
+
+	for (i = 0; i < count; i++) {
+		jobs[i].lock = &lock;
+		jobs[i].done_cond = &done_cond;
 	}
 
-	return _open_and_verify(cd, hdr, h, keyslot, password, password_len, vk);
+	while (1) {
+		/* admit queued jobs in priority order */
+		for (i = 0; i < count && !stop && running < max_parallel; i++) {
+			if (jobs[i].state != KDF_JOB_QUEUED)
+				continue;
+			if (running && memory_kb + jobs[i].kdf.pbkdf.max_memory_kb > lock_kb)
+				break;
+			memory_kb += jobs[i].kdf.pbkdf.max_memory_kb;
+			running++;
+			keyslot_kdf_start(cd, &jobs[i]);
+		}
+		crypt_memory_kdf(cd, memory_kb);
+
+		if (!running)
+			break;
+
+		/* wait for any finished KDF */
+		pthread_mutex_lock(&lock);
+		while (1) {
+			for (i = 0; i < count && jobs[i].state != KDF_JOB_DONE; i++);
+			if (i < count)
+				break;
+			pthread_cond_wait(&done_cond, &lock);
+		}
+		pthread_mutex_unlock(&lock);
+
+		memory_kb -= jobs[i].kdf.pbkdf.max_memory_kb;
+		running--;
+
+		keyslot_kdf_join(&jobs[i]);
+		if (!stop && done(cd, &jobs[i], usrptr))
+			stop = true;
+	}
+
+	if (serialize)
+		crypt_serialize_unlock(cd);
+
+	return 0;
+}
+
+struct keyslot_kdf_open {
+	struct luks2_hdr *hdr;
+	struct volume_key **vk;
+	int r_slot;
+};
+
+static bool keyslot_kdf_open_done(struct crypt_device *cd,
+	struct keyslot_kdf_job *job, void *usrptr)
+{
+	struct keyslot_kdf_open *open = usrptr;
+	int r;
+
+	r = keyslot_kdf_verify(cd, open->hdr, job, open->vk);
+
+	/* Prefer password wrong to no entry */
+	if (r >= 0 || open->r_slot == -ENOENT || (r != -EPERM && r != -ENOENT))
+		open->r_slot = r;
+
+	return r >= 0 || (r != -EPERM && r != -ENOENT);
+}
+
+static int LUKS2_keyslot_open_parallel(struct crypt_device *cd,
+	struct luks2_hdr *hdr,
+	struct keyslot_kdf_job *jobs,
+	int count,
+	unsigned max_parallel,
+	struct volume_key **vk)
+{
+	struct keyslot_kdf_open open = {
+		.hdr = hdr,
+		.vk = vk,
+		.r_slot = -ENOENT,
+	};
+	int r;
+
+	r = keyslot_kdf_schedule(cd, jobs, count, max_parallel, keyslot_kdf_open_done, &open);
+
+	return r ?: open.r_slot;
 }
 
 static int LUKS2_keyslot_open_priority_digest(struct crypt_device *cd,
@@ -456,18 +754,577 @@ static int LUKS2_keyslot_open_priority_digest(struct crypt_device *cd,
 	return r;
 }
 
+static int LUKS2_keyslot_open_priority_parallel(struct crypt_device *cd,
+	struct luks2_hdr *hdr,
+	crypt_keyslot_priority priority,
+	const char *password,
+	size_t password_len,
+	int segment,
+	unsigned max_parallel,
+	uint32_t skip,
+	struct volume_key **vk)
+{
+	struct keyslot_kdf_job jobs[LUKS2_KEYSLOTS_MAX];
+	int other[LUKS2_KEYSLOTS_MAX];
+	json_object *jobj_keyslots, *jobj;
+	crypt_keyslot_priority slot_priority;
+	const keyslot_handler *h;
+	int i, keyslot, count = 0, other_count = 0, r_collect = -ENOENT, r, r_other;
+
+	json_object_object_get_ex(hdr->jobj, "keyslots", &jobj_keyslots);
+
+	json_object_object_foreach(jobj_keyslots, slot, val) {
+		if (!json_object_object_get_ex(val, "priority", &jobj))
+			slot_priority = CRYPT_SLOT_PRIORITY_NORMAL;
+		else
+			slot_priority = json_object_get_int(jobj);
+
+		keyslot = atoi(slot);
+		if (slot_priority != priority || (skip & (UINT32_C(1) << keyslot)) ||
+		    count + other_count >= LUKS2_KEYSLOTS_MAX)
+			continue;
+
+		r = LUKS2_keyslot_usable(cd, hdr, keyslot, segment, &h);
+		if (r == -ENOENT || r == -EPERM)
+			continue;
+		if (r) {
+			/* as in sequential open, later keyslots are not tried */
+			r_collect = r;
+			break;
+		}
+
+		if (!h->kdf || !h->open_derived) {
+			other[other_count++] = keyslot;
+			continue;
+		}
+
+		memset(&jobs[count], 0, sizeof(jobs[count]));
+		r = h->kdf(cd, keyslot, &jobs[count].kdf);
+		if (r < 0) {
+			r_collect = r;
+			break;
+		}
+		jobs[count].keyslot = keyslot;
+		jobs[count].h = h;
+		jobs[count].password = password;
+		jobs[count].password_len = password_len;
+		count++;
+	}
+
+	log_dbg(cd, "Trying %d keyslots with priority %d in parallel (max %u).", count, priority, max_parallel);
+
+	r = count ? LUKS2_keyslot_open_parallel(cd, hdr, jobs, count, max_parallel, vk) : -ENOENT;
+
+	for (i = 0; i < count; i++)
+		LUKS2_keyslot_kdf_free(&jobs[i].kdf);
+
+	/* keyslots without split key derivation, prefer password wrong to no entry */
+	for (i = 0; i < other_count && (r == -EPERM || r == -ENOENT); i++) {
+		r_other = LUKS2_open_and_verify(cd, hdr, other[i], segment, password, password_len, vk);
+		if (r_other != -ENOENT || r == -ENOENT)
+			r = r_other;
+	}
+
+	if (r < 0 && r_collect != -ENOENT && (r == -EPERM || r == -ENOENT))
+		r = r_collect;
+
+	return r;
+}
+
+static bool keyslot_kdf_run_done(struct crypt_device *cd,
+	struct keyslot_kdf_job *job, void *usrptr)
+{
+	int *r = usrptr;
+
+	if (job->r >= 0)
+		return false;
+
+	log_dbg(cd, "Keyslot %d key derivation failed with %d.", job->keyslot, job->r);
+	*r = job->r;
+	return true;
+}
+
+/* Run all KDF jobs, no new job is started after a failure. */
+static int keyslot_kdf_run_all(struct crypt_device *cd,
+	struct keyslot_kdf_job *jobs,
+	int count,
+	unsigned max_parallel)
+{
+	int r, r_job = 0;
+
+	r = keyslot_kdf_schedule(cd, jobs, count, max_parallel, keyslot_kdf_run_done, &r_job);
+
+	return r ?: r_job;
+}
+
+static int keyslot_kdf_jobs_init(struct crypt_device *cd,
+	struct keyslot_kdf_job *jobs,
+	const int *keyslots,
+	const char *const *passwords,
+	const size_t *password_lens,
+	int count)
+{
+	int i, r;
+
+	for (i = 0; i < count; i++) {
+		LUKS2_keyslot_kdf_free(&jobs[i].kdf);
+		memset(&jobs[i], 0, sizeof(jobs[i]));
+		jobs[i].keyslot = keyslots[i];
+		jobs[i].h = LUKS2_keyslot_handler(cd, keyslots[i]);
+		jobs[i].password = passwords[i];
+		jobs[i].password_len = password_lens[i];
+		if (!jobs[i].h)
+			return -EINVAL;
+		r = jobs[i].h->kdf(cd, keyslots[i], &jobs[i].kdf);
+		if (r < 0)
+			return r;
+	}
+
+	return 0;
+}
+
+/*
+ * Store converted keyslot and commit it. New keyslot material goes to a free
+ * area if there is one, old area is wiped only after the commit. Without
+ * free area the keyslot is overwritten in place, a crash before the commit
+ * then loses only this keyslot.
+ */
+static int keyslot_convert_commit(struct crypt_device *cd,
+	struct luks2_hdr *hdr,
+	struct keyslot_kdf_job *job,
+	json_object *jobj_keyslot,
+	struct volume_key *vk)
+{
+	json_object *jobj_keyslots, *jobj_area;
+	uint64_t old_offset, old_length, offset, length;
+	char num[16];
+	bool moved;
+	int r;
+
+	if (!json_object_object_get_ex(hdr->jobj, "keyslots", &jobj_keyslots) ||
+	    !json_object_object_get_ex(jobj_keyslot, "area", &jobj_area) ||
+	    LUKS2_keyslot_area(hdr, job->keyslot, &old_offset, &old_length) ||
+	    snprintf(num, sizeof(num), "%d", job->keyslot) < 0) {
+		json_object_put(jobj_keyslot);
+		return -EINVAL;
+	}
+
+	moved = !LUKS2_find_area_gap(cd, hdr, vk->keylength, &offset, &length);
+	if (moved) {
+		json_object_object_add(jobj_area, "offset", crypt_jobj_new_uint64(offset));
+		json_object_object_add(jobj_area, "size", crypt_jobj_new_uint64(length));
+	} else
+		log_dbg(cd, "No free keyslot area, keyslot %d is converted in place.", job->keyslot);
+
+	json_object_object_add(jobj_keyslots, num, jobj_keyslot);
+
+	r = job->h->store_derived(cd, job->keyslot, job->kdf.derived_key, vk->key, vk->keylength);
+	if (!r)
+		r = LUKS2_hdr_write(cd, hdr);
+	if (r || !moved)
+		return r;
+
+	r = crypt_wipe_device(cd, crypt_metadata_device(cd), CRYPT_WIPE_SPECIAL, old_offset,
+			      old_length, old_length, NULL, NULL);
+	if (r)
+		log_err(cd, _("Cannot wipe device %s."), device_path(crypt_metadata_device(cd)));
+
+	return r;
+}
+
+/*
+ * Convert several keyslots to the context PBKDF and keyslot encryption.
+ * Old and new key derivations run in parallel, the PBKDF is benchmarked
+ * only once. Header is committed after every keyslot, so an interruption
+ * leaves every keyslot either converted or untouched.
+ */
+int LUKS2_keyslot_convert(struct crypt_device *cd,
+	struct luks2_hdr *hdr,
+	const int *keyslots,
+	const char *const *passwords,
+	const size_t *password_lens,
+	int count)
+{
+	struct keyslot_kdf_job jobs[LUKS2_KEYSLOTS_MAX];
+	struct volume_key *vks[LUKS2_KEYSLOTS_MAX] = {};
+	json_object *jobj_new[LUKS2_KEYSLOTS_MAX] = {};
+	struct luks2_keyslot_params params;
+	struct crypt_pbkdf_type *pbkdf;
+	const keyslot_handler *h;
+	uint32_t pbkdf_flags, seen = 0;
+	unsigned max_parallel;
+	bool modified = false;
+	int i, r;
+
+	if (count <= 0 || count > LUKS2_KEYSLOTS_MAX)
+		return -EINVAL;
+
+	pbkdf = CONST_CAST(struct crypt_pbkdf_type *)crypt_get_pbkdf_type(cd);
+	if (!pbkdf)
+		return -EINVAL;
+
+	for (i = 0; i < count; i++) {
+		if (keyslots[i] < 0 || keyslots[i] >= LUKS2_KEYSLOTS_MAX ||
+		    (seen & (UINT32_C(1) << keyslots[i])) || !passwords[i])
+			return -EINVAL;
+		seen |= UINT32_C(1) << keyslots[i];
+
+		h = LUKS2_keyslot_handler(cd, keyslots[i]);
+		if (!h) {
+			log_err(cd, _("Keyslot %d is not active."), keyslots[i]);
+			return -ENOENT;
+		}
+		if (!h->kdf || !h->open_derived || !h->store_derived || !h->update) {
+			log_dbg(cd, "Keyslot %d (%s) cannot be converted.", keyslots[i], h->name);
+			return -EINVAL;
+		}
+	}
+
+	max_parallel = crypt_get_keyslot_parallel_unlock(cd);
+	if (max_parallel < 2)
+		max_parallel = crypt_cpusonline();
+
+	log_dbg(cd, "Converting %d keyslots (max %u in parallel).", count, max_parallel);
+
+	memset(jobs, 0, sizeof(jobs));
+
+	/* unlock all with the old PBKDF */
+	r = keyslot_kdf_jobs_init(cd, jobs, keyslots, passwords, password_lens, count);
+	if (!r)
+		r = keyslot_kdf_run_all(cd, jobs, count, max_parallel);
+	for (i = 0; i < count && !r; i++) {
+		r = keyslot_kdf_verify(cd, hdr, &jobs[i], &vks[i]);
+		if (r >= 0)
+			r = 0;
+		else
+			log_dbg(cd, "Keyslot %d cannot be unlocked.", keyslots[i]);
+	}
+	if (r < 0)
+		goto out;
+
+	/* new PBKDF parameters and salt, benchmark is run for the first keyslot only */
+	r = LUKS2_keyslot_params_default(cd, hdr, &params);
+	if (r < 0)
+		goto out;
+
+	modified = true;
+	pbkdf_flags = pbkdf->flags;
+	for (i = 0; i < count && !r; i++) {
+		h = LUKS2_keyslot_handler(cd, keyslots[i]);
+		r = h->update(cd, keyslots[i], &params);
+		if (!r)
+			r = h->validate(cd, LUKS2_get_keyslot_jobj(hdr, keyslots[i]));
+		if (!r)
+			pbkdf->flags |= CRYPT_PBKDF_NO_BENCHMARK;
+	}
+	pbkdf->flags = pbkdf_flags;
+	if (r) {
+		log_dbg(cd, "Failed to update keyslots json.");
+		goto out;
+	}
+
+	if (LUKS2_hdr_validate(cd, hdr->jobj, hdr->hdr_size - LUKS2_HDR_BIN_LEN)) {
+		r = -EINVAL;
+		goto out;
+	}
+
+	/* derive new keyslot keys */
+	r = keyslot_kdf_jobs_init(cd, jobs, keyslots, passwords, password_lens, count);
+	if (!r)
+		r = keyslot_kdf_run_all(cd, jobs, count, max_parallel);
+	if (r < 0)
+		goto out;
+
+	/* keep converted json, keyslots are put back to on-disk state and committed one by one */
+	for (i = 0; i < count && !r; i++)
+		if (json_object_copy(LUKS2_get_keyslot_jobj(hdr, keyslots[i]), &jobj_new[i]))
+			r = -ENOMEM;
+	if (r < 0)
+		goto out;
+
+	r = LUKS2_hdr_rollback(cd, hdr);
+	if (r < 0)
+		goto out;
+
+	r = LUKS2_device_write_lock(cd, hdr, crypt_metadata_device(cd));
+	if (r)
+		goto out;
+
+	for (i = 0; i < count && !r; i++) {
+		r = keyslot_convert_commit(cd, hdr, &jobs[i], jobj_new[i], vks[i]);
+		jobj_new[i] = NULL;
+	}
+
+	device_write_unlock(cd, crypt_metadata_device(cd));
+out:
+	for (i = 0; i < count; i++) {
+		LUKS2_keyslot_kdf_free(&jobs[i].kdf);
+		crypt_free_volume_key(vks[i]);
+		json_object_put(jobj_new[i]);
+	}
+
+	if (r < 0 && modified && LUKS2_hdr_rollback(cd, hdr) < 0)
+		log_dbg(cd, "Failed to rollback LUKS2 metadata in memory.");
+
+	return r;
+}
+
+/* Do not read ahead more than this span of keyslot areas at once */
+#define LUKS2_AREA_PREFETCH_MAX (4 * 1024 * 1024)
+
+struct luks2_area_prefetch {
+	struct device *device;
+	char *buf;
+	uint64_t offset, length;
+	size_t bsize, alignment;
+	int devfd;
+	pthread_t thread;
+	bool threaded;
+	int r;
+};
+
+static void *keyslot_area_prefetch_thread(void *arg)
+{
+	struct luks2_area_prefetch *pf = arg;
+
+	if (pread_blockwise(pf->devfd, pf->bsize, pf->alignment, pf->buf,
+				 pf->length, pf->offset) < 0)
+		pf->r = -EIO;
+
+	return NULL;
+}
+
+/*
+ * Read all keyslot areas of candidate keyslots in one request, in another
+ * thread while the first KDF runs. The device read lock is held until the
+ * first keyslot area is needed and then the read is waited for.
+ *
+ * Only plain luks2 keyslots are prefetched, other handlers may access
+ * the device in between.
+ */
+static void keyslot_area_prefetch_start(struct crypt_device *cd,
+	struct luks2_hdr *hdr,
+	crypt_keyslot_priority priority,
+	int segment,
+	struct luks2_area_prefetch *pf)
+{
+	json_object *jobj_keyslots, *jobj;
+	crypt_keyslot_priority slot_priority;
+	const keyslot_handler *h;
+	uint64_t offset, length, start = UINT64_MAX, end = 0;
+	int keyslot, count = 0;
+
+	memset(pf, 0, sizeof(*pf));
+	pf->devfd = -1;
+
+	json_object_object_get_ex(hdr->jobj, "keyslots", &jobj_keyslots);
+
+	json_object_object_foreach(jobj_keyslots, slot, val) {
+		if (!json_object_object_get_ex(val, "priority", &jobj))
+			slot_priority = CRYPT_SLOT_PRIORITY_NORMAL;
+		else
+			slot_priority = json_object_get_int(jobj);
+
+		keyslot = atoi(slot);
+		if (slot_priority != priority || LUKS2_keyslot_for_segment(hdr, keyslot, segment))
+			continue;
+
+		if (!(h = LUKS2_keyslot_handler(cd, keyslot)) || strcmp(h->name, "luks2") ||
+		    LUKS2_keyslot_jobj_area(val, &offset, &length))
+			return;
+
+		if (offset < start)
+			start = offset;
+		if (offset + length > end)
+			end = offset + length;
+		count++;
+	}
+
+	if (!count || end - start > LUKS2_AREA_PREFETCH_MAX)
+		return;
+
+	pf->device = crypt_metadata_device(cd);
+	pf->offset = start;
+	pf->length = end - start;
+	pf->buf = malloc(pf->length);
+	if (!pf->buf)
+		return;
+
+	if (device_read_lock(cd, pf->device)) {
+		free(pf->buf);
+		pf->buf = NULL;
+		return;
+	}
+
+	pf->devfd = device_open_locked(cd, pf->device, O_RDONLY);
+	if (pf->devfd < 0) {
+		device_read_unlock(cd, pf->device);
+		free(pf->buf);
+		pf->buf = NULL;
+		return;
+	}
+
+	pf->bsize = device_block_size(cd, pf->device);
+	pf->alignment = device_alignment(pf->device);
+
+	log_dbg(cd, "Prefetching %d keyslot areas [0x%04" PRIx64 ", 0x%04" PRIx64 "].", count, start, end);
+
+	pf->threaded = !pthread_create(&pf->thread, NULL, keyslot_area_prefetch_thread, pf);
+	if (!pf->threaded)
+		(void)keyslot_area_prefetch_thread(pf);
+
+	hdr->area_prefetch = pf;
+}
+
+static void keyslot_area_prefetch_wait(struct crypt_device *cd, struct luks2_area_prefetch *pf)
+{
+	if (pf->devfd < 0)
+		return;
+
+	if (pf->threaded)
+		pthread_join(pf->thread, NULL);
+	pf->threaded = false;
+
+	device_read_unlock(cd, pf->device);
+	pf->devfd = -1;
+
+	if (pf->r)
+		log_dbg(cd, "Keyslot areas prefetch failed, reading them directly.");
+}
+
+static void keyslot_area_prefetch_end(struct crypt_device *cd, struct luks2_hdr *hdr)
+{
+	struct luks2_area_prefetch *pf = hdr->area_prefetch;
+
+	if (!pf)
+		return;
+
+	keyslot_area_prefetch_wait(cd, pf);
+	free(pf->buf);
+	hdr->area_prefetch = NULL;
+}
+
+/* Copy of prefetched keyslot area, -ENOENT if it has to be read from the device. */
+int LUKS2_keyslot_area_prefetched(struct crypt_device *cd, struct luks2_hdr *hdr,
+	uint64_t offset, size_t length, char *dst)
+{
+	struct luks2_area_prefetch *pf = hdr ? hdr->area_prefetch : NULL;
+
+	if (!pf)
+		return -ENOENT;
+
+	keyslot_area_prefetch_wait(cd, pf);
+
+	if (pf->r || offset < pf->offset || length > pf->length ||
+	    offset - pf->offset > pf->length - length)
+		return -ENOENT;
+
+	memcpy(dst, pf->buf + (offset - pf->offset), length);
+	return 0;
+}
+
+/*
+ * Keyslot hint is a short tag of caller supplied label salted by keyslot
+ * KDF salt, so the same label gives unrelated tags in different keyslots
+ * and headers. It does not reveal the label, it only orders unlock attempts.
+ */
+#define LUKS2_KEYSLOT_HINT_BYTES 2
+
+static int keyslot_hint_tag(json_object *jobj_keyslot, const char *hint,
+			    char tag[LUKS2_KEYSLOT_HINT_BYTES * 2 + 1])
+{
+	json_object *jobj_kdf, *jobj_salt;
+	struct crypt_hash *hd = NULL;
+	const char *salt = "";
+	unsigned char digest[32];
+	int i, r;
+
+	if (json_object_object_get_ex(jobj_keyslot, "kdf", &jobj_kdf) &&
+	    json_object_object_get_ex(jobj_kdf, "salt", &jobj_salt))
+		salt = json_object_get_string(jobj_salt);
+
+	if (crypt_hash_init(&hd, "sha256"))
+		return -EINVAL;
+
+	r = crypt_hash_write(hd, salt, strlen(salt) + 1);
+	if (!r)
+		r = crypt_hash_write(hd, hint, strlen(hint));
+	if (!r)
+		r = crypt_hash_final(hd, (char *)digest, sizeof(digest));
+	crypt_hash_destroy(hd);
+	if (r)
+		return r;
+
+	for (i = 0; i < LUKS2_KEYSLOT_HINT_BYTES; i++)
+		sprintf(&tag[i * 2], "%02x", digest[i]);
+
+	return 0;
+}
+
+/* Try keyslots tagged with hint set in context, mark the ones tried in @tried. */
+static int LUKS2_keyslot_open_hinted(struct crypt_device *cd,
+	struct luks2_hdr *hdr,
+	const char *password,
+	size_t password_len,
+	int segment,
+	uint32_t *tried,
+	struct volume_key **vk)
+{
+	char tag[LUKS2_KEYSLOT_HINT_BYTES * 2 + 1];
+	const char *hint = crypt_get_keyslot_hint(cd);
+	json_object *jobj_keyslots, *jobj_hint;
+	int keyslot, r = -ENOENT;
+
+	if (!hint)
+		return -ENOENT;
+
+	json_object_object_get_ex(hdr->jobj, "keyslots", &jobj_keyslots);
+
+	json_object_object_foreach(jobj_keyslots, slot, val) {
+		keyslot = atoi(slot);
+		if (!json_object_object_get_ex(val, "hint", &jobj_hint) ||
+		    LUKS2_keyslot_priority_get(hdr, keyslot) == CRYPT_SLOT_PRIORITY_IGNORE ||
+		    keyslot_hint_tag(val, hint, tag) ||
+		    strcmp(tag, json_object_get_string(jobj_hint)))
+			continue;
+
+		log_dbg(cd, "Trying hinted keyslot %d first.", keyslot);
+		r = LUKS2_open_and_verify(cd, hdr, keyslot, segment, password, password_len, vk);
+		if ((r != -EPERM) && (r != -ENOENT))
+			break;
+		*tried |= UINT32_C(1) << keyslot;
+	}
+
+	return r;
+}
+
 static int LUKS2_keyslot_open_priority(struct crypt_device *cd,
 	struct luks2_hdr *hdr,
 	crypt_keyslot_priority priority,
 	const char *password,
 	size_t password_len,
 	int segment,
+	uint32_t skip,
 	struct volume_key **vk)
 {
 	json_object *jobj_keyslots, *jobj;
 	crypt_keyslot_priority slot_priority;
+	unsigned max_parallel = crypt_get_keyslot_parallel_unlock(cd);
+	struct luks2_area_prefetch pf;
 	int keyslot, r = -ENOENT;
 
+	keyslot_area_prefetch_start(cd, hdr, priority, segment, &pf);
+
+	if (max_parallel > 1) {
+		CRYPT_TRACE(keyslot__open__start, -1, priority);
+		r = LUKS2_keyslot_open_priority_parallel(cd, hdr, priority, password,
+							 password_len, segment, max_parallel,
+							 skip, vk);
+		CRYPT_TRACE(keyslot__open__done, -1, r);
+		keyslot_area_prefetch_end(cd, hdr);
+		return r;
+	}
+
 	json_object_object_get_ex(hdr->jobj, "keyslots", &jobj_keyslots);
 
 	json_object_object_foreach(jobj_keyslots, slot, val) {
@@ -483,7 +1340,12 @@ static int LUKS2_keyslot_open_priority(struct crypt_device *cd,
 			continue;
 		}
 
+		if (skip & (UINT32_C(1) << keyslot))
+			continue;
+
+		CRYPT_TRACE(keyslot__open__start, keyslot, priority);
 		r = LUKS2_open_and_verify(cd, hdr, keyslot, segment, password, password_len, vk);
+		CRYPT_TRACE(keyslot__open__done, keyslot, r);
 
 		/* Do not retry for errors that are no -EPERM or -ENOENT,
 		   former meaning password wrong, latter key slot unusable for segment */
@@ -491,6 +1353,7 @@ static int LUKS2_keyslot_open_priority(struct crypt_device *cd,
 			break;
 	}
 
+	keyslot_area_prefetch_end(cd, hdr);
 	return r;
 }
 
@@ -536,6 +1399,7 @@ int LUKS2_keyslot_open_all_segments(struct crypt_device *cd,
 	struct volume_key *vk = NULL;
 	int digest_old, digest_new, r = -EINVAL;
 	struct luks2_hdr *hdr = crypt_get_hdr(cd, CRYPT_LUKS2);
+	uint64_t t = crypt_time_us();
 
 	digest_old = LUKS2_reencrypt_digest_old(hdr);
 	if (digest_old >= 0) {
@@ -555,12 +1419,15 @@ int LUKS2_keyslot_open_all_segments(struct crypt_device *cd,
 		crypt_volume_key_add_next(vks, vk);
 	}
 out:
+	crypt_timing_add(cd, CRYPT_TIMING_KEYSLOT, t);
 	if (r < 0) {
 		crypt_free_volume_key(*vks);
 		*vks = NULL;
 
 		if (r == -ENOMEM)
 			log_err(cd, _("Not enough available memory to open a keyslot."));
+		else if (r == -ECANCELED || r == -ETIMEDOUT)
+			log_dbg(cd, "Keyslot open cancelled (%d).", r);
 		else if (r != -EPERM && r != -ENOENT)
 			log_err(cd, _("Keyslot open failed."));
 	}
@@ -575,29 +1442,39 @@ int LUKS2_keyslot_open(struct crypt_device *cd,
 	struct volume_key **vk)
 {
 	struct luks2_hdr *hdr;
-	int r_prio, r = -EINVAL;
+	uint32_t tried = 0;
+	uint64_t t = crypt_time_us();
+	int r_hint, r_prio, r = -EINVAL;
 
 	hdr = crypt_get_hdr(cd, CRYPT_LUKS2);
 
 	if (keyslot == CRYPT_ANY_SLOT) {
-		r_prio = LUKS2_keyslot_open_priority(cd, hdr, CRYPT_SLOT_PRIORITY_PREFER,
-			password, password_len, segment, vk);
-		if (r_prio >= 0)
-			r = r_prio;
-		else if (r_prio != -EPERM && r_prio != -ENOENT)
-			r = r_prio;
-		else
-			r = LUKS2_keyslot_open_priority(cd, hdr, CRYPT_SLOT_PRIORITY_NORMAL,
-				password, password_len, segment, vk);
-		/* Prefer password wrong to no entry from priority slot */
-		if (r_prio == -EPERM && r == -ENOENT)
-			r = r_prio;
+		r_hint = LUKS2_keyslot_open_hinted(cd, hdr, password, password_len, segment, &tried, vk);
+		if (r_hint >= 0 || (r_hint != -EPERM && r_hint != -ENOENT))
+			r = r_hint;
+		else {
+			r_prio = LUKS2_keyslot_open_priority(cd, hdr, CRYPT_SLOT_PRIORITY_PREFER,
+				password, password_len, segment, tried, vk);
+			if (r_prio >= 0)
+				r = r_prio;
+			else if (r_prio != -EPERM && r_prio != -ENOENT)
+				r = r_prio;
+			else
+				r = LUKS2_keyslot_open_priority(cd, hdr, CRYPT_SLOT_PRIORITY_NORMAL,
+					password, password_len, segment, tried, vk);
+			/* Prefer password wrong to no entry from priority slot */
+			if ((r_prio == -EPERM || r_hint == -EPERM) && r == -ENOENT)
+				r = -EPERM;
+		}
 	} else
 		r = LUKS2_open_and_verify(cd, hdr, keyslot, segment, password, password_len, vk);
 
+	crypt_timing_add(cd, CRYPT_TIMING_KEYSLOT, t);
 	if (r < 0) {
 		if (r == -ENOMEM)
 			log_err(cd, _("Not enough available memory to open a keyslot."));
+		else if (r == -ECANCELED || r == -ETIMEDOUT)
+			log_dbg(cd, "Keyslot open cancelled (%d).", r);
 		else if (r != -EPERM && r != -ENOENT)
 			log_err(cd, _("Keyslot open failed."));
 	}
@@ -739,6 +1616,104 @@ out:
 	return r;
 }
 
+struct keyslot_extent {
+	uint64_t offset;
+	uint64_t length;
+};
+
+static int keyslot_extent_cmp(const void *a, const void *b)
+{
+	const struct keyslot_extent *ea = a, *eb = b;
+
+	if (ea->offset < eb->offset)
+		return -1;
+	return ea->offset > eb->offset ? 1 : 0;
+}
+
+/*
+ * Wipe all active keyslots (bound to a digest) under one write lock:
+ * adjacent keyslot areas are merged and wiped as a single extent and
+ * the header is committed once. Unbound and reencryption keyslots stay.
+ */
+int LUKS2_keyslot_wipe_all(struct crypt_device *cd, struct luks2_hdr *hdr)
+{
+	struct device *device = crypt_metadata_device(cd);
+	struct keyslot_extent extents[LUKS2_KEYSLOTS_MAX];
+	int keyslots[LUKS2_KEYSLOTS_MAX];
+	json_object *jobj_keyslots;
+	const keyslot_handler *h;
+	crypt_keyslot_info ki;
+	int i, j, count = 0, r;
+
+	if (!json_object_object_get_ex(hdr->jobj, "keyslots", &jobj_keyslots))
+		return -EINVAL;
+
+	for (i = 0; i < LUKS2_KEYSLOTS_MAX; i++) {
+		ki = LUKS2_keyslot_info(hdr, i);
+		if (ki == CRYPT_SLOT_ACTIVE || ki == CRYPT_SLOT_ACTIVE_LAST)
+			keyslots[count++] = i;
+	}
+
+	if (!count)
+		return 0;
+
+	r = LUKS2_device_write_lock(cd, hdr, device);
+	if (r)
+		return r;
+
+	for (i = 0, j = 0; i < count; i++) {
+		r = LUKS2_keyslot_area(hdr, keyslots[i], &extents[j].offset, &extents[j].length);
+		if (r == -ENOENT)
+			continue;
+		if (r)
+			goto out;
+		j++;
+	}
+
+	qsort(extents, j, sizeof(*extents), keyslot_extent_cmp);
+
+	/* secure deletion of possible key material in keyslot areas */
+	for (i = 0; i < j; i++) {
+		while (i + 1 < j && extents[i].offset + extents[i].length == extents[i + 1].offset) {
+			extents[i + 1].offset = extents[i].offset;
+			extents[i + 1].length += extents[i].length;
+			i++;
+		}
+
+		log_dbg(cd, "Wiping keyslots area extent at offset %" PRIu64 ", length %" PRIu64 ".",
+			extents[i].offset, extents[i].length);
+
+		r = crypt_wipe_device(cd, device, CRYPT_WIPE_SPECIAL, extents[i].offset,
+				      extents[i].length, extents[i].length, NULL, NULL);
+		if (r) {
+			if (r == -EACCES) {
+				log_err(cd, _("Cannot write to device %s, permission denied."),
+					device_path(device));
+				r = -EINVAL;
+			} else
+				log_err(cd, _("Cannot wipe device %s."), device_path(device));
+			goto out;
+		}
+	}
+
+	for (i = 0; i < count; i++) {
+		h = LUKS2_keyslot_handler(cd, keyslots[i]);
+		if (h) {
+			r = h->wipe(cd, keyslots[i]);
+			if (r < 0)
+				goto out;
+		} else
+			log_dbg(cd, "Wiping keyslot %d without specific-slot handler loaded.", keyslots[i]);
+
+		json_object_object_del_by_uint(jobj_keyslots, keyslots[i]);
+	}
+
+	r = LUKS2_hdr_write(cd, hdr);
+out:
+	device_write_unlock(cd, device);
+	return r;
+}
+
 int LUKS2_keyslot_dump(struct crypt_device *cd, int keyslot)
 {
 	const keyslot_handler *h;
@@ -780,6 +1755,29 @@ int LUKS2_keyslot_priority_set(struct crypt_device *cd, struct luks2_hdr *hdr,
 	return commit ? LUKS2_hdr_write(cd, hdr) : 0;
 }
 
+int LUKS2_keyslot_hint_set(struct crypt_device *cd, struct luks2_hdr *hdr,
+			   int keyslot, const char *hint, int commit)
+{
+	char tag[LUKS2_KEYSLOT_HINT_BYTES * 2 + 1];
+	json_object *jobj_keyslot;
+	int r;
+
+	jobj_keyslot = LUKS2_get_keyslot_jobj(hdr, keyslot);
+	if (!jobj_keyslot)
+		return -EINVAL;
+
+	if (!hint)
+		json_object_object_del(jobj_keyslot, "hint");
+	else {
+		r = keyslot_hint_tag(jobj_keyslot, hint, tag);
+		if (r)
+			return r;
+		json_object_object_add(jobj_keyslot, "hint", json_object_new_string(tag));
+	}
+
+	return commit ? LUKS2_hdr_write(cd, hdr) : 0;
+}
+
 int placeholder_keyslot_alloc(struct crypt_device *cd,
 	int keyslot,
 	uint64_t area_offset,
@@ -822,34 +1820,71 @@ int placeholder_keyslot_alloc(struct crypt_device *cd,
 	return 0;
 }
 
-static unsigned LUKS2_get_keyslot_digests_count(json_object *hdr_jobj, int keyslot)
+/*
+ * Count digests assigned to every keyslot in one pass over digests
+ * (a keyslot listed more times in one digest is counted once).
+ * Searching all digests for every keyslot is quadratic in header size.
+ */
+static json_object *LUKS2_keyslots_digests_count(json_object *hdr_jobj)
 {
-	char num[16];
-	json_object *jobj_digests, *jobj_keyslots;
-	unsigned count = 0;
+	json_object *jobj_digests, *jobj_keyslots, *jobj_counts, *jobj_seen, *jobj_count;
+	const char *num;
+	int i, length;
 
-	if (!json_object_object_get_ex(hdr_jobj, "digests", &jobj_digests))
-		return 0;
+	if (!(jobj_counts = json_object_new_object()))
+		return NULL;
 
-	if (snprintf(num, sizeof(num), "%u", keyslot) < 0)
-		return 0;
+	if (!json_object_object_get_ex(hdr_jobj, "digests", &jobj_digests))
+		return jobj_counts;
 
 	json_object_object_foreach(jobj_digests, key, val) {
 		UNUSED(key);
-		json_object_object_get_ex(val, "keyslots", &jobj_keyslots);
-		if (LUKS2_array_jobj(jobj_keyslots, num))
-			count++;
+		if (!json_object_object_get_ex(val, "keyslots", &jobj_keyslots))
+			continue;
+
+		if (!(jobj_seen = json_object_new_object())) {
+			json_object_put(jobj_counts);
+			return NULL;
+		}
+
+		length = (int) json_object_array_length(jobj_keyslots);
+		for (i = 0; i < length; i++) {
+			num = json_object_get_string(json_object_array_get_idx(jobj_keyslots, i));
+			if (!num || json_object_object_get_ex(jobj_seen, num, NULL))
+				continue;
+			json_object_object_add(jobj_seen, num, NULL);
+
+			if (json_object_object_get_ex(jobj_counts, num, &jobj_count))
+				json_object_object_add(jobj_counts, num,
+					json_object_new_int(json_object_get_int(jobj_count) + 1));
+			else
+				json_object_object_add(jobj_counts, num, json_object_new_int(1));
+		}
+
+		json_object_put(jobj_seen);
 	}
 
-	return count;
+	return jobj_counts;
+}
+
+static unsigned LUKS2_get_keyslot_digests_count(json_object *jobj_counts, int keyslot)
+{
+	char num[16];
+	json_object *jobj_count;
+
+	if (snprintf(num, sizeof(num), "%u", keyslot) < 0 ||
+	    !json_object_object_get_ex(jobj_counts, num, &jobj_count))
+		return 0;
+
+	return (unsigned) json_object_get_int(jobj_count);
 }
 
 /* run only on header that passed basic format validation */
 int LUKS2_keyslots_validate(struct crypt_device *cd, json_object *hdr_jobj)
 {
 	const keyslot_handler *h;
-	int keyslot;
-	json_object *jobj_keyslots, *jobj_type;
+	int keyslot, r = -EINVAL;
+	json_object *jobj_keyslots, *jobj_type, *jobj_counts;
 	uint32_t reqs, reencrypt_count = 0;
 	struct luks2_hdr dummy = {
 		.jobj = hdr_jobj
@@ -861,6 +1896,9 @@ int LUKS2_keyslots_validate(struct crypt_device *cd, json_object *hdr_jobj)
 	if (LUKS2_config_get_requirements(cd, &dummy, &reqs))
 		return -EINVAL;
 
+	if (!(jobj_counts = LUKS2_keyslots_digests_count(hdr_jobj)))
+		return -ENOMEM;
+
 	json_object_object_foreach(jobj_keyslots, slot, val) {
 		keyslot = atoi(slot);
 		json_object_object_get_ex(val, "type", &jobj_type);
@@ -869,12 +1907,12 @@ int LUKS2_keyslots_validate(struct crypt_device *cd, json_object *hdr_jobj)
 			continue;
 		if (h->validate && h->validate(cd, val)) {
 			log_dbg(cd, "Keyslot type %s validation failed on keyslot %d.", h->name, keyslot);
-			return -EINVAL;
+			goto out;
 		}
 
-		if (!strcmp(h->name, "luks2") && LUKS2_get_keyslot_digests_count(hdr_jobj, keyslot) != 1) {
+		if (!strcmp(h->name, "luks2") && LUKS2_get_keyslot_digests_count(jobj_counts, keyslot) != 1) {
 			log_dbg(cd, "Keyslot %d is not assigned to exactly 1 digest.", keyslot);
-			return -EINVAL;
+			goto out;
 		}
 
 		if (!strcmp(h->name, "reencrypt"))
@@ -883,20 +1921,23 @@ int LUKS2_keyslots_validate(struct crypt_device *cd, json_object *hdr_jobj)
 
 	if ((reqs & CRYPT_REQUIREMENT_ONLINE_REENCRYPT) && reencrypt_count == 0) {
 		log_dbg(cd, "Missing reencryption keyslot.");
-		return -EINVAL;
+		goto out;
 	}
 
 	if (reencrypt_count && !LUKS2_reencrypt_requirement_candidate(&dummy)) {
 		log_dbg(cd, "Missing reencryption requirement flag.");
-		return -EINVAL;
+		goto out;
 	}
 
 	if (reencrypt_count > 1) {
 		log_dbg(cd, "Too many reencryption keyslots.");
-		return -EINVAL;
+		goto out;
 	}
 
-	return 0;
+	r = 0;
+out:
+	json_object_put(jobj_counts);
+	return r;
 }
 
 void LUKS2_keyslots_repair(struct crypt_device *cd, json_object *jobj_keyslots)
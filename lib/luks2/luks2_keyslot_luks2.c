@@ -29,9 +29,6 @@
 #define LUKS_SLOT_ITERATIONS_MIN 1000
 #define LUKS_STRIPES 4000
 
-/* Serialize memory-hard keyslot access: optional workaround for parallel processing */
-#define MIN_MEMORY_FOR_SERIALIZE_LOCK_KB 32*1024 /* 32MB */
-
 /* coverity[ -taint_source : arg-0 ] */
 static int luks2_encrypt_to_storage(char *src, size_t srcLength,
 	const char *cipher, const char *cipher_mode,
@@ -65,7 +62,7 @@ static int luks2_encrypt_to_storage(char *src, size_t srcLength,
 
 	devfd = device_open_locked(cd, device, O_RDWR);
 	if (devfd >= 0) {
-		if (write_lseek_blockwise(devfd, device_block_size(cd, device),
+		if (pwrite_blockwise(devfd, device_block_size(cd, device),
 					  device_alignment(device), src,
 					  srcLength, sector * SECTOR_SIZE) < 0)
 			r = -EIO;
@@ -111,6 +108,11 @@ static int luks2_decrypt_from_storage(char *dst, size_t dstLength,
 		return r;
 	}
 
+	/* keyslot area may be already read ahead with other candidate keyslots */
+	if (!LUKS2_keyslot_area_prefetched(cd, crypt_get_hdr(cd, CRYPT_LUKS2),
+					   (uint64_t)sector * SECTOR_SIZE, dstLength, dst))
+		goto decrypt;
+
 	r = device_read_lock(cd, device);
 	if (r) {
 		log_err(cd, _("Failed to acquire read lock on device %s."),
@@ -121,7 +123,7 @@ static int luks2_decrypt_from_storage(char *dst, size_t dstLength,
 
 	devfd = device_open_locked(cd, device, O_RDONLY);
 	if (devfd >= 0) {
-		if (read_lseek_blockwise(devfd, device_block_size(cd, device),
+		if (pread_blockwise(devfd, device_block_size(cd, device),
 					 device_alignment(device), dst,
 					 dstLength, sector * SECTOR_SIZE) < 0)
 			r = -EIO;
@@ -132,6 +134,7 @@ static int luks2_decrypt_from_storage(char *dst, size_t dstLength,
 
 	device_read_unlock(cd, device);
 
+decrypt:
 	/* Decrypt buffer */
 	if (!r)
 		r = crypt_storage_decrypt(s, 0, dstLength, dst);
@@ -198,23 +201,21 @@ static int luks2_keyslot_get_pbkdf_params(json_object *jobj_keyslot,
 	return 0;
 }
 
-static int luks2_keyslot_set_key(struct crypt_device *cd,
+/* Split volume key and encrypt it to keyslot area with derived key */
+static int luks2_keyslot_split_key(struct crypt_device *cd,
 	json_object *jobj_keyslot,
-	const char *password, size_t passwordLen,
+	struct volume_key *derived_key,
 	const char *volume_key, size_t volume_key_len)
 {
-	struct volume_key *derived_key;
-	char *salt = NULL, cipher[MAX_CIPHER_LEN], cipher_mode[MAX_CIPHER_LEN];
+	char cipher[MAX_CIPHER_LEN], cipher_mode[MAX_CIPHER_LEN];
 	char *AfKey = NULL;
 	const char *af_hash = NULL;
-	size_t AFEKSize, keyslot_key_len;
-	json_object *jobj2, *jobj_kdf, *jobj_af, *jobj_area;
+	size_t AFEKSize;
+	json_object *jobj2, *jobj_af, *jobj_area;
 	uint64_t area_offset;
-	struct crypt_pbkdf_type pbkdf;
 	int r;
 
-	if (!json_object_object_get_ex(jobj_keyslot, "kdf", &jobj_kdf) ||
-	    !json_object_object_get_ex(jobj_keyslot, "af", &jobj_af) ||
+	if (!json_object_object_get_ex(jobj_keyslot, "af", &jobj_af) ||
 	    !json_object_object_get_ex(jobj_keyslot, "area", &jobj_area))
 		return -EINVAL;
 
@@ -234,14 +235,58 @@ static int luks2_keyslot_set_key(struct crypt_device *cd,
 	if (r < 0)
 		return r;
 
-	if (!json_object_object_get_ex(jobj_area, "key_size", &jobj2))
-		return -EINVAL;
-	keyslot_key_len = json_object_get_int(jobj2);
-
 	if (!json_object_object_get_ex(jobj_af, "hash", &jobj2))
 		return -EINVAL;
 	af_hash = json_object_get_string(jobj2);
 
+	// FIXME: verity key_size to AFEKSize
+	AFEKSize = AF_split_sectors(volume_key_len, LUKS_STRIPES) * SECTOR_SIZE;
+	AfKey = crypt_safe_alloc(AFEKSize);
+	if (!AfKey)
+		return -ENOMEM;
+
+	r = crypt_hash_size(af_hash);
+	if (r < 0)
+		log_err(cd, _("Hash algorithm %s is not available."), af_hash);
+	else
+		r = AF_split(cd, volume_key, AfKey, volume_key_len, LUKS_STRIPES, af_hash);
+
+	if (r == 0) {
+		log_dbg(cd, "Updating keyslot area [0x%04" PRIx64 "].", area_offset);
+		/* FIXME: sector_offset should be size_t, fix LUKS_encrypt... accordingly */
+		r = luks2_encrypt_to_storage(AfKey, AFEKSize, cipher, cipher_mode,
+				    derived_key, (unsigned)(area_offset / SECTOR_SIZE), cd);
+	}
+
+	crypt_safe_free(AfKey);
+	return r < 0 ? r : 0;
+}
+
+static int luks2_keyslot_set_key(struct crypt_device *cd,
+	json_object *jobj_keyslot,
+	const char *password, size_t passwordLen,
+	const char *volume_key, size_t volume_key_len)
+{
+	struct volume_key *derived_key;
+	char *salt = NULL;
+	size_t keyslot_key_len;
+	json_object *jobj2, *jobj_area;
+	struct crypt_pbkdf_type pbkdf;
+	int r;
+
+	if (!json_object_object_get_ex(jobj_keyslot, "area", &jobj_area))
+		return -EINVAL;
+
+	/* prevent accidental volume key size change after allocation */
+	if (!json_object_object_get_ex(jobj_keyslot, "key_size", &jobj2))
+		return -EINVAL;
+	if (json_object_get_int(jobj2) != (int)volume_key_len)
+		return -EINVAL;
+
+	if (!json_object_object_get_ex(jobj_area, "key_size", &jobj2))
+		return -EINVAL;
+	keyslot_key_len = json_object_get_int(jobj2);
+
 	r = luks2_keyslot_get_pbkdf_params(jobj_keyslot, &pbkdf, &salt);
 	if (r < 0)
 		return r;
@@ -258,6 +303,7 @@ static int luks2_keyslot_set_key(struct crypt_device *cd,
 	 * Calculate keyslot content, split and store it to keyslot area.
 	 */
 	log_dbg(cd, "Running keyslot key derivation.");
+	crypt_memory_kdf(cd, pbkdf.max_memory_kb);
 	r = crypt_pbkdf(pbkdf.type, pbkdf.hash, password, passwordLen,
 			salt, LUKS_SALTSIZE,
 			derived_key->key, derived_key->keylength,
@@ -272,50 +318,23 @@ static int luks2_keyslot_set_key(struct crypt_device *cd,
 		return r;
 	}
 
-	// FIXME: verity key_size to AFEKSize
-	AFEKSize = AF_split_sectors(volume_key_len, LUKS_STRIPES) * SECTOR_SIZE;
-	AfKey = crypt_safe_alloc(AFEKSize);
-	if (!AfKey) {
-		crypt_free_volume_key(derived_key);
-		return -ENOMEM;
-	}
-
-	r = crypt_hash_size(af_hash);
-	if (r < 0)
-		log_err(cd, _("Hash algorithm %s is not available."), af_hash);
-	else
-		r = AF_split(cd, volume_key, AfKey, volume_key_len, LUKS_STRIPES, af_hash);
+	r = luks2_keyslot_split_key(cd, jobj_keyslot, derived_key, volume_key, volume_key_len);
 
-	if (r == 0) {
-		log_dbg(cd, "Updating keyslot area [0x%04" PRIx64 "].", area_offset);
-		/* FIXME: sector_offset should be size_t, fix LUKS_encrypt... accordingly */
-		r = luks2_encrypt_to_storage(AfKey, AFEKSize, cipher, cipher_mode,
-				    derived_key, (unsigned)(area_offset / SECTOR_SIZE), cd);
-	}
-
-	crypt_safe_free(AfKey);
 	crypt_free_volume_key(derived_key);
-	if (r < 0)
-		return r;
-
-	return 0;
+	return r;
 }
 
-static int luks2_keyslot_get_key(struct crypt_device *cd,
+/* Decrypt keyslot area with derived key and merge volume key */
+static int luks2_keyslot_merge_key(struct crypt_device *cd,
 	json_object *jobj_keyslot,
-	const char *password, size_t passwordLen,
+	struct volume_key *derived_key,
 	char *volume_key, size_t volume_key_len)
 {
-	struct volume_key *derived_key = NULL;
-	struct crypt_pbkdf_type pbkdf;
-	char *AfKey = NULL;
-	size_t AFEKSize;
-	const char *af_hash = NULL;
-	char *salt = NULL, cipher[MAX_CIPHER_LEN], cipher_mode[MAX_CIPHER_LEN];
+	char *AfKey, cipher[MAX_CIPHER_LEN], cipher_mode[MAX_CIPHER_LEN];
 	json_object *jobj2, *jobj_af, *jobj_area;
+	const char *af_hash;
 	uint64_t area_offset;
-	size_t keyslot_key_len;
-	bool try_serialize_lock = false;
+	size_t AFEKSize;
 	int r;
 
 	if (!json_object_object_get_ex(jobj_keyslot, "af", &jobj_af) ||
@@ -336,69 +355,105 @@ static int luks2_keyslot_get_key(struct crypt_device *cd,
 	if (r < 0)
 		return r;
 
-	if (!json_object_object_get_ex(jobj_area, "key_size", &jobj2))
+	AFEKSize = AF_split_sectors(volume_key_len, LUKS_STRIPES) * SECTOR_SIZE;
+	AfKey = crypt_safe_alloc(AFEKSize);
+	if (!AfKey)
+		return -ENOMEM;
+
+	log_dbg(cd, "Reading keyslot area [0x%04" PRIx64 "].", area_offset);
+	/* FIXME: sector_offset should be size_t, fix LUKS_decrypt... accordingly */
+	r = luks2_decrypt_from_storage(AfKey, AFEKSize, cipher, cipher_mode,
+			      derived_key, (unsigned)(area_offset / SECTOR_SIZE), cd);
+
+	if (r == 0) {
+		r = crypt_hash_size(af_hash);
+		if (r < 0)
+			log_err(cd, _("Hash algorithm %s is not available."), af_hash);
+		else
+			r = AF_merge(AfKey, volume_key, volume_key_len, LUKS_STRIPES, af_hash);
+	}
+
+	crypt_safe_free(AfKey);
+	return r;
+}
+
+/* PBKDF parameters, salt and derived key storage of keyslot */
+static int luks2_keyslot_kdf_init(json_object *jobj_keyslot, struct luks2_keyslot_kdf *kdf)
+{
+	json_object *jobj2, *jobj_area;
+	size_t keyslot_key_len;
+	int r;
+
+	memset(kdf, 0, sizeof(*kdf));
+
+	if (!json_object_object_get_ex(jobj_keyslot, "area", &jobj_area) ||
+	    !json_object_object_get_ex(jobj_area, "key_size", &jobj2))
 		return -EINVAL;
 	keyslot_key_len = json_object_get_int(jobj2);
 
-	r = luks2_keyslot_get_pbkdf_params(jobj_keyslot, &pbkdf, &salt);
+	r = luks2_keyslot_get_pbkdf_params(jobj_keyslot, &kdf->pbkdf, &kdf->salt);
 	if (r < 0)
 		return r;
+	kdf->salt_length = LUKS_SALTSIZE;
 
-	/*
-	 * Allocate derived key storage space.
-	 */
-	derived_key = crypt_alloc_volume_key(keyslot_key_len, NULL);
-	if (!derived_key) {
-		r = -ENOMEM;
-		goto out;
+	kdf->derived_key = crypt_alloc_volume_key(keyslot_key_len, NULL);
+	if (!kdf->derived_key) {
+		free(kdf->salt);
+		kdf->salt = NULL;
+		return -ENOMEM;
 	}
 
-	AFEKSize = AF_split_sectors(volume_key_len, LUKS_STRIPES) * SECTOR_SIZE;
-	AfKey = crypt_safe_alloc(AFEKSize);
-	if (!AfKey) {
-		r = -ENOMEM;
-		goto out;
-	}
+	return 0;
+}
 
-	/*
-	 * If requested, serialize unlocking for memory-hard KDF. Usually NOOP.
-	 */
-	if (pbkdf.max_memory_kb > MIN_MEMORY_FOR_SERIALIZE_LOCK_KB)
-		try_serialize_lock = true;
-	if (try_serialize_lock && (r = crypt_serialize_lock(cd)))
-		goto out;
+static int luks2_keyslot_get_key(struct crypt_device *cd,
+	json_object *jobj_keyslot,
+	const char *password, size_t passwordLen,
+	char *volume_key, size_t volume_key_len)
+{
+	struct luks2_keyslot_kdf kdf;
+	bool try_serialize_lock = false;
+	int r;
+
+	r = luks2_keyslot_kdf_init(jobj_keyslot, &kdf);
+	if (r < 0)
+		return r;
 
 	/*
-	 * Calculate derived key, decrypt keyslot content and merge it.
+	 * Cloned keyslot unlocked by the same passphrase recently (if enabled).
 	 */
-	log_dbg(cd, "Running keyslot key derivation.");
-	r = crypt_pbkdf(pbkdf.type, pbkdf.hash, password, passwordLen,
-			salt, LUKS_SALTSIZE,
-			derived_key->key, derived_key->keylength,
-			pbkdf.iterations, pbkdf.max_memory_kb,
-			pbkdf.parallel_threads);
-
-	if (try_serialize_lock)
-		crypt_serialize_unlock(cd);
-
-	if (r == 0) {
-		log_dbg(cd, "Reading keyslot area [0x%04" PRIx64 "].", area_offset);
-		/* FIXME: sector_offset should be size_t, fix LUKS_decrypt... accordingly */
-		r = luks2_decrypt_from_storage(AfKey, AFEKSize, cipher, cipher_mode,
-				      derived_key, (unsigned)(area_offset / SECTOR_SIZE), cd);
+	r = crypt_derived_key_cache_get(cd, kdf.pbkdf.type, kdf.pbkdf.hash, password, passwordLen,
+			kdf.salt, kdf.salt_length, kdf.derived_key->key, kdf.derived_key->keylength,
+			kdf.pbkdf.iterations, kdf.pbkdf.max_memory_kb, kdf.pbkdf.parallel_threads);
+	if (r == -ENOENT) {
+		/*
+		 * If requested, serialize unlocking for memory-hard KDF. Usually NOOP.
+		 */
+		if (kdf.pbkdf.max_memory_kb > MIN_MEMORY_FOR_SERIALIZE_LOCK_KB)
+			try_serialize_lock = true;
+		if (try_serialize_lock && (r = crypt_serialize_lock(cd, kdf.pbkdf.max_memory_kb)))
+			goto out;
+
+		/*
+		 * Calculate derived key, decrypt keyslot content and merge it.
+		 */
+		log_dbg(cd, "Running keyslot key derivation.");
+		crypt_memory_kdf(cd, kdf.pbkdf.max_memory_kb);
+		r = LUKS2_keyslot_kdf_run(&kdf, password, passwordLen);
+
+		if (try_serialize_lock)
+			crypt_serialize_unlock(cd);
+
+		if (!r)
+			crypt_derived_key_cache_put(cd, kdf.pbkdf.type, kdf.pbkdf.hash, password, passwordLen,
+				kdf.salt, kdf.salt_length, kdf.derived_key->key, kdf.derived_key->keylength,
+				kdf.pbkdf.iterations, kdf.pbkdf.max_memory_kb, kdf.pbkdf.parallel_threads);
 	}
 
-	if (r == 0) {
-		r = crypt_hash_size(af_hash);
-		if (r < 0)
-			log_err(cd, _("Hash algorithm %s is not available."), af_hash);
-		else
-			r = AF_merge(AfKey, volume_key, volume_key_len, LUKS_STRIPES, af_hash);
-	}
+	if (r == 0)
+		r = luks2_keyslot_merge_key(cd, jobj_keyslot, kdf.derived_key, volume_key, volume_key_len);
 out:
-	free(salt);
-	crypt_free_volume_key(derived_key);
-	crypt_safe_free(AfKey);
+	LUKS2_keyslot_kdf_free(&kdf);
 
 	return r;
 }
@@ -567,6 +622,36 @@ static int luks2_keyslot_open(struct crypt_device *cd,
 				     volume_key, volume_key_len);
 }
 
+static int luks2_keyslot_kdf(struct crypt_device *cd,
+	int keyslot,
+	struct luks2_keyslot_kdf *kdf)
+{
+	json_object *jobj_keyslot;
+
+	jobj_keyslot = LUKS2_get_keyslot_jobj(crypt_get_hdr(cd, CRYPT_LUKS2), keyslot);
+	if (!jobj_keyslot)
+		return -EINVAL;
+
+	return luks2_keyslot_kdf_init(jobj_keyslot, kdf);
+}
+
+static int luks2_keyslot_open_derived(struct crypt_device *cd,
+	int keyslot,
+	struct volume_key *derived_key,
+	char *volume_key,
+	size_t volume_key_len)
+{
+	json_object *jobj_keyslot;
+
+	log_dbg(cd, "Opening LUKS2 keyslot %d with derived key.", keyslot);
+
+	jobj_keyslot = LUKS2_get_keyslot_jobj(crypt_get_hdr(cd, CRYPT_LUKS2), keyslot);
+	if (!jobj_keyslot)
+		return -EINVAL;
+
+	return luks2_keyslot_merge_key(cd, jobj_keyslot, derived_key, volume_key, volume_key_len);
+}
+
 /*
  * This function must not modify json.
  * It's called after luks2 keyslot validation.
@@ -606,6 +691,27 @@ static int luks2_keyslot_store(struct crypt_device *cd,
 	return r < 0 ? r : keyslot;
 }
 
+/*
+ * This function must not modify json.
+ * Metadata device write lock is held and header is committed by caller.
+ */
+static int luks2_keyslot_store_derived(struct crypt_device *cd,
+	int keyslot,
+	struct volume_key *derived_key,
+	const char *volume_key,
+	size_t volume_key_len)
+{
+	json_object *jobj_keyslot;
+
+	log_dbg(cd, "Storing LUKS2 keyslot %d with derived key.", keyslot);
+
+	jobj_keyslot = LUKS2_get_keyslot_jobj(crypt_get_hdr(cd, CRYPT_LUKS2), keyslot);
+	if (!jobj_keyslot)
+		return -EINVAL;
+
+	return luks2_keyslot_split_key(cd, jobj_keyslot, derived_key, volume_key, volume_key_len);
+}
+
 static int luks2_keyslot_wipe(struct crypt_device *cd, int keyslot)
 {
 	struct luks2_hdr *hdr;
@@ -817,5 +923,8 @@ const keyslot_handler luks2_keyslot = {
 	.wipe  = luks2_keyslot_wipe,
 	.dump  = luks2_keyslot_dump,
 	.validate = luks2_keyslot_validate,
-	.repair = luks2_keyslot_repair
+	.repair = luks2_keyslot_repair,
+	.kdf   = luks2_keyslot_kdf,
+	.open_derived = luks2_keyslot_open_derived,
+	.store_derived = luks2_keyslot_store_derived
 };
@@ -179,7 +179,7 @@ static int reenc_keyslot_store_data(struct crypt_device *cd,
 
 	devfd = device_open_locked(cd, device, O_RDWR);
 	if (devfd >= 0) {
-		if (write_lseek_blockwise(devfd, device_block_size(cd, device),
+		if (pwrite_blockwise(devfd, device_block_size(cd, device),
 					  device_alignment(device), CONST_CAST(void *)buffer,
 					  buffer_len, area_offset) < 0)
 			r = -EIO;
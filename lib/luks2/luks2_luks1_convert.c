@@ -460,6 +460,7 @@ static int move_keyslot_areas(struct crypt_device *cd, off_t offset_from,
 {
 	int devfd, r = -EIO;
 	struct device *device = crypt_metadata_device(cd);
+	size_t probe_size;
 	void *buf = NULL;
 
 	log_dbg(cd, "Moving keyslot areas of size %zu from %jd to %jd.",
@@ -478,18 +479,22 @@ static int move_keyslot_areas(struct crypt_device *cd, off_t offset_from,
 	if (posix_fallocate(devfd, offset_to, buf_size))
 		log_dbg(cd, "Preallocation (fallocate) of new keyslot area not available.");
 
-	/* Try to read *new* area to check that area is there (trimmed backup). */
-	if (read_lseek_blockwise(devfd, device_block_size(cd, device),
-				 device_alignment(device), buf, buf_size,
-				 offset_to)!= (ssize_t)buf_size)
+	/*
+	 * Try to read end of *new* area to check that area is there (trimmed backup).
+	 * Reading the last block is enough, the whole area is overwritten below.
+	 */
+	probe_size = MIN(buf_size, (size_t)device_block_size(cd, device));
+	if (pread_blockwise(devfd, device_block_size(cd, device),
+				 device_alignment(device), buf, probe_size,
+				 offset_to + buf_size - probe_size) != (ssize_t)probe_size)
 		goto out;
 
-	if (read_lseek_blockwise(devfd, device_block_size(cd, device),
+	if (pread_blockwise(devfd, device_block_size(cd, device),
 				 device_alignment(device), buf, buf_size,
 				 offset_from)!= (ssize_t)buf_size)
 		goto out;
 
-	if (write_lseek_blockwise(devfd, device_block_size(cd, device),
+	if (pwrite_blockwise(devfd, device_block_size(cd, device),
 				  device_alignment(device), buf, buf_size,
 				  offset_to) != (ssize_t)buf_size)
 		goto out;
@@ -532,7 +537,7 @@ static int luksmeta_header_present(struct crypt_device *cd, off_t luks1_size)
 	}
 
 	/* Note: we must not detect failure as problem here, header can be trimmed. */
-	if (read_lseek_blockwise(devfd, device_block_size(cd, device), device_alignment(device),
+	if (pread_blockwise(devfd, device_block_size(cd, device), device_alignment(device),
 		buf, sizeof(LM_MAGIC), luks1_size) == (ssize_t)sizeof(LM_MAGIC) &&
 		!memcmp(LM_MAGIC, buf, sizeof(LM_MAGIC))) {
 			log_err(cd, _("Unable to convert header with LUKSMETA additional metadata."));
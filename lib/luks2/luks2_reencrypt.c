@@ -19,9 +19,22 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <pthread.h>
+#include <time.h>
 #include "luks2_internal.h"
 #include "utils_device_locking.h"
 
+/* Next hotzone read in background while current hotzone is written */
+struct reencrypt_prefetch {
+	pthread_t thread;
+	bool running;
+	struct crypt_storage_wrapper *cw;
+	void *buffer;
+	uint64_t offset;
+	uint64_t length;
+	ssize_t read;
+};
+
 struct luks2_reencrypt {
 	/* reencryption window attributes */
 	uint64_t offset;
@@ -58,8 +71,35 @@ struct luks2_reencrypt {
 	struct volume_key *vks;
 
 	void *reenc_buffer;
+	size_t reenc_buffer_length;
 	ssize_t read;
 
+	struct reencrypt_prefetch prefetch;
+
+	/* adaptive hotzone length (online reencryption only) */
+	uint32_t latency_target_ms;
+	uint64_t max_length;
+	size_t alignment;
+	uint64_t suspended_us;
+	uint64_t io_us;
+
+	/* I/O throttle */
+	struct crypt_params_reencrypt_throttle throttle;
+	int64_t tb_bytes;
+	int64_t tb_ios;
+	uint64_t tb_time_us;
+	uint64_t stat_ios;
+	uint64_t stat_ticks;
+	bool stat_valid;
+
+	/* skip (and discard) unallocated hotzones */
+	uint32_t sparse_flags;
+
+	/* per step statistics */
+	struct crypt_reencrypt_stats stats;
+	void (*stats_cb)(const struct crypt_reencrypt_stats *stats, void *usrptr);
+	void *stats_usrptr;
+
 	struct crypt_storage_wrapper *cw1;
 	struct crypt_storage_wrapper *cw2;
 
@@ -161,6 +201,12 @@ static uint64_t reencrypt_get_data_offset_old(struct luks2_hdr *hdr)
 {
 	return reencrypt_data_offset(hdr, 0);
 }
+
+/* Non-zero only for adopted foreign formats with IV counted from device start */
+static uint64_t reencrypt_get_iv_tweak_old(struct luks2_hdr *hdr)
+{
+	return json_segment_get_iv_offset(reencrypt_segment_old(hdr));
+}
 #endif
 static int reencrypt_digest(struct luks2_hdr *hdr, unsigned new)
 {
@@ -469,7 +515,7 @@ static json_object *reencrypt_make_segment_old(struct crypt_device *cd,
 	case CRYPT_REENCRYPT_REENCRYPT:
 	case CRYPT_REENCRYPT_DECRYPT:
 		jobj_old_seg = json_segment_create_crypt(data_offset + segment_offset,
-						    crypt_get_iv_offset(cd) + (segment_offset >> SECTOR_SHIFT),
+						    reencrypt_get_iv_tweak_old(hdr) + (segment_offset >> SECTOR_SHIFT),
 						    segment_length,
 						    reencrypt_segment_cipher_old(hdr),
 						    reencrypt_get_sector_size_old(hdr),
@@ -811,13 +857,31 @@ void LUKS2_reencrypt_protection_erase(struct reenc_protection *rp)
 	}
 }
 
+/* Checksum buffers are accounted in context, erase has none */
+static void reencrypt_protection_free(struct crypt_device *cd, struct reenc_protection *rp)
+{
+	if (rp->type == REENC_PROTECTION_CHECKSUM && rp->p.csum.checksums)
+		crypt_memory_io_put(cd, rp->p.csum.checksums_len);
+
+	LUKS2_reencrypt_protection_erase(rp);
+}
+
+static void reencrypt_prefetch_wait(struct luks2_reencrypt *rh)
+{
+	if (!rh->prefetch.running)
+		return;
+
+	pthread_join(rh->prefetch.thread, NULL);
+	rh->prefetch.running = false;
+}
+
 void LUKS2_reencrypt_free(struct crypt_device *cd, struct luks2_reencrypt *rh)
 {
 	if (!rh)
 		return;
 
-	LUKS2_reencrypt_protection_erase(&rh->rp);
-	LUKS2_reencrypt_protection_erase(&rh->rp_moved_segment);
+	reencrypt_protection_free(cd, &rh->rp);
+	reencrypt_protection_free(cd, &rh->rp_moved_segment);
 
 	json_object_put(rh->jobj_segs_hot);
 	rh->jobj_segs_hot = NULL;
@@ -830,6 +894,14 @@ void LUKS2_reencrypt_free(struct crypt_device *cd, struct luks2_reencrypt *rh)
 	json_object_put(rh->jobj_segment_moved);
 	rh->jobj_segment_moved = NULL;
 
+	reencrypt_prefetch_wait(rh);
+	if (rh->prefetch.buffer)
+		crypt_memory_io_put(cd, rh->reenc_buffer_length);
+	free(rh->prefetch.buffer);
+	rh->prefetch.buffer = NULL;
+
+	if (rh->reenc_buffer)
+		crypt_memory_io_put(cd, rh->reenc_buffer_length);
 	free(rh->reenc_buffer);
 	rh->reenc_buffer = NULL;
 	crypt_storage_wrapper_destroy(rh->cw1);
@@ -1212,6 +1284,8 @@ static int reencrypt_context_init(struct crypt_device *cd,
 	log_dbg(cd, "reencrypt progress: %" PRIu64, rh->progress);
 
 	rh->device_size = device_size;
+	rh->max_length = rh->length;
+	rh->alignment = alignment;
 
 	return rh->length < 512 ? -EINVAL : 0;
 }
@@ -1242,11 +1316,15 @@ static int reencrypt_load_clean(struct crypt_device *cd,
 	if (r)
 		goto err;
 
+	tmp->reenc_buffer_length = reencrypt_buffer_length(tmp);
 	if (posix_memalign(&tmp->reenc_buffer, device_alignment(crypt_data_device(cd)),
-			   reencrypt_buffer_length(tmp))) {
+			   tmp->reenc_buffer_length)) {
 		r = -ENOMEM;
 		goto err;
 	}
+	crypt_memory_io_get(cd, tmp->reenc_buffer_length);
+	crypt_numa_bind_buffer(tmp->reenc_buffer, tmp->reenc_buffer_length,
+			       crypt_dev_numa_node(device_path(crypt_data_device(cd))));
 
 	*rh = tmp;
 
@@ -1351,12 +1429,12 @@ static int reencrypt_init_storage_wrappers(struct crypt_device *cd,
 {
 	int r;
 	struct volume_key *vk;
-	uint32_t wrapper_flags = (getuid() || geteuid()) ? 0 : DISABLE_KCAPI;
+	uint32_t wrapper_flags = ((getuid() || geteuid()) ? 0 : DISABLE_KCAPI) | USE_IO_URING;
 
 	vk = crypt_volume_key_by_id(vks, rh->digest_old);
 	r = crypt_storage_wrapper_init(cd, &rh->cw1, crypt_data_device(cd),
 			reencrypt_get_data_offset_old(hdr),
-			crypt_get_iv_offset(cd),
+			reencrypt_get_iv_tweak_old(hdr),
 			reencrypt_get_sector_size_old(hdr),
 			reencrypt_segment_cipher_old(hdr),
 			vk, wrapper_flags | OPEN_READONLY);
@@ -1381,6 +1459,10 @@ static int reencrypt_init_storage_wrappers(struct crypt_device *cd,
 	rh->wflags2 = wrapper_flags;
 	log_dbg(cd, "New cipher storage wrapper type: %d", crypt_storage_wrapper_get_type(rh->cw2));
 
+	/* optional, fails if io_uring is not used */
+	(void)crypt_storage_wrapper_register_buffer(rh->cw1, rh->reenc_buffer, rh->reenc_buffer_length);
+	(void)crypt_storage_wrapper_register_buffer(rh->cw2, rh->reenc_buffer, rh->reenc_buffer_length);
+
 	return 0;
 }
 
@@ -1466,6 +1548,7 @@ static int reencrypt_hotzone_protect_ready(struct crypt_device *cd,
 		if (posix_memalign(&rp->p.csum.checksums, device_alignment(crypt_metadata_device(cd)),
 				   rp->p.csum.checksums_len))
 			return -ENOMEM;
+		crypt_memory_io_get(cd, rp->p.csum.checksums_len);
 	}
 
 	return 0;
@@ -1477,11 +1560,11 @@ static int reencrypt_recover_segment(struct crypt_device *cd,
 	struct volume_key *vks)
 {
 	struct volume_key *vk_old, *vk_new;
-	size_t count, s;
+	size_t count, s, run, run_offset, run_length;
 	ssize_t read, w;
 	struct reenc_protection *rp;
 	int devfd, r, new_sector_size, old_sector_size, rseg;
-	uint64_t area_offset, area_length, area_length_read, crash_iv_offset,
+	uint64_t area_offset, area_length, area_length_read, crash_iv_offset, crash_iv_offset_old,
 		 data_offset = crypt_get_data_offset(cd) << SECTOR_SHIFT;
 	char *checksum_tmp = NULL, *data_buffer = NULL;
 	struct crypt_storage_wrapper *cw1 = NULL, *cw2 = NULL;
@@ -1515,9 +1598,10 @@ static int reencrypt_recover_segment(struct crypt_device *cd,
 	old_sector_size = json_segment_get_sector_size(reencrypt_segment_old(hdr));
 	new_sector_size = json_segment_get_sector_size(reencrypt_segment_new(hdr));
 	if (rh->mode == CRYPT_REENCRYPT_DECRYPT)
-		crash_iv_offset = rh->offset >> SECTOR_SHIFT; /* TODO: + old iv_tweak */
+		crash_iv_offset = rh->offset >> SECTOR_SHIFT;
 	else
 		crash_iv_offset = json_segment_get_iv_offset(json_segments_get_segment(rh->jobj_segs_hot, rseg));
+	crash_iv_offset_old = reencrypt_get_iv_tweak_old(hdr) + (rh->offset >> SECTOR_SHIFT);
 
 	log_dbg(cd, "crash_offset: %" PRIu64 ", crash_length: %" PRIu64 ",  crash_iv_offset: %" PRIu64,
 		data_offset + rh->offset, rh->length, crash_iv_offset);
@@ -1539,13 +1623,14 @@ static int reencrypt_recover_segment(struct crypt_device *cd,
 		r = -ENOMEM;
 		goto out;
 	}
+	crypt_memory_io_get(cd, rh->length);
 
 	switch (rp->type) {
 	case  REENC_PROTECTION_CHECKSUM:
 		log_dbg(cd, "Checksums based recovery.");
 
 		r = crypt_storage_wrapper_init(cd, &cw1, crypt_data_device(cd),
-				data_offset + rh->offset, crash_iv_offset, old_sector_size,
+				data_offset + rh->offset, crash_iv_offset_old, old_sector_size,
 				reencrypt_segment_cipher_old(hdr), vk_old, 0);
 		if (r) {
 			log_err(cd, _("Failed to initialize old segment storage wrapper."));
@@ -1560,11 +1645,12 @@ static int reencrypt_recover_segment(struct crypt_device *cd,
 			goto out;
 		}
 
-		checksum_tmp = malloc(rp->p.csum.hash_size);
+		checksum_tmp = malloc(area_length_read);
 		if (!checksum_tmp) {
 			r = -ENOMEM;
 			goto out;
 		}
+		crypt_memory_io_get(cd, area_length_read);
 
 		/* TODO: lock for read */
 		devfd = device_open(cd, crypt_metadata_device(cd), O_RDONLY);
@@ -1572,7 +1658,7 @@ static int reencrypt_recover_segment(struct crypt_device *cd,
 			goto out;
 
 		/* read old data checksums */
-		read = read_lseek_blockwise(devfd, device_block_size(cd, crypt_metadata_device(cd)),
+		read = pread_blockwise(devfd, device_block_size(cd, crypt_metadata_device(cd)),
 					device_alignment(crypt_metadata_device(cd)), rp->p.csum.checksums, area_length_read, area_offset);
 		if (read < 0 || (size_t)read != area_length_read) {
 			log_err(cd, _("Failed to read checksums for current hotzone."));
@@ -1587,30 +1673,55 @@ static int reencrypt_recover_segment(struct crypt_device *cd,
 			goto out;
 		}
 
-		for (s = 0; s < count; s++) {
-			if (crypt_hash_write(rp->p.csum.ch, data_buffer + (s * rp->p.csum.block_size), rp->p.csum.block_size)) {
-				log_dbg(cd, "Failed to write hash.");
-				r = EINVAL;
-				goto out;
-			}
-			if (crypt_hash_final(rp->p.csum.ch, checksum_tmp, rp->p.csum.hash_size)) {
-				log_dbg(cd, "Failed to finalize hash.");
-				r = EINVAL;
-				goto out;
+		if (crypt_hash_blocks(rp->p.csum.hash, crypt_cpusonline(), data_buffer, count * rp->p.csum.block_size,
+				      rp->p.csum.block_size, checksum_tmp, rp->p.csum.hash_size)) {
+			log_dbg(cd, "Failed to hash hotzone blocks.");
+			r = -EINVAL;
+			goto out;
+		}
+
+		/*
+		 * Blocks still matching old checksums need recovery. Process contiguous
+		 * runs of them at once, so the parallel cipher and a single write
+		 * are used instead of one block per call.
+		 */
+		for (s = 0; s < count; s = run) {
+			if (memcmp(checksum_tmp + (s * rp->p.csum.hash_size), (char *)rp->p.csum.checksums + (s * rp->p.csum.hash_size), rp->p.csum.hash_size)) {
+				run = s + 1;
+				continue;
 			}
-			if (!memcmp(checksum_tmp, (char *)rp->p.csum.checksums + (s * rp->p.csum.hash_size), rp->p.csum.hash_size)) {
-				log_dbg(cd, "Sector %zu (size %zu, offset %zu) needs recovery", s, rp->p.csum.block_size, s * rp->p.csum.block_size);
-				if (crypt_storage_wrapper_decrypt(cw1, s * rp->p.csum.block_size, data_buffer + (s * rp->p.csum.block_size), rp->p.csum.block_size)) {
+
+			for (run = s + 1; run < count; run++)
+				if (memcmp(checksum_tmp + (run * rp->p.csum.hash_size), (char *)rp->p.csum.checksums + (run * rp->p.csum.hash_size), rp->p.csum.hash_size))
+					break;
+
+			run_offset = s * rp->p.csum.block_size;
+			run_length = (run - s) * rp->p.csum.block_size;
+			log_dbg(cd, "Sectors %zu-%zu (size %zu, offset %zu) need recovery", s, run - 1, rp->p.csum.block_size, run_offset);
+
+			r = crypt_storage_wrapper_reencrypt(cw1, cw2, run_offset, data_buffer + run_offset, run_length);
+			if (!r)
+				w = crypt_storage_wrapper_write(cw2, run_offset, data_buffer + run_offset, run_length);
+			else if (r == -ENOTSUP) {
+				if (crypt_storage_wrapper_decrypt(cw1, run_offset, data_buffer + run_offset, run_length)) {
 					log_err(cd, _("Failed to decrypt sector %zu."), s);
+					crypt_safe_memzero(data_buffer + run_offset, run_length);
 					r = -EINVAL;
 					goto out;
 				}
-				w = crypt_storage_wrapper_encrypt_write(cw2, s * rp->p.csum.block_size, data_buffer + (s * rp->p.csum.block_size), rp->p.csum.block_size);
-				if (w < 0 || (size_t)w != rp->p.csum.block_size) {
-					log_err(cd, _("Failed to recover sector %zu."), s);
-					r = -EINVAL;
-					goto out;
-				}
+				w = crypt_storage_wrapper_encrypt_write(cw2, run_offset, data_buffer + run_offset, run_length);
+			} else {
+				log_err(cd, _("Failed to decrypt sector %zu."), s);
+				r = -EINVAL;
+				goto out;
+			}
+
+			if (w < 0 || (size_t)w != run_length) {
+				log_err(cd, _("Failed to recover sector %zu."), s);
+				/* may content plaintext */
+				crypt_safe_memzero(data_buffer + run_offset, run_length);
+				r = -EINVAL;
+				goto out;
 			}
 		}
 
@@ -1628,7 +1739,7 @@ static int reencrypt_recover_segment(struct crypt_device *cd,
 
 		/* TODO locking */
 		r = crypt_storage_wrapper_init(cd, &cw1, crypt_metadata_device(cd),
-				area_offset, crash_iv_offset, old_sector_size,
+				area_offset, crash_iv_offset_old, old_sector_size,
 				reencrypt_segment_cipher_old(hdr), vk_old, 0);
 		if (r) {
 			log_err(cd, _("Failed to initialize old segment storage wrapper."));
@@ -1668,7 +1779,7 @@ static int reencrypt_recover_segment(struct crypt_device *cd,
 				data_offset = data_offset + rh->offset - data_shift_value(rp);
 			r = crypt_storage_wrapper_init(cd, &cw1, crypt_data_device(cd),
 					data_offset,
-					crash_iv_offset,
+					crash_iv_offset_old,
 					reencrypt_get_sector_size_old(hdr),
 					reencrypt_segment_cipher_old(hdr), vk_old, 0);
 		}
@@ -1703,6 +1814,10 @@ static int reencrypt_recover_segment(struct crypt_device *cd,
 	if (!r)
 		rh->read = rh->length;
 out:
+	if (data_buffer)
+		crypt_memory_io_put(cd, rh->length);
+	if (checksum_tmp)
+		crypt_memory_io_put(cd, area_length_read);
 	free(data_buffer);
 	free(checksum_tmp);
 	crypt_storage_wrapper_destroy(cw1);
@@ -2371,54 +2486,139 @@ static int reencrypt_refresh_overlay_devices(struct crypt_device *cd,
 	return REENC_OK;
 }
 
+/* Moved segment is copied in chunks of this size */
+#define REENCRYPT_MOVE_CHUNK (4 * 1024 * 1024)
+
+struct reencrypt_move_read {
+	pthread_t thread;
+	int devfd;
+	size_t bsize;
+	size_t alignment;
+	void *buffer;
+	size_t length;
+	uint64_t offset;
+	ssize_t read;
+};
+
+static void *reencrypt_move_read_thread(void *arg)
+{
+	struct reencrypt_move_read *mr = arg;
+
+	mr->read = pread_blockwise(mr->devfd, mr->bsize, mr->alignment,
+					mr->buffer, mr->length, mr->offset);
+	return NULL;
+}
+
+/*
+ * Copy the first segment to its new offset in chunks, the next chunk is read
+ * (through separate read-only fd) while the current one is written. Without
+ * the read-only fd, chunks are read and written sequentially.
+ * Chunks are processed in memmove() order, so even overlapping source
+ * and destination areas are handled properly.
+ */
 static int reencrypt_move_data(struct crypt_device *cd,
 	int devfd,
 	uint64_t data_shift,
 	crypt_reencrypt_mode_info mode)
 {
-	void *buffer;
-	int r;
+	void *buffer[2] = {};
+	int r, ro_fd, cur = 0;
 	ssize_t ret;
-	uint64_t buffer_len, offset,
+	size_t len;
+	bool backward, threaded;
+	uint64_t buffer_len, offset, pos, k, count, chunk,
 		 read_offset = (mode == CRYPT_REENCRYPT_ENCRYPT ? 0 : data_shift);
 	struct luks2_hdr *hdr = crypt_get_hdr(cd, CRYPT_LUKS2);
+	struct reencrypt_move_read mr = {
+		.bsize = device_block_size(cd, crypt_data_device(cd)),
+		.alignment = device_alignment(crypt_data_device(cd))
+	};
 
 	offset = json_segment_get_offset(LUKS2_get_segment_jobj(hdr, 0), 0);
 	buffer_len = json_segment_get_size(LUKS2_get_segment_jobj(hdr, 0), 0);
 	if (!buffer_len || buffer_len > data_shift)
 		return -EINVAL;
 
-	if (posix_memalign(&buffer, device_alignment(crypt_data_device(cd)), buffer_len))
-		return -ENOMEM;
+	chunk = buffer_len < REENCRYPT_MOVE_CHUNK ? buffer_len : REENCRYPT_MOVE_CHUNK;
+	count = (buffer_len + chunk - 1) / chunk;
+	backward = offset > read_offset;
 
-	ret = read_lseek_blockwise(devfd,
-			device_block_size(cd, crypt_data_device(cd)),
-			device_alignment(crypt_data_device(cd)),
-			buffer, buffer_len, read_offset);
-	if (ret < 0 || (uint64_t)ret != buffer_len) {
-		log_dbg(cd, "Failed to read data at offset %" PRIu64 " (size: %zu)",
-			read_offset, buffer_len);
-		r = -EIO;
+	if (posix_memalign(&buffer[0], mr.alignment, chunk) ||
+	    (count > 1 && posix_memalign(&buffer[1], mr.alignment, chunk))) {
+		r = -ENOMEM;
 		goto out;
 	}
+	crypt_memory_io_get(cd, count > 1 ? 2 * chunk : chunk);
 
-	log_dbg(cd, "Going to write %" PRIu64 " bytes read at offset %" PRIu64 " to new offset %" PRIu64,
-		buffer_len, read_offset, offset);
-	ret = write_lseek_blockwise(devfd,
-			device_block_size(cd, crypt_data_device(cd)),
-			device_alignment(crypt_data_device(cd)),
-			buffer, buffer_len, offset);
-	if (ret < 0 || (uint64_t)ret != buffer_len) {
-		log_dbg(cd, "Failed to write data at offset %" PRIu64 " (size: %zu)",
-			offset, buffer_len);
-		r = -EIO;
-		goto out;
+	ro_fd = device_open(cd, crypt_data_device(cd), O_RDONLY);
+	mr.devfd = ro_fd < 0 ? devfd : ro_fd;
+
+	log_dbg(cd, "Going to move %" PRIu64 " bytes from offset %" PRIu64 " to new offset %" PRIu64
+		" in %" PRIu64 " chunk(s).", buffer_len, read_offset, offset, count);
+
+	/* first chunk */
+	pos = backward ? (count - 1) * chunk : 0;
+	mr.buffer = buffer[cur];
+	mr.offset = read_offset + pos;
+	mr.length = buffer_len - pos < chunk ? buffer_len - pos : chunk;
+	(void)reencrypt_move_read_thread(&mr);
+
+	for (k = 0; k < count; k++) {
+		if (mr.read < 0 || (size_t)mr.read != mr.length) {
+			log_dbg(cd, "Failed to read data at offset %" PRIu64 " (size: %zu)",
+				mr.offset, mr.length);
+			r = -EIO;
+			goto out;
+		}
+
+		/* issue read of next chunk before writing current one */
+		pos = mr.offset - read_offset;
+		len = mr.length;
+		threaded = false;
+		if (k + 1 < count) {
+			mr.buffer = buffer[1 - cur];
+			mr.offset = read_offset + (backward ? pos - chunk : pos + chunk);
+			mr.length = buffer_len - (mr.offset - read_offset) < chunk ?
+				    buffer_len - (mr.offset - read_offset) : chunk;
+			/*
+			 * Source and destination areas of reads must not be written yet.
+			 * Blockwise I/O may seek, the shared rw fd fallback is not threaded.
+			 */
+			threaded = ro_fd >= 0 && (backward ? mr.offset + mr.length <= offset + pos :
+							   mr.offset >= offset + pos + chunk) &&
+				   !pthread_create(&mr.thread, NULL, reencrypt_move_read_thread, &mr);
+		}
+
+		ret = pwrite_blockwise(devfd, mr.bsize, mr.alignment, buffer[cur], len, offset + pos);
+
+		if (threaded)
+			pthread_join(mr.thread, NULL);
+
+		if (ret < 0 || (size_t)ret != len) {
+			log_dbg(cd, "Failed to write data at offset %" PRIu64 " (size: %zu)",
+				offset + pos, len);
+			r = -EIO;
+			goto out;
+		}
+
+		if (k + 1 < count && !threaded)
+			(void)reencrypt_move_read_thread(&mr);
+
+		cur = 1 - cur;
 	}
 
 	r = 0;
 out:
-	crypt_safe_memzero(buffer, buffer_len);
-	free(buffer);
+	if (buffer[0] && (count == 1 || buffer[1]))
+		crypt_memory_io_put(cd, count > 1 ? 2 * chunk : chunk);
+	if (buffer[0]) {
+		crypt_safe_memzero(buffer[0], chunk);
+		free(buffer[0]);
+	}
+	if (buffer[1]) {
+		crypt_safe_memzero(buffer[1], chunk);
+		free(buffer[1]);
+	}
 	return r;
 }
 
@@ -3127,13 +3327,39 @@ out:
 	return r;
 }
 
+/* Hash every checksum block of buffer, store checksums from csum_offset on. */
+static int reencrypt_hotzone_checksums(struct crypt_device *cd,
+	const struct reenc_protection *rp,
+	const void *buffer, size_t buffer_len,
+	size_t csum_offset, size_t *csum_len)
+{
+	size_t len;
+
+	len = buffer_len / rp->p.csum.block_size * rp->p.csum.hash_size;
+	if (buffer_len % rp->p.csum.block_size || csum_offset + len > rp->p.csum.checksums_len) {
+		log_dbg(cd, "Checksums do not fit in reencryption keyslot area.");
+		return -EINVAL;
+	}
+
+	/* blocks are independent, hash them in parallel */
+	if (crypt_hash_blocks(rp->p.csum.hash, crypt_cpusonline(), buffer, buffer_len,
+			      rp->p.csum.block_size, (char *)rp->p.csum.checksums + csum_offset,
+			      rp->p.csum.hash_size)) {
+		log_dbg(cd, "Failed to hash hotzone blocks.");
+		return -EINVAL;
+	}
+
+	*csum_len = csum_offset + len;
+	return 0;
+}
+
 static int reencrypt_hotzone_protect_final(struct crypt_device *cd,
 	struct luks2_hdr *hdr, int reencrypt_keyslot,
 	const struct reenc_protection *rp,
 	const void *buffer, size_t buffer_len)
 {
 	const void *pbuffer;
-	size_t data_offset, len;
+	size_t len;
 	int r;
 
 	assert(hdr);
@@ -3145,16 +3371,9 @@ static int reencrypt_hotzone_protect_final(struct crypt_device *cd,
 	if (rp->type == REENC_PROTECTION_CHECKSUM) {
 		log_dbg(cd, "Checksums hotzone resilience.");
 
-		for (data_offset = 0, len = 0; data_offset < buffer_len; data_offset += rp->p.csum.block_size, len += rp->p.csum.hash_size) {
-			if (crypt_hash_write(rp->p.csum.ch, (const char *)buffer + data_offset, rp->p.csum.block_size)) {
-				log_dbg(cd, "Failed to hash sector at offset %zu.", data_offset);
-				return -EINVAL;
-			}
-			if (crypt_hash_final(rp->p.csum.ch, (char *)rp->p.csum.checksums + len, rp->p.csum.hash_size)) {
-				log_dbg(cd, "Failed to finalize hash.");
-				return -EINVAL;
-			}
-		}
+		r = reencrypt_hotzone_checksums(cd, rp, buffer, buffer_len, 0, &len);
+		if (r)
+			return r;
 		pbuffer = rp->p.csum.checksums;
 	} else if (rp->type == REENC_PROTECTION_JOURNAL) {
 		log_dbg(cd, "Journal hotzone resilience.");
@@ -3723,6 +3942,12 @@ static int reencrypt_init_by_passphrase(struct crypt_device *cd,
 	uint32_t flags = params ? params->flags : 0;
 	struct luks2_hdr *hdr = crypt_get_hdr(cd, CRYPT_LUKS2);
 
+	/* every reencryption metadata update must hit the disk immediately */
+	if (crypt_header_transaction_active(cd)) {
+		log_err(cd, _("Reencryption cannot be initialized in LUKS2 header transaction."));
+		return -EBUSY;
+	}
+
 	/* short-circuit in reencryption metadata update and finish immediately. */
 	if (flags & CRYPT_REENCRYPT_REPAIR_NEEDED)
 		return reencrypt_repair_by_passphrase(cd, hdr, keyslot_old, keyslot_new, passphrase, passphrase_size);
@@ -3742,6 +3967,12 @@ static int reencrypt_init_by_passphrase(struct crypt_device *cd,
 		}
 	}
 
+	/* sequential zones cannot be rewritten in place */
+	if (device_zone_size(crypt_data_device(cd))) {
+		log_err(cd, _("Reencryption is not supported on host-managed zoned devices."));
+		return -ENOTSUP;
+	}
+
 	r = LUKS2_device_write_lock(cd, hdr, crypt_metadata_device(cd));
 	if (r)
 		return r;
@@ -3835,164 +4066,731 @@ int crypt_reencrypt_init_by_passphrase(struct crypt_device *cd,
 }
 
 #if USE_LUKS2_REENCRYPTION
-static reenc_status_t reencrypt_step(struct crypt_device *cd,
-		struct luks2_hdr *hdr,
-		struct luks2_reencrypt *rh,
-		uint64_t device_size,
-		bool online)
+static uint64_t reencrypt_time_us(void)
 {
-	int r;
-	struct reenc_protection *rp;
+	struct timespec ts;
 
-	assert(hdr);
-	assert(rh);
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return 0;
 
-	rp = &rh->rp;
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
 
-	/* in memory only */
-	r = reencrypt_make_segments(cd, hdr, rh, device_size);
-	if (r)
-		return REENC_ERR;
+/* Add time elapsed since start to counter, return current time. */
+static uint64_t reencrypt_stats_add(uint64_t *counter, uint64_t start)
+{
+	uint64_t now = reencrypt_time_us();
 
-	r = reencrypt_assign_segments(cd, hdr, rh, 1, 0);
-	if (r) {
-		log_err(cd, _("Failed to set device segments for next reencryption hotzone."));
-		return REENC_ERR;
-	}
+	*counter += now - start;
+	return now;
+}
 
-	log_dbg(cd, "Reencrypting chunk starting at offset: %" PRIu64 ", size :%" PRIu64 ".", rh->offset, rh->length);
-	log_dbg(cd, "data_offset: %" PRIu64, crypt_get_data_offset(cd) << SECTOR_SHIFT);
+/* Lower limit for adaptive hotzone length */
+#define REENCRYPT_ADAPTIVE_MIN_LENGTH (256 * 1024)
 
-	if (!rh->offset && rp->type == REENC_PROTECTION_DATASHIFT && rh->jobj_segment_moved) {
-		crypt_storage_wrapper_destroy(rh->cw1);
-		log_dbg(cd, "Reinitializing old segment storage wrapper for moved segment.");
-		r = crypt_storage_wrapper_init(cd, &rh->cw1, crypt_data_device(cd),
-				LUKS2_reencrypt_get_data_offset_moved(hdr),
-				crypt_get_iv_offset(cd),
-				reencrypt_get_sector_size_old(hdr),
-				reencrypt_segment_cipher_old(hdr),
-				crypt_volume_key_by_id(rh->vks, rh->digest_old),
-				rh->wflags1);
-		if (r) {
-			log_err(cd, _("Failed to initialize old segment storage wrapper."));
-			return REENC_ROLLBACK;
-		}
+/*
+ * Adapt next hotzone length so the time the hotzone device stays suspended
+ * fits in the latency target. Data I/O time (read, write and datasync)
+ * scales with hotzone length, the rest (dm table reload, metadata commit)
+ * is taken as a constant overhead. Grow at most twice per step.
+ */
+static void reencrypt_adapt_length(struct crypt_device *cd, struct luks2_reencrypt *rh)
+{
+	uint64_t target_us, overhead_us, length, min_length;
 
-		if (rh->rp_moved_segment.type != REENC_PROTECTION_NOT_SET) {
-			log_dbg(cd, "Switching to moved segment resilience type.");
-			rp = &rh->rp_moved_segment;
-		}
-	}
+	if (!rh->latency_target_ms || !rh->online || rh->read <= 0 || !rh->io_us ||
+	    rh->rp.type == REENC_PROTECTION_DATASHIFT || rh->jobj_segment_moved)
+		return;
 
-	r = reencrypt_hotzone_protect_ready(cd, rp);
-	if (r) {
-		log_err(cd, _("Failed to initialize hotzone protection."));
-		return REENC_ROLLBACK;
-	}
+	target_us = (uint64_t)rh->latency_target_ms * 1000;
+	overhead_us = rh->suspended_us > rh->io_us ? rh->suspended_us - rh->io_us : 0;
 
-	if (online) {
-		r = reencrypt_refresh_overlay_devices(cd, hdr, rh->overlay_name, rh->hotzone_name, rh->vks, rh->device_size, rh->flags);
-		/* Teardown overlay devices with dm-error. None bio shall pass! */
-		if (r != REENC_OK)
-			return r;
-	}
+	if (target_us <= overhead_us)
+		length = 0;
+	else
+		length = (target_us - overhead_us) * (uint64_t)rh->read / rh->io_us;
 
-	rh->read = crypt_storage_wrapper_read(rh->cw1, rh->offset, rh->reenc_buffer, rh->length);
-	if (rh->read < 0) {
-		/* severity normal */
-		log_err(cd, _("Failed to read hotzone area starting at %" PRIu64 "."), rh->offset);
-		return REENC_ROLLBACK;
-	}
+	if (length > 2 * rh->length)
+		length = 2 * rh->length;
+	if (length > rh->max_length)
+		length = rh->max_length;
 
-	/* metadata commit point */
-	r = reencrypt_hotzone_protect_final(cd, hdr, rh->reenc_keyslot, rp, rh->reenc_buffer, rh->read);
-	if (r < 0) {
-		/* severity normal */
-		log_err(cd, _("Failed to write reencryption resilience metadata."));
-		return REENC_ROLLBACK;
-	}
+	min_length = REENCRYPT_ADAPTIVE_MIN_LENGTH + rh->alignment - 1;
+	min_length -= min_length % rh->alignment;
+	if (length < min_length)
+		length = min_length < rh->max_length ? min_length : rh->max_length;
 
-	r = crypt_storage_wrapper_decrypt(rh->cw1, rh->offset, rh->reenc_buffer, rh->read);
-	if (r) {
-		/* severity normal */
-		log_err(cd, _("Decryption failed."));
-		return REENC_ROLLBACK;
-	}
-	if (rh->read != crypt_storage_wrapper_encrypt_write(rh->cw2, rh->offset, rh->reenc_buffer, rh->read)) {
-		/* severity fatal */
-		log_err(cd, _("Failed to write hotzone area starting at %" PRIu64 "."), rh->offset);
-		return REENC_FATAL;
-	}
+	length -= length % rh->alignment;
 
-	if (rp->type != REENC_PROTECTION_NONE && crypt_storage_wrapper_datasync(rh->cw2)) {
-		log_err(cd, _("Failed to sync data."));
-		return REENC_FATAL;
-	}
+	log_dbg(cd, "Hotzone suspended for %" PRIu64 " us (data I/O %" PRIu64 " us), "
+		"adapting hotzone length %" PRIu64 " -> %" PRIu64 ".",
+		rh->suspended_us, rh->io_us, rh->length, length);
 
-	/* metadata commit safe point */
-	r = reencrypt_assign_segments(cd, hdr, rh, 0, rp->type != REENC_PROTECTION_NONE);
-	if (r) {
-		/* severity fatal */
-		log_err(cd, _("Failed to update metadata after current reencryption hotzone completed."));
-		return REENC_FATAL;
-	}
+	rh->length = length;
+}
 
-	if (online) {
-		/* severity normal */
-		log_dbg(cd, "Resuming device %s", rh->hotzone_name);
-		r = dm_resume_device(cd, rh->hotzone_name, DM_RESUME_PRIVATE);
-		if (r) {
-			log_err(cd, _("Failed to resume device %s."), rh->hotzone_name);
-			return REENC_ERR;
-		}
-	}
+/* I/O request size used for IOPS accounting */
+#define REENCRYPT_THROTTLE_IO_SIZE (256 * 1024)
 
-	return REENC_OK;
-}
+/* Backoff while active device is busy */
+#define REENCRYPT_BACKOFF_MIN_US   10000
+#define REENCRYPT_BACKOFF_MAX_US   1000000
+#define REENCRYPT_BACKOFF_LIMIT_US 10000000
 
-static int reencrypt_erase_backup_segments(struct crypt_device *cd,
-		struct luks2_hdr *hdr)
+static void reencrypt_sleep_us(uint64_t us)
 {
-	int segment = LUKS2_get_segment_id_by_flag(hdr, "backup-previous");
-	if (segment >= 0) {
-		if (LUKS2_digest_segment_assign(cd, hdr, segment, CRYPT_ANY_DIGEST, 0, 0))
-			return -EINVAL;
-		json_object_object_del_by_uint(LUKS2_get_segments_jobj(hdr), segment);
-	}
-	segment = LUKS2_get_segment_id_by_flag(hdr, "backup-final");
-	if (segment >= 0) {
-		if (LUKS2_digest_segment_assign(cd, hdr, segment, CRYPT_ANY_DIGEST, 0, 0))
-			return -EINVAL;
-		json_object_object_del_by_uint(LUKS2_get_segments_jobj(hdr), segment);
-	}
-	segment = LUKS2_get_segment_id_by_flag(hdr, "backup-moved-segment");
-	if (segment >= 0) {
-		if (LUKS2_digest_segment_assign(cd, hdr, segment, CRYPT_ANY_DIGEST, 0, 0))
-			return -EINVAL;
-		json_object_object_del_by_uint(LUKS2_get_segments_jobj(hdr), segment);
-	}
+	struct timespec ts = {
+		.tv_sec = us / 1000000,
+		.tv_nsec = (us % 1000000) * 1000
+	};
 
-	return 0;
+	/* interrupted sleep just ends early */
+	(void)nanosleep(&ts, NULL);
 }
 
-static int reencrypt_wipe_unused_device_area(struct crypt_device *cd, struct luks2_reencrypt *rh)
+/*
+ * Token bucket refilled at max rate with capacity of one second.
+ * Returns time to wait until the bucket can pay the cost.
+ */
+static uint64_t reencrypt_bucket_wait(int64_t *tokens, uint64_t rate,
+				      uint64_t elapsed_us, uint64_t cost)
 {
-	uint64_t offset, length, dev_size;
-	int r = 0;
+	if (!rate)
+		return 0;
 
-	assert(cd);
-	assert(rh);
+	*tokens += (int64_t)(elapsed_us * rate / 1000000);
+	if (*tokens > (int64_t)rate)
+		*tokens = (int64_t)rate;
 
-	if (rh->jobj_segment_moved && rh->mode == CRYPT_REENCRYPT_ENCRYPT) {
-		offset = json_segment_get_offset(rh->jobj_segment_moved, 0);
-		length = json_segment_get_size(rh->jobj_segment_moved, 0);
-		log_dbg(cd, "Wiping %" PRIu64 " bytes of backup segment data at offset %" PRIu64,
-			length, offset);
-		r = crypt_wipe_device(cd, crypt_data_device(cd), CRYPT_WIPE_RANDOM,
-				offset, length, 1024 * 1024, NULL, NULL);
-	}
+	if (*tokens >= (int64_t)cost)
+		return 0;
 
-	if (r < 0)
+	return ((uint64_t)((int64_t)cost - *tokens) * 1000000 + rate - 1) / rate;
+}
+
+static void reencrypt_throttle_rate(struct crypt_device *cd, struct luks2_reencrypt *rh)
+{
+	uint64_t now, elapsed, wait_us, w, ios;
+
+	if (!rh->throttle.max_rate && !rh->throttle.max_iops)
+		return;
+
+	now = reencrypt_time_us();
+	if (!rh->tb_time_us) {
+		/* start with full buckets */
+		rh->tb_bytes = (int64_t)rh->throttle.max_rate;
+		rh->tb_ios = (int64_t)rh->throttle.max_iops;
+		elapsed = 0;
+	} else
+		elapsed = now - rh->tb_time_us;
+
+	/* buckets are full after one second anyway */
+	if (elapsed > 1000000)
+		elapsed = 1000000;
+
+	ios = 2 * ((rh->length + REENCRYPT_THROTTLE_IO_SIZE - 1) / REENCRYPT_THROTTLE_IO_SIZE);
+
+	wait_us = reencrypt_bucket_wait(&rh->tb_bytes, rh->throttle.max_rate, elapsed, rh->length);
+	w = reencrypt_bucket_wait(&rh->tb_ios, rh->throttle.max_iops, elapsed, ios);
+	if (w > wait_us)
+		wait_us = w;
+
+	if (wait_us) {
+		log_dbg(cd, "Throttling reencryption for %" PRIu64 " us.", wait_us);
+		reencrypt_sleep_us(wait_us);
+		rh->tb_bytes += (int64_t)(wait_us * rh->throttle.max_rate / 1000000);
+		rh->tb_ios += (int64_t)(wait_us * rh->throttle.max_iops / 1000000);
+	}
+
+	rh->tb_bytes -= (int64_t)rh->length;
+	rh->tb_ios -= (int64_t)ios;
+	rh->tb_time_us = now + wait_us;
+}
+
+/* Check block layer stats of the overlay device, all production I/O passes it. */
+static bool reencrypt_device_busy(struct crypt_device *cd, struct luks2_reencrypt *rh, const char *path)
+{
+	uint64_t ios, ticks, in_flight;
+	bool busy = false;
+
+	if (crypt_dev_get_stat(path, &ios, &ticks, &in_flight))
+		return false;
+
+	if (rh->throttle.max_latency_ms && rh->stat_valid && ios > rh->stat_ios &&
+	    ticks - rh->stat_ticks > (uint64_t)rh->throttle.max_latency_ms * (ios - rh->stat_ios)) {
+		log_dbg(cd, "Average I/O latency %" PRIu64 " ms on %s.",
+			(ticks - rh->stat_ticks) / (ios - rh->stat_ios), path);
+		busy = true;
+	}
+
+	if (rh->throttle.max_in_flight && in_flight > rh->throttle.max_in_flight) {
+		log_dbg(cd, "%" PRIu64 " I/O requests in flight on %s.", in_flight, path);
+		busy = true;
+	}
+
+	rh->stat_ios = ios;
+	rh->stat_ticks = ticks;
+	rh->stat_valid = true;
+
+	return busy;
+}
+
+static void reencrypt_throttle_latency(struct crypt_device *cd, struct luks2_reencrypt *rh)
+{
+	char path[PATH_MAX];
+	uint64_t backoff = REENCRYPT_BACKOFF_MIN_US, waited = 0;
+
+	if (!rh->online || !rh->overlay_name ||
+	    (!rh->throttle.max_latency_ms && !rh->throttle.max_in_flight))
+		return;
+
+	if (snprintf(path, sizeof(path), "%s/%s", dm_get_dir(), rh->overlay_name) < 0)
+		return;
+
+	/* do not stall reencryption forever under permanent load */
+	while (reencrypt_device_busy(cd, rh, path) && waited < REENCRYPT_BACKOFF_LIMIT_US) {
+		log_dbg(cd, "Active device is busy, backing off for %" PRIu64 " us.", backoff);
+		reencrypt_sleep_us(backoff);
+		waited += backoff;
+		backoff *= 2;
+		if (backoff > REENCRYPT_BACKOFF_MAX_US)
+			backoff = REENCRYPT_BACKOFF_MAX_US;
+	}
+}
+
+static void reencrypt_throttle(struct crypt_device *cd, struct luks2_reencrypt *rh)
+{
+	reencrypt_throttle_latency(cd, rh);
+	reencrypt_throttle_rate(cd, rh);
+}
+
+static void *reencrypt_prefetch_thread(void *arg)
+{
+	struct reencrypt_prefetch *pf = arg;
+
+	pf->read = crypt_storage_wrapper_read(pf->cw, pf->offset, pf->buffer, pf->length);
+
+	return NULL;
+}
+
+/*
+ * The next hotzone can be read early only if nothing else writes there
+ * (offline) and current hotzone write never overlaps it (no data shift).
+ * The old segment wrapper is read-only, so it does not share the file
+ * descriptor (and its file offset) with the new segment wrapper.
+ */
+static bool reencrypt_prefetch_allowed(struct luks2_reencrypt *rh, struct reenc_protection *rp)
+{
+	return !rh->online && !rh->jobj_segment_moved &&
+	       (rp->type == REENC_PROTECTION_NONE || rp->type == REENC_PROTECTION_CHECKSUM);
+}
+
+/* Start background read of old segment data into the spare buffer */
+static void reencrypt_prefetch_range(struct crypt_device *cd, struct luks2_reencrypt *rh,
+				     uint64_t offset, uint64_t length)
+{
+	struct reencrypt_prefetch *pf = &rh->prefetch;
+
+	if (pf->running || length > rh->reenc_buffer_length)
+		return;
+
+	if (!pf->buffer) {
+		if (posix_memalign(&pf->buffer, device_alignment(crypt_data_device(cd)),
+				   rh->reenc_buffer_length)) {
+			pf->buffer = NULL;
+			return;
+		}
+		crypt_memory_io_get(cd, rh->reenc_buffer_length);
+		crypt_numa_bind_buffer(pf->buffer, rh->reenc_buffer_length,
+				       crypt_dev_numa_node(device_path(crypt_data_device(cd))));
+		(void)crypt_storage_wrapper_register_buffer(rh->cw1, pf->buffer, rh->reenc_buffer_length);
+		(void)crypt_storage_wrapper_register_buffer(rh->cw2, pf->buffer, rh->reenc_buffer_length);
+	}
+
+	pf->cw = rh->cw1;
+	pf->offset = offset;
+	pf->length = length;
+	pf->read = -1;
+
+	if (pthread_create(&pf->thread, NULL, reencrypt_prefetch_thread, pf))
+		return;
+
+	pf->running = true;
+	log_dbg(cd, "Prefetching hotzone data at offset %" PRIu64 ", size %" PRIu64 ".", offset, length);
+}
+
+static void reencrypt_prefetch_start(struct crypt_device *cd, struct luks2_reencrypt *rh)
+{
+	uint64_t offset, length;
+
+	/* same as reencrypt_context_update() without data shift */
+	if (rh->direction == CRYPT_REENCRYPT_FORWARD) {
+		offset = rh->offset + (uint64_t)rh->read;
+		if (offset >= rh->device_size)
+			return;
+		length = rh->device_size - offset < rh->length ? rh->device_size - offset : rh->length;
+	} else {
+		if (!rh->offset)
+			return;
+		length = rh->offset < rh->length ? rh->offset : rh->length;
+		offset = rh->offset - length;
+	}
+
+	reencrypt_prefetch_range(cd, rh, offset, length);
+}
+
+/* Use prefetched data (by swapping buffers) if it matches requested area */
+static bool reencrypt_prefetch_take(struct luks2_reencrypt *rh, uint64_t offset, uint64_t length)
+{
+	struct reencrypt_prefetch *pf = &rh->prefetch;
+	void *tmp;
+
+	reencrypt_prefetch_wait(rh);
+
+	if (!pf->buffer || pf->read < 0 || pf->cw != rh->cw1 ||
+	    pf->offset != offset || pf->length != length)
+		return false;
+
+	tmp = rh->reenc_buffer;
+	rh->reenc_buffer = pf->buffer;
+	pf->buffer = tmp;
+	rh->read = pf->read;
+	pf->read = -1;
+
+	return true;
+}
+
+/* Decrypt, encrypt and write back one hotzone buffer. */
+static reenc_status_t reencrypt_hotzone_write(struct crypt_device *cd,
+		struct luks2_reencrypt *rh,
+		struct reenc_protection *rp,
+		uint64_t offset, void *buffer, size_t length,
+		bool prefetch)
+{
+	uint64_t t = reencrypt_time_us();
+	ssize_t written = -EINVAL;
+	int r;
+
+	/* decrypt and encrypt the hotzone in one pass split across worker threads */
+	r = crypt_storage_wrapper_reencrypt(rh->cw1, rh->cw2, offset, buffer, length);
+	if (!r && prefetch && reencrypt_prefetch_allowed(rh, rp))
+		reencrypt_prefetch_start(cd, rh);
+	if (!r) {
+		t = reencrypt_stats_add(&rh->stats.transform_us, t);
+		written = crypt_storage_wrapper_write(rh->cw2, offset, buffer, length);
+		(void)reencrypt_stats_add(&rh->stats.write_us, t);
+	} else if (r == -ENOTSUP) {
+		/* dm-crypt wrapper, transform is done by the kernel */
+		r = crypt_storage_wrapper_decrypt(rh->cw1, offset, buffer, length);
+		t = reencrypt_stats_add(&rh->stats.transform_us, t);
+		if (!r)
+			written = crypt_storage_wrapper_encrypt_write(rh->cw2, offset, buffer, length);
+		(void)reencrypt_stats_add(&rh->stats.write_us, t);
+	}
+	if (r) {
+		/* severity normal */
+		log_err(cd, _("Decryption failed."));
+		return REENC_ROLLBACK;
+	}
+	if (written < 0 || (size_t)written != length) {
+		/* severity fatal */
+		log_err(cd, _("Failed to write hotzone area starting at %" PRIu64 "."), offset);
+		return REENC_FATAL;
+	}
+
+	return REENC_OK;
+}
+
+static reenc_status_t reencrypt_hotzone(struct crypt_device *cd,
+		struct luks2_hdr *hdr,
+		struct luks2_reencrypt *rh,
+		struct reenc_protection *rp)
+{
+	uint64_t t = reencrypt_time_us();
+	int r;
+
+	if (!reencrypt_prefetch_take(rh, rh->offset, rh->length))
+		rh->read = crypt_storage_wrapper_read(rh->cw1, rh->offset, rh->reenc_buffer, rh->length);
+	t = reencrypt_stats_add(&rh->stats.read_us, t);
+	if (rh->read < 0) {
+		/* severity normal */
+		log_err(cd, _("Failed to read hotzone area starting at %" PRIu64 "."), rh->offset);
+		return REENC_ROLLBACK;
+	}
+
+	/* metadata commit point */
+	r = reencrypt_hotzone_protect_final(cd, hdr, rh->reenc_keyslot, rp, rh->reenc_buffer, rh->read);
+	(void)reencrypt_stats_add(&rh->stats.protect_us, t);
+	if (r < 0) {
+		/* severity normal */
+		log_err(cd, _("Failed to write reencryption resilience metadata."));
+		return REENC_ROLLBACK;
+	}
+
+	return reencrypt_hotzone_write(cd, rh, rp, rh->offset, rh->reenc_buffer, rh->read, true);
+}
+
+/* Read one sub-hotzone, from the spare buffer if it was prefetched */
+static ssize_t reencrypt_batch_read(struct luks2_reencrypt *rh, uint64_t offset, size_t length)
+{
+	if (reencrypt_prefetch_take(rh, offset, length))
+		return rh->read;
+
+	return crypt_storage_wrapper_read(rh->cw1, offset, rh->reenc_buffer, length);
+}
+
+/*
+ * Batched checksum resilience: the hotzone in metadata spans several
+ * buffer sized sub-hotzones. Checksums of all of them are stored in one
+ * metadata commit before any sub-hotzone is written, so recovery works
+ * the same way as for a single large hotzone.
+ *
+ * Data is streamed through two buffers: the next sub-hotzone is read in
+ * background while the current one is hashed or transformed and written.
+ * On high latency devices (network block device with detached header)
+ * device reads and writes overlap and there is one header commit per batch.
+ */
+static reenc_status_t reencrypt_hotzone_batch(struct crypt_device *cd,
+		struct luks2_hdr *hdr,
+		struct luks2_reencrypt *rh,
+		struct reenc_protection *rp)
+{
+	uint64_t offset, next, last = rh->offset, end = rh->offset + rh->length;
+	uint64_t t;
+	size_t len, csum_len = 0, buffer_length = rh->reenc_buffer_length;
+	ssize_t read;
+	reenc_status_t rs;
+	bool stream;
+	int r;
+
+	if (rp->type != REENC_PROTECTION_CHECKSUM)
+		return REENC_ERR;
+
+	stream = reencrypt_prefetch_allowed(rh, rp);
+
+	log_dbg(cd, "Checksums hotzone resilience for %" PRIu64 " sub-hotzones%s.",
+		(rh->length + buffer_length - 1) / buffer_length, stream ? ", streamed" : "");
+
+	for (offset = rh->offset; offset < end; offset = next) {
+		len = end - offset < buffer_length ? end - offset : buffer_length;
+		next = offset + len;
+		t = reencrypt_time_us();
+		read = reencrypt_batch_read(rh, offset, len);
+		t = reencrypt_stats_add(&rh->stats.read_us, t);
+		if (read < 0 || (size_t)read != len) {
+			/* severity normal */
+			log_err(cd, _("Failed to read hotzone area starting at %" PRIu64 "."), offset);
+			return REENC_ROLLBACK;
+		}
+
+		if (stream && next < end)
+			reencrypt_prefetch_range(cd, rh, next, end - next < buffer_length ? end - next : buffer_length);
+
+		r = reencrypt_hotzone_checksums(cd, rp, rh->reenc_buffer, len, csum_len, &csum_len);
+		(void)reencrypt_stats_add(&rh->stats.protect_us, t);
+		if (r)
+			return REENC_ROLLBACK;
+		last = offset;
+	}
+
+	/* metadata commit point, no data device read runs across it */
+	reencrypt_prefetch_wait(rh);
+	log_dbg(cd, "Going to store %zu bytes in reencrypt keyslot.", csum_len);
+	t = reencrypt_time_us();
+	r = LUKS2_keyslot_reencrypt_store(cd, hdr, rh->reenc_keyslot, rp->p.csum.checksums, csum_len);
+	(void)reencrypt_stats_add(&rh->stats.protect_us, t);
+	if (r < 0) {
+		/* severity normal */
+		log_err(cd, _("Failed to write reencryption resilience metadata."));
+		return REENC_ROLLBACK;
+	}
+
+	/* buffer still holds the last sub-hotzone, read the first one meanwhile */
+	if (stream && rh->offset < last)
+		reencrypt_prefetch_range(cd, rh, rh->offset, buffer_length);
+
+	rs = reencrypt_hotzone_write(cd, rh, rp, last, rh->reenc_buffer, end - last, false);
+	if (rs != REENC_OK)
+		return rs;
+
+	for (offset = rh->offset; offset < last; offset = next) {
+		len = buffer_length;
+		next = offset + len;
+		t = reencrypt_time_us();
+		read = reencrypt_batch_read(rh, offset, len);
+		(void)reencrypt_stats_add(&rh->stats.read_us, t);
+		if (read < 0 || (size_t)read != len) {
+			/* severity fatal, part of the hotzone is already written */
+			log_err(cd, _("Failed to read hotzone area starting at %" PRIu64 "."), offset);
+			return REENC_FATAL;
+		}
+
+		if (stream && next < last)
+			reencrypt_prefetch_range(cd, rh, next, buffer_length);
+
+		rs = reencrypt_hotzone_write(cd, rh, rp, offset, rh->reenc_buffer, len, false);
+		if (rs != REENC_OK)
+			return REENC_FATAL;
+	}
+
+	rh->read = (ssize_t)rh->length;
+
+	return REENC_OK;
+}
+
+/*
+ * Return length of unallocated area starting at hotzone (forward direction
+ * extends it up to next allocated data), or 0 if hotzone contains data.
+ */
+static uint64_t reencrypt_hole_length(struct crypt_device *cd,
+		struct luks2_reencrypt *rh, uint64_t device_size)
+{
+	uint64_t data_offset, next, length;
+
+	if (!rh->sparse_flags || rh->online || rh->jobj_segment_moved ||
+	    rh->rp.type == REENC_PROTECTION_DATASHIFT)
+		return 0;
+
+	/* caller asserted there is no data, whole rest is one hole */
+	if (rh->sparse_flags & CRYPT_REENCRYPT_SPARSE_UNUSED)
+		return rh->direction == CRYPT_REENCRYPT_BACKWARD ? rh->offset + rh->length : device_size - rh->offset;
+
+	data_offset = crypt_get_data_offset(cd) << SECTOR_SHIFT;
+	if (device_next_data(crypt_data_device(cd), data_offset + rh->offset, &next))
+		return 0;
+
+	if (next - data_offset < rh->offset + rh->length)
+		return 0;
+
+	if (rh->direction == CRYPT_REENCRYPT_BACKWARD)
+		return rh->length;
+
+	if (next == UINT64_MAX || next - data_offset >= device_size)
+		return device_size - rh->offset;
+
+	length = next - data_offset - rh->offset;
+	return length - length % rh->alignment;
+}
+
+/*
+ * Switch unallocated area to new segment in metadata only. There is no
+ * hot segment commit: resilience data in reencrypt keyslot belongs to
+ * the previous hotzone and must never be used to recover the hole.
+ * Post segments are committed directly, so a crash leaves either old or
+ * new segment mapping over the hole and nothing to recover.
+ */
+static reenc_status_t reencrypt_step_hole(struct crypt_device *cd,
+		struct luks2_hdr *hdr,
+		struct luks2_reencrypt *rh,
+		uint64_t device_size,
+		uint64_t length)
+{
+	uint64_t saved_offset = rh->offset, saved_length = rh->length;
+	int r;
+
+	/* backward hole ends where the current hotzone ends */
+	if (rh->direction == CRYPT_REENCRYPT_BACKWARD)
+		rh->offset = rh->offset + rh->length - length;
+
+	log_dbg(cd, "Skipping unallocated area at offset %" PRIu64 ", size %" PRIu64 ".", rh->offset, length);
+
+	rh->length = length;
+	rh->stats.offset = rh->offset;
+	rh->stats.length = length;
+
+	r = reencrypt_make_segments(cd, hdr, rh, device_size);
+	if (r) {
+		rh->offset = saved_offset;
+		rh->length = saved_length;
+		log_err(cd, _("Failed to set device segments for next reencryption hotzone."));
+		return REENC_ERR;
+	}
+	json_object_put(rh->jobj_segs_hot);
+	rh->jobj_segs_hot = NULL;
+
+	/* no data device reads may run across metadata commit */
+	reencrypt_prefetch_wait(rh);
+
+	if ((rh->sparse_flags & CRYPT_REENCRYPT_SPARSE_DISCARD) &&
+	    device_discard(crypt_data_device(cd), (crypt_get_data_offset(cd) << SECTOR_SHIFT) + rh->offset, length))
+		log_dbg(cd, "Failed to discard unallocated area.");
+
+	/* metadata commit safe point */
+	r = reencrypt_assign_segments(cd, hdr, rh, 0, rh->rp.type != REENC_PROTECTION_NONE);
+	rh->length = saved_length;
+	if (r) {
+		/* severity fatal */
+		log_err(cd, _("Failed to update metadata after current reencryption hotzone completed."));
+		return REENC_FATAL;
+	}
+
+	rh->read = (ssize_t)length;
+
+	return REENC_OK;
+}
+
+static reenc_status_t reencrypt_step(struct crypt_device *cd,
+		struct luks2_hdr *hdr,
+		struct luks2_reencrypt *rh,
+		uint64_t device_size,
+		bool online)
+{
+	int r;
+	uint64_t t, t_suspend, t_io, hole;
+	reenc_status_t rs;
+	struct reenc_protection *rp;
+
+	assert(hdr);
+	assert(rh);
+
+	rp = &rh->rp;
+
+	memset(&rh->stats, 0, sizeof(rh->stats));
+	rh->stats.offset = rh->offset;
+	rh->stats.length = rh->length;
+
+	hole = reencrypt_hole_length(cd, rh, device_size);
+	if (hole)
+		return reencrypt_step_hole(cd, hdr, rh, device_size, hole);
+
+	/* in memory only */
+	r = reencrypt_make_segments(cd, hdr, rh, device_size);
+	if (r)
+		return REENC_ERR;
+
+	r = reencrypt_assign_segments(cd, hdr, rh, 1, 0);
+	if (r) {
+		log_err(cd, _("Failed to set device segments for next reencryption hotzone."));
+		return REENC_ERR;
+	}
+
+	log_dbg(cd, "Reencrypting chunk starting at offset: %" PRIu64 ", size :%" PRIu64 ".", rh->offset, rh->length);
+	log_dbg(cd, "data_offset: %" PRIu64, crypt_get_data_offset(cd) << SECTOR_SHIFT);
+
+	if (!rh->offset && rp->type == REENC_PROTECTION_DATASHIFT && rh->jobj_segment_moved) {
+		crypt_storage_wrapper_destroy(rh->cw1);
+		log_dbg(cd, "Reinitializing old segment storage wrapper for moved segment.");
+		r = crypt_storage_wrapper_init(cd, &rh->cw1, crypt_data_device(cd),
+				LUKS2_reencrypt_get_data_offset_moved(hdr),
+				reencrypt_get_iv_tweak_old(hdr),
+				reencrypt_get_sector_size_old(hdr),
+				reencrypt_segment_cipher_old(hdr),
+				crypt_volume_key_by_id(rh->vks, rh->digest_old),
+				rh->wflags1);
+		if (r) {
+			log_err(cd, _("Failed to initialize old segment storage wrapper."));
+			return REENC_ROLLBACK;
+		}
+
+		if (rh->rp_moved_segment.type != REENC_PROTECTION_NOT_SET) {
+			log_dbg(cd, "Switching to moved segment resilience type.");
+			rp = &rh->rp_moved_segment;
+		}
+	}
+
+	r = reencrypt_hotzone_protect_ready(cd, rp);
+	if (r) {
+		log_err(cd, _("Failed to initialize hotzone protection."));
+		return REENC_ROLLBACK;
+	}
+
+	t_suspend = reencrypt_time_us();
+	if (online) {
+		r = reencrypt_refresh_overlay_devices(cd, hdr, rh->overlay_name, rh->hotzone_name, rh->vks, rh->device_size, rh->flags);
+		(void)reencrypt_stats_add(&rh->stats.suspend_us, t_suspend);
+		/* Teardown overlay devices with dm-error. None bio shall pass! */
+		if (r != REENC_OK)
+			return r;
+	}
+
+	t_io = reencrypt_time_us();
+	if (rh->length > rh->reenc_buffer_length)
+		rs = reencrypt_hotzone_batch(cd, hdr, rh, rp);
+	else
+		rs = reencrypt_hotzone(cd, hdr, rh, rp);
+	if (rs != REENC_OK)
+		return rs;
+
+	t = reencrypt_time_us();
+	if (rp->type != REENC_PROTECTION_NONE && crypt_storage_wrapper_datasync(rh->cw2)) {
+		log_err(cd, _("Failed to sync data."));
+		return REENC_FATAL;
+	}
+	(void)reencrypt_stats_add(&rh->stats.datasync_us, t);
+
+	/* no data device reads may run across metadata commit */
+	reencrypt_prefetch_wait(rh);
+	rh->io_us = reencrypt_time_us() - t_io;
+
+	/* metadata commit safe point */
+	t = reencrypt_time_us();
+	r = reencrypt_assign_segments(cd, hdr, rh, 0, rp->type != REENC_PROTECTION_NONE);
+	(void)reencrypt_stats_add(&rh->stats.commit_us, t);
+	if (r) {
+		/* severity fatal */
+		log_err(cd, _("Failed to update metadata after current reencryption hotzone completed."));
+		return REENC_FATAL;
+	}
+
+	if (online) {
+		/* severity normal */
+		log_dbg(cd, "Resuming device %s", rh->hotzone_name);
+		t = reencrypt_time_us();
+		r = dm_resume_device(cd, rh->hotzone_name, DM_RESUME_PRIVATE);
+		(void)reencrypt_stats_add(&rh->stats.resume_us, t);
+		if (r) {
+			log_err(cd, _("Failed to resume device %s."), rh->hotzone_name);
+			return REENC_ERR;
+		}
+	}
+	rh->suspended_us = reencrypt_time_us() - t_suspend;
+
+	return REENC_OK;
+}
+
+static int reencrypt_erase_backup_segments(struct crypt_device *cd,
+		struct luks2_hdr *hdr)
+{
+	int segment = LUKS2_get_segment_id_by_flag(hdr, "backup-previous");
+	if (segment >= 0) {
+		if (LUKS2_digest_segment_assign(cd, hdr, segment, CRYPT_ANY_DIGEST, 0, 0))
+			return -EINVAL;
+		json_object_object_del_by_uint(LUKS2_get_segments_jobj(hdr), segment);
+	}
+	segment = LUKS2_get_segment_id_by_flag(hdr, "backup-final");
+	if (segment >= 0) {
+		if (LUKS2_digest_segment_assign(cd, hdr, segment, CRYPT_ANY_DIGEST, 0, 0))
+			return -EINVAL;
+		json_object_object_del_by_uint(LUKS2_get_segments_jobj(hdr), segment);
+	}
+	segment = LUKS2_get_segment_id_by_flag(hdr, "backup-moved-segment");
+	if (segment >= 0) {
+		if (LUKS2_digest_segment_assign(cd, hdr, segment, CRYPT_ANY_DIGEST, 0, 0))
+			return -EINVAL;
+		json_object_object_del_by_uint(LUKS2_get_segments_jobj(hdr), segment);
+	}
+
+	return 0;
+}
+
+static int reencrypt_wipe_unused_device_area(struct crypt_device *cd, struct luks2_reencrypt *rh)
+{
+	uint64_t offset, length, dev_size;
+	int r = 0;
+
+	assert(cd);
+	assert(rh);
+
+	if (rh->jobj_segment_moved && rh->mode == CRYPT_REENCRYPT_ENCRYPT) {
+		offset = json_segment_get_offset(rh->jobj_segment_moved, 0);
+		length = json_segment_get_size(rh->jobj_segment_moved, 0);
+		log_dbg(cd, "Wiping %" PRIu64 " bytes of backup segment data at offset %" PRIu64,
+			length, offset);
+		r = crypt_wipe_device(cd, crypt_data_device(cd), CRYPT_WIPE_RANDOM,
+				offset, length, 1024 * 1024, NULL, NULL);
+	}
+
+	if (r < 0)
 		return r;
 
 	if (rh->rp.type == REENC_PROTECTION_DATASHIFT && rh->direction == CRYPT_REENCRYPT_FORWARD) {
@@ -4124,12 +4922,20 @@ int crypt_reencrypt_run(
 	crypt_reencrypt_info ri;
 	struct luks2_hdr *hdr;
 	struct luks2_reencrypt *rh;
+	struct crypt_progress_throttle pt;
 	reenc_status_t rs;
+	uint64_t t;
 	bool quit = false;
 
 	if (onlyLUKS2mask(cd, CRYPT_REQUIREMENT_ONLINE_REENCRYPT))
 		return -EINVAL;
 
+	if (progress) {
+		crypt_progress_init(cd, &pt, progress, usrptr);
+		progress = crypt_progress_throttled;
+		usrptr = &pt;
+	}
+
 	hdr = crypt_get_hdr(cd, CRYPT_LUKS2);
 
 	ri = LUKS2_reencrypt_status(hdr);
@@ -4159,14 +4965,28 @@ int crypt_reencrypt_run(
 		quit = true;
 
 	while (!quit && (rh->device_size > rh->progress)) {
+		reencrypt_throttle(cd, rh);
+
+		t = reencrypt_time_us();
+		CRYPT_TRACE(reencrypt__step__start, rh->offset, rh->length);
 		rs = reencrypt_step(cd, hdr, rh, rh->device_size, rh->online);
+		rh->stats.total_us = reencrypt_time_us() - t;
+		CRYPT_TRACE(reencrypt__step__done, rh->stats.offset, rh->stats.length, (int)rs,
+			    rh->stats.read_us, rh->stats.protect_us, rh->stats.transform_us,
+			    rh->stats.write_us, rh->stats.datasync_us, rh->stats.commit_us,
+			    rh->stats.suspend_us, rh->stats.resume_us, rh->stats.total_us);
 		if (rs != REENC_OK)
 			break;
 
+		if (rh->stats_cb)
+			rh->stats_cb(&rh->stats, rh->stats_usrptr);
+
 		log_dbg(cd, "Progress %" PRIu64 ", device_size %" PRIu64, rh->progress, rh->device_size);
 		if (progress && progress(rh->device_size, rh->progress, usrptr))
 			quit = true;
 
+		reencrypt_adapt_length(cd, rh);
+
 		r = reencrypt_context_update(cd, rh);
 		if (r) {
 			log_err(cd, _("Failed to update reencryption context."));
@@ -4192,6 +5012,207 @@ int crypt_reencrypt(
 {
 	return crypt_reencrypt_run(cd, progress, NULL);
 }
+
+int crypt_reencrypt_set_hotzone_latency(struct crypt_device *cd, uint32_t target_ms)
+{
+#if USE_LUKS2_REENCRYPTION
+	struct luks2_reencrypt *rh;
+
+	if (onlyLUKS2mask(cd, CRYPT_REQUIREMENT_ONLINE_REENCRYPT))
+		return -EINVAL;
+
+	rh = crypt_get_luks2_reencrypt(cd);
+	if (!rh) {
+		log_err(cd, _("Missing or invalid reencrypt context."));
+		return -EINVAL;
+	}
+
+	if (target_ms > CRYPT_REENCRYPT_HOTZONE_LATENCY_MAX_MS) {
+		log_err(cd, _("Invalid hotzone latency target."));
+		return -EINVAL;
+	}
+
+	if (target_ms && !rh->online)
+		log_dbg(cd, "Hotzone latency target is used only for online reencryption.");
+
+	rh->latency_target_ms = target_ms;
+	return 0;
+#else
+	UNUSED(target_ms);
+	log_err(cd, _("This operation is not supported for this device type."));
+	return -ENOTSUP;
+#endif
+}
+
+int crypt_reencrypt_set_throttle(struct crypt_device *cd,
+	const struct crypt_params_reencrypt_throttle *params)
+{
+#if USE_LUKS2_REENCRYPTION
+	struct luks2_reencrypt *rh;
+
+	if (onlyLUKS2mask(cd, CRYPT_REQUIREMENT_ONLINE_REENCRYPT))
+		return -EINVAL;
+
+	rh = crypt_get_luks2_reencrypt(cd);
+	if (!rh) {
+		log_err(cd, _("Missing or invalid reencrypt context."));
+		return -EINVAL;
+	}
+
+	if (params && params->max_rate > INT64_MAX) {
+		log_err(cd, _("Invalid reencryption throttle rate."));
+		return -EINVAL;
+	}
+
+	if (params) {
+		rh->throttle = *params;
+		if ((params->max_latency_ms || params->max_in_flight) && !rh->online)
+			log_dbg(cd, "Latency and in-flight limits are used only for online reencryption.");
+	} else
+		memset(&rh->throttle, 0, sizeof(rh->throttle));
+
+	rh->tb_time_us = 0;
+	rh->stat_valid = false;
+
+	return 0;
+#else
+	UNUSED(params);
+	log_err(cd, _("This operation is not supported for this device type."));
+	return -ENOTSUP;
+#endif
+}
+
+int crypt_reencrypt_set_sparse(struct crypt_device *cd, uint32_t flags)
+{
+#if USE_LUKS2_REENCRYPTION
+	struct luks2_reencrypt *rh;
+
+	if (onlyLUKS2mask(cd, CRYPT_REQUIREMENT_ONLINE_REENCRYPT))
+		return -EINVAL;
+
+	if (flags & ~(CRYPT_REENCRYPT_SPARSE_SKIP | CRYPT_REENCRYPT_SPARSE_DISCARD |
+		      CRYPT_REENCRYPT_SPARSE_UNUSED))
+		return -EINVAL;
+
+	rh = crypt_get_luks2_reencrypt(cd);
+	if (!rh) {
+		log_err(cd, _("Missing or invalid reencrypt context."));
+		return -EINVAL;
+	}
+
+	if (flags && rh->online)
+		log_dbg(cd, "Sparse mode is used only for offline reencryption.");
+
+	rh->sparse_flags = flags;
+
+	return 0;
+#else
+	UNUSED(flags);
+	log_err(cd, _("This operation is not supported for this device type."));
+	return -ENOTSUP;
+#endif
+}
+
+int crypt_reencrypt_set_stats_callback(struct crypt_device *cd,
+	void (*stats)(const struct crypt_reencrypt_stats *stats, void *usrptr),
+	void *usrptr)
+{
+#if USE_LUKS2_REENCRYPTION
+	struct luks2_reencrypt *rh;
+
+	if (onlyLUKS2mask(cd, CRYPT_REQUIREMENT_ONLINE_REENCRYPT))
+		return -EINVAL;
+
+	rh = crypt_get_luks2_reencrypt(cd);
+	if (!rh) {
+		log_err(cd, _("Missing or invalid reencrypt context."));
+		return -EINVAL;
+	}
+
+	rh->stats_cb = stats;
+	rh->stats_usrptr = usrptr;
+
+	return 0;
+#else
+	UNUSED(stats);
+	UNUSED(usrptr);
+	log_err(cd, _("This operation is not supported for this device type."));
+	return -ENOTSUP;
+#endif
+}
+
+int crypt_reencrypt_set_hotzone_batch(struct crypt_device *cd, uint32_t hotzones)
+{
+#if USE_LUKS2_REENCRYPTION
+	struct luks2_reencrypt *rh;
+	uint64_t length, limit, soft_mem_limit, end;
+	size_t block_size;
+
+	if (onlyLUKS2mask(cd, CRYPT_REQUIREMENT_ONLINE_REENCRYPT))
+		return -EINVAL;
+
+	rh = crypt_get_luks2_reencrypt(cd);
+	if (!rh) {
+		log_err(cd, _("Missing or invalid reencrypt context."));
+		return -EINVAL;
+	}
+
+	if (hotzones > CRYPT_REENCRYPT_HOTZONE_BATCH_MAX) {
+		log_err(cd, _("Invalid number of hotzones in batch."));
+		return -EINVAL;
+	}
+
+	if (hotzones <= 1)
+		return 0;
+
+	if (rh->online || rh->rp.type != REENC_PROTECTION_CHECKSUM || rh->jobj_segment_moved) {
+		log_dbg(cd, "Hotzone batching is used only for offline reencryption with checksum resilience.");
+		return 0;
+	}
+
+	block_size = rh->rp.p.csum.block_size;
+
+	/* all checksums of the batch must fit in reencryption keyslot area */
+	limit = (rh->rp.p.csum.checksums_len / rh->rp.p.csum.hash_size) * block_size;
+	if (limit > LUKS2_REENCRYPT_MAX_HOTZONE_LENGTH)
+		limit = LUKS2_REENCRYPT_MAX_HOTZONE_LENGTH;
+
+	/* crash recovery reads whole hotzone in memory */
+	soft_mem_limit = crypt_getphysmemory_kb() << 8;
+	if (soft_mem_limit && limit > soft_mem_limit)
+		limit = soft_mem_limit;
+
+	length = (uint64_t)hotzones * rh->reenc_buffer_length;
+	if (length > limit)
+		length = limit;
+	length -= length % block_size;
+
+	if (length <= rh->length)
+		return 0;
+
+	if (rh->direction == CRYPT_REENCRYPT_FORWARD) {
+		if (length > rh->device_size - rh->offset)
+			length = rh->device_size - rh->offset;
+	} else {
+		end = rh->offset + rh->length;
+		if (length > end)
+			length = end;
+		rh->offset = end - length;
+	}
+
+	log_dbg(cd, "Batching %" PRIu64 " bytes of hotzones (buffer %zu bytes) in one metadata commit.",
+		length, rh->reenc_buffer_length);
+
+	rh->length = length;
+	rh->max_length = length;
+
+	return 0;
+#else
+	UNUSED(hotzones);
+	log_err(cd, _("This operation is not supported for this device type."));
+	return -ENOTSUP;
+#endif
+}
 #if USE_LUKS2_REENCRYPTION
 static int reencrypt_recovery(struct crypt_device *cd,
 		struct luks2_hdr *hdr,
@@ -4373,3 +5394,276 @@ crypt_reencrypt_info LUKS2_reencrypt_get_params(struct luks2_hdr *hdr,
 
 	return ri;
 }
+
+#if USE_LUKS2_REENCRYPTION
+/* Hotzone length as reencryption initialization would compute it for the resilience type */
+static int reencrypt_benchmark_hotzone(struct crypt_device *cd, struct luks2_hdr *hdr,
+	const struct crypt_params_reencrypt *params, uint32_t block_size, uint64_t *length)
+{
+	uint64_t dummy, area_length;
+	int hash_size;
+
+	if (params->max_hotzone_size)
+		*length = params->max_hotzone_size << SECTOR_SHIFT;
+	else if (!strcmp(params->resilience, "none"))
+		*length = LUKS2_DEFAULT_NONE_REENCRYPTION_LENGTH;
+	else if (!strncmp(params->resilience, "datashift", 9))
+		*length = params->data_shift << SECTOR_SHIFT;
+	else {
+		/* reencryption keyslot takes the largest free area */
+		if (LUKS2_find_area_max_gap(cd, hdr, &dummy, &area_length) < 0)
+			return -EINVAL;
+		if (!strcmp(params->resilience, "checksum")) {
+			hash_size = crypt_hash_size(params->hash);
+			if (hash_size <= 0)
+				return -EINVAL;
+			*length = area_length / hash_size * block_size;
+		} else if (!strcmp(params->resilience, "journal"))
+			*length = area_length;
+		else
+			return -EINVAL;
+	}
+
+	if (*length > LUKS2_REENCRYPT_MAX_HOTZONE_LENGTH)
+		*length = LUKS2_REENCRYPT_MAX_HOTZONE_LENGTH;
+	*length -= *length % block_size;
+
+	return *length ? 0 : -EINVAL;
+}
+
+/*
+ * One sampled hotzone: read, resilience (checksums or journal write), write
+ * of unchanged data back to the same place with data sync (only if writes
+ * are enabled) and decryption with encryption in memory. New ciphertext is
+ * never written, so the device content does not change.
+ */
+static int reencrypt_benchmark_hotzone_step(struct crypt_device *cd,
+	const struct crypt_params_reencrypt *params,
+	struct crypt_storage_wrapper *cw1, struct crypt_storage_wrapper *cw2,
+	uint32_t block_size, bool write, uint64_t offset, void *buffer,
+	size_t length, struct crypt_reencrypt_stats *stats)
+{
+	uint64_t t;
+	ssize_t s;
+	char *csums;
+	int r = 0, hash_size;
+
+	t = reencrypt_time_us();
+	s = crypt_storage_wrapper_read(cw1, offset, buffer, length);
+	if (s < 0 || (size_t)s != length)
+		return -EIO;
+	t = reencrypt_stats_add(&stats->read_us, t);
+
+	if (!strcmp(params->resilience, "checksum")) {
+		hash_size = crypt_hash_size(params->hash);
+		csums = malloc(length / block_size * hash_size);
+		if (!csums)
+			return -ENOMEM;
+		r = crypt_hash_blocks(params->hash, crypt_cpusonline(), buffer, length,
+				      block_size, csums, hash_size);
+		free(csums);
+	} else if (write && !strcmp(params->resilience, "journal")) {
+		/* journal copy costs another write of the whole hotzone */
+		s = crypt_storage_wrapper_write(cw2, offset, buffer, length);
+		if (s < 0 || (size_t)s != length || crypt_storage_wrapper_datasync(cw2))
+			r = -EIO;
+	}
+	if (r)
+		return r;
+	t = reencrypt_stats_add(&stats->protect_us, t);
+
+	if (write) {
+		s = crypt_storage_wrapper_write(cw2, offset, buffer, length);
+		if (s < 0 || (size_t)s != length)
+			return -EIO;
+		t = reencrypt_stats_add(&stats->write_us, t);
+		if (crypt_storage_wrapper_datasync(cw2))
+			return -EIO;
+		t = reencrypt_stats_add(&stats->datasync_us, t);
+	}
+
+	r = crypt_storage_wrapper_reencrypt(cw1, cw2, offset, buffer, length);
+	if (r)
+		return r;
+	(void)reencrypt_stats_add(&stats->transform_us, t);
+
+	stats->length += length;
+	return 0;
+}
+
+static int reencrypt_benchmark(struct crypt_device *cd, struct luks2_hdr *hdr,
+	struct volume_key *vk_old, struct volume_key *vk_new, const char *cipher_new,
+	const struct crypt_params_reencrypt *params, uint64_t sample_size,
+	uint32_t flags, struct crypt_reencrypt_benchmark *result)
+{
+	struct crypt_storage_wrapper *cw1 = NULL, *cw2 = NULL;
+	struct crypt_reencrypt_stats *stats = &result->sample;
+	uint32_t sector_size_old = LUKS2_get_sector_size(hdr), sector_size_new, block_size;
+	uint64_t i, count, offset, data_offset = LUKS2_get_data_offset(hdr) << SECTOR_SHIFT,
+		 length, t;
+	bool write = flags & CRYPT_REENCRYPT_BENCHMARK_WRITE;
+	void *buffer = NULL;
+	int r;
+
+	sector_size_new = params->luks2 && params->luks2->sector_size ?
+			  params->luks2->sector_size : sector_size_old;
+	block_size = sector_size_old > sector_size_new ? sector_size_old : sector_size_new;
+
+	r = device_size(crypt_data_device(cd), &result->data_size);
+	if (r < 0)
+		return r;
+	if (result->data_size <= data_offset)
+		return -EINVAL;
+	result->data_size -= data_offset;
+	if (params->device_size && (params->device_size << SECTOR_SHIFT) < result->data_size)
+		result->data_size = params->device_size << SECTOR_SHIFT;
+	result->data_size -= result->data_size % block_size;
+
+	r = reencrypt_benchmark_hotzone(cd, hdr, params, block_size, &result->hotzone_size);
+	if (r < 0) {
+		log_err(cd, _("Cannot compute hotzone size for resilience %s."), params->resilience);
+		return r;
+	}
+	if (result->hotzone_size > result->data_size)
+		result->hotzone_size = result->data_size;
+	result->hotzones = (result->data_size + result->hotzone_size - 1) / result->hotzone_size;
+
+	/* unchanged data are written back only if nobody else can use the device */
+	if (write) {
+		r = device_open_excl(cd, crypt_data_device(cd), O_RDONLY);
+		if (r < 0) {
+			log_err(cd, _("Cannot exclusively open %s, device in use."),
+				device_path(crypt_data_device(cd)));
+			return r;
+		}
+	}
+
+	/* userspace transformation only, new ciphertext is never written */
+	r = crypt_storage_wrapper_init(cd, &cw1, crypt_data_device(cd), data_offset,
+			crypt_get_iv_offset(cd), sector_size_old,
+			LUKS2_get_cipher(hdr, CRYPT_DEFAULT_SEGMENT), vk_old,
+			DISABLE_DMCRYPT | USE_IO_URING | OPEN_READONLY);
+	if (!r)
+		r = crypt_storage_wrapper_init(cd, &cw2, crypt_data_device(cd), data_offset,
+				crypt_get_iv_offset(cd), sector_size_new, cipher_new, vk_new,
+				DISABLE_DMCRYPT | USE_IO_URING | (write ? 0 : OPEN_READONLY));
+	if (r) {
+		log_err(cd, _("Failed to initialize storage wrappers."));
+		goto out;
+	}
+
+	if (posix_memalign(&buffer, device_alignment(crypt_data_device(cd)), result->hotzone_size)) {
+		r = -ENOMEM;
+		goto out;
+	}
+	crypt_memory_io_get(cd, result->hotzone_size);
+	(void)crypt_storage_wrapper_register_buffer(cw1, buffer, result->hotzone_size);
+	(void)crypt_storage_wrapper_register_buffer(cw2, buffer, result->hotzone_size);
+
+	/* hotzones spread evenly over the device */
+	count = ((sample_size ?: result->hotzone_size) + result->hotzone_size - 1) / result->hotzone_size;
+	if (count > result->hotzones)
+		count = result->hotzones;
+
+	log_dbg(cd, "Reencryption benchmark of %" PRIu64 " hotzones of %" PRIu64 " bytes (%s).",
+		count, result->hotzone_size, write ? "with writes" : "read only");
+
+	t = reencrypt_time_us();
+	for (i = 0; i < count && !r; i++) {
+		offset = count > 1 ? (result->data_size - result->hotzone_size) / (count - 1) * i : 0;
+		offset -= offset % block_size;
+		length = result->data_size - offset < result->hotzone_size ?
+			 result->data_size - offset : result->hotzone_size;
+		r = reencrypt_benchmark_hotzone_step(cd, params, cw1, cw2, block_size, write,
+						     offset, buffer, length, stats);
+	}
+	(void)reencrypt_stats_add(&stats->total_us, t);
+
+	if (!r && stats->length)
+		result->projected_us = stats->total_us * result->data_size / stats->length;
+out:
+	if (buffer)
+		crypt_memory_io_put(cd, result->hotzone_size);
+	free(buffer);
+	crypt_storage_wrapper_destroy(cw1);
+	crypt_storage_wrapper_destroy(cw2);
+	if (write)
+		device_release_excl(cd, crypt_data_device(cd));
+	return r;
+}
+#endif
+
+int crypt_reencrypt_benchmark(struct crypt_device *cd,
+	const char *passphrase,
+	size_t passphrase_size,
+	int keyslot_old,
+	const char *cipher,
+	const char *cipher_mode,
+	size_t volume_key_size,
+	const struct crypt_params_reencrypt *params,
+	uint64_t sample_size,
+	uint32_t flags,
+	struct crypt_reencrypt_benchmark *result)
+{
+#if USE_LUKS2_REENCRYPTION
+	struct luks2_hdr *hdr;
+	struct volume_key *vk_old = NULL, *vk_new = NULL;
+	char cipher_new[MAX_CIPHER_LEN * 2];
+	int r;
+
+	if (onlyLUKS2(cd) || !passphrase || !params || !params->resilience || !result)
+		return -EINVAL;
+
+	if (params->mode != CRYPT_REENCRYPT_REENCRYPT && params->mode != CRYPT_REENCRYPT_DECRYPT) {
+		log_err(cd, _("Reencryption benchmark is supported only for reencryption and decryption."));
+		return -ENOTSUP;
+	}
+
+	hdr = crypt_get_hdr(cd, CRYPT_LUKS2);
+	if (LUKS2_reencrypt_status(hdr) != CRYPT_REENCRYPT_NONE) {
+		log_err(cd, _("Device is already in reencryption."));
+		return -EINVAL;
+	}
+
+	if (params->mode == CRYPT_REENCRYPT_DECRYPT)
+		strcpy(cipher_new, "cipher_null-ecb");
+	else if (!cipher || !cipher_mode || !volume_key_size ||
+		 snprintf(cipher_new, sizeof(cipher_new), "%s-%s", cipher, cipher_mode) < 0)
+		return -EINVAL;
+
+	memset(result, 0, sizeof(*result));
+
+	r = LUKS2_keyslot_open(cd, keyslot_old, CRYPT_DEFAULT_SEGMENT, passphrase,
+			       passphrase_size, &vk_old);
+	if (r < 0)
+		return r;
+
+	if (params->mode == CRYPT_REENCRYPT_REENCRYPT) {
+		vk_new = crypt_generate_volume_key(cd, volume_key_size);
+		if (!vk_new) {
+			r = -ENOMEM;
+			goto out;
+		}
+	}
+
+	r = reencrypt_benchmark(cd, hdr, vk_old, vk_new, cipher_new, params,
+				sample_size, flags, result);
+out:
+	crypt_free_volume_key(vk_old);
+	crypt_free_volume_key(vk_new);
+	return r;
+#else
+	UNUSED(passphrase);
+	UNUSED(passphrase_size);
+	UNUSED(keyslot_old);
+	UNUSED(cipher);
+	UNUSED(cipher_mode);
+	UNUSED(volume_key_size);
+	UNUSED(params);
+	UNUSED(sample_size);
+	UNUSED(flags);
+	UNUSED(result);
+	log_err(cd, _("This operation is not supported for this device type."));
+	return -ENOTSUP;
+#endif
+}
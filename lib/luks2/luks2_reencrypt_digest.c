@@ -261,12 +261,48 @@ static size_t blob_serialize(void *blob, size_t length, uint8_t *buffer)
 	return length;
 }
 
+/*
+ * Serialization buffer is kept with the header and reused by every digest
+ * create and verify (reencryption init, load, resume and recovery). Repeated
+ * PBKDF2 digest checks of the same data are skipped by the verified key cache.
+ */
+struct luks2_reencrypt_digest {
+	/* keylength is set for current data, data_size is allocated length */
+	struct volume_key *data;
+	size_t data_size;
+};
+
+static struct luks2_reencrypt_digest *reencrypt_digest_cache(struct luks2_hdr *hdr)
+{
+	if (!hdr->reencrypt_digest)
+		hdr->reencrypt_digest = calloc(1, sizeof(*hdr->reencrypt_digest));
+
+	return hdr->reencrypt_digest;
+}
+
+void LUKS2_reencrypt_digest_cache_free(struct luks2_hdr *hdr)
+{
+	struct luks2_reencrypt_digest *c = hdr->reencrypt_digest;
+
+	if (!c)
+		return;
+
+	if (c->data) {
+		c->data->keylength = c->data_size;
+		crypt_free_volume_key(c->data);
+	}
+	crypt_safe_memzero(c, sizeof(*c));
+	free(c);
+	hdr->reencrypt_digest = NULL;
+}
+
 static int reencrypt_assembly_verification_data(struct crypt_device *cd,
 	struct luks2_hdr *hdr,
 	struct volume_key *vks,
 	uint8_t version,
 	struct volume_key **verification_data)
 {
+	struct luks2_reencrypt_digest *c;
 	uint8_t *ptr;
 	int digest_new, digest_old;
 	struct volume_key *data = NULL, *vk_old = NULL, *vk_new = NULL;
@@ -311,11 +347,24 @@ static int reencrypt_assembly_verification_data(struct crypt_device *cd,
 		return -EINVAL;
 	data_len += segments_data_len;
 
-	/* Alloc and fill serialization data */
-	data = crypt_alloc_volume_key(data_len, NULL);
-	if (!data)
+	/* Fill serialization data, buffer is kept in header for the next use */
+	if (!(c = reencrypt_digest_cache(hdr)))
 		return -ENOMEM;
 
+	if (c->data_size < data_len) {
+		data = crypt_alloc_volume_key(data_len, NULL);
+		if (!data)
+			return -ENOMEM;
+		if (c->data) {
+			c->data->keylength = c->data_size;
+			crypt_free_volume_key(c->data);
+		}
+		c->data = data;
+		c->data_size = data_len;
+	}
+	data = c->data;
+	data->keylength = data_len;
+
 	ptr = (uint8_t*)data->key;
 
 	*ptr++ = 0x76;
@@ -341,10 +390,15 @@ static int reencrypt_assembly_verification_data(struct crypt_device *cd,
 
 	return 0;
 bad:
-	crypt_free_volume_key(data);
+	crypt_safe_memzero(data->key, data_len);
 	return -EINVAL;
 }
 
+static void reencrypt_verification_data_wipe(struct volume_key *data)
+{
+	crypt_safe_memzero(data->key, data->keylength);
+}
+
 int LUKS2_keyslot_reencrypt_digest_create(struct crypt_device *cd,
 	struct luks2_hdr *hdr,
 	uint8_t version,
@@ -362,17 +416,19 @@ int LUKS2_keyslot_reencrypt_digest_create(struct crypt_device *cd,
 		return r;
 
 	r = LUKS2_digest_create(cd, "pbkdf2", hdr, data);
-	crypt_free_volume_key(data);
 	if (r < 0)
-		return r;
+		goto out;
 
 	digest_reencrypt = r;
 
 	r = LUKS2_digest_assign(cd, hdr, keyslot_reencrypt, CRYPT_ANY_DIGEST, 0, 0);
 	if (r < 0)
-		return r;
+		goto out;
 
-	return LUKS2_digest_assign(cd, hdr, keyslot_reencrypt, digest_reencrypt, 1, 0);
+	r = LUKS2_digest_assign(cd, hdr, keyslot_reencrypt, digest_reencrypt, 1, 0);
+out:
+	reencrypt_verification_data_wipe(data);
+	return r;
 }
 
 int LUKS2_reencrypt_digest_verify(struct crypt_device *cd,
@@ -397,7 +453,7 @@ int LUKS2_reencrypt_digest_verify(struct crypt_device *cd,
 		return r;
 
 	r = LUKS2_digest_verify(cd, hdr, data, keyslot_reencrypt);
-	crypt_free_volume_key(data);
+	reencrypt_verification_data_wipe(data);
 
 	if (r < 0) {
 		if (r == -ENOENT)
@@ -263,6 +263,21 @@ json_object *json_segment_create_crypt(uint64_t offset,
 	return jobj;
 }
 
+/* Existing ciphertext with IV counted from elsewhere and fixed length (adopted formats) */
+int LUKS2_segment_set_iv_and_size(struct luks2_hdr *hdr, int segment,
+				  uint64_t iv_offset, uint64_t size)
+{
+	json_object *jobj_segment = LUKS2_get_segment_jobj(hdr, segment);
+
+	if (!LUKS2_segment_is_type(hdr, segment, "crypt"))
+		return -EINVAL;
+
+	json_object_object_add(jobj_segment, "iv_tweak", crypt_jobj_new_uint64(iv_offset));
+	json_object_object_add(jobj_segment, "size", crypt_jobj_new_uint64(size));
+
+	return 0;
+}
+
 uint64_t LUKS2_segment_offset(struct luks2_hdr *hdr, int segment, unsigned blockwise)
 {
 	return json_segment_get_offset(LUKS2_get_segment_jobj(hdr, segment), blockwise);
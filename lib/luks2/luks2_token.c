@@ -21,6 +21,8 @@
 
 #include <ctype.h>
 #include <dlfcn.h>
+#include <pthread.h>
+#include <time.h>
 
 #include "luks2_internal.h"
 
@@ -44,6 +46,22 @@ static struct crypt_token_handler_internal token_handlers[LUKS2_TOKENS_MAX] = {
 	}
 };
 
+/*
+ * Handlers are shared by all contexts in the process and external ones stay
+ * loaded until library unload. Names of external handlers that failed to load
+ * are remembered for a short time, so missing plugins are not searched for
+ * on every device, but a plugin installed later is still found.
+ */
+#define TOKEN_LOAD_RETRY_MS 5000
+
+struct token_load_failure {
+	char *type;
+	uint64_t expires_ms;
+};
+
+static pthread_mutex_t token_handlers_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct token_load_failure token_load_failed[LUKS2_TOKENS_MAX];
+
 void crypt_token_external_disable(void)
 {
 	external_tokens_enabled = false;
@@ -234,13 +252,15 @@ int crypt_token_register(const crypt_token_handler *handler)
 	if (!token_validate_v1(NULL, handler))
 		return -EINVAL;
 
+	pthread_mutex_lock(&token_handlers_lock);
 	r = crypt_token_find_free(NULL, handler->name, &i);
-	if (r < 0)
-		return r;
+	if (!r) {
+		token_handlers[i].version = 1;
+		token_handlers[i].u.v1 = *handler;
+	}
+	pthread_mutex_unlock(&token_handlers_lock);
 
-	token_handlers[i].version = 1;
-	token_handlers[i].u.v1 = *handler;
-	return 0;
+	return r;
 }
 
 void crypt_token_unload_external_all(struct crypt_device *cd)
@@ -248,6 +268,11 @@ void crypt_token_unload_external_all(struct crypt_device *cd)
 #if USE_EXTERNAL_TOKENS
 	int i;
 
+	for (i = 0; i < LUKS2_TOKENS_MAX; i++) {
+		free(token_load_failed[i].type);
+		token_load_failed[i].type = NULL;
+	}
+
 	for (i = LUKS2_TOKENS_MAX - 1; i >= 0; i--) {
 		if (token_handlers[i].version < 2)
 			continue;
@@ -262,25 +287,80 @@ void crypt_token_unload_external_all(struct crypt_device *cd)
 #endif
 }
 
+static uint64_t token_now_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return 0;
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Called with token_handlers_lock held, expired entries are dropped */
+static bool token_load_failed_recently(const char *type, uint64_t now)
+{
+	bool found = false;
+	int i;
+
+	for (i = 0; i < LUKS2_TOKENS_MAX; i++) {
+		if (!token_load_failed[i].type)
+			continue;
+		if (token_load_failed[i].expires_ms <= now) {
+			free(token_load_failed[i].type);
+			token_load_failed[i].type = NULL;
+		} else if (!strcmp(token_load_failed[i].type, type))
+			found = true;
+	}
+
+	return found;
+}
+
+/* Called with token_handlers_lock held */
+static void token_load_failed_add(const char *type, uint64_t now)
+{
+	int i;
+
+	for (i = 0; i < LUKS2_TOKENS_MAX; i++)
+		if (!token_load_failed[i].type) {
+			token_load_failed[i].type = strdup(type);
+			token_load_failed[i].expires_ms = now + TOKEN_LOAD_RETRY_MS;
+			return;
+		}
+}
+
 static const void
 *LUKS2_token_handler_type(struct crypt_device *cd, const char *type)
 {
-	int i;
+	const void *h = NULL;
+	uint64_t now;
+	int i, r;
 
-	for (i = 0; i < LUKS2_TOKENS_MAX && token_handlers[i].u.v1.name; i++)
-		if (!strcmp(token_handlers[i].u.v1.name, type))
-			return &token_handlers[i].u;
+	pthread_mutex_lock(&token_handlers_lock);
 
-	if (i >= LUKS2_TOKENS_MAX)
-		return NULL;
+	for (i = 0; i < LUKS2_TOKENS_MAX && token_handlers[i].u.v1.name; i++)
+		if (!strcmp(token_handlers[i].u.v1.name, type)) {
+			h = &token_handlers[i].u;
+			goto out;
+		}
 
-	if (is_builtin_candidate(type))
-		return NULL;
+	if (i >= LUKS2_TOKENS_MAX || is_builtin_candidate(type))
+		goto out;
 
-	if (crypt_token_load_external(cd, type, &token_handlers[i]))
-		return NULL;
+	now = token_now_ms();
+	if (token_load_failed_recently(type, now)) {
+		log_dbg(cd, "Token handler %s failed to load recently, skipping.", type);
+		goto out;
+	}
 
-	return &token_handlers[i].u;
+	r = crypt_token_load_external(cd, type, &token_handlers[i]);
+	if (!r)
+		h = &token_handlers[i].u;
+	else if (r != -ENOTSUP)
+		token_load_failed_add(type, now);
+out:
+	pthread_mutex_unlock(&token_handlers_lock);
+	return h;
 }
 
 static const void
@@ -478,21 +558,17 @@ static int translate_errno(struct crypt_device *cd, int ret_val, const char *typ
 	return ret_val;
 }
 
-static int token_open(struct crypt_device *cd,
+/* Checks done before token handler open callback, returns the handler in @h */
+static int token_open_prepare(struct crypt_device *cd,
 	struct luks2_hdr *hdr,
 	int token,
 	json_object *jobj_token,
 	const char *type,
 	int segment,
 	crypt_keyslot_priority priority,
-	const char *pin,
-	size_t pin_size,
-	char **buffer,
-	size_t *buffer_len,
-	void *usrptr,
-	bool requires_keyslot)
+	bool requires_keyslot,
+	const struct crypt_token_handler_v2 **h)
 {
-	const struct crypt_token_handler_v2 *h;
 	json_object *jobj_type;
 	int r;
 
@@ -515,14 +591,38 @@ static int token_open(struct crypt_device *cd,
 		return r;
 	}
 
-	if (!(h = LUKS2_token_handler(cd, token)))
+	if (!(*h = LUKS2_token_handler(cd, token)))
 		return -ENOENT;
 
-	if (h->validate && h->validate(cd, token_json_to_string(jobj_token))) {
-		log_dbg(cd, "Token %d (%s) validation failed.", token, h->name);
+	if ((*h)->validate && (*h)->validate(cd, token_json_to_string(jobj_token))) {
+		log_dbg(cd, "Token %d (%s) validation failed.", token, (*h)->name);
 		return -ENOENT;
 	}
 
+	return 0;
+}
+
+static int token_open(struct crypt_device *cd,
+	struct luks2_hdr *hdr,
+	int token,
+	json_object *jobj_token,
+	const char *type,
+	int segment,
+	crypt_keyslot_priority priority,
+	const char *pin,
+	size_t pin_size,
+	char **buffer,
+	size_t *buffer_len,
+	void *usrptr,
+	bool requires_keyslot)
+{
+	const struct crypt_token_handler_v2 *h;
+	int r;
+
+	r = token_open_prepare(cd, hdr, token, jobj_token, type, segment, priority, requires_keyslot, &h);
+	if (r < 0)
+		return r;
+
 	if (pin && !h->open_pin)
 		r = -ENOENT;
 	else if (pin)
@@ -636,6 +736,209 @@ static void token_block(int token, uint32_t *block_list)
 	*block_list |= (UINT32_C(1) << token);
 }
 
+struct token_open_batch;
+
+struct token_open_job {
+	struct crypt_device *cd;
+	const struct crypt_token_handler_v2 *h;
+	int token;
+	void *usrptr;
+	char *buffer;
+	size_t buffer_size;
+	struct token_open_batch *batch;
+	pthread_t thread;
+	bool threaded;
+	bool done;
+	int r;
+};
+
+struct token_open_batch {
+	pthread_mutex_t lock;
+	pthread_cond_t done_cond;
+	bool abandoned;
+	int count;
+	struct token_open_job jobs[LUKS2_TOKENS_MAX];
+};
+
+static void token_open_job_buffer_free(struct token_open_job *job)
+{
+	if (job->h->buffer_free)
+		job->h->buffer_free(job->buffer, job->buffer_size);
+	else {
+		crypt_safe_memzero(job->buffer, job->buffer_size);
+		free(job->buffer);
+	}
+	job->buffer = NULL;
+}
+
+static void *token_open_thread(void *arg)
+{
+	struct token_open_job *job = arg;
+	struct token_open_batch *batch = job->batch;
+	int r;
+
+	r = translate_errno(job->cd, job->h->open(job->cd, job->token, &job->buffer,
+			    &job->buffer_size, job->usrptr), job->h->name);
+	if (r < 0)
+		log_dbg(job->cd, "Token %d (%s) open failed with %d.", job->token, job->h->name, r);
+
+	pthread_mutex_lock(&batch->lock);
+	job->r = r;
+	job->done = true;
+	/* the caller already returned, nobody takes the buffer */
+	if (batch->abandoned && !r)
+		token_open_job_buffer_free(job);
+	pthread_cond_broadcast(&batch->done_cond);
+	pthread_mutex_unlock(&batch->lock);
+
+	return NULL;
+}
+
+/*
+ * Wait for token open callbacks left running by a previous parallel open.
+ */
+void LUKS2_token_open_wait(struct crypt_device *cd)
+{
+	struct token_open_batch *batch = crypt_get_token_open_batch(cd);
+	int i;
+
+	if (!batch)
+		return;
+
+	for (i = 0; i < batch->count; i++)
+		if (batch->jobs[i].threaded)
+			pthread_join(batch->jobs[i].thread, NULL);
+
+	pthread_cond_destroy(&batch->done_cond);
+	pthread_mutex_destroy(&batch->lock);
+	free(batch);
+	crypt_set_token_open_batch(cd, NULL);
+}
+
+/*
+ * Token open callbacks (without pin) of one priority run concurrently, their
+ * results are processed in token order (as in sequential open) in the calling
+ * thread. Callbacks cannot be interrupted; once a token in order unlocks a key,
+ * the remaining ones are left running, their results are discarded and they
+ * are waited for in the next parallel open or in crypt_free().
+ *
+ * Token handlers reach the context through library calls only, the ones they
+ * use (token JSON, logging) are serialized with the token open code here.
+ */
+static int token_open_priority_parallel(struct crypt_device *cd,
+	struct luks2_hdr *hdr,
+	json_object *jobj_tokens,
+	const char *type,
+	int segment,
+	crypt_keyslot_priority priority,
+	void *usrptr,
+	int *stored_retval,
+	uint32_t *block_list,
+	struct volume_key **vk)
+{
+	struct token_open_batch *batch;
+	struct token_open_job *job;
+	const struct crypt_token_handler_v2 *h;
+	int i, token, r, r_final = 0, r_collect = 0;
+	bool stop = false;
+
+	LUKS2_token_open_wait(cd);
+
+	batch = calloc(1, sizeof(*batch));
+	if (!batch)
+		return -ENOMEM;
+	pthread_mutex_init(&batch->lock, NULL);
+	pthread_cond_init(&batch->done_cond, NULL);
+	crypt_set_token_open_batch(cd, batch);
+
+	crypt_token_cd_lock(cd);
+
+	json_object_object_foreach(jobj_tokens, slot, val) {
+		token = atoi(slot);
+		if (token_is_blocked(token, block_list) || batch->count >= LUKS2_TOKENS_MAX)
+			continue;
+
+		r = token_open_prepare(cd, hdr, token, val, type, segment, priority, true, &h);
+		if (r < 0 && break_loop_retval(r)) {
+			/* as in sequential open, later tokens are not tried */
+			r_collect = r;
+			break;
+		}
+		if (r < 0) {
+			update_return_errno(r, stored_retval);
+			continue;
+		}
+
+		job = &batch->jobs[batch->count++];
+		job->cd = cd;
+		job->h = h;
+		job->token = token;
+		job->usrptr = usrptr;
+		job->batch = batch;
+	}
+
+	if (batch->count)
+		log_dbg(cd, "Opening %d tokens with priority %d in parallel.", batch->count, priority);
+
+	for (i = 0; i < batch->count; i++) {
+		job = &batch->jobs[i];
+		job->threaded = !pthread_create(&job->thread, NULL, token_open_thread, job);
+		if (!job->threaded)
+			(void)token_open_thread(job);
+	}
+
+	for (i = 0; i < batch->count && !stop; i++) {
+		job = &batch->jobs[i];
+
+		/* handlers running in other threads can use the context meanwhile */
+		crypt_token_cd_unlock(cd);
+		pthread_mutex_lock(&batch->lock);
+		while (!job->done)
+			pthread_cond_wait(&batch->done_cond, &batch->lock);
+		pthread_mutex_unlock(&batch->lock);
+		crypt_token_cd_lock(cd);
+
+		r = job->r;
+		if (!r) {
+			r = LUKS2_keyslot_open_by_token(cd, hdr, job->token, segment, priority,
+							job->buffer, job->buffer_size, vk);
+			token_open_job_buffer_free(job);
+		}
+
+		if (r == -ENOANO)
+			token_block(job->token, block_list);
+
+		if (break_loop_retval(r)) {
+			r_final = r;
+			stop = true;
+			continue;
+		}
+
+		update_return_errno(r, stored_retval);
+	}
+
+	/* release buffers of finished but unprocessed tokens, running ones do it itself */
+	pthread_mutex_lock(&batch->lock);
+	batch->abandoned = true;
+	for (; i < batch->count; i++)
+		if (batch->jobs[i].done && !batch->jobs[i].r)
+			token_open_job_buffer_free(&batch->jobs[i]);
+	for (i = 0; i < batch->count && batch->jobs[i].done; i++);
+	pthread_mutex_unlock(&batch->lock);
+
+	crypt_token_cd_unlock(cd);
+
+	if (i == batch->count)
+		LUKS2_token_open_wait(cd);
+	else
+		log_dbg(cd, "Token open callbacks still running, results will be discarded.");
+
+	if (stop)
+		return r_final;
+
+	return r_collect ?: *stored_retval;
+}
+
 static int token_open_priority(struct crypt_device *cd,
 	struct luks2_hdr *hdr,
 	json_object *jobj_tokens,
@@ -656,6 +959,10 @@ static int token_open_priority(struct crypt_device *cd,
 	assert(stored_retval);
 	assert(block_list);
 
+	if (!pin && crypt_get_token_parallel_open(cd))
+		return token_open_priority_parallel(cd, hdr, jobj_tokens, type, segment, priority,
+						    usrptr, stored_retval, block_list, vk);
+
 	json_object_object_foreach(jobj_tokens, slot, val) {
 		token = atoi(slot);
 		if (token_is_blocked(token, block_list))
@@ -21,11 +21,18 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
+#include <sys/mman.h>
 #include <sys/select.h>
+#ifdef HAVE_SYS_RANDOM_H
+#include <sys/random.h>
+#endif
 
 #include "libcryptsetup.h"
 #include "internal.h"
 
+/* Contexts can be initialized from several threads at once */
+static pthread_mutex_t random_init_lock = PTHREAD_MUTEX_INITIALIZER;
 static int random_initialised = 0;
 
 #define URANDOM_DEVICE	"/dev/urandom"
@@ -40,6 +47,136 @@ static int random_fd = -1;
 /* Timeout to print warning if no random data (entropy) */
 #define RANDOM_DEVICE_TIMEOUT	5
 
+#if defined(HAVE_GETRANDOM) && defined(HAVE_SYS_RANDOM_H)
+#define USE_GETRANDOM 1
+
+/*
+ * Small requests (salts, AF stripes, wipe keys) are served from a per-process
+ * buffer refilled by one getrandom() call. Consumed bytes are wiped at once.
+ * The buffer is mapped with MADV_WIPEONFORK (and the owner pid is checked
+ * for kernels without it), so a forked child never reuses parent's bytes.
+ */
+#define RANDOM_POOL_SIZE	4096
+#define RANDOM_POOL_MAX_REQUEST	256
+
+struct random_pool {
+	pid_t pid;
+	size_t avail;
+	unsigned char data[RANDOM_POOL_SIZE];
+};
+
+static pthread_mutex_t random_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct random_pool *random_pool = NULL;
+static size_t random_pool_mapped = 0;
+static int getrandom_missing = 0;
+
+/* getrandom() with urandom source, returns -ENOSYS if not usable */
+static int _get_getrandom(char *buf, size_t len)
+{
+	ssize_t r;
+
+	if (getrandom_missing)
+		return -ENOSYS;
+
+	while (len) {
+		r = getrandom(buf, len, 0);
+		if (r == -1 && errno == EINTR)
+			continue;
+		if (r == -1 && errno == ENOSYS) {
+			getrandom_missing = 1;
+			return -ENOSYS;
+		}
+		if (r <= 0)
+			return -EINVAL;
+		len -= r;
+		buf += r;
+	}
+
+	return 0;
+}
+
+static void random_pool_init(void)
+{
+	size_t size;
+	void *p;
+
+	if (random_pool || getrandom_missing)
+		return;
+
+	size = crypt_getpagesize();
+	size = (sizeof(struct random_pool) + size - 1) / size * size;
+
+	p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (p == MAP_FAILED)
+		return;
+
+	/* Neither swap nor core dumps, the pool can only be an optimization */
+	(void)mlock(p, size);
+#ifdef MADV_DONTDUMP
+	(void)madvise(p, size, MADV_DONTDUMP);
+#endif
+#ifdef MADV_WIPEONFORK
+	(void)madvise(p, size, MADV_WIPEONFORK);
+#endif
+	random_pool = p;
+	random_pool_mapped = size;
+}
+
+static void random_pool_destroy(void)
+{
+	pthread_mutex_lock(&random_pool_lock);
+	if (random_pool) {
+		crypt_safe_memzero(random_pool, random_pool_mapped);
+		(void)munmap(random_pool, random_pool_mapped);
+		random_pool = NULL;
+		random_pool_mapped = 0;
+	}
+	pthread_mutex_unlock(&random_pool_lock);
+}
+
+static int _get_pooled(char *buf, size_t len)
+{
+	unsigned char *p;
+	size_t n;
+	int r = 0;
+
+	if (len > RANDOM_POOL_MAX_REQUEST)
+		return _get_getrandom(buf, len);
+
+	pthread_mutex_lock(&random_pool_lock);
+	if (!random_pool) {
+		pthread_mutex_unlock(&random_pool_lock);
+		return _get_getrandom(buf, len);
+	}
+
+	if (random_pool->pid != getpid()) {
+		crypt_safe_memzero(random_pool->data, sizeof(random_pool->data));
+		random_pool->avail = 0;
+		random_pool->pid = getpid();
+	}
+
+	while (len) {
+		if (!random_pool->avail) {
+			r = _get_getrandom((char *)random_pool->data, sizeof(random_pool->data));
+			if (r < 0)
+				break;
+			random_pool->avail = sizeof(random_pool->data);
+		}
+
+		n = len < random_pool->avail ? len : random_pool->avail;
+		p = random_pool->data + sizeof(random_pool->data) - random_pool->avail;
+		memcpy(buf, p, n);
+		crypt_safe_memzero(p, n);
+		random_pool->avail -= n;
+		buf += n;
+		len -= n;
+	}
+	pthread_mutex_unlock(&random_pool_lock);
+
+	return r;
+}
+#endif
+
 /* URANDOM_DEVICE access */
 static int _get_urandom(char *buf, size_t len)
 {
@@ -47,6 +184,11 @@ static int _get_urandom(char *buf, size_t len)
 	size_t old_len = len;
 	char *old_buf = buf;
 
+#ifdef USE_GETRANDOM
+	r = _get_getrandom(buf, len);
+	if (r != -ENOSYS)
+		return r;
+#endif
 	assert(urandom_fd != -1);
 
 	while (len) {
@@ -142,7 +284,7 @@ static int _get_random(struct crypt_device *ctx, char *buf, size_t len)
 	return 0;
 }
 /* Initialisation of both RNG file descriptors is mandatory */
-int crypt_random_init(struct crypt_device *ctx)
+static int _random_init(struct crypt_device *ctx)
 {
 	if (random_initialised)
 		return 0;
@@ -162,6 +304,11 @@ int crypt_random_init(struct crypt_device *ctx)
 	if (crypt_fips_mode())
 		log_verbose(ctx, _("Running in FIPS mode."));
 
+#ifdef USE_GETRANDOM
+	pthread_mutex_lock(&random_pool_lock);
+	random_pool_init();
+	pthread_mutex_unlock(&random_pool_lock);
+#endif
 	random_initialised = 1;
 	return 0;
 err:
@@ -170,6 +317,17 @@ err:
 	return -ENOSYS;
 }
 
+int crypt_random_init(struct crypt_device *ctx)
+{
+	int r;
+
+	pthread_mutex_lock(&random_init_lock);
+	r = _random_init(ctx);
+	pthread_mutex_unlock(&random_init_lock);
+
+	return r;
+}
+
 /* coverity[ -taint_source : arg-1 ] */
 int crypt_random_get(struct crypt_device *ctx, char *buf, size_t len, int quality)
 {
@@ -177,13 +335,24 @@ int crypt_random_get(struct crypt_device *ctx, char *buf, size_t len, int qualit
 
 	switch(quality) {
 	case CRYPT_RND_NORMAL:
+#ifdef USE_GETRANDOM
+		status = _get_pooled(buf, len);
+		if (status != -ENOSYS)
+			break;
+#endif
 		status = _get_urandom(buf, len);
 		break;
 	case CRYPT_RND_SALT:
-		if (crypt_fips_mode())
+		if (crypt_fips_mode()) {
 			status = crypt_backend_rng(buf, len, quality, 1);
-		else
-			status = _get_urandom(buf, len);
+			break;
+		}
+#ifdef USE_GETRANDOM
+		status = _get_pooled(buf, len);
+		if (status != -ENOSYS)
+			break;
+#endif
+		status = _get_urandom(buf, len);
 		break;
 	case CRYPT_RND_KEY:
 		if (crypt_fips_mode()) {
@@ -218,6 +387,10 @@ void crypt_random_exit(void)
 {
 	random_initialised = 0;
 
+#ifdef USE_GETRANDOM
+	random_pool_destroy();
+#endif
+
 	if(random_fd != -1) {
 		(void)close(random_fd);
 		random_fd = -1;
@@ -26,7 +26,12 @@
 #include <stdlib.h>
 #include <stdarg.h>
 #include <sys/utsname.h>
+#include <sys/stat.h>
 #include <errno.h>
+#include <pthread.h>
+#ifdef HAVE_SYS_SYSMACROS_H
+# include <sys/sysmacros.h>     /* for major, minor */
+#endif
 
 #include "libcryptsetup.h"
 #include "luks1/luks.h"
@@ -62,6 +67,71 @@ struct crypt_device {
 	uint64_t metadata_size; /* Used in LUKS2 format */
 	uint64_t keyslots_size; /* Used in LUKS2 format */
 
+	/* PBKDF calibration cache file */
+	char *pbkdf_cache;
+
+	/* Lifetime of shared in-process derived key cache entries, 0 disables */
+	uint32_t derived_key_cache_ms;
+
+	/* Max. keyslots of the same priority unlocked in parallel, 0 or 1 is sequential */
+	unsigned keyslot_parallel_unlock;
+
+	/* Max. wipe writes in flight, 0 or 1 is sequential */
+	unsigned wipe_queue_depth;
+
+	/* Wipe checkpoint file, interrupted crypt_wipe() continues from it */
+	char *wipe_checkpoint;
+
+	/* Attach loop devices for image files with buffered I/O */
+	bool loop_buffered_io;
+
+	/* Progress callback throttling and smoothed rate of the last operation */
+	struct {
+		uint64_t interval_bytes;
+		uint32_t interval_ms;
+		bool started;
+		uint64_t start_us, last_us;
+		uint64_t start_offset, last_offset, size;
+		double rate;
+	} progress;
+
+	/* Select LUKS2 encryption sector size by measurement */
+	bool sector_size_benchmark;
+
+	/* Keyslot hint label, tagged keyslots are tried first */
+	char *keyslot_hint;
+
+	/* Use shared in-process cache of parsed LUKS2 headers */
+	bool header_cache;
+
+	/* Token open callbacks (without pin) of the same priority run concurrently */
+	bool token_parallel_open;
+	/* Serializes token handler calls into the context, callbacks left running */
+	pthread_mutex_t token_cd_lock;
+	void *token_open_batch;
+
+	/* Staged volume key shared by mappings, not dropped on their deactivation */
+	char *staged_key_description;
+
+	/* HMAC tags of volume keys that passed digest verification */
+	char *verified_key_secret;
+	char verified_key_tags[VERIFIED_KEY_TAGS][VERIFIED_KEY_TAG_SIZE];
+	unsigned verified_key_count;
+
+	/* LUKS2 header writes are deferred to crypt_header_transaction_commit() */
+	bool header_transaction;
+
+	/* JSON metadata read without loading for crypt_dump_json() */
+	struct luks2_hdr json_dump_hdr;
+
+	/* Phase timing, start times are relative to context initialization */
+	uint64_t init_us;
+	struct crypt_timing timing[CRYPT_TIMING_COUNT];
+
+	/* Memory accounting, I/O buffers allocated now */
+	struct crypt_memory_usage memory;
+	uint64_t io_current;
+
 	/* Workaround for OOM during parallel activation (like in systemd) */
 	bool memory_hard_pbkdf_lock_enabled;
 	struct crypt_lock_handle *pbkdf_memory_hard_lock;
@@ -99,6 +169,8 @@ struct crypt_device {
 		unsigned int root_hash_size;
 		char *uuid;
 		struct device *fec_device;
+		char *verify_cache;
+		unsigned int signature_cache_timeout;
 	} verity;
 	struct { /* used in CRYPT_TCRYPT */
 		struct crypt_params_tcrypt params;
@@ -137,6 +209,13 @@ struct crypt_device {
 /* Just to suppress redundant messages about crypto backend */
 static int _crypto_logged = 0;
 
+/* Crypto backends and RNG are initialized once for all contexts (and threads) */
+static pthread_mutex_t _crypto_init_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Number of allocated contexts, process-wide caches are flushed with the last one */
+static pthread_mutex_t _contexts_lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int _contexts = 0;
+
 /* Log helper */
 static void (*_default_log)(int level, const char *msg, void *usrptr) = NULL;
 static void *_default_log_usrptr = NULL;
@@ -145,6 +224,9 @@ static int _debug_level = 0;
 /* Library can do metadata locking  */
 static int _metadata_locking = 1;
 
+/* Read-only header loads first try without metadata lock */
+static int _metadata_read_optimistic = 0;
+
 /* Library scope detection for kernel keyring support */
 static int _kernel_keyring_supported;
 
@@ -169,9 +251,11 @@ void crypt_log(struct crypt_device *cd, int level, const char *msg)
 	if (level < _debug_level)
 		return;
 
-	if (cd && cd->log)
+	if (cd && cd->log) {
+		crypt_token_cd_lock(cd);
 		cd->log(level, msg, cd->log_usrptr);
-	else if (_default_log)
+		crypt_token_cd_unlock(cd);
+	} else if (_default_log)
 		_default_log(level, msg, _default_log_usrptr);
 	/* Default to stdout/stderr if there is no callback. */
 	else
@@ -226,10 +310,12 @@ int init_crypto(struct crypt_device *ctx)
 	struct utsname uts;
 	int r;
 
+	pthread_mutex_lock(&_crypto_init_lock);
+
 	r = crypt_random_init(ctx);
 	if (r < 0) {
 		log_err(ctx, _("Cannot initialize crypto RNG backend."));
-		return r;
+		goto out;
 	}
 
 	r = crypt_backend_init(crypt_fips_mode());
@@ -244,7 +330,8 @@ int init_crypto(struct crypt_device *ctx)
 				uts.sysname, uts.release, uts.machine);
 		_crypto_logged = 1;
 	}
-
+out:
+	pthread_mutex_unlock(&_crypto_init_lock);
 	return r;
 }
 
@@ -582,6 +669,7 @@ const char *crypt_get_dir(void)
 int crypt_init(struct crypt_device **cd, const char *device)
 {
 	struct crypt_device *h = NULL;
+	pthread_mutexattr_t attr;
 	int r;
 
 	if (!cd)
@@ -603,9 +691,20 @@ int crypt_init(struct crypt_device **cd, const char *device)
 		return r;
 	}
 
+	/* token handlers can log from within library calls holding the lock */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&h->token_cd_lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+
 	dm_backend_init(NULL);
 
 	h->rng_type = crypt_random_default_key_rng();
+	h->init_us = crypt_time_us();
+
+	pthread_mutex_lock(&_contexts_lock);
+	_contexts++;
+	pthread_mutex_unlock(&_contexts_lock);
 
 	*cd = h;
 	return 0;
@@ -724,6 +823,7 @@ static void crypt_free_type(struct crypt_device *cd, const char *force_type)
 		free(CONST_CAST(void*)cd->u.verity.hdr.salt);
 		free(CONST_CAST(void*)cd->u.verity.root_hash);
 		free(cd->u.verity.uuid);
+		free(cd->u.verity.verify_cache);
 		device_free(cd, cd->u.verity.fec_device);
 	} else if (isINTEGRITY(type)) {
 		free(CONST_CAST(void*)cd->u.integrity.params.integrity);
@@ -748,6 +848,398 @@ struct crypt_pbkdf_type *crypt_get_pbkdf(struct crypt_device *cd)
 	return &cd->pbkdf;
 }
 
+const char *crypt_get_pbkdf_cache(struct crypt_device *cd)
+{
+	return cd ? cd->pbkdf_cache : NULL;
+}
+
+int crypt_set_pbkdf_cache(struct crypt_device *cd, const char *path)
+{
+	char *cache = NULL;
+
+	if (!cd)
+		return -EINVAL;
+
+	if (path && !(cache = strdup(path)))
+		return -ENOMEM;
+
+	free(cd->pbkdf_cache);
+	cd->pbkdf_cache = cache;
+	log_dbg(cd, "PBKDF calibration cache %s.", cache ?: "disabled");
+
+	return 0;
+}
+
+uint64_t crypt_time_us(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return 0;
+
+	return (uint64_t)ts.tv_sec * 1000000 + (uint64_t)ts.tv_nsec / 1000;
+}
+
+/* Add time elapsed since @start_us to phase timing */
+void crypt_timing_add(struct crypt_device *cd, crypt_timing_phase phase, uint64_t start_us)
+{
+	struct crypt_timing *t;
+	uint64_t now = crypt_time_us();
+
+	if (!cd || phase >= CRYPT_TIMING_COUNT)
+		return;
+
+	t = &cd->timing[phase];
+	if (!t->count++)
+		t->start_us = start_us > cd->init_us ? start_us - cd->init_us : 0;
+	if (now > start_us)
+		t->duration_us += now - start_us;
+}
+
+int crypt_get_timing(struct crypt_device *cd, crypt_timing_phase phase,
+	struct crypt_timing *timing)
+{
+	if (!cd || !timing || phase < 0 || phase >= CRYPT_TIMING_COUNT)
+		return -EINVAL;
+
+	*timing = cd->timing[phase];
+	return 0;
+}
+
+/* Record memory cost of PBKDF (or PBKDFs running in parallel) */
+void crypt_memory_kdf(struct crypt_device *cd, uint64_t memory_kb)
+{
+	if (cd && memory_kb * 1024 > cd->memory.kdf_peak)
+		cd->memory.kdf_peak = memory_kb * 1024;
+}
+
+void crypt_memory_io_get(struct crypt_device *cd, size_t size)
+{
+	if (!cd)
+		return;
+
+	cd->io_current += size;
+	if (cd->io_current > cd->memory.io_peak)
+		cd->memory.io_peak = cd->io_current;
+}
+
+void crypt_memory_io_put(struct crypt_device *cd, size_t size)
+{
+	if (cd)
+		cd->io_current = size < cd->io_current ? cd->io_current - size : 0;
+}
+
+int crypt_get_memory_usage(struct crypt_device *cd, struct crypt_memory_usage *usage)
+{
+	if (!cd || !usage)
+		return -EINVAL;
+
+	*usage = cd->memory;
+	crypt_safe_memory_usage(&usage->safe_current, &usage->safe_peak);
+	return 0;
+}
+
+uint32_t crypt_get_derived_key_cache_timeout(struct crypt_device *cd)
+{
+	return cd ? cd->derived_key_cache_ms : 0;
+}
+
+int crypt_set_derived_key_cache(struct crypt_device *cd, uint32_t timeout_ms)
+{
+	if (!cd || timeout_ms > CRYPT_DERIVED_KEY_CACHE_MAX_MS)
+		return -EINVAL;
+
+	cd->derived_key_cache_ms = timeout_ms;
+	log_dbg(cd, "Derived key cache %s (%" PRIu32 " ms).", timeout_ms ? "enabled" : "disabled", timeout_ms);
+
+	return 0;
+}
+
+unsigned crypt_get_wipe_queue_depth(struct crypt_device *cd)
+{
+	return cd ? cd->wipe_queue_depth : 0;
+}
+
+int crypt_set_wipe_queue_depth(struct crypt_device *cd, unsigned depth)
+{
+	if (!cd || depth > CRYPT_WIPE_QUEUE_DEPTH_MAX)
+		return -EINVAL;
+
+	cd->wipe_queue_depth = depth;
+	log_dbg(cd, "Wipe queue depth set to %u.", depth);
+
+	return 0;
+}
+
+const char *crypt_get_wipe_checkpoint(struct crypt_device *cd)
+{
+	return cd ? cd->wipe_checkpoint : NULL;
+}
+
+int crypt_set_wipe_checkpoint(struct crypt_device *cd, const char *path)
+{
+	char *checkpoint = NULL;
+
+	if (!cd)
+		return -EINVAL;
+
+	if (path && !(checkpoint = strdup(path)))
+		return -ENOMEM;
+
+	free(cd->wipe_checkpoint);
+	cd->wipe_checkpoint = checkpoint;
+	log_dbg(cd, "Wipe checkpoint %s.", checkpoint ?: "disabled");
+
+	return 0;
+}
+
+int crypt_set_progress_interval(struct crypt_device *cd, uint64_t bytes, uint32_t msecs)
+{
+	if (!cd)
+		return -EINVAL;
+
+	cd->progress.interval_bytes = bytes;
+	cd->progress.interval_ms = msecs;
+	log_dbg(cd, "Progress interval set to %" PRIu64 " bytes, %u ms.", bytes, msecs);
+
+	return 0;
+}
+
+int crypt_get_progress_info(struct crypt_device *cd, struct crypt_progress_info *info)
+{
+	if (!cd || !info)
+		return -EINVAL;
+
+	memset(info, 0, sizeof(*info));
+	if (!cd->progress.started)
+		return -ENOENT;
+
+	info->bytes = cd->progress.last_offset - cd->progress.start_offset;
+	info->time_ms = (cd->progress.last_us - cd->progress.start_us) / 1000;
+	info->rate = (uint64_t)cd->progress.rate;
+	if (info->rate && cd->progress.size > cd->progress.last_offset)
+		info->eta_ms = (cd->progress.size - cd->progress.last_offset) * 1000 / info->rate;
+
+	return 0;
+}
+
+void crypt_progress_init(struct crypt_device *cd, struct crypt_progress_throttle *pt,
+			 int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+			 void *usrptr)
+{
+	pt->cd = cd;
+	pt->progress = progress;
+	pt->usrptr = usrptr;
+	cd->progress.started = false;
+	cd->progress.rate = 0;
+}
+
+/* Time constant of the rate moving average, older samples fade out */
+#define PROGRESS_RATE_TAU_US UINT64_C(3000000)
+
+int crypt_progress_throttled(uint64_t size, uint64_t offset, void *usrptr)
+{
+	struct crypt_progress_throttle *pt = usrptr;
+	struct crypt_device *cd = pt->cd;
+	uint64_t now = crypt_time_us(), dt;
+	bool report;
+	double rate, alpha;
+
+	if (!cd->progress.started || offset < cd->progress.last_offset) {
+		cd->progress.started = true;
+		cd->progress.start_us = cd->progress.last_us = now;
+		cd->progress.start_offset = cd->progress.last_offset = offset;
+		cd->progress.size = size;
+		cd->progress.rate = 0;
+		return pt->progress(size, offset, pt->usrptr);
+	}
+
+	dt = now - cd->progress.last_us;
+	report = offset >= size ||
+		 (!cd->progress.interval_ms && !cd->progress.interval_bytes) ||
+		 (cd->progress.interval_ms && dt >= cd->progress.interval_ms * UINT64_C(1000)) ||
+		 (cd->progress.interval_bytes &&
+		  offset - cd->progress.last_offset >= cd->progress.interval_bytes);
+	if (!report)
+		return 0;
+
+	/* exponential moving average, weighted by the time the sample covers */
+	if (dt) {
+		rate = (double)(offset - cd->progress.last_offset) * 1E6 / dt;
+		alpha = (double)dt / (dt + PROGRESS_RATE_TAU_US);
+		cd->progress.rate = cd->progress.rate ? cd->progress.rate + alpha * (rate - cd->progress.rate) : rate;
+		cd->progress.last_us = now;
+		cd->progress.last_offset = offset;
+	}
+	cd->progress.size = size;
+
+	return pt->progress(size, offset, pt->usrptr);
+}
+
+bool crypt_get_sector_size_benchmark(struct crypt_device *cd)
+{
+	return cd ? cd->sector_size_benchmark : false;
+}
+
+int crypt_set_sector_size_benchmark(struct crypt_device *cd, int enable)
+{
+	if (!cd)
+		return -EINVAL;
+
+	cd->sector_size_benchmark = enable ? true : false;
+	log_dbg(cd, "Encryption sector size benchmark %s.", enable ? "enabled" : "disabled");
+
+	return 0;
+}
+
+unsigned crypt_get_keyslot_parallel_unlock(struct crypt_device *cd)
+{
+	return cd ? cd->keyslot_parallel_unlock : 0;
+}
+
+int crypt_set_keyslot_parallel_unlock(struct crypt_device *cd, unsigned max_parallel)
+{
+	if (!cd || max_parallel > LUKS2_KEYSLOTS_MAX)
+		return -EINVAL;
+
+	cd->keyslot_parallel_unlock = max_parallel;
+	log_dbg(cd, "Parallel keyslot unlock %s (%u).", max_parallel > 1 ? "enabled" : "disabled", max_parallel);
+
+	return 0;
+}
+
+const char *crypt_get_keyslot_hint(struct crypt_device *cd)
+{
+	return cd ? cd->keyslot_hint : NULL;
+}
+
+int crypt_set_keyslot_hint(struct crypt_device *cd, const char *hint)
+{
+	char *tmp = NULL;
+
+	if (!cd || (hint && !*hint))
+		return -EINVAL;
+
+	if (hint && !(tmp = strdup(hint)))
+		return -ENOMEM;
+
+	free(cd->keyslot_hint);
+	cd->keyslot_hint = tmp;
+	log_dbg(cd, "Keyslot hint %s.", hint ? "set" : "cleared");
+
+	return 0;
+}
+
+bool crypt_get_header_cache(struct crypt_device *cd)
+{
+	return cd ? cd->header_cache : false;
+}
+
+int crypt_set_header_cache(struct crypt_device *cd, int enable)
+{
+	if (!cd)
+		return -EINVAL;
+
+	cd->header_cache = enable ? true : false;
+	log_dbg(cd, "LUKS2 header cache %s.", enable ? "enabled" : "disabled");
+
+	return 0;
+}
+
+/*
+ * Tag of volume key and digest parameters, HMAC under per-context secret.
+ * Returns 1 if the key was already verified with the same digest, 0 if not
+ * (and @tag can be stored later) or negative errno if tag is not available.
+ */
+int crypt_verified_key_lookup(struct crypt_device *cd, const char *params,
+			      const char *key, size_t key_length, char *tag)
+{
+	struct crypt_hmac *hd = NULL;
+	unsigned i;
+	int r;
+
+	if (!cd || !params)
+		return -EINVAL;
+
+	if (!cd->verified_key_secret) {
+		cd->verified_key_secret = crypt_safe_alloc(VERIFIED_KEY_TAG_SIZE);
+		if (!cd->verified_key_secret)
+			return -ENOMEM;
+		r = crypt_random_get(cd, cd->verified_key_secret, VERIFIED_KEY_TAG_SIZE, CRYPT_RND_NORMAL);
+		if (r < 0) {
+			crypt_safe_free(cd->verified_key_secret);
+			cd->verified_key_secret = NULL;
+			return r;
+		}
+	}
+
+	r = crypt_hmac_init(&hd, "sha256", cd->verified_key_secret, VERIFIED_KEY_TAG_SIZE);
+	if (r)
+		return r;
+
+	r = crypt_hmac_write(hd, params, strlen(params) + 1);
+	if (!r)
+		r = crypt_hmac_write(hd, key, key_length);
+	if (!r)
+		r = crypt_hmac_final(hd, tag, VERIFIED_KEY_TAG_SIZE);
+	crypt_hmac_destroy(hd);
+	if (r)
+		return r;
+
+	for (i = 0; i < cd->verified_key_count && i < VERIFIED_KEY_TAGS; i++)
+		if (!crypt_backend_memeq(cd->verified_key_tags[i], tag, VERIFIED_KEY_TAG_SIZE))
+			return 1;
+
+	return 0;
+}
+
+void crypt_verified_key_store(struct crypt_device *cd, const char *tag)
+{
+	if (!cd)
+		return;
+
+	/* oldest entry is replaced when full */
+	memcpy(cd->verified_key_tags[cd->verified_key_count % VERIFIED_KEY_TAGS], tag, VERIFIED_KEY_TAG_SIZE);
+	if (++cd->verified_key_count == 2 * VERIFIED_KEY_TAGS)
+		cd->verified_key_count = VERIFIED_KEY_TAGS;
+}
+
+bool crypt_get_token_parallel_open(struct crypt_device *cd)
+{
+	return cd ? cd->token_parallel_open : false;
+}
+
+void crypt_token_cd_lock(struct crypt_device *cd)
+{
+	pthread_mutex_lock(&cd->token_cd_lock);
+}
+
+void crypt_token_cd_unlock(struct crypt_device *cd)
+{
+	pthread_mutex_unlock(&cd->token_cd_lock);
+}
+
+void *crypt_get_token_open_batch(struct crypt_device *cd)
+{
+	return cd->token_open_batch;
+}
+
+void crypt_set_token_open_batch(struct crypt_device *cd, void *batch)
+{
+	cd->token_open_batch = batch;
+}
+
+int crypt_set_token_parallel_open(struct crypt_device *cd, int enable)
+{
+	if (!cd)
+		return -EINVAL;
+
+	cd->token_parallel_open = enable ? true : false;
+	log_dbg(cd, "Parallel token open %s.", enable ? "enabled" : "disabled");
+
+	return 0;
+}
+
 /*
  * crypt_load() helpers
  */
@@ -1092,6 +1584,7 @@ int crypt_load(struct crypt_device *cd,
 	       const char *requested_type,
 	       void *params)
 {
+	uint64_t t = crypt_time_us();
 	int r;
 
 	if (!cd)
@@ -1148,6 +1641,7 @@ int crypt_load(struct crypt_device *cd,
 	} else
 		return -EINVAL;
 
+	crypt_timing_add(cd, CRYPT_TIMING_LOAD, t);
 	return r;
 }
 
@@ -1823,6 +2317,9 @@ static int _crypt_format_luks2(struct crypt_device *cd,
 		sector_size = device_optimal_encryption_sector_size(cd, crypt_data_device(cd));
 		log_dbg(cd, "Auto-detected optimal encryption sector size for device %s is %d bytes.",
 			device_path(crypt_data_device(cd)), sector_size);
+		if (crypt_get_sector_size_benchmark(cd))
+			(void)crypt_benchmark_sector_size(cd, crypt_data_device(cd), cipher, cipher_mode,
+							  volume_key_size, &sector_size);
 	} else
 		sector_size = params ? params->sector_size : SECTOR_SIZE;
 
@@ -2214,9 +2711,8 @@ static int _crypt_format_verity(struct crypt_device *cd,
 
 	if (params->flags & CRYPT_VERITY_CREATE_HASH) {
 		r = VERITY_create(cd, &cd->u.verity.hdr,
+				  cd->u.verity.fec_device,
 				  cd->u.verity.root_hash, cd->u.verity.root_hash_size);
-		if (!r && params->fec_device)
-			r = VERITY_FEC_process(cd, &cd->u.verity.hdr, cd->u.verity.fec_device, 0, NULL);
 		if (r)
 			goto out;
 	}
@@ -2431,22 +2927,104 @@ CRYPT_SYMBOL_EXPORT_OLD(int, crypt_format, 2, 0,
 	return _crypt_format(cd, type, cipher, cipher_mode, uuid, volume_key, volume_key_size, params, false);
 }
 
-int crypt_repair(struct crypt_device *cd,
-		 const char *requested_type,
-		 void *params __attribute__((unused)))
+int crypt_format_luks2_adopt(struct crypt_device *cd,
+	struct crypt_device *cd_src,
+	const char *volume_key,
+	size_t volume_key_size,
+	const struct crypt_params_luks2 *params)
 {
+	struct crypt_params_luks2 luks2_params = {};
+	uint64_t size;
 	int r;
 
-	if (!cd)
+	if (!cd || !cd_src || !volume_key || cd->type)
 		return -EINVAL;
 
-	log_dbg(cd, "Trying to repair %s crypt type from device %s.",
-		requested_type ?: "any", mdata_device_path(cd) ?: "(none)");
-
-	if (!crypt_metadata_device(cd))
+	if (!cd->metadata_device) {
+		log_err(cd, _("Detached LUKS2 header is required to adopt existing encrypted data."));
 		return -EINVAL;
+	}
 
-	if (requested_type && !isLUKS(requested_type))
+	if (device_is_identical(crypt_data_device(cd), crypt_data_device(cd_src)) <= 0) {
+		log_err(cd, _("Data device %s does not match the source device."), data_device_path(cd));
+		return -EINVAL;
+	}
+
+	if (isTCRYPT(cd_src->type)) {
+		if (cd_src->u.tcrypt.params.flags & CRYPT_TCRYPT_SYSTEM_HEADER) {
+			log_err(cd, _("TCRYPT system encryption cannot be adopted to LUKS2."));
+			return -ENOTSUP;
+		}
+		/* cipher chains use several dm-crypt targets, LUKS2 segment has only one cipher */
+		if (strchr(cd_src->u.tcrypt.params.cipher, '-') ||
+		    strncmp(cd_src->u.tcrypt.params.mode, "xts", 3)) {
+			log_err(cd, _("Only single cipher TCRYPT devices in XTS mode can be adopted to LUKS2."));
+			return -ENOTSUP;
+		}
+		if (cd_src->u.tcrypt.params.flags & CRYPT_TCRYPT_HIDDEN_HEADER)
+			size = cd_src->u.tcrypt.hdr.d.hidden_volume_size;
+		else
+			size = cd_src->u.tcrypt.hdr.d.volume_size;
+	} else if (isFVAULT2(cd_src->type)) {
+		size = cd_src->u.fvault2.params.log_vol_size;
+	} else if (isBITLK(cd_src->type)) {
+		/* relocated filesystem header and metadata holes need several segments */
+		log_err(cd, _("BITLK device layout cannot be adopted to LUKS2."));
+		return -ENOTSUP;
+	} else {
+		log_err(cd, _("This operation is not supported for this device type."));
+		return -EINVAL;
+	}
+
+	if (volume_key_size != (size_t)crypt_get_volume_key_size(cd_src)) {
+		log_err(cd, _("Volume key does not match the volume."));
+		return -EINVAL;
+	}
+
+	if (params)
+		luks2_params = *params;
+	luks2_params.data_alignment = 0;
+	luks2_params.data_device = NULL;
+	luks2_params.integrity = NULL;
+	luks2_params.integrity_params = NULL;
+	luks2_params.sector_size = SECTOR_SIZE;
+
+	/* keyslots area must fit before existing data, crypt_set_data_offset() alignment is not required */
+	cd->data_offset = crypt_get_data_offset(cd_src);
+
+	log_dbg(cd, "Adopting %s device data at offset %" PRIu64 " sectors, IV offset %" PRIu64
+		", size %" PRIu64 " bytes.", cd_src->type, cd->data_offset,
+		crypt_get_iv_offset(cd_src), size);
+
+	r = crypt_format(cd, CRYPT_LUKS2, crypt_get_cipher(cd_src), crypt_get_cipher_mode(cd_src),
+			 NULL, volume_key, volume_key_size, &luks2_params);
+	if (r < 0)
+		return r;
+
+	r = LUKS2_segment_set_iv_and_size(&cd->u.luks2.hdr, CRYPT_DEFAULT_SEGMENT,
+					  crypt_get_iv_offset(cd_src), size);
+	if (!r)
+		r = LUKS2_hdr_write(cd, &cd->u.luks2.hdr);
+
+	return r;
+}
+
+int crypt_repair(struct crypt_device *cd,
+		 const char *requested_type,
+		 void *params __attribute__((unused)))
+{
+	int r;
+
+	if (!cd)
+		return -EINVAL;
+
+	log_dbg(cd, "Trying to repair %s crypt type from device %s.",
+		requested_type ?: "any", mdata_device_path(cd) ?: "(none)");
+
+	if (!crypt_metadata_device(cd))
+		return -EINVAL;
+
+	if (requested_type && !isLUKS(requested_type))
 		return -EINVAL;
 
 	/* Load with repair */
@@ -2920,6 +3498,28 @@ out:
 	return r;
 }
 
+/*
+ * Plain dm-crypt mapping with the volume key in the table (not in keyring)
+ * can be grown by reloading the queried table with the new size only.
+ * It must still map the data device and offset of the context.
+ */
+static bool _resize_grow_in_place(struct crypt_device *cd,
+				  const struct crypt_dm_active_device *dmdq)
+{
+	const struct dm_target *tgt = &dmdq->segment;
+
+	if (!isPLAIN(cd->type) && !isLUKS(cd->type))
+		return false;
+
+	if (tgt->type != DM_CRYPT || tgt->u.crypt.tag_size || tgt->u.crypt.integrity ||
+	    (dmdq->flags & CRYPT_ACTIVATE_KEYRING_KEY) ||
+	    !tgt->u.crypt.vk || !tgt->u.crypt.cipher || !tgt->data_device)
+		return false;
+
+	return tgt->u.crypt.offset == crypt_get_data_offset(cd) &&
+	       device_is_identical(tgt->data_device, crypt_data_device(cd)) > 0;
+}
+
 int crypt_resize(struct crypt_device *cd, const char *name, uint64_t new_size)
 {
 	struct crypt_dm_active_device dmdq, dmd = {};
@@ -2945,7 +3545,8 @@ int crypt_resize(struct crypt_device *cd, const char *name, uint64_t new_size)
 
 	log_dbg(cd, "Resizing device %s to %" PRIu64 " sectors.", name, new_size);
 
-	r = dm_query_device(cd, name, DM_ACTIVE_CRYPT_KEYSIZE | DM_ACTIVE_CRYPT_KEY |
+	r = dm_query_device(cd, name, DM_ACTIVE_DEVICE | DM_ACTIVE_CRYPT_CIPHER |
+			    DM_ACTIVE_CRYPT_KEYSIZE | DM_ACTIVE_CRYPT_KEY |
 			    DM_ACTIVE_INTEGRITY_PARAMS | DM_ACTIVE_JOURNAL_CRYPT_KEY |
 			    DM_ACTIVE_JOURNAL_MAC_KEY, &dmdq);
 	if (r < 0) {
@@ -3044,6 +3645,18 @@ int crypt_resize(struct crypt_device *cd, const char *name, uint64_t new_size)
 		goto out;
 	}
 
+	if (new_size > dmdq.size && _resize_grow_in_place(cd, &dmdq)) {
+		log_dbg(cd, "Growing device %s in place using active table parameters.", name);
+		if (isLUKS2(cd->type))
+			r = LUKS2_unmet_requirements(cd, &cd->u.luks2.hdr, 0, 0);
+		if (!r) {
+			dmdq.size = tgt->size = new_size;
+			dmdq.flags |= CRYPT_ACTIVATE_REFRESH;
+			r = dm_reload_device(cd, name, &dmdq, 0, 1);
+		}
+		goto out;
+	}
+
 	dmd.uuid = crypt_get_uuid(cd);
 	dmd.size = new_size;
 	dmd.flags = dmdq.flags | CRYPT_ACTIVATE_REFRESH;
@@ -3261,16 +3874,44 @@ void crypt_free(struct crypt_device *cd)
 
 	log_dbg(cd, "Releasing crypt device %s context.", mdata_device_path(cd) ?: "empty");
 
+	LUKS2_token_open_wait(cd);
+
+	if (cd->memory.kdf_peak || cd->memory.io_peak) {
+		crypt_safe_memory_usage(&cd->memory.safe_current, &cd->memory.safe_peak);
+		log_dbg(cd, "Memory peak: PBKDF %" PRIu64 " KiB, I/O buffers %" PRIu64 " KiB, "
+			"safe memory %" PRIu64 " KiB (process).", cd->memory.kdf_peak / 1024,
+			cd->memory.io_peak / 1024, cd->memory.safe_peak / 1024);
+	}
+
 	dm_backend_exit(cd);
 	crypt_free_volume_key(cd->volume_key);
 
 	crypt_free_type(cd, NULL);
+	LUKS2_hdr_free(cd, &cd->json_dump_hdr);
 
 	device_free(cd, cd->device);
 	device_free(cd, cd->metadata_device);
 
 	free(CONST_CAST(void*)cd->pbkdf.type);
 	free(CONST_CAST(void*)cd->pbkdf.hash);
+	free(cd->pbkdf_cache);
+
+	if (cd->derived_key_cache_ms)
+		crypt_derived_key_cache_flush(false);
+
+	free(cd->staged_key_description);
+	crypt_safe_free(cd->verified_key_secret);
+	free(cd->keyslot_hint);
+	free(cd->wipe_checkpoint);
+
+	pthread_mutex_destroy(&cd->token_cd_lock);
+
+	pthread_mutex_lock(&_contexts_lock);
+	if (_contexts && !--_contexts) {
+		log_dbg(cd, "Last context released, flushing LUKS2 header cache.");
+		LUKS2_hdr_cache_flush();
+	}
+	pthread_mutex_unlock(&_contexts_lock);
 
 	/* Some structures can contain keys (TCRYPT), wipe it */
 	crypt_safe_memzero(cd, sizeof(*cd));
@@ -3360,6 +4001,149 @@ out:
 	return r;
 }
 
+/* one held key per mapping, the same LUKS device can be mapped more times */
+static char *held_key_description(struct crypt_device *cd, const char *name)
+{
+	const char *uuid = crypt_get_uuid(cd);
+	char *desc;
+
+	if (!uuid || asprintf(&desc, "cryptsetup-suspend:%s:%s", uuid, name) < 0)
+		return NULL;
+
+	return desc;
+}
+
+int crypt_suspend_with_held_key(struct crypt_device *cd,
+	const char *name,
+	const char *volume_key,
+	size_t volume_key_size,
+	unsigned int timeout)
+{
+	struct crypt_dm_active_device dmd;
+	struct dm_target *tgt = &dmd.segment;
+	struct volume_key *vk = NULL;
+	char *desc = NULL;
+	int r;
+
+	if (!cd || !name || !timeout)
+		return -EINVAL;
+
+	log_dbg(cd, "Suspending volume %s with volume key held for %u seconds.", name, timeout);
+
+	if ((r = onlyLUKS(cd)))
+		return r;
+
+	if (!keyring_check()) {
+		log_err(cd, _("Kernel keyring is not supported by the kernel."));
+		return -ENOTSUP;
+	}
+
+	if (crypt_cipher_wrapped_key(crypt_get_cipher(cd), crypt_get_cipher_mode(cd)) ||
+	    crypt_is_cipher_null(crypt_get_cipher_spec(cd)))
+		return -ENOTSUP;
+
+	if (volume_key) {
+		r = crypt_volume_key_verify(cd, volume_key, volume_key_size);
+		if (r < 0) {
+			log_err(cd, _("Volume key does not match the volume."));
+			return r;
+		}
+		vk = crypt_alloc_volume_key(volume_key_size, volume_key);
+	} else {
+		/* Only a table with the key itself (not kernel key reference) can be used */
+		r = dm_query_device(cd, name, DM_ACTIVE_CRYPT_KEYSIZE | DM_ACTIVE_CRYPT_KEY, &dmd);
+		if (r < 0) {
+			log_err(cd, _("Volume %s is not active."), name);
+			return -EINVAL;
+		}
+		if (single_segment(&dmd) && tgt->type == DM_CRYPT && tgt->u.crypt.vk &&
+		    !(dmd.flags & CRYPT_ACTIVATE_KEYRING_KEY))
+			vk = crypt_alloc_volume_key(tgt->u.crypt.vk->keylength, tgt->u.crypt.vk->key);
+		else
+			r = -ENOKEY;
+		dm_targets_free(cd, &dmd);
+		if (r == -ENOKEY) {
+			log_dbg(cd, "Volume key of %s is not available in active table.", name);
+			return r;
+		}
+	}
+
+	if (!vk)
+		return -ENOMEM;
+
+	desc = held_key_description(cd, name);
+	if (!desc) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	/* user type, payload is verified against the digest before resume */
+	r = keyring_add_key_in_user_keyring_timeout(USER_KEY, desc, vk->key, vk->keylength, timeout);
+	if (r < 0) {
+		log_err(cd, _("Failed to hold volume key in kernel keyring."));
+		goto out;
+	}
+
+	r = crypt_suspend(cd, name);
+	if (r < 0 && !keyring_link_user_key_in_thread_keyring(USER_KEY, desc))
+		(void)keyring_revoke_and_unlink_key(USER_KEY, desc);
+out:
+	free(desc);
+	crypt_free_volume_key(vk);
+	return r;
+}
+
+int crypt_resume_by_held_key(struct crypt_device *cd, const char *name)
+{
+	char *desc, *key = NULL;
+	size_t key_size = 0;
+	int r;
+
+	if (!cd || !name)
+		return -EINVAL;
+
+	log_dbg(cd, "Resuming volume %s by held volume key.", name);
+
+	if ((r = onlyLUKS(cd)))
+		return r;
+
+	r = dm_status_suspended(cd, name);
+	if (r < 0)
+		return r;
+
+	if (!r) {
+		log_err(cd, _("Volume %s is not suspended."), name);
+		return -EINVAL;
+	}
+
+	desc = held_key_description(cd, name);
+	if (!desc)
+		return -ENOMEM;
+
+	r = keyring_read_user_key(USER_KEY, desc, &key, &key_size);
+	if (r < 0) {
+		log_dbg(cd, "Held volume key %s is not available (%d).", desc, r);
+		free(desc);
+		return -ENOKEY;
+	}
+
+	/*
+	 * Anybody with access to user keyring can add a key with the same
+	 * description, the key is verified and then used as a volume key.
+	 * No KDF is needed and the resumed table does not reference the held
+	 * key, so it can be dropped afterwards.
+	 */
+	r = crypt_resume_by_volume_key(cd, name, key, key_size);
+	if (!r || r == -EPERM)
+		(void)keyring_revoke_and_unlink_key(USER_KEY, desc);
+	else
+		(void)keyring_unlink_key_from_thread_keyring(USER_KEY, desc);
+
+	crypt_safe_free(key);
+	free(desc);
+	return r;
+}
+
 /* key must be properly verified */
 static int resume_by_volume_key(struct crypt_device *cd,
 		struct volume_key *vk,
@@ -3744,6 +4528,27 @@ out:
 	return keyslot_new;
 }
 
+int crypt_keyslot_convert_by_passphrases(struct crypt_device *cd,
+	const int *keyslots,
+	const char *const *passphrases,
+	const size_t *passphrase_sizes,
+	size_t count)
+{
+	int r;
+
+	if (!keyslots || !passphrases || !passphrase_sizes ||
+	    !count || count > LUKS2_KEYSLOTS_MAX)
+		return -EINVAL;
+
+	if ((r = onlyLUKS2(cd)))
+		return r;
+
+	log_dbg(cd, "Converting %zu keyslots.", count);
+
+	return LUKS2_keyslot_convert(cd, &cd->u.luks2.hdr, keyslots, passphrases,
+				     passphrase_sizes, (int)count);
+}
+
 int crypt_keyslot_add_by_keyfile_device_offset(struct crypt_device *cd,
 	int keyslot,
 	const char *keyfile,
@@ -3847,6 +4652,21 @@ int crypt_keyslot_destroy(struct crypt_device *cd, int keyslot)
 	return LUKS2_keyslot_wipe(cd, &cd->u.luks2.hdr, keyslot, 0);
 }
 
+int crypt_keyslot_destroy_all(struct crypt_device *cd)
+{
+	int r;
+
+	log_dbg(cd, "Destroying all active keyslots.");
+
+	if ((r = _onlyLUKS(cd, CRYPT_CD_UNRESTRICTED)))
+		return r;
+
+	if (isLUKS1(cd->type))
+		return LUKS_del_key_all(&cd->u.luks1.hdr, cd);
+
+	return LUKS2_keyslot_wipe_all(cd, &cd->u.luks2.hdr);
+}
+
 static int _check_header_data_overlap(struct crypt_device *cd, const char *name)
 {
 	if (!name || !isLUKS(cd->type))
@@ -4301,6 +5121,7 @@ static int _activate_by_passphrase(struct crypt_device *cd,
 {
 	int r;
 	struct volume_key *vk = NULL;
+	struct dm_prepare_job dm_job = {};
 
 	if ((flags & CRYPT_ACTIVATE_KEYRING_KEY) && !crypt_use_keyring_for_vk(cd))
 		return -EINVAL;
@@ -4315,6 +5136,10 @@ static int _activate_by_passphrase(struct crypt_device *cd,
 	if (flags & CRYPT_ACTIVATE_SERIALIZE_MEMORY_HARD_PBKDF)
 		cd->memory_hard_pbkdf_lock_enabled = true;
 
+	/* dm-crypt target probe overlaps keyslot KDF, activation waits for it */
+	if (name && (isLUKS1(cd->type) || isLUKS2(cd->type)))
+		dm_prepare_start(cd, DM_CRYPT, &dm_job);
+
 	/* plain, use hashed passphrase */
 	if (isPLAIN(cd->type)) {
 		r = -EINVAL;
@@ -4353,6 +5178,7 @@ static int _activate_by_passphrase(struct crypt_device *cd,
 		r = -EINVAL;
 	}
 out:
+	dm_prepare_wait(&dm_job);
 	if (r < 0)
 		crypt_drop_keyring_key(cd, vk);
 	crypt_free_volume_key(vk);
@@ -4432,6 +5258,47 @@ int crypt_activate_by_passphrase(struct crypt_device *cd,
 	return _activate_by_passphrase(cd, name, keyslot, passphrase, passphrase_size, flags);
 }
 
+int crypt_keyslot_test_passphrases(struct crypt_device *cd,
+	int keyslot,
+	const char *const *passphrases,
+	const size_t *passphrase_sizes,
+	size_t count,
+	unsigned threads,
+	size_t *index)
+{
+	size_t i;
+	int r;
+
+	if (!cd || !passphrases || !passphrase_sizes || !index)
+		return -EINVAL;
+
+	log_dbg(cd, "Testing %zu passphrases [keyslot %d].", count, keyslot);
+
+	if ((r = onlyLUKS(cd)))
+		return r;
+
+	if (!threads)
+		threads = crypt_cpusonline();
+
+	if (isLUKS1(cd->type))
+		return LUKS_test_passphrases(keyslot, passphrases, passphrase_sizes, count,
+					     threads, &cd->u.luks1.hdr, index, cd);
+
+	/* LUKS2 keyslots are not batched, memory-hard PBKDF is the cost here */
+	for (i = 0, r = -EPERM; i < count; i++) {
+		r = _activate_by_passphrase(cd, NULL, keyslot, passphrases[i],
+					    passphrase_sizes[i], 0);
+		if (r >= 0) {
+			*index = i;
+			break;
+		}
+		if (r != -EPERM)
+			break;
+	}
+
+	return r;
+}
+
 int crypt_activate_by_keyfile_device_offset(struct crypt_device *cd,
 	const char *name,
 	int keyslot,
@@ -4626,6 +5493,53 @@ int crypt_activate_by_volume_key(struct crypt_device *cd,
 	return r;
 }
 
+/*
+ * Cached signatures are user keys in user keyring named by signature digest,
+ * so identical signed images share one key. Kernel still verifies
+ * the signature against trusted keys on every activation.
+ */
+static int verity_cached_signature(struct crypt_device *cd,
+	const char *signature, size_t signature_size,
+	char *description, size_t description_size)
+{
+	struct crypt_hash *hd = NULL;
+	char digest[32], *hex = NULL;
+	int r;
+
+	if (crypt_hash_init(&hd, "sha256"))
+		return -EINVAL;
+	r = crypt_hash_write(hd, signature, signature_size);
+	if (!r)
+		r = crypt_hash_final(hd, digest, sizeof(digest));
+	crypt_hash_destroy(hd);
+	if (r)
+		return -EINVAL;
+
+	hex = crypt_bytes_to_hex(sizeof(digest), digest);
+	if (!hex)
+		return -ENOMEM;
+
+	r = snprintf(description, description_size, "cryptsetup-verity-sig:%s", hex);
+	crypt_safe_free(hex);
+	if (r < 0 || (size_t)r >= description_size)
+		return -EINVAL;
+
+	r = keyring_link_user_key_in_thread_keyring_matching(USER_KEY, description,
+							     signature, signature_size);
+	if (!r) {
+		log_dbg(cd, "Using cached signature %s.", description);
+		return 0;
+	}
+
+	log_dbg(cd, "Adding signature into keyring cache %s", description);
+	r = keyring_add_key_in_user_keyring_timeout(USER_KEY, description, signature, signature_size,
+						    cd->u.verity.signature_cache_timeout);
+	if (!r)
+		r = keyring_link_user_key_in_thread_keyring(USER_KEY, description);
+
+	return r;
+}
+
 int crypt_activate_by_signed_key(struct crypt_device *cd,
 	const char *name,
 	const char *volume_key,
@@ -4668,7 +5582,13 @@ int crypt_activate_by_signed_key(struct crypt_device *cd,
 	free(CONST_CAST(void*)cd->u.verity.root_hash);
 	cd->u.verity.root_hash = NULL;
 
-	if (signature) {
+	if (signature && cd->u.verity.signature_cache_timeout) {
+		r = verity_cached_signature(cd, signature, signature_size, description, sizeof(description));
+		if (r) {
+			log_err(cd, _("Failed to load key in kernel keyring."));
+			return r;
+		}
+	} else if (signature) {
 		r = snprintf(description, sizeof(description)-1, "cryptsetup:%s%s%s",
 			     crypt_get_uuid(cd) ?: "", crypt_get_uuid(cd) ? "-" : "", name);
 		if (r < 0)
@@ -4685,7 +5605,8 @@ int crypt_activate_by_signed_key(struct crypt_device *cd,
 	r = VERITY_activate(cd, name, volume_key, volume_key_size,
 			    signature ? description : NULL,
 			    cd->u.verity.fec_device,
-			    &cd->u.verity.hdr, flags | CRYPT_ACTIVATE_READONLY);
+			    &cd->u.verity.hdr, cd->u.verity.verify_cache,
+			    flags | CRYPT_ACTIVATE_READONLY);
 
 	if (!r) {
 		cd->u.verity.root_hash_size = volume_key_size;
@@ -4694,12 +5615,37 @@ int crypt_activate_by_signed_key(struct crypt_device *cd,
 			memcpy(CONST_CAST(void*)cd->u.verity.root_hash, volume_key, volume_key_size);
 	}
 
-	if (signature)
+	if (signature && cd->u.verity.signature_cache_timeout)
+		(void)keyring_unlink_key_from_thread_keyring(USER_KEY, description);
+	else if (signature)
 		crypt_drop_keyring_key_by_description(cd, description, USER_KEY);
 
 	return r;
 }
 
+int crypt_activate_batch_begin(struct crypt_device *cd)
+{
+	int r;
+
+	dm_backend_init(cd);
+	r = dm_udev_batch_begin(cd);
+	if (r)
+		dm_backend_exit(cd);
+
+	return r;
+}
+
+int crypt_activate_batch_end(struct crypt_device *cd)
+{
+	int r;
+
+	r = dm_udev_batch_end(cd);
+	if (!r)
+		dm_backend_exit(cd);
+
+	return r;
+}
+
 int crypt_deactivate_by_name(struct crypt_device *cd, const char *name, uint32_t flags)
 {
 	struct crypt_device *fake_cd = NULL;
@@ -4781,21 +5727,109 @@ int crypt_deactivate(struct crypt_device *cd, const char *name)
 	return crypt_deactivate_by_name(cd, name, 0);
 }
 
-int crypt_get_active_device(struct crypt_device *cd, const char *name,
-			    struct crypt_active_device *cad)
+int crypt_deactivate_batch(struct crypt_device *cd, const char * const *names,
+			   size_t count, uint32_t flags)
 {
-	int r;
-	struct crypt_dm_active_device dmd, dmdi = {};
-	const char *namei = NULL;
-	struct dm_target *tgt = &dmd.segment;
-	uint64_t min_offset = UINT64_MAX;
+	struct crypt_dm_active_device dmd;
+	bool *done, progress;
+	size_t i;
+	int r, err = 0;
 
-	if (!cd || !name || !cad)
+	if (!names || !count || (flags & CRYPT_DEACTIVATE_DEFERRED_CANCEL))
 		return -EINVAL;
 
-	r = dm_query_device(cd, name, DM_ACTIVE_DEVICE, &dmd);
-	if (r < 0)
-		return r;
+	if (!(done = calloc(count, sizeof(*done))))
+		return -ENOMEM;
+
+	r = crypt_activate_batch_begin(cd);
+	if (r) {
+		free(done);
+		return r;
+	}
+
+	/*
+	 * Devices in the list can hold each other, so remove all unused
+	 * devices and repeat while it frees some more. Only the rest is
+	 * then removed with retries or deferred.
+	 */
+	do {
+		progress = false;
+		for (i = 0; i < count; i++) {
+			if (done[i])
+				continue;
+
+			r = dm_query_device(cd, names[i], 0, &dmd);
+			if (r >= 0)
+				dm_targets_free(cd, &dmd);
+			if (r > 0)
+				continue;
+
+			/* inactive ones fail here with proper error message */
+			done[i] = progress = true;
+			r = crypt_deactivate_by_name(NULL, names[i], flags & ~CRYPT_DEACTIVATE_DEFERRED);
+			if (r < 0 && !err)
+				err = r;
+		}
+	} while (progress);
+
+	for (i = 0; i < count; i++) {
+		if (done[i])
+			continue;
+		log_dbg(cd, "Device %s is in use, %s.", names[i],
+			flags & CRYPT_DEACTIVATE_DEFERRED ? "deferring removal" : "retrying removal");
+		r = crypt_deactivate_by_name(NULL, names[i], flags);
+		if (r < 0 && !err)
+			err = r;
+	}
+
+	/* one udev wait for all removed devices */
+	crypt_activate_batch_end(cd);
+	free(done);
+
+	return err;
+}
+
+/* Offsets from dm table only, no metadata needed */
+static void _fill_active_device(struct crypt_dm_active_device *dmd, struct crypt_active_device *cad)
+{
+	struct dm_target *tgt = &dmd->segment;
+	uint64_t min_offset = UINT64_MAX;
+
+	while (tgt) {
+		if (tgt->type == DM_CRYPT && (min_offset > tgt->u.crypt.offset)) {
+			min_offset = tgt->u.crypt.offset;
+			cad->iv_offset = tgt->u.crypt.iv_offset;
+		} else if (tgt->type == DM_INTEGRITY && (min_offset > tgt->u.integrity.offset)) {
+			min_offset = tgt->u.integrity.offset;
+			cad->iv_offset = 0;
+		} else if (tgt->type == DM_LINEAR && (min_offset > tgt->u.linear.offset)) {
+			min_offset = tgt->u.linear.offset;
+			cad->iv_offset = 0;
+		}
+		tgt = tgt->next;
+	}
+
+	if (min_offset != UINT64_MAX)
+		cad->offset = min_offset;
+
+	cad->size	= dmd->size;
+	cad->flags	= dmd->flags;
+}
+
+int crypt_get_active_device(struct crypt_device *cd, const char *name,
+			    struct crypt_active_device *cad)
+{
+	int r;
+	struct crypt_dm_active_device dmd, dmdi = {};
+	const char *namei = NULL;
+	struct dm_target *tgt = &dmd.segment;
+
+	if (!cd || !name || !cad)
+		return -EINVAL;
+
+	r = dm_query_device(cd, name, DM_ACTIVE_DEVICE, &dmd);
+	if (r < 0)
+		return r;
 
 	/* For LUKS2 with integrity we need flags from underlying dm-integrity */
 	if (isLUKS2(cd->type) && crypt_get_integrity_tag_size(cd) && single_segment(&dmd)) {
@@ -4807,27 +5841,10 @@ int crypt_get_active_device(struct crypt_device *cd, const char *name,
 	if (cd && isTCRYPT(cd->type)) {
 		cad->offset	= TCRYPT_get_data_offset(cd, &cd->u.tcrypt.hdr, &cd->u.tcrypt.params);
 		cad->iv_offset	= TCRYPT_get_iv_offset(cd, &cd->u.tcrypt.hdr, &cd->u.tcrypt.params);
-	} else {
-		while (tgt) {
-			if (tgt->type == DM_CRYPT && (min_offset > tgt->u.crypt.offset)) {
-				min_offset = tgt->u.crypt.offset;
-				cad->iv_offset = tgt->u.crypt.iv_offset;
-			} else if (tgt->type == DM_INTEGRITY && (min_offset > tgt->u.integrity.offset)) {
-				min_offset = tgt->u.integrity.offset;
-				cad->iv_offset = 0;
-			} else if (tgt->type == DM_LINEAR && (min_offset > tgt->u.linear.offset)) {
-				min_offset = tgt->u.linear.offset;
-				cad->iv_offset = 0;
-			}
-			tgt = tgt->next;
-		}
-	}
-
-	if (min_offset != UINT64_MAX)
-		cad->offset = min_offset;
-
-	cad->size	= dmd.size;
-	cad->flags	= dmd.flags;
+		cad->size	= dmd.size;
+		cad->flags	= dmd.flags;
+	} else
+		_fill_active_device(&dmd, cad);
 
 	r = 0;
 	dm_targets_free(cd, &dmd);
@@ -4836,6 +5853,71 @@ int crypt_get_active_device(struct crypt_device *cd, const char *name,
 	return r;
 }
 
+int crypt_get_active_devices(struct crypt_device *cd,
+			     struct crypt_active_device_entry **entries,
+			     size_t *count)
+{
+	struct crypt_active_device_entry *list = NULL, *tmp, *e;
+	struct crypt_dm_active_device dmd;
+	char **names = NULL, **name;
+	const char *sep;
+	size_t n = 0;
+	int r;
+
+	if (!entries || !count)
+		return -EINVAL;
+
+	*entries = NULL;
+	*count = 0;
+
+	r = dm_list_devices(cd, &names);
+	if (r < 0)
+		return r;
+
+	for (name = names; *name; name++) {
+		/* device can disappear or use foreign target, just skip it */
+		if (dm_query_device(cd, *name, DM_ACTIVE_UUID, &dmd) < 0)
+			continue;
+
+		/* only devices with CRYPT- uuid prefix, the prefix is already stripped */
+		if (!dmd.uuid || !(sep = strchr(dmd.uuid, '-')) ||
+		    (size_t)(sep - dmd.uuid) >= sizeof(e->type) ||
+		    strlen(*name) >= sizeof(e->name) || strlen(dmd.uuid) >= sizeof(e->uuid)) {
+			dm_targets_free(cd, &dmd);
+			free(CONST_CAST(void*)dmd.uuid);
+			continue;
+		}
+
+		if (!(tmp = realloc(list, (n + 1) * sizeof(*list)))) {
+			dm_targets_free(cd, &dmd);
+			free(CONST_CAST(void*)dmd.uuid);
+			r = -ENOMEM;
+			goto out;
+		}
+		list = tmp;
+		e = &list[n++];
+		memset(e, 0, sizeof(*e));
+
+		strcpy(e->name, *name);
+		strcpy(e->uuid, dmd.uuid);
+		memcpy(e->type, dmd.uuid, sep - dmd.uuid);
+		_fill_active_device(&dmd, &e->info);
+
+		dm_targets_free(cd, &dmd);
+		free(CONST_CAST(void*)dmd.uuid);
+	}
+
+	log_dbg(cd, "Found %zu active crypt devices.", n);
+	*entries = list;
+	*count = n;
+	list = NULL;
+	r = 0;
+out:
+	free(list);
+	dm_names_free(names);
+	return r;
+}
+
 uint64_t crypt_get_active_integrity_failures(struct crypt_device *cd, const char *name)
 {
 	struct crypt_dm_active_device dmd;
@@ -4856,6 +5938,186 @@ uint64_t crypt_get_active_integrity_failures(struct crypt_device *cd, const char
 	return failures;
 }
 
+/*
+ * Returns 1 for dm-integrity and dm-verity (failure is reported in status only,
+ * without dm event), 0 for other targets.
+ */
+static int _active_device_failures(struct crypt_device *cd, const char *name, uint64_t *failures)
+{
+	int r;
+
+	/* status only, the table is not parsed; -EEXIST means another target type */
+	r = dm_status_integrity_failures(cd, name, failures);
+	if (r != -EEXIST && r != -ENOTSUP)
+		return r < 0 ? r : 1;
+
+	r = dm_status_verity_ok(cd, name);
+	if (r != -EEXIST && r != -ENOTSUP) {
+		if (r < 0)
+			return r;
+		*failures = r ? 0 : 1;
+		return 1;
+	}
+
+	*failures = 0;
+	return 0;
+}
+
+#define FAILURES_POLL_US 500000
+
+int crypt_wait_active_device_failures(struct crypt_device *cd, const char *name,
+				      uint32_t *event_nr, uint64_t *failures)
+{
+	uint64_t start_failures;
+	uint32_t nr;
+	int r;
+
+	if (!name || !event_nr || !failures)
+		return -EINVAL;
+
+	r = _active_device_failures(cd, name, &start_failures);
+	if (r < 0)
+		return r;
+
+	if (!r) {
+		r = dm_wait_event(cd, name, event_nr);
+		if (r < 0)
+			return r;
+	} else while (1) {
+		r = dm_get_event_nr(cd, name, &nr);
+		if (r < 0)
+			return r;
+		if (nr != *event_nr) {
+			*event_nr = nr;
+			break;
+		}
+
+		r = _active_device_failures(cd, name, failures);
+		if (r < 0)
+			return r;
+		if (*failures != start_failures)
+			break;
+
+		usleep(FAILURES_POLL_US);
+	}
+
+	r = _active_device_failures(cd, name, failures);
+	return r < 0 ? r : 0;
+}
+
+static int _io_stats_add(struct crypt_device_io_stats **list, size_t *n, const char *name,
+			 dev_t devno, const char *slave)
+{
+	struct crypt_device_io_stats *tmp, *st;
+	char kernel_name[sizeof(st->kernel_name)];
+	uint64_t val[17];
+	size_t i;
+	int r;
+
+	if (slave)
+		r = snprintf(kernel_name, sizeof(kernel_name), "%s", slave);
+	else
+		r = snprintf(kernel_name, sizeof(kernel_name), "dm-%u", minor(devno));
+	if (r < 0 || (size_t)r >= sizeof(kernel_name) || strlen(name) >= sizeof(st->name))
+		return -EINVAL;
+
+	/* lower devices can be shared in the stack */
+	for (i = 0; i < *n; i++)
+		if (!strcmp((*list)[i].kernel_name, kernel_name))
+			return 0;
+
+	r = crypt_sysfs_get_stat(major(devno), minor(devno), slave, val, ARRAY_SIZE(val));
+	if (r < 0)
+		return r;
+
+	if (!(tmp = realloc(*list, (*n + 1) * sizeof(**list))))
+		return -ENOMEM;
+	*list = tmp;
+	st = &tmp[(*n)++];
+	memset(st, 0, sizeof(*st));
+
+	strcpy(st->name, name);
+	strcpy(st->kernel_name, kernel_name);
+	st->dm = slave ? 0 : 1;
+	st->read_ios = val[0];
+	st->read_sectors = val[2];
+	st->read_ticks = val[3];
+	st->write_ios = val[4];
+	st->write_sectors = val[6];
+	st->write_ticks = val[7];
+	st->in_flight = val[8];
+	st->io_ticks = val[9];
+	st->time_in_queue = val[10];
+	st->discard_ios = val[11];
+	st->discard_sectors = val[13];
+	st->flush_ios = val[15];
+
+	return 0;
+}
+
+int crypt_get_active_device_io_stats(struct crypt_device *cd, const char *name,
+				     struct crypt_device_io_stats **stats, size_t *count)
+{
+	struct crypt_device_io_stats *list = NULL;
+	char path[PATH_MAX], *deps[MAX_DM_DEPS+1] = {}, *slaves[MAX_DM_DEPS+1];
+	dev_t devno[MAX_DM_DEPS+1];
+	const char *dmname;
+	struct stat st;
+	size_t i, n = 0, dm_count = 0;
+	int j, slaves_count, r;
+
+	if (!name || !stats || !count)
+		return -EINVAL;
+
+	*stats = NULL;
+	*count = 0;
+
+	r = dm_device_deps(cd, name, NULL, deps, ARRAY_SIZE(deps));
+	if (r < 0)
+		return r;
+
+	/* active device, then all its device-mapper dependencies */
+	for (dmname = name; dmname && !r; dmname = deps[dm_count]) {
+		r = snprintf(path, sizeof(path), "%s/%s", dm_get_dir(), dmname);
+		if (r < 0 || (size_t)r >= sizeof(path))
+			r = -EINVAL;
+		else if (stat(path, &st) < 0 || !S_ISBLK(st.st_mode))
+			r = -ENODEV;
+		else {
+			devno[dm_count++] = st.st_rdev;
+			r = _io_stats_add(&list, &n, dmname, st.st_rdev, NULL);
+		}
+	}
+
+	/* block devices below device-mapper stack */
+	for (i = 0; i < dm_count && !r; i++) {
+		slaves_count = crypt_dev_get_slaves(major(devno[i]), minor(devno[i]),
+						    slaves, ARRAY_SIZE(slaves));
+		if (slaves_count < 0) {
+			r = slaves_count;
+			break;
+		}
+		for (j = 0; j < slaves_count; j++) {
+			if (!r)
+				r = _io_stats_add(&list, &n, slaves[j], devno[i], slaves[j]);
+			free(slaves[j]);
+		}
+	}
+
+	for (i = 0; deps[i]; i++)
+		free(deps[i]);
+
+	if (r < 0) {
+		log_dbg(cd, "Cannot read I/O statistics of %s.", name);
+		free(list);
+		return r;
+	}
+
+	*stats = list;
+	*count = n;
+	return 0;
+}
+
 /*
  * Volume key handling
  */
@@ -4979,6 +6241,50 @@ int crypt_volume_key_get_by_keyslot_context(struct crypt_device *cd,
 	return r;
 }
 
+int crypt_bitlk_find_recovery_key(struct crypt_device *cd,
+	const char *const *recovery_keys,
+	size_t count)
+{
+	if (!cd || !recovery_keys || !count)
+		return -EINVAL;
+
+	if (!isBITLK(cd->type)) {
+		log_err(cd, _("This operation is supported only for BITLK device."));
+		return -EINVAL;
+	}
+
+	log_dbg(cd, "Searching %zu BITLK recovery keys.", count);
+
+	return BITLK_find_recovery_key(cd, &cd->u.bitlk.params, recovery_keys, count);
+}
+
+int crypt_volume_read_decrypt(struct crypt_device *cd,
+	const char *volume_key,
+	size_t volume_key_size,
+	uint64_t offset,
+	char *buffer,
+	size_t length)
+{
+	if (!cd || !volume_key || !volume_key_size || !buffer)
+		return -EINVAL;
+
+	if (!length)
+		return 0;
+
+	log_dbg(cd, "Decrypting %zu bytes at offset %" PRIu64 " in userspace.", length, offset);
+
+	if (isBITLK(cd->type))
+		return BITLK_read_decrypt(cd, &cd->u.bitlk.params, volume_key,
+					  volume_key_size, offset, buffer, length);
+
+	if (isFVAULT2(cd->type))
+		return FVAULT2_read_decrypt(cd, &cd->u.fvault2.params, volume_key,
+					    volume_key_size, offset, buffer, length);
+
+	log_err(cd, _("This operation is not supported for this device type."));
+	return -ENOTSUP;
+}
+
 int crypt_volume_key_verify(struct crypt_device *cd,
 	const char *volume_key,
 	size_t volume_key_size)
@@ -5150,8 +6456,25 @@ int crypt_dump(struct crypt_device *cd)
 
 int crypt_dump_json(struct crypt_device *cd, const char **json, uint32_t flags)
 {
-	if (!cd || flags)
+	int r;
+
+	if (!cd || (flags & ~CRYPT_DUMP_JSON_UNLOCKED))
 		return -EINVAL;
+
+	if (flags & CRYPT_DUMP_JSON_UNLOCKED) {
+		if (!crypt_metadata_device(cd))
+			return -EINVAL;
+
+		LUKS2_hdr_free(cd, &cd->json_dump_hdr);
+		r = LUKS2_disk_hdr_read_json_unlocked(cd, crypt_metadata_device(cd), &cd->json_dump_hdr);
+		if (r < 0) {
+			log_dbg(cd, "Cannot read LUKS2 JSON metadata from %s.", mdata_device_path(cd));
+			return r;
+		}
+
+		return LUKS2_hdr_dump_json(cd, &cd->json_dump_hdr, json);
+	}
+
 	if (isLUKS2(cd->type))
 		return LUKS2_hdr_dump_json(cd, &cd->u.luks2.hdr, json);
 
@@ -5492,6 +6815,22 @@ int crypt_keyslot_get_pbkdf(struct crypt_device *cd, int keyslot, struct crypt_p
 	return -EINVAL;
 }
 
+int crypt_set_loop_direct_io(struct crypt_device *cd, int enable)
+{
+	if (!cd)
+		return -EINVAL;
+
+	cd->loop_buffered_io = !enable;
+	log_dbg(cd, "Loop device direct-io %s.", enable ? "enabled" : "disabled");
+
+	return 0;
+}
+
+bool crypt_loop_direct_io(struct crypt_device *cd)
+{
+	return !cd || !cd->loop_buffered_io;
+}
+
 int crypt_set_data_offset(struct crypt_device *cd, uint64_t data_offset)
 {
 	if (!cd)
@@ -5674,6 +7013,27 @@ int crypt_keyslot_set_priority(struct crypt_device *cd, int keyslot, crypt_keysl
 	return LUKS2_keyslot_priority_set(cd, &cd->u.luks2.hdr, keyslot, priority, 1);
 }
 
+int crypt_keyslot_set_hint(struct crypt_device *cd, int keyslot, const char *hint)
+{
+	int r;
+
+	log_dbg(cd, "%s keyslot %d hint.", hint ? "Setting" : "Removing", keyslot);
+
+	if (hint && !*hint)
+		return -EINVAL;
+
+	if ((r = onlyLUKS2(cd)))
+		return r;
+
+	if (keyslot < 0 || keyslot >= crypt_keyslot_max(cd->type))
+		return -EINVAL;
+
+	if (LUKS2_keyslot_info(&cd->u.luks2.hdr, keyslot) < CRYPT_SLOT_ACTIVE)
+		return -EINVAL;
+
+	return LUKS2_keyslot_hint_set(cd, &cd->u.luks2.hdr, keyslot, hint, 1);
+}
+
 const char *crypt_get_type(struct crypt_device *cd)
 {
 	return cd ? cd->type : NULL;
@@ -5684,6 +7044,14 @@ const char *crypt_get_default_type(void)
 	return DEFAULT_LUKS_FORMAT;
 }
 
+const char *crypt_get_crypto_backend(struct crypt_device *cd)
+{
+	if (init_crypto(cd))
+		return NULL;
+
+	return crypt_backend_version();
+}
+
 int crypt_get_verity_info(struct crypt_device *cd,
 	struct crypt_params_verity *vp)
 {
@@ -5707,36 +7075,125 @@ int crypt_get_verity_info(struct crypt_device *cd,
 	return 0;
 }
 
-int crypt_get_integrity_info(struct crypt_device *cd,
-	struct crypt_params_integrity *ip)
+int crypt_verity_set_verify_cache(struct crypt_device *cd, const char *path)
 {
-	if (!cd || !ip)
+	char *cache = NULL;
+
+	if (!cd || !isVERITY(cd->type))
 		return -EINVAL;
 
-	if (isINTEGRITY(cd->type)) {
-		ip->journal_size = cd->u.integrity.params.journal_size;
-		ip->journal_watermark = cd->u.integrity.params.journal_watermark;
-		ip->journal_commit_time = cd->u.integrity.params.journal_commit_time;
-		ip->interleave_sectors = cd->u.integrity.params.interleave_sectors;
-		ip->tag_size = cd->u.integrity.params.tag_size;
-		ip->sector_size = cd->u.integrity.params.sector_size;
-		ip->buffer_sectors = cd->u.integrity.params.buffer_sectors;
+	if (path && !(cache = strdup(path)))
+		return -ENOMEM;
 
-		ip->integrity = cd->u.integrity.params.integrity;
-		ip->integrity_key_size = crypt_get_integrity_key_size(cd);
+	free(cd->u.verity.verify_cache);
+	cd->u.verity.verify_cache = cache;
+	log_dbg(cd, "Verity verification cache %s.", cache ?: "disabled");
 
-		ip->journal_integrity = cd->u.integrity.params.journal_integrity;
-		ip->journal_integrity_key_size = cd->u.integrity.params.journal_integrity_key_size;
-		ip->journal_integrity_key = NULL;
+	return 0;
+}
 
-		ip->journal_crypt = cd->u.integrity.params.journal_crypt;
-		ip->journal_crypt_key_size = cd->u.integrity.params.journal_crypt_key_size;
-		ip->journal_crypt_key = NULL;
-		return 0;
-	} else if (isLUKS2(cd->type)) {
-		ip->journal_size = 0; // FIXME
-		ip->journal_watermark = 0; // FIXME
-		ip->journal_commit_time = 0; // FIXME
+int crypt_verity_set_signature_cache(struct crypt_device *cd, unsigned int timeout)
+{
+	if (!cd || !isVERITY(cd->type))
+		return -EINVAL;
+
+	cd->u.verity.signature_cache_timeout = timeout;
+	log_dbg(cd, "Verity signature cache timeout %u seconds.", timeout);
+
+	return 0;
+}
+
+int crypt_verity_update(struct crypt_device *cd,
+	const struct crypt_verity_range *ranges, size_t count,
+	char *root_hash, size_t root_hash_size)
+{
+	struct crypt_verity_range *hash_ranges = NULL, *fec_ranges;
+	size_t i, hash_count = 0;
+	int r;
+
+	if (!cd || !isVERITY(cd->type) || (count && !ranges) || !root_hash)
+		return -EINVAL;
+
+	if (root_hash_size != cd->u.verity.root_hash_size) {
+		log_err(cd, _("Invalid root hash size."));
+		return -EINVAL;
+	}
+
+	r = VERITY_update(cd, &cd->u.verity.hdr, ranges, count, root_hash, root_hash_size);
+	if (!r && cd->u.verity.root_hash)
+		memcpy(CONST_CAST(char *)cd->u.verity.root_hash, root_hash, root_hash_size);
+	if (r || !cd->u.verity.fec_device)
+		return r;
+
+	/* FEC covers both data and hash area, both are changed now */
+	r = VERITY_update_hash_ranges(cd, &cd->u.verity.hdr, ranges, count, &hash_ranges, &hash_count);
+	if (r)
+		return r;
+
+	fec_ranges = malloc((count + hash_count ?: 1) * sizeof(*fec_ranges));
+	if (!fec_ranges) {
+		free(hash_ranges);
+		return -ENOMEM;
+	}
+
+	memcpy(fec_ranges, ranges, count * sizeof(*fec_ranges));
+	for (i = 0; i < hash_count; i++) {
+		fec_ranges[count + i].offset = cd->u.verity.hdr.data_size + hash_ranges[i].offset;
+		fec_ranges[count + i].length = hash_ranges[i].length;
+	}
+
+	r = VERITY_FEC_update(cd, &cd->u.verity.hdr, cd->u.verity.fec_device,
+			      fec_ranges, count + hash_count);
+	free(hash_ranges);
+	free(fec_ranges);
+	return r;
+}
+
+int crypt_verity_verify_report(struct crypt_device *cd,
+	const char *root_hash, size_t root_hash_size,
+	uint32_t flags, struct crypt_verity_report *report)
+{
+	if (!cd || !isVERITY(cd->type) || !root_hash || !report)
+		return -EINVAL;
+
+	if (root_hash_size != cd->u.verity.root_hash_size) {
+		log_err(cd, _("Invalid root hash size."));
+		return -EINVAL;
+	}
+
+	return VERITY_verify_report(cd, &cd->u.verity.hdr, root_hash, root_hash_size, flags, report);
+}
+
+int crypt_get_integrity_info(struct crypt_device *cd,
+	struct crypt_params_integrity *ip)
+{
+	if (!cd || !ip)
+		return -EINVAL;
+
+	if (isINTEGRITY(cd->type)) {
+		ip->journal_size = cd->u.integrity.params.journal_size;
+		ip->journal_watermark = cd->u.integrity.params.journal_watermark;
+		ip->journal_commit_time = cd->u.integrity.params.journal_commit_time;
+		ip->interleave_sectors = cd->u.integrity.params.interleave_sectors;
+		ip->tag_size = cd->u.integrity.params.tag_size;
+		ip->sector_size = cd->u.integrity.params.sector_size;
+		ip->buffer_sectors = cd->u.integrity.params.buffer_sectors;
+
+		ip->integrity = cd->u.integrity.params.integrity;
+		ip->integrity_key_size = crypt_get_integrity_key_size(cd);
+
+		ip->journal_integrity = cd->u.integrity.params.journal_integrity;
+		ip->journal_integrity_key_size = cd->u.integrity.params.journal_integrity_key_size;
+		ip->journal_integrity_key = NULL;
+
+		ip->journal_crypt = cd->u.integrity.params.journal_crypt;
+		ip->journal_crypt_key_size = cd->u.integrity.params.journal_crypt_key_size;
+		ip->journal_crypt_key = NULL;
+		return 0;
+	} else if (isLUKS2(cd->type)) {
+		ip->journal_size = 0; // FIXME
+		ip->journal_watermark = 0; // FIXME
+		ip->journal_commit_time = 0; // FIXME
 		ip->interleave_sectors = 0; // FIXME
 		ip->sector_size = crypt_get_sector_size(cd);
 		ip->buffer_sectors = 0; // FIXME
@@ -5758,6 +7215,130 @@ int crypt_get_integrity_info(struct crypt_device *cd,
 	return -ENOTSUP;
 }
 
+int crypt_wipe_integrity_tags(struct crypt_device *cd,
+	size_t wipe_block_size,
+	int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+	void *usrptr)
+{
+	struct crypt_params_integrity ip;
+	int r;
+
+	if (!cd || !isINTEGRITY(cd->type))
+		return -EINVAL;
+
+	r = init_crypto(cd);
+	if (r < 0)
+		return r;
+
+	r = crypt_get_integrity_info(cd, &ip);
+	if (r < 0)
+		return r;
+
+	if (!wipe_block_size)
+		wipe_block_size = 1024*1024;
+
+	return INTEGRITY_wipe_tags(cd, &ip, wipe_block_size, progress, usrptr);
+}
+
+int crypt_wipe_integrity_tags_range(struct crypt_device *cd,
+	uint64_t offset,
+	uint64_t length,
+	uint64_t *skipped,
+	size_t wipe_block_size,
+	int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+	void *usrptr)
+{
+	struct crypt_params_integrity ip;
+	int r;
+
+	if (!cd || !isINTEGRITY(cd->type) || !length || !skipped ||
+	    offset + length < offset)
+		return -EINVAL;
+
+	r = init_crypto(cd);
+	if (r < 0)
+		return r;
+
+	r = crypt_get_integrity_info(cd, &ip);
+	if (r < 0)
+		return r;
+
+	if (!wipe_block_size)
+		wipe_block_size = 1024*1024;
+
+	return INTEGRITY_wipe_tags_range(cd, &ip, offset, offset + length, skipped,
+					 wipe_block_size, progress, usrptr);
+}
+
+int crypt_integrity_metadata_size(const struct crypt_params_integrity *params,
+	uint64_t data_size,
+	uint64_t *metadata_size)
+{
+	if (!params || !params->integrity || !metadata_size)
+		return -EINVAL;
+
+	return INTEGRITY_metadata_size(params, data_size, metadata_size);
+}
+
+int crypt_recalculate_integrity_tags(struct crypt_device *cd,
+	const char *integrity_key,
+	size_t integrity_key_size,
+	int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+	void *usrptr)
+{
+	struct crypt_params_integrity ip;
+	int r;
+
+	if (!cd || !isINTEGRITY(cd->type) || (!integrity_key && integrity_key_size))
+		return -EINVAL;
+
+	r = init_crypto(cd);
+	if (r < 0)
+		return r;
+
+	r = crypt_get_integrity_info(cd, &ip);
+	if (r < 0)
+		return r;
+
+	if (INTEGRITY_key_size(ip.integrity) > 0 && !integrity_key) {
+		log_err(cd, _("Integrity key is required to calculate %s tags."), ip.integrity);
+		return -EINVAL;
+	}
+
+	return INTEGRITY_recalculate_tags(cd, &ip, integrity_key, integrity_key_size, progress, usrptr);
+}
+
+int crypt_verify_integrity_tags(struct crypt_device *cd,
+	const char *integrity_key,
+	size_t integrity_key_size,
+	int (*mismatch)(uint64_t sector, uint64_t count, void *usrptr),
+	int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+	void *usrptr,
+	uint64_t *mismatched_sectors)
+{
+	struct crypt_params_integrity ip;
+	int r;
+
+	if (!cd || !isINTEGRITY(cd->type) || (!integrity_key && integrity_key_size))
+		return -EINVAL;
+
+	r = init_crypto(cd);
+	if (r < 0)
+		return r;
+
+	r = crypt_get_integrity_info(cd, &ip);
+	if (r < 0)
+		return r;
+
+	if (INTEGRITY_key_size(ip.integrity) > 0 && !integrity_key) {
+		log_err(cd, _("Integrity key is required to calculate %s tags."), ip.integrity);
+		return -EINVAL;
+	}
+
+	return INTEGRITY_verify_tags(cd, &ip, integrity_key, integrity_key_size,
+				     mismatch, progress, usrptr, mismatched_sectors);
+}
+
 int crypt_convert(struct crypt_device *cd,
 		  const char *type,
 		  void *params)
@@ -5841,6 +7422,7 @@ int crypt_activate_by_token_pin(struct crypt_device *cd, const char *name,
 	const char *type, int token, const char *pin, size_t pin_size,
 	void *usrptr, uint32_t flags)
 {
+	uint64_t t;
 	int r;
 
 	log_dbg(cd, "%s volume %s using token (%s type) %d.",
@@ -5860,8 +7442,12 @@ int crypt_activate_by_token_pin(struct crypt_device *cd, const char *name,
 	if (r < 0)
 		return r;
 
-	return LUKS2_token_open_and_activate(cd, &cd->u.luks2.hdr, token, name, type,
-					     pin, pin_size, flags, usrptr);
+	t = crypt_time_us();
+	r = LUKS2_token_open_and_activate(cd, &cd->u.luks2.hdr, token, name, type,
+					  pin, pin_size, flags, usrptr);
+	crypt_timing_add(cd, CRYPT_TIMING_TOKEN, t);
+
+	return r;
 }
 
 int crypt_activate_by_token(struct crypt_device *cd,
@@ -5882,7 +7468,11 @@ int crypt_token_json_get(struct crypt_device *cd, int token, const char **json)
 	if ((r = _onlyLUKS2(cd, CRYPT_CD_UNRESTRICTED, 0)))
 		return r;
 
-	return LUKS2_token_json_get(&cd->u.luks2.hdr, token, json) ?: token;
+	crypt_token_cd_lock(cd);
+	r = LUKS2_token_json_get(&cd->u.luks2.hdr, token, json) ?: token;
+	crypt_token_cd_unlock(cd);
+
+	return r;
 }
 
 int crypt_token_json_set(struct crypt_device *cd, int token, const char *json)
@@ -6018,6 +7608,29 @@ int crypt_metadata_locking(struct crypt_device *cd __attribute__((unused)), int
 	return 0;
 }
 
+int crypt_metadata_lock_hold(struct crypt_device *cd, int enable)
+{
+	if (!cd)
+		return -EINVAL;
+
+	log_dbg(cd, "Metadata lock hold %s.", enable ? "enabled" : "disabled");
+	device_set_lock_hold(cd, crypt_metadata_device(cd), enable ? true : false);
+
+	return 0;
+}
+
+int crypt_metadata_read_optimistic_enabled(void)
+{
+	return _metadata_read_optimistic;
+}
+
+int crypt_metadata_read_optimistic(struct crypt_device *cd, int enable)
+{
+	_metadata_read_optimistic = enable ? 1 : 0;
+	log_dbg(cd, "Optimistic metadata read %s.", enable ? "enabled" : "disabled");
+	return 0;
+}
+
 int crypt_persistent_flags_set(struct crypt_device *cd, crypt_flags_type type, uint32_t flags)
 {
 	int r;
@@ -6053,6 +7666,198 @@ int crypt_persistent_flags_get(struct crypt_device *cd, crypt_flags_type type, u
 	return -EINVAL;
 }
 
+int crypt_performance_flags_hint(struct crypt_device *cd, uint32_t *flags)
+{
+	uint32_t dmc_flags;
+	int r;
+
+	if (!cd || !flags)
+		return -EINVAL;
+
+	*flags = 0;
+
+	if (!crypt_data_device(cd))
+		return -EINVAL;
+
+	r = device_is_rotational(crypt_data_device(cd));
+	if (r < 0)
+		return r;
+
+	/*
+	 * Rotational disks benefit from dm-crypt write sorting and offload,
+	 * fast (non-rotational) devices are slowed down by the extra queueing.
+	 */
+	if (r) {
+		log_dbg(cd, "Rotational data device, keeping default dm-crypt queueing.");
+		return 0;
+	}
+
+	if (dm_flags(cd, DM_CRYPT, &dmc_flags) || !(dmc_flags & DM_CRYPT_NO_WORKQUEUE_SUPPORTED)) {
+		log_dbg(cd, "Non-rotational data device, but dm-crypt cannot bypass workqueues.");
+		return 0;
+	}
+
+	log_dbg(cd, "Non-rotational data device, suggesting to bypass dm-crypt workqueues.");
+	*flags = CRYPT_ACTIVATE_NO_READ_WORKQUEUE | CRYPT_ACTIVATE_NO_WRITE_WORKQUEUE;
+
+	return 0;
+}
+
+int crypt_inline_crypto_supported(struct crypt_device *cd)
+{
+	static const struct {
+		const char *cipher;
+		const char *mode;
+		size_t key_size;
+		const char *blk_mode;
+	} modes[] = {
+		{ "aes",	"xts-plain64",		64, "AES-256-XTS" },
+		{ "aes",	"cbc-essiv:sha256",	16, "AES-128-CBC-ESSIV" },
+		{ "xchacha12,aes", "adiantum-plain64",	32, "Adiantum" },
+		{ NULL,		NULL,			0,  NULL }
+	};
+	const char *cipher, *cipher_mode;
+	uint64_t sizes;
+	int i, sector_size;
+
+	if (!cd || !crypt_data_device(cd))
+		return -EINVAL;
+
+	cipher = crypt_get_cipher(cd);
+	cipher_mode = crypt_get_cipher_mode(cd);
+	sector_size = crypt_get_sector_size(cd);
+	if (!cipher || !cipher_mode || sector_size <= 0)
+		return -EINVAL;
+
+	if (crypt_get_integrity_tag_size(cd))
+		return 0;
+
+	for (i = 0; modes[i].cipher; i++) {
+		if (strcmp(cipher, modes[i].cipher) || strcmp(cipher_mode, modes[i].mode) ||
+		    (size_t)crypt_get_volume_key_size(cd) != modes[i].key_size)
+			continue;
+
+		sizes = device_inline_crypto_sizes(crypt_data_device(cd), modes[i].blk_mode);
+		log_dbg(cd, "Inline encryption %s data unit sizes mask 0x%" PRIx64 ".", modes[i].blk_mode, sizes);
+
+		return (sizes & (uint64_t)sector_size) ? 1 : 0;
+	}
+
+	return 0;
+}
+
+int crypt_reload_performance_flags(struct crypt_device *cd, const char *name, uint32_t flags)
+{
+	const uint32_t perf_flags = CRYPT_ACTIVATE_SAME_CPU_CRYPT | CRYPT_ACTIVATE_SUBMIT_FROM_CRYPT_CPUS |
+				    CRYPT_ACTIVATE_NO_READ_WORKQUEUE | CRYPT_ACTIVATE_NO_WRITE_WORKQUEUE;
+	struct crypt_dm_active_device dmd;
+	struct dm_target *tgt = &dmd.segment;
+	int r;
+
+	if (!cd || !name || (flags & ~perf_flags))
+		return -EINVAL;
+
+	r = dm_query_device(cd, name, DM_ACTIVE_DEVICE | DM_ACTIVE_CRYPT_CIPHER |
+				  DM_ACTIVE_UUID | DM_ACTIVE_CRYPT_KEYSIZE |
+				  DM_ACTIVE_CRYPT_KEY, &dmd);
+	if (r < 0) {
+		log_err(cd, _("Device %s is not active."), name);
+		return -EINVAL;
+	}
+
+	/* dm-integrity underneath would need its own reload */
+	if (!single_segment(&dmd) || tgt->type != DM_CRYPT || tgt->u.crypt.tag_size) {
+		r = -ENOTSUP;
+		log_err(cd, _("Unsupported parameters on device %s."), name);
+		goto out;
+	}
+
+	if ((dmd.flags & perf_flags) == flags) {
+		log_dbg(cd, "Performance flags of device %s already set.", name);
+		r = 0;
+		goto out;
+	}
+
+	log_dbg(cd, "Reloading device %s with key %s.", name,
+		tgt->u.crypt.vk->key_description ? "in keyring" : "from table");
+
+	/* Volume key (or its keyring reference) is reused from the active table */
+	dmd.flags = (dmd.flags & ~perf_flags) | flags;
+	r = dm_reload_device(cd, name, &dmd, 0, 1);
+out:
+	dm_targets_free(cd, &dmd);
+	free(CONST_CAST(void*)dmd.uuid);
+
+	return r;
+}
+
+bool crypt_header_transaction_active(struct crypt_device *cd)
+{
+	return cd ? cd->header_transaction : false;
+}
+
+int crypt_header_transaction_begin(struct crypt_device *cd)
+{
+	int r;
+
+	if ((r = onlyLUKS2(cd)))
+		return r;
+
+	if (cd->header_transaction)
+		return -EBUSY;
+
+	/* reencryption (or its recovery) must commit every step to disk */
+	if (crypt_get_luks2_reencrypt(cd) ||
+	    LUKS2_reencrypt_status(&cd->u.luks2.hdr) != CRYPT_REENCRYPT_NONE) {
+		log_err(cd, _("Cannot defer LUKS2 metadata writes during reencryption."));
+		return -EBUSY;
+	}
+
+	log_dbg(cd, "Starting LUKS2 header transaction.");
+	cd->header_transaction = true;
+
+	return 0;
+}
+
+int crypt_header_transaction_commit(struct crypt_device *cd)
+{
+	int r;
+
+	if ((r = onlyLUKS2(cd)))
+		return r;
+
+	if (!cd->header_transaction)
+		return -EINVAL;
+
+	cd->header_transaction = false;
+
+	log_dbg(cd, "Committing LUKS2 header transaction.");
+	r = LUKS2_hdr_write(cd, &cd->u.luks2.hdr);
+	if (r < 0) {
+		/* nothing staged survives, in-memory state follows the disk */
+		log_dbg(cd, "LUKS2 header transaction commit failed, reloading header.");
+		(void) _crypt_load_luks2(cd, 1, 0);
+	}
+
+	return r;
+}
+
+int crypt_header_transaction_abort(struct crypt_device *cd)
+{
+	int r;
+
+	if ((r = onlyLUKS2(cd)))
+		return r;
+
+	if (!cd->header_transaction)
+		return -EINVAL;
+
+	cd->header_transaction = false;
+
+	log_dbg(cd, "Aborting LUKS2 header transaction.");
+	return _crypt_load_luks2(cd, 1, 0);
+}
+
 static int update_volume_key_segment_digest(struct crypt_device *cd, struct luks2_hdr *hdr, int digest, int commit)
 {
 	int r;
@@ -6401,6 +8206,12 @@ int crypt_volume_key_keyring(struct crypt_device *cd __attribute__((unused)), in
 	return 0;
 }
 
+int crypt_set_udev_sync(struct crypt_device *cd, int enable)
+{
+	dm_udev_sync_set(cd, enable ? true : false);
+	return 0;
+}
+
 /* internal only */
 int crypt_volume_key_load_in_keyring(struct crypt_device *cd, struct volume_key *vk)
 {
@@ -6451,6 +8262,12 @@ void crypt_drop_keyring_key_by_description(struct crypt_device *cd, const char *
 	if (!key_description || !type_name)
 		return;
 
+	if (cd && cd->staged_key_description && !strcmp(cd->staged_key_description, key_description)) {
+		log_dbg(cd, "Keeping staged keyring %s key.", type_name);
+		crypt_set_key_in_keyring(cd, 0);
+		return;
+	}
+
 	log_dbg(cd, "Requesting keyring %s key for revoke and unlink.", type_name);
 
 	r = keyring_revoke_and_unlink_key(ktype, key_description);
@@ -6508,23 +8325,188 @@ int crypt_activate_by_keyring(struct crypt_device *cd,
 	return r;
 }
 
+static int _set_staged_key_description(struct crypt_device *cd, const char *key_description)
+{
+	char *desc = NULL;
+
+	if (key_description && !(desc = strdup(key_description)))
+		return -ENOMEM;
+
+	free(cd->staged_key_description);
+	cd->staged_key_description = desc;
+	return 0;
+}
+
+static int _check_staged_key_device(struct crypt_device *cd)
+{
+	if (!isLUKS2(cd->type)) {
+		log_err(cd, _("This operation is supported only for LUKS2 device."));
+		return -EINVAL;
+	}
+
+	if (!crypt_use_keyring_for_vk(cd)) {
+		log_err(cd, _("Kernel keyring is not supported by the kernel."));
+		return -EINVAL;
+	}
+
+	if (crypt_is_cipher_null(crypt_get_cipher(cd)) ||
+	    LUKS2_reencrypt_status(&cd->u.luks2.hdr) != CRYPT_REENCRYPT_NONE) {
+		log_err(cd, _("Device type is not properly initialized."));
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+int crypt_volume_key_keyring_stage(struct crypt_device *cd,
+	const char *volume_key,
+	size_t volume_key_size,
+	const char *key_description)
+{
+	struct volume_key *vk;
+	int r;
+
+	if (!cd || !volume_key || !volume_key_size || !key_description)
+		return -EINVAL;
+
+	if ((r = _check_staged_key_device(cd)))
+		return r;
+
+	vk = crypt_alloc_volume_key(volume_key_size, volume_key);
+	if (!vk)
+		return -ENOMEM;
+
+	r = LUKS2_digest_verify_by_segment(cd, &cd->u.luks2.hdr, CRYPT_DEFAULT_SEGMENT, vk);
+	if (r == -EPERM || r == -ENOENT)
+		log_err(cd, _("Volume key does not match the volume."));
+	crypt_free_volume_key(vk);
+	if (r < 0)
+		return r;
+
+	log_dbg(cd, "Staging volume key (%zu bytes) in session keyring.", volume_key_size);
+
+	r = keyring_add_key_in_session_keyring(LOGON_KEY, key_description, volume_key, volume_key_size);
+	if (r) {
+		log_dbg(cd, "keyring_add_key_in_session_keyring failed (error %d)", r);
+		log_err(cd, _("Failed to load key in kernel keyring."));
+		return r;
+	}
+
+	return _set_staged_key_description(cd, key_description);
+}
+
+int crypt_volume_key_keyring_drop(struct crypt_device *cd)
+{
+	char *desc;
+
+	if (!cd)
+		return -EINVAL;
+
+	if (!(desc = cd->staged_key_description))
+		return 0;
+
+	cd->staged_key_description = NULL;
+	crypt_drop_keyring_key_by_description(cd, desc, LOGON_KEY);
+	free(desc);
+
+	return 0;
+}
+
+int crypt_activate_by_staged_volume_key(struct crypt_device *cd,
+	const char *name,
+	const char *key_description,
+	uint32_t flags)
+{
+	struct volume_key *vk;
+	int r;
+
+	if (!cd || !name)
+		return -EINVAL;
+
+	if (!cd->staged_key_description)
+		return -ENOENT;
+
+	/* logon key cannot be read back, only the key verified when staged is trusted */
+	if (key_description && strcmp(key_description, cd->staged_key_description)) {
+		log_err(cd, _("Key %s was not staged and verified in this context."), key_description);
+		return -EPERM;
+	}
+	key_description = cd->staged_key_description;
+
+	log_dbg(cd, "Activating volume %s by staged volume key.", name);
+
+	if ((r = _check_staged_key_device(cd)))
+		return r;
+
+	r = _activate_check_status(cd, name, flags & CRYPT_ACTIVATE_REFRESH);
+	if (r < 0)
+		return r;
+
+	r = _check_header_data_overlap(cd, name);
+	if (r < 0)
+		return r;
+
+	/* only size and description of the key are used, the key stays in keyring */
+	vk = crypt_alloc_volume_key(crypt_get_volume_key_size(cd), NULL);
+	if (!vk)
+		return -ENOMEM;
+
+	r = crypt_volume_key_set_description(vk, key_description);
+	if (!r)
+		r = LUKS2_activate(cd, name, vk, flags | CRYPT_ACTIVATE_KEYRING_KEY);
+
+	crypt_free_volume_key(vk);
+
+	return r;
+}
+
 /*
  * Workaround for serialization of parallel activation and memory-hard PBKDF
  * In specific situation (systemd activation) this causes OOM killer activation.
- * For now, let's provide this ugly way to serialize unlocking of devices.
+ *
+ * Memory usable for PBKDF (the same limit as for benchmark) is split into
+ * slots shared by all processes; a derivation waits until slots covering
+ * its memory cost are free, so as many run in parallel as fit in memory.
+ * The global lock only serializes taking of slots. If slots cannot be used,
+ * the global lock is held for the whole derivation as before.
  */
-int crypt_serialize_lock(struct crypt_device *cd)
+#define MEMORY_HARD_SLOTS 64
+
+int crypt_serialize_lock(struct crypt_device *cd, uint32_t memory_kb)
 {
+	struct crypt_lock_handle *lock;
+	uint32_t slot_kb;
+	unsigned slots;
+	int r;
+
 	if (!cd->memory_hard_pbkdf_lock_enabled)
 		return 0;
 
+	slot_kb = adjusted_phys_memory() / MEMORY_HARD_SLOTS ?: 1;
+	slots = memory_kb / slot_kb + (memory_kb % slot_kb ? 1 : 0);
+	if (slots > MEMORY_HARD_SLOTS)
+		slots = MEMORY_HARD_SLOTS;
+	if (!slots)
+		slots = 1;
+
 	log_dbg(cd, "Taking global memory-hard access serialization lock.");
-	if (crypt_write_lock(cd, "memory-hard-access", true, &cd->pbkdf_memory_hard_lock)) {
+	if (crypt_write_lock(cd, "memory-hard-access", true, &lock)) {
 		log_err(cd, _("Failed to acquire global memory-hard access serialization lock."));
 		cd->pbkdf_memory_hard_lock = NULL;
 		return -EINVAL;
 	}
 
+	r = crypt_slots_lock(cd, "memory-hard-slots", MEMORY_HARD_SLOTS, slots,
+			     &cd->pbkdf_memory_hard_lock);
+	if (!r) {
+		log_dbg(cd, "Memory-hard access admitted for %" PRIu32 " kB (%u slots of %" PRIu32 " kB).",
+			memory_kb, slots, slot_kb);
+		crypt_unlock_internal(cd, lock);
+		return 0;
+	}
+
+	log_dbg(cd, "Memory-hard access slots not available (%d), serializing.", r);
+	cd->pbkdf_memory_hard_lock = lock;
 	return 0;
 }
 
@@ -23,6 +23,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <pthread.h>
 
 #include "libcryptsetup.h"
 #include "tcrypt.h"
@@ -270,7 +271,7 @@ static void TCRYPT_swab_le(char *buf)
 }
 
 static int decrypt_blowfish_le_cbc(struct tcrypt_alg *alg,
-				   const char *key, char *buf)
+				   const char *key, char *buf, size_t len)
 {
 	int bs = alg->iv_size;
 	char iv[8], iv_old[8];
@@ -285,7 +286,7 @@ static int decrypt_blowfish_le_cbc(struct tcrypt_alg *alg,
 		return r;
 
 	memcpy(iv, &key[alg->iv_offset], alg->iv_size);
-	for (i = 0; i < TCRYPT_HDR_LEN; i += bs) {
+	for (i = 0; i < (int)len; i += bs) {
 		memcpy(iv_old, &buf[i], bs);
 		TCRYPT_swab_le(&buf[i]);
 		r = crypt_cipher_decrypt(cipher, &buf[i], &buf[i],
@@ -304,11 +305,11 @@ static int decrypt_blowfish_le_cbc(struct tcrypt_alg *alg,
 	return r;
 }
 
-static void TCRYPT_remove_whitening(char *buf, const char *key)
+static void TCRYPT_remove_whitening(char *buf, const char *key, size_t len)
 {
-	int j;
+	size_t j;
 
-	for (j = 0; j < TCRYPT_HDR_LEN; j++)
+	for (j = 0; j < len; j++)
 		buf[j] ^= key[j % 8];
 }
 
@@ -333,7 +334,7 @@ static void TCRYPT_copy_key(struct tcrypt_alg *alg, const char *mode,
 }
 
 static int TCRYPT_decrypt_hdr_one(struct tcrypt_alg *alg, const char *mode,
-				   const char *key,struct tcrypt_phdr *hdr)
+				   const char *key, struct tcrypt_phdr *hdr, size_t len)
 {
 	char backend_key[TCRYPT_HDR_KEY_LEN];
 	char iv[TCRYPT_HDR_IV_LEN] = {};
@@ -352,9 +353,9 @@ static int TCRYPT_decrypt_hdr_one(struct tcrypt_alg *alg, const char *mode,
 	if (!strncmp(mode, "lrw", 3))
 		iv[alg->iv_size - 1] = 1;
 	else if (!strncmp(mode, "cbc", 3)) {
-		TCRYPT_remove_whitening(buf, &key[8]);
+		TCRYPT_remove_whitening(buf, &key[8], len);
 		if (!strcmp(alg->name, "blowfish_le"))
-			return decrypt_blowfish_le_cbc(alg, key, buf);
+			return decrypt_blowfish_le_cbc(alg, key, buf, len);
 		memcpy(iv, &key[alg->iv_offset], alg->iv_size);
 	}
 
@@ -362,7 +363,7 @@ static int TCRYPT_decrypt_hdr_one(struct tcrypt_alg *alg, const char *mode,
 	r = crypt_cipher_init(&cipher, alg->name, mode_name,
 			      backend_key, alg->key_size);
 	if (!r) {
-		r = crypt_cipher_decrypt(cipher, buf, buf, TCRYPT_HDR_LEN,
+		r = crypt_cipher_decrypt(cipher, buf, buf, len,
 					 iv, alg->iv_size);
 		crypt_cipher_destroy(cipher);
 	}
@@ -377,7 +378,7 @@ static int TCRYPT_decrypt_hdr_one(struct tcrypt_alg *alg, const char *mode,
  * Backend doesn't provide this, so implement it here directly using ECB.
  */
 static int TCRYPT_decrypt_cbci(struct tcrypt_algs *ciphers,
-				const char *key, struct tcrypt_phdr *hdr)
+				const char *key, struct tcrypt_phdr *hdr, size_t len)
 {
 	struct crypt_cipher *cipher[3];
 	unsigned int bs = ciphers->cipher[0].iv_size;
@@ -388,7 +389,7 @@ static int TCRYPT_decrypt_cbci(struct tcrypt_algs *ciphers,
 	assert(ciphers->chain_count <= 3);
 	assert(bs <= 16);
 
-	TCRYPT_remove_whitening(buf, &key[8]);
+	TCRYPT_remove_whitening(buf, &key[8], len);
 
 	memcpy(iv, &key[ciphers->cipher[0].iv_offset], bs);
 
@@ -404,7 +405,7 @@ static int TCRYPT_decrypt_cbci(struct tcrypt_algs *ciphers,
 	}
 
 	/* Implements CBC with chained ciphers in loop inside */
-	for (i = 0; i < TCRYPT_HDR_LEN; i += bs) {
+	for (i = 0; i < len; i += bs) {
 		memcpy(iv_old, &buf[i], bs);
 		for (j = ciphers->chain_count; j > 0; j--) {
 			r = crypt_cipher_decrypt(cipher[j - 1], &buf[i], &buf[i],
@@ -426,11 +427,44 @@ out:
 	return r;
 }
 
+/*
+ * All modes process the header in independent (XTS, LRW) or forward chained
+ * (CBC) blocks, so the first block holding the magic can be decrypted alone.
+ * Only a chain producing the magic decrypts the whole header.
+ */
+static int TCRYPT_decrypt_chain(struct tcrypt_algs *ciphers, const char *key,
+				struct tcrypt_phdr *hdr, size_t len)
+{
+	int j, r = -EINVAL;
+
+	if (!strncmp(ciphers->mode, "cbci", 4))
+		return TCRYPT_decrypt_cbci(ciphers, key, hdr, len);
+
+	for (j = ciphers->chain_count - 1; j >= 0 ; j--) {
+		if (!ciphers->cipher[j].name)
+			continue;
+		r = TCRYPT_decrypt_hdr_one(&ciphers->cipher[j], ciphers->mode, key, hdr, len);
+		if (r < 0)
+			break;
+	}
+
+	return r;
+}
+
+static bool TCRYPT_hdr_magic(struct tcrypt_phdr *hdr, struct crypt_params_tcrypt *params)
+{
+	if (!strncmp(hdr->d.magic, TCRYPT_HDR_MAGIC, TCRYPT_HDR_MAGIC_LEN))
+		return true;
+
+	return (params->flags & CRYPT_TCRYPT_VERA_MODES) &&
+		!strncmp(hdr->d.magic, VCRYPT_HDR_MAGIC, TCRYPT_HDR_MAGIC_LEN);
+}
+
 static int TCRYPT_decrypt_hdr(struct crypt_device *cd, struct tcrypt_phdr *hdr,
 			       const char *key, struct crypt_params_tcrypt *params)
 {
 	struct tcrypt_phdr hdr2;
-	int i, j, r = -EINVAL;
+	int i, r = -EINVAL;
 
 	for (i = 0; tcrypt_cipher[i].chain_count; i++) {
 		if (params->cipher && !strstr(tcrypt_cipher[i].long_name, params->cipher))
@@ -440,19 +474,8 @@ static int TCRYPT_decrypt_hdr(struct crypt_device *cd, struct tcrypt_phdr *hdr,
 		log_dbg(cd, "TCRYPT:  trying cipher %s-%s",
 			tcrypt_cipher[i].long_name, tcrypt_cipher[i].mode);
 
-		memcpy(&hdr2.e, &hdr->e, TCRYPT_HDR_LEN);
-
-		if (!strncmp(tcrypt_cipher[i].mode, "cbci", 4))
-			r = TCRYPT_decrypt_cbci(&tcrypt_cipher[i], key, &hdr2);
-		else for (j = tcrypt_cipher[i].chain_count - 1; j >= 0 ; j--) {
-			if (!tcrypt_cipher[i].cipher[j].name)
-				continue;
-			r = TCRYPT_decrypt_hdr_one(&tcrypt_cipher[i].cipher[j],
-					    tcrypt_cipher[i].mode, key, &hdr2);
-			if (r < 0)
-				break;
-		}
-
+		memcpy(&hdr2.e, &hdr->e, TCRYPT_HDR_TRIAL_LEN);
+		r = TCRYPT_decrypt_chain(&tcrypt_cipher[i], key, &hdr2, TCRYPT_HDR_TRIAL_LEN);
 		if (r < 0) {
 			log_dbg(cd, "TCRYPT:   returned error %d, skipped.", r);
 			if (r == -ENOTSUP)
@@ -461,6 +484,13 @@ static int TCRYPT_decrypt_hdr(struct crypt_device *cd, struct tcrypt_phdr *hdr,
 			continue;
 		}
 
+		if (TCRYPT_hdr_magic(&hdr2, params)) {
+			memcpy(&hdr2.e, &hdr->e, TCRYPT_HDR_LEN);
+			r = TCRYPT_decrypt_chain(&tcrypt_cipher[i], key, &hdr2, TCRYPT_HDR_LEN);
+			if (r < 0)
+				break;
+		}
+
 		if (!strncmp(hdr2.d.magic, TCRYPT_HDR_MAGIC, TCRYPT_HDR_MAGIC_LEN)) {
 			log_dbg(cd, "TCRYPT: Signature magic detected.");
 			memcpy(&hdr->e, &hdr2.e, TCRYPT_HDR_LEN);
@@ -526,18 +556,116 @@ out:
 	return r;
 }
 
-static int TCRYPT_init_hdr(struct crypt_device *cd,
-			   struct tcrypt_phdr *hdr,
-			   struct crypt_params_tcrypt *params)
-{
-	unsigned char pwd[VCRYPT_KEY_POOL_LEN] = {};
-	size_t passphrase_size, max_passphrase_size;
+/*
+ * KDF candidates are independent, they are derived by a pool of threads
+ * while the calling thread tries header decryption in table order, so the
+ * result is the same as with sequential search. Once a header matches, no
+ * new derivation is started; running ones cannot be interrupted and are
+ * waited for and discarded. Threads do not run ahead to candidates much
+ * more expensive than the tested one, so a match of a cheap TrueCrypt KDF
+ * does not wait for VeraCrypt derivations.
+ */
+struct tcrypt_kdf_job {
+	unsigned int kdf;
+	uint32_t iterations;
 	char *key;
-	unsigned int i, skipped = 0, iterations;
-	int r = -EPERM, keyfiles_pool_length;
+	bool taken;
+	bool done;
+	int r;
+};
 
-	if (posix_memalign((void*)&key, crypt_getpagesize(), TCRYPT_HDR_KEY_LEN))
-		return -ENOMEM;
+struct tcrypt_kdf_pool {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct tcrypt_kdf_job jobs[ARRAY_SIZE(tcrypt_kdf)];
+	unsigned int count;
+	unsigned int next;
+	uint64_t max_iterations;
+	bool cancel;
+	const char *pwd;
+	size_t pwd_size;
+	const char *salt;
+};
+
+static void TCRYPT_kdf_run(struct tcrypt_kdf_pool *pool, struct tcrypt_kdf_job *job)
+{
+	int r;
+
+	r = crypt_pbkdf(tcrypt_kdf[job->kdf].name, tcrypt_kdf[job->kdf].hash,
+			pool->pwd, pool->pwd_size,
+			pool->salt, TCRYPT_HDR_SALT_LEN,
+			job->key, TCRYPT_HDR_KEY_LEN,
+			job->iterations, 0, 0);
+
+	pthread_mutex_lock(&pool->lock);
+	job->r = r;
+	job->done = true;
+	pthread_cond_broadcast(&pool->cond);
+	pthread_mutex_unlock(&pool->lock);
+}
+
+static void *TCRYPT_kdf_thread(void *arg)
+{
+	struct tcrypt_kdf_pool *pool = arg;
+	struct tcrypt_kdf_job *job;
+
+	pthread_mutex_lock(&pool->lock);
+	while (true) {
+		while (pool->next < pool->count && pool->jobs[pool->next].taken)
+			pool->next++;
+		if (pool->cancel || pool->next >= pool->count)
+			break;
+		if (pool->jobs[pool->next].iterations > pool->max_iterations) {
+			pthread_cond_wait(&pool->cond, &pool->lock);
+			continue;
+		}
+		job = &pool->jobs[pool->next++];
+		job->taken = true;
+		pthread_mutex_unlock(&pool->lock);
+
+		TCRYPT_kdf_run(pool, job);
+		pthread_mutex_lock(&pool->lock);
+	}
+	pthread_mutex_unlock(&pool->lock);
+
+	return NULL;
+}
+
+/* Wait for derived key of the job, derive it here if no thread took it yet. */
+static int TCRYPT_kdf_wait(struct tcrypt_kdf_pool *pool, struct tcrypt_kdf_job *job)
+{
+	bool run = false;
+
+	pthread_mutex_lock(&pool->lock);
+	/* let threads take candidates up to twice as expensive */
+	if (pool->max_iterations < (uint64_t)job->iterations * 2) {
+		pool->max_iterations = (uint64_t)job->iterations * 2;
+		pthread_cond_broadcast(&pool->cond);
+	}
+	if (!job->taken)
+		run = job->taken = true;
+	else while (!job->done)
+		pthread_cond_wait(&pool->cond, &pool->lock);
+	pthread_mutex_unlock(&pool->lock);
+
+	if (run)
+		TCRYPT_kdf_run(pool, job);
+
+	return job->r;
+}
+
+/*
+ * KDF password depends only on passphrase and keyfiles, it is the same
+ * for all probed headers (normal, hidden, backup) and computed once.
+ */
+static int TCRYPT_init_passphrase(struct crypt_device *cd,
+				  struct crypt_params_tcrypt *params,
+				  unsigned char pwd[VCRYPT_KEY_POOL_LEN],
+				  size_t *passphrase_size)
+{
+	size_t max_passphrase_size;
+	unsigned int i;
+	int r, keyfiles_pool_length;
 
 	if (params->flags & CRYPT_TCRYPT_VERA_MODES &&
 	    params->passphrase_size > TCRYPT_KEY_POOL_LEN) {
@@ -550,27 +678,49 @@ static int TCRYPT_init_hdr(struct crypt_device *cd,
 	}
 
 	if (params->keyfiles_count)
-		passphrase_size = max_passphrase_size;
+		*passphrase_size = max_passphrase_size;
 	else
-		passphrase_size = params->passphrase_size;
+		*passphrase_size = params->passphrase_size;
 
 	if (params->passphrase_size > max_passphrase_size) {
 		log_err(cd, _("Maximum TCRYPT passphrase length (%zu) exceeded."),
 			      max_passphrase_size);
-		goto out;
+		return -EPERM;
 	}
 
 	/* Calculate pool content from keyfiles */
 	for (i = 0; i < params->keyfiles_count; i++) {
 		r = TCRYPT_pool_keyfile(cd, pwd, params->keyfiles[i], keyfiles_pool_length);
 		if (r < 0)
-			goto out;
+			return r;
 	}
 
 	/* If provided password, combine it with pool */
 	for (i = 0; i < params->passphrase_size; i++)
 		pwd[i] += params->passphrase[i];
 
+	return 0;
+}
+
+static int TCRYPT_init_hdr(struct crypt_device *cd,
+			   struct tcrypt_phdr *hdr,
+			   struct crypt_params_tcrypt *params,
+			   const unsigned char *pwd, size_t passphrase_size)
+{
+	struct tcrypt_kdf_pool pool = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+	};
+	pthread_t threads[ARRAY_SIZE(tcrypt_kdf)];
+	struct tcrypt_kdf_job *job;
+	char *keys;
+	unsigned int i, j, skipped = 0, iterations, started = 0, nthreads;
+	int r = -EPERM;
+
+	if (posix_memalign((void*)&keys, crypt_getpagesize(),
+			   ARRAY_SIZE(tcrypt_kdf) * TCRYPT_HDR_KEY_LEN))
+		return -ENOMEM;
+
 	for (i = 0; tcrypt_kdf[i].name; i++) {
 		if (params->hash_name && strcmp(params->hash_name, tcrypt_kdf[i].hash))
 			continue;
@@ -587,15 +737,36 @@ static int TCRYPT_init_hdr(struct crypt_device *cd,
 				    (tcrypt_kdf[i].veracrypt_pim_mult * params->veracrypt_pim);
 		} else
 			iterations = tcrypt_kdf[i].iterations;
+
+		job = &pool.jobs[pool.count];
+		job->kdf = i;
+		job->iterations = iterations;
+		job->key = &keys[pool.count++ * TCRYPT_HDR_KEY_LEN];
+	}
+
+	pool.pwd = (const char*)pwd;
+	pool.pwd_size = passphrase_size;
+	pool.salt = hdr->salt;
+
+	/* The calling thread derives keys too while waiting for the next one */
+	nthreads = crypt_cpusonline();
+	if (nthreads > pool.count)
+		nthreads = pool.count;
+	for (started = 0; started + 1 < nthreads; started++)
+		if (pthread_create(&threads[started], NULL, TCRYPT_kdf_thread, &pool))
+			break;
+	if (started)
+		log_dbg(cd, "TCRYPT: deriving %u KDF candidates with %u threads.",
+			pool.count, started + 1);
+
+	for (j = 0; j < pool.count; j++) {
+		job = &pool.jobs[j];
+		i = job->kdf;
 		/* Derive header key */
 		log_dbg(cd, "TCRYPT: trying KDF: %s-%s-%d%s.",
 			tcrypt_kdf[i].name, tcrypt_kdf[i].hash, tcrypt_kdf[i].iterations,
 			params->veracrypt_pim && tcrypt_kdf[i].veracrypt ? "-PIM" : "");
-		r = crypt_pbkdf(tcrypt_kdf[i].name, tcrypt_kdf[i].hash,
-				(char*)pwd, passphrase_size,
-				hdr->salt, TCRYPT_HDR_SALT_LEN,
-				key, TCRYPT_HDR_KEY_LEN,
-				iterations, 0, 0);
+		r = TCRYPT_kdf_wait(&pool, job);
 		if (r < 0) {
 			log_verbose(cd, _("PBKDF2 hash algorithm %s not available, skipping."),
 				      tcrypt_kdf[i].hash);
@@ -605,7 +776,7 @@ static int TCRYPT_init_hdr(struct crypt_device *cd,
 		}
 
 		/* Decrypt header */
-		r = TCRYPT_decrypt_hdr(cd, hdr, key, params);
+		r = TCRYPT_decrypt_hdr(cd, hdr, job->key, params);
 		if (r == -ENOENT) {
 			skipped++;
 			r = -EPERM;
@@ -615,6 +786,19 @@ static int TCRYPT_init_hdr(struct crypt_device *cd,
 			break;
 	}
 
+	pthread_mutex_lock(&pool.lock);
+	pool.cancel = true;
+	pthread_cond_broadcast(&pool.cond);
+	pthread_mutex_unlock(&pool.lock);
+	while (started)
+		pthread_join(threads[--started], NULL);
+
+	/* i is the matching KDF, otherwise the count of all table entries */
+	if (j < pool.count)
+		i = pool.jobs[j].kdf;
+	else
+		i = ARRAY_SIZE(tcrypt_kdf) - 1;
+
 	if ((r < 0 && skipped && skipped == i) || r == -ENOTSUP) {
 		log_err(cd, _("Required kernel crypto interface not available."));
 #ifdef ENABLE_AF_ALG
@@ -637,10 +821,10 @@ static int TCRYPT_init_hdr(struct crypt_device *cd,
 			params->cipher, params->mode, params->key_size);
 	}
 out:
-	crypt_safe_memzero(pwd, TCRYPT_KEY_POOL_LEN);
-	if (key)
-		crypt_safe_memzero(key, TCRYPT_HDR_KEY_LEN);
-	free(key);
+	crypt_safe_memzero(keys, ARRAY_SIZE(tcrypt_kdf) * TCRYPT_HDR_KEY_LEN);
+	free(keys);
+	pthread_cond_destroy(&pool.cond);
+	pthread_mutex_destroy(&pool.lock);
 	return r;
 }
 
@@ -650,11 +834,17 @@ int TCRYPT_read_phdr(struct crypt_device *cd,
 {
 	struct device *base_device = NULL, *device = crypt_metadata_device(cd);
 	ssize_t hdr_size = sizeof(struct tcrypt_phdr);
+	unsigned char pwd[VCRYPT_KEY_POOL_LEN] = {};
+	size_t pwd_size;
 	char *base_device_path;
 	int devfd, r;
 
 	assert(sizeof(struct tcrypt_phdr) == 512);
 
+	r = TCRYPT_init_passphrase(cd, params, pwd, &pwd_size);
+	if (r < 0)
+		goto out;
+
 	log_dbg(cd, "Reading TCRYPT header of size %zu bytes from device %s.",
 		hdr_size, device_path(device));
 
@@ -663,13 +853,15 @@ int TCRYPT_read_phdr(struct crypt_device *cd,
 		base_device_path = crypt_get_base_device(device_path(device));
 
 		log_dbg(cd, "Reading TCRYPT system header from device %s.", base_device_path ?: "?");
-		if (!base_device_path)
-			return -EINVAL;
+		if (!base_device_path) {
+			r = -EINVAL;
+			goto out;
+		}
 
 		r = device_alloc(cd, &base_device, base_device_path);
 		free(base_device_path);
 		if (r < 0)
-			return r;
+			goto out;
 		devfd = device_open(cd, base_device, O_RDONLY);
 	} else
 		devfd = device_open(cd, device, O_RDONLY);
@@ -677,42 +869,45 @@ int TCRYPT_read_phdr(struct crypt_device *cd,
 	if (devfd < 0) {
 		device_free(cd, base_device);
 		log_err(cd, _("Cannot open device %s."), device_path(device));
-		return -EINVAL;
+		r = -EINVAL;
+		goto out;
 	}
 
 	r = -EIO;
 	if (params->flags & CRYPT_TCRYPT_SYSTEM_HEADER) {
-		if (read_lseek_blockwise(devfd, device_block_size(cd, device),
+		if (pread_blockwise(devfd, device_block_size(cd, device),
 			device_alignment(device), hdr, hdr_size,
 			TCRYPT_HDR_SYSTEM_OFFSET) == hdr_size) {
-			r = TCRYPT_init_hdr(cd, hdr, params);
+			r = TCRYPT_init_hdr(cd, hdr, params, pwd, pwd_size);
 		}
 	} else if (params->flags & CRYPT_TCRYPT_HIDDEN_HEADER) {
 		if (params->flags & CRYPT_TCRYPT_BACKUP_HEADER) {
-			if (read_lseek_blockwise(devfd, device_block_size(cd, device),
+			if (pread_blockwise(devfd, device_block_size(cd, device),
 				device_alignment(device), hdr, hdr_size,
 				TCRYPT_HDR_HIDDEN_OFFSET_BCK) == hdr_size)
-				r = TCRYPT_init_hdr(cd, hdr, params);
+				r = TCRYPT_init_hdr(cd, hdr, params, pwd, pwd_size);
 		} else {
-			if (read_lseek_blockwise(devfd, device_block_size(cd, device),
+			if (pread_blockwise(devfd, device_block_size(cd, device),
 				device_alignment(device), hdr, hdr_size,
 				TCRYPT_HDR_HIDDEN_OFFSET) == hdr_size)
-				r = TCRYPT_init_hdr(cd, hdr, params);
-			if (r && read_lseek_blockwise(devfd, device_block_size(cd, device),
+				r = TCRYPT_init_hdr(cd, hdr, params, pwd, pwd_size);
+			if (r && pread_blockwise(devfd, device_block_size(cd, device),
 				device_alignment(device), hdr, hdr_size,
 				TCRYPT_HDR_HIDDEN_OFFSET_OLD) == hdr_size)
-				r = TCRYPT_init_hdr(cd, hdr, params);
+				r = TCRYPT_init_hdr(cd, hdr, params, pwd, pwd_size);
 		}
 	} else if (params->flags & CRYPT_TCRYPT_BACKUP_HEADER) {
-		if (read_lseek_blockwise(devfd, device_block_size(cd, device),
+		if (pread_blockwise(devfd, device_block_size(cd, device),
 			device_alignment(device), hdr, hdr_size,
 			TCRYPT_HDR_OFFSET_BCK) == hdr_size)
-			r = TCRYPT_init_hdr(cd, hdr, params);
-	} else if (read_lseek_blockwise(devfd, device_block_size(cd, device),
+			r = TCRYPT_init_hdr(cd, hdr, params, pwd, pwd_size);
+	} else if (pread_blockwise(devfd, device_block_size(cd, device),
 			device_alignment(device), hdr, hdr_size, 0) == hdr_size)
-		r = TCRYPT_init_hdr(cd, hdr, params);
+		r = TCRYPT_init_hdr(cd, hdr, params, pwd, pwd_size);
 
 	device_free(cd, base_device);
+out:
+	crypt_safe_memzero(pwd, sizeof(pwd));
 	if (r < 0)
 		memset(hdr, 0, sizeof (*hdr));
 	return r;
@@ -31,6 +31,8 @@
 #define TCRYPT_HDR_MAGIC "TRUE"
 #define VCRYPT_HDR_MAGIC "VERA"
 #define TCRYPT_HDR_MAGIC_LEN 4
+/* first cipher block(s) holding the magic */
+#define TCRYPT_HDR_TRIAL_LEN 16
 
 #define TCRYPT_HDR_HIDDEN_OFFSET_OLD -1536
 #define TCRYPT_HDR_HIDDEN_OFFSET 65536
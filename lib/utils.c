@@ -142,7 +142,7 @@ int crypt_keyfile_device_read(struct crypt_device *cd,  const char *keyfile,
 {
 	int fd, regular_file, char_to_read = 0, char_read = 0, unlimited_read = 0;
 	int r = -EINVAL, newline;
-	char *pass = NULL;
+	char *pass = NULL, *eol;
 	size_t buflen, i;
 	uint64_t file_read_size;
 	struct stat st;
@@ -209,9 +209,16 @@ int crypt_keyfile_device_read(struct crypt_device *cd,  const char *keyfile,
 		goto out;
 	}
 
+	/* Whole keyfile is read in one go, let the kernel read ahead all of it */
+	if (regular_file) {
+		(void)posix_fadvise(fd, (off_t)keyfile_offset, (off_t)buflen, POSIX_FADV_SEQUENTIAL);
+		(void)posix_fadvise(fd, (off_t)keyfile_offset, (off_t)buflen, POSIX_FADV_WILLNEED);
+	}
+
 	for (i = 0, newline = 0; i < key_size; i += char_read) {
 		if (i == buflen) {
-			buflen += 4096;
+			/* grow geometrically, every realloc copies the whole buffer */
+			buflen = buflen > key_size / 2 ? key_size : buflen * 2;
 			pass = crypt_safe_realloc(pass, buflen);
 			if (!pass) {
 				log_err(cd, _("Out of memory while reading passphrase."));
@@ -220,11 +227,12 @@ int crypt_keyfile_device_read(struct crypt_device *cd,  const char *keyfile,
 			}
 		}
 
-		if (flags & CRYPT_KEYFILE_STOP_EOL) {
+		if ((flags & CRYPT_KEYFILE_STOP_EOL) && !regular_file) {
 			/* If we should stop on newline, we must read the input
 			 * one character at the time. Otherwise we might end up
 			 * having read some bytes after the newline, which we
-			 * promised not to do.
+			 * promised not to do. Regular keyfile is closed after
+			 * read, so there the bytes after newline are just wiped.
 			 */
 			char_to_read = 1;
 		} else {
@@ -242,6 +250,13 @@ int crypt_keyfile_device_read(struct crypt_device *cd,  const char *keyfile,
 		if (char_read == 0)
 			break;
 		/* Stop on newline only if not requested read from keyfile */
+		if ((flags & CRYPT_KEYFILE_STOP_EOL) && regular_file &&
+		    (eol = memchr(&pass[i], '\n', char_read))) {
+			crypt_safe_memzero(eol, char_read - (eol - &pass[i]));
+			i = eol - pass;
+			newline = 1;
+			break;
+		}
 		if ((flags & CRYPT_KEYFILE_STOP_EOL) && pass[i] == '\n') {
 			newline = 1;
 			pass[i] = '\0';
@@ -0,0 +1,191 @@
+/*
+ * libcryptsetup - cryptsetup library, asynchronous activation jobs
+ *
+ * Copyright (C) 2023 Red Hat, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+
+#include "internal.h"
+
+/*
+ * One activation runs in its own thread on the caller's device context.
+ * Cancel request and deadline are polled through the crypto backend KDF
+ * cancel hook, completion is signalled on an eventfd.
+ */
+struct crypt_activation_job {
+	struct crypt_device *cd;
+	char *name;
+	char *passphrase;
+	size_t passphrase_size;
+	int keyslot;
+	uint32_t flags;
+	uint64_t deadline_us;
+
+	struct crypt_pbkdf_cancel cancel;
+	int cancelled;
+	int done;
+	int r;
+	int fd;
+	pthread_t thread;
+};
+
+static int job_check_cancel(void *usrptr)
+{
+	struct crypt_activation_job *job = usrptr;
+
+	if (__atomic_load_n(&job->cancelled, __ATOMIC_RELAXED))
+		return -ECANCELED;
+	if (job->deadline_us && crypt_time_us() >= job->deadline_us)
+		return -ETIMEDOUT;
+
+	return 0;
+}
+
+static void *job_thread(void *arg)
+{
+	struct crypt_activation_job *job = arg;
+	uint64_t one = 1;
+	int r, c;
+
+	crypt_pbkdf_set_cancel(&job->cancel);
+	r = job_check_cancel(job);
+	if (!r)
+		r = crypt_activate_by_passphrase(job->cd, job->name, job->keyslot,
+						 job->passphrase, job->passphrase_size, job->flags);
+	crypt_pbkdf_set_cancel(NULL);
+
+	/* aborted KDF may be reported as generic failure (e.g. LUKS1 digest check) */
+	if (r < 0 && (c = job_check_cancel(job)))
+		r = c;
+
+	log_dbg(job->cd, "Asynchronous activation finished with %d.", r);
+
+	/* passphrase is not needed anymore */
+	crypt_safe_free(job->passphrase);
+	job->passphrase = NULL;
+
+	job->r = r;
+	__atomic_store_n(&job->done, 1, __ATOMIC_RELEASE);
+	if (write(job->fd, &one, sizeof(one)) < 0)
+		log_dbg(job->cd, "Cannot signal activation job completion.");
+
+	return NULL;
+}
+
+int crypt_activate_by_passphrase_async(struct crypt_device *cd,
+	const char *name,
+	int keyslot,
+	const char *passphrase,
+	size_t passphrase_size,
+	uint32_t flags,
+	uint32_t timeout_ms,
+	struct crypt_activation_job **job)
+{
+	struct crypt_activation_job *j;
+	int r;
+
+	if (!cd || !passphrase || !job || (!name && (flags & CRYPT_ACTIVATE_REFRESH)))
+		return -EINVAL;
+
+	j = calloc(1, sizeof(*j));
+	if (!j)
+		return -ENOMEM;
+
+	j->cd = cd;
+	j->keyslot = keyslot;
+	j->flags = flags;
+	j->passphrase_size = passphrase_size;
+	j->cancel.check = job_check_cancel;
+	j->cancel.usrptr = j;
+	j->fd = -1;
+	if (timeout_ms)
+		j->deadline_us = crypt_time_us() + (uint64_t)timeout_ms * 1000;
+
+	r = -ENOMEM;
+	if (name && !(j->name = strdup(name)))
+		goto err;
+
+	j->passphrase = crypt_safe_alloc(passphrase_size ?: 1);
+	if (!j->passphrase)
+		goto err;
+	memcpy(j->passphrase, passphrase, passphrase_size);
+
+	j->fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (j->fd < 0) {
+		r = -errno;
+		goto err;
+	}
+
+	log_dbg(cd, "Starting asynchronous activation of %s [keyslot %d, timeout %u ms].",
+		name ?: "passphrase check", keyslot, timeout_ms);
+
+	r = -pthread_create(&j->thread, NULL, job_thread, j);
+	if (r)
+		goto err;
+
+	*job = j;
+	return 0;
+err:
+	if (j->fd >= 0)
+		close(j->fd);
+	crypt_safe_free(j->passphrase);
+	free(j->name);
+	free(j);
+	return r;
+}
+
+int crypt_activation_job_get_fd(struct crypt_activation_job *job)
+{
+	return job ? job->fd : -EINVAL;
+}
+
+void crypt_activation_job_cancel(struct crypt_activation_job *job)
+{
+	if (job)
+		__atomic_store_n(&job->cancelled, 1, __ATOMIC_RELAXED);
+}
+
+int crypt_activation_job_result(struct crypt_activation_job *job)
+{
+	if (!job)
+		return -EINVAL;
+
+	if (!__atomic_load_n(&job->done, __ATOMIC_ACQUIRE))
+		return -EINPROGRESS;
+
+	return job->r;
+}
+
+void crypt_activation_job_free(struct crypt_activation_job *job)
+{
+	if (!job)
+		return;
+
+	crypt_activation_job_cancel(job);
+	pthread_join(job->thread, NULL);
+
+	close(job->fd);
+	crypt_safe_free(job->passphrase);
+	free(job->name);
+	free(job);
+}
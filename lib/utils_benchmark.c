@@ -19,17 +19,31 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
 
 #include "internal.h"
 
-int crypt_benchmark(struct crypt_device *cd,
+/* PBKDF calibration cache sizes */
+#define PBKDF_CACHE_HOST_DIGEST	"sha256"
+#define PBKDF_CACHE_HOST_SIZE	32
+#define PBKDF_CACHE_MAX_SIZE	(64 * 1024)
+#define PBKDF_CACHE_LINE_MAX	256
+
+/* Cipher benchmark in one thread (@threads == 0, with shared buffer) or in @threads threads */
+static int cipher_benchmark(struct crypt_device *cd,
 	const char *cipher,
 	const char *cipher_mode,
 	size_t volume_key_size,
 	size_t iv_size,
 	size_t buffer_size,
+	unsigned threads,
 	double *encryption_mbs,
 	double *decryption_mbs)
 {
@@ -45,9 +59,11 @@ int crypt_benchmark(struct crypt_device *cd,
 		return r;
 
 	r = -ENOMEM;
-	if (posix_memalign(&buffer, crypt_getpagesize(), buffer_size))
-		goto out;
-	memset(buffer, 0, buffer_size);
+	if (!threads) {
+		if (posix_memalign(&buffer, crypt_getpagesize(), buffer_size))
+			goto out;
+		memset(buffer, 0, buffer_size);
+	}
 
 	r = crypt_cipher_ivsize(cipher, cipher_mode);
 	if (r >= 0 && iv_size != (size_t)r) {
@@ -73,8 +89,12 @@ int crypt_benchmark(struct crypt_device *cd,
 	if ((c  = strchr(mode, '-')))
 		*c = '\0';
 
-	r = crypt_cipher_perf_kernel(cipher, cipher_mode, buffer, buffer_size, key, volume_key_size,
-				     iv, iv_size, encryption_mbs, decryption_mbs);
+	if (threads)
+		r = crypt_cipher_perf_kernel_threads(cipher, cipher_mode, buffer_size, key, volume_key_size,
+						     iv, iv_size, threads, encryption_mbs, decryption_mbs);
+	else
+		r = crypt_cipher_perf_kernel(cipher, cipher_mode, buffer, buffer_size, key, volume_key_size,
+					     iv, iv_size, encryption_mbs, decryption_mbs);
 
 	if (r == -ERANGE)
 		log_dbg(cd, "Measured cipher runtime is too low.");
@@ -89,6 +109,119 @@ out:
 	return r;
 }
 
+int crypt_benchmark(struct crypt_device *cd,
+	const char *cipher,
+	const char *cipher_mode,
+	size_t volume_key_size,
+	size_t iv_size,
+	size_t buffer_size,
+	double *encryption_mbs,
+	double *decryption_mbs)
+{
+	return cipher_benchmark(cd, cipher, cipher_mode, volume_key_size, iv_size,
+				buffer_size, 0, encryption_mbs, decryption_mbs);
+}
+
+int crypt_benchmark_threads(struct crypt_device *cd,
+	const char *cipher,
+	const char *cipher_mode,
+	size_t volume_key_size,
+	size_t iv_size,
+	size_t buffer_size,
+	unsigned threads,
+	double *encryption_mbs,
+	double *decryption_mbs)
+{
+	if (!threads || threads > CRYPT_BENCHMARK_THREADS_MAX)
+		return -EINVAL;
+
+	return cipher_benchmark(cd, cipher, cipher_mode, volume_key_size, iv_size,
+				buffer_size, threads, encryption_mbs, decryption_mbs);
+}
+
+int crypt_benchmark_sectors(struct crypt_device *cd,
+	const char *cipher,
+	const char *cipher_mode,
+	size_t volume_key_size,
+	uint32_t sector_size,
+	size_t buffer_size,
+	double *encryption_mbs,
+	double *decryption_mbs)
+{
+	void *buffer = NULL;
+	char *key = NULL;
+	int r;
+
+	if (!cipher || !cipher_mode || !volume_key_size || !encryption_mbs || !decryption_mbs ||
+	    sector_size < SECTOR_SIZE || sector_size > MAX_SECTOR_SIZE || NOTPOW2(sector_size) ||
+	    !buffer_size || buffer_size % sector_size)
+		return -EINVAL;
+
+	r = init_crypto(cd);
+	if (r < 0)
+		return r;
+
+	r = -ENOMEM;
+	if (posix_memalign(&buffer, crypt_getpagesize(), buffer_size))
+		goto out;
+	memset(buffer, 0, buffer_size);
+
+	key = crypt_safe_alloc(volume_key_size);
+	if (!key)
+		goto out;
+
+	crypt_random_get(cd, key, volume_key_size, CRYPT_RND_NORMAL);
+
+	r = crypt_storage_perf(cipher, cipher_mode, sector_size, buffer, buffer_size,
+			       key, volume_key_size, encryption_mbs, decryption_mbs);
+	if (r == -ERANGE)
+		log_dbg(cd, "Measured cipher runtime is too low.");
+	else if (r)
+		log_dbg(cd, "Cannot initialize cipher %s, mode %s, key size %zu, sector size %" PRIu32 ".",
+			cipher, cipher_mode, volume_key_size, sector_size);
+out:
+	free(buffer);
+	crypt_safe_free(key);
+
+	return r;
+}
+
+/* Single run with exactly the requested costs, time is reported through progress */
+static int pbkdf_measure(struct crypt_pbkdf_type *pbkdf,
+	const char *password, size_t password_size,
+	const char *salt, size_t salt_size,
+	size_t volume_key_size,
+	int (*progress)(uint32_t time_ms, void *usrptr),
+	void *usrptr)
+{
+	struct timespec start, end;
+	char *key;
+	uint64_t ms;
+	int r;
+
+	if (!pbkdf->iterations)
+		return -EINVAL;
+
+	key = crypt_safe_alloc(volume_key_size);
+	if (!key)
+		return -ENOMEM;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	r = crypt_pbkdf(pbkdf->type, pbkdf->hash, password, password_size, salt, salt_size,
+			key, volume_key_size, pbkdf->iterations, pbkdf->max_memory_kb,
+			pbkdf->parallel_threads);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	crypt_safe_free(key);
+
+	if (!r) {
+		ms = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_nsec - start.tv_nsec) / 1000000;
+		if (progress && progress((uint32_t)ms, usrptr))
+			r = -EINTR;
+	}
+
+	return r;
+}
+
 int crypt_benchmark_pbkdf(struct crypt_device *cd,
 	struct crypt_pbkdf_type *pbkdf,
 	const char *password,
@@ -114,10 +247,14 @@ int crypt_benchmark_pbkdf(struct crypt_device *cd,
 	log_dbg(cd, "Running %s(%s) benchmark.", pbkdf->type, kdf_opt);
 
 	crypt_process_priority(cd, &priority, true);
-	r = crypt_pbkdf_perf(pbkdf->type, pbkdf->hash, password, password_size,
-			     salt, salt_size, volume_key_size, pbkdf->time_ms,
-			     pbkdf->max_memory_kb, pbkdf->parallel_threads,
-			     &pbkdf->iterations, &pbkdf->max_memory_kb, progress, usrptr);
+	if (pbkdf->flags & CRYPT_PBKDF_NO_BENCHMARK)
+		r = pbkdf_measure(pbkdf, password, password_size, salt, salt_size,
+				  volume_key_size, progress, usrptr);
+	else
+		r = crypt_pbkdf_perf(pbkdf->type, pbkdf->hash, password, password_size,
+				     salt, salt_size, volume_key_size, pbkdf->time_ms,
+				     pbkdf->max_memory_kb, pbkdf->parallel_threads,
+				     &pbkdf->iterations, &pbkdf->max_memory_kb, progress, usrptr);
 	crypt_process_priority(cd, &priority, false);
 
 	if (!r)
@@ -143,6 +280,172 @@ static int benchmark_callback(uint32_t time_ms, void *usrptr)
 	return 0;
 }
 
+/*
+ * Host identity for calibration cache: results are valid only on the
+ * same CPU model with the same number of online CPUs, physical memory
+ * and crypto backend.
+ */
+static int pbkdf_cache_host(char *host_hex, size_t host_hex_size)
+{
+	char line[256], model[256] = "unknown", digest[PBKDF_CACHE_HOST_SIZE], *hex, *p;
+	struct crypt_hash *hd;
+	FILE *f;
+	int r;
+
+	if ((f = fopen("/proc/cpuinfo", "r"))) {
+		while (fgets(line, sizeof(line), f))
+			if (!strncmp(line, "model name", 10) && (p = strchr(line, ':'))) {
+				strncpy(model, p + 1, sizeof(model) - 1);
+				break;
+			}
+		fclose(f);
+	}
+
+	r = snprintf(line, sizeof(line), "%s|%u|%" PRIu64 "|%s", model, crypt_cpusonline(),
+		     crypt_getphysmemory_kb(), crypt_backend_version());
+	if (r < 0 || (size_t)r >= sizeof(line))
+		return -EINVAL;
+
+	if (crypt_hash_init(&hd, PBKDF_CACHE_HOST_DIGEST))
+		return -EINVAL;
+	r = crypt_hash_write(hd, line, strlen(line));
+	if (!r)
+		r = crypt_hash_final(hd, digest, sizeof(digest));
+	crypt_hash_destroy(hd);
+	if (r)
+		return r;
+
+	if (!(hex = crypt_bytes_to_hex(sizeof(digest), digest)))
+		return -ENOMEM;
+	r = snprintf(host_hex, host_hex_size, "%s", hex) < 0 ? -EINVAL : 0;
+	crypt_safe_free(hex);
+
+	return r;
+}
+
+static int pbkdf_cache_key(struct crypt_pbkdf_type *pbkdf, size_t volume_key_size,
+			   char *key, size_t key_size)
+{
+	char host[PBKDF_CACHE_HOST_SIZE * 2 + 1];
+	int r;
+
+	r = pbkdf_cache_host(host, sizeof(host));
+	if (r)
+		return r;
+
+	r = snprintf(key, key_size, "%s %s %s %u %u %u %zu", host, pbkdf->type,
+		     pbkdf->hash ?: "-", pbkdf->time_ms, pbkdf->max_memory_kb,
+		     pbkdf->parallel_threads, volume_key_size);
+
+	return (r < 0 || (size_t)r >= key_size) ? -EINVAL : 0;
+}
+
+/*
+ * Read whole cache file. Cached costs directly weaken new keyslots,
+ * so the file must be a regular file not writable by other users.
+ */
+static char *pbkdf_cache_read(struct crypt_device *cd, const char *path)
+{
+	struct stat st;
+	char *buf;
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+	if (fd < 0)
+		return NULL;
+
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size > PBKDF_CACHE_MAX_SIZE ||
+	    (st.st_uid && st.st_uid != geteuid()) || (st.st_mode & (S_IWGRP | S_IWOTH))) {
+		log_dbg(cd, "Ignoring PBKDF cache %s (unsafe file).", path);
+		close(fd);
+		return NULL;
+	}
+
+	buf = malloc(st.st_size + 1);
+	if (buf) {
+		len = read_buffer(fd, buf, st.st_size);
+		if (len < 0) {
+			free(buf);
+			buf = NULL;
+		} else
+			buf[len] = '\0';
+	}
+	close(fd);
+
+	return buf;
+}
+
+static int pbkdf_cache_lookup(struct crypt_device *cd, const char *path,
+			      struct crypt_pbkdf_type *pbkdf, const char *key)
+{
+	struct crypt_pbkdf_limits limits;
+	char *buf, *line, *save = NULL;
+	uint32_t iterations, memory_kb;
+	size_t key_len = strlen(key);
+	int r = -ENOENT;
+
+	if (crypt_pbkdf_get_limits(pbkdf->type, &limits) || !(buf = pbkdf_cache_read(cd, path)))
+		return -ENOENT;
+
+	for (line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save)) {
+		if (strncmp(line, key, key_len) || line[key_len] != ' ' ||
+		    sscanf(line + key_len, " %u %u", &iterations, &memory_kb) != 2)
+			continue;
+
+		if (iterations < limits.min_iterations || iterations > limits.max_iterations ||
+		    (strcmp(pbkdf->type, CRYPT_KDF_PBKDF2) &&
+		     (memory_kb < limits.min_memory || memory_kb > pbkdf->max_memory_kb)))
+			continue;
+
+		pbkdf->iterations = iterations;
+		if (strcmp(pbkdf->type, CRYPT_KDF_PBKDF2))
+			pbkdf->max_memory_kb = memory_kb;
+		else
+			pbkdf->max_memory_kb = pbkdf->parallel_threads = 0;
+		r = 0;
+	}
+
+	free(buf);
+	return r;
+}
+
+/* Failure to store only means next calibration is not cached. */
+static void pbkdf_cache_store(struct crypt_device *cd, const char *path,
+			      struct crypt_pbkdf_type *pbkdf, const char *key)
+{
+	char tmp[PATH_MAX], *buf, *line, *save = NULL;
+	size_t key_len = strlen(key);
+	FILE *f;
+	int fd;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) < 0)
+		return;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, S_IRUSR | S_IWUSR);
+	if (fd < 0 || !(f = fdopen(fd, "w"))) {
+		log_dbg(cd, "Cannot write PBKDF cache %s.", tmp);
+		if (fd >= 0)
+			close(fd);
+		return;
+	}
+
+	/* keep other entries, replace the one with the same key */
+	if ((buf = pbkdf_cache_read(cd, path))) {
+		for (line = strtok_r(buf, "\n", &save); line; line = strtok_r(NULL, "\n", &save))
+			if (strncmp(line, key, key_len) || line[key_len] != ' ')
+				fprintf(f, "%s\n", line);
+		free(buf);
+	}
+	fprintf(f, "%s %u %u\n", key, pbkdf->iterations, pbkdf->max_memory_kb);
+
+	if (fflush(f) || fsync(fileno(f)) || fclose(f) || rename(tmp, path)) {
+		unlink(tmp);
+		return;
+	}
+	log_dbg(cd, "Stored PBKDF calibration in cache %s.", path);
+}
+
 /*
  * Used in internal places to benchmark crypt_device context PBKDF.
  * Once requested parameters are benchmarked, iterations attribute is set,
@@ -155,6 +458,8 @@ int crypt_benchmark_pbkdf_internal(struct crypt_device *cd,
 				   size_t volume_key_size)
 {
 	struct crypt_pbkdf_limits pbkdf_limits;
+	char cache_key[PBKDF_CACHE_LINE_MAX];
+	const char *cache;
 	double PBKDF2_tmp;
 	uint32_t ms_tmp;
 	int r = -EINVAL;
@@ -176,6 +481,18 @@ int crypt_benchmark_pbkdf_internal(struct crypt_device *cd,
 		return -EINVAL;
 	}
 
+	cache = crypt_get_pbkdf_cache(cd);
+	if (cache && pbkdf_cache_key(pbkdf, volume_key_size, cache_key, sizeof(cache_key)))
+		cache = NULL;
+
+	/* Argon2 values already set are reused below, PBKDF2 depends on key size only */
+	if (cache && (!pbkdf->iterations || !strcmp(pbkdf->type, CRYPT_KDF_PBKDF2)) &&
+	    !pbkdf_cache_lookup(cd, cache, pbkdf, cache_key)) {
+		log_dbg(cd, "Using cached PBKDF %s values %u iterations, %u memory.",
+			pbkdf->type, pbkdf->iterations, pbkdf->max_memory_kb);
+		return 0;
+	}
+
 	/* For PBKDF2 run benchmark always. Also note it depends on volume_key_size! */
 	if (!strcmp(pbkdf->type, CRYPT_KDF_PBKDF2)) {
 		/*
@@ -214,5 +531,169 @@ int crypt_benchmark_pbkdf_internal(struct crypt_device *cd,
 			log_err(cd, _("Not compatible PBKDF options."));
 	}
 
+	if (!r && cache)
+		pbkdf_cache_store(cd, cache, pbkdf, cache_key);
+
+	return r;
+}
+
+int crypt_benchmark_pbkdf_calibrate(struct crypt_device *cd,
+	size_t volume_key_size,
+	struct crypt_pbkdf_type *pbkdf)
+{
+	int r;
+
+	if (!cd || !pbkdf || !volume_key_size || !crypt_get_pbkdf(cd)->type)
+		return -EINVAL;
+
+	r = init_crypto(cd);
+	if (r < 0)
+		return r;
+
+	*pbkdf = *crypt_get_pbkdf(cd);
+
+	r = crypt_benchmark_pbkdf_internal(cd, pbkdf, volume_key_size);
+	if (r < 0)
+		return r;
+
+	log_dbg(cd, "Calibrated PBKDF %s values %u iterations, %u memory.",
+		pbkdf->type, pbkdf->iterations, pbkdf->max_memory_kb);
+	pbkdf->flags |= CRYPT_PBKDF_NO_BENCHMARK;
+
+	return 0;
+}
+
+/* Encryption sector size benchmark */
+#define SECTOR_BENCH_BUFFER	(256 * 1024)
+#define SECTOR_BENCH_MS		50
+#define SECTOR_BENCH_READS	32
+
+static double bench_elapsed_ms(const struct timespec *start)
+{
+	struct timespec end;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	return (end.tv_sec - start->tv_sec) * 1000.0 + (end.tv_nsec - start->tv_nsec) / 1000000.0;
+}
+
+/* Userspace equivalent of dm-crypt processing with given sector size */
+static int sector_cipher_mbs(const char *cipher, const char *cipher_mode,
+			     const char *key, size_t key_size, uint32_t sector_size,
+			     char *buffer, double *mbs)
+{
+	struct crypt_storage *s;
+	struct timespec start;
+	uint64_t bytes = 0;
+	double ms;
+	int r;
+
+	r = crypt_storage_init(&s, sector_size, cipher, cipher_mode, key, key_size, true);
+	if (r)
+		return r;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		r = crypt_storage_encrypt(s, bytes >> SECTOR_SHIFT, SECTOR_BENCH_BUFFER, buffer);
+		bytes += SECTOR_BENCH_BUFFER;
+		ms = bench_elapsed_ms(&start);
+	} while (!r && ms < SECTOR_BENCH_MS);
+
+	crypt_storage_destroy(s);
+
+	if (!r)
+		*mbs = (double)bytes / (1024 * 1024) / (ms / 1000.0);
+	return r;
+}
+
+/* Average latency of random direct-io reads (writes would destroy data) */
+static int sector_read_us(struct crypt_device *cd, struct device *device,
+			  uint32_t sector_size, char *buffer, double *us)
+{
+	uint64_t offsets[SECTOR_BENCH_READS], size;
+	struct timespec start;
+	int devfd, i;
+
+	if (!device_direct_io(device) || device_size(device, &size) || size < 2 * sector_size)
+		return -ENOTSUP;
+
+	devfd = device_open(cd, device, O_RDONLY);
+	if (devfd < 0)
+		return -EINVAL;
+
+	if (crypt_random_get(cd, (char *)offsets, sizeof(offsets), CRYPT_RND_NORMAL))
+		return -EINVAL;
+	for (i = 0; i < SECTOR_BENCH_READS; i++)
+		offsets[i] = (offsets[i] % (size / sector_size)) * sector_size;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < SECTOR_BENCH_READS; i++)
+		if (pread(devfd, buffer, sector_size, (off_t)offsets[i]) != (ssize_t)sector_size)
+			return -EIO;
+
+	*us = bench_elapsed_ms(&start) * 1000.0 / SECTOR_BENCH_READS;
+	return 0;
+}
+
+/*
+ * Measure encryption throughput and device read latency for all possible
+ * sector sizes, select the fastest cipher processing among sizes the device
+ * does not penalize (latency within 1.5x of the best one). Measured values
+ * are only in debug log, @sector_size is kept if nothing can be measured.
+ */
+int crypt_benchmark_sector_size(struct crypt_device *cd, struct device *device,
+				const char *cipher, const char *cipher_mode,
+				size_t volume_key_size, uint32_t *sector_size)
+{
+	double mbs[4], us[4], best_us = 0.0, best_mbs = 0.0;
+	bool have_us[4] = {};
+	uint32_t ss, best = *sector_size;
+	size_t bsize = device_block_size(cd, device);
+	char *buffer = NULL, *key = NULL;
+	int i, r = -ENOTSUP;
+
+	if (!cipher || !cipher_mode || !volume_key_size)
+		return -EINVAL;
+
+	key = crypt_safe_alloc(volume_key_size);
+	if (!key || posix_memalign((void **)&buffer, crypt_getpagesize(), SECTOR_BENCH_BUFFER)) {
+		r = -ENOMEM;
+		goto out;
+	}
+	memset(buffer, 0, SECTOR_BENCH_BUFFER);
+	if (crypt_random_get(cd, key, volume_key_size, CRYPT_RND_NORMAL)) {
+		r = -EINVAL;
+		goto out;
+	}
+
+	for (i = 0, ss = SECTOR_SIZE; ss <= MAX_SECTOR_SIZE; i++, ss <<= 1) {
+		mbs[i] = 0.0;
+		if (ss < bsize || sector_cipher_mbs(cipher, cipher_mode, key, volume_key_size,
+						     ss, buffer, &mbs[i]))
+			continue;
+		have_us[i] = !sector_read_us(cd, device, ss, buffer, &us[i]);
+		if (have_us[i] && (!best_us || us[i] < best_us))
+			best_us = us[i];
+		log_dbg(cd, "Sector size %u: encryption %.1f MiB/s, read latency %.0f us.",
+			ss, mbs[i], have_us[i] ? us[i] : -1.0);
+	}
+
+	for (i = 0, ss = SECTOR_SIZE; ss <= MAX_SECTOR_SIZE; i++, ss <<= 1) {
+		if (!mbs[i] || (have_us[i] && us[i] > best_us * 1.5))
+			continue;
+		/* prefer larger sector on a tie (less per-sector overhead in kernel) */
+		if (mbs[i] >= best_mbs * 0.97) {
+			best_mbs = mbs[i];
+			best = ss;
+			r = 0;
+		}
+	}
+
+	if (!r) {
+		log_dbg(cd, "Measured optimal encryption sector size is %u bytes.", best);
+		*sector_size = best;
+	}
+out:
+	crypt_safe_free(key);
+	free(buffer);
 	return r;
 }
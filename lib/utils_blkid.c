@@ -307,7 +307,7 @@ int blk_do_wipe(struct blkid_handle *h)
 	offset_val = strtoll(offset, NULL, 10);
 
 	/* TODO: missing crypt_wipe_fd() */
-	ret = write_lseek_blockwise(h->fd, bsize, alignment, buf, len, offset_val);
+	ret = pwrite_blockwise(h->fd, bsize, alignment, buf, len, offset_val);
 	free(buf);
 	if (ret < 0)
 		return -EIO;
@@ -24,9 +24,11 @@
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <pthread.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/ioctl.h>
+#include <fcntl.h>
 #include <linux/fs.h>
 #include <unistd.h>
 #ifdef HAVE_SYS_SYSMACROS_H
@@ -47,8 +49,10 @@ struct device {
 	int ro_dev_fd;
 	int dev_fd;
 	int dev_fd_excl;
+	int query_fd; /* buffered read-only fd for size and ioctl queries */
 
 	struct crypt_lock_handle *lh;
+	unsigned int lock_hold:1; /* keep lock handle until explicitly dropped */
 
 	unsigned int o_direct:1;
 	unsigned int init_done:1; /* path is bdev or loop already initialized */
@@ -57,8 +61,47 @@ struct device {
 	size_t alignment;
 	size_t block_size;
 	size_t loop_block_size;
+
+	/* cached properties, reset by device_invalidate_properties() */
+	unsigned int devno_valid:1;
+	unsigned int rotational_valid:1;
+	unsigned int read_ahead_valid:1;
+	unsigned int topology_valid:1;
+	dev_t devno; /* 0 if not a block device */
+	int rotational;
+	int read_ahead_r;
+	uint32_t read_ahead;
+	int topology_r;
+	unsigned int min_io_size;
+	unsigned int opt_io_size;
+	int alignment_offset;
+};
+
+/*
+ * Block devices that already passed direct-io read test in this process,
+ * the test reads from device and is not repeated for every allocation.
+ * Device numbers are reused after device removal, so entries are keyed also
+ * by the disk sequence number (if the kernel provides it) and by the device
+ * node inode (devtmpfs node is recreated with the device). Entries of loop
+ * devices attached here are dropped when the loop is released.
+ */
+#define DIRECT_IO_TESTED_MAX 16
+
+#ifndef BLKGETDISKSEQ
+#define BLKGETDISKSEQ _IOR(0x12,128,uint64_t)
+#endif
+
+struct direct_io_tested_entry {
+	dev_t rdev;
+	dev_t node_dev;
+	ino_t node_ino;
+	uint64_t diskseq;
 };
 
+static pthread_mutex_t direct_io_tested_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct direct_io_tested_entry direct_io_tested[DIRECT_IO_TESTED_MAX];
+static unsigned direct_io_tested_next;
+
 static size_t device_fs_block_size_fd(int fd)
 {
 	size_t page_size = crypt_getpagesize();
@@ -165,6 +208,74 @@ static int device_read_test(int devfd)
 	return r;
 }
 
+/* 0 if disk sequence number is not supported (kernel < 5.15) */
+static uint64_t device_diskseq(int devfd)
+{
+	uint64_t diskseq;
+
+	if (ioctl(devfd, BLKGETDISKSEQ, &diskseq) < 0)
+		return 0;
+
+	return diskseq;
+}
+
+/* Drop direct-io test result of block device @devfd before it is released. */
+static void device_read_test_forget(int devfd)
+{
+	struct stat st;
+	unsigned i;
+
+	if (fstat(devfd, &st) || !S_ISBLK(st.st_mode) || !st.st_rdev)
+		return;
+
+	pthread_mutex_lock(&direct_io_tested_lock);
+	for (i = 0; i < DIRECT_IO_TESTED_MAX; i++)
+		if (direct_io_tested[i].rdev == st.st_rdev)
+			memset(&direct_io_tested[i], 0, sizeof(direct_io_tested[i]));
+	pthread_mutex_unlock(&direct_io_tested_lock);
+}
+
+static int device_read_test_cached(struct crypt_device *cd, int devfd)
+{
+	struct stat st;
+	uint64_t diskseq = 0;
+	bool blk;
+	unsigned i;
+	int r;
+
+	blk = !fstat(devfd, &st) && S_ISBLK(st.st_mode) && st.st_rdev;
+
+	if (blk) {
+		diskseq = device_diskseq(devfd);
+		pthread_mutex_lock(&direct_io_tested_lock);
+		for (i = 0; i < DIRECT_IO_TESTED_MAX; i++)
+			if (direct_io_tested[i].rdev == st.st_rdev &&
+			    direct_io_tested[i].node_dev == st.st_dev &&
+			    direct_io_tested[i].node_ino == st.st_ino &&
+			    direct_io_tested[i].diskseq == diskseq)
+				break;
+		pthread_mutex_unlock(&direct_io_tested_lock);
+		if (i < DIRECT_IO_TESTED_MAX) {
+			log_dbg(cd, "Direct-io read test already passed for this device.");
+			return 0;
+		}
+	}
+
+	r = device_read_test(devfd);
+
+	if (!r && blk) {
+		pthread_mutex_lock(&direct_io_tested_lock);
+		direct_io_tested[direct_io_tested_next].rdev = st.st_rdev;
+		direct_io_tested[direct_io_tested_next].node_dev = st.st_dev;
+		direct_io_tested[direct_io_tested_next].node_ino = st.st_ino;
+		direct_io_tested[direct_io_tested_next].diskseq = diskseq;
+		direct_io_tested_next = (direct_io_tested_next + 1) % DIRECT_IO_TESTED_MAX;
+		pthread_mutex_unlock(&direct_io_tested_lock);
+	}
+
+	return r;
+}
+
 /*
  * The direct-io is always preferred. The header is usually mapped to the same
  * device and can be accessed when the rest of device is mapped to data device.
@@ -188,7 +299,7 @@ static int device_ready(struct crypt_device *cd, struct device *device)
 		device->o_direct = 0;
 		devfd = open(device_path(device), O_RDONLY | O_DIRECT);
 		if (devfd >= 0) {
-			if (device_read_test(devfd) == 0) {
+			if (device_read_test_cached(cd, devfd) == 0) {
 				device->o_direct = 1;
 			} else {
 				close(devfd);
@@ -233,6 +344,44 @@ static int device_ready(struct crypt_device *cd, struct device *device)
 	return r;
 }
 
+/*
+ * Query fd is used only for fstat and ioctls, so it does not depend on
+ * locking or direct-io and is kept open until device_close().
+ * Device-mapper devices are not kept open, open count would block their
+ * deactivation while the context still exists.
+ */
+static int device_query_fd_get(struct device *device)
+{
+	struct stat st;
+	int fd;
+
+	if (device->query_fd >= 0)
+		return device->query_fd;
+
+	fd = open(device->path, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (!fstat(fd, &st) && (!S_ISBLK(st.st_mode) || !dm_is_dm_device(major(st.st_rdev))))
+		device->query_fd = fd;
+
+	return fd;
+}
+
+static void device_query_fd_put(struct device *device, int fd)
+{
+	if (fd >= 0 && fd != device->query_fd)
+		close(fd);
+}
+
+static void device_query_fd_close(struct device *device)
+{
+	if (device->query_fd >= 0) {
+		close(device->query_fd);
+		device->query_fd = -1;
+	}
+}
+
 static int _open_locked(struct crypt_device *cd, struct device *device, int flags)
 {
 	int fd;
@@ -411,6 +560,7 @@ int device_alloc_no_check(struct device **device, const char *path)
 	dev->ro_dev_fd = -1;
 	dev->dev_fd = -1;
 	dev->dev_fd_excl = -1;
+	dev->query_fd = -1;
 	dev->o_direct = 1;
 
 	*device = dev;
@@ -457,9 +607,11 @@ void device_free(struct crypt_device *cd, struct device *device)
 
 	if (device->loop_fd != -1) {
 		log_dbg(cd, "Closed loop %s (%s).", device->path, device->file_path);
+		device_read_test_forget(device->loop_fd);
 		close(device->loop_fd);
 	}
 
+	device_lock_release_held(cd, device);
 	assert(!device_locked(device->lh));
 
 	free(device->file_path);
@@ -519,6 +671,7 @@ void device_topology_alignment(struct crypt_device *cd,
 	int dev_alignment_offset = 0;
 	unsigned int min_io_size = 0, opt_io_size = 0;
 	unsigned long temp_alignment = 0;
+	uint64_t zone_size;
 	int fd;
 
 	*required_alignment = default_alignment;
@@ -527,25 +680,41 @@ void device_topology_alignment(struct crypt_device *cd,
 	if (!device || !device->path) //FIXME
 		return;
 
-	fd = open(device->path, O_RDONLY);
-	if (fd == -1)
-		return;
+	if (!device->topology_valid) {
+		fd = device_query_fd_get(device);
+		if (fd == -1)
+			return;
+
+		/* minimum io size */
+		if (ioctl(fd, BLKIOMIN, &min_io_size) == -1)
+			device->topology_r = -ENOTSUP;
+		else {
+			/* optimal io size */
+			if (ioctl(fd, BLKIOOPT, &opt_io_size) == -1)
+				opt_io_size = min_io_size;
+
+			/* alignment offset, bogus -1 means misaligned/unknown */
+			if (ioctl(fd, BLKALIGNOFF, &dev_alignment_offset) == -1 || dev_alignment_offset < 0)
+				dev_alignment_offset = 0;
+			device->topology_r = 0;
+		}
+		device_query_fd_put(device, fd);
 
-	/* minimum io size */
-	if (ioctl(fd, BLKIOMIN, &min_io_size) == -1) {
+		device->min_io_size = min_io_size;
+		device->opt_io_size = opt_io_size;
+		device->alignment_offset = dev_alignment_offset;
+		device->topology_valid = 1;
+	}
+
+	if (device->topology_r) {
 		log_dbg(cd, "Topology info for %s not supported, using default offset %lu bytes.",
 			device->path, default_alignment);
-		goto out;
+		return;
 	}
 
-	/* optimal io size */
-	if (ioctl(fd, BLKIOOPT, &opt_io_size) == -1)
-		opt_io_size = min_io_size;
-
-	/* alignment offset, bogus -1 means misaligned/unknown */
-	if (ioctl(fd, BLKALIGNOFF, &dev_alignment_offset) == -1 || dev_alignment_offset < 0)
-		dev_alignment_offset = 0;
-	*alignment_offset = (unsigned long)dev_alignment_offset;
+	min_io_size = device->min_io_size;
+	opt_io_size = device->opt_io_size;
+	*alignment_offset = (unsigned long)device->alignment_offset;
 
 	temp_alignment = (unsigned long)min_io_size;
 
@@ -564,10 +733,15 @@ void device_topology_alignment(struct crypt_device *cd,
 	if (temp_alignment && (default_alignment % temp_alignment))
 		*required_alignment = temp_alignment;
 
+	/* Data on host-managed zoned device must start on zone boundary */
+	zone_size = device_zone_size(device);
+	if (zone_size && zone_size <= ULONG_MAX && (*required_alignment % zone_size)) {
+		log_dbg(cd, "Zoned device, aligning to zone size %" PRIu64 " bytes.", zone_size);
+		*required_alignment = (unsigned long)zone_size;
+	}
+
 	log_dbg(cd, "Topology: IO (%u/%u), offset = %lu; Required alignment is %lu bytes.",
 		min_io_size, opt_io_size, *alignment_offset, *required_alignment);
-out:
-	(void)close(fd);
 }
 
 size_t device_block_size(struct crypt_device *cd, struct device *device)
@@ -580,10 +754,10 @@ size_t device_block_size(struct crypt_device *cd, struct device *device)
 	if (device->block_size)
 		return device->block_size;
 
-	fd = open(device->file_path ?: device->path, O_RDONLY);
+	fd = device->file_path ? open(device->file_path, O_RDONLY) : device_query_fd_get(device);
 	if (fd >= 0) {
 		device->block_size = device_block_size_fd(fd, NULL);
-		close(fd);
+		device_query_fd_put(device, fd);
 	}
 
 	if (!device->block_size)
@@ -639,16 +813,22 @@ int device_read_ahead(struct device *device, uint32_t *read_ahead)
 	if (!device)
 		return 0;
 
-	if ((fd = open(device->path, O_RDONLY)) < 0)
-		return 0;
+	if (!device->read_ahead_valid) {
+		if ((fd = device_query_fd_get(device)) < 0)
+			return 0;
 
-	r = ioctl(fd, BLKRAGET, &read_ahead_long) ? 0 : 1;
-	close(fd);
+		r = ioctl(fd, BLKRAGET, &read_ahead_long) ? 0 : 1;
+		device_query_fd_put(device, fd);
 
-	if (r)
-		*read_ahead = (uint32_t) read_ahead_long;
+		device->read_ahead_r = r;
+		device->read_ahead = r ? (uint32_t)read_ahead_long : 0;
+		device->read_ahead_valid = 1;
+	}
 
-	return r;
+	if (device->read_ahead_r)
+		*read_ahead = device->read_ahead;
+
+	return device->read_ahead_r;
 }
 
 /* Get data size in bytes */
@@ -660,7 +840,7 @@ int device_size(struct device *device, uint64_t *size)
 	if (!device)
 		return -EINVAL;
 
-	devfd = open(device->path, O_RDONLY);
+	devfd = device_query_fd_get(device);
 	if (devfd == -1)
 		return -EINVAL;
 
@@ -673,7 +853,7 @@ int device_size(struct device *device, uint64_t *size)
 	} else if (ioctl(devfd, BLKGETSIZE64, size) >= 0)
 		r = 0;
 out:
-	close(devfd);
+	device_query_fd_put(device, devfd);
 	return r;
 }
 
@@ -701,6 +881,68 @@ int device_fallocate(struct device *device, uint64_t size)
 	return r;
 }
 
+/*
+ * Find next allocated data at or after offset (SEEK_DATA). Only files
+ * (or files backing loop devices) can report holes.
+ */
+int device_next_data(struct device *device, uint64_t offset, uint64_t *data_offset)
+{
+	struct stat st;
+	off_t pos;
+	int devfd, r = 0;
+
+	if (!device)
+		return -EINVAL;
+
+	devfd = open(device->file_path ?: device->path, O_RDONLY);
+	if (devfd == -1)
+		return -EINVAL;
+
+	if (fstat(devfd, &st) < 0 || !S_ISREG(st.st_mode)) {
+		close(devfd);
+		return -ENOTSUP;
+	}
+
+	pos = lseek(devfd, (off_t)offset, SEEK_DATA);
+	if (pos >= 0)
+		*data_offset = (uint64_t)pos;
+	else if (errno == ENXIO)
+		*data_offset = UINT64_MAX; /* no data till end of file */
+	else
+		r = -ENOTSUP;
+
+	close(devfd);
+	return r;
+}
+
+/* Discard area on block device or punch hole in a file */
+int device_discard(struct device *device, uint64_t offset, uint64_t length)
+{
+	struct stat st;
+	uint64_t range[2] = { offset, length };
+	int devfd, r = -ENOTSUP;
+
+	if (!device)
+		return -EINVAL;
+
+	devfd = open(device_path(device), O_RDWR);
+	if (devfd == -1)
+		return -EINVAL;
+
+	if (fstat(devfd, &st) < 0)
+		r = -EINVAL;
+	else if (S_ISBLK(st.st_mode))
+		r = ioctl(devfd, BLKDISCARD, &range) < 0 ? -errno : 0;
+#ifdef FALLOC_FL_PUNCH_HOLE
+	else if (S_ISREG(st.st_mode))
+		r = fallocate(devfd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+			      (off_t)offset, (off_t)length) < 0 ? -errno : 0;
+#endif
+
+	close(devfd);
+	return r;
+}
+
 int device_check_size(struct crypt_device *cd,
 		      struct device *device,
 		      uint64_t req_offset, int falloc)
@@ -824,7 +1066,7 @@ int device_check_access(struct crypt_device *cd,
 static int device_internal_prepare(struct crypt_device *cd, struct device *device)
 {
 	char *loop_device = NULL, *file_path = NULL;
-	int r, loop_fd, readonly = 0;
+	int r, loop_fd, readonly = 0, direct_io = crypt_loop_direct_io(cd) ? 1 : 0;
 
 	if (device->init_done)
 		return 0;
@@ -835,11 +1077,12 @@ static int device_internal_prepare(struct crypt_device *cd, struct device *devic
 		return -ENOTSUP;
 	}
 
-	log_dbg(cd, "Allocating a free loop device (block size: %zu).",
-		device->loop_block_size ?: SECTOR_SIZE);
+	log_dbg(cd, "Allocating a free loop device (block size: %zu, %s I/O).",
+		device->loop_block_size ?: SECTOR_SIZE, direct_io ? "direct" : "buffered");
 
 	/* Keep the loop open, detached on last close. */
-	loop_fd = crypt_loop_attach(&loop_device, device->path, 0, 1, &readonly, device->loop_block_size);
+	loop_fd = crypt_loop_attach(&loop_device, device->path, 0, 1, &readonly, &direct_io,
+				    device->loop_block_size);
 	if (loop_fd == -1) {
 		log_err(cd, _("Attaching loopback device failed "
 			"(loop device with autoclear flag is required)."));
@@ -849,16 +1092,22 @@ static int device_internal_prepare(struct crypt_device *cd, struct device *devic
 
 	file_path = device->path;
 	device->path = loop_device;
+	device_query_fd_close(device);
+	device_invalidate_properties(device);
 
 	r = device_ready(cd, device);
 	if (r < 0) {
 		device->path = file_path;
+		device_query_fd_close(device);
+		device_invalidate_properties(device);
+		device_read_test_forget(loop_fd);
 		crypt_loop_detach(loop_device);
 		free(loop_device);
 		return r;
 	}
 
-	log_dbg(cd, "Attached loop device block size is %zu bytes.", device_block_size_fd(loop_fd, NULL));
+	log_dbg(cd, "Attached loop device block size is %zu bytes, direct-io %s.",
+		device_block_size_fd(loop_fd, NULL), direct_io ? "enabled" : "disabled");
 
 	device->loop_fd = loop_fd;
 	device->file_path = file_path;
@@ -969,20 +1218,72 @@ int device_is_identical(struct device *device1, struct device *device2)
 	return device_compare_path(device_path(device1), device_path(device2));
 }
 
-int device_is_rotational(struct device *device)
+/* Device number of block device (0 for other files), stat() done only once */
+static int device_devno(struct device *device, dev_t *devno)
 {
 	struct stat st;
 
 	if (!device)
 		return -EINVAL;
 
-	if (stat(device_path(device), &st) < 0)
+	if (!device->devno_valid) {
+		if (stat(device_path(device), &st) < 0)
+			return -EINVAL;
+		device->devno = S_ISBLK(st.st_mode) ? st.st_rdev : 0;
+		device->devno_valid = 1;
+	}
+
+	*devno = device->devno;
+	return 0;
+}
+
+uint64_t device_inline_crypto_sizes(struct device *device, const char *mode)
+{
+	dev_t devno;
+
+	if (device_devno(device, &devno) || !devno)
+		return 0;
+
+	return crypt_dev_inline_crypto_sizes(major(devno), minor(devno), mode);
+}
+
+uint64_t device_write_zeroes_max_bytes(struct device *device)
+{
+	dev_t devno;
+
+	if (device_devno(device, &devno) || !devno)
+		return 0;
+
+	return crypt_dev_write_zeroes_max_bytes(major(devno), minor(devno));
+}
+
+/* Zone size in bytes for host-managed zoned device, 0 otherwise */
+uint64_t device_zone_size(struct device *device)
+{
+	dev_t devno;
+
+	if (device_devno(device, &devno) || !devno)
+		return 0;
+
+	return crypt_dev_zone_sectors(major(devno), minor(devno)) << SECTOR_SHIFT;
+}
+
+int device_is_rotational(struct device *device)
+{
+	dev_t devno;
+
+	if (device_devno(device, &devno))
 		return -EINVAL;
 
-	if (!S_ISBLK(st.st_mode))
+	if (!devno)
 		return 0;
 
-	return crypt_dev_is_rotational(major(st.st_rdev), minor(st.st_rdev));
+	if (!device->rotational_valid) {
+		device->rotational = crypt_dev_is_rotational(major(devno), minor(devno));
+		device->rotational_valid = 1;
+	}
+
+	return device->rotational;
 }
 
 size_t device_alignment(struct device *device)
@@ -993,10 +1294,10 @@ size_t device_alignment(struct device *device)
 		return -EINVAL;
 
 	if (!device->alignment) {
-		devfd = open(device_path(device), O_RDONLY);
+		devfd = device_query_fd_get(device);
 		if (devfd != -1) {
 			device->alignment = device_alignment_fd(devfd);
-			close(devfd);
+			device_query_fd_put(device, devfd);
 		}
 	}
 
@@ -1060,11 +1361,28 @@ bool device_is_locked(struct device *device)
 	return device ? device_locked(device->lh) : 0;
 }
 
+bool device_get_lock_hold(struct device *device)
+{
+	return device ? device->lock_hold : false;
+}
+
+void device_set_lock_hold(struct crypt_device *cd, struct device *device, bool hold)
+{
+	if (!device)
+		return;
+
+	device->lock_hold = hold;
+	if (!hold)
+		device_lock_release_held(cd, device);
+}
+
 void device_close(struct crypt_device *cd, struct device *device)
 {
 	if (!device)
 		return;
 
+	device_query_fd_close(device);
+
 	if (device->ro_dev_fd != -1) {
 		log_dbg(cd, "Closing read only fd for %s.", device_path(device));
 		if (close(device->ro_dev_fd))
@@ -1080,6 +1398,43 @@ void device_close(struct crypt_device *cd, struct device *device)
 	}
 }
 
+static bool fd_buffered(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	return flags >= 0 && !(flags & O_DIRECT);
+}
+
+/*
+ * Page cache hints for scans through buffered fd (direct-io does not use
+ * page cache). Sequential hint enlarges readahead for the range, drop
+ * removes already processed (clean) pages, so a scan of a large device
+ * does not evict page cache of other workloads. Length 0 means to the end.
+ */
+void device_hint_sequential(int fd, uint64_t offset, uint64_t length)
+{
+	if (fd >= 0 && fd_buffered(fd))
+		(void)posix_fadvise(fd, (off_t)offset, (off_t)length, POSIX_FADV_SEQUENTIAL);
+}
+
+void device_hint_drop(int fd, uint64_t offset, uint64_t length)
+{
+	if (fd >= 0 && fd_buffered(fd))
+		(void)posix_fadvise(fd, (off_t)offset, (off_t)length, POSIX_FADV_DONTNEED);
+}
+
+/* Properties are read again on next use, e.g. if the device path was remapped */
+void device_invalidate_properties(struct device *device)
+{
+	if (!device)
+		return;
+
+	device->devno_valid = 0;
+	device->rotational_valid = 0;
+	device->read_ahead_valid = 0;
+	device->topology_valid = 0;
+}
+
 void device_set_block_size(struct device *device, size_t size)
 {
 	if (!device)
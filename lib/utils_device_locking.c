@@ -24,6 +24,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <fcntl.h>
 #include <sys/file.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -42,13 +43,15 @@
 
 enum lock_type {
 	DEV_LOCK_READ = 0,
-	DEV_LOCK_WRITE
+	DEV_LOCK_WRITE,
+	DEV_LOCK_IDLE /* handle kept by lock hold, not locked */
 };
 
 enum lock_mode {
 	DEV_LOCK_FILE = 0,
 	DEV_LOCK_BDEV,
-	DEV_LOCK_NAME
+	DEV_LOCK_NAME,
+	DEV_LOCK_SLOTS
 };
 
 struct crypt_lock_handle {
@@ -260,6 +263,12 @@ int device_locked_readonly(struct crypt_lock_handle *h)
 	return (h && h->type == DEV_LOCK_READ);
 }
 
+/* Lock handle kept by lock hold with no user, see device_unlock_internal() */
+int device_locked_idle(struct crypt_lock_handle *h)
+{
+	return (h && h->type == DEV_LOCK_IDLE);
+}
+
 static int verify_lock_handle(struct crypt_lock_handle *h)
 {
 	char res[PATH_MAX];
@@ -296,6 +305,32 @@ static unsigned device_lock_dec(struct crypt_lock_handle *h)
 	return --h->refcnt;
 }
 
+static void unlock_internal(struct crypt_device *cd, struct crypt_lock_handle *h)
+{
+	if (flock(h->flock_fd, LOCK_UN))
+		log_dbg(cd, "flock on fd %d failed.", h->flock_fd);
+	release_lock_handle(cd, h);
+	free(h);
+}
+
+/*
+ * Lock handle kept by lock hold. The resource file could be dropped by other
+ * process meanwhile (nobody keeps it locked), so it must be verified as after
+ * new flock. Stale handle is released and caller acquires a new one.
+ */
+static int relock_idle(struct crypt_device *cd, struct device *device,
+		       struct crypt_lock_handle *h, int flock_op)
+{
+	if (!flock(h->flock_fd, flock_op) && !verify_lock_handle(h))
+		return 0;
+
+	log_dbg(cd, "Kept lock handle for device %s is stale.", device_path(device));
+	unlock_internal(cd, h);
+	device_set_lock_handle(device, NULL);
+
+	return -EAGAIN;
+}
+
 static int acquire_and_verify(struct crypt_device *cd, struct device *device, const char *resource, int flock_op, struct crypt_lock_handle **lock)
 {
 	int r;
@@ -354,6 +389,17 @@ int device_read_lock_internal(struct crypt_device *cd, struct device *device)
 
 	h = device_get_lock_handle(device);
 
+	if (device_locked_idle(h)) {
+		log_dbg(cd, "Reusing kept lock handle for device %s.", device_path(device));
+		if (!relock_idle(cd, device, h, LOCK_SH)) {
+			h->type = DEV_LOCK_READ;
+			h->refcnt = 1;
+			log_dbg(cd, "Device %s READ lock taken.", device_path(device));
+			return 0;
+		}
+		h = NULL;
+	}
+
 	if (device_locked(h)) {
 		device_lock_inc(h);
 		log_dbg(cd, "Device %s READ lock (or higher) already held.", device_path(device));
@@ -385,6 +431,18 @@ int device_write_lock_internal(struct crypt_device *cd, struct device *device)
 
 	h = device_get_lock_handle(device);
 
+	/* Return 1 as for new lock, the caller checks metadata sequence id. */
+	if (device_locked_idle(h)) {
+		log_dbg(cd, "Reusing kept lock handle for device %s.", device_path(device));
+		if (!relock_idle(cd, device, h, LOCK_EX)) {
+			h->type = DEV_LOCK_WRITE;
+			h->refcnt = 1;
+			log_dbg(cd, "Device %s WRITE lock taken.", device_path(device));
+			return 1;
+		}
+		h = NULL;
+	}
+
 	if (device_locked(h)) {
 		log_dbg(cd, "Device %s WRITE lock already held.", device_path(device));
 		return device_lock_inc(h);
@@ -453,12 +511,88 @@ int crypt_write_lock(struct crypt_device *cd, const char *resource, bool blockin
 	return 0;
 }
 
-static void unlock_internal(struct crypt_device *cd, struct crypt_lock_handle *h)
+/* poll interval while waiting for slots (holders release without notice) */
+#define SLOTS_POLL_US 20000
+
+static int slot_trylock(int fd, unsigned slot)
 {
-	if (flock(h->flock_fd, LOCK_UN))
-		log_dbg(cd, "flock on fd %d failed.", h->flock_fd);
-	release_lock_handle(cd, h);
-	free(h);
+#ifdef F_OFD_SETLK
+	struct flock fl = {
+		.l_type = F_WRLCK,
+		.l_whence = SEEK_SET,
+		.l_start = slot,
+		.l_len = 1,
+	};
+
+	if (fcntl(fd, F_OFD_SETLK, &fl) < 0)
+		return (errno == EAGAIN || errno == EACCES) ? -EBUSY : -errno;
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+/*
+ * Counting semaphore of @total slots, each slot is a byte range OFD lock
+ * of the resource file, so it is shared by threads and processes and
+ * released by the kernel if the holder dies. Takes @slots free slots,
+ * waiting for the others to release some. Callers must serialize
+ * acquisition (so no two waiters hold part of what they need), release
+ * does not need it.
+ */
+int crypt_slots_lock(struct crypt_device *cd, const char *resource, unsigned total,
+		     unsigned slots, struct crypt_lock_handle **lock)
+{
+	struct crypt_lock_handle *h;
+	uint64_t held = 0;
+	unsigned i, count = 0;
+	int fd, r = 0;
+
+	if (!resource || !total || total > 64 || !slots || slots > total)
+		return -EINVAL;
+
+	log_dbg(cd, "Acquiring %u of %u slots of resource %s.", slots, total, resource);
+
+	fd = open_resource(cd, resource);
+	if (fd < 0)
+		return fd;
+
+	while (!r) {
+		for (i = 0; i < total && count < slots; i++) {
+			if (held & (UINT64_C(1) << i))
+				continue;
+			r = slot_trylock(fd, i);
+			if (r == -EBUSY) {
+				r = 0;
+				continue;
+			}
+			if (r)
+				break;
+			held |= UINT64_C(1) << i;
+			count++;
+		}
+
+		if (r || count == slots)
+			break;
+
+		usleep(SLOTS_POLL_US);
+	}
+
+	if (r || !(h = malloc(sizeof(*h)))) {
+		close(fd);
+		return r ?: -ENOMEM;
+	}
+
+	h->flock_fd = fd;
+	h->mode = DEV_LOCK_SLOTS;
+	h->type = DEV_LOCK_WRITE;
+	h->refcnt = 1;
+
+	log_dbg(cd, "Slots of resource %s taken.", resource);
+
+	*lock = h;
+
+	return 0;
 }
 
 void crypt_unlock_internal(struct crypt_device *cd, struct crypt_lock_handle *h)
@@ -486,6 +620,19 @@ void device_unlock_internal(struct crypt_device *cd, struct device *device)
 
 	readonly = device_locked_readonly(h);
 
+	/*
+	 * Only the opened and verified handle is kept, the flock itself is
+	 * dropped so no other context or process waits for this one.
+	 */
+	if (device_get_lock_hold(device)) {
+		if (flock(h->flock_fd, LOCK_UN))
+			log_dbg(cd, "flock on fd %d failed.", h->flock_fd);
+		h->type = DEV_LOCK_IDLE;
+		log_dbg(cd, "Device %s %s lock released, handle kept for reuse.",
+			device_path(device), readonly ? "READ" : "WRITE");
+		return;
+	}
+
 	unlock_internal(cd, h);
 
 	log_dbg(cd, "Device %s %s lock released.", device_path(device),
@@ -494,6 +641,21 @@ void device_unlock_internal(struct crypt_device *cd, struct device *device)
 	device_set_lock_handle(device, NULL);
 }
 
+void device_lock_release_held(struct crypt_device *cd, struct device *device)
+{
+	struct crypt_lock_handle *h = device_get_lock_handle(device);
+
+	if (!device_locked_idle(h))
+		return;
+
+	release_lock_handle(cd, h);
+	free(h);
+
+	log_dbg(cd, "Device %s kept lock handle released.", device_path(device));
+
+	device_set_lock_handle(device, NULL);
+}
+
 int device_locked_verify(struct crypt_device *cd, int dev_fd, struct crypt_lock_handle *h)
 {
 	char res[PATH_MAX];
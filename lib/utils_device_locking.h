@@ -30,15 +30,19 @@ struct device;
 
 int device_locked_readonly(struct crypt_lock_handle *h);
 int device_locked(struct crypt_lock_handle *h);
+int device_locked_idle(struct crypt_lock_handle *h);
 
 int device_read_lock_internal(struct crypt_device *cd, struct device *device);
 int device_write_lock_internal(struct crypt_device *cd, struct device *device);
 void device_unlock_internal(struct crypt_device *cd, struct device *device);
+void device_lock_release_held(struct crypt_device *cd, struct device *device);
 
 int device_locked_verify(struct crypt_device *cd, int fd, struct crypt_lock_handle *h);
 
 int crypt_read_lock(struct crypt_device *cd, const char *name, bool blocking, struct crypt_lock_handle **lock);
 int crypt_write_lock(struct crypt_device *cd, const char *name, bool blocking, struct crypt_lock_handle **lock);
+int crypt_slots_lock(struct crypt_device *cd, const char *resource, unsigned total,
+		     unsigned slots, struct crypt_lock_handle **lock);
 void crypt_unlock_internal(struct crypt_device *cd, struct crypt_lock_handle *h);
 
 
@@ -220,6 +220,86 @@ int crypt_dev_is_rotational(int major, int minor)
 	return val ? 1 : 0;
 }
 
+/* Queue attribute, partition has no queue directory, the parent disk one is used then. */
+static int _sysfs_queue_read(int major, int minor, const char *attr, char *buf, size_t buf_size)
+{
+	char path[PATH_MAX];
+	int fd, r;
+
+	if (snprintf(path, sizeof(path), "/sys/dev/block/%d:%d/queue/%s", major, minor, attr) < 0)
+		return -EINVAL;
+
+	if ((fd = open(path, O_RDONLY)) < 0) {
+		if (snprintf(path, sizeof(path), "/sys/dev/block/%d:%d/../queue/%s", major, minor, attr) < 0)
+			return -EINVAL;
+		if ((fd = open(path, O_RDONLY)) < 0)
+			return -errno;
+	}
+
+	r = read(fd, buf, buf_size - 1);
+	close(fd);
+	if (r <= 0)
+		return -EINVAL;
+
+	buf[r] = '\0';
+	return 0;
+}
+
+/*
+ * Data unit sizes (bitmask of sizes in bytes) supported by inline encryption
+ * hardware (blk-crypto) for @mode, 0 if not supported.
+ */
+uint64_t crypt_dev_inline_crypto_sizes(int major, int minor, const char *mode)
+{
+	char attr[64], tmp[64];
+	uint64_t val;
+	char *endp;
+
+	if (snprintf(attr, sizeof(attr), "crypto/modes/%s", mode) < 0 ||
+	    _sysfs_queue_read(major, minor, attr, tmp, sizeof(tmp)))
+		return 0;
+
+	/* printed as hex number (0x...) */
+	val = strtoull(tmp, &endp, 0);
+	if (endp == tmp)
+		return 0;
+
+	return val;
+}
+
+/* Max. bytes of one WRITE_ZEROES command, 0 if the device does not offload it */
+uint64_t crypt_dev_write_zeroes_max_bytes(int major, int minor)
+{
+	char tmp[64];
+	uint64_t val;
+
+	if (_sysfs_queue_read(major, minor, "write_zeroes_max_bytes", tmp, sizeof(tmp)) ||
+	    sscanf(tmp, "%" PRIu64, &val) != 1)
+		return 0;
+
+	return val;
+}
+
+/*
+ * Zone size in sectors for host-managed zoned device, 0 otherwise.
+ * Host-aware devices accept random writes and are used as conventional ones.
+ */
+uint64_t crypt_dev_zone_sectors(int major, int minor)
+{
+	char tmp[64];
+	uint64_t val;
+
+	if (_sysfs_queue_read(major, minor, "zoned", tmp, sizeof(tmp)) ||
+	    strncmp(tmp, "host-managed", 12))
+		return 0;
+
+	if (_sysfs_queue_read(major, minor, "chunk_sectors", tmp, sizeof(tmp)) ||
+	    sscanf(tmp, "%" PRIu64, &val) != 1)
+		return 0;
+
+	return val;
+}
+
 int crypt_dev_is_partition(const char *dev_path)
 {
 	uint64_t val;
@@ -256,6 +336,113 @@ uint64_t crypt_dev_partition_offset(const char *dev_path)
 	return val;
 }
 
+/*
+ * Read block layer stat fields of device, or of its lower device @slave
+ * (see kernel Documentation/block/stat.rst). Older kernels provide only
+ * the first 11 fields, missing fields are set to zero.
+ */
+int crypt_sysfs_get_stat(int major, int minor, const char *slave,
+			 uint64_t *val, unsigned count)
+{
+	char path[PATH_MAX], tmp[512] = {0}, *p, *end;
+	unsigned i;
+	int fd, r;
+
+	if (slave)
+		r = snprintf(path, sizeof(path), "/sys/dev/block/%d:%d/slaves/%s/stat",
+			     major, minor, slave);
+	else
+		r = snprintf(path, sizeof(path), "/sys/dev/block/%d:%d/stat", major, minor);
+	if (r < 0 || (size_t)r >= sizeof(path))
+		return -EINVAL;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -errno;
+	r = read(fd, tmp, sizeof(tmp) - 1);
+	close(fd);
+
+	if (r <= 0)
+		return -EIO;
+
+	for (i = 0, p = tmp; i < count; i++, p = end) {
+		val[i] = strtoull(p, &end, 10);
+		if (end == p)
+			break;
+	}
+
+	if (i < CRYPT_SYSFS_STAT_MIN)
+		return -EINVAL;
+
+	for (; i < count; i++)
+		val[i] = 0;
+
+	return 0;
+}
+
+/*
+ * Get kernel names of lower block devices which are not device-mapper devices.
+ * Returns number of names allocated in @names.
+ */
+int crypt_dev_get_slaves(int major, int minor, char **names, size_t names_length)
+{
+	char path[PATH_MAX];
+	struct dirent *entry;
+	DIR *dir;
+	int r = 0, count = 0;
+
+	if (snprintf(path, sizeof(path), "/sys/dev/block/%d:%d/slaves", major, minor) < 0)
+		return -EINVAL;
+
+	if (!(dir = opendir(path)))
+		return -errno;
+
+	while ((entry = readdir(dir))) {
+		if (entry->d_name[0] == '.' || !strncmp(entry->d_name, "dm-", 3))
+			continue;
+
+		if ((size_t)count >= names_length ||
+		    !(names[count] = strdup(entry->d_name))) {
+			r = -ENOMEM;
+			break;
+		}
+		count++;
+	}
+	closedir(dir);
+
+	if (r < 0) {
+		while (count--)
+			free(names[count]);
+		return r;
+	}
+
+	return count;
+}
+
+/*
+ * Read completed I/O count, total I/O time (ms) and in-flight requests
+ * from sysfs block device stat.
+ */
+int crypt_dev_get_stat(const char *dev_path, uint64_t *ios, uint64_t *ticks, uint64_t *in_flight)
+{
+	uint64_t val[CRYPT_SYSFS_STAT_MIN];
+	struct stat st;
+	int r;
+
+	if (stat(dev_path, &st) < 0 || !S_ISBLK(st.st_mode))
+		return -EINVAL;
+
+	/* read I/Os, merges, sectors, ticks, write I/Os, merges, sectors, ticks, in_flight, ... */
+	r = crypt_sysfs_get_stat(major(st.st_rdev), minor(st.st_rdev), NULL, val, ARRAY_SIZE(val));
+	if (r < 0)
+		return r;
+
+	*ios = val[0] + val[4];
+	*ticks = val[3] + val[7];
+	*in_flight = val[8];
+
+	return 0;
+}
+
 /* Try to find partition which match offset and size on top level device */
 char *crypt_get_partition_device(const char *dev_path, uint64_t offset, uint64_t size)
 {
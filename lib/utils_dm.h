@@ -27,6 +27,8 @@
 /* device-mapper library helpers */
 #include <stddef.h>
 #include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
 
 struct crypt_device;
 struct volume_key;
@@ -190,6 +192,20 @@ static inline bool single_segment(const struct crypt_dm_active_device *dmd)
 void dm_backend_init(struct crypt_device *cd);
 void dm_backend_exit(struct crypt_device *cd);
 
+/* DM target version probe running in background (e.g. during keyslot KDF) */
+struct dm_prepare_job {
+	struct crypt_device *cd;
+	dm_target_type target;
+	pthread_t thread;
+	bool threaded;
+};
+
+void dm_prepare_start(struct crypt_device *cd, dm_target_type target, struct dm_prepare_job *job);
+void dm_prepare_wait(struct dm_prepare_job *job);
+void dm_udev_sync_set(struct crypt_device *cd, bool enable);
+int dm_udev_batch_begin(struct crypt_device *cd);
+int dm_udev_batch_end(struct crypt_device *cd);
+
 int dm_targets_allocate(struct dm_target *first, unsigned count);
 void dm_targets_free(struct crypt_device *cd, struct crypt_dm_active_device *dmd);
 
@@ -217,6 +233,10 @@ int dm_status_device(struct crypt_device *cd, const char *name);
 int dm_status_suspended(struct crypt_device *cd, const char *name);
 int dm_status_verity_ok(struct crypt_device *cd, const char *name);
 int dm_status_integrity_failures(struct crypt_device *cd, const char *name, uint64_t *count);
+int dm_wait_event(struct crypt_device *cd, const char *name, uint32_t *event_nr);
+int dm_get_event_nr(struct crypt_device *cd, const char *name, uint32_t *event_nr);
+int dm_list_devices(struct crypt_device *cd, char ***names);
+void dm_names_free(char **names);
 int dm_query_device(struct crypt_device *cd, const char *name,
 		    uint32_t get_flags, struct crypt_dm_active_device *dmd);
 int dm_device_deps(struct crypt_device *cd, const char *name, const char *prefix,
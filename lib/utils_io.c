@@ -22,6 +22,8 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
 #include <string.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -29,6 +31,39 @@
 
 #include "utils_io.h"
 
+/* Partial blocks up to this size are padded in a stack buffer */
+#define BLOCKWISE_PAD_MAX 4096
+
+/*
+ * Only direct-io needs aligned buffers, page cache copies
+ * from any user buffer itself (no bounce buffer needed).
+ */
+static bool fd_is_direct(int fd)
+{
+	int flags = fcntl(fd, F_GETFL);
+
+	return flags < 0 || (flags & O_DIRECT);
+}
+
+static void *pad_block_alloc(char *stack_buf, size_t bsize, size_t alignment)
+{
+	void *buf;
+
+	if (bsize <= BLOCKWISE_PAD_MAX && !((size_t)stack_buf & (alignment - 1)))
+		return stack_buf;
+
+	if (posix_memalign(&buf, alignment, bsize))
+		return NULL;
+
+	return buf;
+}
+
+static void pad_block_free(void *buf, char *stack_buf)
+{
+	if (buf != stack_buf)
+		free(buf);
+}
+
 /* coverity[ -taint_source : arg-1 ] */
 static ssize_t _read_buffer(int fd, void *buf, size_t length, volatile int *quit)
 {
@@ -96,9 +131,55 @@ ssize_t write_buffer_intr(int fd, const void *buf, size_t length, volatile int *
 	return _write_buffer(fd, buf, length, quit);
 }
 
+#define SPARSE_BLOCK 4096
+
+static bool buffer_is_zero(const uint8_t *buf, size_t length)
+{
+	return !buf[0] && !memcmp(buf, buf + 1, length - 1);
+}
+
+/*
+ * Write buffer to a regular file from the current position, zero blocks
+ * are skipped (stay a hole). The file is extended to the end of written
+ * data, so the result reads back as if it was written with write_buffer().
+ */
+ssize_t write_buffer_sparse(int fd, const void *buf, size_t length)
+{
+	const uint8_t *p = buf;
+	size_t block, done = 0;
+	bool skipped = false;
+	off_t pos;
+
+	if (fd < 0 || !buf || !length)
+		return -EINVAL;
+
+	while (done < length) {
+		block = length - done > SPARSE_BLOCK ? SPARSE_BLOCK : length - done;
+		if (buffer_is_zero(p + done, block)) {
+			if (lseek(fd, block, SEEK_CUR) < 0)
+				return -1;
+			skipped = true;
+		} else {
+			if (write_buffer(fd, p + done, block) != (ssize_t)block)
+				return -1;
+			skipped = false;
+		}
+		done += block;
+	}
+
+	if (skipped) {
+		pos = lseek(fd, 0, SEEK_CUR);
+		if (pos < 0 || ftruncate(fd, pos))
+			return -1;
+	}
+
+	return (ssize_t)length;
+}
+
 ssize_t write_blockwise(int fd, size_t bsize, size_t alignment,
 			void *orig_buf, size_t length)
 {
+	char pad[BLOCKWISE_PAD_MAX] __attribute__((aligned(BLOCKWISE_PAD_MAX)));
 	void *hangover_buf = NULL, *buf = NULL;
 	size_t hangover, solid;
 	ssize_t r, ret = -1;
@@ -109,7 +190,7 @@ ssize_t write_blockwise(int fd, size_t bsize, size_t alignment,
 	hangover = length % bsize;
 	solid = length - hangover;
 
-	if ((size_t)orig_buf & (alignment - 1)) {
+	if (((size_t)orig_buf & (alignment - 1)) && fd_is_direct(fd)) {
 		if (posix_memalign(&buf, alignment, length))
 			return -1;
 		memcpy(buf, orig_buf, length);
@@ -123,7 +204,7 @@ ssize_t write_blockwise(int fd, size_t bsize, size_t alignment,
 	}
 
 	if (hangover) {
-		if (posix_memalign(&hangover_buf, alignment, bsize))
+		if (!(hangover_buf = pad_block_alloc(pad, bsize, alignment)))
 			goto out;
 		memset(hangover_buf, 0, bsize);
 
@@ -142,7 +223,8 @@ ssize_t write_blockwise(int fd, size_t bsize, size_t alignment,
 	}
 	ret = length;
 out:
-	free(hangover_buf);
+	if (hangover_buf)
+		pad_block_free(hangover_buf, pad);
 	if (buf != orig_buf)
 		free(buf);
 	return ret;
@@ -151,6 +233,7 @@ out:
 ssize_t read_blockwise(int fd, size_t bsize, size_t alignment,
 		       void *orig_buf, size_t length)
 {
+	char pad[BLOCKWISE_PAD_MAX] __attribute__((aligned(BLOCKWISE_PAD_MAX)));
 	void *hangover_buf = NULL, *buf = NULL;
 	size_t hangover, solid;
 	ssize_t r, ret = -1;
@@ -161,7 +244,7 @@ ssize_t read_blockwise(int fd, size_t bsize, size_t alignment,
 	hangover = length % bsize;
 	solid = length - hangover;
 
-	if ((size_t)orig_buf & (alignment - 1)) {
+	if (((size_t)orig_buf & (alignment - 1)) && fd_is_direct(fd)) {
 		if (posix_memalign(&buf, alignment, length))
 			return -1;
 	} else
@@ -172,7 +255,7 @@ ssize_t read_blockwise(int fd, size_t bsize, size_t alignment,
 		goto out;
 
 	if (hangover) {
-		if (posix_memalign(&hangover_buf, alignment, bsize))
+		if (!(hangover_buf = pad_block_alloc(pad, bsize, alignment)))
 			goto out;
 		r = read_buffer(fd, hangover_buf, bsize);
 		if (r <  0 || r < (ssize_t)hangover)
@@ -182,7 +265,8 @@ ssize_t read_blockwise(int fd, size_t bsize, size_t alignment,
 	}
 	ret = length;
 out:
-	free(hangover_buf);
+	if (hangover_buf)
+		pad_block_free(hangover_buf, pad);
 	if (buf != orig_buf) {
 		if (ret != -1)
 			memcpy(orig_buf, buf, length);
@@ -191,17 +275,55 @@ out:
 	return ret;
 }
 
+static ssize_t pread_buffer(int fd, void *buf, size_t length, off_t offset)
+{
+	size_t read_size = 0;
+	ssize_t r;
+
+	while (read_size < length) {
+		r = pread(fd, (uint8_t *)buf + read_size, length - read_size, offset + read_size);
+		if (r < 0 && errno == EINTR)
+			continue;
+		if (r < 0)
+			return r;
+		if (r == 0)
+			break;
+		read_size += (size_t)r;
+	}
+
+	return (ssize_t)read_size;
+}
+
+static ssize_t pwrite_buffer(int fd, const void *buf, size_t length, off_t offset)
+{
+	size_t write_size = 0;
+	ssize_t w;
+
+	while (write_size < length) {
+		w = pwrite(fd, (const uint8_t *)buf + write_size, length - write_size, offset + write_size);
+		if (w < 0 && errno == EINTR)
+			continue;
+		if (w < 0)
+			return w;
+		if (w == 0)
+			break;
+		write_size += (size_t)w;
+	}
+
+	return (ssize_t)write_size;
+}
+
 /*
- * Combines llseek with blockwise write. write_blockwise can already deal with short writes
- * but we also need a function to deal with short writes at the start. But this information
- * is implicitly included in the read/write offset, which can not be set to non-aligned
- * boundaries. Hence, we combine llseek with write.
+ * Blockwise I/O at explicit offset. Partial head and tail blocks are read
+ * and merged, file offset is never used or changed, so the same fd can be
+ * shared by several threads. Negative offset is relative to the end.
  */
-ssize_t write_lseek_blockwise(int fd, size_t bsize, size_t alignment,
-			      void *buf, size_t length, off_t offset)
+ssize_t pwrite_blockwise(int fd, size_t bsize, size_t alignment,
+			 void *buf, size_t length, off_t offset)
 {
-	void *frontPadBuf = NULL;
-	size_t frontHang, innerCount = 0;
+	char pad[BLOCKWISE_PAD_MAX] __attribute__((aligned(BLOCKWISE_PAD_MAX)));
+	void *pad_buf = NULL, *bounce_buf = NULL;
+	size_t front_hang, inner_count = 0, hangover, solid;
 	ssize_t r, ret = -1;
 
 	if (fd == -1 || !buf || !bsize || !alignment)
@@ -213,52 +335,80 @@ ssize_t write_lseek_blockwise(int fd, size_t bsize, size_t alignment,
 	if (offset < 0)
 		return -1;
 
-	frontHang = offset % bsize;
-
-	if (lseek(fd, offset - frontHang, SEEK_SET) < 0)
-		return -1;
+	front_hang = offset % bsize;
+	offset -= front_hang;
 
-	if (frontHang && length) {
-		if (posix_memalign(&frontPadBuf, alignment, bsize))
+	if ((front_hang && length) || length % bsize) {
+		if (!(pad_buf = pad_block_alloc(pad, bsize, alignment)))
 			return -1;
+	}
 
-		innerCount = bsize - frontHang;
-		if (innerCount > length)
-			innerCount = length;
+	if (front_hang && length) {
+		inner_count = bsize - front_hang;
+		if (inner_count > length)
+			inner_count = length;
 
-		r = read_buffer(fd, frontPadBuf, bsize);
-		if (r < 0 || r < (ssize_t)(frontHang + innerCount))
+		r = pread_buffer(fd, pad_buf, bsize, offset);
+		if (r < 0 || r < (ssize_t)(front_hang + inner_count))
 			goto out;
 
-		memcpy((char*)frontPadBuf + frontHang, buf, innerCount);
+		memcpy((char *)pad_buf + front_hang, buf, inner_count);
 
-		if (lseek(fd, offset - frontHang, SEEK_SET) < 0)
+		r = pwrite_buffer(fd, pad_buf, bsize, offset);
+		if (r < 0 || r != (ssize_t)bsize)
 			goto out;
 
-		r = write_buffer(fd, frontPadBuf, bsize);
-		if (r < 0 || r != (ssize_t)bsize)
+		buf = (char *)buf + inner_count;
+		length -= inner_count;
+		offset += bsize;
+	}
+
+	hangover = length % bsize;
+	solid = length - hangover;
+
+	if (solid) {
+		if (((size_t)buf & (alignment - 1)) && fd_is_direct(fd)) {
+			if (posix_memalign(&bounce_buf, alignment, solid))
+				goto out;
+			memcpy(bounce_buf, buf, solid);
+		}
+
+		r = pwrite_buffer(fd, bounce_buf ?: buf, solid, offset);
+		if (r < 0 || r != (ssize_t)solid)
 			goto out;
+	}
+
+	if (hangover) {
+		memset(pad_buf, 0, bsize);
+
+		r = pread_buffer(fd, pad_buf, bsize, offset + solid);
+		if (r < 0)
+			goto out;
+
+		memcpy(pad_buf, (char *)buf + solid, hangover);
 
-		buf = (char*)buf + innerCount;
-		length -= innerCount;
+		r = pwrite_buffer(fd, pad_buf, bsize, offset + solid);
+		if (r < 0 || r < (ssize_t)hangover)
+			goto out;
 	}
 
-	ret = length ? write_blockwise(fd, bsize, alignment, buf, length) : 0;
-	if (ret >= 0)
-		ret += innerCount;
+	ret = inner_count + length;
 out:
-	free(frontPadBuf);
+	if (pad_buf)
+		pad_block_free(pad_buf, pad);
+	free(bounce_buf);
 	return ret;
 }
 
-ssize_t read_lseek_blockwise(int fd, size_t bsize, size_t alignment,
-			     void *buf, size_t length, off_t offset)
+ssize_t pread_blockwise(int fd, size_t bsize, size_t alignment,
+			void *buf, size_t length, off_t offset)
 {
-	void *frontPadBuf = NULL;
-	size_t frontHang, innerCount = 0;
+	char pad[BLOCKWISE_PAD_MAX] __attribute__((aligned(BLOCKWISE_PAD_MAX)));
+	void *pad_buf = NULL, *bounce_buf = NULL;
+	size_t front_hang, inner_count = 0, hangover, solid;
 	ssize_t r, ret = -1;
 
-	if (fd == -1 || !buf || bsize <= 0)
+	if (fd == -1 || !buf || !bsize || !alignment)
 		return -1;
 
 	if (offset < 0)
@@ -267,33 +417,72 @@ ssize_t read_lseek_blockwise(int fd, size_t bsize, size_t alignment,
 	if (offset < 0)
 		return -1;
 
-	frontHang = offset % bsize;
-
-	if (lseek(fd, offset - frontHang, SEEK_SET) < 0)
-		return -1;
+	front_hang = offset % bsize;
+	offset -= front_hang;
 
-	if (frontHang && length) {
-		if (posix_memalign(&frontPadBuf, alignment, bsize))
+	if ((front_hang && length) || length % bsize) {
+		if (!(pad_buf = pad_block_alloc(pad, bsize, alignment)))
 			return -1;
+	}
+
+	if (front_hang && length) {
+		inner_count = bsize - front_hang;
+		if (inner_count > length)
+			inner_count = length;
+
+		r = pread_buffer(fd, pad_buf, bsize, offset);
+		if (r < 0 || r < (ssize_t)(front_hang + inner_count))
+			goto out;
+
+		memcpy(buf, (char *)pad_buf + front_hang, inner_count);
+
+		buf = (char *)buf + inner_count;
+		length -= inner_count;
+		offset += bsize;
+	}
 
-		innerCount = bsize - frontHang;
-		if (innerCount > length)
-			innerCount = length;
+	hangover = length % bsize;
+	solid = length - hangover;
 
-		r = read_buffer(fd, frontPadBuf, bsize);
-		if (r < 0 || r < (ssize_t)(frontHang + innerCount))
+	if (solid) {
+		if (((size_t)buf & (alignment - 1)) && fd_is_direct(fd) &&
+		    posix_memalign(&bounce_buf, alignment, solid))
 			goto out;
 
-		memcpy(buf, (char*)frontPadBuf + frontHang, innerCount);
+		r = pread_buffer(fd, bounce_buf ?: buf, solid, offset);
+		if (r < 0 || r != (ssize_t)solid)
+			goto out;
+
+		if (bounce_buf)
+			memcpy(buf, bounce_buf, solid);
+	}
+
+	if (hangover) {
+		r = pread_buffer(fd, pad_buf, bsize, offset + solid);
+		if (r < 0 || r < (ssize_t)hangover)
+			goto out;
 
-		buf = (char*)buf + innerCount;
-		length -= innerCount;
+		memcpy((char *)buf + solid, pad_buf, hangover);
 	}
 
-	ret = read_blockwise(fd, bsize, alignment, buf, length);
-	if (ret >= 0)
-		ret += innerCount;
+	ret = inner_count + length;
 out:
-	free(frontPadBuf);
+	if (pad_buf)
+		pad_block_free(pad_buf, pad);
+	free(bounce_buf);
 	return ret;
 }
+
+/* Kept for compatibility, same as pwrite_blockwise() */
+ssize_t write_lseek_blockwise(int fd, size_t bsize, size_t alignment,
+			      void *buf, size_t length, off_t offset)
+{
+	return pwrite_blockwise(fd, bsize, alignment, buf, length, offset);
+}
+
+/* Kept for compatibility, same as pread_blockwise() */
+ssize_t read_lseek_blockwise(int fd, size_t bsize, size_t alignment,
+			     void *buf, size_t length, off_t offset)
+{
+	return pread_blockwise(fd, bsize, alignment, buf, length, offset);
+}
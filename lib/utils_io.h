@@ -31,6 +31,7 @@ ssize_t read_buffer(int fd, void *buf, size_t length);
 ssize_t read_buffer_intr(int fd, void *buf, size_t length, volatile int *quit);
 ssize_t write_buffer(int fd, const void *buf, size_t length);
 ssize_t write_buffer_intr(int fd, const void *buf, size_t length, volatile int *quit);
+ssize_t write_buffer_sparse(int fd, const void *buf, size_t length);
 ssize_t write_blockwise(int fd, size_t bsize, size_t alignment,
 			void *orig_buf, size_t length);
 ssize_t read_blockwise(int fd, size_t bsize, size_t alignment,
@@ -39,5 +40,19 @@ ssize_t write_lseek_blockwise(int fd, size_t bsize, size_t alignment,
 			      void *buf, size_t length, off_t offset);
 ssize_t read_lseek_blockwise(int fd, size_t bsize, size_t alignment,
 			     void *buf, size_t length, off_t offset);
+ssize_t pwrite_blockwise(int fd, size_t bsize, size_t alignment,
+			 void *buf, size_t length, off_t offset);
+ssize_t pread_blockwise(int fd, size_t bsize, size_t alignment,
+			void *buf, size_t length, off_t offset);
+
+/* io_uring engine, on success the ring owns (and closes) the O_DIRECT fd */
+struct crypt_io_uring;
+int crypt_io_uring_init(struct crypt_io_uring **ring, int fd, unsigned depth);
+void crypt_io_uring_destroy(struct crypt_io_uring *ring);
+int crypt_io_uring_register_buffer(struct crypt_io_uring *ring, void *buffer, size_t length);
+ssize_t crypt_io_uring_read(struct crypt_io_uring *ring, void *buffer,
+			    size_t length, off_t offset);
+ssize_t crypt_io_uring_write(struct crypt_io_uring *ring, void *buffer,
+			     size_t length, off_t offset);
 
 #endif
@@ -0,0 +1,367 @@
+/*
+ * utils - io_uring based block I/O engine
+ *
+ * Copyright (C) 2023 Red Hat, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include "utils_io.h"
+
+#if defined(HAVE_LINUX_IO_URING_H) && defined(__NR_io_uring_setup)
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+/* Maximal size of one request (buffer is split into several requests) */
+#define IO_URING_CHUNK		(256 * 1024)
+#define IO_URING_MAX_DEPTH	64
+#define IO_URING_MAX_BUFFERS	4
+
+struct io_uring_req {
+	size_t pos;
+	size_t length;
+};
+
+struct crypt_io_uring {
+	int ring_fd;
+	int fd;
+	unsigned depth;
+	unsigned queued;
+
+	void *sq_ring;
+	size_t sq_ring_size;
+	unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+	struct io_uring_sqe *sqes;
+	size_t sqes_size;
+
+	void *cq_ring;
+	size_t cq_ring_size;
+	unsigned *cq_head, *cq_tail, *cq_mask;
+	struct io_uring_cqe *cqes;
+
+	struct iovec buffers[IO_URING_MAX_BUFFERS];
+	unsigned buffers_count;
+
+	struct io_uring_req req[IO_URING_MAX_DEPTH];
+	unsigned req_free[IO_URING_MAX_DEPTH];
+	unsigned req_free_count;
+};
+
+static int sys_io_uring_setup(unsigned entries, struct io_uring_params *p)
+{
+	return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags)
+{
+	return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+static int sys_io_uring_register(int fd, unsigned opcode, const void *arg, unsigned nr_args)
+{
+	return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+int crypt_io_uring_init(struct crypt_io_uring **ring, int fd, unsigned depth)
+{
+	struct io_uring_params p;
+	struct crypt_io_uring *h;
+	unsigned i;
+
+	if (fd < 0 || !depth)
+		return -EINVAL;
+
+	if (depth > IO_URING_MAX_DEPTH)
+		depth = IO_URING_MAX_DEPTH;
+
+	h = malloc(sizeof(*h));
+	if (!h)
+		return -ENOMEM;
+	memset(h, 0, sizeof(*h));
+	h->sq_ring = h->cq_ring = h->sqes = MAP_FAILED;
+	h->fd = fd;
+	h->depth = depth;
+
+	memset(&p, 0, sizeof(p));
+	h->ring_fd = sys_io_uring_setup(depth, &p);
+	if (h->ring_fd < 0) {
+		free(h);
+		return -ENOTSUP;
+	}
+
+	h->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+	h->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+	if ((p.features & IORING_FEAT_SINGLE_MMAP) && h->cq_ring_size > h->sq_ring_size)
+		h->sq_ring_size = h->cq_ring_size;
+
+	h->sq_ring = mmap(NULL, h->sq_ring_size, PROT_READ | PROT_WRITE,
+			  MAP_SHARED | MAP_POPULATE, h->ring_fd, IORING_OFF_SQ_RING);
+	if (h->sq_ring == MAP_FAILED)
+		goto err;
+
+	if (p.features & IORING_FEAT_SINGLE_MMAP)
+		h->cq_ring = h->sq_ring;
+	else {
+		h->cq_ring = mmap(NULL, h->cq_ring_size, PROT_READ | PROT_WRITE,
+				  MAP_SHARED | MAP_POPULATE, h->ring_fd, IORING_OFF_CQ_RING);
+		if (h->cq_ring == MAP_FAILED)
+			goto err;
+	}
+
+	h->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+	h->sqes = mmap(NULL, h->sqes_size, PROT_READ | PROT_WRITE,
+		       MAP_SHARED | MAP_POPULATE, h->ring_fd, IORING_OFF_SQES);
+	if (h->sqes == MAP_FAILED)
+		goto err;
+
+	h->sq_head  = (unsigned *)((char *)h->sq_ring + p.sq_off.head);
+	h->sq_tail  = (unsigned *)((char *)h->sq_ring + p.sq_off.tail);
+	h->sq_mask  = (unsigned *)((char *)h->sq_ring + p.sq_off.ring_mask);
+	h->sq_array = (unsigned *)((char *)h->sq_ring + p.sq_off.array);
+	h->cq_head  = (unsigned *)((char *)h->cq_ring + p.cq_off.head);
+	h->cq_tail  = (unsigned *)((char *)h->cq_ring + p.cq_off.tail);
+	h->cq_mask  = (unsigned *)((char *)h->cq_ring + p.cq_off.ring_mask);
+	h->cqes     = (struct io_uring_cqe *)((char *)h->cq_ring + p.cq_off.cqes);
+
+	for (i = 0; i < depth; i++)
+		h->req_free[i] = depth - 1 - i;
+	h->req_free_count = depth;
+
+	*ring = h;
+	return 0;
+err:
+	/* fd is owned by caller until init succeeds */
+	h->fd = -1;
+	crypt_io_uring_destroy(h);
+	return -ENOTSUP;
+}
+
+void crypt_io_uring_destroy(struct crypt_io_uring *ring)
+{
+	if (!ring)
+		return;
+
+	if (ring->sqes != MAP_FAILED)
+		munmap(ring->sqes, ring->sqes_size);
+	if (ring->cq_ring != MAP_FAILED && ring->cq_ring != ring->sq_ring)
+		munmap(ring->cq_ring, ring->cq_ring_size);
+	if (ring->sq_ring != MAP_FAILED)
+		munmap(ring->sq_ring, ring->sq_ring_size);
+
+	/* closing the ring waits for (or cancels) all outstanding requests */
+	close(ring->ring_fd);
+	if (ring->fd >= 0)
+		close(ring->fd);
+	free(ring);
+}
+
+int crypt_io_uring_register_buffer(struct crypt_io_uring *ring, void *buffer, size_t length)
+{
+	unsigned i;
+
+	for (i = 0; i < ring->buffers_count; i++)
+		if (ring->buffers[i].iov_base == buffer && ring->buffers[i].iov_len == length)
+			return 0;
+
+	if (ring->buffers_count == IO_URING_MAX_BUFFERS)
+		return -ENOSPC;
+
+	/* buffer table cannot be extended, register all buffers again */
+	if (ring->buffers_count)
+		(void)sys_io_uring_register(ring->ring_fd, IORING_UNREGISTER_BUFFERS, NULL, 0);
+
+	ring->buffers[ring->buffers_count].iov_base = buffer;
+	ring->buffers[ring->buffers_count].iov_len = length;
+
+	if (sys_io_uring_register(ring->ring_fd, IORING_REGISTER_BUFFERS,
+				  ring->buffers, ring->buffers_count + 1) < 0) {
+		/* e.g. RLIMIT_MEMLOCK, unregistered buffers are still usable */
+		ring->buffers_count = 0;
+		return -errno;
+	}
+
+	ring->buffers_count++;
+	return 0;
+}
+
+static int io_uring_buffer_index(struct crypt_io_uring *ring, const char *buf, size_t length)
+{
+	unsigned i;
+
+	for (i = 0; i < ring->buffers_count; i++)
+		if (buf >= (const char *)ring->buffers[i].iov_base &&
+		    buf + length <= (const char *)ring->buffers[i].iov_base + ring->buffers[i].iov_len)
+			return (int)i;
+	return -1;
+}
+
+static void io_uring_queue(struct crypt_io_uring *ring, bool write, char *buf,
+			   off_t offset, unsigned slot)
+{
+	struct io_uring_sqe *sqe;
+	unsigned tail, idx;
+	void *addr = buf + ring->req[slot].pos;
+	int index;
+
+	tail = *ring->sq_tail;
+	idx = tail & *ring->sq_mask;
+	sqe = &ring->sqes[idx];
+	memset(sqe, 0, sizeof(*sqe));
+
+	index = io_uring_buffer_index(ring, addr, ring->req[slot].length);
+	if (index >= 0) {
+		sqe->opcode = write ? IORING_OP_WRITE_FIXED : IORING_OP_READ_FIXED;
+		sqe->buf_index = (uint16_t)index;
+	} else
+		sqe->opcode = write ? IORING_OP_WRITE : IORING_OP_READ;
+
+	sqe->fd = ring->fd;
+	sqe->addr = (uint64_t)(uintptr_t)addr;
+	sqe->len = (uint32_t)ring->req[slot].length;
+	sqe->off = (uint64_t)offset + ring->req[slot].pos;
+	sqe->user_data = slot;
+
+	ring->sq_array[idx] = idx;
+	__atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+	ring->queued++;
+}
+
+/*
+ * Read or write whole buffer, keeping up to depth requests in flight.
+ * Buffer, offset and length must fulfil O_DIRECT alignment of fd.
+ * Returns processed length (shorter only on EOF) or -1 on error;
+ * after an error the ring should not be used anymore.
+ */
+static ssize_t io_uring_rw(struct crypt_io_uring *ring, bool write, void *buffer,
+			   size_t length, off_t offset)
+{
+	char *buf = buffer;
+	struct io_uring_cqe *cqe;
+	size_t next = 0, total = 0;
+	unsigned head, slot, inflight = 0;
+	bool eof = false, error = false;
+	int r;
+
+	while ((next < length && !eof && !error) || inflight) {
+		while (ring->req_free_count && next < length && !eof && !error) {
+			slot = ring->req_free[--ring->req_free_count];
+			ring->req[slot].pos = next;
+			ring->req[slot].length = length - next < IO_URING_CHUNK ? length - next : IO_URING_CHUNK;
+			next += ring->req[slot].length;
+			io_uring_queue(ring, write, buf, offset, slot);
+			inflight++;
+		}
+
+		r = sys_io_uring_enter(ring->ring_fd, ring->queued, 1, IORING_ENTER_GETEVENTS);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		ring->queued -= (unsigned)r < ring->queued ? (unsigned)r : ring->queued;
+
+		head = *ring->cq_head;
+		while (head != __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE)) {
+			cqe = &ring->cqes[head & *ring->cq_mask];
+			slot = (unsigned)cqe->user_data;
+			head++;
+
+			if (cqe->res == -EAGAIN || cqe->res == -EINTR) {
+				io_uring_queue(ring, write, buf, offset, slot);
+				continue;
+			}
+
+			if (cqe->res < 0)
+				error = true;
+			else if (cqe->res == 0)
+				eof = true;
+			else {
+				total += (size_t)cqe->res;
+				/* short transfer, continue with the rest of the request */
+				if ((size_t)cqe->res < ring->req[slot].length && !error) {
+					ring->req[slot].pos += (size_t)cqe->res;
+					ring->req[slot].length -= (size_t)cqe->res;
+					io_uring_queue(ring, write, buf, offset, slot);
+					continue;
+				}
+			}
+
+			ring->req_free[ring->req_free_count++] = slot;
+			inflight--;
+		}
+		__atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+	}
+
+	if (error || (write && total != length))
+		return -1;
+
+	return (ssize_t)total;
+}
+
+ssize_t crypt_io_uring_read(struct crypt_io_uring *ring, void *buffer,
+			    size_t length, off_t offset)
+{
+	return io_uring_rw(ring, false, buffer, length, offset);
+}
+
+ssize_t crypt_io_uring_write(struct crypt_io_uring *ring, void *buffer,
+			     size_t length, off_t offset)
+{
+	return io_uring_rw(ring, true, buffer, length, offset);
+}
+#else
+int crypt_io_uring_init(struct crypt_io_uring **ring __attribute__((unused)),
+			int fd __attribute__((unused)),
+			unsigned depth __attribute__((unused)))
+{
+	return -ENOTSUP;
+}
+
+void crypt_io_uring_destroy(struct crypt_io_uring *ring __attribute__((unused)))
+{
+}
+
+int crypt_io_uring_register_buffer(struct crypt_io_uring *ring __attribute__((unused)),
+				   void *buffer __attribute__((unused)),
+				   size_t length __attribute__((unused)))
+{
+	return -ENOTSUP;
+}
+
+ssize_t crypt_io_uring_read(struct crypt_io_uring *ring __attribute__((unused)),
+			    void *buffer __attribute__((unused)),
+			    size_t length __attribute__((unused)),
+			    off_t offset __attribute__((unused)))
+{
+	return -1;
+}
+
+ssize_t crypt_io_uring_write(struct crypt_io_uring *ring __attribute__((unused)),
+			     void *buffer __attribute__((unused)),
+			     size_t length __attribute__((unused)),
+			     off_t offset __attribute__((unused)))
+{
+	return -1;
+}
+#endif
@@ -0,0 +1,223 @@
+/*
+ * libcryptsetup - cryptsetup library, in-process cache of keyslot derived keys
+ *
+ * Copyright (C) 2023 Red Hat, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "internal.h"
+
+/*
+ * Keyslots with identical PBKDF parameters and salt (cloned headers) derive
+ * the same key from the same passphrase. Derived keys are cached process-wide
+ * for a short time, shared by all contexts that enabled the cache.
+ *
+ * Entries are found by HMAC of parameters, salt and passphrase under a random
+ * per-process secret, so neither passphrase nor its plain digest is stored.
+ * Everything lives in crypt_safe_alloc() memory and is wiped when expired.
+ */
+#define KEY_CACHE_ENTRIES	16
+#define KEY_CACHE_TAG_HASH	"sha256"
+#define KEY_CACHE_TAG_SIZE	32
+
+struct key_cache_entry {
+	char tag[KEY_CACHE_TAG_SIZE];
+	char *key;
+	size_t key_length;
+	uint64_t expires_ms;
+};
+
+static pthread_mutex_t key_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct key_cache_entry key_cache[KEY_CACHE_ENTRIES];
+static char *key_cache_secret;
+
+static uint64_t key_cache_now_ms(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return 0;
+
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void key_cache_drop(struct key_cache_entry *e)
+{
+	crypt_safe_free(e->key);
+	crypt_safe_memzero(e, sizeof(*e));
+}
+
+/* Called with key_cache_lock held */
+static void key_cache_expire(uint64_t now)
+{
+	bool empty = true;
+	int i;
+
+	for (i = 0; i < KEY_CACHE_ENTRIES; i++) {
+		if (key_cache[i].key && key_cache[i].expires_ms <= now)
+			key_cache_drop(&key_cache[i]);
+		if (key_cache[i].key)
+			empty = false;
+	}
+
+	/* new secret for next entries, nothing can match the old one */
+	if (empty) {
+		crypt_safe_free(key_cache_secret);
+		key_cache_secret = NULL;
+	}
+}
+
+static int key_cache_tag(struct crypt_device *cd, const char *kdf, const char *hash,
+			 const char *password, size_t password_length,
+			 const char *salt, size_t salt_length, size_t key_length,
+			 uint32_t iterations, uint32_t memory, uint32_t parallel, char *tag)
+{
+	struct crypt_hmac *hd = NULL;
+	char params[256];
+	int r, len;
+
+	if (!key_cache_secret) {
+		key_cache_secret = crypt_safe_alloc(KEY_CACHE_TAG_SIZE);
+		if (!key_cache_secret)
+			return -ENOMEM;
+		r = crypt_random_get(cd, key_cache_secret, KEY_CACHE_TAG_SIZE, CRYPT_RND_KEY);
+		if (r < 0) {
+			crypt_safe_free(key_cache_secret);
+			key_cache_secret = NULL;
+			return r;
+		}
+	}
+
+	len = snprintf(params, sizeof(params), "%s %s %" PRIu32 " %" PRIu32 " %" PRIu32 " %zu %zu %zu",
+		       kdf, hash ?: "", iterations, memory, parallel, key_length,
+		       salt_length, password_length);
+	if (len < 0 || (size_t)len >= sizeof(params))
+		return -EINVAL;
+
+	r = crypt_hmac_init(&hd, KEY_CACHE_TAG_HASH, key_cache_secret, KEY_CACHE_TAG_SIZE);
+	if (r)
+		return r;
+
+	r = crypt_hmac_write(hd, params, len + 1);
+	if (!r)
+		r = crypt_hmac_write(hd, salt, salt_length);
+	if (!r)
+		r = crypt_hmac_write(hd, password, password_length);
+	if (!r)
+		r = crypt_hmac_final(hd, tag, KEY_CACHE_TAG_SIZE);
+
+	crypt_hmac_destroy(hd);
+	return r;
+}
+
+/*
+ * Lookup of keyslot derived key, returns 0 and fills @key if cached,
+ * -ENOENT if not (or the cache is not enabled in the context).
+ */
+int crypt_derived_key_cache_get(struct crypt_device *cd, const char *kdf, const char *hash,
+				const char *password, size_t password_length,
+				const char *salt, size_t salt_length,
+				char *key, size_t key_length,
+				uint32_t iterations, uint32_t memory, uint32_t parallel)
+{
+	char tag[KEY_CACHE_TAG_SIZE];
+	int i, r = -ENOENT;
+
+	if (!crypt_get_derived_key_cache_timeout(cd))
+		return -ENOENT;
+
+	pthread_mutex_lock(&key_cache_lock);
+	key_cache_expire(key_cache_now_ms());
+
+	if (key_cache_tag(cd, kdf, hash, password, password_length, salt, salt_length,
+			  key_length, iterations, memory, parallel, tag))
+		goto out;
+
+	for (i = 0; i < KEY_CACHE_ENTRIES; i++) {
+		if (key_cache[i].key && key_cache[i].key_length == key_length &&
+		    !crypt_backend_memeq(key_cache[i].tag, tag, sizeof(tag))) {
+			memcpy(key, key_cache[i].key, key_length);
+			log_dbg(cd, "Using cached %s derived key.", kdf);
+			r = 0;
+			break;
+		}
+	}
+out:
+	pthread_mutex_unlock(&key_cache_lock);
+	crypt_safe_memzero(tag, sizeof(tag));
+	return r;
+}
+
+/* Store derived key, replacing the entry expiring first if the cache is full. */
+void crypt_derived_key_cache_put(struct crypt_device *cd, const char *kdf, const char *hash,
+				 const char *password, size_t password_length,
+				 const char *salt, size_t salt_length,
+				 const char *key, size_t key_length,
+				 uint32_t iterations, uint32_t memory, uint32_t parallel)
+{
+	struct key_cache_entry *e, *slot = NULL;
+	char tag[KEY_CACHE_TAG_SIZE];
+	uint32_t timeout_ms = crypt_get_derived_key_cache_timeout(cd);
+	int i;
+
+	if (!timeout_ms)
+		return;
+
+	pthread_mutex_lock(&key_cache_lock);
+
+	if (key_cache_tag(cd, kdf, hash, password, password_length, salt, salt_length,
+			  key_length, iterations, memory, parallel, tag))
+		goto out;
+
+	for (i = 0; i < KEY_CACHE_ENTRIES; i++) {
+		e = &key_cache[i];
+		/* stored in the meantime by another thread */
+		if (e->key && !crypt_backend_memeq(e->tag, tag, sizeof(tag)))
+			goto out;
+		/* free entry, otherwise the one expiring first */
+		if (!slot || (slot->key && (!e->key || e->expires_ms < slot->expires_ms)))
+			slot = e;
+	}
+
+	if (slot->key)
+		key_cache_drop(slot);
+	if (!(slot->key = crypt_safe_alloc(key_length)))
+		goto out;
+
+	memcpy(slot->key, key, key_length);
+	memcpy(slot->tag, tag, sizeof(tag));
+	slot->key_length = key_length;
+	slot->expires_ms = key_cache_now_ms() + timeout_ms;
+	log_dbg(cd, "Cached %s derived key for %" PRIu32 " ms.", kdf, timeout_ms);
+out:
+	pthread_mutex_unlock(&key_cache_lock);
+	crypt_safe_memzero(tag, sizeof(tag));
+}
+
+/* Wipe expired entries, all of them if @all is set. */
+void crypt_derived_key_cache_flush(bool all)
+{
+	pthread_mutex_lock(&key_cache_lock);
+	key_cache_expire(all ? UINT64_MAX : key_cache_now_ms());
+	pthread_mutex_unlock(&key_cache_lock);
+}
@@ -22,6 +22,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <sys/syscall.h>
 
@@ -82,6 +83,25 @@ static long keyctl_unlink(key_serial_t key, key_serial_t keyring)
 {
 	return syscall(__NR_keyctl, KEYCTL_UNLINK, key, keyring);
 }
+
+/* keyctl_set_timeout */
+static long keyctl_set_timeout(key_serial_t key, unsigned int timeout)
+{
+	return syscall(__NR_keyctl, KEYCTL_SET_TIMEOUT, key, timeout);
+}
+
+/* keyctl_search */
+static key_serial_t keyctl_search(key_serial_t keyring, const char *type,
+	const char *description, key_serial_t destination)
+{
+	return syscall(__NR_keyctl, KEYCTL_SEARCH, keyring, type, description, destination);
+}
+
+/* keyctl_link */
+static long keyctl_link(key_serial_t key, key_serial_t keyring)
+{
+	return syscall(__NR_keyctl, KEYCTL_LINK, key, keyring);
+}
 #endif
 
 int keyring_check(void)
@@ -113,6 +133,26 @@ int keyring_add_key_in_thread_keyring(key_type_t ktype, const char *key_desc, co
 #endif
 }
 
+/* session keyring is searched by dm-crypt and shared by all threads and children */
+int keyring_add_key_in_session_keyring(key_type_t ktype, const char *key_desc, const void *key, size_t key_size)
+{
+#ifdef KERNEL_KEYRING
+	const char *type_name = key_type_name(ktype);
+	key_serial_t kid;
+
+	if (!type_name || !key_desc)
+		return -EINVAL;
+
+	kid = add_key(type_name, key_desc, key, key_size, KEY_SPEC_SESSION_KEYRING);
+	if (kid < 0)
+		return -errno;
+
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
 /* currently used in client utilities only */
 int keyring_add_key_in_user_keyring(key_type_t ktype, const char *key_desc, const void *key, size_t key_size)
 {
@@ -133,6 +173,163 @@ int keyring_add_key_in_user_keyring(key_type_t ktype, const char *key_desc, cons
 #endif
 }
 
+/* key expires (and is garbage collected by the kernel) after timeout seconds */
+int keyring_add_key_in_user_keyring_timeout(key_type_t ktype, const char *key_desc,
+	const void *key, size_t key_size, unsigned int timeout)
+{
+#ifdef KERNEL_KEYRING
+	const char *type_name = key_type_name(ktype);
+	key_serial_t kid;
+	int r;
+
+	if (!type_name || !key_desc || !timeout)
+		return -EINVAL;
+
+	kid = add_key(type_name, key_desc, key, key_size, KEY_SPEC_USER_KEYRING);
+	if (kid < 0)
+		return -errno;
+
+	if (keyctl_set_timeout(kid, timeout)) {
+		r = -errno;
+		keyctl_revoke(kid);
+		keyctl_unlink(kid, KEY_SPEC_USER_KEYRING);
+		return r;
+	}
+
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+/*
+ * dm-crypt searches only thread, process and session keyrings of the caller,
+ * user keyring need not be linked in the session keyring (e.g. services).
+ */
+int keyring_link_user_key_in_thread_keyring(key_type_t ktype, const char *key_desc)
+{
+#ifdef KERNEL_KEYRING
+	const char *type_name = key_type_name(ktype);
+	key_serial_t kid;
+
+	if (!type_name || !key_desc)
+		return -EINVAL;
+
+	kid = keyctl_search(KEY_SPEC_USER_KEYRING, type_name, key_desc, KEY_SPEC_THREAD_KEYRING);
+	if (kid < 0)
+		return (errno == EKEYEXPIRED || errno == EKEYREVOKED) ? -ENOKEY : -errno;
+
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+/*
+ * Link user keyring key in thread keyring only if its payload matches,
+ * anybody with access to user keyring can add a key with the same description.
+ */
+int keyring_link_user_key_in_thread_keyring_matching(key_type_t ktype, const char *key_desc,
+	const void *key, size_t key_size)
+{
+#ifdef KERNEL_KEYRING
+	const char *type_name = key_type_name(ktype);
+	key_serial_t kid;
+	char *buf;
+	long ret;
+	int r = -ENOKEY;
+
+	if (!type_name || !key_desc || !key || !key_size)
+		return -EINVAL;
+
+	kid = keyctl_search(KEY_SPEC_USER_KEYRING, type_name, key_desc, 0);
+	if (kid < 0)
+		return -ENOKEY;
+
+	ret = keyctl_read(kid, NULL, 0);
+	if (ret < 0 || (size_t)ret != key_size)
+		return -ENOKEY;
+
+	buf = malloc(key_size);
+	if (!buf)
+		return -ENOMEM;
+
+	ret = keyctl_read(kid, buf, key_size);
+	if (ret >= 0 && (size_t)ret == key_size && !memcmp(buf, key, key_size))
+		r = keyctl_link(kid, KEY_SPEC_THREAD_KEYRING) ? -errno : 0;
+
+	free(buf);
+	return r;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+/*
+ * Read payload of user keyring key, the key is linked in thread keyring
+ * as well, so it can be revoked later by its description.
+ */
+int keyring_read_user_key(key_type_t ktype, const char *key_desc,
+	char **key, size_t *key_size)
+{
+#ifdef KERNEL_KEYRING
+	const char *type_name = key_type_name(ktype);
+	key_serial_t kid;
+	char *buf;
+	long ret;
+
+	if (!type_name || !key_desc || !key || !key_size)
+		return -EINVAL;
+
+	kid = keyctl_search(KEY_SPEC_USER_KEYRING, type_name, key_desc, KEY_SPEC_THREAD_KEYRING);
+	if (kid < 0)
+		return (errno == EKEYEXPIRED || errno == EKEYREVOKED) ? -ENOKEY : -errno;
+
+	ret = keyctl_read(kid, NULL, 0);
+	if (ret <= 0)
+		return ret < 0 ? -errno : -ENOKEY;
+
+	buf = crypt_safe_alloc(ret);
+	if (!buf)
+		return -ENOMEM;
+
+	*key_size = ret;
+	ret = keyctl_read(kid, buf, *key_size);
+	if (ret < 0 || (size_t)ret != *key_size) {
+		crypt_safe_free(buf);
+		return -ENOKEY;
+	}
+
+	*key = buf;
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+/* drop only the link in thread keyring, the key stays in other keyrings */
+int keyring_unlink_key_from_thread_keyring(key_type_t ktype, const char *key_desc)
+{
+#ifdef KERNEL_KEYRING
+	const char *type_name = key_type_name(ktype);
+	key_serial_t kid;
+
+	if (!type_name || !key_desc)
+		return -EINVAL;
+
+	kid = keyctl_search(KEY_SPEC_THREAD_KEYRING, type_name, key_desc, 0);
+	if (kid < 0)
+		return 0;
+
+	if (keyctl_unlink(kid, KEY_SPEC_THREAD_KEYRING))
+		return -errno;
+
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
 /* alias for the same code */
 int keyring_get_key(const char *key_desc,
 		    char **key,
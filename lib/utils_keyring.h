@@ -50,6 +50,35 @@ int keyring_add_key_in_user_keyring(
 	const void *key,
 	size_t key_size);
 
+int keyring_add_key_in_session_keyring(
+	key_type_t ktype,
+	const char *key_desc,
+	const void *key,
+	size_t key_size);
+
+int keyring_add_key_in_user_keyring_timeout(
+	key_type_t ktype,
+	const char *key_desc,
+	const void *key,
+	size_t key_size,
+	unsigned int timeout);
+
+int keyring_link_user_key_in_thread_keyring(key_type_t ktype, const char *key_desc);
+
+int keyring_link_user_key_in_thread_keyring_matching(
+	key_type_t ktype,
+	const char *key_desc,
+	const void *key,
+	size_t key_size);
+
+int keyring_unlink_key_from_thread_keyring(key_type_t ktype, const char *key_desc);
+
+int keyring_read_user_key(
+	key_type_t ktype,
+	const char *key_desc,
+	char **key,
+	size_t *key_size);
+
 int keyring_revoke_and_unlink_key(key_type_t ktype, const char *key_desc);
 
 #endif
@@ -51,6 +51,14 @@
 #define LOOP_SET_CAPACITY 0x4C07
 #endif
 
+#ifndef LOOP_SET_DIRECT_IO
+#define LOOP_SET_DIRECT_IO 0x4C08
+#endif
+
+#ifndef LO_FLAGS_DIRECT_IO
+#define LO_FLAGS_DIRECT_IO 16
+#endif
+
 #ifndef LOOP_SET_BLOCK_SIZE
 #define LOOP_SET_BLOCK_SIZE 0x4C09
 #endif
@@ -89,22 +97,18 @@ static char *crypt_loop_get_device_old(void)
 	return NULL;
 }
 
-static char *crypt_loop_get_device(void)
+static char *crypt_loop_get_device(int ctl_fd)
 {
 	char dev[64];
-	int i, loop_fd;
+	int i;
 	struct stat st;
 
-	loop_fd = open("/dev/loop-control", O_RDONLY);
-	if (loop_fd < 0)
+	if (ctl_fd < 0)
 		return crypt_loop_get_device_old();
 
-	i = ioctl(loop_fd, LOOP_CTL_GET_FREE);
-	if (i < 0) {
-		close(loop_fd);
+	i = ioctl(ctl_fd, LOOP_CTL_GET_FREE);
+	if (i < 0)
 		return NULL;
-	}
-	close(loop_fd);
 
 	if (sprintf(dev, "/dev/loop%d", i) < 0)
 		return NULL;
@@ -115,115 +119,190 @@ static char *crypt_loop_get_device(void)
 	return strdup(dev);
 }
 
-int crypt_loop_attach(char **loop, const char *file, int offset,
-		      int autoclear, int *readonly, size_t blocksize)
+/*
+ * Configure a free loop device, retried if another process takes it first.
+ * Returns open loop fd, -1 on error or -2 if LOOP_CONFIGURE is not supported.
+ */
+static int loop_configure(int ctl_fd, char **loop, struct loop_config *config, int readonly)
 {
-	struct loop_config config = {0};
-	char *lo_file_name;
-	int loop_fd = -1, file_fd = -1, r = 1;
-	int fallback = 0;
+	int loop_fd, err;
 
-	*loop = NULL;
+	while (1) {
+		*loop = crypt_loop_get_device(ctl_fd);
+		if (!*loop)
+			return -1;
 
-	file_fd = open(file, (*readonly ? O_RDONLY : O_RDWR) | O_EXCL);
-	if (file_fd < 0 && (errno == EROFS || errno == EACCES) && !*readonly) {
-		*readonly = 1;
-		file_fd = open(file, O_RDONLY | O_EXCL);
-	}
-	if (file_fd < 0)
-		goto out;
+		loop_fd = open(*loop, readonly ? O_RDONLY : O_RDWR);
+		if (loop_fd < 0)
+			return -1;
 
-	config.fd = file_fd;
+		if (!ioctl(loop_fd, LOOP_CONFIGURE, config))
+			return loop_fd;
 
-	lo_file_name = (char*)config.info.lo_file_name;
-	lo_file_name[LO_NAME_SIZE-1] = '\0';
-	strncpy(lo_file_name, file, LO_NAME_SIZE-1);
-	config.info.lo_offset = offset;
-	if (autoclear)
-		config.info.lo_flags |= LO_FLAGS_AUTOCLEAR;
-	if (blocksize > SECTOR_SIZE)
-		config.block_size = blocksize;
+		err = errno;
+		close(loop_fd);
+		free(*loop);
+		*loop = NULL;
+
+		/* Some kernels reject direct-io the backing file cannot do, retry without it */
+		if (err == EINVAL && (config->info.lo_flags & LO_FLAGS_DIRECT_IO)) {
+			config->info.lo_flags &= ~LO_FLAGS_DIRECT_IO;
+			continue;
+		}
+
+		/* kernel doesn't support LOOP_CONFIGURE */
+		if (err == EINVAL || err == ENOTTY)
+			return -2;
+
+		if (err != EBUSY)
+			return -1;
+	}
+}
+
+static int loop_set_fd(int ctl_fd, char **loop, struct loop_config *config, int readonly)
+{
+	int loop_fd = -1, err;
 
 	while (loop_fd < 0) {
-		*loop = crypt_loop_get_device();
+		*loop = crypt_loop_get_device(ctl_fd);
 		if (!*loop)
-			goto out;
+			return -1;
 
-		loop_fd = open(*loop, *readonly ? O_RDONLY : O_RDWR);
+		loop_fd = open(*loop, readonly ? O_RDONLY : O_RDWR);
 		if (loop_fd < 0)
-			goto out;
-		if (ioctl(loop_fd, LOOP_CONFIGURE, &config) < 0) {
-			if (errno == EINVAL || errno == ENOTTY) {
-				free(*loop);
-				*loop = NULL;
-
-				close(loop_fd);
-				loop_fd = -1;
-
-				/* kernel doesn't support LOOP_CONFIGURE */
-				fallback = 1;
-				break;
-			}
-			if (errno != EBUSY)
-				goto out;
-			free(*loop);
-			*loop = NULL;
-
+			return -1;
+		if (ioctl(loop_fd, LOOP_SET_FD, config->fd) < 0) {
+			err = errno;
 			close(loop_fd);
 			loop_fd = -1;
+			free(*loop);
+			*loop = NULL;
+			if (err != EBUSY)
+				return -1;
 		}
 	}
 
-	if (fallback) {
-		while (loop_fd < 0) {
-			*loop = crypt_loop_get_device();
-			if (!*loop)
-				goto out;
-
-			loop_fd = open(*loop, *readonly ? O_RDONLY : O_RDWR);
-			if (loop_fd < 0)
-				goto out;
-			if (ioctl(loop_fd, LOOP_SET_FD, file_fd) < 0) {
-				if (errno != EBUSY)
-					goto out;
-				free(*loop);
-				*loop = NULL;
-
-				close(loop_fd);
-				loop_fd = -1;
-			}
-		}
+	if (config->block_size)
+		(void)ioctl(loop_fd, LOOP_SET_BLOCK_SIZE, (unsigned long)config->block_size);
 
-		if (blocksize > SECTOR_SIZE)
-			(void)ioctl(loop_fd, LOOP_SET_BLOCK_SIZE, (unsigned long)blocksize);
+	/* LOOP_SET_STATUS64 ignores direct-io flag, it must be set separately */
+	if (ioctl(loop_fd, LOOP_SET_STATUS64, &config->info) < 0) {
+		(void)ioctl(loop_fd, LOOP_CLR_FD, 0);
+		close(loop_fd);
+		return -1;
+	}
 
-		if (ioctl(loop_fd, LOOP_SET_STATUS64, &config.info) < 0) {
-			(void)ioctl(loop_fd, LOOP_CLR_FD, 0);
-			goto out;
-		}
+	if (config->info.lo_flags & LO_FLAGS_DIRECT_IO)
+		(void)ioctl(loop_fd, LOOP_SET_DIRECT_IO, 1UL);
+
+	return loop_fd;
+}
+
+static int loop_attach_one(int ctl_fd, struct crypt_loop_params *p, int *no_configure)
+{
+	struct loop_config config = {0};
+	char *lo_file_name;
+	int loop_fd = -1, file_fd;
+
+	p->loop = NULL;
+	p->loop_fd = -1;
+
+	file_fd = open(p->file, (p->readonly ? O_RDONLY : O_RDWR) | O_EXCL);
+	if (file_fd < 0 && (errno == EROFS || errno == EACCES) && !p->readonly) {
+		p->readonly = 1;
+		file_fd = open(p->file, O_RDONLY | O_EXCL);
 	}
+	if (file_fd < 0)
+		return -1;
 
-	/* Verify that autoclear is really set */
-	if (autoclear) {
-		memset(&config.info, 0, sizeof(config.info));
-		if (ioctl(loop_fd, LOOP_GET_STATUS64, &config.info) < 0 ||
-		   !(config.info.lo_flags & LO_FLAGS_AUTOCLEAR)) {
-		(void)ioctl(loop_fd, LOOP_CLR_FD, 0);
-			goto out;
+	config.fd = file_fd;
+
+	lo_file_name = (char*)config.info.lo_file_name;
+	lo_file_name[LO_NAME_SIZE-1] = '\0';
+	strncpy(lo_file_name, p->file, LO_NAME_SIZE-1);
+	config.info.lo_offset = p->offset;
+	if (p->autoclear)
+		config.info.lo_flags |= LO_FLAGS_AUTOCLEAR;
+	if (p->direct_io)
+		config.info.lo_flags |= LO_FLAGS_DIRECT_IO;
+	if (p->blocksize > SECTOR_SIZE)
+		config.block_size = p->blocksize;
+
+	if (!*no_configure) {
+		loop_fd = loop_configure(ctl_fd, &p->loop, &config, p->readonly);
+		if (loop_fd == -2)
+			*no_configure = 1;
+	}
+
+	if (*no_configure)
+		loop_fd = loop_set_fd(ctl_fd, &p->loop, &config, p->readonly);
+
+	close(file_fd);
+	if (loop_fd < 0)
+		goto err;
+
+	/* Verify that autoclear is really set and check if direct-io was accepted */
+	memset(&config.info, 0, sizeof(config.info));
+	if (ioctl(loop_fd, LOOP_GET_STATUS64, &config.info) < 0) {
+		if (p->autoclear) {
+			(void)ioctl(loop_fd, LOOP_CLR_FD, 0);
+			goto err;
 		}
+	} else if (p->autoclear && !(config.info.lo_flags & LO_FLAGS_AUTOCLEAR)) {
+		(void)ioctl(loop_fd, LOOP_CLR_FD, 0);
+		goto err;
 	}
+	p->direct_io = (config.info.lo_flags & LO_FLAGS_DIRECT_IO) ? 1 : 0;
+	p->loop_fd = loop_fd;
 
-	r = 0;
-out:
-	if (r && loop_fd >= 0)
+	return 0;
+err:
+	if (loop_fd >= 0)
 		close(loop_fd);
-	if (file_fd >= 0)
-		close(file_fd);
-	if (r && *loop) {
-		free(*loop);
-		*loop = NULL;
-	}
-	return r ? -1 : loop_fd;
+	free(p->loop);
+	p->loop = NULL;
+	return -1;
+}
+
+int crypt_loop_attach_batch(struct crypt_loop_params *params, unsigned count)
+{
+	unsigned i;
+	int ctl_fd, no_configure = 0, r = 0;
+
+	/* One control fd for the whole batch, old kernels scan /dev/loopN instead */
+	ctl_fd = open("/dev/loop-control", O_RDONLY);
+
+	for (i = 0; i < count; i++)
+		if (loop_attach_one(ctl_fd, &params[i], &no_configure))
+			r = -1;
+
+	if (ctl_fd >= 0)
+		close(ctl_fd);
+
+	return r;
+}
+
+int crypt_loop_attach(char **loop, const char *file, int offset,
+		      int autoclear, int *readonly, int *direct_io, size_t blocksize)
+{
+	struct crypt_loop_params p = {
+		.file = file,
+		.offset = offset,
+		.autoclear = autoclear,
+		.readonly = *readonly,
+		.direct_io = direct_io ? *direct_io : 0,
+		.blocksize = blocksize,
+	};
+	int r;
+
+	r = crypt_loop_attach_batch(&p, 1);
+
+	*loop = p.loop;
+	*readonly = p.readonly;
+	if (direct_io)
+		*direct_io = p.direct_io;
+
+	return r ? -1 : p.loop_fd;
 }
 
 int crypt_loop_detach(const char *loop)
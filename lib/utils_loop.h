@@ -27,7 +27,20 @@
 char *crypt_loop_backing_file(const char *loop);
 int crypt_loop_device(const char *loop);
 int crypt_loop_attach(char **loop, const char *file, int offset,
-		      int autoclear, int *readonly, size_t blocksize);
+		      int autoclear, int *readonly, int *direct_io, size_t blocksize);
+
+struct crypt_loop_params {
+	const char *file;
+	int offset;
+	int autoclear;
+	int readonly;   /* in/out, set if fallback to read-only was needed */
+	int direct_io;  /* in/out, set if kernel enabled direct-io */
+	size_t blocksize;
+	char *loop;     /* out, allocated loop device path */
+	int loop_fd;    /* out, open loop device or -1 */
+};
+/* Attach several files sharing one loop-control fd, returns -1 if any failed */
+int crypt_loop_attach_batch(struct crypt_loop_params *params, unsigned count);
 int crypt_loop_detach(const char *loop);
 int crypt_loop_resize(const char *loop);
 
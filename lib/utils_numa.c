@@ -0,0 +1,186 @@
+/*
+ * NUMA placement of bulk I/O buffers
+ *
+ * Copyright (C) 2023 Red Hat, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#ifdef HAVE_SYS_SYSMACROS_H
+# include <sys/sysmacros.h>     /* for major, minor */
+#endif
+#include "internal.h"
+
+/* from linux/mempolicy.h, not all distributions ship it */
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED 1
+#endif
+
+/* dm devices stacked over other dm devices */
+#define NUMA_MAX_STACK 8
+
+static int _read_sysfs_int(const char *dir, const char *attr, int *value)
+{
+	char path[PATH_MAX], tmp[64] = {0};
+	int fd, r;
+
+	if (snprintf(path, sizeof(path), "%s/%s", dir, attr) < 0)
+		return -EINVAL;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -errno;
+	r = read(fd, tmp, sizeof(tmp) - 1);
+	close(fd);
+
+	if (r <= 0 || sscanf(tmp, "%d", value) != 1)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int _sysfs_numa_node(const char *sysfs_dir, int level)
+{
+	char path[PATH_MAX], *real, *p;
+	struct dirent *entry;
+	DIR *dir;
+	int node = -1;
+
+	if (level > NUMA_MAX_STACK || !(real = realpath(sysfs_dir, NULL)))
+		return -1;
+
+	/* partition: attributes live in the parent disk directory */
+	if (snprintf(path, sizeof(path), "%s/partition", real) > 0 && !access(path, F_OK) &&
+	    (p = strrchr(real, '/')))
+		*p = '\0';
+
+	if (!_read_sysfs_int(real, "device/numa_node", &node) && node >= 0)
+		goto out;
+	node = -1;
+
+	/* stacked (dm, md) device: use node of the first underlying device that has one */
+	if (snprintf(path, sizeof(path), "%s/slaves", real) < 0 || !(dir = opendir(path)))
+		goto out;
+
+	while (node < 0 && (entry = readdir(dir))) {
+		if (entry->d_name[0] == '.')
+			continue;
+		if (snprintf(path, sizeof(path), "%s/slaves/%s", real, entry->d_name) > 0)
+			node = _sysfs_numa_node(path, level + 1);
+	}
+	closedir(dir);
+out:
+	free(real);
+	return node;
+}
+
+/*
+ * Return NUMA node the device (or its backing disk) is attached to,
+ * -1 if unknown or the system is not NUMA.
+ */
+int crypt_dev_numa_node(const char *dev_path)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	dev_t dev;
+
+	if (!dev_path || stat(dev_path, &st) < 0)
+		return -1;
+
+	/* regular file: node of the block device holding the filesystem */
+	dev = S_ISBLK(st.st_mode) ? st.st_rdev : st.st_dev;
+
+	if (snprintf(path, sizeof(path), "/sys/dev/block/%d:%d", major(dev), minor(dev)) < 0)
+		return -1;
+
+	return _sysfs_numa_node(path, 0);
+}
+
+/*
+ * Prefer allocation of buffer pages on the node. Best effort, pages
+ * already faulted in are not moved and a failure is silently ignored.
+ */
+void crypt_numa_bind_buffer(void *buffer, size_t length, int node)
+{
+#ifdef SYS_mbind
+	unsigned long mask[4] = {0};
+	uintptr_t start, end;
+	long page_size = crypt_getpagesize();
+
+	if (node < 0 || (size_t)node >= sizeof(mask) * 8 || page_size <= 0)
+		return;
+
+	/* only pages fully contained in the buffer */
+	start = ((uintptr_t)buffer + page_size - 1) & ~((uintptr_t)page_size - 1);
+	end = ((uintptr_t)buffer + length) & ~((uintptr_t)page_size - 1);
+	if (end <= start)
+		return;
+
+	mask[node / (sizeof(mask[0]) * 8)] = 1UL << (node % (sizeof(mask[0]) * 8));
+
+	(void)syscall(SYS_mbind, start, end - start, MPOL_PREFERRED, mask, sizeof(mask) * 8, 0);
+#endif
+}
+
+/*
+ * Fill CPU set of the NUMA node from sysfs cpulist (e.g. "0-7,16-23").
+ */
+int crypt_numa_node_cpus(int node, cpu_set_t *set)
+{
+	char path[PATH_MAX], tmp[1024] = {0}, *p, *end;
+	unsigned long first, last;
+	int fd, r;
+
+	if (node < 0 || !set)
+		return -EINVAL;
+
+	if (snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node) < 0)
+		return -EINVAL;
+
+	if ((fd = open(path, O_RDONLY)) < 0)
+		return -errno;
+	r = read(fd, tmp, sizeof(tmp) - 1);
+	close(fd);
+	if (r <= 0)
+		return -EINVAL;
+
+	CPU_ZERO(set);
+	for (p = tmp; *p && *p != '\n'; p = end) {
+		first = last = strtoul(p, &end, 10);
+		if (end == p)
+			return -EINVAL;
+		if (*end == '-') {
+			p = end + 1;
+			last = strtoul(p, &end, 10);
+			if (end == p)
+				return -EINVAL;
+		}
+		for (; first <= last && first < CPU_SETSIZE; first++)
+			CPU_SET(first, set);
+		if (*end == ',')
+			end++;
+	}
+
+	return CPU_COUNT(set) ? 0 : -ENOENT;
+}
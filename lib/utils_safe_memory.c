@@ -22,16 +22,144 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <pthread.h>
 #include <sys/mman.h>
-#include "libcryptsetup.h"
+#include "internal.h"
 
 struct safe_allocation {
 	size_t size;
 	bool locked;
+	bool pooled;
 	char data[0] __attribute__((aligned(8)));
 };
 #define OVERHEAD offsetof(struct safe_allocation, data)
 
+/*
+ * Small allocations (passphrases, keys, AF buffers) come from an arena
+ * of mlocked chunks excluded from core dumps. Each chunk is split into
+ * slots of one size class, freed slots are wiped and kept on a free list,
+ * so the hot path needs no mlock/munlock syscall. Chunks are never
+ * returned, the arena is capped to stay well within RLIMIT_MEMLOCK;
+ * everything else falls back to malloc with per-allocation mlock.
+ */
+#define SAFE_POOL_MIN_SHIFT	6	/* 64 bytes */
+#define SAFE_POOL_CLASSES	7	/* up to 4 KiB */
+#define SAFE_POOL_CHUNK		(32 * 1024)
+#define SAFE_POOL_MAX_CHUNKS	32
+
+struct safe_pool_slot {
+	struct safe_pool_slot *next;
+};
+
+static pthread_mutex_t safe_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct safe_pool_slot *safe_pool_free[SAFE_POOL_CLASSES];
+static unsigned safe_pool_chunks;
+static bool safe_pool_disabled;
+
+/* process-wide accounting, allocations are not bound to a context */
+static uint64_t safe_current, safe_peak;
+
+static void safe_account(size_t size, bool alloc)
+{
+	uint64_t current, peak;
+
+	if (!alloc) {
+		__atomic_sub_fetch(&safe_current, size, __ATOMIC_RELAXED);
+		return;
+	}
+
+	current = __atomic_add_fetch(&safe_current, size, __ATOMIC_RELAXED);
+	peak = __atomic_load_n(&safe_peak, __ATOMIC_RELAXED);
+	while (current > peak &&
+	       !__atomic_compare_exchange_n(&safe_peak, &peak, current, true,
+					    __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+static int safe_pool_class(size_t size)
+{
+	int class;
+
+	for (class = 0; class < SAFE_POOL_CLASSES; class++)
+		if (size <= ((size_t)1 << (SAFE_POOL_MIN_SHIFT + class)))
+			return class;
+
+	return -1;
+}
+
+/* Called with safe_pool_lock held */
+static bool safe_pool_grow(int class)
+{
+	size_t slot_size = (size_t)1 << (SAFE_POOL_MIN_SHIFT + class), off;
+	struct safe_pool_slot *slot;
+	char *chunk;
+
+	if (safe_pool_disabled || safe_pool_chunks >= SAFE_POOL_MAX_CHUNKS)
+		return false;
+
+	chunk = mmap(NULL, SAFE_POOL_CHUNK, PROT_READ | PROT_WRITE,
+		     MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (chunk == MAP_FAILED)
+		return false;
+
+	/* Pooled memory must be locked, do not try again when over limit */
+	if (mlock(chunk, SAFE_POOL_CHUNK)) {
+		munmap(chunk, SAFE_POOL_CHUNK);
+		safe_pool_disabled = true;
+		return false;
+	}
+#ifdef MADV_DONTDUMP
+	(void)madvise(chunk, SAFE_POOL_CHUNK, MADV_DONTDUMP);
+#endif
+	safe_pool_chunks++;
+
+	for (off = 0; off < SAFE_POOL_CHUNK; off += slot_size) {
+		slot = (struct safe_pool_slot *)(chunk + off);
+		slot->next = safe_pool_free[class];
+		safe_pool_free[class] = slot;
+	}
+
+	return true;
+}
+
+static struct safe_allocation *safe_pool_get(size_t size)
+{
+	struct safe_pool_slot *slot = NULL;
+	int class = safe_pool_class(size);
+
+	if (class < 0)
+		return NULL;
+
+	pthread_mutex_lock(&safe_pool_lock);
+	if (safe_pool_free[class] || safe_pool_grow(class)) {
+		slot = safe_pool_free[class];
+		safe_pool_free[class] = slot->next;
+	}
+	pthread_mutex_unlock(&safe_pool_lock);
+
+	return (struct safe_allocation *)slot;
+}
+
+static void safe_pool_put(struct safe_allocation *alloc, size_t size)
+{
+	struct safe_pool_slot *slot = (struct safe_pool_slot *)alloc;
+	int class = safe_pool_class(size);
+
+	assert(class >= 0);
+
+	crypt_safe_memzero(alloc, size);
+
+	pthread_mutex_lock(&safe_pool_lock);
+	slot->next = safe_pool_free[class];
+	safe_pool_free[class] = slot;
+	pthread_mutex_unlock(&safe_pool_lock);
+}
+
+void crypt_safe_memory_usage(uint64_t *current, uint64_t *peak)
+{
+	*current = __atomic_load_n(&safe_current, __ATOMIC_RELAXED);
+	*peak = __atomic_load_n(&safe_peak, __ATOMIC_RELAXED);
+}
+
 /*
  * Replacement for memset(s, 0, n) on stack that can be optimized out
  * Also used in safe allocations for explicit memory wipe.
@@ -59,12 +187,23 @@ void *crypt_safe_alloc(size_t size)
 	if (!size || size > (SIZE_MAX - OVERHEAD))
 		return NULL;
 
+	alloc = safe_pool_get(size + OVERHEAD);
+	if (alloc) {
+		crypt_safe_memzero(alloc, size + OVERHEAD);
+		alloc->size = size;
+		alloc->locked = true;
+		alloc->pooled = true;
+		safe_account(size, true);
+		return &alloc->data;
+	}
+
 	alloc = malloc(size + OVERHEAD);
 	if (!alloc)
 		return NULL;
 
 	crypt_safe_memzero(alloc, size + OVERHEAD);
 	alloc->size = size;
+	safe_account(size, true);
 
 	/* Ignore failure if it is over limit. */
 	if (!mlock(alloc, size + OVERHEAD))
@@ -87,6 +226,12 @@ void crypt_safe_free(void *data)
 	alloc = (struct safe_allocation *)p;
 
 	crypt_safe_memzero(data, alloc->size);
+	safe_account(alloc->size, false);
+
+	if (alloc->pooled) {
+		safe_pool_put(alloc, alloc->size + OVERHEAD);
+		return;
+	}
 
 	if (alloc->locked) {
 		munlock(alloc, alloc->size + OVERHEAD);
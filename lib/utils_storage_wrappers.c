@@ -31,19 +31,28 @@
 #include "utils_storage_wrappers.h"
 #include "internal.h"
 
+/* Outstanding requests for io_uring engine */
+#define IO_URING_DEPTH 16
+
 struct crypt_storage_wrapper {
 	crypt_storage_wrapper_type type;
 	int dev_fd;
+	int buffered_fd;
 	int block_size;
 	size_t mem_alignment;
 	uint64_t data_offset;
+	struct crypt_io_uring *ring;
+	struct device *device;
+	int open_flags;
 	union {
 	struct {
-		struct crypt_storage *s;
+		struct crypt_storage_parallel *s;
 		uint64_t iv_start;
 	} cb;
 	struct {
 		int dmcrypt_fd;
+		int block_size;
+		struct crypt_io_uring *ring;
 		char name[PATH_MAX];
 	} dm;
 	} u;
@@ -51,6 +60,7 @@ struct crypt_storage_wrapper {
 
 static int crypt_storage_backend_init(struct crypt_device *cd,
 		struct crypt_storage_wrapper *w,
+		struct device *device,
 		uint64_t iv_start,
 		int sector_size,
 		const char *cipher,
@@ -58,20 +68,38 @@ static int crypt_storage_backend_init(struct crypt_device *cd,
 		const struct volume_key *vk,
 		uint32_t flags)
 {
-	int r;
-	struct crypt_storage *s;
+	int r, node;
+	unsigned threads = crypt_cpusonline();
+	bool numa_cpus = false;
+	cpu_set_t cpus;
+	struct crypt_storage_parallel *s;
+
+	/* Keep workers on CPUs local to the device, buffers are allocated there too. */
+	node = crypt_dev_numa_node(device_path(device));
+	if (node >= 0 && !crypt_numa_node_cpus(node, &cpus) &&
+	    (unsigned)CPU_COUNT(&cpus) < threads) {
+		threads = CPU_COUNT(&cpus);
+		numa_cpus = true;
+	}
 
 	/* iv_start, sector_size */
-	r = crypt_storage_init(&s, sector_size, cipher, cipher_mode, vk->key, vk->keylength, flags & LARGE_IV);
+	r = crypt_storage_parallel_init(&s, threads, sector_size, cipher, cipher_mode,
+					vk->key, vk->keylength, flags & LARGE_IV);
 	if (r)
 		return r;
 
-	if ((flags & DISABLE_KCAPI) && crypt_storage_kernel_only(s)) {
+	if (numa_cpus && crypt_storage_parallel_set_affinity(s, &cpus))
+		log_dbg(cd, "Failed to pin cipher threads to NUMA node %d CPUs.", node);
+
+	if ((flags & DISABLE_KCAPI) && crypt_storage_parallel_kernel_only(s)) {
 		log_dbg(cd, "Could not initialize userspace block cipher and kernel fallback is disabled.");
-		crypt_storage_destroy(s);
+		crypt_storage_parallel_destroy(s);
 		return -ENOTSUP;
 	}
 
+	log_dbg(cd, "Using userspace block cipher with %u thread(s)%s.", crypt_storage_parallel_threads(s),
+		numa_cpus ? " on device NUMA node" : "");
+
 	w->type = USPACE;
 	w->u.cb.s = s;
 	w->u.cb.iv_start = iv_start;
@@ -152,10 +180,193 @@ static int crypt_storage_dmcrypt_init(
 
 	cw->type = DMCRYPT;
 	cw->u.dm.dmcrypt_fd = fd;
+	/* dm-crypt device exposes encryption sector size as logical block size */
+	cw->u.dm.block_size = sector_size > cw->block_size ? sector_size : cw->block_size;
 
 	return 0;
 }
 
+/*
+ * The kernel does the cipher work for dm-crypt wrappers, keep several
+ * large O_DIRECT requests in flight on the mapping to keep it busy.
+ * The ring owns a duplicate of the mapping descriptor.
+ */
+static void crypt_storage_dmcrypt_io_uring_init(struct crypt_device *cd,
+		struct crypt_storage_wrapper *cw)
+{
+	int fd, r;
+
+	fd = dup(cw->u.dm.dmcrypt_fd);
+	if (fd < 0)
+		return;
+
+	r = crypt_io_uring_init(&cw->u.dm.ring, fd, IO_URING_DEPTH);
+	if (r) {
+		log_dbg(cd, "Cannot initialize io_uring for dm-crypt mapping (%d).", r);
+		close(fd);
+		return;
+	}
+
+	log_dbg(cd, "Using io_uring for dm-crypt mapping I/O.");
+}
+
+static bool crypt_storage_dmcrypt_io_uring_aligned(const struct crypt_storage_wrapper *cw,
+		const void *buffer, size_t buffer_length, off_t offset)
+{
+	return cw->u.dm.ring && !((uintptr_t)buffer % cw->mem_alignment) &&
+	       !(buffer_length % cw->u.dm.block_size) &&
+	       !(offset % cw->u.dm.block_size);
+}
+
+static ssize_t crypt_storage_dmcrypt_read(struct crypt_storage_wrapper *cw,
+		off_t offset, void *buffer, size_t buffer_length)
+{
+	ssize_t r;
+
+	if (crypt_storage_dmcrypt_io_uring_aligned(cw, buffer, buffer_length, offset)) {
+		r = crypt_io_uring_read(cw->u.dm.ring, buffer, buffer_length, offset);
+		if (r >= 0)
+			return r;
+		crypt_io_uring_destroy(cw->u.dm.ring);
+		cw->u.dm.ring = NULL;
+	}
+
+	return pread_blockwise(cw->u.dm.dmcrypt_fd,
+			cw->block_size,
+			cw->mem_alignment,
+			buffer,
+			buffer_length,
+			offset);
+}
+
+static ssize_t crypt_storage_dmcrypt_write(struct crypt_storage_wrapper *cw,
+		off_t offset, void *buffer, size_t buffer_length)
+{
+	ssize_t r;
+
+	if (crypt_storage_dmcrypt_io_uring_aligned(cw, buffer, buffer_length, offset)) {
+		r = crypt_io_uring_write(cw->u.dm.ring, buffer, buffer_length, offset);
+		if (r >= 0)
+			return r;
+		crypt_io_uring_destroy(cw->u.dm.ring);
+		cw->u.dm.ring = NULL;
+	}
+
+	return pwrite_blockwise(cw->u.dm.dmcrypt_fd,
+			cw->block_size,
+			cw->mem_alignment,
+			buffer,
+			buffer_length,
+			offset);
+}
+
+/*
+ * io_uring uses its own O_DIRECT descriptor, failure here is not fatal.
+ * Only devices that passed direct-io read test in device_ready() are used.
+ */
+static void crypt_storage_io_uring_init(struct crypt_device *cd,
+		struct crypt_storage_wrapper *cw,
+		struct device *device,
+		int open_flags)
+{
+	int fd, r;
+
+	if (!device_direct_io(device)) {
+		log_dbg(cd, "Direct-io not available for %s, io_uring disabled.", device_path(device));
+		return;
+	}
+
+	fd = open(device_path(device), open_flags | O_DIRECT);
+	if (fd < 0) {
+		log_dbg(cd, "Cannot open %s for direct-io, io_uring disabled.", device_path(device));
+		return;
+	}
+
+	r = crypt_io_uring_init(&cw->ring, fd, IO_URING_DEPTH);
+	if (r) {
+		log_dbg(cd, "Cannot initialize io_uring (%d).", r);
+		close(fd);
+		return;
+	}
+
+	log_dbg(cd, "Using io_uring for storage wrapper I/O.");
+}
+
+static bool crypt_storage_io_uring_aligned(const struct crypt_storage_wrapper *cw,
+		const void *buffer, size_t buffer_length, off_t offset)
+{
+	return cw->ring && !((uintptr_t)buffer % cw->mem_alignment) &&
+	       !(buffer_length % cw->block_size) &&
+	       !((cw->data_offset + offset) % cw->block_size);
+}
+
+/*
+ * The ring failed, do not trust direct-io on this device anymore. Plain I/O
+ * then goes through a new descriptor opened without O_DIRECT, the shared
+ * device descriptor is left untouched.
+ */
+static void crypt_storage_io_uring_drop(struct crypt_storage_wrapper *cw)
+{
+	int flags;
+
+	crypt_io_uring_destroy(cw->ring);
+	cw->ring = NULL;
+
+	flags = fcntl(cw->dev_fd, F_GETFL);
+	if (flags < 0 || !(flags & O_DIRECT) || cw->buffered_fd >= 0)
+		return;
+
+	cw->buffered_fd = open(device_path(cw->device), cw->open_flags);
+	if (cw->buffered_fd < 0)
+		log_dbg(NULL, "Cannot reopen %s without direct-io.", device_path(cw->device));
+}
+
+static int crypt_storage_fd(const struct crypt_storage_wrapper *cw)
+{
+	return cw->buffered_fd >= 0 ? cw->buffered_fd : cw->dev_fd;
+}
+
+static ssize_t crypt_storage_read(struct crypt_storage_wrapper *cw,
+		off_t offset, void *buffer, size_t buffer_length)
+{
+	ssize_t r;
+
+	if (crypt_storage_io_uring_aligned(cw, buffer, buffer_length, offset)) {
+		r = crypt_io_uring_read(cw->ring, buffer, buffer_length, cw->data_offset + offset);
+		if (r >= 0)
+			return r;
+		/* do not trust the ring anymore, and retry with plain I/O */
+		crypt_storage_io_uring_drop(cw);
+	}
+
+	return pread_blockwise(crypt_storage_fd(cw),
+			cw->block_size,
+			cw->mem_alignment,
+			buffer,
+			buffer_length,
+			cw->data_offset + offset);
+}
+
+static ssize_t crypt_storage_write(struct crypt_storage_wrapper *cw,
+		off_t offset, void *buffer, size_t buffer_length)
+{
+	ssize_t r;
+
+	if (crypt_storage_io_uring_aligned(cw, buffer, buffer_length, offset)) {
+		r = crypt_io_uring_write(cw->ring, buffer, buffer_length, cw->data_offset + offset);
+		if (r >= 0)
+			return r;
+		crypt_storage_io_uring_drop(cw);
+	}
+
+	return pwrite_blockwise(crypt_storage_fd(cw),
+			cw->block_size,
+			cw->mem_alignment,
+			buffer,
+			buffer_length,
+			cw->data_offset + offset);
+}
+
 int crypt_storage_wrapper_init(struct crypt_device *cd,
 	struct crypt_storage_wrapper **cw,
 	struct device *device,
@@ -184,6 +395,9 @@ int crypt_storage_wrapper_init(struct crypt_device *cd,
 		return -ENOMEM;
 
 	memset(w, 0, sizeof(*w));
+	w->buffered_fd = -1;
+	w->device = device;
+	w->open_flags = open_flags;
 	w->data_offset = data_offset;
 	w->mem_alignment = device_alignment(device);
 	w->block_size = device_block_size(cd, device);
@@ -199,6 +413,9 @@ int crypt_storage_wrapper_init(struct crypt_device *cd,
 		goto err;
 	}
 
+	if (flags & USE_IO_URING)
+		crypt_storage_io_uring_init(cd, w, device, open_flags);
+
 	if (crypt_is_cipher_null(_cipher)) {
 		log_dbg(cd, "Requested cipher_null, switching to noop wrapper.");
 		w->type = NONE;
@@ -212,7 +429,7 @@ int crypt_storage_wrapper_init(struct crypt_device *cd,
 		goto err;
 	}
 
-	r = crypt_storage_backend_init(cd, w, iv_start, sector_size, _cipher, mode, vk, flags);
+	r = crypt_storage_backend_init(cd, w, device, iv_start, sector_size, _cipher, mode, vk, flags);
 	if (!r) {
 		*cw = w;
 		return 0;
@@ -229,6 +446,10 @@ int crypt_storage_wrapper_init(struct crypt_device *cd,
 		log_dbg(cd, "Dm-crypt backend failed to initialize.");
 		goto err;
 	}
+
+	if (flags & USE_IO_URING)
+		crypt_storage_dmcrypt_io_uring_init(cd, w);
+
 	*cw = w;
 	return 0;
 err:
@@ -241,12 +462,7 @@ err:
 ssize_t crypt_storage_wrapper_read(struct crypt_storage_wrapper *cw,
 		off_t offset, void *buffer, size_t buffer_length)
 {
-	return read_lseek_blockwise(cw->dev_fd,
-			cw->block_size,
-			cw->mem_alignment,
-			buffer,
-			buffer_length,
-			cw->data_offset + offset);
+	return crypt_storage_read(cw, offset, buffer, buffer_length);
 }
 
 ssize_t crypt_storage_wrapper_read_decrypt(struct crypt_storage_wrapper *cw,
@@ -256,23 +472,13 @@ ssize_t crypt_storage_wrapper_read_decrypt(struct crypt_storage_wrapper *cw,
 	ssize_t read;
 
 	if (cw->type == DMCRYPT)
-		return read_lseek_blockwise(cw->u.dm.dmcrypt_fd,
-				cw->block_size,
-				cw->mem_alignment,
-				buffer,
-				buffer_length,
-				offset);
+		return crypt_storage_dmcrypt_read(cw, offset, buffer, buffer_length);
 
-	read = read_lseek_blockwise(cw->dev_fd,
-			cw->block_size,
-			cw->mem_alignment,
-			buffer,
-			buffer_length,
-			cw->data_offset + offset);
+	read = crypt_storage_read(cw, offset, buffer, buffer_length);
 	if (cw->type == NONE || read < 0)
 		return read;
 
-	r = crypt_storage_decrypt(cw->u.cb.s,
+	r = crypt_storage_parallel_decrypt(cw->u.cb.s,
 			cw->u.cb.iv_start + (offset >> SECTOR_SHIFT),
 			read,
 			buffer);
@@ -299,7 +505,7 @@ ssize_t crypt_storage_wrapper_decrypt(struct crypt_storage_wrapper *cw,
 		return 0;
 	}
 
-	r = crypt_storage_decrypt(cw->u.cb.s,
+	r = crypt_storage_parallel_decrypt(cw->u.cb.s,
 			cw->u.cb.iv_start + (offset >> SECTOR_SHIFT),
 			buffer_length,
 			buffer);
@@ -309,40 +515,59 @@ ssize_t crypt_storage_wrapper_decrypt(struct crypt_storage_wrapper *cw,
 	return 0;
 }
 
-ssize_t crypt_storage_wrapper_write(struct crypt_storage_wrapper *cw,
+/*
+ * Decrypt with cw1 and encrypt with cw2 in memory in one pass, no I/O.
+ * Returns -ENOTSUP if any wrapper is dm-crypt backed.
+ */
+int crypt_storage_wrapper_reencrypt(struct crypt_storage_wrapper *cw1,
+		struct crypt_storage_wrapper *cw2,
 		off_t offset, void *buffer, size_t buffer_length)
 {
-	return write_lseek_blockwise(cw->dev_fd,
-			cw->block_size,
-			cw->mem_alignment,
-			buffer,
+	if (cw1->type == DMCRYPT || cw2->type == DMCRYPT)
+		return -ENOTSUP;
+
+	if (cw1->type == NONE && cw2->type == NONE)
+		return 0;
+
+	if (cw1->type == NONE)
+		return crypt_storage_parallel_encrypt(cw2->u.cb.s,
+				cw2->u.cb.iv_start + (offset >> SECTOR_SHIFT),
+				buffer_length,
+				buffer);
+
+	if (cw2->type == NONE)
+		return crypt_storage_parallel_decrypt(cw1->u.cb.s,
+				cw1->u.cb.iv_start + (offset >> SECTOR_SHIFT),
+				buffer_length,
+				buffer);
+
+	return crypt_storage_parallel_reencrypt(cw1->u.cb.s,
+			cw1->u.cb.iv_start + (offset >> SECTOR_SHIFT),
+			cw2->u.cb.s,
+			cw2->u.cb.iv_start + (offset >> SECTOR_SHIFT),
 			buffer_length,
-			cw->data_offset + offset);
+			buffer);
+}
+
+ssize_t crypt_storage_wrapper_write(struct crypt_storage_wrapper *cw,
+		off_t offset, void *buffer, size_t buffer_length)
+{
+	return crypt_storage_write(cw, offset, buffer, buffer_length);
 }
 
 ssize_t crypt_storage_wrapper_encrypt_write(struct crypt_storage_wrapper *cw,
 		off_t offset, void *buffer, size_t buffer_length)
 {
 	if (cw->type == DMCRYPT)
-		return write_lseek_blockwise(cw->u.dm.dmcrypt_fd,
-				cw->block_size,
-				cw->mem_alignment,
-				buffer,
-				buffer_length,
-				offset);
+		return crypt_storage_dmcrypt_write(cw, offset, buffer, buffer_length);
 
 	if (cw->type == USPACE &&
-	    crypt_storage_encrypt(cw->u.cb.s,
+	    crypt_storage_parallel_encrypt(cw->u.cb.s,
 		    cw->u.cb.iv_start + (offset >> SECTOR_SHIFT),
 		    buffer_length, buffer))
 		return -EINVAL;
 
-	return write_lseek_blockwise(cw->dev_fd,
-			cw->block_size,
-			cw->mem_alignment,
-			buffer,
-			buffer_length,
-			cw->data_offset + offset);
+	return crypt_storage_write(cw, offset, buffer, buffer_length);
 }
 
 ssize_t crypt_storage_wrapper_encrypt(struct crypt_storage_wrapper *cw,
@@ -354,7 +579,7 @@ ssize_t crypt_storage_wrapper_encrypt(struct crypt_storage_wrapper *cw,
 	if (cw->type == DMCRYPT)
 		return -ENOTSUP;
 
-	if (crypt_storage_encrypt(cw->u.cb.s,
+	if (crypt_storage_parallel_encrypt(cw->u.cb.s,
 			cw->u.cb.iv_start + (offset >> SECTOR_SHIFT),
 			buffer_length,
 			buffer))
@@ -368,9 +593,14 @@ void crypt_storage_wrapper_destroy(struct crypt_storage_wrapper *cw)
 	if (!cw)
 		return;
 
+	crypt_io_uring_destroy(cw->ring);
+	if (cw->buffered_fd >= 0)
+		close(cw->buffered_fd);
+
 	if (cw->type == USPACE)
-		crypt_storage_destroy(cw->u.cb.s);
+		crypt_storage_parallel_destroy(cw->u.cb.s);
 	if (cw->type == DMCRYPT) {
+		crypt_io_uring_destroy(cw->u.dm.ring);
 		close(cw->u.dm.dmcrypt_fd);
 		dm_remove_device(NULL, cw->u.dm.name, CRYPT_DEACTIVATE_FORCE);
 	}
@@ -378,6 +608,26 @@ void crypt_storage_wrapper_destroy(struct crypt_storage_wrapper *cw)
 	free(cw);
 }
 
+/* Registered buffers avoid page pinning on every io_uring request */
+int crypt_storage_wrapper_register_buffer(struct crypt_storage_wrapper *cw,
+		void *buffer, size_t buffer_length)
+{
+	int r = -ENOTSUP;
+
+	if (!cw)
+		return -ENOTSUP;
+
+	if (cw->ring)
+		r = crypt_io_uring_register_buffer(cw->ring, buffer, buffer_length);
+
+	/* hotzone buffer is also used for reads and writes through dm-crypt mapping */
+	if (cw->type == DMCRYPT && cw->u.dm.ring &&
+	    !crypt_io_uring_register_buffer(cw->u.dm.ring, buffer, buffer_length))
+		r = 0;
+
+	return r;
+}
+
 int crypt_storage_wrapper_datasync(const struct crypt_storage_wrapper *cw)
 {
 	if (!cw)
@@ -385,7 +635,7 @@ int crypt_storage_wrapper_datasync(const struct crypt_storage_wrapper *cw)
 	if (cw->type == DMCRYPT)
 		return fdatasync(cw->u.dm.dmcrypt_fd);
 	else
-		return fdatasync(cw->dev_fd);
+		return fdatasync(crypt_storage_fd(cw));
 }
 
 crypt_storage_wrapper_type crypt_storage_wrapper_get_type(const struct crypt_storage_wrapper *cw)
@@ -35,6 +35,7 @@ struct crypt_device;
 #define DISABLE_DMCRYPT	(1 << 2)
 #define OPEN_READONLY	(1 << 3)
 #define LARGE_IV	(1 << 4)
+#define USE_IO_URING	(1 << 5)
 
 typedef enum {
 	NONE = 0,
@@ -69,6 +70,13 @@ ssize_t crypt_storage_wrapper_encrypt_write(struct crypt_storage_wrapper *cw,
 ssize_t crypt_storage_wrapper_encrypt(struct crypt_storage_wrapper *cw,
 		off_t offset, void *buffer, size_t buffer_length);
 
+int crypt_storage_wrapper_reencrypt(struct crypt_storage_wrapper *cw1,
+		struct crypt_storage_wrapper *cw2,
+		off_t offset, void *buffer, size_t buffer_length);
+
+int crypt_storage_wrapper_register_buffer(struct crypt_storage_wrapper *cw,
+		void *buffer, size_t buffer_length);
+
 int crypt_storage_wrapper_datasync(const struct crypt_storage_wrapper *cw);
 
 crypt_storage_wrapper_type crypt_storage_wrapper_get_type(const struct crypt_storage_wrapper *cw);
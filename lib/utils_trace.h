@@ -0,0 +1,55 @@
+/*
+ * libcryptsetup - static tracepoints (USDT probes)
+ *
+ * Copyright (C) 2023 Red Hat, Inc. All rights reserved.
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this file; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef _UTILS_TRACE_H
+#define _UTILS_TRACE_H
+
+/*
+ * Probes are placed in provider "libcryptsetup", e.g.
+ *   bpftrace -e 'usdt:/usr/lib64/libcryptsetup.so.12:libcryptsetup:pbkdf__done { ... }'
+ * A disabled probe is a single nop; arguments are evaluated only when
+ * a tracer is attached. Without --enable-usdt the macros compile to nothing.
+ *
+ * Probes (name: arguments):
+ *   pbkdf__start: kdf, hash, iterations, memory, parallel
+ *   pbkdf__done: kdf, return code
+ *   keyslot__open__start: keyslot (-1 for parallel unlock), priority
+ *   keyslot__open__done: keyslot (-1 for parallel unlock), return code
+ *   header__read__start: device path
+ *   header__read__done: device path, return code, seqid
+ *   header__write__start: device path, seqid
+ *   header__write__done: device path, return code, seqid
+ *   dm__create__start: name
+ *   dm__create__done: name, return code
+ *   dm__resume__start: name
+ *   dm__resume__done: name, return code
+ *   reencrypt__step__start: offset, length
+ *   reencrypt__step__done: offset, length, status, read_us, protect_us,
+ *     transform_us, write_us, datasync_us, commit_us, suspend_us,
+ *     resume_us, total_us
+ */
+#ifdef ENABLE_USDT
+#include <sys/sdt.h>
+#define CRYPT_TRACE(name, ...)	STAP_PROBEV(libcryptsetup, name, __VA_ARGS__)
+#else
+#define CRYPT_TRACE(name, ...)	do {} while (0)
+#endif
+
+#endif /* _UTILS_TRACE_H */
@@ -20,8 +20,13 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <unistd.h>
 #include <sys/ioctl.h>
 #include <sys/stat.h>
 #include <linux/fs.h>
@@ -32,21 +37,46 @@
 #define BLKZEROOUT _IO(0x12,127)
 #endif
 
-static int wipe_zeroout(struct crypt_device *cd, int devfd,
-			uint64_t offset, uint64_t length)
-{
-	static bool zeroout_available = true;
-	uint64_t range[2] = { offset, length };
-	int r;
+/* Zeroout range per ioctl if device offloads it (WRITE_ZEROES) */
+#define WIPE_ZEROOUT_OFFLOAD_CHUNK (UINT64_C(1) << 30)
 
-	if (!zeroout_available)
-		return -ENOTSUP;
+/*
+ * Zero block device range with BLKZEROOUT. Kernel uses WRITE_ZEROES
+ * (possibly unmapping blocks with guaranteed zeroes) if the device supports
+ * it, otherwise it submits zeroed pages itself. Plain discard is never used,
+ * it does not guarantee reading zeroes back.
+ * Returns -ENOTSUP if nothing was written and the caller should write zeroes.
+ */
+static int wipe_zeroout(struct crypt_device *cd, struct device *device, int devfd,
+			uint64_t *offset, uint64_t dev_size, size_t wipe_block_size,
+			int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+			void *usrptr)
+{
+	uint64_t range[2], step = wipe_block_size, max_bytes, start = *offset;
+
+	/* offloaded to device, large ranges are cheap */
+	max_bytes = device_write_zeroes_max_bytes(device);
+	if (max_bytes && step < WIPE_ZEROOUT_OFFLOAD_CHUNK)
+		step = WIPE_ZEROOUT_OFFLOAD_CHUNK - (WIPE_ZEROOUT_OFFLOAD_CHUNK % wipe_block_size);
+	log_dbg(cd, "Zeroing with BLKZEROOUT in %" PRIu64 " bytes steps%s.", step,
+		max_bytes ? " (write zeroes offload)" : "");
+
+	while (*offset < dev_size) {
+		range[0] = *offset;
+		range[1] = (*offset + step > dev_size) ? dev_size - *offset : step;
+
+		if (ioctl(devfd, BLKZEROOUT, &range) < 0) {
+			if (*offset == start) {
+				log_dbg(cd, "BLKZEROOUT ioctl not available (error %i).", errno);
+				return -ENOTSUP;
+			}
+			log_err(cd, _("Device wipe error, offset %" PRIu64 "."), *offset);
+			return -EIO;
+		}
 
-	r = ioctl(devfd, BLKZEROOUT, &range);
-	if (r < 0) {
-		log_dbg(cd, "BLKZEROOUT ioctl not available (error %i), disabling.", r);
-		zeroout_available = false;
-		return -ENOTSUP;
+		*offset += range[1];
+		if (progress && progress(dev_size, *offset, usrptr))
+			return -EINTR;
 	}
 
 	return 0;
@@ -102,7 +132,7 @@ static int crypt_wipe_special(struct crypt_device *cd, int fd, size_t bsize,
 		if (r < 0)
 			return -EIO;
 
-		written = write_lseek_blockwise(fd, bsize, alignment,
+		written = pwrite_blockwise(fd, bsize, alignment,
 						buffer, size, offset);
 		if (written < 0 || written != (ssize_t)size)
 			return -EIO;
@@ -112,17 +142,38 @@ static int crypt_wipe_special(struct crypt_device *cd, int fd, size_t bsize,
 	if (crypt_random_get(cd, buffer, size, CRYPT_RND_NORMAL) < 0)
 		return -EIO;
 
-	written = write_lseek_blockwise(fd, bsize, alignment, buffer, size, offset);
+	written = pwrite_blockwise(fd, bsize, alignment, buffer, size, offset);
 	if (written < 0 || written != (ssize_t)size)
 		return -EIO;
 
 	return 0;
 }
 
+/*
+ * Random wipe data stream: zeroes encrypted by a random key (seeded once)
+ * with the device offset as IV, so the RNG is not read for every block.
+ * The stream is only overwrite data, never used as key material.
+ */
+static struct crypt_storage *wipe_random_stream_init(struct crypt_device *cd)
+{
+	struct crypt_storage *s = NULL;
+	char key[64];
+
+	if (crypt_random_get(cd, key, sizeof(key), CRYPT_RND_NORMAL))
+		return NULL;
+
+	if (crypt_storage_init(&s, SECTOR_SIZE, "aes", "xts-plain64", key, sizeof(key), false))
+		s = NULL;
+
+	crypt_safe_memzero(key, sizeof(key));
+	log_dbg(cd, "Random wipe data %s.", s ? "generated from seeded AES-XTS stream" : "read from RNG");
+	return s;
+}
+
 static int wipe_block(struct crypt_device *cd, int devfd, crypt_wipe_pattern pattern,
 		      char *sf, size_t device_block_size, size_t alignment,
 		      size_t wipe_block_size, uint64_t offset, bool *need_block_init,
-		      bool blockdev)
+		      struct crypt_storage *rng)
 {
 	int r;
 
@@ -135,6 +186,12 @@ static int wipe_block(struct crypt_device *cd, int devfd, crypt_wipe_pattern pat
 			memset(sf, 0, wipe_block_size);
 			*need_block_init = false;
 			r = 0;
+		} else if ((pattern == CRYPT_WIPE_RANDOM ||
+			    pattern == CRYPT_WIPE_ENCRYPTED_ZERO) && rng) {
+			memset(sf, 0, wipe_block_size);
+			r = crypt_storage_encrypt(rng, offset >> SECTOR_SHIFT,
+						  wipe_block_size, sf) ? -EIO : 0;
+			*need_block_init = true;
 		} else if (pattern == CRYPT_WIPE_RANDOM ||
 			   pattern == CRYPT_WIPE_ENCRYPTED_ZERO) {
 			r = crypt_random_get(cd, sf, wipe_block_size,
@@ -147,16 +204,6 @@ static int wipe_block(struct crypt_device *cd, int devfd, crypt_wipe_pattern pat
 			return r;
 	}
 
-	if (blockdev && pattern == CRYPT_WIPE_ZERO &&
-	    !wipe_zeroout(cd, devfd, offset, wipe_block_size)) {
-		/* zeroout ioctl does not move offset */
-		if (lseek(devfd, offset + wipe_block_size, SEEK_SET) < 0) {
-			log_err(cd, _("Cannot seek to device offset."));
-			return -EINVAL;
-		}
-		return 0;
-	}
-
 	if (write_blockwise(devfd, device_block_size, alignment, sf,
 			    wipe_block_size) == (ssize_t)wipe_block_size)
 		return 0;
@@ -164,14 +211,233 @@ static int wipe_block(struct crypt_device *cd, int devfd, crypt_wipe_pattern pat
 	return -EIO;
 }
 
-int crypt_wipe_device(struct crypt_device *cd,
+struct wipe_write {
+	pthread_t thread;
+	int devfd;
+	const char *buffer;
+	size_t length;
+	uint64_t offset;
+	int r;
+};
+
+static int wipe_pwrite(int devfd, const char *buffer, size_t length, uint64_t offset)
+{
+	ssize_t written;
+	size_t done = 0;
+
+	while (done < length) {
+		written = pwrite(devfd, buffer + done, length - done, offset + done);
+		if (written < 0 && errno == EINTR)
+			continue;
+		if (written <= 0)
+			return -EIO;
+		done += written;
+	}
+
+	return 0;
+}
+
+static void *wipe_write_thread(void *arg)
+{
+	struct wipe_write *w = arg;
+
+	w->r = wipe_pwrite(w->devfd, w->buffer, w->length, w->offset);
+	return NULL;
+}
+
+struct wipe_range_state {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	uint64_t done;
+	unsigned running;
+	bool stop;
+};
+
+struct wipe_range {
+	pthread_t thread;
+	struct wipe_range_state *state;
+	int devfd;
+	const char *buffer;
+	size_t block;
+	uint64_t offset, end;
+	int r;
+};
+
+/* Write the same (zeroed) buffer over the whole range, stop on request. */
+static void *wipe_range_thread(void *arg)
+{
+	struct wipe_range *w = arg;
+	struct wipe_range_state *s = w->state;
+	size_t length;
+	bool stop = false;
+
+	w->r = 0;
+	while (w->offset < w->end && !stop) {
+		length = (w->end - w->offset < w->block) ? w->end - w->offset : w->block;
+		w->r = wipe_pwrite(w->devfd, w->buffer, length, w->offset);
+		if (w->r)
+			break;
+		w->offset += length;
+
+		pthread_mutex_lock(&s->lock);
+		s->done += length;
+		stop = s->stop;
+		pthread_cond_signal(&s->cond);
+		pthread_mutex_unlock(&s->lock);
+	}
+
+	pthread_mutex_lock(&s->lock);
+	if (w->r)
+		s->stop = true;
+	s->running--;
+	pthread_cond_signal(&s->cond);
+	pthread_mutex_unlock(&s->lock);
+	return NULL;
+}
+
+/*
+ * Split the device into @depth ranges, each written by its own thread from
+ * its own buffer. Stacked targets (dm-integrity, dm-crypt) then get several
+ * independent submitters and can process them on more CPUs. Only for zero
+ * pattern, buffer content does not depend on offset.
+ * Offsets and block size must be aligned to device block size.
+ */
+static int wipe_ranges(struct crypt_device *cd, int devfd, char **buffers, unsigned depth,
+		       size_t wipe_block_size, uint64_t offset, uint64_t dev_size,
+		       int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+		       void *usrptr)
+{
+	struct wipe_range w[CRYPT_WIPE_QUEUE_DEPTH_MAX];
+	struct wipe_range_state s = {
+		.lock = PTHREAD_MUTEX_INITIALIZER,
+		.cond = PTHREAD_COND_INITIALIZER,
+	};
+	uint64_t range, start = offset, done;
+	unsigned i, n, started;
+	int r = 0;
+
+	range = (dev_size - offset + depth - 1) / depth;
+	range = (range + wipe_block_size - 1) / wipe_block_size * wipe_block_size;
+
+	for (n = 0; n < depth && offset < dev_size; n++) {
+		memset(buffers[n], 0, wipe_block_size);
+		w[n].state = &s;
+		w[n].devfd = devfd;
+		w[n].buffer = buffers[n];
+		w[n].block = wipe_block_size;
+		w[n].offset = offset;
+		w[n].end = (offset + range > dev_size) ? dev_size : offset + range;
+		offset = w[n].end;
+	}
+	log_dbg(cd, "Wiping in %u ranges of %" PRIu64 " bytes.", n, range);
+
+	s.running = n;
+	for (started = 0; started < n; started++)
+		if (pthread_create(&w[started].thread, NULL, wipe_range_thread, &w[started]))
+			break;
+	/* thread creation failed, write the rest here */
+	for (i = started; i < n; i++)
+		wipe_range_thread(&w[i]);
+
+	pthread_mutex_lock(&s.lock);
+	while (s.running) {
+		pthread_cond_wait(&s.cond, &s.lock);
+		done = s.done;
+		if (progress && !s.stop) {
+			pthread_mutex_unlock(&s.lock);
+			if (progress(dev_size, start + done, usrptr))
+				r = -EINTR;
+			pthread_mutex_lock(&s.lock);
+			if (r)
+				s.stop = true;
+		}
+	}
+	pthread_mutex_unlock(&s.lock);
+
+	for (i = 0; i < started; i++)
+		pthread_join(w[i].thread, NULL);
+
+	for (i = 0; i < n; i++) {
+		if (w[i].r) {
+			log_err(cd, _("Device wipe error, offset %" PRIu64 "."), w[i].offset);
+			return w[i].r;
+		}
+	}
+
+	return r;
+}
+
+/*
+ * Keep up to @depth block writes in flight. Buffers are filled in the calling
+ * thread (random stream is sequential), only the writes run in threads.
+ * Offsets and block size must be aligned to device block size.
+ */
+static int wipe_parallel(struct crypt_device *cd, int devfd, crypt_wipe_pattern pattern,
+			 char **buffers, unsigned depth, size_t wipe_block_size,
+			 uint64_t *offset, uint64_t dev_size, struct crypt_storage *rng,
+			 int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+			 void *usrptr)
+{
+	struct wipe_write w[CRYPT_WIPE_QUEUE_DEPTH_MAX];
+	bool zero_init = false;
+	unsigned i, n, started;
+	int r = 0;
+
+	while (*offset < dev_size && !r) {
+		for (n = 0; n < depth && *offset + n * (uint64_t)wipe_block_size < dev_size; n++) {
+			w[n].devfd = devfd;
+			w[n].buffer = buffers[n];
+			w[n].offset = *offset + n * (uint64_t)wipe_block_size;
+			w[n].length = wipe_block_size;
+			if (w[n].offset + w[n].length > dev_size)
+				w[n].length = dev_size - w[n].offset;
+
+			if (pattern == CRYPT_WIPE_ZERO) {
+				if (!zero_init)
+					memset(buffers[n], 0, wipe_block_size);
+			} else if (rng) {
+				memset(buffers[n], 0, w[n].length);
+				r = crypt_storage_encrypt(rng, w[n].offset >> SECTOR_SHIFT, w[n].length, buffers[n]);
+			} else
+				r = crypt_random_get(cd, buffers[n], w[n].length, CRYPT_RND_NORMAL);
+			if (r)
+				return -EIO;
+		}
+		zero_init = (pattern == CRYPT_WIPE_ZERO);
+
+		for (started = 0; started < n; started++)
+			if (pthread_create(&w[started].thread, NULL, wipe_write_thread, &w[started]))
+				break;
+		/* thread creation failed, write the rest here */
+		for (i = started; i < n; i++)
+			wipe_write_thread(&w[i]);
+		for (i = 0; i < started; i++)
+			pthread_join(w[i].thread, NULL);
+
+		for (i = 0; i < n; i++) {
+			if (w[i].r) {
+				log_err(cd, _("Device wipe error, offset %" PRIu64 "."), w[i].offset);
+				return w[i].r;
+			}
+			*offset += w[i].length;
+		}
+
+		if (progress && progress(dev_size, *offset, usrptr))
+			r = -EINTR;
+	}
+
+	return r;
+}
+
+static int wipe_device(struct crypt_device *cd,
 	struct device *device,
 	crypt_wipe_pattern pattern,
 	uint64_t offset,
 	uint64_t length,
 	size_t wipe_block_size,
 	int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
-	void *usrptr)
+	void *usrptr,
+	bool sync)
 {
 	int r, devfd;
 	struct stat st;
@@ -179,6 +445,9 @@ int crypt_wipe_device(struct crypt_device *cd,
 	char *sf = NULL;
 	uint64_t dev_size;
 	bool need_block_init = true;
+	struct crypt_storage *rng = NULL;
+	char *buffers[CRYPT_WIPE_QUEUE_DEPTH_MAX] = {};
+	unsigned i, depth;
 
 	/* Note: LUKS1 calls it with wipe_block not aligned to multiple of bsize */
 	bsize = device_block_size(cd, device);
@@ -220,6 +489,7 @@ int crypt_wipe_device(struct crypt_device *cd,
 	r = posix_memalign((void **)&sf, alignment, wipe_block_size);
 	if (r)
 		goto out;
+	crypt_numa_bind_buffer(sf, wipe_block_size, crypt_dev_numa_node(device_path(device)));
 
 	if (lseek(devfd, offset, SEEK_SET) < 0) {
 		log_err(cd, _("Cannot seek to device offset."));
@@ -237,12 +507,64 @@ int crypt_wipe_device(struct crypt_device *cd,
 		pattern = CRYPT_WIPE_RANDOM;
 	}
 
+	depth = crypt_get_wipe_queue_depth(cd);
+
+	/*
+	 * Without write zeroes offload the kernel submits zeroed pages for
+	 * each ioctl and waits, several writer threads are faster then.
+	 */
+	if (pattern == CRYPT_WIPE_ZERO && S_ISBLK(st.st_mode) &&
+	    (depth <= 1 || device_write_zeroes_max_bytes(device))) {
+		r = wipe_zeroout(cd, device, devfd, &offset, dev_size, wipe_block_size, progress, usrptr);
+		if (r != -ENOTSUP) {
+			if (sync)
+				device_sync(cd, device);
+			goto out;
+		}
+		/* zeroout ioctl does not move offset */
+		if (lseek(devfd, offset, SEEK_SET) < 0) {
+			log_err(cd, _("Cannot seek to device offset."));
+			r = -EINVAL;
+			goto out;
+		}
+	}
+
+	/* a single block is not worth the cipher setup */
+	if ((pattern == CRYPT_WIPE_RANDOM || pattern == CRYPT_WIPE_ENCRYPTED_ZERO) &&
+	    dev_size - offset > wipe_block_size)
+		rng = wipe_random_stream_init(cd);
+
+	if (depth > 1 && pattern != CRYPT_WIPE_SPECIAL &&
+	    !(wipe_block_size % bsize) && !(offset % bsize) && !(dev_size % bsize) &&
+	    dev_size - offset > wipe_block_size) {
+		for (i = 1; i < depth; i++) {
+			if (posix_memalign((void **)&buffers[i], alignment, wipe_block_size))
+				break;
+			crypt_numa_bind_buffer(buffers[i], wipe_block_size, crypt_dev_numa_node(device_path(device)));
+		}
+		buffers[0] = sf;
+		log_dbg(cd, "Wiping with %u writes in flight.", i);
+		if (i > 1 && pattern == CRYPT_WIPE_ZERO) {
+			r = wipe_ranges(cd, devfd, buffers, i, wipe_block_size,
+					offset, dev_size, progress, usrptr);
+			if (sync)
+				device_sync(cd, device);
+			goto out;
+		} else if (i > 1) {
+			r = wipe_parallel(cd, devfd, pattern, buffers, i, wipe_block_size,
+					  &offset, dev_size, rng, progress, usrptr);
+			if (sync)
+				device_sync(cd, device);
+			goto out;
+		}
+	}
+
 	while (offset < dev_size) {
 		if ((offset + wipe_block_size) > dev_size)
 			wipe_block_size = dev_size - offset;
 
 		r = wipe_block(cd, devfd, pattern, sf, bsize, alignment,
-			       wipe_block_size, offset, &need_block_init, S_ISBLK(st.st_mode));
+			       wipe_block_size, offset, &need_block_init, rng);
 		if (r) {
 			log_err(cd,_("Device wipe error, offset %" PRIu64 "."), offset);
 			break;
@@ -256,12 +578,207 @@ int crypt_wipe_device(struct crypt_device *cd,
 		}
 	}
 
-	device_sync(cd, device);
+	if (sync)
+		device_sync(cd, device);
 out:
+	for (i = 1; i < CRYPT_WIPE_QUEUE_DEPTH_MAX; i++)
+		free(buffers[i]);
+	crypt_storage_destroy(rng);
 	free(sf);
 	return r;
 }
 
+int crypt_wipe_device(struct crypt_device *cd,
+	struct device *device,
+	crypt_wipe_pattern pattern,
+	uint64_t offset,
+	uint64_t length,
+	size_t wipe_block_size,
+	int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+	void *usrptr)
+{
+	return wipe_device(cd, device, pattern, offset, length, wipe_block_size,
+			   progress, usrptr, true);
+}
+
+/*
+ * Wipe several areas (extents) of the device in one pass, the device
+ * is synced only once at the end. Areas must not overlap.
+ */
+int crypt_wipe_device_areas(struct crypt_device *cd,
+	struct device *device,
+	const struct crypt_wipe_area *areas,
+	unsigned count,
+	size_t wipe_block_size)
+{
+	unsigned i;
+	int r = 0;
+
+	for (i = 0; i < count && !r; i++) {
+		if (!areas[i].length)
+			continue;
+		log_dbg(cd, "Wiping area 0x%06" PRIx64 " - 0x%06" PRIx64 " (pattern %u).",
+			areas[i].offset, areas[i].offset + areas[i].length, (unsigned)areas[i].pattern);
+		r = wipe_device(cd, device, areas[i].pattern, areas[i].offset, areas[i].length,
+				wipe_block_size, NULL, NULL, false);
+	}
+
+	device_sync(cd, device);
+	return r;
+}
+
+/* Synced chunk of device between checkpoint updates */
+#define WIPE_CHECKPOINT_CHUNK (UINT64_C(1) << 30)
+#define WIPE_CHECKPOINT_MAX 1024
+
+struct wipe_checkpoint_progress {
+	uint64_t size;
+	int (*progress)(uint64_t size, uint64_t offset, void *usrptr);
+	void *usrptr;
+	bool interrupted;
+};
+
+static int wipe_checkpoint_progress(uint64_t size __attribute__((unused)),
+				    uint64_t offset, void *usrptr)
+{
+	struct wipe_checkpoint_progress *p = usrptr;
+
+	if (p->progress && p->progress(p->size, offset, p->usrptr))
+		p->interrupted = true;
+
+	return p->interrupted ? 1 : 0;
+}
+
+static int wipe_checkpoint_id(struct device *device, crypt_wipe_pattern pattern,
+			      uint64_t offset, uint64_t end, size_t wipe_block_size,
+			      char *id, size_t id_size)
+{
+	int r;
+
+	r = snprintf(id, id_size, "cryptsetup-wipe 1\ndevice %s\npattern %u\n"
+		     "range %" PRIu64 " %" PRIu64 "\nblock %zu\n", device_path(device),
+		     (unsigned)pattern, offset, end, wipe_block_size);
+
+	return (r < 0 || (size_t)r >= id_size) ? -EINVAL : 0;
+}
+
+/* Returns offset recorded for the same wipe, 0 if there is none. */
+static uint64_t wipe_checkpoint_read(struct crypt_device *cd, const char *path,
+				     const char *id, uint64_t offset, uint64_t end)
+{
+	char buf[WIPE_CHECKPOINT_MAX];
+	size_t id_len = strlen(id);
+	uint64_t done;
+	ssize_t len;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+	if (fd < 0)
+		return 0;
+	len = read_buffer(fd, buf, sizeof(buf) - 1);
+	close(fd);
+	if (len < 0)
+		return 0;
+	buf[len] = '\0';
+
+	if ((size_t)len <= id_len || strncmp(buf, id, id_len) ||
+	    sscanf(buf + id_len, "done %" SCNu64 "\n", &done) != 1 ||
+	    done <= offset || done > end || MISALIGNED_512(done)) {
+		log_dbg(cd, "Wipe checkpoint %s does not match this wipe, ignored.", path);
+		return 0;
+	}
+
+	return done;
+}
+
+static int wipe_checkpoint_write(struct crypt_device *cd, const char *path,
+				 const char *id, uint64_t done)
+{
+	char buf[WIPE_CHECKPOINT_MAX], tmp[PATH_MAX];
+	int fd, len, r;
+
+	len = snprintf(buf, sizeof(buf), "%sdone %" PRIu64 "\n", id, done);
+	if (len < 0 || (size_t)len >= sizeof(buf))
+		return -EINVAL;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) < 0)
+		return -EINVAL;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW, S_IRUSR | S_IWUSR);
+	if (fd < 0)
+		return -errno;
+
+	r = (write_buffer(fd, buf, len) != len || fsync(fd) < 0) ? -EIO : 0;
+	if (close(fd) < 0 || r || rename(tmp, path) < 0) {
+		unlink(tmp);
+		return -EIO;
+	}
+
+	log_dbg(cd, "Wipe checkpoint at offset %" PRIu64 " stored.", done);
+	return 0;
+}
+
+/*
+ * Wipe in synced chunks and record the end of each chunk, so everything
+ * up to the recorded offset is on the device if the wipe is interrupted.
+ */
+static int wipe_checkpointed(struct crypt_device *cd, struct device *device,
+			     const char *path, crypt_wipe_pattern pattern,
+			     uint64_t offset, uint64_t length, size_t wipe_block_size,
+			     int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
+			     void *usrptr)
+{
+	struct wipe_checkpoint_progress p = {
+		.progress = progress,
+		.usrptr = usrptr,
+	};
+	char id[WIPE_CHECKPOINT_MAX];
+	uint64_t end, chunk_end, done;
+	int r;
+
+	if (length)
+		end = offset + length;
+	else {
+		r = device_size(device, &end);
+		if (r)
+			return r;
+		if (end <= offset)
+			return -EINVAL;
+	}
+	p.size = end;
+
+	r = wipe_checkpoint_id(device, pattern, offset, end, wipe_block_size, id, sizeof(id));
+	if (r)
+		return r;
+
+	done = wipe_checkpoint_read(cd, path, id, offset, end);
+	if (done) {
+		log_verbose(cd, _("Resuming wipe of device %s at offset %" PRIu64 "."),
+			    device_path(device), done);
+		offset = done;
+	}
+
+	while (offset < end) {
+		chunk_end = (end - offset > WIPE_CHECKPOINT_CHUNK) ? offset + WIPE_CHECKPOINT_CHUNK : end;
+
+		r = crypt_wipe_device(cd, device, pattern, offset, chunk_end - offset,
+				      wipe_block_size, wipe_checkpoint_progress, &p);
+		if (p.interrupted)
+			r = -EINTR;
+		if (r)
+			return r;
+
+		offset = chunk_end;
+		if (offset < end && wipe_checkpoint_write(cd, path, id, offset))
+			log_dbg(cd, "Cannot store wipe checkpoint %s.", path);
+	}
+
+	if (unlink(path) < 0 && errno != ENOENT)
+		log_dbg(cd, "Cannot remove wipe checkpoint %s.", path);
+
+	return 0;
+}
+
 int crypt_wipe(struct crypt_device *cd,
 	const char *dev_path,
 	crypt_wipe_pattern pattern,
@@ -272,6 +789,7 @@ int crypt_wipe(struct crypt_device *cd,
 	int (*progress)(uint64_t size, uint64_t offset, void *usrptr),
 	void *usrptr)
 {
+	struct crypt_progress_throttle pt;
 	struct device *device;
 	int r;
 
@@ -282,6 +800,12 @@ int crypt_wipe(struct crypt_device *cd,
 	if (r < 0)
 		return r;
 
+	if (progress) {
+		crypt_progress_init(cd, &pt, progress, usrptr);
+		progress = crypt_progress_throttled;
+		usrptr = &pt;
+	}
+
 	if (!dev_path)
 		device = crypt_data_device(cd);
 	else {
@@ -301,8 +825,12 @@ int crypt_wipe(struct crypt_device *cd,
 	log_dbg(cd, "Wipe [%u] device %s, offset %" PRIu64 ", length %" PRIu64 ", block %zu.",
 		(unsigned)pattern, device_path(device), offset, length, wipe_block_size);
 
-	r = crypt_wipe_device(cd, device, pattern, offset, length,
-			      wipe_block_size, progress, usrptr);
+	if (crypt_get_wipe_checkpoint(cd))
+		r = wipe_checkpointed(cd, device, crypt_get_wipe_checkpoint(cd), pattern,
+				      offset, length, wipe_block_size, progress, usrptr);
+	else
+		r = crypt_wipe_device(cd, device, pattern, offset, length,
+				      wipe_block_size, progress, usrptr);
 
 	if (dev_path)
 		device_free(cd, device);
@@ -23,6 +23,8 @@
 #ifndef _LIBFEC_RS_H
 #define _LIBFEC_RS_H
 
+#include <stddef.h>
+
 /* Special reserved value encoding zero in index form. */
 #define A0 (rs->nn)
 
@@ -58,6 +60,10 @@ void free_rs_char(struct rs *rs);
 
 /* General purpose RS codec, 8-bit symbols */
 void encode_rs_char(struct rs *rs, data_t *data, data_t *parity);
+void encode_rs_char_columns(struct rs *rs, const data_t *data, size_t stride,
+			    size_t count, data_t *parity);
+void encode_rs_char_update(struct rs *rs, const data_t *data, size_t count,
+			   data_t *parity, size_t plane);
 int decode_rs_char(struct rs *rs, data_t *data);
 
 #endif
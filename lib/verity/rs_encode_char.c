@@ -25,6 +25,11 @@
 
 #include "rs.h"
 
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+#define RS_SIMD_X86 1
+#include <immintrin.h>
+#endif
+
 /* Initialize a Reed-Solomon codec
  * symsize = symbol size, bits
  * gfpoly = Field generator polynomial coefficients
@@ -171,3 +176,178 @@ void encode_rs_char(struct rs *rs, data_t *data, data_t *parity)
 			parity[rs->nroots - 1] = 0;
 	}
 }
+
+/*
+ * Encode count codewords stored column-wise: symbol i of codeword k is
+ * data[i * stride + k], parity of codeword k is stored at parity[k * nroots].
+ * Only the full (unpadded) 8-bit code is vectorized.
+ */
+#ifdef RS_SIMD_X86
+#define RS_SIMD_WIDTH 32
+#define RS_SIMD_MAX_ROOTS 32
+
+static data_t gf_mul(struct rs *rs, data_t a, data_t b)
+{
+	if (!a || !b)
+		return 0;
+	return rs->alpha_to[modnn(rs, rs->index_of[a] + rs->index_of[b])];
+}
+
+/* multiply every byte by a constant: low and high nibble lookup (PSHUFB) */
+__attribute__((target("avx2")))
+static inline __m256i gf_mul_avx2(__m256i v, __m256i lo, __m256i hi, __m256i mask)
+{
+	return _mm256_xor_si256(_mm256_shuffle_epi8(lo, _mm256_and_si256(v, mask)),
+				_mm256_shuffle_epi8(hi, _mm256_and_si256(_mm256_srli_epi64(v, 4), mask)));
+}
+
+__attribute__((target("avx2")))
+static size_t encode_rs_char_avx2(struct rs *rs, const data_t *data, size_t stride,
+				  size_t count, data_t *parity)
+{
+	data_t tab[2][16] __attribute__((aligned(16)));
+	__m256i lo[RS_SIMD_MAX_ROOTS], hi[RS_SIMD_MAX_ROOTS], p[RS_SIMD_MAX_ROOTS], fb;
+	__m256i mask = _mm256_set1_epi8(0x0f);
+	data_t out[RS_SIMD_MAX_ROOTS][RS_SIMD_WIDTH] __attribute__((aligned(32)));
+	int i, j, n = rs->nn - rs->nroots, nroots = rs->nroots;
+	size_t k, c;
+
+	/* tables for multiplication by genpoly coefficients (stored in index form) */
+	for (j = 0; j < nroots; j++) {
+		for (i = 0; i < 16; i++) {
+			tab[0][i] = gf_mul(rs, rs->alpha_to[rs->genpoly[j]], i);
+			tab[1][i] = gf_mul(rs, rs->alpha_to[rs->genpoly[j]], i << 4);
+		}
+		lo[j] = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)tab[0]));
+		hi[j] = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)tab[1]));
+	}
+
+	for (k = 0; k + RS_SIMD_WIDTH <= count; k += RS_SIMD_WIDTH) {
+		for (j = 0; j < nroots; j++)
+			p[j] = _mm256_setzero_si256();
+
+		/* LFSR over RS_SIMD_WIDTH codewords at once */
+		for (i = 0; i < n; i++) {
+			fb = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&data[i * stride + k]), p[0]);
+			for (j = 0; j < nroots - 1; j++)
+				p[j] = _mm256_xor_si256(p[j + 1], gf_mul_avx2(fb, lo[nroots - 1 - j], hi[nroots - 1 - j], mask));
+			p[nroots - 1] = gf_mul_avx2(fb, lo[0], hi[0], mask);
+		}
+
+		for (j = 0; j < nroots; j++)
+			_mm256_store_si256((__m256i *)out[j], p[j]);
+		for (c = 0; c < RS_SIMD_WIDTH; c++)
+			for (j = 0; j < nroots; j++)
+				parity[(k + c) * nroots + j] = out[j][c];
+	}
+
+	return k;
+}
+
+static size_t encode_rs_char_simd(struct rs *rs, const data_t *data, size_t stride,
+				  size_t count, data_t *parity)
+{
+	if (rs->mm != 8 || rs->pad || rs->nroots < 1 || rs->nroots > RS_SIMD_MAX_ROOTS ||
+	    !__builtin_cpu_supports("avx2"))
+		return 0;
+
+	return encode_rs_char_avx2(rs, data, stride, count, parity);
+}
+
+/* one LFSR step of RS_SIMD_WIDTH codewords at once, parity stays in memory */
+__attribute__((target("avx2")))
+static size_t encode_rs_char_update_avx2(struct rs *rs, const data_t *data, size_t count,
+					 data_t *parity, size_t plane)
+{
+	data_t tab[2][16] __attribute__((aligned(16)));
+	__m256i lo[RS_SIMD_MAX_ROOTS], hi[RS_SIMD_MAX_ROOTS], fb;
+	__m256i mask = _mm256_set1_epi8(0x0f);
+	int i, j, nroots = rs->nroots;
+	size_t k;
+
+	for (j = 0; j < nroots; j++) {
+		for (i = 0; i < 16; i++) {
+			tab[0][i] = gf_mul(rs, rs->alpha_to[rs->genpoly[j]], i);
+			tab[1][i] = gf_mul(rs, rs->alpha_to[rs->genpoly[j]], i << 4);
+		}
+		lo[j] = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)tab[0]));
+		hi[j] = _mm256_broadcastsi128_si256(_mm_load_si128((const __m128i *)tab[1]));
+	}
+
+	for (k = 0; k + RS_SIMD_WIDTH <= count; k += RS_SIMD_WIDTH) {
+		fb = _mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&data[k]),
+				      _mm256_loadu_si256((const __m256i *)&parity[k]));
+		for (j = 0; j < nroots - 1; j++)
+			_mm256_storeu_si256((__m256i *)&parity[j * plane + k],
+				_mm256_xor_si256(_mm256_loadu_si256((const __m256i *)&parity[(j + 1) * plane + k]),
+						 gf_mul_avx2(fb, lo[nroots - 1 - j], hi[nroots - 1 - j], mask)));
+		_mm256_storeu_si256((__m256i *)&parity[(nroots - 1) * plane + k],
+				    gf_mul_avx2(fb, lo[0], hi[0], mask));
+	}
+
+	return k;
+}
+
+static size_t encode_rs_char_update_simd(struct rs *rs, const data_t *data, size_t count,
+					 data_t *parity, size_t plane)
+{
+	if (rs->mm != 8 || rs->pad || rs->nroots < 1 || rs->nroots > RS_SIMD_MAX_ROOTS ||
+	    !__builtin_cpu_supports("avx2"))
+		return 0;
+
+	return encode_rs_char_update_avx2(rs, data, count, parity, plane);
+}
+#else
+static size_t encode_rs_char_simd(struct rs *rs, const data_t *data, size_t stride,
+				  size_t count, data_t *parity)
+{
+	(void)rs; (void)data; (void)stride; (void)count; (void)parity;
+	return 0;
+}
+
+static size_t encode_rs_char_update_simd(struct rs *rs, const data_t *data, size_t count,
+					 data_t *parity, size_t plane)
+{
+	(void)rs; (void)data; (void)count; (void)parity; (void)plane;
+	return 0;
+}
+#endif
+
+void encode_rs_char_columns(struct rs *rs, const data_t *data, size_t stride,
+			    size_t count, data_t *parity)
+{
+	data_t block[256];
+	size_t k;
+	int i, n = rs->nn - rs->nroots - rs->pad;
+
+	/* remaining (or all) codewords, one by one */
+	for (k = encode_rs_char_simd(rs, data, stride, count, parity); k < count; k++) {
+		for (i = 0; i < n; i++)
+			block[i] = data[i * stride + k];
+		encode_rs_char(rs, block, &parity[k * rs->nroots]);
+	}
+}
+
+/*
+ * Feed the next symbol data[k] into each of count codewords encoded
+ * incrementally. Parity symbol j of codeword k is kept at
+ * parity[j * plane + k] and must be zeroed before the first symbol.
+ */
+void encode_rs_char_update(struct rs *rs, const data_t *data, size_t count,
+			   data_t *parity, size_t plane)
+{
+	size_t k;
+	int j;
+	data_t feedback;
+
+	for (k = encode_rs_char_update_simd(rs, data, count, parity, plane); k < count; k++) {
+		feedback = rs->index_of[data[k] ^ parity[k]];
+		for (j = 0; j < rs->nroots - 1; j++) {
+			parity[j * plane + k] = parity[(j + 1) * plane + k];
+			if (feedback != A0)
+				parity[j * plane + k] ^= rs->alpha_to[modnn(rs, feedback + rs->genpoly[rs->nroots - 1 - j])];
+		}
+		parity[(rs->nroots - 1) * plane + k] = feedback != A0 ?
+			rs->alpha_to[modnn(rs, feedback + rs->genpoly[0])] : 0;
+	}
+}
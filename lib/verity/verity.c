@@ -24,6 +24,9 @@
 #include <string.h>
 #include <stdint.h>
 #include <ctype.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <uuid/uuid.h>
@@ -81,7 +84,7 @@ int VERITY_read_sb(struct crypt_device *cd,
 		return -EINVAL;
 	}
 
-	if (read_lseek_blockwise(devfd, device_block_size(cd, device),
+	if (pread_blockwise(devfd, device_block_size(cd, device),
 				 device_alignment(device), &sb, hdr_size,
 				 sb_offset) < hdr_size)
 		return -EIO;
@@ -214,7 +217,7 @@ int VERITY_write_sb(struct crypt_device *cd,
 	memcpy(sb.salt, params->salt, params->salt_size);
 	memcpy(sb.uuid, uuid, sizeof(sb.uuid));
 
-	r = write_lseek_blockwise(devfd, block_size, device_alignment(device),
+	r = pwrite_blockwise(devfd, block_size, device_alignment(device),
 				  (char*)&sb, hdr_size, sb_offset) < hdr_size ? -EIO : 0;
 	if (r)
 		log_err(cd, _("Error during update of verity header on device %s."),
@@ -251,6 +254,45 @@ int VERITY_UUID_generate(char **uuid_string)
 	return 0;
 }
 
+/*
+ * dm-verity reads hash blocks on demand, serially from the root for each
+ * first access. Reading one data block per area covered by a level 1 hash
+ * block through the active device makes the kernel load all upper levels
+ * (everything except the large bottom level). Readahead is asynchronous,
+ * activation does not wait for it.
+ */
+static void VERITY_prefetch(struct crypt_device *cd, const char *name,
+			    struct crypt_params_verity *verity_hdr)
+{
+	char path[PATH_MAX];
+	uint64_t block, span, hash_per_block = 1, reads = 0;
+	int digest_size, fd;
+
+	digest_size = crypt_hash_size(verity_hdr->hash_name);
+	if (digest_size <= 0 || !verity_hdr->data_size)
+		return;
+
+	while (hash_per_block * 2 <= verity_hdr->hash_block_size / digest_size)
+		hash_per_block *= 2;
+	span = hash_per_block * hash_per_block;
+
+	if (snprintf(path, sizeof(path), "%s/%s", dm_get_dir(), name) < 0)
+		return;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		log_dbg(cd, "Cannot open %s for hash prefetch.", path);
+		return;
+	}
+
+	for (block = 0; block < verity_hdr->data_size; block += span, reads++)
+		(void)posix_fadvise(fd, (off_t)(block * verity_hdr->data_block_size),
+				    verity_hdr->data_block_size, POSIX_FADV_WILLNEED);
+
+	log_dbg(cd, "Requested readahead of %" PRIu64 " block(s) to prefetch hash tree.", reads);
+	close(fd);
+}
+
 /* Activate verity device in kernel device-mapper */
 int VERITY_activate(struct crypt_device *cd,
 		     const char *name,
@@ -259,6 +301,7 @@ int VERITY_activate(struct crypt_device *cd,
 		     const char *signature_description,
 		     struct device *fec_device,
 		     struct crypt_params_verity *verity_hdr,
+		     const char *verify_cache,
 		     uint32_t activation_flags)
 {
 	uint32_t dmv_flags;
@@ -273,7 +316,8 @@ int VERITY_activate(struct crypt_device *cd,
 	log_dbg(cd, "Trying to activate VERITY device %s using hash %s.",
 		name ?: "[none]", verity_hdr->hash_name);
 
-	if (verity_hdr->flags & CRYPT_VERITY_CHECK_HASH) {
+	if ((verity_hdr->flags & CRYPT_VERITY_CHECK_HASH) &&
+	    !VERITY_cache_check(cd, verity_hdr, root_hash, root_hash_size, verify_cache)) {
 		if (signature_description) {
 			log_err(cd, _("Root hash signature verification is not supported."));
 			return -EINVAL;
@@ -281,6 +325,8 @@ int VERITY_activate(struct crypt_device *cd,
 
 		log_dbg(cd, "Verification of data in userspace required.");
 		r = VERITY_verify(cd, verity_hdr, root_hash, root_hash_size);
+		if (!r)
+			VERITY_cache_store(cd, verity_hdr, root_hash, root_hash_size, verify_cache);
 
 		if ((r == -EPERM || r == -EFAULT) && fec_device) {
 			v = r;
@@ -348,6 +394,8 @@ int VERITY_activate(struct crypt_device *cd,
 
 	if (!r)
 		log_err(cd, _("Verity device detected corruption after activation."));
+	else if (verity_hdr->flags & CRYPT_VERITY_PREFETCH_HASH)
+		VERITY_prefetch(cd, name, verity_hdr);
 
 	r = 0;
 out:
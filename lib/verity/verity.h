@@ -30,6 +30,8 @@
 
 struct crypt_device;
 struct crypt_params_verity;
+struct crypt_verity_range;
+struct crypt_verity_report;
 struct device;
 
 int VERITY_read_sb(struct crypt_device *cd,
@@ -49,6 +51,7 @@ int VERITY_activate(struct crypt_device *cd,
 		     const char *signature_description,
 		     struct device *fec_device,
 		     struct crypt_params_verity *verity_hdr,
+		     const char *verify_cache,
 		     uint32_t activation_flags);
 
 int VERITY_verify(struct crypt_device *cd,
@@ -58,19 +61,55 @@ int VERITY_verify(struct crypt_device *cd,
 
 int VERITY_create(struct crypt_device *cd,
 		  struct crypt_params_verity *verity_hdr,
+		  struct device *fec_device,
 		  const char *root_hash,
 		  size_t root_hash_size);
 
+int VERITY_cache_check(struct crypt_device *cd, struct crypt_params_verity *params,
+		       const char *root_hash, size_t root_hash_size, const char *cache_dir);
+void VERITY_cache_store(struct crypt_device *cd, struct crypt_params_verity *params,
+			const char *root_hash, size_t root_hash_size, const char *cache_dir);
+
+int VERITY_update(struct crypt_device *cd,
+		  struct crypt_params_verity *params,
+		  const struct crypt_verity_range *changed, size_t changed_count,
+		  char *root_hash, size_t digest_size);
+
+int VERITY_update_hash_ranges(struct crypt_device *cd,
+			      struct crypt_params_verity *params,
+			      const struct crypt_verity_range *changed, size_t changed_count,
+			      struct crypt_verity_range **hash_ranges, size_t *hash_count);
+
+int VERITY_verify_report(struct crypt_device *cd,
+			 struct crypt_params_verity *params,
+			 const char *root_hash, size_t digest_size,
+			 uint32_t flags, struct crypt_verity_report *report);
+
 int VERITY_FEC_process(struct crypt_device *cd,
 		      struct crypt_params_verity *params,
 		      struct device *fec_device,
 		      int check_fec,
 		      unsigned int *errors);
 
+struct verity_fec_stream;
+int VERITY_FEC_stream_init(struct crypt_device *cd,
+			   struct crypt_params_verity *params,
+			   struct device *fec_device,
+			   struct verity_fec_stream **fs);
+void VERITY_FEC_stream_add(struct verity_fec_stream *fs, const void *data, size_t blocks);
+int VERITY_FEC_stream_finish(struct crypt_device *cd, struct verity_fec_stream *fs);
+void VERITY_FEC_stream_free(struct verity_fec_stream *fs);
+
 uint64_t VERITY_hash_offset_block(struct crypt_params_verity *params);
 
 uint64_t VERITY_hash_blocks(struct crypt_device *cd, struct crypt_params_verity *params);
 
+int VERITY_FEC_update(struct crypt_device *cd,
+		      struct crypt_params_verity *params,
+		      struct device *fec_device,
+		      const struct crypt_verity_range *changed,
+		      size_t changed_count);
+
 uint64_t VERITY_FEC_blocks(struct crypt_device *cd,
 			   struct device *fec_device,
 			   struct crypt_params_verity *params);
@@ -0,0 +1,176 @@
+/*
+ * dm-verity cache of successful userspace verification
+ *
+ * Copyright (C) 2023 Red Hat, Inc. All rights reserved.
+ *
+ * This file is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this file; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "verity.h"
+#include "internal.h"
+
+/*
+ * Cache entry is a file named by digest of its content. The content
+ * describes verity parameters, root hash and identity of both data and
+ * hash image, so any modification of images (size, mtime or ctime change)
+ * or different parameters simply miss the entry.
+ *
+ * Block devices cannot be checked for changes this way and are never cached.
+ */
+#define VERITY_CACHE_HASH "sha256"
+#define VERITY_CACHE_DIGEST_SIZE 32
+#define VERITY_CACHE_ENTRY_MAX 2048
+
+static int cache_device_id(struct device *device, char *buf, size_t buf_size)
+{
+	struct stat st;
+	int r;
+
+	if (stat(device_path(device), &st) < 0 || !S_ISREG(st.st_mode))
+		return -ENOTSUP;
+
+	r = snprintf(buf, buf_size, "%ju:%ju:%jd:%jd.%09ld:%jd.%09ld",
+		     (uintmax_t)st.st_dev, (uintmax_t)st.st_ino, (intmax_t)st.st_size,
+		     (intmax_t)st.st_mtim.tv_sec, st.st_mtim.tv_nsec,
+		     (intmax_t)st.st_ctim.tv_sec, st.st_ctim.tv_nsec);
+
+	return (r < 0 || (size_t)r >= buf_size) ? -EINVAL : 0;
+}
+
+static int cache_entry(struct crypt_device *cd, struct crypt_params_verity *params,
+		       const char *root_hash, size_t root_hash_size, const char *cache_dir,
+		       char *entry, size_t entry_size, char *path, size_t path_size)
+{
+	char data_id[128], hash_id[128], digest[VERITY_CACHE_DIGEST_SIZE];
+	char *root_hex = NULL, *salt_hex = NULL, *name_hex = NULL;
+	struct crypt_hash *hd = NULL;
+	int r, len;
+
+	if (cache_device_id(crypt_data_device(cd), data_id, sizeof(data_id)) ||
+	    cache_device_id(crypt_metadata_device(cd), hash_id, sizeof(hash_id))) {
+		log_dbg(cd, "Verity devices are not regular files, verification cache not used.");
+		return -ENOTSUP;
+	}
+
+	root_hex = crypt_bytes_to_hex(root_hash_size, root_hash);
+	salt_hex = crypt_bytes_to_hex(params->salt_size, params->salt);
+	if (!root_hex || !salt_hex) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	len = snprintf(entry, entry_size, "root %s\nhash %s\nsalt %s\ntype %u\n"
+		       "block %u %u\nsize %" PRIu64 "\noffset %" PRIu64 "\ndata %s\nhashdev %s\n",
+		       root_hex, params->hash_name, salt_hex, params->hash_type,
+		       params->data_block_size, params->hash_block_size,
+		       params->data_size, VERITY_hash_offset_block(params), data_id, hash_id);
+	if (len < 0 || (size_t)len >= entry_size) {
+		r = -EINVAL;
+		goto out;
+	}
+
+	r = crypt_hash_init(&hd, VERITY_CACHE_HASH);
+	if (!r)
+		r = crypt_hash_write(hd, entry, len);
+	if (!r)
+		r = crypt_hash_final(hd, digest, sizeof(digest));
+	if (r)
+		goto out;
+
+	name_hex = crypt_bytes_to_hex(sizeof(digest), digest);
+	if (!name_hex) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	len = snprintf(path, path_size, "%s/%s", cache_dir, name_hex);
+	r = (len < 0 || (size_t)len >= path_size) ? -EINVAL : 0;
+out:
+	if (hd)
+		crypt_hash_destroy(hd);
+	crypt_safe_free(root_hex);
+	crypt_safe_free(salt_hex);
+	crypt_safe_free(name_hex);
+	return r;
+}
+
+/* Returns 1 if the same images were already verified with this root hash. */
+int VERITY_cache_check(struct crypt_device *cd, struct crypt_params_verity *params,
+		       const char *root_hash, size_t root_hash_size, const char *cache_dir)
+{
+	char entry[VERITY_CACHE_ENTRY_MAX], stored[VERITY_CACHE_ENTRY_MAX], path[PATH_MAX];
+	ssize_t len;
+	int fd;
+
+	if (!cache_dir || cache_entry(cd, params, root_hash, root_hash_size, cache_dir,
+				      entry, sizeof(entry), path, sizeof(path)))
+		return 0;
+
+	fd = open(path, O_RDONLY | O_NOFOLLOW);
+	if (fd < 0)
+		return 0;
+	len = read_buffer(fd, stored, sizeof(stored) - 1);
+	close(fd);
+
+	if (len < 0 || (size_t)len != strlen(entry) || memcmp(entry, stored, len))
+		return 0;
+
+	log_dbg(cd, "Verity images already verified, using cache entry %s.", path);
+	return 1;
+}
+
+/* Record successful verification, failure only means the next check is not cached. */
+void VERITY_cache_store(struct crypt_device *cd, struct crypt_params_verity *params,
+			const char *root_hash, size_t root_hash_size, const char *cache_dir)
+{
+	char entry[VERITY_CACHE_ENTRY_MAX], path[PATH_MAX], tmp[PATH_MAX];
+	size_t len;
+	int fd, r;
+
+	if (!cache_dir || cache_entry(cd, params, root_hash, root_hash_size, cache_dir,
+				      entry, sizeof(entry), path, sizeof(path)))
+		return;
+
+	if (snprintf(tmp, sizeof(tmp), "%s.%d", path, (int)getpid()) < 0)
+		return;
+
+	fd = open(tmp, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW, S_IRUSR | S_IWUSR);
+	if (fd < 0) {
+		log_dbg(cd, "Cannot create verity cache entry %s.", tmp);
+		return;
+	}
+
+	len = strlen(entry);
+	r = (write_buffer(fd, entry, len) != (ssize_t)len || fsync(fd) < 0) ? -EIO : 0;
+	if (close(fd) < 0 || r) {
+		unlink(tmp);
+		return;
+	}
+
+	/* concurrent writers store the same content, last rename wins */
+	if (rename(tmp, path) < 0)
+		unlink(tmp);
+	else
+		log_dbg(cd, "Stored verity cache entry %s.", path);
+}
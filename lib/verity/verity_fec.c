@@ -21,6 +21,7 @@
 
 #include <stdlib.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include "verity.h"
 #include "internal.h"
@@ -33,6 +34,18 @@
 
 #define FEC_INPUT_DEVICES 2
 
+/* upper limit of parallel encoding threads */
+#define FEC_MAX_THREADS 64
+
+/* data buffers of all encoding threads together */
+#define FEC_BUFFER_SIZE (64 * 1024 * 1024)
+
+/* upper limit of parity kept in memory while encoding along hash creation */
+#define FEC_STREAM_PARITY_SIZE (256 * 1024 * 1024)
+
+/* blocks read at once when a stream encoder reads remaining inputs itself */
+#define FEC_STREAM_READ_BLOCKS 256
+
 /* parameters to init_rs_char */
 #define FEC_PARAMS(roots) \
     8,          /* symbol size in bits */ \
@@ -73,50 +86,293 @@ static inline uint64_t FEC_interleave(struct fec_context *ctx, uint64_t offset)
 			(offset % ctx->rsn) * ctx->rounds * ctx->block_size;
 }
 
+/* reads physical range of the concatenated inputs */
+static int FEC_read_range(struct fec_context *ctx, uint64_t offset,
+			  uint8_t *output, size_t count)
+{
+	size_t n, len;
+
+	for (n = 0; n < ctx->ninputs && count; ++n) {
+		if (offset >= ctx->inputs[n].count) {
+			offset -= ctx->inputs[n].count;
+			continue;
+		}
+
+		len = ctx->inputs[n].count - offset < count ? ctx->inputs[n].count - offset : count;
+
+		/* positioned read, rounds are read from several threads */
+		if (pread(ctx->inputs[n].fd, output, len, ctx->inputs[n].start + offset) != (ssize_t)len)
+			return -1;
+
+		output += len;
+		count -= len;
+		offset = 0;
+	}
+
+	/* offsets outside input area are assumed to contain zeros */
+	memset(output, 0, count);
+	return 0;
+}
+
 /* returns data for a byte at the specified RS offset */
 static int FEC_read_interleaved(struct fec_context *ctx, uint64_t i,
 				void *output, size_t count)
 {
-	size_t n;
-	uint64_t offset = FEC_interleave(ctx, i);
+	return FEC_read_range(ctx, FEC_interleave(ctx, i), output, count);
+}
 
-	/* offsets outside input area are assumed to contain zeros */
-	if (offset >= ctx->size) {
-		memset(output, 0, count);
-		return 0;
+/*
+ * Reads data of rounds n .. n + nr - 1. Symbol i of consecutive rounds is
+ * stored in consecutive blocks, so every symbol position is one sequential
+ * read of nr blocks; the block of round n + r for symbol i is stored
+ * at buf[(i * nr + r) * block_size].
+ */
+static int FEC_read_rounds(struct fec_context *ctx, uint64_t n, uint64_t nr,
+			   uint8_t *buf, uint32_t *failed)
+{
+	size_t length = (size_t)nr * ctx->block_size;
+	uint32_t i;
+
+	for (i = 0; i < ctx->rsn; ++i) {
+		if (FEC_read_interleaved(ctx, n * ctx->rsn * ctx->block_size + i,
+					 &buf[i * length], length)) {
+			*failed = i;
+			return -EIO;
+		}
 	}
 
-	/* find the correct input device and read from it */
-	for (n = 0; n < ctx->ninputs; ++n) {
-		if (offset >= ctx->inputs[n].count) {
-			offset -= ctx->inputs[n].count;
+	return 0;
+}
+
+struct fec_encoder {
+	struct fec_context *ctx;
+	struct rs *rs;
+	int fd;
+	uint64_t fec_offset;
+	uint64_t group;		/* rounds encoded together */
+	uint64_t first, stride;	/* groups first, first + stride, ... */
+	const uint8_t *dirty;	/* only rounds marked here (if set) */
+	uint64_t failed_round;
+	uint32_t failed_byte;
+	bool write_failed;
+	pthread_t thread;
+	int r;
+};
+
+/*
+ * Rounds are independent, every encoder reads its own groups of rounds
+ * and writes their parity (block_size codewords per round) with one write.
+ */
+static void *FEC_encode_rounds(void *arg)
+{
+	struct fec_encoder *e = arg;
+	struct fec_context *ctx = e->ctx;
+	uint8_t *buf, *parity;
+	size_t parity_size = (size_t)ctx->block_size * ctx->roots;
+	uint64_t g, n, nr, r;
+
+	buf = malloc((size_t)e->group * ctx->block_size * ctx->rsn);
+	parity = malloc(e->group * parity_size);
+	if (!buf || !parity) {
+		e->r = -ENOMEM;
+		goto out;
+	}
+
+	for (g = e->first, e->r = 0; g * e->group < ctx->rounds; g += e->stride) {
+		n = g * e->group;
+		nr = ctx->rounds - n < e->group ? ctx->rounds - n : e->group;
+
+		if (e->dirty && !memchr(&e->dirty[n], 1, nr))
 			continue;
+
+		if (FEC_read_rounds(ctx, n, nr, buf, &e->failed_byte)) {
+			e->failed_round = n;
+			e->r = -EIO;
+			break;
 		}
 
-		/* FIXME: read_lseek_blockwise candidate */
-		if (lseek(ctx->inputs[n].fd, ctx->inputs[n].start + offset, SEEK_SET) < 0)
-			return -1;
-		return (read_buffer(ctx->inputs[n].fd, output, count) == (ssize_t)count) ? 0 : -1;
+		/* byte b of every block in a round forms codeword b */
+		for (r = 0; r < nr; r++)
+			encode_rs_char_columns(e->rs, &buf[r * ctx->block_size], nr * ctx->block_size,
+					       ctx->block_size, &parity[r * parity_size]);
+
+		if (pwrite(e->fd, parity, nr * parity_size, e->fec_offset + n * parity_size) !=
+		    (ssize_t)(nr * parity_size)) {
+			e->failed_round = n;
+			e->write_failed = true;
+			e->r = -EIO;
+			break;
+		}
+	}
+out:
+	free(buf);
+	free(parity);
+	return NULL;
+}
+
+static int FEC_encode_inputs(struct crypt_device *cd, struct fec_context *ctx,
+			     struct rs *rs, int fd, uint64_t fec_offset, const uint8_t *dirty)
+{
+	struct fec_encoder enc[FEC_MAX_THREADS];
+	unsigned i, threads = crypt_cpusonline(), started;
+	uint64_t group;
+	int r = 0;
+
+	if (threads > FEC_MAX_THREADS)
+		threads = FEC_MAX_THREADS;
+	if (threads > ctx->rounds)
+		threads = ctx->rounds;
+	if (!threads)
+		threads = 1;
+
+	/* Encode several rounds at once to make reads long, limit memory for all threads. */
+	group = FEC_BUFFER_SIZE / ((uint64_t)threads * ctx->rsn * ctx->block_size);
+	if (group > ctx->rounds)
+		group = ctx->rounds;
+	/* scattered updated rounds, do not reencode clean neighbours */
+	if (!group || dirty)
+		group = 1;
+
+	for (i = 0; i < threads; i++) {
+		enc[i].ctx = ctx;
+		enc[i].group = group;
+		enc[i].rs = rs;
+		enc[i].fd = fd;
+		enc[i].fec_offset = fec_offset;
+		enc[i].first = i;
+		enc[i].stride = threads;
+		enc[i].dirty = dirty;
+		enc[i].write_failed = false;
+		enc[i].r = 0;
 	}
 
-	/* should never be reached */
-	return -1;
+	/* Encoder 0 runs in the calling thread and takes over rounds of threads that did not start. */
+	for (started = 1; started < threads; started++)
+		if (pthread_create(&enc[started].thread, NULL, FEC_encode_rounds, &enc[started]))
+			break;
+	log_dbg(cd, "Running FEC encoding with %u thread(s), %" PRIu64 " round(s) per read.", started, group);
+
+	for (i = started; i < threads; i++)
+		(void)FEC_encode_rounds(&enc[i]);
+	(void)FEC_encode_rounds(&enc[0]);
+
+	for (i = 1; i < started; i++)
+		pthread_join(enc[i].thread, NULL);
+
+	for (i = 0; i < threads && !r; i++) {
+		r = enc[i].r;
+		if (r == -ENOMEM)
+			log_err(cd, _("Failed to allocate buffer."));
+		else if (r && enc[i].write_failed)
+			log_err(cd, _("Failed to write parity for RS block %" PRIu64 "."), enc[i].failed_round);
+		else if (r)
+			log_err(cd, _("Failed to read RS block %" PRIu64 " byte %d."),
+				enc[i].failed_round, enc[i].failed_byte);
+	}
+
+	return r;
+}
+
+/* decode inputs with parity read from fd */
+static int FEC_decode_inputs(struct crypt_device *cd, struct fec_context *ctx,
+			     struct rs *rs, int fd, uint64_t fec_offset, unsigned int *errors)
+{
+	int r = 0;
+	unsigned int i;
+	uint32_t b, failed;
+	uint64_t n;
+	uint8_t rs_block[FEC_RSM];
+	uint8_t *buf = NULL, *parity = NULL;
+	size_t parity_size = (size_t)ctx->block_size * ctx->roots;
+
+	buf = malloc((size_t)ctx->block_size * ctx->rsn);
+	parity = malloc(parity_size);
+	if (!buf || !parity) {
+		log_err(cd, _("Failed to allocate buffer."));
+		r = -ENOMEM;
+		goto out;
+	}
+
+	for (n = 0; n < ctx->rounds; ++n) {
+		if (FEC_read_rounds(ctx, n, 1, buf, &failed)) {
+			log_err(cd, _("Failed to read RS block %" PRIu64 " byte %d."), n, failed);
+			r = -EIO;
+			goto out;
+		}
+
+		if (pread(fd, parity, parity_size, fec_offset + n * parity_size) != (ssize_t)parity_size) {
+			log_err(cd, _("Failed to read parity for RS block %" PRIu64 "."), n);
+			r = -EIO;
+			goto out;
+		}
+
+		for (b = 0; b < ctx->block_size; ++b) {
+			for (i = 0; i < ctx->rsn; ++i)
+				rs_block[i] = buf[i * ctx->block_size + b];
+			memcpy(&rs_block[ctx->rsn], &parity[b * ctx->roots], ctx->roots);
+
+			/* coverity[tainted_data] */
+			r = decode_rs_char(rs, rs_block);
+			if (r < 0) {
+				log_err(cd, _("Failed to repair parity for block %" PRIu64 "."), n);
+				r = -EPERM;
+				goto out;
+			}
+			/* return number of detected errors */
+			if (errors)
+				*errors += r;
+			r = 0;
+		}
+	}
+out:
+	free(buf);
+	free(parity);
+	return r;
+}
+
+/*
+ * Marks rounds containing changed blocks. Block i * rounds + n is symbol i
+ * of round n, so a range of at least rounds blocks touches all of them.
+ */
+static int FEC_dirty_rounds(struct crypt_device *cd, struct fec_context *ctx,
+			    const struct crypt_verity_range *changed, size_t changed_count,
+			    uint8_t *dirty)
+{
+	uint64_t b, marked = 0;
+	size_t i;
+
+	for (i = 0; i < changed_count; i++) {
+		if (changed[i].offset >= ctx->blocks || changed[i].length > ctx->blocks - changed[i].offset) {
+			log_err(cd, _("Changed area is outside of the FEC area."));
+			return -EINVAL;
+		}
+		if (changed[i].length >= ctx->rounds) {
+			memset(dirty, 1, ctx->rounds);
+			break;
+		}
+		for (b = changed[i].offset; b < changed[i].offset + changed[i].length; b++)
+			dirty[b % ctx->rounds] = 1;
+	}
+
+	for (b = 0; b < ctx->rounds; b++)
+		marked += dirty[b];
+	log_dbg(cd, "Updating parity of %" PRIu64 " of %" PRIu64 " RS round(s).", marked, ctx->rounds);
+
+	return 0;
 }
 
-/* encodes/decode inputs to/from fd */
+/* encodes/decode inputs to/from fd, encodes only rounds with changed blocks if set */
 static int FEC_process_inputs(struct crypt_device *cd,
 			      struct crypt_params_verity *params,
 			      struct fec_input_device *inputs,
-			      size_t ninputs, int fd,
-			      int decode, unsigned int *errors)
+			      size_t ninputs, int fd, uint64_t fec_offset,
+			      int decode, const struct crypt_verity_range *changed,
+			      size_t changed_count, unsigned int *errors)
 {
 	int r = 0;
-	unsigned int i;
 	struct fec_context ctx;
-	uint32_t b;
+	uint8_t *dirty = NULL;
 	uint64_t n;
-	uint8_t rs_block[FEC_RSM];
-	uint8_t *buf = NULL;
 	void *rs;
 
 	/* initialize parameters */
@@ -144,61 +400,24 @@ static int FEC_process_inputs(struct crypt_device *cd,
 	ctx.blocks = FEC_div_round_up(ctx.size, ctx.block_size);
 	ctx.rounds = FEC_div_round_up(ctx.blocks, ctx.rsn);
 
-	buf = malloc((size_t)ctx.block_size * ctx.rsn);
-	if (!buf) {
-		log_err(cd, _("Failed to allocate buffer."));
-		r = -ENOMEM;
-		goto out;
-	}
-
-	/* encode/decode input */
-	for (n = 0; n < ctx.rounds; ++n) {
-		for (i = 0; i < ctx.rsn; ++i) {
-			if (FEC_read_interleaved(&ctx, n * ctx.rsn * ctx.block_size + i,
-						 &buf[i * ctx.block_size], ctx.block_size)) {
-				log_err(cd, _("Failed to read RS block %" PRIu64 " byte %d."), n, i);
-				r = -EIO;
-				goto out;
-			}
-		}
-
-		for (b = 0; b < ctx.block_size; ++b) {
-			for (i = 0; i < ctx.rsn; ++i)
-				rs_block[i] = buf[i * ctx.block_size + b];
-
-			/* decoding from parity device */
-			if (decode) {
-				if (read_buffer(fd, &rs_block[ctx.rsn], ctx.roots) < 0) {
-					log_err(cd, _("Failed to read parity for RS block %" PRIu64 "."), n);
-					r = -EIO;
-					goto out;
-				}
-
-				/* coverity[tainted_data] */
-				r = decode_rs_char(rs, rs_block);
-				if (r < 0) {
-					log_err(cd, _("Failed to repair parity for block %" PRIu64 "."), n);
-					r = -EPERM;
-					goto out;
-				}
-				/* return number of detected errors */
-				if (errors)
-					*errors += r;
-				r = 0;
-			} else {
-				/* encoding and writing parity data to fec device */
-				encode_rs_char(rs, rs_block, &rs_block[ctx.rsn]);
-				if (write_buffer(fd, &rs_block[ctx.rsn], ctx.roots) < 0) {
-					log_err(cd, _("Failed to write parity for RS block %" PRIu64 "."), n);
-					r = -EIO;
-					goto out;
-				}
-			}
+	if (changed) {
+		dirty = calloc(ctx.rounds, 1);
+		if (!dirty) {
+			r = -ENOMEM;
+			goto out;
 		}
+		r = FEC_dirty_rounds(cd, &ctx, changed, changed_count, dirty);
+		if (r)
+			goto out;
 	}
+
+	if (decode)
+		r = FEC_decode_inputs(cd, &ctx, rs, fd, fec_offset, errors);
+	else
+		r = FEC_encode_inputs(cd, &ctx, rs, fd, fec_offset, dirty);
 out:
+	free(dirty);
 	free_rs_char(rs);
-	free(buf);
 	return r;
 }
 
@@ -218,10 +437,11 @@ static int VERITY_FEC_validate(struct crypt_device *cd, struct crypt_params_veri
 	return 0;
 }
 
-int VERITY_FEC_process(struct crypt_device *cd,
-		      struct crypt_params_verity *params,
-		      struct device *fec_device, int check_fec,
-		      unsigned int *errors)
+static int FEC_process(struct crypt_device *cd,
+		       struct crypt_params_verity *params,
+		       struct device *fec_device, int check_fec,
+		       const struct crypt_verity_range *changed,
+		       size_t changed_count, unsigned int *errors)
 {
 	int r = -EIO, fd = -1;
 	size_t ninputs = FEC_INPUT_DEVICES;
@@ -261,11 +481,6 @@ int VERITY_FEC_process(struct crypt_device *cd,
 		goto out;
 	}
 
-	if (lseek(fd, params->fec_area_offset, SEEK_SET) < 0) {
-		log_dbg(cd, "Cannot seek to requested position in FEC device.");
-		goto out;
-	}
-
 	/* input devices */
 	inputs[0].fd = open(device_path(inputs[0].device), O_RDONLY);
 	if (inputs[0].fd == -1) {
@@ -278,7 +493,19 @@ int VERITY_FEC_process(struct crypt_device *cd,
 		goto out;
 	}
 
-	r = FEC_process_inputs(cd, params, inputs, ninputs, fd, check_fec, errors);
+	/* parity is processed in order, data blocks are interleaved over inputs */
+	device_hint_sequential(fd, params->fec_area_offset, 0);
+
+	r = FEC_process_inputs(cd, params, inputs, ninputs, fd, params->fec_area_offset,
+			       check_fec, changed, changed_count, errors);
+
+	device_hint_drop(inputs[0].fd, inputs[0].start, inputs[0].count);
+	if (inputs[1].count)
+		device_hint_drop(inputs[1].fd, inputs[1].start, inputs[1].count);
+	if (check_fec)
+		device_hint_drop(fd, params->fec_area_offset, 0);
+	if (!r && changed && fsync(fd) < 0)
+		r = -EIO;
 out:
 	if (inputs[0].fd != -1)
 		close(inputs[0].fd);
@@ -290,6 +517,289 @@ out:
 	return r;
 }
 
+int VERITY_FEC_process(struct crypt_device *cd,
+		      struct crypt_params_verity *params,
+		      struct device *fec_device, int check_fec,
+		      unsigned int *errors)
+{
+	return FEC_process(cd, params, fec_device, check_fec, NULL, 0, errors);
+}
+
+/*
+ * Re-encode parity only for RS rounds covering changed blocks. Ranges are
+ * in blocks of the FEC covered area (data blocks, then hash area blocks).
+ */
+int VERITY_FEC_update(struct crypt_device *cd,
+		      struct crypt_params_verity *params,
+		      struct device *fec_device,
+		      const struct crypt_verity_range *changed,
+		      size_t changed_count)
+{
+	if (!changed_count)
+		return 0;
+
+	return FEC_process(cd, params, fec_device, 0, changed, changed_count, NULL);
+}
+
+/*
+ * Single pass encoder: block k of the covered area is symbol k / rounds
+ * of round k % rounds, so blocks read in order feed every codeword its
+ * symbols in order and the LFSR state of all codewords (which is exactly
+ * the parity area) can be kept in memory. Data blocks are fed while
+ * the hash tree is created, the (much smaller) hash area is read after
+ * the tree is written. Parity of round n is kept as roots planes
+ * of block_size bytes at parity[n * roots * block_size].
+ */
+struct verity_fec_stream {
+	struct fec_context ctx;
+	struct fec_input_device inputs[FEC_INPUT_DEVICES];
+	struct device *fec_device;
+	uint64_t fec_offset;
+	struct rs *rs;
+	uint8_t *parity;
+	uint64_t fed;		/* blocks already encoded */
+};
+
+struct fec_stream_job {
+	struct verity_fec_stream *fs;
+	const uint8_t *data;
+	size_t blocks;
+	uint64_t first, last;	/* rounds first .. last - 1 */
+	pthread_t thread;
+};
+
+static void *FEC_stream_job(void *arg)
+{
+	struct fec_stream_job *job = arg;
+	struct fec_context *ctx = &job->fs->ctx;
+	size_t parity_size = (size_t)ctx->block_size * ctx->roots;
+	uint64_t n;
+	size_t i;
+
+	/* blocks of one round are encoded in order, rounds are independent */
+	for (i = 0; i < job->blocks; i++) {
+		n = (job->fs->fed + i) % ctx->rounds;
+		if (n >= job->first && n < job->last)
+			encode_rs_char_update(job->fs->rs, &job->data[i * ctx->block_size],
+					      ctx->block_size, &job->fs->parity[n * parity_size],
+					      ctx->block_size);
+	}
+
+	return NULL;
+}
+
+static void FEC_stream_encode(struct verity_fec_stream *fs, const uint8_t *data, size_t blocks)
+{
+	struct fec_stream_job jobs[FEC_MAX_THREADS];
+	unsigned i, threads = crypt_cpusonline(), started;
+	uint64_t chunk, rounds = fs->ctx.rounds;
+
+	if (blocks < rounds)
+		rounds = blocks;
+	if (threads > FEC_MAX_THREADS)
+		threads = FEC_MAX_THREADS;
+	if (threads > rounds)
+		threads = rounds;
+	if (!threads)
+		threads = 1;
+
+	chunk = FEC_div_round_up(fs->ctx.rounds, threads);
+	for (i = 0; i < threads; i++) {
+		jobs[i].fs = fs;
+		jobs[i].data = data;
+		jobs[i].blocks = blocks;
+		jobs[i].first = i * chunk;
+		jobs[i].last = (i + 1) * chunk;
+	}
+
+	/* Job 0 runs in the calling thread, so do jobs that failed to start. */
+	for (started = 1; started < threads; started++)
+		if (pthread_create(&jobs[started].thread, NULL, FEC_stream_job, &jobs[started]))
+			break;
+
+	for (i = started; i < threads; i++)
+		(void)FEC_stream_job(&jobs[i]);
+	(void)FEC_stream_job(&jobs[0]);
+
+	for (i = 1; i < started; i++)
+		pthread_join(jobs[i].thread, NULL);
+
+	fs->fed += blocks;
+}
+
+/*
+ * Returns -ENOTSUP if parity does not fit in memory (FEC_process
+ * has to be used after hash creation then).
+ */
+int VERITY_FEC_stream_init(struct crypt_device *cd,
+			   struct crypt_params_verity *params,
+			   struct device *fec_device,
+			   struct verity_fec_stream **fs)
+{
+	struct verity_fec_stream *s;
+	uint64_t n, parity_size;
+	int r;
+
+	r = VERITY_FEC_validate(cd, params);
+	if (r < 0)
+		return r;
+
+	s = calloc(1, sizeof(*s));
+	if (!s)
+		return -ENOMEM;
+
+	s->fec_device = fec_device;
+	s->fec_offset = params->fec_area_offset;
+	s->inputs[0].device = crypt_data_device(cd);
+	s->inputs[0].fd = -1;
+	s->inputs[0].count = params->data_size * params->data_block_size;
+	s->inputs[1].device = crypt_metadata_device(cd);
+	s->inputs[1].fd = -1;
+	s->inputs[1].start = VERITY_hash_offset_block(params) * params->data_block_size;
+	s->inputs[1].count = (VERITY_FEC_blocks(cd, fec_device, params) - params->data_size) * params->data_block_size;
+
+	if (!s->inputs[0].count) {
+		log_err(cd, _("Invalid FEC segment length."));
+		r = -EINVAL;
+		goto err;
+	}
+
+	s->ctx.roots = params->fec_roots;
+	s->ctx.rsn = FEC_RSM - s->ctx.roots;
+	s->ctx.block_size = params->data_block_size;
+	s->ctx.inputs = s->inputs;
+	s->ctx.ninputs = s->inputs[1].count ? FEC_INPUT_DEVICES : FEC_INPUT_DEVICES - 1;
+	for (n = 0, s->ctx.size = 0; n < s->ctx.ninputs; n++)
+		s->ctx.size += s->inputs[n].count;
+	s->ctx.blocks = FEC_div_round_up(s->ctx.size, s->ctx.block_size);
+	s->ctx.rounds = FEC_div_round_up(s->ctx.blocks, s->ctx.rsn);
+
+	parity_size = s->ctx.rounds * s->ctx.roots * s->ctx.block_size;
+	if (parity_size > FEC_STREAM_PARITY_SIZE) {
+		log_dbg(cd, "FEC parity (%" PRIu64 " bytes) too large to encode along hash creation.", parity_size);
+		r = -ENOTSUP;
+		goto err;
+	}
+
+	s->rs = init_rs_char(FEC_PARAMS(s->ctx.roots));
+	s->parity = calloc(1, parity_size);
+	if (!s->rs || !s->parity) {
+		r = -ENOTSUP;
+		goto err;
+	}
+
+	for (n = 0; n < s->ctx.ninputs; n++) {
+		s->inputs[n].fd = open(device_path(s->inputs[n].device), O_RDONLY);
+		if (s->inputs[n].fd == -1) {
+			log_err(cd, _("Cannot open device %s."), device_path(s->inputs[n].device));
+			r = -EIO;
+			goto err;
+		}
+	}
+
+	log_dbg(cd, "Encoding FEC of %" PRIu64 " RS round(s) along hash creation.", s->ctx.rounds);
+	*fs = s;
+	return 0;
+err:
+	VERITY_FEC_stream_free(s);
+	return r;
+}
+
+/* Feed data blocks read in order from the start of the data device. */
+void VERITY_FEC_stream_add(struct verity_fec_stream *fs, const void *data, size_t blocks)
+{
+	uint64_t data_blocks;
+
+	if (!fs)
+		return;
+
+	/* hash may cover more blocks than FEC data area */
+	data_blocks = fs->inputs[0].count / fs->ctx.block_size;
+	if (fs->fed >= data_blocks)
+		return;
+	if (blocks > data_blocks - fs->fed)
+		blocks = data_blocks - fs->fed;
+
+	FEC_stream_encode(fs, data, blocks);
+}
+
+/* Encode blocks not fed yet (hash area and padding) and write parity. */
+int VERITY_FEC_stream_finish(struct crypt_device *cd, struct verity_fec_stream *fs)
+{
+	struct fec_context *ctx = &fs->ctx;
+	size_t parity_size = (size_t)ctx->block_size * ctx->roots;
+	uint64_t n, count, total = ctx->rsn * ctx->rounds;
+	uint8_t *buf, *out;
+	uint32_t b, j;
+	int fd, r = 0;
+
+	buf = malloc((size_t)FEC_STREAM_READ_BLOCKS * ctx->block_size);
+	out = malloc(parity_size);
+	if (!buf || !out) {
+		log_err(cd, _("Failed to allocate buffer."));
+		r = -ENOMEM;
+		goto out;
+	}
+
+	/* offsets outside input area read as zeros */
+	while (fs->fed < total) {
+		count = total - fs->fed < FEC_STREAM_READ_BLOCKS ? total - fs->fed : FEC_STREAM_READ_BLOCKS;
+		if (FEC_read_range(ctx, fs->fed * ctx->block_size, buf, count * ctx->block_size)) {
+			log_err(cd, _("Failed to read RS block %" PRIu64 " byte %d."),
+				fs->fed % ctx->rounds, (int)(fs->fed / ctx->rounds));
+			r = -EIO;
+			goto out;
+		}
+		FEC_stream_encode(fs, buf, count);
+	}
+
+	if (ctx->ninputs > 1)
+		device_hint_drop(fs->inputs[1].fd, fs->inputs[1].start, fs->inputs[1].count);
+
+	fd = open(device_path(fs->fec_device), O_RDWR);
+	if (fd == -1) {
+		log_err(cd, _("Cannot open device %s."), device_path(fs->fec_device));
+		r = -EIO;
+		goto out;
+	}
+
+	device_hint_sequential(fd, fs->fec_offset, 0);
+
+	/* codeword b of a round is stored at b * roots */
+	for (n = 0; n < ctx->rounds && !r; n++) {
+		for (j = 0; j < ctx->roots; j++)
+			for (b = 0; b < ctx->block_size; b++)
+				out[b * ctx->roots + j] = fs->parity[n * parity_size + j * ctx->block_size + b];
+
+		if (pwrite(fd, out, parity_size, fs->fec_offset + n * parity_size) != (ssize_t)parity_size) {
+			log_err(cd, _("Failed to write parity for RS block %" PRIu64 "."), n);
+			r = -EIO;
+		}
+	}
+
+	close(fd);
+out:
+	free(buf);
+	free(out);
+	return r;
+}
+
+void VERITY_FEC_stream_free(struct verity_fec_stream *fs)
+{
+	size_t n;
+
+	if (!fs)
+		return;
+
+	for (n = 0; n < FEC_INPUT_DEVICES; n++)
+		if (fs->inputs[n].fd != -1)
+			close(fs->inputs[n].fd);
+	if (fs->rs)
+		free_rs_char(fs->rs);
+	free(fs->parity);
+	free(fs);
+}
+
 /* All blocks that are covered by FEC */
 uint64_t VERITY_FEC_blocks(struct crypt_device *cd,
 			   struct device *fec_device,
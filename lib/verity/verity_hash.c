@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdint.h>
+#include <fcntl.h>
+#include <pthread.h>
 
 #include "verity.h"
 #include "internal.h"
@@ -30,6 +32,12 @@
 #define VERITY_MAX_LEVELS	63
 #define VERITY_MAX_DIGEST_SIZE	1024
 
+/* Blocks are read and hashed in batches of this size */
+#define VERITY_BATCH_SIZE	(4 * 1024 * 1024)
+/* Do not start another hashing thread for fewer blocks than this */
+#define VERITY_THREAD_MIN_BLOCKS 64
+#define VERITY_MAX_THREADS	64
+
 static unsigned get_bits_up(size_t u)
 {
 	unsigned i = 0;
@@ -74,17 +82,14 @@ out:
 	return r;
 }
 
-static int verify_hash_block(const char *hash_name, int version,
-			      char *hash, size_t hash_size,
-			      const char *data, size_t data_size,
-			      const char *salt, size_t salt_size)
+/* Final resets the context, on error it is reset explicitly so it can be reused */
+static int hash_block(struct crypt_hash *ctx, int version,
+		      char *hash, size_t hash_size,
+		      const char *data, size_t data_size,
+		      const char *salt, size_t salt_size)
 {
-	struct crypt_hash *ctx = NULL;
 	int r;
 
-	if (crypt_hash_init(&ctx, hash_name))
-		return -EINVAL;
-
 	if (version == 1 && (r = crypt_hash_write(ctx, salt, salt_size)))
 		goto out;
 
@@ -94,12 +99,134 @@ static int verify_hash_block(const char *hash_name, int version,
 	if (version == 0 && (r = crypt_hash_write(ctx, salt, salt_size)))
 		goto out;
 
-	r = crypt_hash_final(ctx, hash, hash_size);
+	return crypt_hash_final(ctx, hash, hash_size);
 out:
+	(void)crypt_hash_reset(ctx);
+	return r;
+}
+
+static int verify_hash_block(const char *hash_name, int version,
+			      char *hash, size_t hash_size,
+			      const char *data, size_t data_size,
+			      const char *salt, size_t salt_size)
+{
+	struct crypt_hash *ctx = NULL;
+	int r;
+
+	if (crypt_hash_init(&ctx, hash_name))
+		return -EINVAL;
+
+	r = hash_block(ctx, version, hash, hash_size, data, data_size, salt, salt_size);
+
 	crypt_hash_destroy(ctx);
 	return r;
 }
 
+struct hash_batch_job {
+	const char *hash_name;
+	int version;
+	char *digests;
+	size_t digest_size;
+	const char *data;
+	size_t data_size;
+	size_t blocks;
+	const char *salt;
+	size_t salt_size;
+	pthread_t thread;
+	int r;
+};
+
+static void *hash_batch_thread(void *arg)
+{
+	struct hash_batch_job *job = arg;
+
+	/* version 1 hashes salt before data, version 0 after */
+	job->r = crypt_hash_salted_blocks(job->hash_name, job->salt, job->salt_size, job->version == 1,
+					  job->data, job->data_size, job->blocks,
+					  job->digests, job->digest_size);
+	return NULL;
+}
+
+/*
+ * Hash independent blocks split by ranges across threads,
+ * the digests are stored in block order.
+ */
+static int hash_batch(unsigned threads, const char *hash_name, int version,
+		      char *digests, size_t digest_size,
+		      const char *data, size_t data_size, size_t blocks,
+		      const char *salt, size_t salt_size)
+{
+	struct hash_batch_job jobs[VERITY_MAX_THREADS];
+	size_t chunk, done;
+	unsigned i, started;
+	int r = 0;
+
+	if (threads > VERITY_MAX_THREADS)
+		threads = VERITY_MAX_THREADS;
+	if (threads > blocks / VERITY_THREAD_MIN_BLOCKS)
+		threads = blocks / VERITY_THREAD_MIN_BLOCKS;
+	if (!threads)
+		threads = 1;
+
+	chunk = (blocks + threads - 1) / threads;
+
+	for (i = 0, done = 0; i < threads && done < blocks; i++, done += chunk) {
+		jobs[i].hash_name = hash_name;
+		jobs[i].version = version;
+		jobs[i].digests = digests + done * digest_size;
+		jobs[i].digest_size = digest_size;
+		jobs[i].data = data + done * data_size;
+		jobs[i].data_size = data_size;
+		jobs[i].blocks = blocks - done < chunk ? blocks - done : chunk;
+		jobs[i].salt = salt;
+		jobs[i].salt_size = salt_size;
+	}
+	threads = i;
+
+	/* Job 0 runs in the calling thread, so do jobs that failed to start. */
+	for (started = 1; started < threads; started++)
+		if (pthread_create(&jobs[started].thread, NULL, hash_batch_thread, &jobs[started]))
+			break;
+
+	for (i = started; i < threads; i++)
+		(void)hash_batch_thread(&jobs[i]);
+	(void)hash_batch_thread(&jobs[0]);
+
+	for (i = 1; i < started; i++)
+		pthread_join(jobs[i].thread, NULL);
+
+	for (i = 0; i < threads && !r; i++)
+		r = jobs[i].r;
+
+	return r;
+}
+
+/*
+ * Read blocks with large aligned reads on the (possibly O_DIRECT) device fd,
+ * bypassing stdio buffering. Read data not needed again is dropped from
+ * the page cache.
+ */
+static int read_blocks(struct crypt_device *cd, struct device *device, int devfd,
+		       char *buffer, size_t length, uint64_t offset)
+{
+	if (pread_blockwise(devfd, device_block_size(cd, device), device_alignment(device),
+				 buffer, length, offset) != (ssize_t)length)
+		return -EIO;
+
+	device_hint_drop(devfd, offset, length);
+
+	return 0;
+}
+
+static int open_blocks(struct crypt_device *cd, struct device *device, uint64_t offset)
+{
+	int devfd = device_open(cd, device, O_RDONLY);
+
+	device_hint_sequential(devfd, offset, 0);
+
+	return devfd;
+}
+
 static int hash_levels(size_t hash_block_size, size_t digest_size,
 		       uint64_t data_file_blocks, uint64_t *hash_position, int *levels,
 		       uint64_t *hash_level_block, uint64_t *hash_level_size)
@@ -141,7 +268,7 @@ static int hash_levels(size_t hash_block_size, size_t digest_size,
 	return 0;
 }
 
-static int create_or_verify(struct crypt_device *cd, FILE *rd, FILE *wr,
+static int create_or_verify(struct crypt_device *cd, struct device *rd, FILE *wr,
 				   uint64_t data_block, size_t data_block_size,
 				   uint64_t hash_block, size_t hash_block_size,
 				   uint64_t blocks, int version,
@@ -149,15 +276,17 @@ static int create_or_verify(struct crypt_device *cd, FILE *rd, FILE *wr,
 				   char *calculated_digest, size_t digest_size,
 				   const char *salt, size_t salt_size)
 {
-	char *left_block, *data_buffer;
+	char *left_block, *data_buffer, *digests;
 	char read_digest[VERITY_MAX_DIGEST_SIZE];
 	size_t hash_per_block = 1 << get_bits_down(hash_block_size / digest_size);
 	size_t digest_size_full = 1 << get_bits_up(digest_size);
+	size_t batch_blocks, batch_count = 0, batch_idx = 0;
 	uint64_t blocks_to_write = (blocks + hash_per_block - 1) / hash_per_block;
-	uint64_t seek_rd, seek_wr;
+	uint64_t seek_rd, seek_wr, block_idx = 0;
+	unsigned threads = crypt_cpusonline();
 	size_t left_bytes;
 	unsigned i;
-	int r;
+	int devfd, r;
 
 	if (digest_size > sizeof(read_digest))
 		return -EINVAL;
@@ -168,8 +297,9 @@ static int create_or_verify(struct crypt_device *cd, FILE *rd, FILE *wr,
 		return -EINVAL;
 	}
 
-	if (fseeko(rd, seek_rd, SEEK_SET)) {
-		log_dbg(cd, "Cannot seek to requested position in data device.");
+	devfd = open_blocks(cd, rd, seek_rd);
+	if (devfd < 0) {
+		log_dbg(cd, "Cannot open device %s.", device_path(rd));
 		return -EIO;
 	}
 
@@ -178,9 +308,17 @@ static int create_or_verify(struct crypt_device *cd, FILE *rd, FILE *wr,
 		return -EIO;
 	}
 
+	batch_blocks = VERITY_BATCH_SIZE / data_block_size;
+	if (!batch_blocks)
+		batch_blocks = 1;
+	if (batch_blocks > blocks)
+		batch_blocks = blocks ?: 1;
+
 	left_block = malloc(hash_block_size);
-	data_buffer = malloc(data_block_size);
-	if (!left_block || !data_buffer) {
+	if (posix_memalign((void **)&data_buffer, device_alignment(rd), batch_blocks * data_block_size))
+		data_buffer = NULL;
+	digests = malloc(batch_blocks * digest_size);
+	if (!left_block || !data_buffer || !digests) {
 		r = -ENOMEM;
 		goto out;
 	}
@@ -191,20 +329,27 @@ static int create_or_verify(struct crypt_device *cd, FILE *rd, FILE *wr,
 		for (i = 0; i < hash_per_block; i++) {
 			if (!blocks)
 				break;
-			blocks--;
-			if (fread(data_buffer, data_block_size, 1, rd) != 1) {
-				log_dbg(cd, "Cannot read data device block.");
-				r = -EIO;
-				goto out;
-			}
+			if (batch_idx == batch_count) {
+				batch_count = blocks < batch_blocks ? blocks : batch_blocks;
+				batch_idx = 0;
+				if (read_blocks(cd, rd, devfd, data_buffer, batch_count * data_block_size,
+						seek_rd + block_idx * data_block_size)) {
+					log_dbg(cd, "Cannot read data device block.");
+					r = -EIO;
+					goto out;
+				}
 
-			if (verify_hash_block(hash_name, version,
-					calculated_digest, digest_size,
-					data_buffer, data_block_size,
-					salt, salt_size)) {
-				r = -EINVAL;
-				goto out;
+				if (hash_batch(threads, hash_name, version,
+					       digests, digest_size,
+					       data_buffer, data_block_size, batch_count,
+					       salt, salt_size)) {
+					r = -EINVAL;
+					goto out;
+				}
 			}
+			blocks--;
+			memcpy(calculated_digest, digests + batch_idx++ * digest_size, digest_size);
+			block_idx++;
 
 			if (!wr)
 				break;
@@ -216,7 +361,7 @@ static int create_or_verify(struct crypt_device *cd, FILE *rd, FILE *wr,
 				}
 				if (crypt_backend_memeq(read_digest, calculated_digest, digest_size)) {
 					log_err(cd, _("Verification failed at position %" PRIu64 "."),
-						ftello(rd) - data_block_size);
+						seek_rd + (block_idx - 1) * data_block_size);
 					r = -EPERM;
 					goto out;
 				}
@@ -260,16 +405,204 @@ static int create_or_verify(struct crypt_device *cd, FILE *rd, FILE *wr,
 out:
 	free(left_block);
 	free(data_buffer);
+	free(digests);
+	return r;
+}
+
+/*
+ * Single pass hash tree builder: keeps one partial hash block per level
+ * and emits a block as soon as it is full, so every level is written
+ * exactly once and nothing is read back from the hash device.
+ */
+struct verity_stream {
+	struct crypt_device *cd;
+	FILE *wr;
+	int levels;
+	int version;
+	struct crypt_hash *hd; /* shared by all levels */
+	const char *salt;
+	size_t salt_size;
+	size_t hash_block_size;
+	size_t hash_per_block;
+	size_t digest_size;
+	size_t entry_size;
+	const uint64_t *level_block;
+	char *root_digest;
+	struct {
+		char *block;
+		size_t entries;
+		uint64_t written;
+	} level[VERITY_MAX_LEVELS];
+};
+
+static int stream_flush(struct verity_stream *vs, int level);
+
+static int stream_add(struct verity_stream *vs, int level, const char *digest)
+{
+	if (level == vs->levels) {
+		memcpy(vs->root_digest, digest, vs->digest_size);
+		return 0;
+	}
+
+	/* spare area and block tail stay zeroed */
+	memcpy(vs->level[level].block + vs->level[level].entries++ * vs->entry_size,
+	       digest, vs->digest_size);
+
+	if (vs->level[level].entries == vs->hash_per_block)
+		return stream_flush(vs, level);
+
+	return 0;
+}
+
+static int stream_flush(struct verity_stream *vs, int level)
+{
+	char digest[VERITY_MAX_DIGEST_SIZE];
+	uint64_t seek_wr;
+	int r;
+
+	if (uint64_mult_overflow(&seek_wr, vs->level_block[level] + vs->level[level].written,
+				 vs->hash_block_size)) {
+		log_err(vs->cd, _("Device offset overflow."));
+		return -EINVAL;
+	}
+
+	if (fseeko(vs->wr, seek_wr, SEEK_SET)) {
+		log_dbg(vs->cd, "Cannot seek to requested position in hash device.");
+		return -EIO;
+	}
+
+	if (fwrite(vs->level[level].block, vs->hash_block_size, 1, vs->wr) != 1) {
+		log_dbg(vs->cd, "Cannot write hash block to hash device.");
+		return -EIO;
+	}
+	vs->level[level].written++;
+
+	if (hash_block(vs->hd, vs->version, digest, vs->digest_size,
+		       vs->level[level].block, vs->hash_block_size,
+		       vs->salt, vs->salt_size))
+		return -EINVAL;
+
+	memset(vs->level[level].block, 0, vs->hash_block_size);
+	vs->level[level].entries = 0;
+
+	r = stream_add(vs, level + 1, digest);
+	crypt_safe_memzero(digest, sizeof(digest));
+	return r;
+}
+
+static int create_stream(struct crypt_device *cd, struct device *rd, FILE *wr,
+			 size_t data_block_size, size_t hash_block_size,
+			 uint64_t blocks, int levels,
+			 const uint64_t *hash_level_block, const uint64_t *hash_level_size,
+			 int version, const char *hash_name,
+			 char *calculated_digest, size_t digest_size,
+			 const char *salt, size_t salt_size,
+			 struct verity_fec_stream *fs)
+{
+	struct verity_stream vs = {
+		.cd = cd,
+		.wr = wr,
+		.levels = levels,
+		.version = version,
+		.salt = salt,
+		.salt_size = salt_size,
+		.hash_block_size = hash_block_size,
+		.hash_per_block = 1 << get_bits_down(hash_block_size / digest_size),
+		.digest_size = digest_size,
+		.entry_size = version ? 1 << get_bits_up(digest_size) : digest_size,
+		.level_block = hash_level_block,
+		.root_digest = calculated_digest,
+	};
+	char *data_buffer = NULL, *digests = NULL;
+	unsigned threads = crypt_cpusonline();
+	size_t batch_blocks, count, i;
+	uint64_t offset = 0;
+	int devfd, l, r = -ENOMEM;
+
+	if (levels < 1 || levels > VERITY_MAX_LEVELS)
+		return -EINVAL;
+
+	batch_blocks = VERITY_BATCH_SIZE / data_block_size;
+	if (!batch_blocks)
+		batch_blocks = 1;
+	if (batch_blocks > blocks)
+		batch_blocks = blocks ?: 1;
+
+	if (posix_memalign((void **)&data_buffer, device_alignment(rd), batch_blocks * data_block_size))
+		data_buffer = NULL;
+	digests = malloc(batch_blocks * digest_size);
+	if (!data_buffer || !digests)
+		goto out;
+
+	for (l = 0; l < levels; l++)
+		if (!(vs.level[l].block = calloc(1, hash_block_size)))
+			goto out;
+
+	if (crypt_hash_init(&vs.hd, hash_name)) {
+		r = -EINVAL;
+		goto out;
+	}
+
+	devfd = open_blocks(cd, rd, 0);
+	if (devfd < 0) {
+		log_dbg(cd, "Cannot open device %s.", device_path(rd));
+		r = -EIO;
+		goto out;
+	}
+
+	while (blocks) {
+		count = blocks < batch_blocks ? blocks : batch_blocks;
+		if (read_blocks(cd, rd, devfd, data_buffer, count * data_block_size, offset)) {
+			log_dbg(cd, "Cannot read data device block.");
+			r = -EIO;
+			goto out;
+		}
+
+		if (hash_batch(threads, hash_name, version, digests, digest_size,
+			       data_buffer, data_block_size, count, salt, salt_size)) {
+			r = -EINVAL;
+			goto out;
+		}
+
+		/* data blocks are read only once, feed FEC encoder with them too */
+		VERITY_FEC_stream_add(fs, data_buffer, count);
+
+		for (i = 0; i < count; i++)
+			if ((r = stream_add(&vs, 0, digests + i * digest_size)))
+				goto out;
+		blocks -= count;
+		offset += count * data_block_size;
+	}
+
+	/* Emit partial blocks, bottom up, the top level block yields the root digest. */
+	for (l = 0, r = 0; l < levels && !r; l++)
+		if (vs.level[l].entries)
+			r = stream_flush(&vs, l);
+	if (r)
+		goto out;
+
+	for (l = 0; l < levels; l++)
+		if (vs.level[l].written != hash_level_size[l]) {
+			log_dbg(cd, "Unexpected number of hash blocks at level %d.", l);
+			r = -EINVAL;
+			goto out;
+		}
+out:
+	if (vs.hd)
+		crypt_hash_destroy(vs.hd);
+	for (l = 0; l < levels; l++)
+		free(vs.level[l].block);
+	free(data_buffer);
+	free(digests);
 	return r;
 }
 
 static int VERITY_create_or_verify_hash(struct crypt_device *cd, bool verify,
-	struct crypt_params_verity *params,
+	struct crypt_params_verity *params, struct verity_fec_stream *fs,
 	char *root_hash, size_t digest_size)
 {
 	char calculated_digest[VERITY_MAX_DIGEST_SIZE];
-	FILE *data_file = NULL;
-	FILE *hash_file = NULL, *hash_file_2;
+	FILE *hash_file = NULL;
 	uint64_t hash_level_block[VERITY_MAX_LEVELS];
 	uint64_t hash_level_size[VERITY_MAX_LEVELS];
 	uint64_t data_file_blocks;
@@ -315,8 +648,7 @@ static int VERITY_create_or_verify_hash(struct crypt_device *cd, bool verify,
 		hash_device_offset_max - params->hash_area_offset);
 	log_dbg(cd, "Using %d hash levels.", levels);
 
-	data_file = fopen(device_path(crypt_data_device(cd)), "r");
-	if (!data_file) {
+	if (device_open(cd, crypt_data_device(cd), O_RDONLY) < 0) {
 		log_err(cd, _("Cannot open device %s."),
 			device_path(crypt_data_device(cd))
 		);
@@ -334,9 +666,18 @@ static int VERITY_create_or_verify_hash(struct crypt_device *cd, bool verify,
 
 	memset(calculated_digest, 0, digest_size);
 
+	if (!verify && levels) {
+		r = create_stream(cd, crypt_data_device(cd), hash_file,
+				  params->data_block_size, params->hash_block_size,
+				  data_file_blocks, levels, hash_level_block, hash_level_size,
+				  params->hash_type, params->hash_name,
+				  calculated_digest, digest_size, params->salt, params->salt_size, fs);
+		goto out;
+	}
+
 	for (i = 0; i < levels; i++) {
 		if (!i) {
-			r = create_or_verify(cd, data_file, hash_file,
+			r = create_or_verify(cd, crypt_data_device(cd), hash_file,
 						    0, params->data_block_size,
 						    hash_level_block[i], params->hash_block_size,
 						    data_file_blocks, params->hash_type, params->hash_name, verify,
@@ -344,32 +685,24 @@ static int VERITY_create_or_verify_hash(struct crypt_device *cd, bool verify,
 			if (r)
 				goto out;
 		} else {
-			hash_file_2 = fopen(device_path(crypt_metadata_device(cd)), "r");
-			if (!hash_file_2) {
-				log_err(cd, _("Cannot open device %s."),
-					device_path(crypt_metadata_device(cd)));
-				r = -EIO;
-				goto out;
-			}
-			r = create_or_verify(cd, hash_file_2, hash_file,
+			r = create_or_verify(cd, crypt_metadata_device(cd), hash_file,
 						    hash_level_block[i - 1], params->hash_block_size,
 						    hash_level_block[i], params->hash_block_size,
 						    hash_level_size[i - 1], params->hash_type, params->hash_name, verify,
 						    calculated_digest, digest_size, params->salt, params->salt_size);
-			fclose(hash_file_2);
 			if (r)
 				goto out;
 		}
 	}
 
 	if (levels)
-		r = create_or_verify(cd, hash_file, NULL,
+		r = create_or_verify(cd, crypt_metadata_device(cd), NULL,
 					    hash_level_block[levels - 1], params->hash_block_size,
 					    0, params->hash_block_size,
 					    1, params->hash_type, params->hash_name, verify,
 					    calculated_digest, digest_size, params->salt, params->salt_size);
 	else
-		r = create_or_verify(cd, data_file, NULL,
+		r = create_or_verify(cd, crypt_data_device(cd), NULL,
 					    0, params->data_block_size,
 					    0, params->hash_block_size,
 					    data_file_blocks, params->hash_type, params->hash_name, verify,
@@ -397,8 +730,6 @@ out:
 		}
 	}
 
-	if (data_file)
-		fclose(data_file);
 	if (hash_file)
 		fclose(hash_file);
 	return r;
@@ -410,16 +741,19 @@ int VERITY_verify(struct crypt_device *cd,
 		  const char *root_hash,
 		  size_t root_hash_size)
 {
-	return VERITY_create_or_verify_hash(cd, 1, verity_hdr, CONST_CAST(char*)root_hash, root_hash_size);
+	return VERITY_create_or_verify_hash(cd, 1, verity_hdr, NULL, CONST_CAST(char*)root_hash, root_hash_size);
 }
 
-/* Create verity hash */
+/* Create verity hash and FEC parity (if fec_device is set) */
 int VERITY_create(struct crypt_device *cd,
 		  struct crypt_params_verity *verity_hdr,
+		  struct device *fec_device,
 		  const char *root_hash,
 		  size_t root_hash_size)
 {
+	struct verity_fec_stream *fs = NULL;
 	unsigned pgsize = (unsigned)crypt_getpagesize();
+	int r;
 
 	if (verity_hdr->salt_size > 256)
 		return -EINVAL;
@@ -428,7 +762,448 @@ int VERITY_create(struct crypt_device *cd,
 		log_err(cd, _("WARNING: Kernel cannot activate device if data "
 			      "block size exceeds page size (%u)."), pgsize);
 
-	return VERITY_create_or_verify_hash(cd, 0, verity_hdr, CONST_CAST(char*)root_hash, root_hash_size);
+	/* encode parity from data read for hashing, otherwise read all inputs again later */
+	if (fec_device) {
+		r = VERITY_FEC_stream_init(cd, verity_hdr, fec_device, &fs);
+		if (r && r != -ENOTSUP)
+			return r;
+	}
+
+	r = VERITY_create_or_verify_hash(cd, 0, verity_hdr, fs, CONST_CAST(char*)root_hash, root_hash_size);
+	if (!r && fs)
+		r = VERITY_FEC_stream_finish(cd, fs);
+	else if (!r && fec_device)
+		r = VERITY_FEC_process(cd, verity_hdr, fec_device, 0, NULL);
+
+	VERITY_FEC_stream_free(fs);
+	return r;
+}
+
+struct update_range {
+	uint64_t start, end;
+};
+
+static int update_range_cmp(const void *a, const void *b)
+{
+	const struct update_range *ra = a, *rb = b;
+
+	return ra->start < rb->start ? -1 : ra->start > rb->start;
+}
+
+/* sort and merge overlapping or adjacent ranges */
+static size_t update_ranges_merge(struct update_range *ranges, size_t count)
+{
+	size_t i, n = 0;
+
+	if (!count)
+		return 0;
+
+	qsort(ranges, count, sizeof(*ranges), update_range_cmp);
+
+	for (i = 1; i < count; i++) {
+		if (ranges[i].start <= ranges[n].end) {
+			if (ranges[i].end > ranges[n].end)
+				ranges[n].end = ranges[i].end;
+		} else
+			ranges[++n] = ranges[i];
+	}
+
+	return n + 1;
+}
+
+/*
+ * Recompute digests of changed child blocks (data blocks for the lowest
+ * level, hash blocks of the level below otherwise) and patch them into
+ * the hash blocks of this level (read-modify-write of whole hash blocks).
+ */
+static int update_level(struct crypt_device *cd, struct crypt_params_verity *params,
+			struct device *rd, int rd_fd, uint64_t rd_offset, size_t child_size,
+			int wr_fd, uint64_t wr_offset,
+			const struct update_range *ranges, size_t count,
+			size_t hash_per_block, size_t entry_size, size_t digest_size,
+			char *child_buffer, char *digests, char *hash_block)
+{
+	struct device *wr = crypt_metadata_device(cd);
+	unsigned threads = crypt_cpusonline();
+	size_t hash_block_size = params->hash_block_size;
+	uint64_t p, c, cs, ce;
+	size_t i;
+	int r;
+
+	for (i = 0; i < count; i++) {
+		for (p = ranges[i].start / hash_per_block; p * hash_per_block < ranges[i].end; p++) {
+			cs = ranges[i].start > p * hash_per_block ? ranges[i].start : p * hash_per_block;
+			ce = ranges[i].end < (p + 1) * hash_per_block ? ranges[i].end : (p + 1) * hash_per_block;
+
+			r = read_blocks(cd, rd, rd_fd, child_buffer, (ce - cs) * child_size,
+					rd_offset + cs * child_size);
+			if (r)
+				return r;
+
+			if (hash_batch(threads, params->hash_name, params->hash_type,
+				       digests, digest_size, child_buffer, child_size, ce - cs,
+				       params->salt, params->salt_size))
+				return -EINVAL;
+
+			if (pread_blockwise(wr_fd, device_block_size(cd, wr), device_alignment(wr),
+						 hash_block, hash_block_size,
+						 wr_offset + p * hash_block_size) != (ssize_t)hash_block_size)
+				return -EIO;
+
+			for (c = cs; c < ce; c++)
+				memcpy(hash_block + (c - p * hash_per_block) * entry_size,
+				       digests + (c - cs) * digest_size, digest_size);
+
+			if (pwrite_blockwise(wr_fd, device_block_size(cd, wr), device_alignment(wr),
+						  hash_block, hash_block_size,
+						  wr_offset + p * hash_block_size) != (ssize_t)hash_block_size)
+				return -EIO;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Update hash area after data blocks in ranges were modified, only changed
+ * leaves and their ancestors are recomputed. Returns new root hash.
+ */
+int VERITY_update(struct crypt_device *cd,
+		  struct crypt_params_verity *params,
+		  const struct crypt_verity_range *changed, size_t changed_count,
+		  char *root_hash, size_t digest_size)
+{
+	struct device *data_device = crypt_data_device(cd), *hash_device = crypt_metadata_device(cd);
+	uint64_t hash_level_block[VERITY_MAX_LEVELS], hash_level_size[VERITY_MAX_LEVELS];
+	uint64_t hash_position = VERITY_hash_offset_block(params), data_blocks = params->data_size;
+	char *child_buffer = NULL, *digests = NULL, *hash_block = NULL;
+	struct update_range *ranges = NULL;
+	size_t i, count, hash_per_block, entry_size, child_max;
+	int levels, l, data_fd, hash_fd, r = -ENOMEM;
+
+	if (!digest_size || digest_size > VERITY_MAX_DIGEST_SIZE || !data_blocks ||
+	    (int)digest_size != crypt_hash_size(params->hash_name))
+		return -EINVAL;
+
+	if (hash_levels(params->hash_block_size, digest_size, data_blocks, &hash_position,
+			&levels, &hash_level_block[0], &hash_level_size[0])) {
+		log_err(cd, _("Hash area overflow."));
+		return -EINVAL;
+	}
+
+	hash_per_block = 1 << get_bits_down(params->hash_block_size / digest_size);
+	entry_size = params->hash_type ? 1 << get_bits_up(digest_size) : digest_size;
+	child_max = params->data_block_size > params->hash_block_size ?
+		    params->data_block_size : params->hash_block_size;
+
+	ranges = malloc((changed_count ?: 1) * sizeof(*ranges));
+	if (posix_memalign((void **)&child_buffer, device_alignment(data_device) > device_alignment(hash_device) ?
+			   device_alignment(data_device) : device_alignment(hash_device), hash_per_block * child_max))
+		child_buffer = NULL;
+	digests = malloc(hash_per_block * digest_size);
+	hash_block = malloc(params->hash_block_size);
+	if (!ranges || !child_buffer || !digests || !hash_block)
+		goto out;
+
+	for (i = 0, count = 0; i < changed_count; i++) {
+		if (!changed[i].length)
+			continue;
+		if (changed[i].offset >= data_blocks || changed[i].length > data_blocks - changed[i].offset) {
+			log_err(cd, _("Changed area is outside of the data device area."));
+			r = -EINVAL;
+			goto out;
+		}
+		ranges[count].start = changed[i].offset;
+		ranges[count++].end = changed[i].offset + changed[i].length;
+	}
+	count = update_ranges_merge(ranges, count);
+
+	data_fd = open_blocks(cd, data_device, 0);
+	hash_fd = device_open(cd, hash_device, O_RDWR);
+	if (data_fd < 0 || hash_fd < 0) {
+		log_err(cd, _("Cannot open device %s."),
+			device_path(data_fd < 0 ? data_device : hash_device));
+		r = -EIO;
+		goto out;
+	}
+
+	log_dbg(cd, "Updating %zu changed area(s) in %d hash level(s).", count, levels);
+
+	for (l = 0, r = 0; l < levels && !r; l++) {
+		if (!l)
+			r = update_level(cd, params, data_device, data_fd, 0, params->data_block_size,
+					 hash_fd, hash_level_block[0] * params->hash_block_size,
+					 ranges, count, hash_per_block, entry_size, digest_size,
+					 child_buffer, digests, hash_block);
+		else
+			r = update_level(cd, params, hash_device, hash_fd,
+					 hash_level_block[l - 1] * params->hash_block_size, params->hash_block_size,
+					 hash_fd, hash_level_block[l] * params->hash_block_size,
+					 ranges, count, hash_per_block, entry_size, digest_size,
+					 child_buffer, digests, hash_block);
+
+		/* blocks of this level changed by updated children */
+		for (i = 0; i < count; i++) {
+			ranges[i].start /= hash_per_block;
+			ranges[i].end = (ranges[i].end - 1) / hash_per_block + 1;
+		}
+		count = update_ranges_merge(ranges, count);
+	}
+	if (r)
+		goto out;
+
+	/* root digest from the top level block, or the only data block */
+	if (levels)
+		r = read_blocks(cd, hash_device, hash_fd, child_buffer, params->hash_block_size,
+				hash_level_block[levels - 1] * params->hash_block_size);
+	else
+		r = read_blocks(cd, data_device, data_fd, child_buffer, params->data_block_size, 0);
+	if (r)
+		goto out;
+
+	if (verify_hash_block(params->hash_name, params->hash_type, root_hash, digest_size,
+			      child_buffer, levels ? params->hash_block_size : params->data_block_size,
+			      params->salt, params->salt_size)) {
+		r = -EINVAL;
+		goto out;
+	}
+
+	if (fsync(hash_fd) < 0)
+		r = -EIO;
+out:
+	if (r == -EIO)
+		log_err(cd, _("Input/output error while updating hash area."));
+	free(ranges);
+	free(child_buffer);
+	free(digests);
+	free(hash_block);
+	return r;
+}
+
+/*
+ * Hash area blocks (counted from the first hash block) rewritten
+ * by VERITY_update() for the changed data ranges.
+ */
+int VERITY_update_hash_ranges(struct crypt_device *cd,
+			      struct crypt_params_verity *params,
+			      const struct crypt_verity_range *changed, size_t changed_count,
+			      struct crypt_verity_range **hash_ranges, size_t *hash_count)
+{
+	uint64_t hash_level_block[VERITY_MAX_LEVELS], hash_level_size[VERITY_MAX_LEVELS];
+	uint64_t hash_position = VERITY_hash_offset_block(params);
+	struct crypt_verity_range *out;
+	struct update_range *ranges;
+	size_t i, count, hash_per_block, n = 0;
+	int levels, l, digest_size = crypt_hash_size(params->hash_name);
+
+	if (digest_size <= 0 || hash_levels(params->hash_block_size, digest_size, params->data_size,
+					   &hash_position, &levels, &hash_level_block[0], &hash_level_size[0]))
+		return -EINVAL;
+
+	hash_per_block = 1 << get_bits_down(params->hash_block_size / digest_size);
+
+	ranges = malloc((changed_count ?: 1) * sizeof(*ranges));
+	out = malloc((changed_count * levels ?: 1) * sizeof(*out));
+	if (!ranges || !out) {
+		free(ranges);
+		free(out);
+		return -ENOMEM;
+	}
+
+	for (i = 0, count = 0; i < changed_count; i++) {
+		if (!changed[i].length)
+			continue;
+		ranges[count].start = changed[i].offset;
+		ranges[count++].end = changed[i].offset + changed[i].length;
+	}
+	count = update_ranges_merge(ranges, count);
+
+	for (l = 0; l < levels; l++) {
+		for (i = 0; i < count; i++) {
+			ranges[i].start /= hash_per_block;
+			ranges[i].end = (ranges[i].end - 1) / hash_per_block + 1;
+		}
+		count = update_ranges_merge(ranges, count);
+
+		for (i = 0; i < count; i++, n++) {
+			out[n].offset = hash_level_block[l] - VERITY_hash_offset_block(params) + ranges[i].start;
+			out[n].length = ranges[i].end - ranges[i].start;
+		}
+	}
+
+	log_dbg(cd, "Changed data affects %zu hash area range(s).", n);
+	free(ranges);
+	*hash_ranges = out;
+	*hash_count = n;
+	return 0;
+}
+
+/*
+ * Check all children (data blocks or hash blocks of the level below) against
+ * digests stored in their parent level. With report, mismatching children
+ * are recorded and checking continues; without it the first one fails.
+ */
+static int verify_children(struct crypt_device *cd, struct crypt_params_verity *params,
+			   struct device *rd, int rd_fd, uint64_t rd_offset, size_t child_size,
+			   uint64_t children, int hash_fd, uint64_t parent_offset,
+			   size_t hash_per_block, size_t entry_size, size_t digest_size,
+			   size_t batch_children, char *child_buffer, char *parent_buffer, char *digests,
+			   struct crypt_verity_report *report)
+{
+	struct device *hash_device = crypt_metadata_device(cd);
+	unsigned threads = crypt_cpusonline();
+	uint64_t c, cs, count, p0, parents;
+	int r;
+
+	for (cs = 0; cs < children; cs += count) {
+		count = children - cs < batch_children ? children - cs : batch_children;
+		p0 = cs / hash_per_block;
+		parents = (count + hash_per_block - 1) / hash_per_block;
+
+		r = read_blocks(cd, rd, rd_fd, child_buffer, count * child_size, rd_offset + cs * child_size);
+		if (!r)
+			r = read_blocks(cd, hash_device, hash_fd, parent_buffer, parents * params->hash_block_size,
+					parent_offset + p0 * params->hash_block_size);
+		if (r)
+			return r;
+
+		if (hash_batch(threads, params->hash_name, params->hash_type, digests, digest_size,
+			       child_buffer, child_size, count, params->salt, params->salt_size))
+			return -EINVAL;
+
+		for (c = 0; c < count; c++) {
+			if (!crypt_backend_memeq(digests + c * digest_size,
+						 parent_buffer + (c / hash_per_block) * params->hash_block_size +
+						 (c % hash_per_block) * entry_size, digest_size))
+				continue;
+			if (!report)
+				return -EPERM;
+			if (report->bad_blocks && report->bad_blocks_count < report->bad_blocks_size)
+				report->bad_blocks[report->bad_blocks_count] = cs + c;
+			report->bad_blocks_count++;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Verify the tree top down: the root first, then every hash level against
+ * the level above and finally (unless only hash area is requested) all
+ * data blocks, collecting every corrupted data block into report.
+ */
+int VERITY_verify_report(struct crypt_device *cd,
+			 struct crypt_params_verity *params,
+			 const char *root_hash, size_t digest_size,
+			 uint32_t flags, struct crypt_verity_report *report)
+{
+	struct device *data_device = crypt_data_device(cd), *hash_device = crypt_metadata_device(cd);
+	uint64_t hash_level_block[VERITY_MAX_LEVELS], hash_level_size[VERITY_MAX_LEVELS];
+	uint64_t hash_position = VERITY_hash_offset_block(params), data_blocks = params->data_size;
+	char calculated_digest[VERITY_MAX_DIGEST_SIZE];
+	char *child_buffer = NULL, *parent_buffer = NULL, *digests = NULL;
+	size_t hash_per_block, entry_size, child_max, batch_children, alignment;
+	int levels, l, data_fd, hash_fd, r = -ENOMEM;
+
+	if (!digest_size || digest_size > sizeof(calculated_digest) || !data_blocks ||
+	    (int)digest_size != crypt_hash_size(params->hash_name))
+		return -EINVAL;
+
+	report->bad_blocks_count = 0;
+
+	if (hash_levels(params->hash_block_size, digest_size, data_blocks, &hash_position,
+			&levels, &hash_level_block[0], &hash_level_size[0])) {
+		log_err(cd, _("Hash area overflow."));
+		return -EINVAL;
+	}
+
+	hash_per_block = 1 << get_bits_down(params->hash_block_size / digest_size);
+	entry_size = params->hash_type ? 1 << get_bits_up(digest_size) : digest_size;
+	child_max = params->data_block_size > params->hash_block_size ?
+		    params->data_block_size : params->hash_block_size;
+
+	/* whole parent blocks per batch */
+	batch_children = VERITY_BATCH_SIZE / child_max / hash_per_block * hash_per_block;
+	if (!batch_children)
+		batch_children = hash_per_block;
+
+	alignment = device_alignment(data_device) > device_alignment(hash_device) ?
+		    device_alignment(data_device) : device_alignment(hash_device);
+	if (posix_memalign((void **)&child_buffer, alignment, batch_children * child_max))
+		child_buffer = NULL;
+	if (posix_memalign((void **)&parent_buffer, alignment,
+			   batch_children / hash_per_block * params->hash_block_size))
+		parent_buffer = NULL;
+	digests = malloc(batch_children * digest_size);
+	if (!child_buffer || !parent_buffer || !digests)
+		goto out;
+
+	data_fd = open_blocks(cd, data_device, 0);
+	hash_fd = open_blocks(cd, hash_device, hash_level_block[levels ? levels - 1 : 0] * params->hash_block_size);
+	if (data_fd < 0 || hash_fd < 0) {
+		log_err(cd, _("Cannot open device %s."),
+			device_path(data_fd < 0 ? data_device : hash_device));
+		r = -EIO;
+		goto out;
+	}
+
+	/* root covers the top level block, or the only data block */
+	if (levels)
+		r = read_blocks(cd, hash_device, hash_fd, child_buffer, params->hash_block_size,
+				hash_level_block[levels - 1] * params->hash_block_size);
+	else
+		r = read_blocks(cd, data_device, data_fd, child_buffer, params->data_block_size, 0);
+	if (r)
+		goto out;
+
+	if (verify_hash_block(params->hash_name, params->hash_type, calculated_digest, digest_size,
+			      child_buffer, levels ? params->hash_block_size : params->data_block_size,
+			      params->salt, params->salt_size)) {
+		r = -EINVAL;
+		goto out;
+	}
+
+	if (crypt_backend_memeq(root_hash, calculated_digest, digest_size)) {
+		log_err(cd, _("Verification of root hash failed."));
+		if (!levels)
+			report->bad_blocks_count = 1;
+		r = -EFAULT;
+		goto out;
+	}
+	if (!levels)
+		goto out;
+
+	/* upper levels can be checked quickly, data checks are useless if these fail */
+	for (l = levels - 1; l > 0 && !r; l--) {
+		r = verify_children(cd, params, hash_device, hash_fd,
+				    hash_level_block[l - 1] * params->hash_block_size, params->hash_block_size,
+				    hash_level_size[l - 1], hash_fd, hash_level_block[l] * params->hash_block_size,
+				    hash_per_block, entry_size, digest_size,
+				    batch_children, child_buffer, parent_buffer, digests, NULL);
+		if (r == -EPERM) {
+			log_err(cd, _("Verification of hash area failed at level %d."), l - 1);
+			r = -EFAULT;
+		}
+	}
+	if (r || (flags & CRYPT_VERITY_VERIFY_HASH_ONLY))
+		goto out;
+
+	r = verify_children(cd, params, data_device, data_fd, 0, params->data_block_size,
+			    data_blocks, hash_fd, hash_level_block[0] * params->hash_block_size,
+			    hash_per_block, entry_size, digest_size,
+			    batch_children, child_buffer, parent_buffer, digests, report);
+	if (!r && report->bad_blocks_count) {
+		log_err(cd, _("Verification failed for %" PRIu64 " data block(s)."), report->bad_blocks_count);
+		r = -EPERM;
+	}
+out:
+	if (r == -EIO)
+		log_err(cd, _("Input/output error while verifying hash area."));
+	crypt_safe_memzero(calculated_digest, sizeof(calculated_digest));
+	free(child_buffer);
+	free(parent_buffer);
+	free(digests);
+	return r;
 }
 
 uint64_t VERITY_hash_blocks(struct crypt_device *cd, struct crypt_params_verity *params)
@@ -38,6 +38,7 @@ struct volume_key *crypt_alloc_volume_key(size_t keylength, const char *key)
 		return NULL;
 
 	vk->key_description = NULL;
+	vk->key_hex = NULL;
 	vk->keylength = keylength;
 	vk->id = -1;
 	vk->next = NULL;
@@ -66,6 +67,22 @@ int crypt_volume_key_set_description(struct volume_key *vk, const char *key_desc
 	return 0;
 }
 
+/*
+ * Hex encoded key for dm table, kept with the key so repeated table loads
+ * (reencryption steps reload the same keys) do not encode it again.
+ * Key content must not be changed once this is called.
+ */
+const char *crypt_volume_key_hex(struct volume_key *vk)
+{
+	if (!vk)
+		return NULL;
+
+	if (!vk->key_hex)
+		vk->key_hex = crypt_bytes_to_hex(vk->keylength, vk->key);
+
+	return vk->key_hex;
+}
+
 void crypt_volume_key_set_id(struct volume_key *vk, int id)
 {
 	if (vk && id >= 0)
@@ -123,6 +140,7 @@ void crypt_free_volume_key(struct volume_key *vk)
 		crypt_safe_memzero(vk->key, vk->keylength);
 		vk->keylength = 0;
 		free(CONST_CAST(void*)vk->key_description);
+		crypt_safe_free(vk->key_hex);
 		vk_next = vk->next;
 		free(vk);
 		vk = vk_next;
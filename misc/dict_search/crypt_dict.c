@@ -3,8 +3,7 @@
  *
  * Copyright (C) 2012 Milan Broz <gmazyland@gmail.com>
  *
- * Run this (for LUKS as root),
- * e.g. ./crypt_dict test.img /usr/share/john/password.lst 4
+ * Run this e.g. ./crypt_dict luks test.img /usr/share/john/password.lst 4
  *
  * This program is free software; you can redistribute it and/or
  * modify it under the terms of the GNU General Public License
@@ -30,18 +29,86 @@
 #include <sys/prctl.h>
 #include <sys/time.h>
 #include <sys/resource.h>
+#include <errno.h>
 #include <libcryptsetup.h>
 
 #define MAX_LEN 512
+#define BATCH 1024
 
 static enum { LUKS, TCRYPT } device_type;
 
+/* Read next password, returns length or -1 on EOF */
+static int read_pwd(FILE *f, char *pwd)
+{
+	int len;
+
+	while (fgets(pwd, MAX_LEN, f)) {
+		len = strlen(pwd);
+
+		/* strip EOL - this is like a input from tty */
+		if (len && pwd[len - 1] == '\n') {
+			pwd[len - 1] = '\0';
+			len--;
+		}
+
+		/* lines starting "#!comment" are comments */
+		if (len >= 9 && !strncmp(pwd, "#!comment", 9)) {
+			/* printf("skipping %s\n", pwd); */
+			continue;
+		}
+
+		return len;
+	}
+
+	return -1;
+}
+
+/* LUKS candidates are tested in batches by the library, using all threads */
+static int check_luks(struct crypt_device *cd, const char *pwd_file, unsigned threads)
+{
+	static char pwd[BATCH][MAX_LEN];
+	const char *pwds[BATCH];
+	size_t lens[BATCH], count, found;
+	FILE *f;
+	int len, r = -EPERM;
+
+	f = fopen(pwd_file, "r");
+	if (!f) {
+		printf("Cannot open %s.\n", pwd_file);
+		return EXIT_FAILURE;
+	}
+
+	do {
+		for (count = 0; count < BATCH && (len = read_pwd(f, pwd[count])) >= 0; count++) {
+			pwds[count] = pwd[count];
+			lens[count] = len;
+		}
+
+		if (count)
+			r = crypt_keyslot_test_passphrases(cd, CRYPT_ANY_SLOT, pwds, lens,
+							   count, threads, &found);
+	} while (count == BATCH && r == -EPERM);
+
+	fclose(f);
+
+	if (r >= 0)
+		printf("Found passphrase for slot %d: \"%s\"\n", r, pwd[found]);
+	else if (r != -EPERM)
+		printf("Passphrase check failed (%d).\n", r);
+
+	return r >= 0 || r == -EPERM ? EXIT_SUCCESS : EXIT_FAILURE;
+}
+
 static void check(struct crypt_device *cd, const char *pwd_file, unsigned my_id, unsigned max_id)
 {
 	FILE *f;
 	int len, r = -1;
 	unsigned long line = 0;
 	char pwd[MAX_LEN];
+	struct crypt_params_tcrypt params = {
+		.flags = CRYPT_TCRYPT_LEGACY_MODES,
+		.passphrase = pwd,
+	};
 
 	if (fork())
 		return;
@@ -53,37 +120,15 @@ static void check(struct crypt_device *cd, const char *pwd_file, unsigned my_id,
 		exit(EXIT_FAILURE);
 	}
 
-	while (fgets(pwd, MAX_LEN, f)) {
+	while ((len = read_pwd(f, pwd)) >= 0) {
 
-		/* every process tries N-th line, skip others */
+		/* every process tries N-th password, skip others */
 		if (line++ % max_id != my_id)
 			continue;
 
-		len = strlen(pwd);
-
-		/* strip EOL - this is like a input from tty */
-		if (len && pwd[len - 1] == '\n') {
-			pwd[len - 1] = '\0';
-			len--;
-		}
-
-		/* lines starting "#!comment" are comments */
-		if (len >= 9 && !strncmp(pwd, "#!comment", 9)) {
-			/* printf("skipping %s\n", pwd); */
-			continue;
-		}
-
 		/* printf("%d: checking %s\n", my_id, pwd); */
-		if (device_type == LUKS)
-			r = crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, pwd, len, 0);
-		else if (device_type == TCRYPT) {
-			struct crypt_params_tcrypt params = {
-				.flags = CRYPT_TCRYPT_LEGACY_MODES,
-				.passphrase = pwd,
-				.passphrase_size = len,
-			};
-			r = crypt_load(cd, CRYPT_TCRYPT, &params);
-		}
+		params.passphrase_size = len;
+		r = crypt_load(cd, CRYPT_TCRYPT, &params);
 		if (r >= 0) {
 			printf("Found passphrase for slot %d: \"%s\"\n", r, pwd);
 			break;
@@ -101,7 +146,7 @@ int main(int argc, char *argv[])
 	struct crypt_device *cd;
 
 	if (argc < 4 || argc > 5) {
-		printf("Use: %s luks|tcrypt <device|file> <password file> [#processes] %d\n", argv[0], argc);
+		printf("Use: %s luks|tcrypt <device|file> <password file> [#threads] %d\n", argv[0], argc);
 		exit(EXIT_FAILURE);
 	}
 
@@ -121,26 +166,23 @@ int main(int argc, char *argv[])
 
 	/* crypt_set_debug_level(CRYPT_DEBUG_ALL); */
 
-	/*
-	 * Need to create temporary keyslot device-mapper devices and allocate loop if needed,
-	 * so root is required here.
-	 */
-	if (getuid() != 0) {
-		printf("You must be root to run this program.\n");
-                exit(EXIT_FAILURE);
-	}
-
-	/* signal all children if anything happens */
-	prctl(PR_SET_PDEATHSIG, SIGHUP);
-	setpriority(PRIO_PROCESS, 0, -5);
-
 	/* we are not going to modify anything, so common init is ok */
 	if (crypt_init(&cd, argv[2]) ||
-	    (device_type == LUKS && crypt_load(cd, CRYPT_LUKS1, NULL))) {
+	    (device_type == LUKS && crypt_load(cd, CRYPT_LUKS, NULL))) {
 		printf("Cannot open %s.\n", argv[2]);
 		exit(EXIT_FAILURE);
 	}
 
+	if (device_type == LUKS) {
+		status = check_luks(cd, argv[3], procs);
+		crypt_free(cd);
+		exit(status);
+	}
+
+	/* signal all children if anything happens */
+	prctl(PR_SET_PDEATHSIG, SIGHUP);
+	setpriority(PRIO_PROCESS, 0, -5);
+
 	/* run scan in separate processes, it is up to scheduler to assign CPUs inteligently */
 	for (i = 0; i < procs; i++)
 		check(cd, argv[3], i, procs);
@@ -22,6 +22,11 @@
  */
 
 #include <uuid/uuid.h>
+#include <time.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
+#include <pthread.h>
 
 #include "cryptsetup.h"
 #include "cryptsetup_args.h"
@@ -436,6 +441,70 @@ out:
 	return r;
 }
 
+/*
+ * Read recovery passwords (non-empty lines) from file and find the matching
+ * one for the device. Stretched keys are cached, the activation that follows
+ * does not need to stretch the matching key again.
+ */
+static int bitlk_find_recovery_key(struct crypt_device *cd, char **password, size_t *passwordLen)
+{
+	char **keys = NULL, **tmp, *line = NULL;
+	size_t count = 0, i, size = 0;
+	unsigned *lines = NULL, *tmp_lines, lineno = 0;
+	ssize_t len;
+	FILE *f;
+	int r = -ENOMEM;
+
+	if (!(f = fopen(ARG_STR(OPT_RECOVERY_KEYS_FILE_ID), "r"))) {
+		log_err(_("Cannot open recovery keys file %s."), ARG_STR(OPT_RECOVERY_KEYS_FILE_ID));
+		return -EINVAL;
+	}
+
+	while ((len = getline(&line, &size, f)) != -1) {
+		lineno++;
+		while (len && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' '))
+			line[--len] = '\0';
+		if (!len)
+			continue;
+		if (!(tmp = realloc(keys, (count + 1) * sizeof(*keys))))
+			goto out;
+		keys = tmp;
+		if (!(tmp_lines = realloc(lines, (count + 1) * sizeof(*lines))))
+			goto out;
+		lines = tmp_lines;
+		if (!(keys[count] = crypt_safe_alloc(len + 1)))
+			goto out;
+		memcpy(keys[count], line, len + 1);
+		lines[count++] = lineno;
+	}
+
+	if (!count) {
+		log_err(_("No recovery keys found in %s."), ARG_STR(OPT_RECOVERY_KEYS_FILE_ID));
+		r = -EINVAL;
+		goto out;
+	}
+
+	(void)crypt_set_derived_key_cache(cd, 60000);
+	r = crypt_bitlk_find_recovery_key(cd, (const char *const *)keys, count);
+	if (r >= 0) {
+		log_verbose(_("Recovery key on line %u matches.\n"), lines[r]);
+		*passwordLen = strlen(keys[r]);
+		*password = keys[r];
+		keys[r] = NULL;
+		r = 0;
+	} else if (r == -EPERM)
+		log_err(_("No recovery key from %s matches."), ARG_STR(OPT_RECOVERY_KEYS_FILE_ID));
+out:
+	for (i = 0; keys && i < count; i++)
+		crypt_safe_free(keys[i]);
+	free(keys);
+	free(lines);
+	crypt_safe_memzero(line, size);
+	free(line);
+	fclose(f);
+	return r;
+}
+
 static int action_open_bitlk(void)
 {
 	struct crypt_device *cd = NULL;
@@ -472,6 +541,12 @@ static int action_open_bitlk(void)
 			goto out;
 		r = crypt_activate_by_volume_key(cd, activated_name,
 						 key, keysize, activate_flags);
+	} else if (ARG_SET(OPT_RECOVERY_KEYS_FILE_ID)) {
+		r = bitlk_find_recovery_key(cd, &password, &passwordLen);
+		if (r < 0)
+			goto out;
+		r = crypt_activate_by_passphrase(cd, activated_name, CRYPT_ANY_SLOT,
+						password, passwordLen, activate_flags);
 	} else {
 		tries = set_tries_tty();
 		do {
@@ -779,6 +854,495 @@ out:
 	return r;
 }
 
+#define BATCH_UNLOCK_THREADS 16
+
+/* One volume from crypttab-like --batch-file */
+struct batch_volume {
+	char *name;
+	char *device;
+	char *key_file;
+	char *header;
+	uint64_t keyfile_offset;
+	uint64_t keyfile_size;
+	uint32_t flags;
+	bool nofail;
+
+	struct crypt_device *cd;
+	char *vk;
+	size_t vk_size;
+	uint64_t kdf_memory_kb;
+	bool active;
+	int r;
+};
+
+struct batch_unlock {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct batch_volume *volumes;
+	size_t count, next;
+	uint64_t memory_kb, memory_limit_kb;
+};
+
+static void free_batch_volumes(struct batch_volume *volumes, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; i++) {
+		free(volumes[i].name);
+		free(volumes[i].device);
+		free(volumes[i].key_file);
+		free(volumes[i].header);
+		crypt_safe_free(volumes[i].vk);
+		crypt_free(volumes[i].cd);
+	}
+	free(volumes);
+}
+
+/* UUID=, PARTUUID=, LABEL= and PARTLABEL= sources as in crypttab(5) */
+static char *batch_source_path(const char *source)
+{
+	static const struct {
+		const char *tag;
+		const char *dir;
+	} tags[] = {
+		{ "UUID=",      "/dev/disk/by-uuid/" },
+		{ "PARTUUID=",  "/dev/disk/by-partuuid/" },
+		{ "LABEL=",     "/dev/disk/by-label/" },
+		{ "PARTLABEL=", "/dev/disk/by-partlabel/" },
+	};
+	char *path;
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(tags); i++) {
+		if (strncmp(source, tags[i].tag, strlen(tags[i].tag)))
+			continue;
+		if (asprintf(&path, "%s%s", tags[i].dir, source + strlen(tags[i].tag)) < 0)
+			return NULL;
+		return path;
+	}
+
+	return strdup(source);
+}
+
+static int batch_parse_number(const char *value, uint64_t *number)
+{
+	char *end;
+
+	errno = 0;
+	*number = strtoull(value, &end, 10);
+	if (errno || !*value || *end)
+		return -EINVAL;
+
+	return 0;
+}
+
+static int batch_parse_options(struct batch_volume *v, char *options)
+{
+	static const struct {
+		const char *option;
+		uint32_t flag;
+	} flags[] = {
+		{ "discard",                CRYPT_ACTIVATE_ALLOW_DISCARDS },
+		{ "readonly",               CRYPT_ACTIVATE_READONLY },
+		{ "read-only",              CRYPT_ACTIVATE_READONLY },
+		{ "same-cpu-crypt",         CRYPT_ACTIVATE_SAME_CPU_CRYPT },
+		{ "submit-from-crypt-cpus", CRYPT_ACTIVATE_SUBMIT_FROM_CRYPT_CPUS },
+		{ "no-read-workqueue",      CRYPT_ACTIVATE_NO_READ_WORKQUEUE },
+		{ "no-write-workqueue",     CRYPT_ACTIVATE_NO_WRITE_WORKQUEUE },
+	};
+	char *option, *value, *save = NULL;
+	size_t i;
+
+	for (option = strtok_r(options, ",", &save); option; option = strtok_r(NULL, ",", &save)) {
+		for (i = 0; i < ARRAY_SIZE(flags); i++)
+			if (!strcmp(option, flags[i].option))
+				break;
+		if (i < ARRAY_SIZE(flags)) {
+			v->flags |= flags[i].flag;
+			continue;
+		}
+
+		if ((value = strchr(option, '=')))
+			*value++ = '\0';
+
+		if (!strcmp(option, "luks") && !value)
+			continue;
+		else if (!strcmp(option, "nofail") && !value)
+			v->nofail = true;
+		else if (!strcmp(option, "header") && value && *value) {
+			free(v->header);
+			if (!(v->header = strdup(value)))
+				return -ENOMEM;
+		} else if (!strcmp(option, "keyfile-offset") && value) {
+			if (batch_parse_number(value, &v->keyfile_offset))
+				return -EINVAL;
+		} else if (!strcmp(option, "keyfile-size") && value) {
+			if (batch_parse_number(value, &v->keyfile_size) || v->keyfile_size > UINT32_MAX)
+				return -EINVAL;
+		} else if (!strcmp(option, "plain") || !strcmp(option, "tcrypt") ||
+			   !strcmp(option, "bitlk") || !strcmp(option, "fvault2")) {
+			log_err(_("Volume %s: only LUKS devices are supported in batch file."), v->name);
+			return -ENOTSUP;
+		} else
+			log_verbose(_("Volume %s: ignoring unsupported option %s."), v->name, option);
+	}
+
+	return 0;
+}
+
+/*
+ * Read crypttab(5) like file, each line is
+ * "<name> <device> [<key file>|none|- [<options>]]".
+ */
+static int read_batch_file(const char *path, struct batch_volume **r_volumes, size_t *r_count)
+{
+	FILE *f;
+	char *line = NULL, *save, *field[4];
+	struct batch_volume *volumes = NULL, *tmp, *v;
+	size_t count = 0, line_len = 0, line_number = 0, i;
+	int r = 0;
+
+	if (!(f = fopen(path, "r"))) {
+		log_err(_("Cannot open batch file %s."), path);
+		return -EINVAL;
+	}
+
+	while (!r && getline(&line, &line_len, f) != -1) {
+		line_number++;
+		save = NULL;
+		field[0] = strtok_r(line, " \t\r\n", &save);
+		if (!field[0] || *field[0] == '#')
+			continue;
+		for (i = 1; i < ARRAY_SIZE(field); i++)
+			field[i] = strtok_r(NULL, " \t\r\n", &save);
+
+		if (!field[1] || strtok_r(NULL, " \t\r\n", &save)) {
+			log_err(_("Invalid line %zu in batch file %s."), line_number, path);
+			r = -EINVAL;
+			break;
+		}
+
+		if (!(tmp = realloc(volumes, (count + 1) * sizeof(*tmp)))) {
+			r = -ENOMEM;
+			break;
+		}
+		volumes = tmp;
+		v = &volumes[count++];
+		memset(v, 0, sizeof(*v));
+
+		if (!(v->name = strdup(field[0])) || !(v->device = batch_source_path(field[1])) ||
+		    (field[2] && strcmp(field[2], "none") && strcmp(field[2], "-") &&
+		     !(v->key_file = strdup(field[2])))) {
+			r = -ENOMEM;
+			break;
+		}
+
+		if (field[3] && (r = batch_parse_options(v, field[3])) == -EINVAL)
+			log_err(_("Invalid options on line %zu in batch file %s."), line_number, path);
+	}
+
+	if (!r && ferror(f)) {
+		log_err(_("Cannot read batch file %s."), path);
+		r = -EIO;
+	}
+
+	if (!r && !count) {
+		log_err(_("No volumes specified in batch file %s."), path);
+		r = -EINVAL;
+	}
+
+	fclose(f);
+	free(line);
+
+	if (r < 0) {
+		free_batch_volumes(volumes, count);
+		return r;
+	}
+
+	*r_volumes = volumes;
+	*r_count = count;
+	return 0;
+}
+
+/* Memory of the most expensive keyslot PBKDF, keyslots are tried one by one */
+static uint64_t batch_kdf_memory_kb(struct crypt_device *cd)
+{
+	struct crypt_pbkdf_type pbkdf;
+	uint64_t memory_kb = 0;
+	int i;
+
+	for (i = 0; i < crypt_keyslot_max(crypt_get_type(cd)); i++) {
+		if (crypt_keyslot_status(cd, i) < CRYPT_SLOT_ACTIVE ||
+		    crypt_keyslot_get_pbkdf(cd, i, &pbkdf) < 0)
+			continue;
+		if (pbkdf.max_memory_kb > memory_kb)
+			memory_kb = pbkdf.max_memory_kb;
+	}
+
+	return memory_kb;
+}
+
+static int batch_unlock_volume(struct batch_volume *v)
+{
+	char *password = NULL;
+	size_t passwordLen;
+	int r;
+
+	r = crypt_keyfile_device_read(v->cd, v->key_file, &password, &passwordLen,
+				      v->keyfile_offset, v->keyfile_size, 0);
+	if (r < 0)
+		return r;
+
+	v->vk_size = crypt_get_volume_key_size(v->cd);
+	if (!(v->vk = crypt_safe_alloc(v->vk_size))) {
+		crypt_safe_free(password);
+		return -ENOMEM;
+	}
+
+	r = crypt_volume_key_get(v->cd, CRYPT_ANY_SLOT, v->vk, &v->vk_size, password, passwordLen);
+	crypt_safe_free(password);
+	if (r < 0) {
+		crypt_safe_free(v->vk);
+		v->vk = NULL;
+	}
+
+	return r;
+}
+
+/*
+ * Keyslots are unlocked in parallel, but a PBKDF is started only if its
+ * memory cost fits in the limit together with PBKDFs already running
+ * (one is always admitted so that even an oversized keyslot can proceed).
+ */
+static void *batch_unlock_thread(void *arg)
+{
+	struct batch_unlock *bu = arg;
+	struct batch_volume *v;
+	size_t i;
+	int r;
+
+	while (!quit) {
+		pthread_mutex_lock(&bu->lock);
+		i = bu->next++;
+		if (i >= bu->count) {
+			pthread_mutex_unlock(&bu->lock);
+			break;
+		}
+
+		v = &bu->volumes[i];
+		if (!v->cd || v->active || !v->key_file) {
+			pthread_mutex_unlock(&bu->lock);
+			continue;
+		}
+
+		while (bu->memory_kb && bu->memory_kb + v->kdf_memory_kb > bu->memory_limit_kb)
+			pthread_cond_wait(&bu->cond, &bu->lock);
+		bu->memory_kb += v->kdf_memory_kb;
+		pthread_mutex_unlock(&bu->lock);
+
+		r = batch_unlock_volume(v);
+
+		pthread_mutex_lock(&bu->lock);
+		v->r = r;
+		bu->memory_kb -= v->kdf_memory_kb;
+		pthread_cond_broadcast(&bu->cond);
+		pthread_mutex_unlock(&bu->lock);
+	}
+
+	return NULL;
+}
+
+static int batch_unlock_key_files(struct batch_volume *volumes, size_t count)
+{
+	struct batch_unlock bu = {
+		.volumes = volumes,
+		.count = count,
+	};
+	pthread_t threads[BATCH_UNLOCK_THREADS];
+	size_t i, unlock_count = 0, threads_max, threads_count;
+	long cpus, pages, page_size;
+
+	for (i = 0; i < count; i++)
+		if (volumes[i].cd && !volumes[i].active && volumes[i].key_file)
+			unlock_count++;
+
+	threads_max = unlock_count;
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	if (cpus > 0 && threads_max > (size_t)cpus)
+		threads_max = cpus;
+	if (threads_max > BATCH_UNLOCK_THREADS)
+		threads_max = BATCH_UNLOCK_THREADS;
+
+	pages = sysconf(_SC_PHYS_PAGES);
+	page_size = sysconf(_SC_PAGESIZE);
+	bu.memory_limit_kb = (pages > 0 && page_size > 0) ?
+		(uint64_t)pages * page_size / 1024 / 2 : UINT64_MAX;
+
+	if (pthread_mutex_init(&bu.lock, NULL))
+		return -EINVAL;
+	if (pthread_cond_init(&bu.cond, NULL)) {
+		pthread_mutex_destroy(&bu.lock);
+		return -EINVAL;
+	}
+
+	for (threads_count = 0; threads_count < threads_max; threads_count++)
+		if (pthread_create(&threads[threads_count], NULL, batch_unlock_thread, &bu))
+			break;
+
+	log_dbg("Unlocking %zu volumes with key file in %zu threads.", unlock_count, threads_count);
+
+	/* no thread could be started, unlock in this one */
+	if (unlock_count && !threads_count)
+		batch_unlock_thread(&bu);
+
+	for (i = 0; i < threads_count; i++)
+		pthread_join(threads[i], NULL);
+
+	pthread_cond_destroy(&bu.cond);
+	pthread_mutex_destroy(&bu.lock);
+
+	return 0;
+}
+
+/* Volumes without key file use tokens or passphrase, as plain luksOpen */
+static int batch_activate_interactive(struct batch_volume *v)
+{
+	char *password = NULL;
+	size_t passwordLen;
+	int r, tries;
+
+	r = crypt_activate_by_token_pin(v->cd, v->name, NULL, CRYPT_ANY_TOKEN,
+					NULL, 0, NULL, v->flags);
+	tools_keyslot_msg(r, UNLOCKED);
+	if (r >= 0 || r == -EEXIST || quit)
+		return r;
+
+	tries = set_tries_tty();
+	do {
+		r = tools_get_key(NULL, &password, &passwordLen, 0, 0, NULL,
+				  ARG_UINT32(OPT_TIMEOUT_ID), verify_passphrase(0), 0, v->cd);
+		if (r < 0)
+			break;
+
+		r = crypt_activate_by_passphrase(v->cd, v->name, CRYPT_ANY_SLOT,
+						 password, passwordLen, v->flags);
+		tools_keyslot_msg(r, UNLOCKED);
+		tools_passphrase_msg(r);
+		check_signal(&r);
+		crypt_safe_free(password);
+		password = NULL;
+	} while ((r == -EPERM || r == -ERANGE) && (--tries > 0));
+
+	return r;
+}
+
+/*
+ * Headers of all volumes are loaded first, volume keys of volumes with
+ * key file are then unlocked in parallel. All volumes are activated
+ * in one device-mapper batch, waiting for udev only once at the end.
+ */
+static int action_open_batch(void)
+{
+	struct batch_volume *volumes, *v;
+	size_t i, count;
+	int r;
+
+	r = read_batch_file(ARG_STR(OPT_BATCH_FILE_ID), &volumes, &count);
+	if (r < 0)
+		return r;
+
+	for (i = 0; i < count && !quit; i++) {
+		v = &volumes[i];
+
+		if (crypt_status(NULL, v->name) >= CRYPT_ACTIVE) {
+			log_verbose(_("Volume %s is already active."), v->name);
+			v->active = true;
+			continue;
+		}
+
+		v->r = crypt_init_data_device(&v->cd, v->header ?: v->device,
+					      v->header ? v->device : NULL);
+		if (!v->r)
+			v->r = crypt_load(v->cd, luksType(device_type), NULL);
+		if (v->r < 0) {
+			log_err(_("Device %s is not a valid LUKS device."), v->device);
+			crypt_free(v->cd);
+			v->cd = NULL;
+			continue;
+		}
+
+		v->kdf_memory_kb = batch_kdf_memory_kb(v->cd);
+	}
+
+	r = batch_unlock_key_files(volumes, count);
+	if (r < 0)
+		goto out;
+
+	r = crypt_activate_batch_begin(NULL);
+	if (r < 0)
+		goto out;
+
+	for (i = 0; i < count && !quit; i++) {
+		v = &volumes[i];
+		if (!v->cd || v->active)
+			continue;
+
+		if (v->key_file && v->r >= 0) {
+			tools_keyslot_msg(v->r, UNLOCKED);
+			v->r = crypt_activate_by_volume_key(v->cd, v->name, v->vk,
+							    v->vk_size, v->flags);
+		} else if (v->key_file)
+			tools_passphrase_msg(v->r);
+		else
+			v->r = batch_activate_interactive(v);
+
+		crypt_safe_free(v->vk);
+		v->vk = NULL;
+	}
+
+	r = crypt_activate_batch_end(NULL);
+
+	for (i = 0; i < count; i++) {
+		v = &volumes[i];
+		if (v->active || v->r >= 0)
+			continue;
+		log_err(_("Failed to activate volume %s."), v->name);
+		if (!v->nofail && r >= 0)
+			r = v->r;
+	}
+
+	check_signal(&r);
+out:
+	free_batch_volumes(volumes, count);
+	return r;
+}
+
+static int action_close_batch(uint32_t flags)
+{
+	struct batch_volume *volumes;
+	const char **names;
+	size_t i, count;
+	int r;
+
+	r = read_batch_file(ARG_STR(OPT_BATCH_FILE_ID), &volumes, &count);
+	if (r < 0)
+		return r;
+
+	if (!(names = calloc(count, sizeof(*names)))) {
+		free_batch_volumes(volumes, count);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < count; i++)
+		names[i] = volumes[i].name;
+
+	r = crypt_deactivate_batch(NULL, names, count, flags);
+
+	free(names);
+	free_batch_volumes(volumes, count);
+	return r;
+}
+
 static int action_close(void)
 {
 	struct crypt_device *cd = NULL;
@@ -791,6 +1355,12 @@ static int action_close(void)
 	if (ARG_SET(OPT_CANCEL_DEFERRED_ID))
 		flags |= CRYPT_DEACTIVATE_DEFERRED_CANCEL;
 
+	if (ARG_SET(OPT_BATCH_FILE_ID))
+		return action_close_batch(flags);
+
+	if (action_argc > 1)
+		return crypt_deactivate_batch(NULL, action_argv, action_argc, flags);
+
 	r = crypt_init_by_name_and_header(&cd, action_argv[0], ARG_STR(OPT_HEADER_ID));
 	if (r == 0)
 		r = crypt_deactivate_by_name(cd, action_argv[0], flags);
@@ -874,23 +1444,199 @@ out:
 	return r;
 }
 
-static int action_status(void)
+enum {
+	ST_READ_IOS = 0, ST_WRITE_IOS, ST_READ_BYTES, ST_WRITE_BYTES,
+	ST_READ_SECONDS, ST_WRITE_SECONDS, ST_IO_SECONDS, ST_IN_FLIGHT,
+	ST_READ_IOPS, ST_WRITE_IOPS, ST_READ_RATE, ST_WRITE_RATE,
+	ST_READ_LATENCY, ST_WRITE_LATENCY, ST_UTILIZATION, ST_COUNT
+};
+
+static const struct {
+	const char *name;
+	bool counter;
+	const char *help;
+} stats_fields[ST_COUNT] = {
+	{ "read_ios",			true,  "Completed read requests." },
+	{ "write_ios",			true,  "Completed write requests." },
+	{ "read_bytes",			true,  "Bytes read." },
+	{ "write_bytes",		true,  "Bytes written." },
+	{ "read_seconds",		true,  "Time spent by read requests." },
+	{ "write_seconds",		true,  "Time spent by write requests." },
+	{ "io_seconds",			true,  "Time the device had requests in flight." },
+	{ "in_flight",			false, "Requests in flight." },
+	{ "read_iops",			false, "Read requests per second in interval." },
+	{ "write_iops",			false, "Write requests per second in interval." },
+	{ "read_bytes_per_second",	false, "Bytes read per second in interval." },
+	{ "write_bytes_per_second",	false, "Bytes written per second in interval." },
+	{ "read_latency_seconds",	false, "Average read request time in interval." },
+	{ "write_latency_seconds",	false, "Average write request time in interval." },
+	{ "utilization_ratio",		false, "Part of interval the device had requests in flight." },
+};
+
+static void stats_values(const struct crypt_device_io_stats *prev,
+			 const struct crypt_device_io_stats *cur,
+			 double interval_ms, double *v)
 {
-	crypt_status_info ci;
-	crypt_reencrypt_info ri;
-	struct crypt_active_device cad;
-	struct crypt_params_integrity ip = {};
-	struct crypt_device *cd = NULL;
-	char *backing_file;
-	const char *device;
-	int path = 0, r = 0;
+	double secs = interval_ms / 1000.0;
+	uint64_t d_read = cur->read_ios - prev->read_ios,
+		 d_write = cur->write_ios - prev->write_ios;
+
+	v[ST_READ_IOS] = cur->read_ios;
+	v[ST_WRITE_IOS] = cur->write_ios;
+	v[ST_READ_BYTES] = cur->read_sectors * (double)SECTOR_SIZE;
+	v[ST_WRITE_BYTES] = cur->write_sectors * (double)SECTOR_SIZE;
+	v[ST_READ_SECONDS] = cur->read_ticks / 1000.0;
+	v[ST_WRITE_SECONDS] = cur->write_ticks / 1000.0;
+	v[ST_IO_SECONDS] = cur->io_ticks / 1000.0;
+	v[ST_IN_FLIGHT] = cur->in_flight;
+	v[ST_READ_IOPS] = d_read / secs;
+	v[ST_WRITE_IOPS] = d_write / secs;
+	v[ST_READ_RATE] = (cur->read_sectors - prev->read_sectors) * (double)SECTOR_SIZE / secs;
+	v[ST_WRITE_RATE] = (cur->write_sectors - prev->write_sectors) * (double)SECTOR_SIZE / secs;
+	v[ST_READ_LATENCY] = d_read ? (cur->read_ticks - prev->read_ticks) / 1000.0 / d_read : 0.0;
+	v[ST_WRITE_LATENCY] = d_write ? (cur->write_ticks - prev->write_ticks) / 1000.0 / d_write : 0.0;
+	v[ST_UTILIZATION] = (cur->io_ticks - prev->io_ticks) / interval_ms;
+	if (v[ST_UTILIZATION] > 1.0)
+		v[ST_UTILIZATION] = 1.0;
+}
 
-	/* perhaps a path, not a dm device name */
-	if (strchr(action_argv[0], '/'))
-		path = 1;
+/* Both JSON strings and Prometheus label values escape only quote, backslash and newline here. */
+static const char *stats_escape(const char *str, char *buf, size_t buf_size)
+{
+	size_t i = 0;
+
+	for (; *str && i + 2 < buf_size; str++) {
+		if (*str == '"' || *str == '\\')
+			buf[i++] = '\\';
+		else if (*str == '\n') {
+			buf[i++] = '\\';
+			buf[i++] = 'n';
+			continue;
+		} else if ((unsigned char)*str < 0x20)
+			continue;
+		buf[i++] = *str;
+	}
+	buf[i] = '\0';
 
-	ci = crypt_status(NULL, action_argv[0]);
-	switch (ci) {
+	return buf;
+}
+
+static int status_stats(const char *name)
+{
+	struct crypt_device_io_stats *prev = NULL, *cur = NULL;
+	const struct crypt_device_io_stats *p;
+	struct timespec start, end, interval = {
+		.tv_sec = ARG_UINT32(OPT_STATS_INTERVAL_ID) / 1000,
+		.tv_nsec = (ARG_UINT32(OPT_STATS_INTERVAL_ID) % 1000) * 1000000
+	};
+	double interval_ms;
+	char ename[2 * sizeof(cur->name)], edev[2 * sizeof(cur->kernel_name)], emap[2 * sizeof(cur->name)];
+	size_t prev_count, count, i, j;
+	double (*values)[ST_COUNT] = NULL;
+	bool prometheus;
+	int r;
+
+	if (ARG_SET(OPT_STATS_FORMAT_ID) && strcmp(ARG_STR(OPT_STATS_FORMAT_ID), "json") &&
+	    strcmp(ARG_STR(OPT_STATS_FORMAT_ID), "prometheus")) {
+		log_err(_("Unknown I/O statistics format %s."), ARG_STR(OPT_STATS_FORMAT_ID));
+		return -EINVAL;
+	}
+	prometheus = ARG_SET(OPT_STATS_FORMAT_ID) && !strcmp(ARG_STR(OPT_STATS_FORMAT_ID), "prometheus");
+
+	/* accept device path in device-mapper directory */
+	if (!strncmp(name, crypt_get_dir(), strlen(crypt_get_dir())) && name[strlen(crypt_get_dir())] == '/')
+		name += strlen(crypt_get_dir()) + 1;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	r = crypt_get_active_device_io_stats(NULL, name, &prev, &prev_count);
+	if (r < 0)
+		goto out;
+
+	(void)nanosleep(&interval, NULL);
+	check_signal(&r);
+	if (r)
+		goto out;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	r = crypt_get_active_device_io_stats(NULL, name, &cur, &count);
+	if (r < 0)
+		goto out;
+
+	/* rates use real time between both reads */
+	interval_ms = (end.tv_sec - start.tv_sec) * 1000.0 + (end.tv_nsec - start.tv_nsec) / 1000000.0;
+
+	if (!(values = malloc(count * sizeof(*values)))) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < count; i++) {
+		/* device added to the stack in interval has no rates */
+		for (j = 0, p = &cur[i]; j < prev_count; j++)
+			if (!strcmp(prev[j].kernel_name, cur[i].kernel_name))
+				p = &prev[j];
+		stats_values(p, &cur[i], interval_ms, values[i]);
+	}
+
+	stats_escape(name, emap, sizeof(emap));
+
+	if (prometheus) {
+		for (j = 0; j < ST_COUNT; j++) {
+			log_std("# HELP cryptsetup_device_%s%s %s\n", stats_fields[j].name,
+				stats_fields[j].counter ? "_total" : "", stats_fields[j].help);
+			log_std("# TYPE cryptsetup_device_%s%s %s\n", stats_fields[j].name,
+				stats_fields[j].counter ? "_total" : "",
+				stats_fields[j].counter ? "counter" : "gauge");
+			for (i = 0; i < count; i++)
+				log_std("cryptsetup_device_%s%s{mapping=\"%s\",name=\"%s\",device=\"%s\",dm=\"%d\"} %.*g\n",
+					stats_fields[j].name, stats_fields[j].counter ? "_total" : "", emap,
+					stats_escape(cur[i].name, ename, sizeof(ename)),
+					stats_escape(cur[i].kernel_name, edev, sizeof(edev)),
+					cur[i].dm, stats_fields[j].counter ? 15 : 6, values[i][j]);
+		}
+		goto out;
+	}
+
+	log_std("{\n  \"mapping\": \"%s\",\n  \"interval_ms\": %.1f,\n  \"devices\": [", emap, interval_ms);
+	for (i = 0; i < count; i++) {
+		log_std("%s\n    {\n      \"name\": \"%s\",\n      \"device\": \"%s\",\n      \"dm\": %s",
+			i ? "," : "", stats_escape(cur[i].name, ename, sizeof(ename)),
+			stats_escape(cur[i].kernel_name, edev, sizeof(edev)), cur[i].dm ? "true" : "false");
+		for (j = 0; j < ST_COUNT; j++)
+			log_std(",\n      \"%s\": %.*g", stats_fields[j].name,
+				stats_fields[j].counter ? 15 : 6, values[i][j]);
+		log_std("\n    }");
+	}
+	log_std("\n  ]\n}\n");
+out:
+	if (r == -ENODEV)
+		log_err(_("Device %s is not active."), name);
+	free(values);
+	free(prev);
+	free(cur);
+	return r;
+}
+
+static int action_status(void)
+{
+	crypt_status_info ci;
+	crypt_reencrypt_info ri;
+	struct crypt_active_device cad;
+	struct crypt_params_integrity ip = {};
+	struct crypt_device *cd = NULL;
+	char *backing_file;
+	const char *device;
+	int path = 0, r = 0;
+
+	if (ARG_SET(OPT_STATS_ID))
+		return status_stats(action_argv[0]);
+
+	/* perhaps a path, not a dm device name */
+	if (strchr(action_argv[0], '/'))
+		path = 1;
+
+	ci = crypt_status(NULL, action_argv[0]);
+	switch (ci) {
 	case CRYPT_INVALID:
 		r = -EINVAL;
 		break;
@@ -1028,16 +1774,172 @@ static int action_benchmark_kdf(const char *kdf, const char *hash, size_t key_si
 	return r;
 }
 
+/*
+ * One matrix point runs in a child process, so that CPU time and peak RSS
+ * come from its own rusage and are not mixed with previous points.
+ */
+static int benchmark_kdf_point(struct crypt_pbkdf_type *pbkdf, size_t key_size, bool first)
+{
+	struct timespec start, end;
+	struct rusage ru;
+	double wall_ms, cpu_ms;
+	int status, r = 0;
+	pid_t pid;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	pid = fork();
+	if (pid < 0)
+		return -errno;
+	if (!pid)
+		_exit(crypt_benchmark_pbkdf(NULL, pbkdf, "foobarfo", 8,
+			"0123456789abcdef0123456789abcdef", 32, key_size,
+			NULL, NULL) ? EXIT_FAILURE : EXIT_SUCCESS);
+
+	if (wait4(pid, &status, 0, &ru) != pid)
+		return -EINVAL;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (!WIFEXITED(status) || WEXITSTATUS(status))
+		r = -EINVAL;
+
+	wall_ms = (end.tv_sec - start.tv_sec) * 1E3 + (end.tv_nsec - start.tv_nsec) / 1E6;
+	cpu_ms = (ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1E3 +
+		 (ru.ru_utime.tv_usec + ru.ru_stime.tv_usec) / 1E3;
+
+	log_std("%s\n    { \"type\": \"%s\", ", first ? "" : ",", pbkdf->type);
+	if (pbkdf->hash)
+		log_std("\"hash\": \"%s\", ", pbkdf->hash);
+	log_std("\"iterations\": %u, \"memory_kb\": %u, \"parallel\": %u, ",
+		pbkdf->iterations, pbkdf->max_memory_kb, pbkdf->parallel_threads);
+	if (r)
+		log_std("\"ok\": false }");
+	else
+		log_std("\"ok\": true, \"wall_ms\": %.1f, \"cpu_ms\": %.1f, \"peak_rss_kb\": %ld }",
+			wall_ms, cpu_ms, ru.ru_maxrss);
+
+	return r;
+}
+
+/* Argon2 limits for LUKS2 keyslots */
+#define BENCHMARK_MATRIX_MIN_ITERATIONS	4
+#define BENCHMARK_MATRIX_MAX_PARALLEL	4
+
+/* Sweep of PBKDF costs, printed as JSON for comparison of hardware classes */
+static int action_benchmark_kdf_matrix(size_t key_size)
+{
+	static const char *kdfs[] = { CRYPT_KDF_ARGON2I, CRYPT_KDF_ARGON2ID, CRYPT_KDF_PBKDF2, NULL };
+	static const uint32_t pbkdf2_iterations[] = { 1 << 17, 1 << 19, 1 << 21, 0 };
+	struct crypt_pbkdf_type pbkdf;
+	uint64_t max_memory_kb;
+	uint32_t memory_kb, parallel, min_parallel, max_parallel, t;
+	long cpus, pages, page_size;
+	bool first = true;
+	int i, r = 0;
+
+	/* not more than half of physical memory, as the library limits memory cost */
+	max_memory_kb = 4 * 1024 * 1024;
+	pages = sysconf(_SC_PHYS_PAGES);
+	page_size = sysconf(_SC_PAGESIZE);
+	if (pages > 0 && page_size > 0 && (uint64_t)pages * page_size / 2048 < max_memory_kb)
+		max_memory_kb = (uint64_t)pages * page_size / 2048;
+	if (ARG_SET(OPT_PBKDF_MEMORY_ID) && ARG_UINT32(OPT_PBKDF_MEMORY_ID) < max_memory_kb)
+		max_memory_kb = ARG_UINT32(OPT_PBKDF_MEMORY_ID);
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	log_std("{\n  \"key_size\": %zu,\n  \"pbkdf_matrix\": [", key_size * 8);
+
+	for (i = 0; kdfs[i] && r != -EINTR; i++) {
+		if (set_pbkdf && strcmp(set_pbkdf, kdfs[i]))
+			continue;
+
+		memset(&pbkdf, 0, sizeof(pbkdf));
+		pbkdf.type = kdfs[i];
+		pbkdf.flags = CRYPT_PBKDF_NO_BENCHMARK;
+
+		if (!strcmp(kdfs[i], CRYPT_KDF_PBKDF2)) {
+			pbkdf.hash = ARG_STR(OPT_HASH_ID) ?: DEFAULT_LUKS1_HASH;
+			for (t = 0; pbkdf2_iterations[t] && r != -EINTR; t++) {
+				pbkdf.iterations = pbkdf2_iterations[t];
+				r = benchmark_kdf_point(&pbkdf, key_size, first);
+				first = false;
+				check_signal(&r);
+			}
+			continue;
+		}
+
+		min_parallel = 1;
+		max_parallel = BENCHMARK_MATRIX_MAX_PARALLEL;
+		if (cpus > 0 && (uint32_t)cpus < max_parallel)
+			max_parallel = cpus;
+		if (ARG_SET(OPT_PBKDF_PARALLEL_ID))
+			min_parallel = max_parallel = ARG_UINT32(OPT_PBKDF_PARALLEL_ID) ?: 1;
+
+		for (memory_kb = 64 * 1024; memory_kb <= max_memory_kb && r != -EINTR; memory_kb *= 2) {
+			for (parallel = min_parallel; parallel <= max_parallel && r != -EINTR; parallel *= 2) {
+				for (t = BENCHMARK_MATRIX_MIN_ITERATIONS;
+				     t <= BENCHMARK_MATRIX_MIN_ITERATIONS * 4 && r != -EINTR; t *= 2) {
+					pbkdf.iterations = t;
+					pbkdf.max_memory_kb = memory_kb;
+					pbkdf.parallel_threads = parallel;
+					r = benchmark_kdf_point(&pbkdf, key_size, first);
+					first = false;
+					check_signal(&r);
+				}
+			}
+		}
+	}
+
+	log_std("\n  ]\n}\n");
+
+	return r == -EINTR ? r : 0;
+}
+
+static const struct {
+	const char *cipher;
+	const char *mode;
+	size_t key_size;
+} benchmark_ciphers[] = {
+	{ "aes",     "cbc", 16 },
+	{ "serpent", "cbc", 16 },
+	{ "twofish", "cbc", 16 },
+	{ "aes",     "cbc", 32 },
+	{ "serpent", "cbc", 32 },
+	{ "twofish", "cbc", 32 },
+	{ "aes",     "xts", 32 },
+	{ "serpent", "xts", 32 },
+	{ "twofish", "xts", 32 },
+	{ "aes",     "xts", 64 },
+	{ "serpent", "xts", 64 },
+	{ "twofish", "xts", 64 },
+	{  NULL, NULL, 0 }
+};
+
+/*
+ * With --threads, per-thread speeds are stored in @thread_enc and @thread_dec arrays
+ * and the aggregate throughput is returned.
+ */
 static int benchmark_cipher_loop(const char *cipher, const char *cipher_mode,
 				 size_t volume_key_size,
-				 double *encryption_mbs, double *decryption_mbs)
+				 double *encryption_mbs, double *decryption_mbs,
+				 double *thread_enc, double *thread_dec)
 {
+	unsigned i, threads = ARG_UINT32(OPT_THREADS_ID);
 	int r, buffer_size = 1024 * 1024;
 
 	do {
-		r = crypt_benchmark(NULL, cipher, cipher_mode,
-				    volume_key_size, 0, buffer_size,
-				    encryption_mbs, decryption_mbs);
+		if (threads) {
+			r = crypt_benchmark_threads(NULL, cipher, cipher_mode,
+						    volume_key_size, 0, buffer_size,
+						    threads, thread_enc, thread_dec);
+			for (i = 0, *encryption_mbs = *decryption_mbs = 0; !r && i < threads; i++) {
+				*encryption_mbs += thread_enc[i];
+				*decryption_mbs += thread_dec[i];
+			}
+		} else
+			r = crypt_benchmark(NULL, cipher, cipher_mode,
+					    volume_key_size, 0, buffer_size,
+					    encryption_mbs, decryption_mbs);
 		if (r == -ERANGE) {
 			if (buffer_size < 1024 * 1024 * 65)
 				buffer_size *= 2;
@@ -1051,27 +1953,471 @@ static int benchmark_cipher_loop(const char *cipher, const char *cipher_mode,
 	return r;
 }
 
-static int action_benchmark(void)
+/* Repeated runs of every JSON benchmark point */
+#define BENCHMARK_JSON_SAMPLES	5
+
+static int benchmark_double_cmp(const void *a, const void *b)
 {
-	static struct {
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Newton iteration, the tools do not link libm just for this */
+static double benchmark_sqrt(double x)
+{
+	double r = x > 1.0 ? x : 1.0;
+	int i;
+
+	if (x <= 0.0)
+		return 0.0;
+
+	for (i = 0; i < 64; i++)
+		r = (r + x / r) / 2;
+
+	return r;
+}
+
+static void benchmark_json_string(const char *str)
+{
+	log_std("\"");
+	for (; str && *str; str++) {
+		if (*str == '"' || *str == '\\')
+			log_std("\\%c", *str);
+		else if ((unsigned char)*str >= 0x20)
+			log_std("%c", *str);
+	}
+	log_std("\"");
+}
+
+/* Statistics of @count samples (sorted in place), p95 is nearest rank */
+static void benchmark_json_stats(const char *name, double *v, unsigned count)
+{
+	double median, mean = 0.0, var = 0.0;
+	unsigned i;
+
+	qsort(v, count, sizeof(*v), benchmark_double_cmp);
+	for (i = 0; i < count; i++)
+		mean += v[i];
+	mean /= count;
+	for (i = 0; i < count; i++)
+		var += (v[i] - mean) * (v[i] - mean);
+	if (count > 1)
+		var /= count - 1;
+	median = count % 2 ? v[count / 2] : (v[count / 2 - 1] + v[count / 2]) / 2;
+
+	log_std("\"%s\": { \"median\": %.1f, \"p95\": %.1f, \"mean\": %.1f, \"stddev\": %.1f, "
+		"\"min\": %.1f, \"max\": %.1f }", name, median, v[(95 * count + 99) / 100 - 1],
+		mean, benchmark_sqrt(var), v[0], v[count - 1]);
+}
+
+/* Environment of the measurement, opens the top level JSON object */
+static void benchmark_json_header(void)
+{
+	struct utsname uts;
+	char line[256], *model = NULL, *c;
+	FILE *f;
+
+	f = fopen("/proc/cpuinfo", "r");
+	while (f && !model && fgets(line, sizeof(line), f)) {
+		if (strncmp(line, "model name", 10) || !(c = strchr(line, ':')))
+			continue;
+		model = c + 1 + strspn(c + 1, " \t");
+		model[strcspn(model, "\n")] = '\0';
+	}
+	if (f)
+		fclose(f);
+
+	log_std("{\n  \"cryptsetup\": ");
+	benchmark_json_string(PACKAGE_VERSION);
+	log_std(",\n  \"crypto_backend\": ");
+	benchmark_json_string(crypt_get_crypto_backend(NULL));
+	if (!uname(&uts)) {
+		log_std(",\n  \"kernel\": ");
+		benchmark_json_string(uts.release);
+		log_std(",\n  \"machine\": ");
+		benchmark_json_string(uts.machine);
+	}
+	log_std(",\n  \"cpu_model\": ");
+	if (model)
+		benchmark_json_string(model);
+	else
+		log_std("null");
+	log_std(",\n  \"cpus\": %ld", sysconf(_SC_NPROCESSORS_ONLN));
+}
+
+/*
+ * Per-sector encryption with IV generators through library storage wrapper,
+ * as used by userspace reencryption.
+ */
+static int action_benchmark_sectors(size_t key_size)
+{
+	static const struct {
 		const char *cipher;
 		const char *mode;
 		size_t key_size;
 	} bciphers[] = {
-		{ "aes",     "cbc", 16 },
-		{ "serpent", "cbc", 16 },
-		{ "twofish", "cbc", 16 },
-		{ "aes",     "cbc", 32 },
-		{ "serpent", "cbc", 32 },
-		{ "twofish", "cbc", 32 },
-		{ "aes",     "xts", 32 },
-		{ "serpent", "xts", 32 },
-		{ "twofish", "xts", 32 },
-		{ "aes",     "xts", 64 },
-		{ "serpent", "xts", 64 },
-		{ "twofish", "xts", 64 },
-		{  NULL, NULL, 0 }
+		{ "aes", "cbc-plain64",      32 },
+		{ "aes", "cbc-essiv:sha256", 32 },
+		{ "aes", "cbc-benbi",        32 },
+		{ "aes", "cbc-eboiv",        32 },
+		{ "aes", "xts-plain64",      64 },
 	};
+	static const uint32_t sector_sizes[] = { SECTOR_SIZE, MAX_SECTOR_SIZE };
+	char cipher[MAX_CIPHER_LEN], cipher_mode[MAX_CIPHER_LEN], spec[2 * MAX_CIPHER_LEN];
+	double enc_mbr, dec_mbr;
+	uint32_t sector_size;
+	size_t i, j, ks;
+	int r = 0, buffer_size;
+
+	if (ARG_SET(OPT_CIPHER_ID)) {
+		r = crypt_parse_name_and_mode(ARG_STR(OPT_CIPHER_ID), cipher, NULL, cipher_mode);
+		if (r < 0) {
+			log_err(_("No known cipher specification pattern detected."));
+			return r;
+		}
+	}
+
+	/* TRANSLATORS: The string is header of a table and must be exactly (right side) aligned. */
+	log_std(_("#            Algorithm |       Key | Sector |      Encryption |      Decryption\n"));
+
+	for (i = 0; i < (ARG_SET(OPT_CIPHER_ID) ? 1 : ARRAY_SIZE(bciphers)); i++) {
+		if (!ARG_SET(OPT_CIPHER_ID)) {
+			strcpy(cipher, bciphers[i].cipher);
+			strcpy(cipher_mode, bciphers[i].mode);
+		}
+		ks = ARG_SET(OPT_KEY_SIZE_ID) || ARG_SET(OPT_CIPHER_ID) ? key_size : bciphers[i].key_size;
+		if (snprintf(spec, sizeof(spec), "%s-%s", cipher, cipher_mode) < 0)
+			return -EINVAL;
+
+		for (j = 0; j < ARRAY_SIZE(sector_sizes); j++) {
+			sector_size = ARG_UINT32(OPT_SECTOR_SIZE_ID) ?: sector_sizes[j];
+			buffer_size = 1024 * 1024;
+			do {
+				r = crypt_benchmark_sectors(NULL, cipher, cipher_mode, ks, sector_size,
+							    buffer_size, &enc_mbr, &dec_mbr);
+				if (r == -ERANGE)
+					buffer_size *= 2;
+			} while (r == -ERANGE && buffer_size <= 1024 * 1024 * 64);
+			check_signal(&r);
+			if (r == -EINTR)
+				return r;
+
+			if (!r)
+				log_std("%22s  %9zub  %5" PRIu32 "  %10.1f MiB/s  %10.1f MiB/s\n",
+					spec, ks * 8, sector_size, enc_mbr, dec_mbr);
+			else
+				log_std("%22s  %9zub  %5" PRIu32 " %17s %17s\n",
+					spec, ks * 8, sector_size, _("N/A"), _("N/A"));
+			if (ARG_SET(OPT_SECTOR_SIZE_ID))
+				break;
+		}
+	}
+
+	/* with explicit cipher, report the failure */
+	return ARG_SET(OPT_CIPHER_ID) ? r : 0;
+}
+
+/*
+ * End-to-end benchmark through a temporary plain dm-crypt mapping.
+ * The mapping is backed by a sparse file in RAM (tmpfs, attached to
+ * a loop device by the library), so the numbers include dm-crypt queueing,
+ * IV generator, sector size and activation flags but no storage latency.
+ */
+#define DM_BENCH_DIR		"/dev/shm"
+#define DM_BENCH_SIZE		(128 * 1024 * 1024)
+#define DM_BENCH_SEQ_BLOCK	(1024 * 1024)
+#define DM_BENCH_RND_BLOCK	4096
+#define DM_BENCH_MS		2000
+#define DM_BENCH_SAMPLES	(1024 * 1024)
+
+struct dm_bench_result {
+	uint64_t bytes;
+	uint64_t ms;
+	uint32_t p50_us;
+	uint32_t p95_us;
+	uint32_t p99_us;
+};
+
+static uint64_t monotonic_us(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return 0;
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int dm_bench_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+/* Direct I/O for DM_BENCH_MS, per-request latency samples give percentiles */
+static int dm_bench_io(int fd, bool wr, bool rnd, size_t block, void *buf,
+		       uint32_t *samples, struct dm_bench_result *res)
+{
+	uint64_t blocks = DM_BENCH_SIZE / block, n = 0, seed = 0x9e3779b97f4a7c15ULL,
+		 start, t, now;
+	off_t offset;
+	ssize_t s;
+	int r = 0;
+
+	start = now = monotonic_us();
+	while (!r && now - start < DM_BENCH_MS * 1000 && n < DM_BENCH_SAMPLES) {
+		if (rnd) {
+			seed ^= seed << 13; seed ^= seed >> 7; seed ^= seed << 17;
+			offset = (off_t)((seed % blocks) * block);
+		} else
+			offset = (off_t)((n % blocks) * block);
+
+		t = now;
+		s = wr ? pwrite(fd, buf, block, offset) : pread(fd, buf, block, offset);
+		if (s != (ssize_t)block)
+			r = -EIO;
+		now = monotonic_us();
+		samples[n++] = now - t > UINT32_MAX ? UINT32_MAX : (uint32_t)(now - t);
+		check_signal(&r);
+	}
+
+	if (r)
+		return r;
+
+	qsort(samples, n, sizeof(*samples), dm_bench_cmp);
+	res->bytes = n * block;
+	res->ms = (now - start) / 1000 ?: 1;
+	res->p50_us = samples[n / 2];
+	res->p95_us = samples[n * 95 / 100];
+	res->p99_us = samples[n * 99 / 100];
+	return 0;
+}
+
+static const struct {
+	uint32_t flag;
+	const char *name;
+} dm_bench_flags[] = {
+	{ CRYPT_ACTIVATE_SAME_CPU_CRYPT,	  "same_cpu_crypt" },
+	{ CRYPT_ACTIVATE_SUBMIT_FROM_CRYPT_CPUS, "submit_from_crypt_cpus" },
+	{ CRYPT_ACTIVATE_NO_READ_WORKQUEUE,	  "no_read_workqueue" },
+	{ CRYPT_ACTIVATE_NO_WRITE_WORKQUEUE,	  "no_write_workqueue" },
+};
+
+static int action_benchmark_dm(void)
+{
+	static const struct {
+		const char *desc;
+		const char *json;
+		bool wr;
+		bool rnd;
+	} tests[] = {
+		{ N_("sequential write"), "seq_write",  true,  false },
+		{ N_("sequential read"),  "seq_read",   false, false },
+		{ N_("random write"),     "rand_write", true,  true },
+		{ N_("random read"),      "rand_read",  false, true },
+	};
+	struct crypt_device *cd = NULL;
+	struct crypt_active_device cad;
+	struct crypt_params_plain params = {
+		.sector_size = ARG_UINT32(OPT_SECTOR_SIZE_ID) ?: SECTOR_SIZE
+	};
+	struct dm_bench_result res;
+	char cipher[MAX_CIPHER_LEN], cipher_mode[MAX_CIPHER_LEN], *key = NULL;
+	char file[] = DM_BENCH_DIR "/cryptsetup-benchmark-XXXXXX";
+	char tmp_name[64], tmp_path[128], tmp_uuid[40];
+	size_t i, block, key_size = (ARG_UINT32(OPT_KEY_SIZE_ID) ?: DEFAULT_PLAIN_KEYBITS) / 8;
+	uint32_t *samples = NULL, flags = CRYPT_ACTIVATE_PRIVATE;
+	bool json = ARG_SET(OPT_JSON_ID);
+	double mbs;
+	void *buf = NULL;
+	uuid_t tmp_uuid_bin;
+	int fd, r;
+
+	r = crypt_parse_name_and_mode(ARG_STR(OPT_CIPHER_ID) ?: DEFAULT_CIPHER(PLAIN),
+				      cipher, NULL, cipher_mode);
+	if (r < 0) {
+		log_err(_("No known cipher specification pattern detected."));
+		return r;
+	}
+
+	set_activation_flags(&flags);
+
+	uuid_generate(tmp_uuid_bin);
+	uuid_unparse(tmp_uuid_bin, tmp_uuid);
+	if (snprintf(tmp_name, sizeof(tmp_name), "temporary-cryptsetup-%s", tmp_uuid) < 0 ||
+	    snprintf(tmp_path, sizeof(tmp_path), "%s/%s", crypt_get_dir(), tmp_name) < 0)
+		return -EINVAL;
+
+	fd = mkstemp(file);
+	if (fd < 0) {
+		log_err(_("Cannot create RAM backed file in %s."), DM_BENCH_DIR);
+		return -EINVAL;
+	}
+	r = ftruncate(fd, DM_BENCH_SIZE) ? -EINVAL : 0;
+	close(fd);
+	if (r)
+		goto out;
+
+	if (!(key = crypt_safe_alloc(key_size)) ||
+	    !(samples = malloc(DM_BENCH_SAMPLES * sizeof(*samples))) ||
+	    posix_memalign(&buf, 4096, DM_BENCH_SEQ_BLOCK)) {
+		r = -ENOMEM;
+		goto out;
+	}
+	/* Key is not secret here, halves must differ for XTS. */
+	for (i = 0; i < key_size; i++)
+		key[i] = (char)i;
+	memset(buf, 0xa5, DM_BENCH_SEQ_BLOCK);
+
+	r = crypt_init(&cd, file);
+	if (r < 0)
+		goto out;
+
+	r = crypt_format(cd, CRYPT_PLAIN, cipher, cipher_mode, NULL, NULL, key_size, &params);
+	if (r < 0)
+		goto out;
+
+	r = crypt_activate_by_volume_key(cd, tmp_name, key, key_size, flags);
+	if (r < 0)
+		goto out;
+
+	fd = open(tmp_path, O_RDWR | O_DIRECT);
+	if (fd < 0) {
+		log_err(_("Cannot open device %s."), tmp_path);
+		r = -EINVAL;
+	} else if (json) {
+		if (crypt_get_active_device(cd, tmp_name, &cad))
+			cad.flags = 0;
+		benchmark_json_header();
+		log_std(",\n  \"cipher\": \"%s-%s\",\n  \"key_size\": %zu,\n  \"sector_size\": %u,"
+			"\n  \"device_size\": %u,\n  \"test_ms\": %u,\n  \"flags\": {",
+			cipher, cipher_mode, key_size * 8, params.sector_size, DM_BENCH_SIZE, DM_BENCH_MS);
+		for (i = 0; i < ARRAY_SIZE(dm_bench_flags); i++)
+			log_std("%s\n    \"%s\": { \"requested\": %s, \"active\": %s }", i ? "," : "",
+				dm_bench_flags[i].name, flags & dm_bench_flags[i].flag ? "true" : "false",
+				cad.flags & dm_bench_flags[i].flag ? "true" : "false");
+		log_std("\n  },\n  \"tests\": [");
+	} else {
+		log_std(_("# Tests use temporary dm-crypt mapping of %u MiB in RAM, %u ms each.\n"),
+			DM_BENCH_SIZE / 1024 / 1024, DM_BENCH_MS);
+		log_std(_("# %s-%s, %zub key, %u bytes sector\n"),
+			cipher, cipher_mode, key_size * 8, params.sector_size);
+		/* TRANSLATORS: The string is header of a table and must be exactly (right side) aligned. */
+		log_std(_("#             Test |  Block |      Throughput |   p50 latency |   p99 latency\n"));
+	}
+
+	if (fd >= 0) {
+		set_int_handler(0);
+		for (i = 0; !r && i < ARRAY_SIZE(tests); i++) {
+			block = tests[i].rnd ? DM_BENCH_RND_BLOCK : DM_BENCH_SEQ_BLOCK;
+			if (block < params.sector_size)
+				block = params.sector_size;
+			r = dm_bench_io(fd, tests[i].wr, tests[i].rnd, block, buf, samples, &res);
+			if (r)
+				break;
+			mbs = (double)res.bytes / 1024 / 1024 * 1000 / res.ms;
+			if (json)
+				log_std("%s\n    { \"test\": \"%s\", \"block_size\": %zu, \"mbs\": %.1f, "
+					"\"p50_us\": %" PRIu32 ", \"p95_us\": %" PRIu32 ", \"p99_us\": %" PRIu32 " }",
+					i ? "," : "", tests[i].json, block, mbs,
+					res.p50_us, res.p95_us, res.p99_us);
+			else
+				log_std("%18s  %5zuK  %10.1f MiB/s  %10" PRIu32 " us  %10" PRIu32 " us\n",
+					_(tests[i].desc), block / 1024, mbs, res.p50_us, res.p99_us);
+		}
+		if (json)
+			log_std("\n  ]\n}\n");
+		set_int_block(0);
+		close(fd);
+	}
+
+	if (crypt_deactivate(cd, tmp_name))
+		log_err(_("Cannot deactivate temporary device %s."), tmp_path);
+out:
+	crypt_free(cd);
+	unlink(file);
+	crypt_safe_free(key);
+	free(samples);
+	free(buf);
+	return r;
+}
+
+/* Cipher benchmark with repeated samples per cipher, printed as JSON */
+static int action_benchmark_cipher_json(const char *cipher, const char *cipher_mode, size_t key_size)
+{
+	double enc[BENCHMARK_JSON_SAMPLES], dec[BENCHMARK_JSON_SAMPLES], *thread_enc = NULL, *thread_dec = NULL;
+	unsigned s, ok = 0, threads = ARG_UINT32(OPT_THREADS_ID);
+	char spec[2 * MAX_CIPHER_LEN];
+	bool first = true;
+	size_t ks;
+	int i, r = 0;
+
+	if (threads) {
+		thread_enc = calloc(threads, sizeof(*thread_enc));
+		thread_dec = calloc(threads, sizeof(*thread_dec));
+		if (!thread_enc || !thread_dec) {
+			free(thread_enc);
+			free(thread_dec);
+			return -ENOMEM;
+		}
+	}
+
+	benchmark_json_header();
+	log_std(",\n  \"samples\": %u,\n  \"threads\": %u,\n  \"ciphers\": [",
+		BENCHMARK_JSON_SAMPLES, threads ?: 1);
+
+	for (i = 0; r != -EINTR && (cipher ? i < 1 : benchmark_ciphers[i].cipher != NULL); i++) {
+		if (!cipher) {
+			if (snprintf(spec, sizeof(spec), "%s-%s", benchmark_ciphers[i].cipher,
+				     benchmark_ciphers[i].mode) < 0)
+				break;
+			ks = benchmark_ciphers[i].key_size;
+		} else {
+			if (snprintf(spec, sizeof(spec), "%s-%s", cipher, cipher_mode) < 0)
+				break;
+			ks = key_size;
+		}
+
+		for (s = 0, r = 0; !r && s < BENCHMARK_JSON_SAMPLES; s++) {
+			r = benchmark_cipher_loop(cipher ?: benchmark_ciphers[i].cipher,
+						  cipher ? cipher_mode : benchmark_ciphers[i].mode,
+						  ks, &enc[s], &dec[s], thread_enc, thread_dec);
+			check_signal(&r);
+		}
+
+		log_std("%s\n    { \"cipher\": \"%s\", \"key_size\": %zu, ", first ? "" : ",", spec, ks * 8);
+		first = false;
+		if (r) {
+			log_std("\"ok\": false }");
+			continue;
+		}
+		ok++;
+		log_std("\"ok\": true,\n      ");
+		benchmark_json_stats("encryption_mbs", enc, BENCHMARK_JSON_SAMPLES);
+		log_std(",\n      ");
+		benchmark_json_stats("decryption_mbs", dec, BENCHMARK_JSON_SAMPLES);
+		log_std(" }");
+	}
+
+	log_std("\n  ]\n}\n");
+
+	free(thread_enc);
+	free(thread_dec);
+
+	/* unavailable ciphers are reported, only explicit one is an error */
+	if (r == -EINTR || (cipher && r))
+		return r;
+	if (!ok) {
+		log_err(_("Required kernel crypto interface not available."));
+		return -ENOTSUP;
+	}
+	return 0;
+}
+
+static int action_benchmark(void)
+{
 	static struct {
 		const char *type;
 		const char *hash;
@@ -1086,13 +2432,47 @@ static int action_benchmark(void)
 		{ NULL, NULL }
 	};
 	char cipher[MAX_CIPHER_LEN], cipher_mode[MAX_CIPHER_LEN];
-	double enc_mbr = 0, dec_mbr = 0;
+	double enc_mbr = 0, dec_mbr = 0, *thread_enc = NULL, *thread_dec = NULL;
 	int key_size = (ARG_UINT32(OPT_KEY_SIZE_ID) ?: DEFAULT_PLAIN_KEYBITS) / 8;
+	unsigned t, threads = ARG_UINT32(OPT_THREADS_ID);
 	int skipped = 0, width;
 	char *c;
 	int i, r;
 
+	if (ARG_SET(OPT_PBKDF_MATRIX_ID))
+		return action_benchmark_kdf_matrix(key_size);
+
+	if (ARG_SET(OPT_DM_BENCHMARK_ID))
+		return action_benchmark_dm();
+
+	if (ARG_SET(OPT_IV_BENCHMARK_ID))
+		return action_benchmark_sectors(key_size);
+
+	if (ARG_SET(OPT_JSON_ID) && ARG_SET(OPT_CIPHER_ID)) {
+		r = crypt_parse_name_and_mode(ARG_STR(OPT_CIPHER_ID), cipher, NULL, cipher_mode);
+		if (r < 0) {
+			log_err(_("No known cipher specification pattern detected."));
+			return r;
+		}
+		if ((c  = strchr(cipher_mode, '-')))
+			*c = '\0';
+		return action_benchmark_cipher_json(cipher, cipher_mode, key_size);
+	} else if (ARG_SET(OPT_JSON_ID))
+		return action_benchmark_cipher_json(NULL, NULL, 0);
+
+	if (threads) {
+		thread_enc = calloc(threads, sizeof(*thread_enc));
+		thread_dec = calloc(threads, sizeof(*thread_dec));
+		if (!thread_enc || !thread_dec) {
+			free(thread_enc);
+			free(thread_dec);
+			return -ENOMEM;
+		}
+	}
+
 	log_std(_("# Tests are approximate using memory only (no storage IO).\n"));
+	if (threads)
+		log_std(_("# Cipher speeds are aggregate of %u threads running at once.\n"), threads);
 	if (set_pbkdf || ARG_SET(OPT_HASH_ID)) {
 		if (!set_pbkdf && ARG_SET(OPT_HASH_ID))
 			set_pbkdf = CRYPT_KDF_PBKDF2;
@@ -1106,7 +2486,8 @@ static int action_benchmark(void)
 		if ((c  = strchr(cipher_mode, '-')))
 			*c = '\0';
 
-		r = benchmark_cipher_loop(cipher, cipher_mode, key_size, &enc_mbr, &dec_mbr);
+		r = benchmark_cipher_loop(cipher, cipher_mode, key_size, &enc_mbr, &dec_mbr,
+					  thread_enc, thread_dec);
 		if (!r) {
 			width = strlen(cipher) + strlen(cipher_mode) + 1;
 			if (width < 11)
@@ -1115,6 +2496,9 @@ static int action_benchmark(void)
 			log_std(_("#%*s Algorithm |       Key |      Encryption |      Decryption\n"), width - 11, "");
 			log_std("%*s-%s  %9db  %10.1f MiB/s  %10.1f MiB/s\n", width - (int)strlen(cipher_mode) - 1,
 				cipher, cipher_mode, key_size*8, enc_mbr, dec_mbr);
+			for (t = 0; t < threads; t++)
+				log_std(_("%*s thread %3u  %10.1f MiB/s  %10.1f MiB/s\n"), width - 9, "",
+					t, thread_enc[t], thread_dec[t]);
 		} else if (r < 0)
 			log_err(_("Cipher %s (with %i bits key) is not available."), ARG_STR(OPT_CIPHER_ID), key_size * 8);
 	} else {
@@ -1125,9 +2509,10 @@ static int action_benchmark(void)
 				break;
 		}
 
-		for (i = 0; bciphers[i].cipher; i++) {
-			r = benchmark_cipher_loop(bciphers[i].cipher, bciphers[i].mode,
-						  bciphers[i].key_size, &enc_mbr, &dec_mbr);
+		for (i = 0; benchmark_ciphers[i].cipher; i++) {
+			r = benchmark_cipher_loop(benchmark_ciphers[i].cipher, benchmark_ciphers[i].mode,
+						  benchmark_ciphers[i].key_size, &enc_mbr, &dec_mbr,
+						  thread_enc, thread_dec);
 			check_signal(&r);
 			if (r == -ENOTSUP || r == -EINTR)
 				break;
@@ -1138,15 +2523,15 @@ static int action_benchmark(void)
 				log_std(_("#     Algorithm |       Key |      Encryption |      Decryption\n"));
 
 			if (snprintf(cipher, MAX_CIPHER_LEN, "%s-%s",
-				     bciphers[i].cipher, bciphers[i].mode) < 0)
+				     benchmark_ciphers[i].cipher, benchmark_ciphers[i].mode) < 0)
 				r = -EINVAL;
 
 			if (!r)
 				log_std("%15s  %9zub  %10.1f MiB/s  %10.1f MiB/s\n",
-					cipher, bciphers[i].key_size*8, enc_mbr, dec_mbr);
+					cipher, benchmark_ciphers[i].key_size*8, enc_mbr, dec_mbr);
 			else
 				log_std("%15s  %9zub %17s %17s\n", cipher,
-					bciphers[i].key_size*8, _("N/A"), _("N/A"));
+					benchmark_ciphers[i].key_size*8, _("N/A"), _("N/A"));
 		}
 		if (skipped && skipped == i)
 			r = -ENOTSUP;
@@ -1158,6 +2543,8 @@ static int action_benchmark(void)
 		log_err( _("Ensure you have algif_skcipher kernel module loaded."));
 #endif
 	}
+	free(thread_enc);
+	free(thread_dec);
 	return r;
 }
 
@@ -1312,9 +2699,12 @@ static int _wipe_data_device(struct crypt_device *cd)
 		.batch_mode = ARG_SET(OPT_BATCH_MODE_ID),
 		.json_output = ARG_SET(OPT_PROGRESS_JSON_ID),
 		.interrupt_message = _("\nWipe interrupted."),
-		.device = tools_get_device_name(crypt_get_device_name(cd), &backing_file)
+		.device = tools_get_device_name(crypt_get_device_name(cd), &backing_file),
+		.cd = cd
 	};
 
+	(void)crypt_set_progress_interval(cd, 0, prog_parms.frequency ? prog_parms.frequency * 1000 : 500);
+
 	if (!ARG_SET(OPT_BATCH_MODE_ID))
 		log_std(_("Wiping device to initialize integrity checksum.\n"
 			"You can interrupt this by pressing CTRL+c "
@@ -1333,37 +2723,229 @@ static int _wipe_data_device(struct crypt_device *cd)
 	if (r < 0)
 		goto out;
 
-	/* Wipe the device */
-	set_int_handler(0);
-	r = crypt_wipe(cd, tmp_path, CRYPT_WIPE_ZERO, 0, 0, DEFAULT_WIPE_BLOCK,
-		       0, &tools_progress, &prog_parms);
-	if (crypt_deactivate(cd, tmp_name))
-		log_err(_("Cannot deactivate temporary device %s."), tmp_path);
-	set_int_block(0);
+	/* Wipe the device */
+	tools_wipe_set_queue_depth(cd);
+	set_int_handler(0);
+	r = crypt_wipe(cd, tmp_path, CRYPT_WIPE_ZERO, 0, 0, DEFAULT_WIPE_BLOCK,
+		       0, &tools_progress, &prog_parms);
+	if (crypt_deactivate(cd, tmp_name))
+		log_err(_("Cannot deactivate temporary device %s."), tmp_path);
+	set_int_block(0);
+
+out:
+	free(backing_file);
+	return r;
+}
+
+static int strcmp_or_null(const char *str, const char *expected)
+{
+	return !str ? 0 : strcmp(str, expected);
+}
+
+/*
+ * Slower candidate (later in the list) wins only if it is faster
+ * by more than this margin (percent) to avoid noise driven choice.
+ */
+#define AUTO_CIPHER_MARGIN 5
+
+/*
+ * --cipher auto: measure allowed ciphers with per-sector storage benchmark
+ * and use the fastest one. The list is the security policy, all candidates
+ * provide at least 128-bit security, first is preferred.
+ */
+static int luks_auto_cipher(const char *type, char *cipher, char *cipher_mode,
+			    size_t *key_size, uint32_t *sector_size)
+{
+	static const struct {
+		const char *cipher;
+		const char *mode;
+		size_t key_size;
+	} candidates[] = {
+		{ "aes",           "xts-plain64",      64 },
+		{ "aes",           "xts-plain64",      32 },
+		{ "xchacha12,aes", "adiantum-plain64", 32 },
+		{ "xchacha20,aes", "adiantum-plain64", 32 },
+		{ "serpent",       "xts-plain64",      64 },
+		{ "twofish",       "xts-plain64",      64 },
+	};
+	static const uint32_t sector_sizes[] = { SECTOR_SIZE, MAX_SECTOR_SIZE };
+	double enc_mbr, dec_mbr, mbr, best_mbr = 0.0;
+	uint32_t ss;
+	size_t i, j;
+	int r, buffer_size, best = -1, best_ss = 0;
+
+	if (ARG_SET(OPT_INTEGRITY_ID)) {
+		log_err(_("Automatic cipher selection cannot be used with integrity option."));
+		return -EINVAL;
+	}
+
+	log_verbose(_("Benchmarking ciphers for automatic selection."));
+
+	for (i = 0; i < ARRAY_SIZE(candidates); i++) {
+		if (ARG_SET(OPT_KEY_SIZE_ID) && ARG_UINT32(OPT_KEY_SIZE_ID) != candidates[i].key_size * 8)
+			continue;
+
+		for (j = 0; j < ARRAY_SIZE(sector_sizes); j++) {
+			ss = ARG_UINT32(OPT_SECTOR_SIZE_ID) ?: sector_sizes[j];
+			if (isLUKS1(type) && ss > SECTOR_SIZE)
+				break;
+
+			buffer_size = 1024 * 1024;
+			do {
+				r = crypt_benchmark_sectors(NULL, candidates[i].cipher, candidates[i].mode,
+							    candidates[i].key_size, ss, buffer_size,
+							    &enc_mbr, &dec_mbr);
+				if (r == -ERANGE)
+					buffer_size *= 2;
+			} while (r == -ERANGE && buffer_size <= 1024 * 1024 * 64);
+			check_signal(&r);
+			if (r == -EINTR)
+				return r;
+
+			if (r < 0)
+				log_dbg("Cipher %s-%s (%zu bits key, %" PRIu32 " bytes sector) not available.",
+					candidates[i].cipher, candidates[i].mode, candidates[i].key_size * 8, ss);
+			else {
+				mbr = (enc_mbr + dec_mbr) / 2;
+				log_dbg("Cipher %s-%s (%zu bits key, %" PRIu32 " bytes sector): %.1f MiB/s.",
+					candidates[i].cipher, candidates[i].mode, candidates[i].key_size * 8, ss, mbr);
+				if (best < 0 || mbr > best_mbr * (100 + AUTO_CIPHER_MARGIN) / 100) {
+					best = i;
+					best_ss = ss;
+					best_mbr = mbr;
+				}
+			}
+
+			if (ARG_SET(OPT_SECTOR_SIZE_ID))
+				break;
+		}
+	}
+
+	if (best < 0) {
+		log_err(_("No cipher allowed for automatic selection is available."));
+		return -ENOTSUP;
+	}
+
+	strcpy(cipher, candidates[best].cipher);
+	strcpy(cipher_mode, candidates[best].mode);
+	*key_size = candidates[best].key_size;
+	/* large sector is detected by library if device allows it */
+	*sector_size = ARG_SET(OPT_SECTOR_SIZE_ID) || best_ss == SECTOR_SIZE ? (uint32_t)best_ss : 0;
+
+	log_verbose(_("Selected cipher %s-%s with %zu bits key (%.1f MiB/s with %d bytes sector)."),
+		    cipher, cipher_mode, *key_size * 8, best_mbr, best_ss);
+	return 0;
+}
+
+#define FORMAT_BATCH_THREADS 16
+
+/*
+ * State shared by all devices formatted from --devices-file. Signatures
+ * were already reported (and overwrite confirmed) and passphrase read
+ * for the whole batch. Automatic cipher selection and PBKDF calibration
+ * run only once, by the first device that needs them.
+ *
+ * Context setup up to the header format (device probing, signature wipe,
+ * RNG and device-mapper use) runs under setup_lock, one device at a time.
+ * Only keyslot creation with its PBKDF runs in parallel.
+ */
+struct format_batch {
+	pthread_mutex_t lock;
+	pthread_mutex_t setup_lock;
+	char **devices;
+	size_t *signatures;
+	int *results;
+	size_t count, next;
+
+	char *password;
+	size_t password_len;
+
+	int cipher_r;
+	bool cipher_done;
+	char cipher[MAX_CIPHER_LEN], cipher_mode[MAX_CIPHER_LEN];
+	size_t key_size;
+	uint32_t sector_size;
+
+	int pbkdf_r;
+	bool pbkdf_done;
+	struct crypt_pbkdf_type pbkdf;
+	char pbkdf_type[32], pbkdf_hash[32];
+};
+
+static int format_batch_auto_cipher(struct format_batch *fb, const char *type,
+				    char *cipher, char *cipher_mode,
+				    size_t *key_size, uint32_t *sector_size)
+{
+	pthread_mutex_lock(&fb->lock);
+	if (!fb->cipher_done) {
+		fb->sector_size = *sector_size;
+		fb->cipher_r = luks_auto_cipher(type, fb->cipher, fb->cipher_mode,
+						&fb->key_size, &fb->sector_size);
+		fb->cipher_done = true;
+	}
+	pthread_mutex_unlock(&fb->lock);
+
+	if (fb->cipher_r < 0)
+		return fb->cipher_r;
+
+	strcpy(cipher, fb->cipher);
+	strcpy(cipher_mode, fb->cipher_mode);
+	*key_size = fb->key_size;
+	*sector_size = fb->sector_size;
+
+	return 0;
+}
+
+static int format_batch_pbkdf(struct format_batch *fb, struct crypt_device *cd, size_t key_size)
+{
+	pthread_mutex_lock(&fb->lock);
+	if (!fb->pbkdf_done) {
+		fb->pbkdf_r = crypt_benchmark_pbkdf_calibrate(cd, key_size, &fb->pbkdf);
+		if (!fb->pbkdf_r) {
+			/* strings are owned by cd, keep copies for other devices */
+			if (snprintf(fb->pbkdf_type, sizeof(fb->pbkdf_type), "%s", fb->pbkdf.type) >= (int)sizeof(fb->pbkdf_type) ||
+			    snprintf(fb->pbkdf_hash, sizeof(fb->pbkdf_hash), "%s", fb->pbkdf.hash ?: "") >= (int)sizeof(fb->pbkdf_hash))
+				fb->pbkdf_r = -EINVAL;
+			fb->pbkdf.type = fb->pbkdf_type;
+			fb->pbkdf.hash = fb->pbkdf_hash;
+		}
+		fb->pbkdf_done = true;
+	}
+	pthread_mutex_unlock(&fb->lock);
+
+	if (fb->pbkdf_r < 0)
+		return fb->pbkdf_r;
 
-out:
-	free(backing_file);
-	return r;
+	return crypt_set_pbkdf_type(cd, &fb->pbkdf);
 }
 
-static int strcmp_or_null(const char *str, const char *expected)
+static void format_batch_setup(struct format_batch *fb, bool *locked, bool lock)
 {
-	return !str ? 0 : strcmp(str, expected);
+	if (!fb || *locked == lock)
+		return;
+
+	if (lock)
+		pthread_mutex_lock(&fb->setup_lock);
+	else
+		pthread_mutex_unlock(&fb->setup_lock);
+	*locked = lock;
 }
 
-int luksFormat(struct crypt_device **r_cd, char **r_password, size_t *r_passwordLen)
+static int _luksFormat(const char *device, struct format_batch *fb, size_t signatures_probed,
+		       struct crypt_device **r_cd, char **r_password, size_t *r_passwordLen)
 {
+	bool setup_locked = false;
 	int r = -EINVAL, keysize, integrity_keysize = 0, fd, created = 0;
 	struct stat st;
 	const char *header_device, *type;
 	char *msg = NULL, *key = NULL, *password = NULL;
 	char cipher [MAX_CIPHER_LEN], cipher_mode[MAX_CIPHER_LEN], integrity[MAX_CIPHER_LEN];
-	size_t passwordLen, signatures;
+	size_t passwordLen, signatures, auto_key_size = 0;
 	struct crypt_device *cd = NULL;
 	struct crypt_params_luks1 params1 = {
 		.hash = ARG_STR(OPT_HASH_ID) ?: DEFAULT_LUKS1_HASH,
 		.data_alignment = ARG_UINT32(OPT_ALIGN_PAYLOAD_ID),
-		.data_device = ARG_SET(OPT_HEADER_ID) ? action_argv[0] : NULL,
+		.data_device = ARG_SET(OPT_HEADER_ID) ? device : NULL,
 	};
 	struct crypt_params_luks2 params2 = {
 		.data_alignment = params1.data_alignment,
@@ -1422,13 +3004,22 @@ int luksFormat(struct crypt_device **r_cd, char **r_password, size_t *r_password
 			return r;
 	}
 
-	header_device = ARG_STR(OPT_HEADER_ID) ?: action_argv[0];
+	header_device = ARG_STR(OPT_HEADER_ID) ?: device;
 
-	r = crypt_parse_name_and_mode(ARG_STR(OPT_CIPHER_ID) ?: DEFAULT_CIPHER(LUKS1),
-				      cipher, NULL, cipher_mode);
-	if (r < 0) {
-		log_err(_("No known cipher specification pattern detected."));
-		goto out;
+	if (ARG_SET(OPT_CIPHER_ID) && !strcmp(ARG_STR(OPT_CIPHER_ID), "auto")) {
+		if (fb)
+			r = format_batch_auto_cipher(fb, type, cipher, cipher_mode, &auto_key_size, &params2.sector_size);
+		else
+			r = luks_auto_cipher(type, cipher, cipher_mode, &auto_key_size, &params2.sector_size);
+		if (r < 0)
+			goto out;
+	} else {
+		r = crypt_parse_name_and_mode(ARG_STR(OPT_CIPHER_ID) ?: DEFAULT_CIPHER(LUKS1),
+					      cipher, NULL, cipher_mode);
+		if (r < 0) {
+			log_err(_("No known cipher specification pattern detected."));
+			goto out;
+		}
 	}
 
 	if (ARG_SET(OPT_INTEGRITY_ID)) {
@@ -1445,7 +3036,10 @@ int luksFormat(struct crypt_device **r_cd, char **r_password, size_t *r_password
 	if (crypt_is_cipher_null(cipher))
 		ARG_SET_TRUE(OPT_FORCE_PASSWORD_ID);
 
+	format_batch_setup(fb, &setup_locked, true);
+
 	if ((r = crypt_init(&cd, header_device))) {
+		format_batch_setup(fb, &setup_locked, false);
 		if (ARG_SET(OPT_HEADER_ID))
 			log_err(_("Cannot use %s as on-disk header."), header_device);
 		return r;
@@ -1465,12 +3059,16 @@ int luksFormat(struct crypt_device **r_cd, char **r_password, size_t *r_password
 			goto out;
 	}
 
+	if (ARG_SET(OPT_SECTOR_SIZE_BENCHMARK_ID))
+		(void)crypt_set_sector_size_benchmark(cd, 1);
+
+	if (fb)
+		signatures = signatures_probed;
 	/* Print all present signatures in read-only mode */
-	r = tools_detect_signatures(header_device, PRB_FILTER_NONE, &signatures, ARG_SET(OPT_BATCH_MODE_ID));
-	if (r < 0)
+	else if ((r = tools_detect_signatures(header_device, PRB_FILTER_NONE, &signatures, ARG_SET(OPT_BATCH_MODE_ID))) < 0)
 		goto out;
 
-	if (!created && !ARG_SET(OPT_BATCH_MODE_ID)) {
+	if (!created && !fb && !ARG_SET(OPT_BATCH_MODE_ID)) {
 		r = asprintf(&msg, _("This will overwrite data on %s irrevocably."), header_device);
 		if (r == -1) {
 			r = -ENOMEM;
@@ -1483,18 +3081,27 @@ int luksFormat(struct crypt_device **r_cd, char **r_password, size_t *r_password
 			goto out;
 	}
 
-	keysize = get_adjusted_key_size(cipher_mode, DEFAULT_LUKS1_KEYBITS, integrity_keysize);
+	keysize = auto_key_size ?: get_adjusted_key_size(cipher_mode, DEFAULT_LUKS1_KEYBITS, integrity_keysize);
 
 	if (ARG_SET(OPT_USE_RANDOM_ID))
 		crypt_set_rng_type(cd, CRYPT_RNG_RANDOM);
 	else if (ARG_SET(OPT_USE_URANDOM_ID))
 		crypt_set_rng_type(cd, CRYPT_RNG_URANDOM);
 
-	r = tools_get_key(NULL, &password, &passwordLen,
-			  ARG_UINT64(OPT_KEYFILE_OFFSET_ID), ARG_UINT32(OPT_KEYFILE_SIZE_ID), ARG_STR(OPT_KEY_FILE_ID),
-			  ARG_UINT32(OPT_TIMEOUT_ID), verify_passphrase(1), !ARG_SET(OPT_FORCE_PASSWORD_ID), cd);
-	if (r < 0)
-		goto out;
+	if (fb) {
+		if (!(password = crypt_safe_alloc(fb->password_len + 1))) {
+			r = -ENOMEM;
+			goto out;
+		}
+		memcpy(password, fb->password, fb->password_len);
+		passwordLen = fb->password_len;
+	} else {
+		r = tools_get_key(NULL, &password, &passwordLen,
+				  ARG_UINT64(OPT_KEYFILE_OFFSET_ID), ARG_UINT32(OPT_KEYFILE_SIZE_ID), ARG_STR(OPT_KEY_FILE_ID),
+				  ARG_UINT32(OPT_TIMEOUT_ID), verify_passphrase(1), !ARG_SET(OPT_FORCE_PASSWORD_ID), cd);
+		if (r < 0)
+			goto out;
+	}
 
 	if (ARG_SET(OPT_VOLUME_KEY_FILE_ID)) {
 		r = tools_read_vk(ARG_STR(OPT_VOLUME_KEY_FILE_ID), &key, keysize);
@@ -1508,6 +3115,13 @@ int luksFormat(struct crypt_device **r_cd, char **r_password, size_t *r_password
 		goto out;
 	}
 
+	/* LUKS2 keyslot key size differs only with explicit keyslot encryption */
+	if (fb && (r = format_batch_pbkdf(fb, cd, ARG_SET(OPT_KEYSLOT_KEY_SIZE_ID) ?
+					  ARG_UINT32(OPT_KEYSLOT_KEY_SIZE_ID) / 8 : (size_t)keysize))) {
+		log_err(_("Failed to set pbkdf parameters."));
+		goto out;
+	}
+
 	/* Signature candidates found */
 	if (signatures && ((r = tools_wipe_all_signatures(header_device, true, false)) < 0))
 		goto out;
@@ -1521,6 +3135,8 @@ int luksFormat(struct crypt_device **r_cd, char **r_password, size_t *r_password
 	if (r < 0)
 		goto out;
 
+	format_batch_setup(fb, &setup_locked, false);
+
 	r = _set_keyslot_encryption_params(cd);
 	if (r < 0)
 		goto out;
@@ -1538,6 +3154,7 @@ int luksFormat(struct crypt_device **r_cd, char **r_password, size_t *r_password
 	    strcmp_or_null(params2.integrity, "none"))
 		r = _wipe_data_device(cd);
 out:
+	format_batch_setup(fb, &setup_locked, false);
 	if (r >= 0 && r_cd && r_password && r_passwordLen) {
 		*r_cd = cd;
 		*r_password = password;
@@ -1552,22 +3169,279 @@ out:
 	return r;
 }
 
+int luksFormat(struct crypt_device **r_cd, char **r_password, size_t *r_passwordLen)
+{
+	return _luksFormat(action_argv[0], NULL, 0, r_cd, r_password, r_passwordLen);
+}
+
+static void free_devices_list(char **devices, size_t count)
+{
+	while (count)
+		free(devices[--count]);
+	free(devices);
+}
+
+/* One device per line, empty lines and lines starting with '#' are ignored. */
+static int read_devices_file(const char *path, char ***r_devices, size_t *r_count)
+{
+	FILE *f;
+	char *line = NULL, *p, *end, **devices = NULL, **tmp;
+	size_t count = 0, line_len = 0;
+	int r = 0;
+
+	if (!(f = fopen(path, "r"))) {
+		log_err(_("Cannot open devices file %s."), path);
+		return -EINVAL;
+	}
+
+	while (getline(&line, &line_len, f) != -1) {
+		p = line + strspn(line, " \t");
+		end = p + strlen(p);
+		while (end > p && strchr(" \t\r\n", end[-1]))
+			*--end = '\0';
+		if (!*p || *p == '#')
+			continue;
+
+		if (!(tmp = realloc(devices, (count + 1) * sizeof(*tmp))) ||
+		    !(tmp[count] = strdup(p))) {
+			devices = tmp ?: devices;
+			r = -ENOMEM;
+			break;
+		}
+		devices = tmp;
+		count++;
+	}
+
+	if (!r && ferror(f)) {
+		log_err(_("Cannot read devices file %s."), path);
+		r = -EIO;
+	}
+
+	if (!r && !count) {
+		log_err(_("No devices specified in devices file %s."), path);
+		r = -EINVAL;
+	}
+
+	fclose(f);
+	free(line);
+
+	if (r < 0) {
+		free_devices_list(devices, count);
+		return r;
+	}
+
+	*r_devices = devices;
+	*r_count = count;
+	return 0;
+}
+
+static void *format_batch_thread(void *arg)
+{
+	struct format_batch *fb = arg;
+	size_t i;
+
+	while (!quit) {
+		pthread_mutex_lock(&fb->lock);
+		i = fb->next++;
+		pthread_mutex_unlock(&fb->lock);
+
+		if (i >= fb->count)
+			break;
+
+		log_verbose(_("Formatting device %s."), fb->devices[i]);
+		fb->results[i] = _luksFormat(fb->devices[i], fb, fb->signatures[i], NULL, NULL, NULL);
+	}
+
+	return NULL;
+}
+
+/*
+ * Every format runs PBKDF once with calibrated costs,
+ * limit number of parallel formats so Argon2 memory fits in RAM.
+ */
+static size_t format_batch_threads(size_t count)
+{
+	const struct crypt_pbkdf_type *pbkdf;
+	const char *type;
+	long cpus, pages, page_size;
+	uint64_t memory_kb = 0, max_threads;
+	size_t threads;
+
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	threads = cpus > 0 ? (size_t)cpus : 1;
+	if (threads > count)
+		threads = count;
+	if (threads > FORMAT_BATCH_THREADS)
+		threads = FORMAT_BATCH_THREADS;
+
+	type = luksType(device_type) ?: crypt_get_default_type();
+	if (isLUKS2(type) && strcmp_or_null(ARG_STR(OPT_PBKDF_ID), CRYPT_KDF_PBKDF2)) {
+		pbkdf = crypt_get_pbkdf_default(type);
+		memory_kb = ARG_SET(OPT_PBKDF_MEMORY_ID) ? ARG_UINT32(OPT_PBKDF_MEMORY_ID) :
+			    (pbkdf ? pbkdf->max_memory_kb : 0);
+	}
+
+	pages = sysconf(_SC_PHYS_PAGES);
+	page_size = sysconf(_SC_PAGESIZE);
+	if (memory_kb && pages > 0 && page_size > 0) {
+		max_threads = (uint64_t)pages * page_size / 1024 / 2 / memory_kb;
+		if (threads > max_threads)
+			threads = max_threads;
+	}
+
+	return threads ?: 1;
+}
+
+/*
+ * Probe all listed devices for signatures in parallel first and ask for
+ * overwrite confirmation once. Devices are then formatted in parallel,
+ * sharing passphrase, automatic cipher selection and PBKDF calibration.
+ */
+static int luksFormat_devices_file(void)
+{
+	struct format_batch fb = {};
+	pthread_t threads[FORMAT_BATCH_THREADS];
+	char **devices, *msg;
+	size_t i, count, threads_max, threads_count, *signatures;
+	int r;
+
+	r = read_devices_file(ARG_STR(OPT_DEVICES_FILE_ID), &devices, &count);
+	if (r < 0)
+		return r;
+
+	signatures = calloc(count, sizeof(*signatures));
+	fb.results = calloc(count, sizeof(*fb.results));
+	if (!signatures || !fb.results) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	r = tools_detect_signatures_batch((const char * const *)devices, count,
+					  signatures, ARG_SET(OPT_BATCH_MODE_ID));
+	if (r < 0)
+		goto out;
+
+	if (!ARG_SET(OPT_BATCH_MODE_ID)) {
+		if (count == 1)
+			r = asprintf(&msg, _("This will overwrite data on %s irrevocably."), devices[0]);
+		else
+			r = asprintf(&msg, _("This will overwrite data on %zu devices listed in %s irrevocably."),
+				     count, ARG_STR(OPT_DEVICES_FILE_ID));
+		if (r == -1) {
+			r = -ENOMEM;
+			goto out;
+		}
+
+		r = yesDialog(msg, _("Operation aborted.\n")) ? 0 : -EINVAL;
+		free(msg);
+		if (r < 0)
+			goto out;
+	}
+
+	r = tools_get_key(NULL, &fb.password, &fb.password_len,
+			  ARG_UINT64(OPT_KEYFILE_OFFSET_ID), ARG_UINT32(OPT_KEYFILE_SIZE_ID), ARG_STR(OPT_KEY_FILE_ID),
+			  ARG_UINT32(OPT_TIMEOUT_ID), verify_passphrase(1), !ARG_SET(OPT_FORCE_PASSWORD_ID), NULL);
+	if (r < 0)
+		goto out;
+
+	if (pthread_mutex_init(&fb.lock, NULL)) {
+		r = -EINVAL;
+		goto out;
+	}
+	if (pthread_mutex_init(&fb.setup_lock, NULL)) {
+		pthread_mutex_destroy(&fb.lock);
+		r = -EINVAL;
+		goto out;
+	}
+
+	fb.devices = devices;
+	fb.signatures = signatures;
+	fb.count = count;
+	for (i = 0; i < count; i++)
+		fb.results[i] = -EINTR;
+
+	threads_max = format_batch_threads(count);
+	for (threads_count = 0; threads_count < threads_max; threads_count++)
+		if (pthread_create(&threads[threads_count], NULL, format_batch_thread, &fb))
+			break;
+
+	log_dbg("Formatting %zu devices in %zu threads.", count, threads_count);
+
+	/* no thread could be started, format in this one */
+	if (!threads_count)
+		format_batch_thread(&fb);
+
+	for (i = 0; i < threads_count; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&fb.setup_lock);
+	pthread_mutex_destroy(&fb.lock);
+
+	for (i = 0; i < count; i++) {
+		if (fb.results[i] >= 0)
+			continue;
+		log_err(_("Failed to format device %s."), devices[i]);
+		r = fb.results[i];
+	}
+out:
+	crypt_safe_free(fb.password);
+	free(fb.results);
+	free(signatures);
+	free_devices_list(devices, count);
+	return r;
+}
+
 static int action_luksFormat(void)
 {
+	if (ARG_SET(OPT_DEVICES_FILE_ID))
+		return luksFormat_devices_file();
+
 	return luksFormat(NULL, NULL, NULL);
 }
 
+static void print_activation_timing(struct crypt_device *cd, uint64_t start_us,
+				    uint64_t passphrase_us)
+{
+	static const struct {
+		crypt_timing_phase phase;
+		const char *name;
+	} phases[] = {
+		{ CRYPT_TIMING_LOAD,     N_("metadata load") },
+		{ CRYPT_TIMING_RECOVERY, N_("header recovery") },
+		{ CRYPT_TIMING_TOKEN,    N_("token") },
+		{ CRYPT_TIMING_KEYSLOT,  N_("keyslot unlock") },
+		{ CRYPT_TIMING_DM,       N_("device-mapper") },
+		{ CRYPT_TIMING_UDEV,     N_("udev wait") },
+	};
+	struct crypt_timing t;
+	size_t i;
+
+	log_std(_("Activation timing:\n"));
+	log_std("  %-16s %10.1f ms\n", _("total"), (monotonic_us() - start_us) / 1E3);
+	if (passphrase_us)
+		log_std("  %-16s %10.1f ms\n", _("passphrase input"), passphrase_us / 1E3);
+
+	for (i = 0; i < ARRAY_SIZE(phases); i++) {
+		if (crypt_get_timing(cd, phases[i].phase, &t) || !t.count)
+			continue;
+		log_std("  %-16s %10.1f ms", _(phases[i].name), t.duration_us / 1E3);
+		if (t.count > 1)
+			log_std(_(" in %" PRIu32 " runs"), t.count);
+		log_std(_(", started at +%.1f ms\n"), t.start_us / 1E3);
+	}
+}
+
 static int action_open_luks(void)
 {
 	struct crypt_active_device cad;
 	struct crypt_device *cd = NULL;
 	const char *data_device, *header_device, *activated_name;
 	char *key = NULL;
-	uint32_t activate_flags = 0;
+	uint32_t activate_flags = 0, perf_flags = 0;
 	int r, keysize, tries;
 	char *password = NULL;
 	size_t passwordLen;
 	struct stat st;
+	uint64_t t, start_us = monotonic_us(), passphrase_us = 0;
 
 	if (ARG_SET(OPT_REFRESH_ID)) {
 		activated_name = action_argc > 1 ? action_argv[1] : action_argv[0];
@@ -1606,6 +3480,13 @@ static int action_open_luks(void)
 
 	set_activation_flags(&activate_flags);
 
+	if (ARG_SET(OPT_PERF_AUTO_ID)) {
+		r = crypt_performance_flags_hint(cd, &perf_flags);
+		if (r < 0)
+			goto out;
+		activate_flags |= perf_flags;
+	}
+
 	if (ARG_SET(OPT_VOLUME_KEY_FILE_ID)) {
 		keysize = crypt_get_volume_key_size(cd);
 		if (!keysize && !ARG_SET(OPT_KEY_SIZE_ID)) {
@@ -1636,9 +3517,11 @@ static int action_open_luks(void)
 
 		tries = set_tries_tty();
 		do {
+			t = monotonic_us();
 			r = tools_get_key(NULL, &password, &passwordLen,
 					ARG_UINT64(OPT_KEYFILE_OFFSET_ID), ARG_UINT32(OPT_KEYFILE_SIZE_ID), ARG_STR(OPT_KEY_FILE_ID),
 					ARG_UINT32(OPT_TIMEOUT_ID), verify_passphrase(0), 0, cd);
+			passphrase_us += monotonic_us() - t;
 			if (r < 0)
 				goto out;
 
@@ -1657,6 +3540,9 @@ out:
 	     crypt_persistent_flags_set(cd, CRYPT_FLAGS_ACTIVATION, cad.flags & activate_flags)))
 		log_err(_("Device activated but cannot make flags persistent."));
 
+	if (cd && ARG_SET(OPT_TIMING_ID))
+		print_activation_timing(cd, start_us, passphrase_us);
+
 	crypt_safe_free(key);
 	crypt_safe_free(password);
 	crypt_free(cd);
@@ -1723,6 +3609,9 @@ static int action_luksKillSlot(void)
 	if ((r = crypt_init(&cd, uuid_or_device_header(NULL))))
 		goto out;
 
+	/* Several metadata accesses follow, keep the lock handle (not the lock) */
+	(void) crypt_metadata_lock_hold(cd, 1);
+
 	if ((r = crypt_load(cd, luksType(device_type), NULL))) {
 		log_err(_("Device %s is not a valid LUKS device."),
 			uuid_or_device_header(NULL));
@@ -1778,6 +3667,9 @@ static int action_luksRemoveKey(void)
 	if ((r = crypt_init(&cd, uuid_or_device_header(NULL))))
 		goto out;
 
+	/* Several metadata accesses follow, keep the lock handle (not the lock) */
+	(void) crypt_metadata_lock_hold(cd, 1);
+
 	if ((r = crypt_load(cd, luksType(device_type), NULL))) {
 		log_err(_("Device %s is not a valid LUKS device."),
 			uuid_or_device_header(NULL));
@@ -1973,6 +3865,9 @@ static int action_luksAddKey(void)
 	if ((r = crypt_init(&cd, uuid_or_device_header(NULL))))
 		goto out;
 
+	/* Several metadata accesses follow, keep the lock handle (not the lock) */
+	(void) crypt_metadata_lock_hold(cd, 1);
+
 	if ((r = crypt_load(cd, luksType(device_type), NULL))) {
 		log_err(_("Device %s is not a valid LUKS device."),
 			uuid_or_device_header(NULL));
@@ -2129,6 +4024,9 @@ static int action_luksChangeKey(void)
 	if ((r = crypt_init(&cd, uuid_or_device_header(NULL))))
 		goto out;
 
+	/* Several metadata accesses follow, keep the lock handle (not the lock) */
+	(void) crypt_metadata_lock_hold(cd, 1);
+
 	if ((r = crypt_load(cd, luksType(device_type), NULL))) {
 		log_err(_("Device %s is not a valid LUKS device."),
 			uuid_or_device_header(NULL));
@@ -2193,6 +4091,9 @@ static int action_luksConvertKey(void)
 	if ((r = crypt_init(&cd, uuid_or_device_header(NULL))))
 		goto out;
 
+	/* Several metadata accesses follow, keep the lock handle (not the lock) */
+	(void) crypt_metadata_lock_hold(cd, 1);
+
 	if ((r = crypt_load(cd, CRYPT_LUKS2, NULL))) {
 		log_err(_("Device %s is not a valid LUKS2 device."),
 			uuid_or_device_header(NULL));
@@ -2410,6 +4311,13 @@ static int action_luksDump(void)
 	if ((r = crypt_init(&cd, uuid_or_device_header(NULL))))
 		goto out;
 
+	/* Read-only inventory path, JSON is printed without full header load */
+	if (ARG_SET(OPT_DUMP_JSON_ID) && ARG_SET(OPT_DISABLE_LOCKS_ID) &&
+	    !ARG_SET(OPT_DUMP_VOLUME_KEY_ID) && !ARG_SET(OPT_UNBOUND_ID) &&
+	    (!luksType(device_type) || isLUKS2(luksType(device_type))) &&
+	    !crypt_dump_json(cd, NULL, CRYPT_DUMP_JSON_UNLOCKED))
+		goto out;
+
 	if ((r = crypt_load(cd, luksType(device_type), NULL))) {
 		log_err(_("Device %s is not a valid LUKS device."),
 			uuid_or_device_header(NULL));
@@ -2429,14 +4337,68 @@ out:
 	return r;
 }
 
+/* Active table references keyring key, volume key must be unlocked first */
+static int luksSuspend_hold_key(struct crypt_device *cd)
+{
+	char *password = NULL, *vk = NULL;
+	size_t passwordLen, vk_size;
+	int r, tries;
+
+	r = crypt_suspend_with_held_key(cd, action_argv[0], NULL, 0, ARG_UINT32(OPT_HOLD_KEY_ID));
+	if (r != -ENOKEY)
+		return r;
+
+	r = crypt_get_volume_key_size(cd);
+	if (r <= 0)
+		return -EINVAL;
+	vk_size = r;
+
+	vk = crypt_safe_alloc(vk_size);
+	if (!vk)
+		return -ENOMEM;
+
+	tries = set_tries_tty();
+	do {
+		r = tools_get_key(NULL, &password, &passwordLen,
+			ARG_UINT64(OPT_KEYFILE_OFFSET_ID), ARG_UINT32(OPT_KEYFILE_SIZE_ID), ARG_STR(OPT_KEY_FILE_ID),
+			ARG_UINT32(OPT_TIMEOUT_ID), verify_passphrase(0), 0, cd);
+		if (r < 0)
+			goto out;
+
+		r = crypt_volume_key_get(cd, ARG_INT32(OPT_KEY_SLOT_ID), vk, &vk_size,
+					 password, passwordLen);
+		tools_passphrase_msg(r);
+		check_signal(&r);
+
+		crypt_safe_free(password);
+		password = NULL;
+	} while ((r == -EPERM || r == -ERANGE) && (--tries > 0));
+
+	if (r >= 0)
+		r = crypt_suspend_with_held_key(cd, action_argv[0], vk, vk_size,
+						ARG_UINT32(OPT_HOLD_KEY_ID));
+out:
+	crypt_safe_free(password);
+	crypt_safe_free(vk);
+	return r;
+}
+
 static int action_luksSuspend(void)
 {
 	struct crypt_device *cd = NULL;
 	int r;
 
+	if (ARG_SET(OPT_HOLD_KEY_ID) && !ARG_UINT32(OPT_HOLD_KEY_ID)) {
+		log_err(_("Option --hold-key requires non-zero timeout."));
+		return -EINVAL;
+	}
+
 	r = crypt_init_by_name_and_header(&cd, action_argv[0], uuid_or_device(ARG_STR(OPT_HEADER_ID)));
 	if (!r) {
-		r = crypt_suspend(cd, action_argv[0]);
+		if (ARG_SET(OPT_HOLD_KEY_ID))
+			r = luksSuspend_hold_key(cd);
+		else
+			r = crypt_suspend(cd, action_argv[0]);
 		if (r == -ENODEV)
 			log_err(_("%s is not active %s device name."), action_argv[0], "LUKS");
 	}
@@ -2481,6 +4443,11 @@ static int action_luksResume(void)
 		goto out;
 	}
 
+	/* volume key held in kernel keyring by luksSuspend --hold-key needs no KDF */
+	r = crypt_resume_by_held_key(cd, action_argv[0]);
+	if (r != -ENOKEY)
+		goto out;
+
 	/* try to resume LUKS2 device by token first */
 	r = crypt_resume_by_token_pin(cd, action_argv[0], ARG_STR(OPT_TOKEN_TYPE_ID),
 					ARG_INT32(OPT_TOKEN_ID_ID), NULL, 0, NULL);
@@ -2598,6 +4565,9 @@ static int action_open(void)
 {
 	int r = -EINVAL;
 
+	if (ARG_SET(OPT_BATCH_FILE_ID))
+		return action_open_batch();
+
 	if (ARG_SET(OPT_REFRESH_ID) && !device_type)
 		/* read device type from active mapping */
 		device_type = _get_device_type();
@@ -2645,7 +4615,7 @@ out:
 static int action_luksErase(void)
 {
 	struct crypt_device *cd = NULL;
-	crypt_keyslot_info ki;
+	crypt_keyslot_info ki, *active = NULL;
 	char *msg = NULL;
 	int i, max, r;
 
@@ -2677,16 +4647,25 @@ static int action_luksErase(void)
 		goto out;
 	}
 
+	active = malloc(max * sizeof(*active));
+	if (!active) {
+		r = -ENOMEM;
+		goto out;
+	}
+	for (i = 0; i < max; i++)
+		active[i] = crypt_keyslot_status(cd, i);
+
+	r = crypt_keyslot_destroy_all(cd);
+	if (r < 0)
+		goto out;
+
 	for (i = 0; i < max; i++) {
-		ki = crypt_keyslot_status(cd, i);
-		if (ki == CRYPT_SLOT_ACTIVE || ki == CRYPT_SLOT_ACTIVE_LAST) {
-			r = crypt_keyslot_destroy(cd, i);
-			if (r < 0)
-				goto out;
+		ki = active[i];
+		if (ki == CRYPT_SLOT_ACTIVE || ki == CRYPT_SLOT_ACTIVE_LAST)
 			tools_keyslot_msg(i, REMOVED);
-		}
 	}
 out:
+	free(active);
 	free(msg);
 	crypt_free(cd);
 	return r;
@@ -2777,6 +4756,9 @@ static int action_luksConfig(void)
 	if ((r = crypt_init(&cd, uuid_or_device_header(NULL))))
 		return r;
 
+	/* Several metadata accesses follow, keep the lock handle (not the lock) */
+	(void) crypt_metadata_lock_hold(cd, 1);
+
 	if ((r = crypt_load(cd, CRYPT_LUKS2, NULL))) {
 		log_err(_("Device %s is not a valid LUKS2 device."),
 			uuid_or_device_header(NULL));
@@ -2944,6 +4926,9 @@ static int action_token(void)
 	if ((r = crypt_init(&cd, uuid_or_device(ARG_STR(OPT_HEADER_ID) ?: action_argv[1]))))
 		return r;
 
+	/* Several metadata accesses follow, keep the lock handle (not the lock) */
+	(void) crypt_metadata_lock_hold(cd, 1);
+
 	if ((r = crypt_load(cd, CRYPT_LUKS2, NULL))) {
 		log_err(_("Device %s is not a valid LUKS2 device."),
 			uuid_or_device(ARG_STR(OPT_HEADER_ID) ?: action_argv[1]));
@@ -3040,6 +5025,22 @@ static const char * verify_open(void)
 	if (ARG_SET(OPT_UNBOUND_ID) && !ARG_SET(OPT_TEST_PASSPHRASE_ID))
 		return _("Option --unbound cannot be used without --test-passphrase.");
 
+	if (ARG_SET(OPT_RECOVERY_KEYS_FILE_ID) && strcmp_or_null(device_type, "bitlk"))
+		return _("Option --recovery-keys-file is allowed only for open of BITLK device.");
+
+	if (ARG_SET(OPT_RECOVERY_KEYS_FILE_ID) && (ARG_SET(OPT_KEY_FILE_ID) || ARG_SET(OPT_VOLUME_KEY_FILE_ID)))
+		return _("Option --recovery-keys-file cannot be combined with --key-file or --volume-key-file.");
+
+	if (ARG_SET(OPT_BATCH_FILE_ID)) {
+		if (!device_type || strncmp(device_type, "luks", 4))
+			return _("Option --batch-file is allowed only for open of LUKS devices.");
+		if (action_argc)
+			return _("Option --batch-file cannot be combined with device argument.");
+		if (ARG_SET(OPT_HEADER_ID) || ARG_SET(OPT_KEY_FILE_ID) || ARG_SET(OPT_VOLUME_KEY_FILE_ID) ||
+		    ARG_SET(OPT_TEST_PASSPHRASE_ID) || ARG_SET(OPT_REFRESH_ID))
+			return _("Option --batch-file cannot be combined with --header, --key-file, --volume-key-file, --test-passphrase or refresh.");
+	}
+
 	/* "open --type tcrypt" and "tcryptDump" checks are identical */
 	return verify_tcryptdump();
 }
@@ -3049,6 +5050,12 @@ static const char *verify_close(void)
 	if (ARG_SET(OPT_CANCEL_DEFERRED_ID) && ARG_SET(OPT_DEFERRED_ID))
 		return _("Options --cancel-deferred and --deferred cannot be used at the same time.");
 
+	if (ARG_SET(OPT_BATCH_FILE_ID) && (action_argc || ARG_SET(OPT_CANCEL_DEFERRED_ID) || ARG_SET(OPT_HEADER_ID)))
+		return _("Option --batch-file cannot be combined with device name argument, --cancel-deferred or --header.");
+
+	if (action_argc > 1 && (ARG_SET(OPT_CANCEL_DEFERRED_ID) || ARG_SET(OPT_HEADER_ID)))
+		return _("Options --cancel-deferred and --header can be used only with one device.");
+
 	return NULL;
 }
 
@@ -3093,6 +5100,50 @@ static const char *verify_format(void)
 	if (ARG_SET(OPT_USE_RANDOM_ID) && ARG_SET(OPT_USE_URANDOM_ID))
 		return  _("Only one of --use-[u]random options is allowed.");
 
+	if (ARG_SET(OPT_SECTOR_SIZE_BENCHMARK_ID) && ARG_SET(OPT_SECTOR_SIZE_ID))
+		return _("Options --sector-size-benchmark and --sector-size cannot be combined.");
+
+	if (ARG_SET(OPT_DEVICES_FILE_ID)) {
+		if (action_argc)
+			return _("Option --devices-file cannot be combined with device argument.");
+		if (ARG_SET(OPT_HEADER_ID) || ARG_SET(OPT_UUID_ID) || ARG_SET(OPT_VOLUME_KEY_FILE_ID))
+			return _("Option --devices-file cannot be combined with --header, --uuid or --volume-key-file.");
+		/* integrity wipe needs device-mapper, not usable in parallel formats */
+		if (ARG_SET(OPT_INTEGRITY_ID))
+			return _("Option --devices-file cannot be combined with --integrity.");
+	}
+
+	return NULL;
+}
+
+static const char *verify_benchmark(void)
+{
+	if (ARG_SET(OPT_DM_BENCHMARK_ID) && (ARG_SET(OPT_THREADS_ID) || ARG_SET(OPT_PBKDF_ID) ||
+	    ARG_SET(OPT_HASH_ID) || ARG_SET(OPT_PBKDF_MATRIX_ID)))
+		return _("Option --dm-benchmark cannot be combined with --threads, --pbkdf, --hash or --pbkdf-matrix.");
+
+	if (ARG_SET(OPT_IV_BENCHMARK_ID) && (ARG_SET(OPT_DM_BENCHMARK_ID) || ARG_SET(OPT_THREADS_ID) ||
+	    ARG_SET(OPT_PBKDF_ID) || ARG_SET(OPT_HASH_ID) || ARG_SET(OPT_PBKDF_MATRIX_ID)))
+		return _("Option --iv-benchmark cannot be combined with --dm-benchmark, --threads, --pbkdf, --hash or --pbkdf-matrix.");
+
+	if (ARG_SET(OPT_JSON_ID) && (ARG_SET(OPT_IV_BENCHMARK_ID) || ARG_SET(OPT_PBKDF_ID) ||
+	    ARG_SET(OPT_HASH_ID) || ARG_SET(OPT_PBKDF_MATRIX_ID)))
+		return _("Option --json can be used only for cipher benchmark or with --dm-benchmark.");
+
+	if (ARG_SET(OPT_SECTOR_SIZE_ID) && !ARG_SET(OPT_DM_BENCHMARK_ID) && !ARG_SET(OPT_IV_BENCHMARK_ID))
+		return _("Option --sector-size with benchmark action requires --dm-benchmark or --iv-benchmark.");
+
+	return NULL;
+}
+
+static const char *verify_status(void)
+{
+	if ((ARG_SET(OPT_STATS_FORMAT_ID) || ARG_SET(OPT_STATS_INTERVAL_ID)) && !ARG_SET(OPT_STATS_ID))
+		return _("Options --stats-format and --stats-interval require --stats.");
+
+	if (ARG_SET(OPT_STATS_INTERVAL_ID) && !ARG_UINT32(OPT_STATS_INTERVAL_ID))
+		return _("Option --stats-interval must be positive.");
+
 	return NULL;
 }
 
@@ -3154,10 +5205,10 @@ static struct action_type {
 	const char *desc;
 } action_types[] = {
 	{ OPEN_ACTION,		action_open,		verify_open,		1, N_("<device> [--type <type>] [<name>]"),N_("open device as <name>") },
-	{ CLOSE_ACTION,		action_close,		verify_close,		1, N_("<name>"), N_("close device (remove mapping)") },
+	{ CLOSE_ACTION,		action_close,		verify_close,		1, N_("<name> [<name>...]"), N_("close device (remove mapping)") },
 	{ RESIZE_ACTION,	action_resize,		verify_resize,		1, N_("<name>"), N_("resize active device") },
-	{ STATUS_ACTION,	action_status,		NULL,			1, N_("<name>"), N_("show device status") },
-	{ BENCHMARK_ACTION,	action_benchmark,	NULL,			0, N_("[--cipher <cipher>]"), N_("benchmark cipher") },
+	{ STATUS_ACTION,	action_status,		verify_status,		1, N_("<name>"), N_("show device status") },
+	{ BENCHMARK_ACTION,	action_benchmark,	verify_benchmark,			0, N_("[--cipher <cipher>]"), N_("benchmark cipher") },
 	{ REPAIR_ACTION,	action_luksRepair,	NULL,			1, N_("<device>"), N_("try to repair on-disk metadata") },
 	{ REENCRYPT_ACTION,	action_reencrypt,	verify_reencrypt,	0, N_("<device>"), N_("reencrypt LUKS2 device") },
 	{ ERASE_ACTION,		action_luksErase,	NULL,			1, N_("<device>"), N_("erase all keyslots (remove encryption key)") },
@@ -3299,7 +5350,7 @@ static bool needs_size_conversion(unsigned arg_id)
 {
 	return (arg_id == OPT_DEVICE_SIZE_ID || arg_id == OPT_HOTZONE_SIZE_ID ||
 		arg_id == OPT_LUKS2_KEYSLOTS_SIZE_ID || arg_id == OPT_LUKS2_METADATA_SIZE_ID ||
-		arg_id == OPT_REDUCE_DEVICE_SIZE_ID);
+		arg_id == OPT_REDUCE_DEVICE_SIZE_ID || arg_id == OPT_THROTTLE_RATE_ID);
 }
 
 static void check_key_slot_value(poptContext popt_context)
@@ -3348,6 +5399,12 @@ static void basic_options_cb(poptContext popt_context,
 			keyfiles[keyfiles_count++] = strdup(ARG_STR(OPT_KEY_FILE_ID));
 		total_keyfiles++;
 		break;
+	case OPT_THREADS_ID:
+		if (!ARG_UINT32(OPT_THREADS_ID) || ARG_UINT32(OPT_THREADS_ID) > CRYPT_BENCHMARK_THREADS_MAX)
+			usage(popt_context, EXIT_FAILURE,
+			      _("Invalid number of benchmark threads."),
+			      poptGetInvocationName(popt_context));
+		break;
 	case OPT_KEY_SIZE_ID:
 		if (ARG_UINT32(OPT_KEY_SIZE_ID) % 8)
 			usage(popt_context, EXIT_FAILURE,
@@ -3528,7 +5585,9 @@ int main(int argc, const char **argv)
 		usage(popt_context, EXIT_FAILURE, _("Unknown action."),
 		      poptGetInvocationName(popt_context));
 
-	if (action_argc < action->required_action_argc)
+	if (action_argc < action->required_action_argc &&
+	    !(!strcmp(aname, FORMAT_ACTION) && ARG_SET(OPT_DEVICES_FILE_ID)) &&
+	    !((!strcmp(aname, OPEN_ACTION) || !strcmp(aname, CLOSE_ACTION)) && ARG_SET(OPT_BATCH_FILE_ID)))
 		help_args(action, popt_context);
 
 	/* this routine short circuits to exit() on error */
@@ -3590,6 +5649,11 @@ int main(int argc, const char **argv)
 	if (ARG_SET(OPT_DISABLE_EXTERNAL_TOKENS_ID))
 		(void) crypt_token_external_disable();
 
+	/* Metadata inspection only, read header without lock if no update is running */
+	if (!strcmp(aname, STATUS_ACTION) || !strcmp(aname, LUKSDUMP_ACTION) ||
+	    !strcmp(aname, ISLUKS_ACTION))
+		(void) crypt_metadata_read_optimistic(NULL, 1);
+
 	if (ARG_SET(OPT_DISABLE_LOCKS_ID) && crypt_metadata_locking(NULL, 0)) {
 		log_std(_("Cannot disable metadata locking."));
 		r = EXIT_FAILURE;
@@ -73,6 +73,7 @@ void tools_keyslot_msg(int keyslot, crypt_object_op op);
 void tools_token_msg(int token, crypt_object_op op);
 void tools_token_error_msg(int error, const char *type, int token, bool pin_provided);
 void tools_package_version(const char *name, bool use_pwlibs);
+void tools_wipe_set_queue_depth(struct crypt_device *cd);
 
 extern volatile int quit;
 void set_int_block(int block);
@@ -99,6 +100,7 @@ struct tools_progress_params {
 	bool json_output;
 	const char *interrupt_message;
 	const char *device;
+	struct crypt_device *cd;
 };
 
 int tools_progress(uint64_t size, uint64_t offset, void *usrptr);
@@ -117,6 +119,8 @@ typedef enum {
 } tools_probe_filter_info;
 
 int tools_detect_signatures(const char *device, tools_probe_filter_info filter, size_t *count, bool batch_mode);
+int tools_detect_signatures_batch(const char * const *devices, size_t count,
+				  size_t *signatures, bool batch_mode);
 int tools_wipe_all_signatures(const char *path, bool exclusive, bool only_luks);
 int tools_superblock_block_size(const char *device, char *sb_name,
 				size_t sb_name_len, unsigned *r_block_size);
@@ -124,6 +128,7 @@ bool tools_blkid_supported(void);
 
 int tools_lookup_crypt_device(struct crypt_device *cd, const char *type,
 		const char *data_device_path, char **r_name);
+int tools_device_disks(const char *device, dev_t *disks, size_t max, size_t *count);
 
 
 /* each utility is required to implement it */
@@ -27,8 +27,12 @@ ARG(OPT_ALIGN_PAYLOAD, '\0', POPT_ARG_STRING, N_("Align payload at <n> sector bo
 
 ARG(OPT_ALLOW_DISCARDS, '\0', POPT_ARG_NONE, N_("Allow discards (aka TRIM) requests for device"), NULL, CRYPT_ARG_BOOL, {}, OPT_ALLOW_DISCARDS_ACTIONS)
 
+ARG(OPT_BATCH_FILE, '\0', POPT_ARG_STRING, N_("Read list of volumes to open or close from crypttab-like file"), NULL, CRYPT_ARG_STRING, {}, OPT_BATCH_FILE_ACTIONS)
+
 ARG(OPT_BATCH_MODE, 'q', POPT_ARG_NONE, N_("Do not ask for confirmation"), NULL, CRYPT_ARG_BOOL, {}, {})
 
+ARG(OPT_BENCHMARK, '\0', POPT_ARG_NONE, N_("Estimate reencryption time from sampled hotzones without changing the device"), NULL, CRYPT_ARG_BOOL, {}, OPT_BENCHMARK_ACTIONS)
+
 ARG(OPT_CANCEL_DEFERRED, '\0', POPT_ARG_NONE, N_("Cancel a previously set deferred device removal"), NULL, CRYPT_ARG_BOOL, {}, OPT_DEFERRED_ACTIONS)
 
 ARG(OPT_CIPHER, 'c', POPT_ARG_STRING, N_("The cipher used to encrypt the disk (see /proc/crypto)"), NULL, CRYPT_ARG_STRING, {}, {})
@@ -41,6 +45,8 @@ ARG(OPT_DEFERRED, '\0', POPT_ARG_NONE, N_("Device removal is deferred until the
 
 ARG(OPT_DEVICE_SIZE, '\0', POPT_ARG_STRING, N_("Use only specified device size (ignore rest of device). DANGEROUS!"), N_("bytes"), CRYPT_ARG_UINT64, {}, OPT_DEVICE_SIZE_ACTIONS)
 
+ARG(OPT_DEVICES_FILE, '\0', POPT_ARG_STRING, N_("Read list of devices to format from file"), NULL, CRYPT_ARG_STRING, {}, OPT_DEVICES_FILE_ACTIONS)
+
 ARG(OPT_DECRYPT, '\0', POPT_ARG_NONE, N_("Decrypt LUKS2 device (remove encryption)."), NULL, CRYPT_ARG_BOOL, {}, {})
 
 ARG(OPT_DISABLE_EXTERNAL_TOKENS, '\0', POPT_ARG_NONE, N_("Disable loading of external LUKS2 token plugins"), NULL, CRYPT_ARG_BOOL, {}, {})
@@ -51,6 +57,8 @@ ARG(OPT_DISABLE_LOCKS, '\0', POPT_ARG_NONE, N_("Disable locking of on-disk metad
 
 ARG(OPT_DISABLE_VERACRYPT, '\0', POPT_ARG_NONE, N_("Do not scan for VeraCrypt compatible device"), NULL, CRYPT_ARG_BOOL, {}, OPT_DISABLE_VERACRYPT_ACTIONS)
 
+ARG(OPT_DM_BENCHMARK, '\0', POPT_ARG_NONE, N_("Measure I/O throughput and latency of temporary dm-crypt mapping in RAM"), NULL, CRYPT_ARG_BOOL, {}, OPT_DM_BENCHMARK_ACTIONS)
+
 ARG(OPT_DUMP_JSON, '\0', POPT_ARG_NONE, N_("Dump info in JSON format (LUKS2 only)"), NULL, CRYPT_ARG_BOOL, {}, {})
 
 ARG(OPT_DUMP_VOLUME_KEY, '\0', POPT_ARG_NONE, N_("Dump volume key instead of keyslots info"), NULL, CRYPT_ARG_BOOL, {}, {})
@@ -67,8 +75,14 @@ ARG(OPT_HEADER, '\0', POPT_ARG_STRING, N_("Device or file with separated LUKS he
 
 ARG(OPT_HEADER_BACKUP_FILE, '\0', POPT_ARG_STRING, N_("File with LUKS header and keyslots backup"), NULL, CRYPT_ARG_STRING, {}, {})
 
+ARG(OPT_HOLD_KEY, '\0', POPT_ARG_STRING, N_("Hold volume key in kernel keyring for resume without passphrase (expires after secs)."), N_("secs"), CRYPT_ARG_UINT32, {}, OPT_HOLD_KEY_ACTIONS)
+
 ARG(OPT_HOTZONE_SIZE, '\0', POPT_ARG_STRING, N_("Maximal reencryption hotzone size."), N_("bytes"), CRYPT_ARG_UINT64, {}, OPT_HOTZONE_SIZE_ACTIONS)
 
+ARG(OPT_HOTZONE_BATCH, '\0', POPT_ARG_STRING, N_("Number of reencryption hotzones per metadata commit (checksum resilience)."), NULL, CRYPT_ARG_UINT32, {}, OPT_HOTZONE_SIZE_ACTIONS)
+
+ARG(OPT_HOTZONE_LATENCY, '\0', POPT_ARG_STRING, N_("Adapt online reencryption hotzone size to keep device suspended at most this long."), N_("msecs"), CRYPT_ARG_UINT32, {}, OPT_HOTZONE_SIZE_ACTIONS)
+
 ARG(OPT_INIT_ONLY, '\0', POPT_ARG_NONE, N_("Initialize LUKS2 reencryption in metadata only."), NULL, CRYPT_ARG_BOOL, {}, {})
 
 ARG(OPT_INTEGRITY, 'I', POPT_ARG_STRING, N_("Data integrity algorithm (LUKS2 only)"), NULL, CRYPT_ARG_STRING, {}, OPT_INTEGRITY_ACTIONS)
@@ -81,8 +95,12 @@ ARG(OPT_INTEGRITY_NO_WIPE, '\0', POPT_ARG_NONE, N_("Do not wipe device after for
 
 ARG(OPT_ITER_TIME, 'i', POPT_ARG_STRING, N_("PBKDF iteration time for LUKS (in ms)"), N_("msecs"), CRYPT_ARG_UINT32, {}, OPT_ITER_TIME_ACTIONS)
 
+ARG(OPT_IV_BENCHMARK, '\0', POPT_ARG_NONE, N_("Measure per-sector encryption with IV generators as in userspace reencryption"), NULL, CRYPT_ARG_BOOL, {}, OPT_IV_BENCHMARK_ACTIONS)
+
 ARG(OPT_IV_LARGE_SECTORS, '\0', POPT_ARG_NONE, N_("Use IV counted in sector size (not in 512 bytes)"), NULL , CRYPT_ARG_BOOL, {}, OPT_IV_LARGE_SECTORS_ACTIONS)
 
+ARG(OPT_JSON, '\0', POPT_ARG_NONE, N_("Print benchmark results with statistics of repeated runs in JSON format"), NULL, CRYPT_ARG_BOOL, {}, OPT_JSON_ACTIONS)
+
 ARG(OPT_JSON_FILE, '\0', POPT_ARG_STRING, N_("Read or write the json from or to a file"), NULL, CRYPT_ARG_STRING, {}, {})
 
 ARG(OPT_KEEP_KEY, '\0', POPT_ARG_NONE, N_("Do not change volume key."), NULL, CRYPT_ARG_BOOL, {}, OPT_KEEP_KEY_ACTIONS)
@@ -123,14 +141,22 @@ ARG(OPT_NEW_TOKEN_ID, '\0', POPT_ARG_STRING, N_("Token number (default: any)"),
 
 ARG(OPT_OFFSET, 'o', POPT_ARG_STRING, N_("The start offset in the backend device"), N_("SECTORS"), CRYPT_ARG_UINT64, {}, OPT_OFFSET_ACTIONS)
 
+ARG(OPT_PARALLEL_DEVICES, '\0', POPT_ARG_STRING, N_("Resume reencryption of all listed devices, at most this number at once."), NULL, CRYPT_ARG_UINT32, {}, OPT_HOTZONE_SIZE_ACTIONS)
+
 ARG(OPT_PBKDF, '\0', POPT_ARG_STRING, N_("PBKDF algorithm (for LUKS2): argon2i, argon2id, pbkdf2"), NULL, CRYPT_ARG_STRING, {}, OPT_PBKDF_ACTIONS)
 
+ARG(OPT_PBKDF_CACHE, '\0', POPT_ARG_STRING, N_("File with cache of PBKDF benchmark results"), N_("path"), CRYPT_ARG_STRING, {}, OPT_PBKDF_CACHE_ACTIONS)
+
 ARG(OPT_PBKDF_FORCE_ITERATIONS, '\0', POPT_ARG_STRING, N_("PBKDF iterations cost (forced, disables benchmark)"), "LONG", CRYPT_ARG_UINT32, {}, OPT_PBKDF_FORCE_ITERATIONS_ACTIONS)
 
+ARG(OPT_PBKDF_MATRIX, '\0', POPT_ARG_NONE, N_("Measure PBKDF over a matrix of memory, threads and iterations costs (JSON output)"), NULL, CRYPT_ARG_BOOL, {}, OPT_PBKDF_MATRIX_ACTIONS)
+
 ARG(OPT_PBKDF_MEMORY, '\0', POPT_ARG_STRING, N_("PBKDF memory cost limit"), N_("kilobytes"), CRYPT_ARG_UINT32, { .u32_value = DEFAULT_LUKS2_MEMORY_KB }, {})
 
 ARG(OPT_PBKDF_PARALLEL, '\0', POPT_ARG_STRING, N_("PBKDF parallel cost"), N_("threads"), CRYPT_ARG_UINT32, { .u32_value = DEFAULT_LUKS2_PARALLEL_THREADS }, {})
 
+ARG(OPT_PERF_AUTO, '\0', POPT_ARG_NONE, N_("Choose dm-crypt performance options according to data device"), NULL, CRYPT_ARG_BOOL, {}, {})
+
 ARG(OPT_PERF_NO_READ_WORKQUEUE, '\0', POPT_ARG_NONE, N_("Bypass dm-crypt workqueue and process read requests synchronously"), NULL, CRYPT_ARG_BOOL, {}, {})
 
 ARG(OPT_PERF_NO_WRITE_WORKQUEUE, '\0', POPT_ARG_NONE, N_("Bypass dm-crypt workqueue and process write requests synchronously"), NULL, CRYPT_ARG_BOOL, {}, {})
@@ -149,6 +175,8 @@ ARG(OPT_PROGRESS_FREQUENCY, '\0', POPT_ARG_STRING, N_("Progress line update (in
 
 ARG(OPT_READONLY, 'r', POPT_ARG_NONE, N_("Create a readonly mapping"), NULL, CRYPT_ARG_BOOL, {}, {})
 
+ARG(OPT_RECOVERY_KEYS_FILE, '\0', POPT_ARG_STRING, N_("Try BITLK recovery passwords from file (one per line)"), NULL, CRYPT_ARG_STRING, {}, OPT_RECOVERY_KEYS_FILE_ACTIONS)
+
 ARG(OPT_REDUCE_DEVICE_SIZE, '\0', POPT_ARG_STRING, N_("Reduce data device size (move data offset). DANGEROUS!"), N_("bytes"), CRYPT_ARG_UINT64, {}, {})
 
 ARG(OPT_REFRESH, '\0', POPT_ARG_NONE, N_("Refresh (reactivate) device with new parameters"), NULL, CRYPT_ARG_BOOL, {}, OPT_REFRESH_ACTIONS)
@@ -161,7 +189,9 @@ ARG(OPT_RESUME_ONLY, '\0', POPT_ARG_NONE, N_("Resume initialized LUKS2 reencrypt
 
 ARG(OPT_SECTOR_SIZE, '\0', POPT_ARG_STRING, N_("Encryption sector size (default: 512 bytes)"), "INT", CRYPT_ARG_UINT32, {}, OPT_SECTOR_SIZE_ACTIONS)
 
-ARG(OPT_SERIALIZE_MEMORY_HARD_PBKDF, '\0', POPT_ARG_NONE, N_("Use global lock to serialize memory hard PBKDF (OOM workaround)"), NULL, CRYPT_ARG_BOOL, {}, OPT_SERIALIZE_MEMORY_HARD_PBKDF_ACTIONS)
+ARG(OPT_SECTOR_SIZE_BENCHMARK, '\0', POPT_ARG_NONE, N_("Select encryption sector size by measuring throughput and device latency"), NULL, CRYPT_ARG_BOOL, {}, OPT_SECTOR_SIZE_BENCHMARK_ACTIONS)
+
+ARG(OPT_SERIALIZE_MEMORY_HARD_PBKDF, '\0', POPT_ARG_NONE, N_("Use global lock to limit parallel memory hard PBKDF (OOM workaround)"), NULL, CRYPT_ARG_BOOL, {}, OPT_SERIALIZE_MEMORY_HARD_PBKDF_ACTIONS)
 
 ARG(OPT_SHARED, '\0', POPT_ARG_NONE, N_("Share device with another non-overlapping crypt segment"), NULL, CRYPT_ARG_BOOL, {}, OPT_SHARED_ACTIONS )
 
@@ -169,6 +199,18 @@ ARG(OPT_SIZE, 'b', POPT_ARG_STRING, N_("The size of the device"), N_("SECTORS"),
 
 ARG(OPT_SKIP, 'p', POPT_ARG_STRING, N_("How many sectors of the encrypted data to skip at the beginning"), N_("SECTORS"), CRYPT_ARG_UINT64, {}, OPT_SKIP_ACTIONS)
 
+ARG(OPT_SPARSE, '\0', POPT_ARG_NONE, N_("Do not reencrypt unallocated areas of data device (offline only)."), NULL, CRYPT_ARG_BOOL, {}, OPT_HOTZONE_SIZE_ACTIONS)
+
+ARG(OPT_SPARSE_DISCARD, '\0', POPT_ARG_NONE, N_("Discard unallocated areas of data device instead of reencryption (offline only)."), NULL, CRYPT_ARG_BOOL, {}, OPT_HOTZONE_SIZE_ACTIONS)
+
+ARG(OPT_SPARSE_UNUSED, '\0', POPT_ARG_NONE, N_("Data device contains no data, change only metadata (offline only)."), NULL, CRYPT_ARG_BOOL, {}, OPT_HOTZONE_SIZE_ACTIONS)
+
+ARG(OPT_STATS, '\0', POPT_ARG_NONE, N_("Print I/O statistics of active device and devices below it"), NULL, CRYPT_ARG_BOOL, {}, OPT_STATS_ACTIONS)
+
+ARG(OPT_STATS_FORMAT, '\0', POPT_ARG_STRING, N_("I/O statistics output format (json, prometheus)"), NULL, CRYPT_ARG_STRING, {}, OPT_STATS_ACTIONS)
+
+ARG(OPT_STATS_INTERVAL, '\0', POPT_ARG_STRING, N_("Interval for I/O statistics rates"), N_("msecs"), CRYPT_ARG_UINT32, { .u32_value = 1000 }, OPT_STATS_ACTIONS)
+
 ARG(OPT_SUBSYSTEM, '\0', POPT_ARG_STRING, N_("Set subsystem label for the LUKS2 device"), NULL, CRYPT_ARG_STRING, {}, OPT_SUBSYSTEM_ACTIONS)
 
 ARG(OPT_TCRYPT_BACKUP, '\0', POPT_ARG_NONE, N_("Use backup (secondary) TCRYPT header"), NULL, CRYPT_ARG_BOOL, {}, OPT_TCRYPT_BACKUP_ACTIONS)
@@ -181,8 +223,20 @@ ARG(OPT_TEST_ARGS, '\0', POPT_ARG_NONE, N_("Do not run action, just validate all
 
 ARG(OPT_TEST_PASSPHRASE, '\0', POPT_ARG_NONE, N_("Do not activate device, just check passphrase"), NULL, CRYPT_ARG_BOOL, {}, OPT_TEST_PASSPHRASE_ACTIONS)
 
+ARG(OPT_THREADS, '\0', POPT_ARG_STRING, N_("Run cipher benchmark in parallel threads pinned to CPUs"), N_("threads"), CRYPT_ARG_UINT32, {}, OPT_THREADS_ACTIONS)
+
+ARG(OPT_THROTTLE_IN_FLIGHT, '\0', POPT_ARG_STRING, N_("Back off online reencryption while active device has more I/O requests in flight."), NULL, CRYPT_ARG_UINT32, {}, OPT_HOTZONE_SIZE_ACTIONS)
+
+ARG(OPT_THROTTLE_IOPS, '\0', POPT_ARG_STRING, N_("Maximal reencryption I/O requests per second."), NULL, CRYPT_ARG_UINT32, {}, OPT_HOTZONE_SIZE_ACTIONS)
+
+ARG(OPT_THROTTLE_LATENCY, '\0', POPT_ARG_STRING, N_("Back off online reencryption while average I/O latency of active device is higher."), N_("msecs"), CRYPT_ARG_UINT32, {}, OPT_HOTZONE_SIZE_ACTIONS)
+
+ARG(OPT_THROTTLE_RATE, '\0', POPT_ARG_STRING, N_("Maximal reencryption data rate per second."), N_("bytes"), CRYPT_ARG_UINT64, {}, OPT_HOTZONE_SIZE_ACTIONS)
+
 ARG(OPT_TIMEOUT, 't', POPT_ARG_STRING, N_("Timeout for interactive passphrase prompt (in seconds)"), N_("secs"), CRYPT_ARG_UINT32, {}, {})
 
+ARG(OPT_TIMING, '\0', POPT_ARG_NONE, N_("Print time spent in activation phases"), NULL, CRYPT_ARG_BOOL, {}, OPT_TIMING_ACTIONS)
+
 ARG(OPT_TOKEN_ID, '\0', POPT_ARG_STRING, N_("Token number (default: any)"), "INT", CRYPT_ARG_INT32, { .i32_value = CRYPT_ANY_TOKEN }, {})
 
 ARG(OPT_TOKEN_ONLY, '\0', POPT_ARG_NONE, N_("Do not ask for passphrase if activation by token fails"), NULL, CRYPT_ARG_BOOL, {}, {})
@@ -19,6 +19,7 @@
  * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
  */
 
+#include <time.h>
 #include <uuid/uuid.h>
 
 #define DEFAULT_ALG_NAME "crc32c"
@@ -95,6 +96,16 @@ static int _wipe_data_device(struct crypt_device *cd, const char *integrity_key)
 			"You can interrupt this by pressing CTRL+c "
 			"(rest of not wiped device will contain invalid checksum).\n"));
 
+	if (ARG_SET(OPT_WIPE_DIRECT_ID)) {
+		tools_wipe_set_queue_depth(cd);
+		set_int_handler(0);
+		r = crypt_wipe_integrity_tags(cd, DEFAULT_WIPE_BLOCK, &tools_progress, &prog_parms);
+		set_int_block(0);
+		if (r != -ENOTSUP)
+			goto out;
+		log_verbose(_("Integrity tags cannot be initialized directly, wiping through the device."));
+	}
+
 	/* Activate the device a temporary one */
 	uuid_generate(tmp_uuid_bin);
 	uuid_unparse(tmp_uuid_bin, tmp_uuid);
@@ -109,6 +120,7 @@ static int _wipe_data_device(struct crypt_device *cd, const char *integrity_key)
 		goto out;
 
 	/* Wipe the device */
+	tools_wipe_set_queue_depth(cd);
 	set_int_handler(0);
 	r = crypt_wipe(cd, tmp_path, CRYPT_WIPE_ZERO, 0, 0, DEFAULT_WIPE_BLOCK,
 		       0, &tools_progress, &prog_parms);
@@ -121,7 +133,234 @@ out:
 	return r;
 }
 
-static int action_format(void)
+static int _recalculate_data_device(struct crypt_device *cd, const char *integrity_key)
+{
+	int r;
+	char *backing_file = NULL;
+	struct tools_progress_params prog_parms = {
+		.frequency = ARG_UINT32(OPT_PROGRESS_FREQUENCY_ID),
+		.batch_mode = ARG_SET(OPT_BATCH_MODE_ID),
+		.json_output = ARG_SET(OPT_PROGRESS_JSON_ID),
+		.interrupt_message = _("\nRecalculation interrupted."),
+		.device = tools_get_device_name(crypt_get_device_name(cd), &backing_file)
+	};
+
+	if (!ARG_SET(OPT_BATCH_MODE_ID))
+		log_std(_("Calculating integrity checksum of existing data.\n"
+			"You can interrupt this by pressing CTRL+c "
+			"(rest of device will contain invalid checksum).\n"));
+
+	set_int_handler(0);
+	r = crypt_recalculate_integrity_tags(cd, integrity_key, ARG_UINT32(OPT_INTEGRITY_KEY_SIZE_ID),
+					     &tools_progress, &prog_parms);
+	set_int_block(0);
+	if (r == -ENOTSUP)
+		log_err(_("Integrity checksum cannot be calculated in userspace, "
+			  "activate the device with --integrity-recalculate instead."));
+
+	free(backing_file);
+	return r;
+}
+
+/*
+ * Journal benchmark: every candidate is formatted (without wipe), activated
+ * as a temporary device and a short random write workload is run in the
+ * scratch area at the device start. Activation settings are not stored
+ * on disk, they are only printed as recommendation.
+ */
+#define BENCH_SCRATCH_SIZE	(256 * 1024 * 1024)
+#define BENCH_BLOCK_SIZE	4096
+#define BENCH_SYNC_WRITES	256
+#define BENCH_MS		3000
+
+static const struct {
+	const char *desc;
+	uint64_t journal_size;
+	uint32_t watermark;	/* percent, 0 for default */
+	uint32_t commit_time;	/* ms, 0 for default */
+	bool bitmap;
+} bench_candidates[] = {
+	{ N_("journal, default size"), 0, 0, 0, false },
+	{ N_("journal 64 MiB"), 64 * 1024 * 1024, 0, 0, false },
+	{ N_("journal 64 MiB, watermark 90%"), 64 * 1024 * 1024, 90, 0, false },
+	{ N_("journal 256 MiB, watermark 90%"), 256 * 1024 * 1024, 90, 0, false },
+	{ N_("bitmap mode"), 0, 0, 0, true },
+};
+
+static uint64_t _bench_us(void)
+{
+	struct timespec ts;
+
+	if (clock_gettime(CLOCK_MONOTONIC, &ts) < 0)
+		return 0;
+
+	return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t _bench_ms(void)
+{
+	return _bench_us() / 1000;
+}
+
+/* Random synchronous writes to scratch area, returns KiB/s */
+static int _bench_write(const char *path, uint32_t block_size, uint64_t *speed)
+{
+	uint64_t size, blocks, writes = 0, start, ms = 0, rnd = 0x9e3779b97f4a7c15ULL;
+	void *buf = NULL;
+	off_t end;
+	int fd, r = 0;
+
+	fd = open(path, O_WRONLY | O_DIRECT);
+	if (fd < 0)
+		return -EINVAL;
+
+	end = lseek(fd, 0, SEEK_END);
+	if (end < (off_t)block_size) {
+		r = -EINVAL;
+		goto out;
+	}
+	size = (uint64_t)end;
+	if (size > BENCH_SCRATCH_SIZE)
+		size = BENCH_SCRATCH_SIZE;
+	blocks = size / block_size;
+
+	if (posix_memalign(&buf, block_size, block_size)) {
+		r = -ENOMEM;
+		goto out;
+	}
+	memset(buf, 0xa5, block_size);
+
+	start = _bench_ms();
+	while (!r && ms < BENCH_MS) {
+		rnd ^= rnd << 13; rnd ^= rnd >> 7; rnd ^= rnd << 17;
+		if (pwrite(fd, buf, block_size, (rnd % blocks) * block_size) != (ssize_t)block_size)
+			r = -EIO;
+		else if (++writes % BENCH_SYNC_WRITES == 0) {
+			if (fdatasync(fd) < 0)
+				r = -EIO;
+			ms = _bench_ms() - start;
+		}
+		check_signal(&r);
+	}
+
+	if (!r && fdatasync(fd) < 0)
+		r = -EIO;
+	ms = _bench_ms() - start;
+	if (!r)
+		*speed = ms ? writes * block_size / ms * 1000 / 1024 : 0;
+out:
+	free(buf);
+	close(fd);
+	return r;
+}
+
+static int _bench_candidate(const char *device, const char *data_device,
+			    const struct crypt_params_integrity *base, unsigned i,
+			    const char *integrity_key, uint64_t *speed)
+{
+	struct crypt_device *cd = NULL;
+	struct crypt_params_integrity params = *base;
+	char tmp_name[64], tmp_path[128], tmp_uuid[40];
+	uuid_t tmp_uuid_bin;
+	uint32_t flags = CRYPT_ACTIVATE_PRIVATE;
+	int r;
+
+	params.journal_size = bench_candidates[i].journal_size ?: base->journal_size;
+	if (bench_candidates[i].bitmap) {
+		if (base->journal_integrity || base->journal_crypt)
+			return -ENOTSUP;
+		flags |= CRYPT_ACTIVATE_NO_JOURNAL | CRYPT_ACTIVATE_NO_JOURNAL_BITMAP;
+		params.journal_watermark = ARG_UINT32(OPT_BITMAP_SECTORS_PER_BIT_ID);
+		params.journal_commit_time = ARG_UINT32(OPT_BITMAP_FLUSH_TIME_ID);
+	} else {
+		params.journal_watermark = bench_candidates[i].watermark ?: base->journal_watermark;
+		params.journal_commit_time = bench_candidates[i].commit_time ?: base->journal_commit_time;
+	}
+
+	uuid_generate(tmp_uuid_bin);
+	uuid_unparse(tmp_uuid_bin, tmp_uuid);
+	if (snprintf(tmp_name, sizeof(tmp_name), "temporary-cryptsetup-%s", tmp_uuid) < 0 ||
+	    snprintf(tmp_path, sizeof(tmp_path), "%s/%s", crypt_get_dir(), tmp_name) < 0)
+		return -EINVAL;
+
+	r = crypt_init_data_device(&cd, device, data_device);
+	if (r < 0)
+		return r;
+
+	if (ARG_SET(OPT_INTEGRITY_LEGACY_PADDING_ID))
+		crypt_set_compatibility(cd, CRYPT_COMPAT_LEGACY_INTEGRITY_PADDING);
+	if (ARG_SET(OPT_INTEGRITY_LEGACY_HMAC_ID))
+		crypt_set_compatibility(cd, CRYPT_COMPAT_LEGACY_INTEGRITY_HMAC);
+
+	r = crypt_format(cd, CRYPT_INTEGRITY, NULL, NULL, NULL, NULL, 0, &params);
+	if (r < 0)
+		goto out;
+
+	r = crypt_activate_by_volume_key(cd, tmp_name, integrity_key,
+					 ARG_UINT32(OPT_INTEGRITY_KEY_SIZE_ID), flags);
+	if (r < 0)
+		goto out;
+
+	r = _bench_write(tmp_path, crypt_get_sector_size(cd) > BENCH_BLOCK_SIZE ?
+			 crypt_get_sector_size(cd) : BENCH_BLOCK_SIZE, speed);
+
+	if (crypt_deactivate(cd, tmp_name))
+		log_err(_("Cannot deactivate temporary device %s."), tmp_path);
+out:
+	crypt_free(cd);
+	return r;
+}
+
+/* Run all candidates, set journal size in params and print the best activation options */
+static int _benchmark_journal(const char *device, const char *data_device,
+			      struct crypt_params_integrity *params, const char *integrity_key)
+{
+	uint64_t speed, best_speed = 0;
+	unsigned i, best = 0;
+	int r;
+
+	log_std(_("Benchmarking journal settings on %s, this takes %u seconds per setting.\n"),
+		device, BENCH_MS / 1000);
+
+	set_int_handler(0);
+	for (i = 0; i < ARRAY_SIZE(bench_candidates); i++) {
+		speed = 0;
+		r = _bench_candidate(device, data_device, params, i, integrity_key, &speed);
+		if (r == -EINTR)
+			break;
+		if (r < 0) {
+			log_std("%-32s N/A\n", _(bench_candidates[i].desc));
+			continue;
+		}
+		log_std("%-32s %8" PRIu64 " KiB/s\n", _(bench_candidates[i].desc), speed);
+		if (speed > best_speed) {
+			best_speed = speed;
+			best = i;
+		}
+	}
+	set_int_block(0);
+
+	if (r == -EINTR)
+		return r;
+	if (!best_speed) {
+		log_err(_("Journal benchmark failed."));
+		return -EINVAL;
+	}
+
+	if (bench_candidates[best].journal_size)
+		params->journal_size = bench_candidates[best].journal_size;
+
+	log_std(_("Formatting with %s.\n"), _(bench_candidates[best].desc));
+	if (bench_candidates[best].bitmap)
+		log_std(_("Activate the device with --integrity-bitmap-mode option.\n"));
+	else if (bench_candidates[best].watermark)
+		log_std(_("Activate the device with --journal-watermark %u option.\n"),
+			bench_candidates[best].watermark);
+
+	return 0;
+}
+
+static int _format_device(const char *device, const char *data_device, bool confirmed)
 {
 	struct crypt_device *cd = NULL;
 	struct crypt_params_integrity params = {
@@ -168,17 +407,18 @@ static int action_format(void)
 	if (r)
 		goto out;
 
-	r = crypt_init_data_device(&cd, action_argv[0], ARG_STR(OPT_DATA_DEVICE_ID));
+	r = crypt_init_data_device(&cd, device, data_device);
 	if (r < 0)
 		goto out;
 
-	if (!ARG_SET(OPT_BATCH_MODE_ID)) {
-		if (ARG_SET(OPT_DATA_DEVICE_ID) && !ARG_SET(OPT_NO_WIPE_ID))
+	if (!ARG_SET(OPT_BATCH_MODE_ID) && !confirmed) {
+		if (data_device && !ARG_SET(OPT_NO_WIPE_ID) &&
+		    !ARG_SET(OPT_INTEGRITY_RECALCULATE_DIRECT_ID))
 			r = asprintf(&msg, _("This will overwrite data on %s and %s irrevocably.\n"
 			"To preserve data device use --no-wipe option (and then activate with --integrity-recalculate)."),
-			action_argv[0], ARG_STR(OPT_DATA_DEVICE_ID));
+			device, data_device);
 		else
-			r = asprintf(&msg, _("This will overwrite data on %s irrevocably."), action_argv[0]);
+			r = asprintf(&msg, _("This will overwrite data on %s irrevocably."), device);
 		if (r == -1) {
 			r = -ENOMEM;
 			goto out;
@@ -190,12 +430,12 @@ static int action_format(void)
 			goto out;
 	}
 
-	r = tools_detect_signatures(action_argv[0], PRB_FILTER_NONE, &signatures, ARG_SET(OPT_BATCH_MODE_ID));
+	r = tools_detect_signatures(device, PRB_FILTER_NONE, &signatures, ARG_SET(OPT_BATCH_MODE_ID));
 	if (r < 0)
 		goto out;
 
 	/* Signature candidates found */
-	if (signatures && ((r = tools_wipe_all_signatures(action_argv[0], true, false)) < 0))
+	if (signatures && ((r = tools_wipe_all_signatures(device, true, false)) < 0))
 		goto out;
 
 	if (ARG_SET(OPT_INTEGRITY_LEGACY_PADDING_ID))
@@ -204,6 +444,9 @@ static int action_format(void)
 	if (ARG_SET(OPT_INTEGRITY_LEGACY_HMAC_ID))
 		crypt_set_compatibility(cd, CRYPT_COMPAT_LEGACY_INTEGRITY_HMAC);
 
+	if (ARG_SET(OPT_JOURNAL_BENCHMARK_ID) && (r = _benchmark_journal(device, data_device, &params, integrity_key)) < 0)
+		goto out;
+
 	r = crypt_format(cd, CRYPT_INTEGRITY, NULL, NULL, NULL, NULL, 0, &params);
 	if (r < 0) /* FIXME: call wipe signatures again */
 		goto out;
@@ -212,7 +455,9 @@ static int action_format(void)
 		log_std(_("Formatted with tag size %u, internal integrity %s.\n"),
 			params2.tag_size, params2.integrity);
 
-	if (!ARG_SET(OPT_NO_WIPE_ID))
+	if (ARG_SET(OPT_INTEGRITY_RECALCULATE_DIRECT_ID))
+		r = _recalculate_data_device(cd, integrity_key);
+	else if (!ARG_SET(OPT_NO_WIPE_ID))
 		r = _wipe_data_device(cd, integrity_key);
 out:
 	crypt_safe_free(integrity_key);
@@ -222,13 +467,149 @@ out:
 	return r;
 }
 
+static int action_format(void)
+{
+	return _format_device(action_argv[0], ARG_STR(OPT_DATA_DEVICE_ID), false);
+}
+
+/*
+ * Metadata placement advisor. Latency is measured by random direct reads only
+ * (nothing is written before the user confirms format); with tags interleaved
+ * on the data device every random write costs two seeks there, with tags on
+ * a separate device one seek plus the metadata device access.
+ */
+#define LAYOUT_SAMPLES		128
+#define LAYOUT_BLOCK_SIZE	4096
+
+static int _layout_latency(const char *device, uint64_t *size, uint64_t *latency_us)
+{
+	uint64_t blocks, total = 0, start, rnd = 0x9e3779b97f4a7c15ULL;
+	void *buf = NULL;
+	off_t end;
+	int fd, i, r = 0;
+
+	fd = open(device, O_RDONLY | O_DIRECT);
+	if (fd < 0)
+		return -EINVAL;
+
+	end = lseek(fd, 0, SEEK_END);
+	if (end < LAYOUT_BLOCK_SIZE) {
+		r = -EINVAL;
+		goto out;
+	}
+	*size = (uint64_t)end;
+	blocks = *size / LAYOUT_BLOCK_SIZE;
+
+	if (posix_memalign(&buf, LAYOUT_BLOCK_SIZE, LAYOUT_BLOCK_SIZE)) {
+		r = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < LAYOUT_SAMPLES && !r; i++) {
+		rnd ^= rnd << 13; rnd ^= rnd >> 7; rnd ^= rnd << 17;
+		start = _bench_us();
+		if (pread(fd, buf, LAYOUT_BLOCK_SIZE, (rnd % blocks) * LAYOUT_BLOCK_SIZE) != LAYOUT_BLOCK_SIZE)
+			r = -EIO;
+		total += _bench_us() - start;
+		check_signal(&r);
+	}
+
+	if (!r)
+		*latency_us = total / LAYOUT_SAMPLES ?: 1;
+out:
+	free(buf);
+	close(fd);
+	return r;
+}
+
+static int action_layout(void)
+{
+	struct crypt_params_integrity params = {
+		.journal_size = ARG_UINT64(OPT_JOURNAL_SIZE_ID),
+		.tag_size = ARG_UINT32(OPT_TAG_SIZE_ID),
+		.sector_size = ARG_UINT32(OPT_SECTOR_SIZE_ID),
+	};
+	char integrity[MAX_CIPHER_LEN], *msg = NULL;
+	uint64_t data_size, data_latency, size, latency, metadata_size, best_latency = 0;
+	const char *best = NULL;
+	int i, r;
+
+	r = crypt_parse_hash_integrity_mode(ARG_STR(OPT_INTEGRITY_ID), integrity);
+	if (r < 0) {
+		log_err(_("No known integrity specification pattern detected."));
+		return r;
+	}
+	params.integrity = integrity;
+
+	set_int_handler(0);
+	r = _layout_latency(action_argv[0], &data_size, &data_latency);
+	if (!r)
+		r = crypt_integrity_metadata_size(&params, data_size, &metadata_size);
+	if (r) {
+		set_int_block(0);
+		log_err(_("Cannot measure data device %s."), action_argv[0]);
+		return r;
+	}
+
+	log_std(_("Data device %s: %" PRIu64 " us random access latency, "
+		  "metadata device needs %" PRIu64 " MiB.\n"),
+		action_argv[0], data_latency, (metadata_size + 1024 * 1024 - 1) / 1024 / 1024);
+
+	for (i = 1; i < action_argc; i++) {
+		r = _layout_latency(action_argv[i], &size, &latency);
+		if (r == -EINTR)
+			break;
+		if (r) {
+			log_std("%-32s N/A\n", action_argv[i]);
+			continue;
+		}
+		log_std(_("%-32s %8" PRIu64 " us, %s\n"), action_argv[i], latency,
+			size >= metadata_size ? _("large enough") : _("too small"));
+		if (size >= metadata_size && latency < data_latency &&
+		    (!best || latency < best_latency)) {
+			best = action_argv[i];
+			best_latency = latency;
+		}
+	}
+	set_int_block(0);
+	if (r == -EINTR)
+		return r;
+
+	if (!best) {
+		log_std(_("Keep integrity tags interleaved on the data device.\n"));
+		return 0;
+	}
+
+	log_std(_("Recommended layout: tags on %s, data on %s, expected random write "
+		  "throughput gain %" PRIu64 ".%02" PRIu64 "x.\n"), best, action_argv[0],
+		200 * data_latency / (data_latency + best_latency) / 100,
+		200 * data_latency / (data_latency + best_latency) % 100);
+
+	if (ARG_SET(OPT_BATCH_MODE_ID)) {
+		log_std(_("Format it with: integritysetup format %s --data-device %s\n"),
+			best, action_argv[0]);
+		return 0;
+	}
+
+	if (asprintf(&msg, _("This will format %s with integrity tags on %s and overwrite data "
+			     "on both devices irrevocably."), action_argv[0], best) == -1)
+		return -ENOMEM;
+	r = yesDialog(msg, _("Operation aborted.\n")) ? 0 : -EINVAL;
+	free(msg);
+	if (r < 0)
+		return r;
+
+	return _format_device(best, action_argv[0], true);
+}
+
 static int action_resize(void)
 {
 	int r;
 	struct crypt_device *cd = NULL;
 	struct crypt_active_device cad;
 	uint64_t new_dev_size = 0;
-	uint64_t old_dev_size;
+	uint64_t old_dev_size, wipe_size;
+	uint32_t old_flags;
 	char path[PATH_MAX];
 	char *backing_file = NULL;
 	struct tools_progress_params prog_parms = {
@@ -252,6 +633,7 @@ static int action_resize(void)
 	if (r)
 		goto out;
 	old_dev_size = cad.size;
+	old_flags = cad.flags;
 
 	r = snprintf(path, sizeof(path), "%s/%s", crypt_get_dir(), action_argv[0]);
 	if (r < 0)
@@ -268,7 +650,7 @@ static int action_resize(void)
 	}
 
 	if (new_dev_size > old_dev_size) {
-		if (ARG_SET(OPT_WIPE_ID)) {
+		if (ARG_SET(OPT_WIPE_ID) || ARG_SET(OPT_WIPE_DIRECT_ID)) {
 			if (ARG_SET(OPT_BATCH_MODE_ID))
 				log_dbg("Wiping the end of the resized device");
 			else
@@ -276,10 +658,25 @@ static int action_resize(void)
 					"You can interrupt this by pressing CTRL+c "
 					"(rest of not wiped device will contain invalid checksum).\n"));
 
+			wipe_size = new_dev_size - old_dev_size;
+			tools_wipe_set_queue_depth(cd);
 			set_int_handler(0);
-			r = crypt_wipe(cd, path, CRYPT_WIPE_ZERO, old_dev_size * SECTOR_SIZE,
-				      (new_dev_size - old_dev_size) * SECTOR_SIZE, DEFAULT_WIPE_BLOCK,
-				      0, &tools_progress, &prog_parms);
+			/* kernel recalculation would race with direct writes */
+			if (ARG_SET(OPT_WIPE_DIRECT_ID) && !(old_flags & CRYPT_ACTIVATE_RECALCULATE)) {
+				r = crypt_wipe_integrity_tags_range(cd, old_dev_size, wipe_size, &wipe_size,
+								    DEFAULT_WIPE_BLOCK, &tools_progress, &prog_parms);
+				if (r == -ENOTSUP) {
+					log_verbose(_("Integrity tags cannot be initialized directly, wiping through the device."));
+					wipe_size = new_dev_size - old_dev_size;
+					r = 0;
+				}
+			}
+
+			/* the part sharing metadata buffers with the old area goes through the device */
+			if (!r && wipe_size)
+				r = crypt_wipe(cd, path, CRYPT_WIPE_ZERO, old_dev_size * SECTOR_SIZE,
+					       wipe_size * SECTOR_SIZE, DEFAULT_WIPE_BLOCK,
+					       0, &tools_progress, &prog_parms);
 			set_int_block(0);
 		} else {
 			log_dbg("Setting recalculate flag");
@@ -524,6 +921,70 @@ static int action_dump(void)
 	return r;
 }
 
+static int _verify_mismatch(uint64_t sector, uint64_t count, void *usrptr __attribute__((unused)))
+{
+	log_std(_("Integrity tag mismatch at sector %" PRIu64 ", %" PRIu64 " sectors.\n"),
+		sector, count);
+	return 0;
+}
+
+static int action_verify(void)
+{
+	struct crypt_device *cd = NULL;
+	struct crypt_params_integrity params = {};
+	char integrity[MAX_CIPHER_LEN];
+	char *integrity_key = NULL, *backing_file = NULL;
+	uint64_t mismatched = 0;
+	int r;
+	struct tools_progress_params prog_parms = {
+		.frequency = ARG_UINT32(OPT_PROGRESS_FREQUENCY_ID),
+		.batch_mode = ARG_SET(OPT_BATCH_MODE_ID),
+		.json_output = ARG_SET(OPT_PROGRESS_JSON_ID),
+		.interrupt_message = _("\nVerification interrupted."),
+	};
+
+	r = crypt_parse_hash_integrity_mode(ARG_STR(OPT_INTEGRITY_ID), integrity);
+	if (r < 0) {
+		log_err(_("No known integrity specification pattern detected."));
+		return r;
+	}
+	params.integrity = integrity;
+
+	r = _read_keys(&integrity_key, &params);
+	if (r)
+		goto out;
+
+	if ((r = crypt_init_data_device(&cd, action_argv[0], ARG_STR(OPT_DATA_DEVICE_ID))))
+		goto out;
+
+	r = crypt_load(cd, CRYPT_INTEGRITY, &params);
+	if (r) {
+		log_err(_("Device %s is not a valid INTEGRITY device."), action_argv[0]);
+		goto out;
+	}
+
+	prog_parms.device = tools_get_device_name(crypt_get_device_name(cd), &backing_file);
+
+	set_int_handler(0);
+	r = crypt_verify_integrity_tags(cd, integrity_key, ARG_UINT32(OPT_INTEGRITY_KEY_SIZE_ID),
+					&_verify_mismatch, &tools_progress, &prog_parms, &mismatched);
+	set_int_block(0);
+	if (r == -ENOTSUP)
+		log_err(_("Integrity checksum cannot be calculated in userspace."));
+	else if (!r && mismatched) {
+		log_err(_("Found %" PRIu64 " sectors with invalid integrity checksum."), mismatched);
+		r = -EPERM;
+	} else if (!r)
+		log_verbose(_("All integrity checksums are valid."));
+out:
+	free(backing_file);
+	crypt_safe_free(integrity_key);
+	crypt_safe_free(CONST_CAST(void*)params.journal_integrity_key);
+	crypt_safe_free(CONST_CAST(void*)params.journal_crypt_key);
+	crypt_free(cd);
+	return r;
+}
+
 static struct action_type {
 	const char *type;
 	int (*handler)(void);
@@ -537,6 +998,8 @@ static struct action_type {
 	{ STATUS_ACTION,action_status, 1, N_("<name>"),N_("show active device status") },
 	{ DUMP_ACTION,	action_dump,   1, N_("<integrity_device>"),N_("show on-disk information") },
 	{ RESIZE_ACTION,action_resize, 1, N_("<name>"), N_("resize active device") },
+	{ VERIFY_ACTION,action_verify, 1, N_("<integrity_device>"),N_("verify integrity tags of inactive device") },
+	{ LAYOUT_ACTION,action_layout, 1, N_("<data_device> [<metadata_device>...]"),N_("advise placement of integrity tags") },
 	{}
 };
 
@@ -750,6 +1213,24 @@ int main(int argc, const char **argv)
 		usage(popt_context, EXIT_FAILURE, _("Bitmap options can be used only in bitmap mode."),
 		      poptGetInvocationName(popt_context));
 
+	if (ARG_SET(OPT_INTEGRITY_RECALCULATE_DIRECT_ID) && ARG_SET(OPT_WIPE_DIRECT_ID))
+		usage(popt_context, EXIT_FAILURE,
+		      _("Options --integrity-recalculate-direct and --wipe-direct cannot be used at the same time."),
+		      poptGetInvocationName(popt_context));
+
+	if (ARG_SET(OPT_JOURNAL_BENCHMARK_ID) &&
+	    (ARG_SET(OPT_NO_WIPE_ID) || ARG_SET(OPT_INTEGRITY_RECALCULATE_DIRECT_ID) ||
+	     ARG_SET(OPT_INTEGRITY_BITMAP_MODE_ID) || ARG_SET(OPT_INTEGRITY_NO_JOURNAL_ID)))
+		usage(popt_context, EXIT_FAILURE,
+		      _("Option --journal-benchmark overwrites data and cannot be combined with --no-wipe, "
+			"--integrity-recalculate-direct or journal mode options."),
+		      poptGetInvocationName(popt_context));
+
+	if (ARG_SET(OPT_WIPE_DIRECT_ID) && ARG_SET(OPT_NO_WIPE_ID))
+		usage(popt_context, EXIT_FAILURE,
+		      _("Options --wipe-direct and --no-wipe cannot be used at the same time."),
+		      poptGetInvocationName(popt_context));
+
 	if (ARG_SET(OPT_CANCEL_DEFERRED_ID) && ARG_SET(OPT_DEFERRED_ID))
 		usage(popt_context, EXIT_FAILURE,
 		      _("Options --cancel-deferred and --deferred cannot be used at the same time."),
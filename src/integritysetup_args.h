@@ -31,19 +31,24 @@
 #define STATUS_ACTION	"status"
 #define DUMP_ACTION	"dump"
 #define RESIZE_ACTION	"resize"
+#define VERIFY_ACTION	"verify"
+#define LAYOUT_ACTION	"layout"
 
 #define OPT_ALLOW_DISCARDS_ACTIONS		{ OPEN_ACTION }
 #define OPT_DEFERRED_ACTIONS			{ CLOSE_ACTION }
 #define OPT_INTEGRITY_RECALCULATE_ACTIONS	{ OPEN_ACTION }
-#define OPT_JOURNAL_SIZE_ACTIONS		{ FORMAT_ACTION }
+#define OPT_INTEGRITY_RECALCULATE_DIRECT_ACTIONS	{ FORMAT_ACTION }
+#define OPT_JOURNAL_BENCHMARK_ACTIONS		{ FORMAT_ACTION }
+#define OPT_JOURNAL_SIZE_ACTIONS		{ FORMAT_ACTION, LAYOUT_ACTION }
 #define OPT_NO_WIPE_ACTIONS			{ FORMAT_ACTION }
 #define OPT_INTERLEAVE_SECTORS_ACTIONS		{ FORMAT_ACTION }
-#define OPT_PROGRESS_JSON_ACTIONS		{ FORMAT_ACTION, RESIZE_ACTION }
-#define OPT_SECTOR_SIZE_ACTIONS			{ FORMAT_ACTION }
-#define OPT_TAG_SIZE_ACTIONS			{ FORMAT_ACTION }
+#define OPT_PROGRESS_JSON_ACTIONS		{ FORMAT_ACTION, RESIZE_ACTION, VERIFY_ACTION }
+#define OPT_SECTOR_SIZE_ACTIONS			{ FORMAT_ACTION, LAYOUT_ACTION }
+#define OPT_TAG_SIZE_ACTIONS			{ FORMAT_ACTION, LAYOUT_ACTION }
 #define OPT_DEVICE_SIZE_ACTIONS			{ RESIZE_ACTION }
 #define OPT_SIZE_ACTIONS			{ RESIZE_ACTION }
 #define OPT_WIPE_ACTIONS			{ RESIZE_ACTION }
+#define OPT_WIPE_DIRECT_ACTIONS			{ FORMAT_ACTION, RESIZE_ACTION }
 
 enum {
 OPT_UNUSED_ID = 0,
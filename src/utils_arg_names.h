@@ -25,7 +25,9 @@
 #define OPT_ACTIVE_NAME			"active-name"
 #define OPT_ALIGN_PAYLOAD		"align-payload"
 #define OPT_ALLOW_DISCARDS		"allow-discards"
+#define OPT_BATCH_FILE			"batch-file"
 #define OPT_BATCH_MODE			"batch-mode"
+#define OPT_BENCHMARK			"benchmark"
 #define OPT_BITMAP_FLUSH_TIME		"bitmap-flush-time"
 #define OPT_BITMAP_SECTORS_PER_BIT	"bitmap-sectors-per-bit"
 #define OPT_BLOCK_SIZE			"block-size"
@@ -40,11 +42,13 @@
 #define OPT_DEBUG_JSON			"debug-json"
 #define OPT_DEFERRED			"deferred"
 #define OPT_DEVICE_SIZE			"device-size"
+#define OPT_DEVICES_FILE		"devices-file"
 #define OPT_DECRYPT			"decrypt"
 #define OPT_DISABLE_EXTERNAL_TOKENS	"disable-external-tokens"
 #define OPT_DISABLE_KEYRING		"disable-keyring"
 #define OPT_DISABLE_LOCKS		"disable-locks"
 #define OPT_DISABLE_VERACRYPT		"disable-veracrypt"
+#define OPT_DM_BENCHMARK		"dm-benchmark"
 #define OPT_DUMP_JSON			"dump-json-metadata"
 #define OPT_DUMP_MASTER_KEY		"dump-master-key"
 #define OPT_DUMP_VOLUME_KEY		"dump-volume-key"
@@ -56,10 +60,14 @@
 #define OPT_FORCE_OFFLINE_REENCRYPT	"force-offline-reencrypt"
 #define OPT_FORMAT			"format"
 #define OPT_HASH			"hash"
+#define OPT_HASH_AREA_ONLY		"hash-area-only"
 #define OPT_HASH_BLOCK_SIZE		"hash-block-size"
 #define OPT_HASH_OFFSET			"hash-offset"
 #define OPT_HEADER			"header"
 #define OPT_HEADER_BACKUP_FILE		"header-backup-file"
+#define OPT_HOLD_KEY			"hold-key"
+#define OPT_HOTZONE_BATCH		"hotzone-batch"
+#define OPT_HOTZONE_LATENCY		"hotzone-latency"
 #define OPT_HOTZONE_SIZE		"hotzone-size"
 #define OPT_IGNORE_CORRUPTION		"ignore-corruption"
 #define OPT_IGNORE_ZERO_BLOCKS		"ignore-zero-blocks"
@@ -75,11 +83,15 @@
 #define OPT_INTEGRITY_NO_WIPE		"integrity-no-wipe"
 #define OPT_INTEGRITY_RECALCULATE	"integrity-recalculate"
 #define OPT_INTEGRITY_RECALCULATE_RESET	"integrity-recalculate-reset"
+#define OPT_INTEGRITY_RECALCULATE_DIRECT	"integrity-recalculate-direct"
 #define OPT_INTEGRITY_RECOVERY_MODE	"integrity-recovery-mode"
 #define OPT_INTERLEAVE_SECTORS		"interleave-sectors"
 #define OPT_ITER_TIME			"iter-time"
+#define OPT_IV_BENCHMARK		"iv-benchmark"
 #define OPT_IV_LARGE_SECTORS		"iv-large-sectors"
+#define OPT_JSON			"json"
 #define OPT_JSON_FILE			"json-file"
+#define OPT_JOURNAL_BENCHMARK		"journal-benchmark"
 #define OPT_JOURNAL_COMMIT_TIME		"journal-commit-time"
 #define OPT_JOURNAL_CRYPT		"journal-crypt"
 #define OPT_JOURNAL_CRYPT_KEY_FILE	"journal-crypt-key-file"
@@ -101,6 +113,7 @@
 #define OPT_NO_SUPERBLOCK		"no-superblock"
 #define OPT_NO_WIPE			"no-wipe"
 #define OPT_WIPE			"wipe"
+#define OPT_WIPE_DIRECT			"wipe-direct"
 #define OPT_LABEL			"label"
 #define OPT_LUKS2_KEYSLOTS_SIZE		"luks2-keyslots-size"
 #define OPT_LUKS2_METADATA_SIZE		"luks2-metadata-size"
@@ -114,22 +127,29 @@
 #define OPT_NEW_TOKEN_ID		"new-token-id"
 #define OPT_OFFSET			"offset"
 #define OPT_PANIC_ON_CORRUPTION		"panic-on-corruption"
+#define OPT_PARALLEL_DEVICES		"parallel-devices"
 #define OPT_PBKDF			"pbkdf"
+#define OPT_PBKDF_CACHE			"pbkdf-cache"
 #define OPT_PBKDF_FORCE_ITERATIONS	"pbkdf-force-iterations"
+#define OPT_PBKDF_MATRIX		"pbkdf-matrix"
 #define OPT_PBKDF_MEMORY		"pbkdf-memory"
 #define OPT_PBKDF_PARALLEL		"pbkdf-parallel"
+#define OPT_PERF_AUTO			"perf-auto"
 #define OPT_PERF_NO_READ_WORKQUEUE	"perf-no_read_workqueue"
 #define OPT_PERF_NO_WRITE_WORKQUEUE	"perf-no_write_workqueue"
 #define OPT_PERF_SAME_CPU_CRYPT		"perf-same_cpu_crypt"
 #define OPT_PERF_SUBMIT_FROM_CRYPT_CPUS	"perf-submit_from_crypt_cpus"
 #define OPT_PERSISTENT			"persistent"
 #define OPT_PLUGIN			"plugin"
+#define OPT_PREFETCH_HASH		"prefetch-hash"
 #define OPT_PRIORITY			"priority"
 #define OPT_PROGRESS_JSON		"progress-json"
 #define OPT_PROGRESS_FREQUENCY		"progress-frequency"
 #define OPT_READONLY			"readonly"
+#define OPT_RECOVERY_KEYS_FILE		"recovery-keys-file"
 #define OPT_REDUCE_DEVICE_SIZE		"reduce-device-size"
 #define OPT_REFRESH			"refresh"
+#define OPT_REPORT_CORRUPTED		"report-corrupted"
 #define OPT_RESILIENCE			"resilience"
 #define OPT_RESILIENCE_HASH		"resilience-hash"
 #define OPT_RESTART_ON_CORRUPTION	"restart-on-corruption"
@@ -138,10 +158,18 @@
 #define OPT_ROOT_HASH_SIGNATURE		"root-hash-signature"
 #define OPT_SALT			"salt"
 #define OPT_SECTOR_SIZE			"sector-size"
+#define OPT_SECTOR_SIZE_BENCHMARK	"sector-size-benchmark"
 #define OPT_SERIALIZE_MEMORY_HARD_PBKDF	"serialize-memory-hard-pbkdf"
 #define OPT_SHARED			"shared"
+#define OPT_SIGNATURE_CACHE		"signature-cache"
 #define OPT_SIZE			"size"
 #define OPT_SKIP			"skip"
+#define OPT_SPARSE			"sparse"
+#define OPT_SPARSE_DISCARD		"sparse-discard"
+#define OPT_SPARSE_UNUSED		"sparse-unused"
+#define OPT_STATS			"stats"
+#define OPT_STATS_FORMAT		"stats-format"
+#define OPT_STATS_INTERVAL		"stats-interval"
 #define OPT_SUBSYSTEM			"subsystem"
 #define OPT_TAG_SIZE			"tag-size"
 #define OPT_TCRYPT_BACKUP		"tcrypt-backup"
@@ -149,7 +177,13 @@
 #define OPT_TCRYPT_SYSTEM		"tcrypt-system"
 #define OPT_TEST_ARGS			"test-args"
 #define OPT_TEST_PASSPHRASE		"test-passphrase"
+#define OPT_THREADS			"threads"
+#define OPT_THROTTLE_IN_FLIGHT		"throttle-in-flight"
+#define OPT_THROTTLE_IOPS		"throttle-iops"
+#define OPT_THROTTLE_LATENCY		"throttle-latency"
+#define OPT_THROTTLE_RATE		"throttle-rate"
 #define OPT_TIMEOUT			"timeout"
+#define OPT_TIMING			"timing"
 #define OPT_TOKEN_ID			"token-id"
 #define OPT_TOKEN_ONLY			"token-only"
 #define OPT_TOKEN_REPLACE		"token-replace"
@@ -167,6 +201,7 @@
 #define OPT_VERACRYPT_PIM		"veracrypt-pim"
 #define OPT_VERACRYPT_QUERY_PIM		"veracrypt-query-pim"
 #define OPT_VERBOSE			"verbose"
+#define OPT_VERIFY_CACHE		"verify-cache"
 #define OPT_VERIFY_PASSPHRASE		"verify-passphrase"
 #define OPT_WRITE_LOG			"write-log"
 
@@ -21,6 +21,7 @@
 
 #include "cryptsetup.h"
 #include <dirent.h>
+#include <pthread.h>
 #ifdef HAVE_SYS_SYSMACROS_H
 # include <sys/sysmacros.h>     /* for major, minor */
 #endif
@@ -258,6 +259,159 @@ out:
 	return r;
 }
 
+#define PROBE_BATCH_THREADS 16
+
+struct probe_signature {
+	bool partition;
+	char *type;
+};
+
+struct probe_device {
+	const char *device;
+	struct probe_signature *signatures;
+	size_t count;
+	int r;
+};
+
+struct probe_batch {
+	pthread_mutex_t lock;
+	struct probe_device *devices;
+	size_t count;
+	size_t next;
+};
+
+static int probe_device_add(struct probe_device *pd, bool partition, const char *type)
+{
+	struct probe_signature *tmp;
+
+	if (!(tmp = realloc(pd->signatures, (pd->count + 1) * sizeof(*tmp))))
+		return -ENOMEM;
+	pd->signatures = tmp;
+
+	if (!(tmp[pd->count].type = strdup(type ?: "")))
+		return -ENOMEM;
+	tmp[pd->count++].partition = partition;
+
+	return 0;
+}
+
+/* No logging here, results are reported in device order by caller. */
+static void probe_device(struct probe_device *pd)
+{
+	struct blkid_handle *h;
+	blk_probe_status pr;
+	int r;
+
+	if (blk_init_by_path(&h, pd->device)) {
+		pd->r = -ENODEV;
+		return;
+	}
+
+	blk_set_chains_for_fast_detection(h);
+
+	r = 0;
+	while (!r && (pr = blk_probe(h)) < PRB_EMPTY) {
+		if (blk_is_partition(h))
+			r = probe_device_add(pd, true, blk_get_partition_type(h));
+		else if (blk_is_superblock(h))
+			r = probe_device_add(pd, false, blk_get_superblock_type(h));
+		else
+			r = -EINVAL;
+	}
+
+	if (!r && pr == PRB_FAIL)
+		r = -EINVAL;
+
+	pd->r = r;
+	blk_free(h);
+}
+
+static void *probe_batch_thread(void *arg)
+{
+	struct probe_batch *pb = arg;
+	size_t i;
+
+	while (1) {
+		pthread_mutex_lock(&pb->lock);
+		i = pb->next++;
+		pthread_mutex_unlock(&pb->lock);
+
+		if (i >= pb->count)
+			break;
+
+		probe_device(&pb->devices[i]);
+	}
+
+	return NULL;
+}
+
+/*
+ * Probe signatures of all devices in parallel (blkid probes are independent),
+ * using only fast detection chains (type of partition table and superblocks).
+ * All signatures are reported before return, @signatures gets count per device.
+ */
+int tools_detect_signatures_batch(const char * const *devices, size_t count,
+				  size_t *signatures, bool batch_mode)
+{
+	struct probe_batch pb = { .count = count };
+	pthread_t threads[PROBE_BATCH_THREADS];
+	size_t i, j, threads_count = 0;
+	int r = 0;
+
+	for (i = 0; i < count; i++)
+		signatures[i] = 0;
+
+	if (!blk_supported()) {
+		log_dbg("Blkid support disabled.");
+		return 0;
+	}
+
+	if (!(pb.devices = calloc(count, sizeof(*pb.devices))))
+		return -ENOMEM;
+
+	for (i = 0; i < count; i++)
+		pb.devices[i].device = devices[i];
+
+	if (pthread_mutex_init(&pb.lock, NULL)) {
+		free(pb.devices);
+		return -EINVAL;
+	}
+
+	while (threads_count < PROBE_BATCH_THREADS && threads_count < count &&
+	       !pthread_create(&threads[threads_count], NULL, probe_batch_thread, &pb))
+		threads_count++;
+
+	/* no thread could be started, probe in this one */
+	if (!threads_count)
+		probe_batch_thread(&pb);
+
+	for (i = 0; i < threads_count; i++)
+		pthread_join(threads[i], NULL);
+	pthread_mutex_destroy(&pb.lock);
+
+	log_dbg("Probed signatures of %zu devices in %zu threads.", count, threads_count);
+
+	for (i = 0; i < count; i++) {
+		if (pb.devices[i].r < 0 && !r) {
+			log_err(_("Failed to probe device %s for signatures."), devices[i]);
+			r = pb.devices[i].r;
+		}
+
+		for (j = 0; j < pb.devices[i].count; j++) {
+			if (pb.devices[i].signatures[j].partition)
+				report_partition(pb.devices[i].signatures[j].type, devices[i], batch_mode);
+			else
+				report_superblock(pb.devices[i].signatures[j].type, devices[i], batch_mode);
+			free(pb.devices[i].signatures[j].type);
+		}
+		free(pb.devices[i].signatures);
+		signatures[i] = pb.devices[i].count;
+	}
+
+	free(pb.devices);
+	return r;
+}
+
 int tools_wipe_all_signatures(const char *path, bool exclusive, bool only_luks)
 {
 	int fd, flags, r;
@@ -380,3 +534,91 @@ bool tools_blkid_supported(void)
 {
 	return blk_supported() != 0;
 }
+
+static int sysfs_read_devno(const char *path, dev_t *devno)
+{
+	char buf[32] = {0};
+	unsigned maj, min;
+	int fd, r;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	r = read(fd, buf, sizeof(buf) - 1);
+	close(fd);
+
+	if (r <= 0 || sscanf(buf, "%u:%u", &maj, &min) != 2)
+		return -EINVAL;
+
+	*devno = makedev(maj, min);
+	return 0;
+}
+
+/* Walk device stack in sysfs (partitions, dm and md slaves) down to physical disks. */
+static void add_disks(dev_t devno, dev_t *disks, size_t max, size_t *count, int depth)
+{
+	char path[PATH_MAX], slave[PATH_MAX];
+	struct dirent *entry;
+	struct stat st;
+	dev_t dev;
+	bool leaf = true;
+	size_t i;
+	DIR *dir;
+
+	if (depth > 16)
+		return;
+
+	/* partition belongs to parent disk */
+	if (snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/partition", major(devno), minor(devno)) > 0 &&
+	    !stat(path, &st) &&
+	    snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/../dev", major(devno), minor(devno)) > 0 &&
+	    !sysfs_read_devno(path, &dev)) {
+		add_disks(dev, disks, max, count, depth + 1);
+		return;
+	}
+
+	if (snprintf(path, sizeof(path), "/sys/dev/block/%u:%u/slaves", major(devno), minor(devno)) > 0 &&
+	    (dir = opendir(path))) {
+		while ((entry = readdir(dir))) {
+			if (entry->d_name[0] == '.')
+				continue;
+			if (snprintf(slave, sizeof(slave), "%s/%s/dev", path, entry->d_name) > 0 &&
+			    !sysfs_read_devno(slave, &dev)) {
+				leaf = false;
+				add_disks(dev, disks, max, count, depth + 1);
+			}
+		}
+		closedir(dir);
+	}
+
+	if (!leaf)
+		return;
+
+	for (i = 0; i < *count; i++)
+		if (disks[i] == devno)
+			return;
+	if (*count < max)
+		disks[(*count)++] = devno;
+}
+
+/*
+ * Get physical disks under device (for a file, the device holding its filesystem).
+ */
+int tools_device_disks(const char *device, dev_t *disks, size_t max, size_t *count)
+{
+	struct stat st;
+
+	*count = 0;
+
+	if (stat(device, &st) < 0)
+		return -errno;
+
+	if (S_ISBLK(st.st_mode))
+		add_disks(st.st_rdev, disks, max, count, 0);
+	else if (S_ISREG(st.st_mode))
+		add_disks(st.st_dev, disks, max, count, 0);
+	else
+		return -EINVAL;
+
+	return *count ? 0 : -ENOENT;
+}
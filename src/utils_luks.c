@@ -115,6 +115,7 @@ int set_pbkdf_params(struct crypt_device *cd, const char *dev_type)
 {
 	const struct crypt_pbkdf_type *pbkdf_default;
 	struct crypt_pbkdf_type pbkdf = {};
+	int r;
 
 	pbkdf_default = crypt_get_pbkdf_default(dev_type);
 	if (!pbkdf_default)
@@ -134,6 +135,12 @@ int set_pbkdf_params(struct crypt_device *cd, const char *dev_type)
 		pbkdf.flags |= CRYPT_PBKDF_NO_BENCHMARK;
 	}
 
+	if (ARG_SET(OPT_PBKDF_CACHE_ID)) {
+		r = crypt_set_pbkdf_cache(cd, ARG_STR(OPT_PBKDF_CACHE_ID));
+		if (r < 0)
+			return r;
+	}
+
 	return crypt_set_pbkdf_type(cd, &pbkdf);
 }
 
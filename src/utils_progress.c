@@ -182,6 +182,23 @@ static bool calculate_tdiff(bool final, uint64_t bytes, struct tools_progress_pa
 	return true;
 }
 
+/*
+ * Prefer the moving average rate tracked by libcryptsetup, the average
+ * from the start reacts slowly to throughput changes (e.g. device cache).
+ * The final summary always uses the average.
+ */
+static bool smoothed_rate(bool final, struct tools_progress_params *parms, double *uib, uint64_t *eta_ms)
+{
+	struct crypt_progress_info info;
+
+	if (final || !parms->cd || crypt_get_progress_info(parms->cd, &info) || !info.rate)
+		return false;
+
+	*uib = (double)info.rate;
+	*eta_ms = info.eta_ms;
+	return true;
+}
+
 static void tools_time_progress(uint64_t device_size, uint64_t bytes, struct tools_progress_params *parms)
 {
 	uint64_t eta;
@@ -197,9 +214,12 @@ static void tools_time_progress(uint64_t device_size, uint64_t bytes, struct too
 	else
 		eol = "";
 
-	uib = (double)(bytes - parms->start_offset) / tdiff;
-
-	eta = (uint64_t)((device_size / uib - tdiff) * 1E6);
+	if (smoothed_rate(final, parms, &uib, &eta))
+		eta *= 1000;
+	else {
+		uib = (double)(bytes - parms->start_offset) / tdiff;
+		eta = (uint64_t)((device_size / uib - tdiff) * 1E6);
+	}
 
 	if (uib > 1073741824.0f) {
 		uib /= 1073741824.0f;
@@ -246,18 +266,22 @@ static void log_progress_json(const char *device, uint64_t bytes, uint64_t devic
 
 static void tools_time_progress_json(uint64_t device_size, uint64_t bytes, struct tools_progress_params *parms)
 {
+	uint64_t eta;
 	double tdiff, uib;
 	bool final = (bytes == device_size);
 
 	if (!calculate_tdiff(final, bytes, parms, &tdiff))
 		return;
 
-	uib = (double)(bytes - parms->start_offset) / tdiff;
+	if (!smoothed_rate(final, parms, &uib, &eta)) {
+		uib = (double)(bytes - parms->start_offset) / tdiff;
+		eta = final ? UINT64_C(0) : (uint64_t)((device_size / uib - tdiff) * 1E3);
+	}
 
 	log_progress_json(parms->device,
 			  bytes,
 			  device_size,
-			  final ? UINT64_C(0) : (uint64_t)((device_size / uib - tdiff) * 1E3),
+			  eta,
 			  (uint64_t)uib,
 			  (uint64_t)(tdiff * 1E3));
 
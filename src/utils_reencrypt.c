@@ -21,6 +21,7 @@
  */
 
 #include <uuid/uuid.h>
+#include <sys/wait.h>
 
 #include "cryptsetup.h"
 #include "cryptsetup_args.h"
@@ -30,6 +31,9 @@ extern int64_t data_shift;
 extern const char *device_type;
 extern const char *set_pbkdf;
 
+/* set in child process of parallel reencryption */
+static bool parallel_child = false;
+
 enum device_status_info {
 	DEVICE_LUKS2 = 0,	/* LUKS2 device */
 	DEVICE_LUKS2_REENCRYPT,	/* LUKS2 device in reencryption  */
@@ -1296,21 +1300,79 @@ out:
 	return r;
 }
 
+static void reencrypt_stats(const struct crypt_reencrypt_stats *stats, void *usrptr __attribute__((unused)))
+{
+	log_dbg("Hotzone %" PRIu64 " (%" PRIu64 " bytes) took %" PRIu64 " us: read %" PRIu64
+		", protect %" PRIu64 ", transform %" PRIu64 ", write %" PRIu64 ", datasync %" PRIu64
+		", commit %" PRIu64 ", suspend %" PRIu64 ", resume %" PRIu64 ".",
+		stats->offset, stats->length, stats->total_us, stats->read_us,
+		stats->protect_us, stats->transform_us, stats->write_us, stats->datasync_us,
+		stats->commit_us, stats->suspend_us, stats->resume_us);
+}
+
 static int reencrypt_luks2_resume(struct crypt_device *cd)
 {
 	int r;
 	char *backing_file = NULL;
 	struct tools_progress_params prog_parms = {
 		.frequency = ARG_UINT32(OPT_PROGRESS_FREQUENCY_ID),
-		.batch_mode = ARG_SET(OPT_BATCH_MODE_ID),
+		.batch_mode = ARG_SET(OPT_BATCH_MODE_ID) || parallel_child,
 		.json_output = ARG_SET(OPT_PROGRESS_JSON_ID),
 		.interrupt_message = _("\nReencryption interrupted."),
-		.device = tools_get_device_name(crypt_get_device_name(cd), &backing_file)
+		.device = tools_get_device_name(crypt_get_device_name(cd), &backing_file),
+		.cd = cd
 	};
 
+	(void)crypt_set_progress_interval(cd, 0, prog_parms.frequency ? prog_parms.frequency * 1000 : 500);
+
 	if (ARG_SET(OPT_FORCE_OFFLINE_REENCRYPT_ID) && !ARG_SET(OPT_BATCH_MODE_ID))
 		log_std(_("Resuming LUKS reencryption in forced offline mode.\n"));
 
+	if (ARG_SET(OPT_DEBUG_ID))
+		(void)crypt_reencrypt_set_stats_callback(cd, reencrypt_stats, NULL);
+
+	if (ARG_SET(OPT_SPARSE_ID) || ARG_SET(OPT_SPARSE_DISCARD_ID) || ARG_SET(OPT_SPARSE_UNUSED_ID)) {
+		r = crypt_reencrypt_set_sparse(cd, CRYPT_REENCRYPT_SPARSE_SKIP |
+			(ARG_SET(OPT_SPARSE_DISCARD_ID) ? CRYPT_REENCRYPT_SPARSE_DISCARD : 0) |
+			(ARG_SET(OPT_SPARSE_UNUSED_ID) ? CRYPT_REENCRYPT_SPARSE_UNUSED : 0));
+		if (r) {
+			free(backing_file);
+			return r;
+		}
+	}
+
+	if (ARG_SET(OPT_HOTZONE_BATCH_ID)) {
+		r = crypt_reencrypt_set_hotzone_batch(cd, ARG_UINT32(OPT_HOTZONE_BATCH_ID));
+		if (r) {
+			free(backing_file);
+			return r;
+		}
+	}
+
+	if (ARG_SET(OPT_HOTZONE_LATENCY_ID)) {
+		r = crypt_reencrypt_set_hotzone_latency(cd, ARG_UINT32(OPT_HOTZONE_LATENCY_ID));
+		if (r) {
+			free(backing_file);
+			return r;
+		}
+	}
+
+	if (ARG_SET(OPT_THROTTLE_RATE_ID) || ARG_SET(OPT_THROTTLE_IOPS_ID) ||
+	    ARG_SET(OPT_THROTTLE_LATENCY_ID) || ARG_SET(OPT_THROTTLE_IN_FLIGHT_ID)) {
+		struct crypt_params_reencrypt_throttle throttle = {
+			.max_rate = ARG_UINT64(OPT_THROTTLE_RATE_ID),
+			.max_iops = ARG_UINT32(OPT_THROTTLE_IOPS_ID),
+			.max_latency_ms = ARG_UINT32(OPT_THROTTLE_LATENCY_ID),
+			.max_in_flight = ARG_UINT32(OPT_THROTTLE_IN_FLIGHT_ID)
+		};
+
+		r = crypt_reencrypt_set_throttle(cd, &throttle);
+		if (r) {
+			free(backing_file);
+			return r;
+		}
+	}
+
 	set_int_handler(0);
 	r = crypt_reencrypt_run(cd, tools_progress, &prog_parms);
 	free(backing_file);
@@ -1471,6 +1533,112 @@ static int _decrypt(struct crypt_device **cd, enum device_status_info dev_st, co
 	return r;
 }
 
+/* Amount of data measured by reencryption benchmark */
+#define REENCRYPT_BENCHMARK_SAMPLE	(UINT64_C(1) << 30)
+
+static void reencrypt_benchmark_phase(const char *phase, uint64_t us,
+				      const struct crypt_reencrypt_benchmark *b)
+{
+	double projected = b->sample.length ? (double)us * b->data_size / b->sample.length : 0;
+
+	log_std("%-10s %12.1f %14.1f\n", phase, us / 1E3, projected / 1E6);
+}
+
+static int reencrypt_luks2_benchmark(struct crypt_device *cd, const char *data_device)
+{
+	int r, key_size = 0;
+	uint32_t flags = 0;
+	size_t passwordLen;
+	char cipher[MAX_CIPHER_LEN] = {}, mode[MAX_CIPHER_LEN] = {}, *password = NULL, *active_name = NULL;
+	struct crypt_reencrypt_benchmark b = {};
+	struct crypt_params_luks2 luks2_params = {};
+	struct crypt_params_reencrypt params = {
+		.mode = ARG_SET(OPT_DECRYPT_ID) ? CRYPT_REENCRYPT_DECRYPT : CRYPT_REENCRYPT_REENCRYPT,
+		.direction = data_shift < 0 ? CRYPT_REENCRYPT_BACKWARD : CRYPT_REENCRYPT_FORWARD,
+		.resilience = data_shift ? "datashift" : (ARG_STR(OPT_RESILIENCE_ID) ?: "checksum"),
+		.hash = ARG_STR(OPT_RESILIENCE_HASH_ID) ?: "sha256",
+		.data_shift = imaxabs(data_shift) / SECTOR_SIZE,
+		.max_hotzone_size = ARG_UINT64(OPT_HOTZONE_SIZE_ID) / SECTOR_SIZE,
+		.device_size = ARG_UINT64(OPT_DEVICE_SIZE_ID) / SECTOR_SIZE,
+		.luks2 = &luks2_params,
+	};
+
+	if (ARG_SET(OPT_ENCRYPT_ID)) {
+		log_err(_("Reencryption benchmark is not supported for encryption."));
+		return -ENOTSUP;
+	}
+
+	if (params.mode == CRYPT_REENCRYPT_DECRYPT) {
+		r = decrypt_verify_and_set_params(&params);
+		if (r)
+			return r;
+	} else {
+		if (ARG_SET(OPT_CIPHER_ID)) {
+			if ((r = crypt_parse_name_and_mode(ARG_STR(OPT_CIPHER_ID), cipher, NULL, mode))) {
+				log_err(_("No known cipher specification pattern detected."));
+				return r;
+			}
+			key_size = get_adjusted_key_size(mode, DEFAULT_LUKS1_KEYBITS, 0);
+		} else {
+			strncpy(cipher, crypt_get_cipher(cd), MAX_CIPHER_LEN - 1);
+			strncpy(mode, crypt_get_cipher_mode(cd), MAX_CIPHER_LEN - 1);
+			key_size = ARG_SET(OPT_KEY_SIZE_ID) ? get_adjusted_key_size(mode, DEFAULT_LUKS1_KEYBITS, 0) :
+				   crypt_get_volume_key_size(cd);
+		}
+		if (!key_size)
+			return -EINVAL;
+		luks2_params.sector_size = ARG_UINT32(OPT_SECTOR_SIZE_ID) ?: (uint32_t)crypt_get_sector_size(cd);
+	}
+
+	/* rewriting unchanged data is safe only if nothing else uses the device */
+	if (ARG_SET(OPT_ACTIVE_NAME_ID))
+		r = 1;
+	else if (ARG_SET(OPT_FORCE_OFFLINE_REENCRYPT_ID))
+		r = 0;
+	else
+		r = tools_lookup_crypt_device(cd, crypt_get_type(cd), data_device, &active_name);
+	if (!r)
+		flags |= CRYPT_REENCRYPT_BENCHMARK_WRITE;
+
+	r = tools_get_key(NULL, &password, &passwordLen,
+			ARG_UINT64(OPT_KEYFILE_OFFSET_ID), ARG_UINT32(OPT_KEYFILE_SIZE_ID),
+			ARG_STR(OPT_KEY_FILE_ID), ARG_UINT32(OPT_TIMEOUT_ID),
+			verify_passphrase(0), 0, cd);
+	if (r < 0)
+		goto out;
+
+	r = crypt_reencrypt_benchmark(cd, password, passwordLen, ARG_INT32(OPT_KEY_SLOT_ID),
+				      cipher, mode, key_size, &params,
+				      REENCRYPT_BENCHMARK_SAMPLE, flags, &b);
+	check_signal(&r);
+	tools_passphrase_msg(r);
+	if (r == -EBUSY)
+		log_err(_("Device %s is in use, writes cannot be measured."), data_device ?: ARG_STR(OPT_ACTIVE_NAME_ID));
+	if (r < 0)
+		goto out;
+
+	log_std(_("Data size %" PRIu64 " MiB, %" PRIu64 " hotzones of %" PRIu64 " KiB, "
+		  "sampled %" PRIu64 " MiB.\n"), b.data_size >> 20, b.hotzones,
+		b.hotzone_size >> 10, b.sample.length >> 20);
+	log_std(_("%-10s %12s %14s\n"), _("# Phase"), _("Sample [ms]"), _("Projected [s]"));
+	reencrypt_benchmark_phase(_("read"), b.sample.read_us, &b);
+	reencrypt_benchmark_phase(_("protect"), b.sample.protect_us, &b);
+	reencrypt_benchmark_phase(_("transform"), b.sample.transform_us, &b);
+	if (flags & CRYPT_REENCRYPT_BENCHMARK_WRITE) {
+		reencrypt_benchmark_phase(_("write"), b.sample.write_us, &b);
+		reencrypt_benchmark_phase(_("datasync"), b.sample.datasync_us, &b);
+	}
+	reencrypt_benchmark_phase(_("total"), b.sample.total_us, &b);
+
+	if (!(flags & CRYPT_REENCRYPT_BENCHMARK_WRITE))
+		log_std(_("Device is active or its holders cannot be detected, writes were not measured.\n"));
+	log_std(_("Metadata commits and dm-crypt encryption of written data are not included.\n"));
+out:
+	free(active_name);
+	crypt_safe_free(password);
+	return r;
+}
+
 static int _reencrypt(struct crypt_device *cd, enum device_status_info dev_st, const char *data_device)
 {
 	int r;
@@ -1490,7 +1658,7 @@ static int _reencrypt(struct crypt_device *cd, enum device_status_info dev_st, c
 	return reencrypt_luks2_resume(cd);
 }
 
-int reencrypt(int action_argc, const char **action_argv)
+static int reencrypt_device(int action_argc, const char **action_argv)
 {
 	enum device_status_info dev_st;
 	int r = -EINVAL;
@@ -1547,7 +1715,13 @@ int reencrypt(int action_argc, const char **action_argv)
 		goto out;
 	}
 
-	if (ARG_SET(OPT_ENCRYPT_ID))
+	if (ARG_SET(OPT_BENCHMARK_ID)) {
+		if (dev_st != DEVICE_LUKS2) {
+			log_err(_("Reencryption benchmark requires LUKS2 device without reencryption in progress."));
+			r = -EINVAL;
+		} else
+			r = reencrypt_luks2_benchmark(cd, action_argv[0]);
+	} else if (ARG_SET(OPT_ENCRYPT_ID))
 		r = _encrypt(cd, type, dev_st, action_argc, action_argv);
 	else if (ARG_SET(OPT_DECRYPT_ID))
 		r = _decrypt(&cd, dev_st, action_argv[0]);
@@ -1558,3 +1732,155 @@ out:
 	crypt_free(cd);
 	return r;
 }
+
+#define PARALLEL_MAX_DISKS 32
+
+struct reencrypt_job {
+	const char *device;
+	dev_t disks[PARALLEL_MAX_DISKS];
+	size_t disks_count;
+	pid_t pid;
+	bool started;
+	bool done;
+};
+
+static bool reencrypt_jobs_conflict(const struct reencrypt_job *a, const struct reencrypt_job *b)
+{
+	size_t i, j;
+
+	for (i = 0; i < a->disks_count; i++)
+		for (j = 0; j < b->disks_count; j++)
+			if (a->disks[i] == b->disks[j])
+				return true;
+	return false;
+}
+
+static bool reencrypt_job_startable(const struct reencrypt_job *jobs, int count, int job)
+{
+	int i;
+
+	for (i = 0; i < count; i++)
+		if (jobs[i].started && !jobs[i].done && reencrypt_jobs_conflict(&jobs[i], &jobs[job]))
+			return false;
+	return true;
+}
+
+static int reencrypt_job_start(struct reencrypt_job *job, unsigned parallel)
+{
+	int r;
+
+	fflush(stdout);
+	fflush(stderr);
+
+	job->pid = fork();
+	if (job->pid < 0)
+		return -errno;
+	if (job->pid) {
+		job->started = true;
+		return 0;
+	}
+
+	/* child, global throttle rate is split between running jobs */
+	parallel_child = true;
+	if (ARG_SET(OPT_THROTTLE_RATE_ID))
+		tool_core_args[OPT_THROTTLE_RATE_ID].u.u64_value = ARG_UINT64(OPT_THROTTLE_RATE_ID) / parallel ?: 1;
+
+	r = reencrypt_device(1, &job->device);
+	exit(r ? EXIT_FAILURE : EXIT_SUCCESS);
+}
+
+/*
+ * Resume reencryption of several devices at once, every device in its own
+ * process. Devices sharing a physical disk never run at the same time.
+ */
+static int reencrypt_parallel(int action_argc, const char **action_argv)
+{
+	struct reencrypt_job *jobs;
+	unsigned parallel = ARG_UINT32(OPT_PARALLEL_DEVICES_ID), running = 0;
+	int i, status, done = 0, failed = 0, r = 0;
+	pid_t pid;
+
+	if (!ARG_SET(OPT_RESUME_ONLY_ID) ||
+	    (!ARG_SET(OPT_KEY_FILE_ID) && !ARG_SET(OPT_TOKEN_ONLY_ID)) ||
+	    (ARG_SET(OPT_KEY_FILE_ID) && tools_is_stdin(ARG_STR(OPT_KEY_FILE_ID)))) {
+		log_err(_("Parallel reencryption requires --resume-only and --key-file (not stdin) or --token-only."));
+		return -EINVAL;
+	}
+
+	if (ARG_SET(OPT_ACTIVE_NAME_ID) || ARG_SET(OPT_HEADER_ID)) {
+		log_err(_("Options --active-name and --header cannot be used with parallel reencryption."));
+		return -EINVAL;
+	}
+
+	if (!parallel)
+		parallel = 1;
+	if (parallel > (unsigned)action_argc)
+		parallel = action_argc;
+
+	jobs = calloc(action_argc, sizeof(*jobs));
+	if (!jobs)
+		return -ENOMEM;
+
+	for (i = 0; i < action_argc; i++) {
+		jobs[i].device = action_argv[i];
+		if (tools_device_disks(action_argv[i], jobs[i].disks, PARALLEL_MAX_DISKS, &jobs[i].disks_count))
+			log_dbg("Cannot get physical disks for device %s.", action_argv[i]);
+		else
+			log_dbg("Device %s uses %zu physical disk(s).", action_argv[i], jobs[i].disks_count);
+	}
+
+	while (done < action_argc) {
+		for (i = 0; i < action_argc && running < parallel && !r && !failed; i++) {
+			if (jobs[i].started || !reencrypt_job_startable(jobs, action_argc, i))
+				continue;
+			r = reencrypt_job_start(&jobs[i], parallel);
+			if (r) {
+				log_err(_("Cannot start reencryption of device %s."), jobs[i].device);
+				break;
+			}
+			log_verbose(_("Reencryption of device %s started.\n"), jobs[i].device);
+			running++;
+		}
+
+		/* no new job is started after failure, just wait for running ones */
+		if (!running)
+			break;
+
+		pid = waitpid(-1, &status, 0);
+		if (pid < 0) {
+			if (errno == EINTR)
+				continue;
+			r = -errno;
+			break;
+		}
+
+		for (i = 0; i < action_argc; i++) {
+			if (jobs[i].pid != pid || !jobs[i].started || jobs[i].done)
+				continue;
+			jobs[i].done = true;
+			running--;
+			done++;
+			if (WIFEXITED(status) && WEXITSTATUS(status) == EXIT_SUCCESS)
+				log_verbose(_("Reencryption of device %s finished.\n"), jobs[i].device);
+			else {
+				log_err(_("Reencryption of device %s failed."), jobs[i].device);
+				failed++;
+			}
+		}
+	}
+
+	free(jobs);
+
+	if (!r && failed)
+		r = -EINVAL;
+
+	return r;
+}
+
+int reencrypt(int action_argc, const char **action_argv)
+{
+	if (ARG_SET(OPT_PARALLEL_DEVICES_ID) && action_argc > 1)
+		return reencrypt_parallel(action_argc, action_argv);
+
+	return reencrypt_device(action_argc, action_argv);
+}
@@ -466,3 +466,17 @@ void tools_package_version(const char *name, bool use_pwlibs)
 		pwquality && use_pwlibs ? "PWQUALITY " : "",
 		passwdqc && use_pwlibs ? "PASSWDQC " : "");
 }
+
+/*
+ * Initialization wipe goes through dm-integrity (or dm-crypt), which can
+ * process writes on several CPUs; use one writer per online CPU.
+ */
+void tools_wipe_set_queue_depth(struct crypt_device *cd)
+{
+	long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+
+	if (cpus > CRYPT_WIPE_QUEUE_DEPTH_MAX)
+		cpus = CRYPT_WIPE_QUEUE_DEPTH_MAX;
+	if (cpus > 1)
+		(void)crypt_set_wipe_queue_depth(cd, (unsigned)cpus);
+}
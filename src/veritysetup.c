@@ -156,6 +156,35 @@ out:
 	return r;
 }
 
+/* Max number of corrupted blocks listed by verify --report-corrupted */
+#define VERITY_REPORT_MAX_BLOCKS 1024
+
+static int _verify_report(struct crypt_device *cd, const char *root_hash, size_t root_hash_size)
+{
+	struct crypt_verity_report report = {
+		.bad_blocks_size = ARG_SET(OPT_REPORT_CORRUPTED_ID) ? VERITY_REPORT_MAX_BLOCKS : 0
+	};
+	uint64_t i;
+	int r;
+
+	if (report.bad_blocks_size &&
+	    !(report.bad_blocks = malloc(report.bad_blocks_size * sizeof(*report.bad_blocks))))
+		return -ENOMEM;
+
+	r = crypt_verity_verify_report(cd, root_hash, root_hash_size,
+				       ARG_SET(OPT_HASH_AREA_ONLY_ID) ? CRYPT_VERITY_VERIFY_HASH_ONLY : 0,
+				       &report);
+
+	for (i = 0; i < report.bad_blocks_count && i < report.bad_blocks_size; i++)
+		log_std(_("Corrupted data block %" PRIu64 ".\n"), report.bad_blocks[i]);
+	if (report.bad_blocks_count > report.bad_blocks_size && report.bad_blocks_size)
+		log_std(_("Listed %zu of %" PRIu64 " corrupted data blocks.\n"),
+			report.bad_blocks_size, report.bad_blocks_count);
+
+	free(report.bad_blocks);
+	return r;
+}
+
 static int _activate(const char *dm_device,
 		      const char *data_device,
 		      const char *hash_device,
@@ -206,6 +235,18 @@ static int _activate(const char *dm_device,
 	if (r < 0)
 		goto out;
 
+	if (ARG_SET(OPT_VERIFY_CACHE_ID)) {
+		r = crypt_verity_set_verify_cache(cd, ARG_STR(OPT_VERIFY_CACHE_ID));
+		if (r < 0)
+			goto out;
+	}
+
+	if (ARG_SET(OPT_SIGNATURE_CACHE_ID)) {
+		r = crypt_verity_set_signature_cache(cd, ARG_UINT32(OPT_SIGNATURE_CACHE_ID));
+		if (r < 0)
+			goto out;
+	}
+
 	hash_size = crypt_get_volume_key_size(cd);
 	hash_size_hex = 2 * hash_size;
 
@@ -257,6 +298,12 @@ static int _activate(const char *dm_device,
 			goto out;
 		}
 	}
+
+	if (!dm_device && (ARG_SET(OPT_REPORT_CORRUPTED_ID) || ARG_SET(OPT_HASH_AREA_ONLY_ID))) {
+		r = _verify_report(cd, root_hash_bytes, hash_size);
+		goto out;
+	}
+
 	r = crypt_activate_by_signed_key(cd, dm_device,
 					 root_hash_bytes,
 					 hash_size,
@@ -275,16 +322,25 @@ out:
 
 static int action_open(void)
 {
+	uint32_t flags = 0;
+
 	if (action_argc < 4 && !ARG_SET(OPT_ROOT_HASH_FILE_ID)) {
 		log_err(_("Command requires <root_hash> or --root-hash-file option as argument."));
 		return -EINVAL;
 	}
 
+	if (ARG_SET(OPT_ROOT_HASH_SIGNATURE_ID))
+		flags |= CRYPT_VERITY_ROOT_HASH_SIGNATURE;
+	if (ARG_SET(OPT_VERIFY_CACHE_ID))
+		flags |= CRYPT_VERITY_CHECK_HASH;
+	if (ARG_SET(OPT_PREFETCH_HASH_ID))
+		flags |= CRYPT_VERITY_PREFETCH_HASH;
+
 	return _activate(action_argv[1],
 			 action_argv[0],
 			 action_argv[2],
 			 ARG_SET(OPT_ROOT_HASH_FILE_ID) ? NULL : action_argv[3],
-			 ARG_SET(OPT_ROOT_HASH_SIGNATURE_ID) ? CRYPT_VERITY_ROOT_HASH_SIGNATURE : 0);
+			 flags);
 }
 
 static int action_verify(void)
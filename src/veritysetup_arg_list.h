@@ -43,6 +43,8 @@ ARG(OPT_FORMAT, '\0', POPT_ARG_STRING, N_("Format type (1 - normal, 0 - original
 
 ARG(OPT_HASH, 'h',  POPT_ARG_STRING, N_("Hash algorithm"), N_("string"), CRYPT_ARG_STRING, { .str_value = CONST_CAST(void *)DEFAULT_VERITY_HASH }, {})
 
+ARG(OPT_HASH_AREA_ONLY, '\0', POPT_ARG_NONE, N_("Verify only root hash and hash area, not data blocks"), NULL, CRYPT_ARG_BOOL, {}, OPT_HASH_AREA_ONLY_ACTIONS)
+
 ARG(OPT_HASH_BLOCK_SIZE, '\0', POPT_ARG_STRING, N_("Block size on the hash device"), N_("bytes"), CRYPT_ARG_UINT32, { .u32_value = DEFAULT_VERITY_HASH_BLOCK }, {})
 
 ARG(OPT_HASH_OFFSET, '\0', POPT_ARG_STRING, N_("Starting offset on the hash device"), N_("bytes"), CRYPT_ARG_UINT64, {}, {})
@@ -55,6 +57,10 @@ ARG(OPT_NO_SUPERBLOCK, '\0', POPT_ARG_NONE, N_("Do not use verity superblock"),
 
 ARG(OPT_PANIC_ON_CORRUPTION, '\0', POPT_ARG_NONE, N_("Panic kernel if corruption is detected"), NULL, CRYPT_ARG_BOOL, {}, OPT_PANIC_ON_CORRUPTION_ACTIONS)
 
+ARG(OPT_PREFETCH_HASH, '\0', POPT_ARG_NONE, N_("Prefetch upper hash tree levels after activation"), NULL, CRYPT_ARG_BOOL, {}, OPT_PREFETCH_HASH_ACTIONS)
+
+ARG(OPT_REPORT_CORRUPTED, '\0', POPT_ARG_NONE, N_("Do not stop on first corrupted data block, list all of them"), NULL, CRYPT_ARG_BOOL, {}, OPT_REPORT_CORRUPTED_ACTIONS)
+
 ARG(OPT_RESTART_ON_CORRUPTION, '\0', POPT_ARG_NONE, N_("Restart kernel if corruption is detected"), NULL, CRYPT_ARG_BOOL, {}, OPT_RESTART_ON_CORRUPTION_ACTIONS)
 
 ARG(OPT_ROOT_HASH_FILE, '\0', POPT_ARG_STRING, N_("Path to root hash file"), NULL, CRYPT_ARG_STRING, {}, OPT_ROOT_HASH_FILE_ACTIONS)
@@ -63,8 +69,12 @@ ARG(OPT_ROOT_HASH_SIGNATURE, '\0', POPT_ARG_STRING, N_("Path to root hash signat
 
 ARG(OPT_SALT, 's', POPT_ARG_STRING, N_("Salt"), N_("hex string"), CRYPT_ARG_STRING, {}, {})
 
+ARG(OPT_SIGNATURE_CACHE, '\0', POPT_ARG_STRING, N_("Keep root hash signature in user keyring for the given time for reuse by later activations"), N_("secs"), CRYPT_ARG_UINT32, {}, OPT_SIGNATURE_CACHE_ACTIONS)
+
 ARG(OPT_USE_TASKLETS, '\0', POPT_ARG_NONE, N_("Use kernel tasklets for performance"), NULL, CRYPT_ARG_BOOL, {}, OPT_USE_TASKLETS_ACTIONS)
 
 ARG(OPT_UUID, '\0', POPT_ARG_STRING, N_("UUID for device to use"), NULL, CRYPT_ARG_STRING, {}, {})
 
 ARG(OPT_VERBOSE, 'v', POPT_ARG_NONE, N_("Shows more detailed error messages"), NULL, CRYPT_ARG_BOOL, {}, {})
+
+ARG(OPT_VERIFY_CACHE, '\0', POPT_ARG_STRING, N_("Directory with cache of verified images, verify in userspace before activation"), N_("path"), CRYPT_ARG_STRING, {}, OPT_VERIFY_CACHE_ACTIONS)
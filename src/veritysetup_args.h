@@ -33,13 +33,18 @@
 #define VERIFY_ACTION	"verify"
 
 #define OPT_DEFERRED_ACTIONS			{ CLOSE_ACTION }
+#define OPT_HASH_AREA_ONLY_ACTIONS		{ VERIFY_ACTION }
 #define OPT_IGNORE_CORRUPTION_ACTIONS		{ OPEN_ACTION }
 #define OPT_IGNORE_ZERO_BLOCKS_ACTIONS		{ OPEN_ACTION }
+#define OPT_PREFETCH_HASH_ACTIONS		{ OPEN_ACTION }
+#define OPT_REPORT_CORRUPTED_ACTIONS		{ VERIFY_ACTION }
 #define OPT_RESTART_ON_CORRUPTION_ACTIONS	{ OPEN_ACTION }
 #define OPT_PANIC_ON_CORRUPTION_ACTIONS		{ OPEN_ACTION }
 #define OPT_ROOT_HASH_FILE_ACTIONS		{ FORMAT_ACTION, OPEN_ACTION, VERIFY_ACTION }
 #define OPT_ROOT_HASH_SIGNATURE_ACTIONS		{ OPEN_ACTION }
+#define OPT_SIGNATURE_CACHE_ACTIONS		{ OPEN_ACTION }
 #define OPT_USE_TASKLETS_ACTIONS		{ OPEN_ACTION }
+#define OPT_VERIFY_CACHE_ACTIONS		{ OPEN_ACTION, VERIFY_ACTION }
 
 enum {
 OPT_UNUSED_ID = 0,
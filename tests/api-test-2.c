@@ -27,6 +27,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <signal.h>
+#include <time.h>
 #include <sys/stat.h>
 #include <inttypes.h>
 #include <sys/types.h>
@@ -66,6 +67,8 @@ typedef int32_t key_serial_t;
 #define IMAGE_EMPTY "empty.img"
 #define IMAGE_EMPTY_SMALL "empty_small.img"
 #define IMAGE_EMPTY_SMALL_2 "empty_small2.img"
+#define IMAGE_SPARSE "sparse.img"
+#define IMAGE_REENCRYPT "reencrypt_data.img"
 #define IMAGE_PV_LUKS2_SEC "blkid-luks2-pv.img"
 
 #define KEYFILE1 "key1.file"
@@ -359,6 +362,8 @@ static void _cleanup(void)
 	remove(IMAGE_PV_LUKS2_SEC ".bcp");
 	remove(IMAGE_EMPTY_SMALL);
 	remove(IMAGE_EMPTY_SMALL_2);
+	remove(IMAGE_SPARSE);
+	remove(IMAGE_REENCRYPT);
 
 	_remove_keyfiles();
 
@@ -539,6 +544,32 @@ static int test_open(struct crypt_device *cd __attribute__((unused)),
 	return 0;
 }
 
+static int test_open_fast(struct crypt_device *cd,
+	int token,
+	char **buffer,
+	size_t *buffer_len,
+	void *usrptr __attribute__((unused)))
+{
+	return test_open(cd, token, buffer, buffer_len, PASSPHRASE);
+}
+
+static int test_open_slow(struct crypt_device *cd,
+	int token,
+	char **buffer,
+	size_t *buffer_len,
+	void *usrptr __attribute__((unused)))
+{
+	const char *json;
+
+	/* handler access to the context while other tokens are processed */
+	if (crypt_token_json_get(cd, token, &json) != token)
+		return -EINVAL;
+
+	usleep(200000);
+
+	return test_open(cd, token, buffer, buffer_len, PASSPHRASE1);
+}
+
 static int test_validate(struct crypt_device *cd __attribute__((unused)), const char *json)
 {
 	return (strstr(json, "magic_string") == NULL);
@@ -601,6 +632,9 @@ static void SuspendDevice(void)
 {
 	struct crypt_active_device cad;
 	char key[128];
+#ifdef KERNEL_KEYRING
+	char held_desc[256];
+#endif
 	size_t key_size;
 	int suspend_status;
 	uint64_t r_payload_offset;
@@ -665,6 +699,47 @@ static void SuspendDevice(void)
 	FAIL_(crypt_resume_by_volume_key(cd, CDEVICE_1, key, key_size), "wrong key");
 	OK_(crypt_volume_key_get(cd, CRYPT_ANY_SLOT, key, &key_size, KEY1, strlen(KEY1)));
 	OK_(crypt_resume_by_volume_key(cd, CDEVICE_1, key, key_size));
+
+#ifdef KERNEL_KEYRING
+	/* Resume by volume key held in kernel keyring */
+	FAIL_(crypt_suspend_with_held_key(cd, CDEVICE_1, key, key_size, 0), "no timeout");
+	FAIL_(crypt_suspend_with_held_key(cd, NULL, key, key_size, 60), "no name");
+	FAIL_(crypt_resume_by_held_key(cd, CDEVICE_1), "not suspended");
+	if (t_dm_crypt_keyring_support())
+		EQ_(crypt_suspend_with_held_key(cd, CDEVICE_1, NULL, 0, 60), -ENOKEY);
+	key[0] = ~key[0];
+	FAIL_(crypt_suspend_with_held_key(cd, CDEVICE_1, key, key_size, 60), "wrong key");
+	key[0] = ~key[0];
+	EQ_(crypt_status(cd, CDEVICE_1), CRYPT_ACTIVE);
+	OK_(crypt_suspend_with_held_key(cd, CDEVICE_1, key, key_size, 60));
+	OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+	EQ_(CRYPT_ACTIVATE_SUSPENDED, cad.flags & CRYPT_ACTIVATE_SUSPENDED);
+	OK_(crypt_resume_by_held_key(cd, CDEVICE_1));
+	OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+	EQ_(0, cad.flags & CRYPT_ACTIVATE_SUSPENDED);
+	FAIL_(crypt_resume_by_held_key(cd, CDEVICE_1), "not suspended");
+
+	/* held key is revoked after resume and expires */
+	OK_(crypt_suspend(cd, CDEVICE_1));
+	EQ_(crypt_resume_by_held_key(cd, CDEVICE_1), -ENOKEY);
+	OK_(crypt_resume_by_volume_key(cd, CDEVICE_1, key, key_size));
+	OK_(crypt_suspend_with_held_key(cd, CDEVICE_1, key, key_size, 1));
+	sleep(2);
+	EQ_(crypt_resume_by_held_key(cd, CDEVICE_1), -ENOKEY);
+	OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+	EQ_(CRYPT_ACTIVATE_SUSPENDED, cad.flags & CRYPT_ACTIVATE_SUSPENDED);
+
+	/* key planted by somebody else with the same description is rejected and revoked */
+	GE_(snprintf(held_desc, sizeof(held_desc), "cryptsetup-suspend:%s:%s", crypt_get_uuid(cd), CDEVICE_1), 0);
+	key[0] = ~key[0];
+	NOTFAIL_(add_key("user", held_desc, key, key_size, KEY_SPEC_USER_KEYRING), "Test or kernel keyring are broken.");
+	key[0] = ~key[0];
+	EQ_(crypt_resume_by_held_key(cd, CDEVICE_1), -EPERM);
+	OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+	EQ_(CRYPT_ACTIVATE_SUSPENDED, cad.flags & CRYPT_ACTIVATE_SUSPENDED);
+	EQ_(crypt_resume_by_held_key(cd, CDEVICE_1), -ENOKEY);
+	OK_(crypt_resume_by_volume_key(cd, CDEVICE_1, key, key_size));
+#endif
 	OK_(crypt_deactivate(cd, CDEVICE_1));
 	CRYPT_FREE(cd);
 
@@ -2159,6 +2234,72 @@ static void Tokens(void)
 	_cleanup_dmdevices();
 }
 
+static void TokensParallel(void)
+{
+#define TEST_TOKEN_SLOW_JSON(x) "{\"type\":\"test_token_slow\",\"keyslots\":[" x "]}"
+#define TEST_TOKEN_FAST_JSON(x) "{\"type\":\"test_token_fast\",\"keyslots\":[" x "]}"
+	uint64_t r_payload_offset;
+
+	static const crypt_token_handler th_slow = {
+		.name = "test_token_slow",
+		.open = test_open_slow,
+	}, th_fast = {
+		.name = "test_token_fast",
+		.open = test_open_fast,
+	};
+
+	OK_(crypt_token_register(&th_slow));
+	OK_(crypt_token_register(&th_fast));
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_1S, r_payload_offset + 1));
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_1S));
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, 32, NULL));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 32, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 1, NULL, 32, PASSPHRASE1, strlen(PASSPHRASE1)), 1);
+	/* slow token first in order, fast token finishes before it */
+	EQ_(crypt_token_json_set(cd, 0, TEST_TOKEN_SLOW_JSON("\"1\"")), 0);
+	EQ_(crypt_token_json_set(cd, 1, TEST_TOKEN_FAST_JSON("\"0\"")), 1);
+	CRYPT_FREE(cd);
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_1S));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	FAIL_(crypt_set_token_parallel_open(NULL, 1), "No context");
+	OK_(crypt_set_token_parallel_open(cd, 1));
+
+	/* result follows token order, same as in sequential open */
+	EQ_(crypt_activate_by_token(cd, NULL, CRYPT_ANY_TOKEN, NULL, 0), 1);
+	EQ_(crypt_activate_by_token_pin(cd, NULL, "test_token_fast", CRYPT_ANY_TOKEN, NULL, 0, NULL, 0), 0);
+	EQ_(crypt_activate_by_token_pin(cd, NULL, "test_token_slow", CRYPT_ANY_TOKEN, NULL, 0, NULL, 0), 1);
+	EQ_(crypt_activate_by_token_pin(cd, NULL, "test_token_none", CRYPT_ANY_TOKEN, NULL, 0, NULL, 0), -ENOENT);
+	OK_(crypt_set_token_parallel_open(cd, 0));
+	EQ_(crypt_activate_by_token(cd, NULL, CRYPT_ANY_TOKEN, NULL, 0), 1);
+
+	/* token passphrase not unlocking its keyslot */
+	OK_(crypt_set_token_parallel_open(cd, 1));
+	EQ_(crypt_token_json_set(cd, 0, NULL), 0);
+	EQ_(crypt_token_json_set(cd, 1, NULL), 1);
+	EQ_(crypt_token_json_set(cd, 0, TEST_TOKEN_SLOW_JSON("\"0\"")), 0);
+	EQ_(crypt_token_json_set(cd, 1, TEST_TOKEN_FAST_JSON("\"1\"")), 1);
+	EQ_(crypt_activate_by_token(cd, NULL, CRYPT_ANY_TOKEN, NULL, 0), -EPERM);
+
+	/* fast token first, slow one is left running and waited for later */
+	EQ_(crypt_token_json_set(cd, 0, NULL), 0);
+	EQ_(crypt_token_json_set(cd, 1, NULL), 1);
+	EQ_(crypt_token_json_set(cd, 0, TEST_TOKEN_FAST_JSON("\"0\"")), 0);
+	EQ_(crypt_token_json_set(cd, 1, TEST_TOKEN_SLOW_JSON("\"1\"")), 1);
+	EQ_(crypt_activate_by_token(cd, NULL, CRYPT_ANY_TOKEN, NULL, 0), 0);
+	EQ_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, PASSPHRASE1, strlen(PASSPHRASE1), 0), 1);
+	EQ_(crypt_activate_by_token(cd, NULL, CRYPT_ANY_TOKEN, NULL, 0), 0);
+
+	/* context released with token callback still running */
+	CRYPT_FREE(cd);
+
+	_cleanup_dmdevices();
+}
+
 static void LuksConvert(void)
 {
 	uint64_t offset, r_payload_offset;
@@ -3867,6 +4008,270 @@ static int test_progress(uint64_t size __attribute__((unused)),
 	return 1;
 }
 
+static int test_progress_count(uint64_t size __attribute__((unused)),
+	uint64_t offset __attribute__((unused)),
+	void *usrptr)
+{
+	(*(unsigned *)usrptr)++;
+	return 0;
+}
+
+static void Luks2ReencryptionSparse(void)
+{
+	uint64_t r_header_size;
+	unsigned steps;
+	struct crypt_pbkdf_type pbkdf = {
+		.type = CRYPT_KDF_PBKDF2,
+		.hash = "sha256",
+		.iterations = 1000,
+		.flags = CRYPT_PBKDF_NO_BENCHMARK
+	};
+	struct crypt_params_luks2 params2 = {
+		.pbkdf = &pbkdf,
+		.sector_size = 512
+	};
+	struct crypt_params_reencrypt rparams = {
+		.mode = CRYPT_REENCRYPT_REENCRYPT,
+		.direction = CRYPT_REENCRYPT_FORWARD,
+		.resilience = "checksum",
+		.hash = "sha256",
+		.max_hotzone_size = 8,
+		.luks2 = &params2,
+	};
+
+	/* reencryption currently depends on kernel keyring support in dm-crypt */
+	if (!t_dm_crypt_keyring_support())
+		return;
+
+	OK_(get_luks2_offsets(1, 0, 0, &r_header_size, NULL));
+	OK_(create_dmdevice_over_loop(H_DEVICE, r_header_size));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, 64));
+
+	OK_(crypt_init_data_device(&cd, DMDIR H_DEVICE, DMDIR L_DEVICE_OK));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "cbc-essiv:sha256", NULL, NULL, 32, &params2));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 32, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	EQ_(crypt_keyslot_add_by_key(cd, 1, NULL, 32, PASSPHRASE, strlen(PASSPHRASE), CRYPT_VOLUME_KEY_NO_SEGMENT), 1);
+
+	/* sparse mode requires reencryption context */
+	FAIL_(crypt_reencrypt_set_sparse(cd, CRYPT_REENCRYPT_SPARSE_SKIP), "Reencryption context not initialized.");
+
+	/* whole device unused, forward direction switches all data in one step */
+	EQ_(crypt_reencrypt_init_by_passphrase(cd, NULL, PASSPHRASE, strlen(PASSPHRASE), 0, 1, "aes", "xts-plain64", &rparams), 2);
+	FAIL_(crypt_reencrypt_set_sparse(cd, UINT32_C(1) << 3), "Invalid sparse flags.");
+	OK_(crypt_reencrypt_set_sparse(cd, CRYPT_REENCRYPT_SPARSE_SKIP | CRYPT_REENCRYPT_SPARSE_UNUSED));
+	steps = 0;
+	OK_(crypt_reencrypt_run(cd, test_progress_count, &steps));
+	EQ_(steps, 3); /* init, single step, finish */
+	EQ_(crypt_reencrypt_status(cd, NULL), CRYPT_REENCRYPT_NONE);
+	EQ_(crypt_keyslot_status(cd, 0), CRYPT_SLOT_INACTIVE);
+	EQ_(crypt_keyslot_status(cd, 1), CRYPT_SLOT_ACTIVE_LAST);
+	OK_(strcmp(crypt_get_cipher_mode(cd), "xts-plain64"));
+
+	/* whole device unused, backward direction */
+	EQ_(crypt_keyslot_add_by_key(cd, 2, NULL, 32, PASSPHRASE, strlen(PASSPHRASE), CRYPT_VOLUME_KEY_NO_SEGMENT), 2);
+	rparams.direction = CRYPT_REENCRYPT_BACKWARD;
+	EQ_(crypt_reencrypt_init_by_passphrase(cd, NULL, PASSPHRASE, strlen(PASSPHRASE), 1, 2, "aes", "cbc-essiv:sha256", &rparams), 0);
+	OK_(crypt_reencrypt_set_sparse(cd, CRYPT_REENCRYPT_SPARSE_UNUSED));
+	steps = 0;
+	OK_(crypt_reencrypt_run(cd, test_progress_count, &steps));
+	EQ_(steps, 3);
+	EQ_(crypt_reencrypt_status(cd, NULL), CRYPT_REENCRYPT_NONE);
+	EQ_(crypt_keyslot_status(cd, 2), CRYPT_SLOT_ACTIVE_LAST);
+	OK_(strcmp(crypt_get_cipher_mode(cd), "cbc-essiv:sha256"));
+
+	/* allocated device with hole check, all hotzones are reencrypted */
+	EQ_(crypt_keyslot_add_by_key(cd, 3, NULL, 32, PASSPHRASE, strlen(PASSPHRASE), CRYPT_VOLUME_KEY_NO_SEGMENT), 3);
+	rparams.direction = CRYPT_REENCRYPT_FORWARD;
+	EQ_(crypt_reencrypt_init_by_passphrase(cd, NULL, PASSPHRASE, strlen(PASSPHRASE), 2, 3, "aes", "xts-plain64", &rparams), 0);
+	OK_(crypt_reencrypt_set_sparse(cd, CRYPT_REENCRYPT_SPARSE_SKIP));
+	steps = 0;
+	OK_(crypt_reencrypt_run(cd, test_progress_count, &steps));
+	EQ_(steps, 10); /* 8 hotzones */
+	EQ_(crypt_reencrypt_status(cd, NULL), CRYPT_REENCRYPT_NONE);
+	EQ_(crypt_keyslot_status(cd, 3), CRYPT_SLOT_ACTIVE_LAST);
+	CRYPT_FREE(cd);
+
+	/* image file with data in 4th block only, holes are switched in one step each */
+	_system("dd if=/dev/zero of=" IMAGE_SPARSE " bs=4096 count=0 seek=8 2>/dev/null", 1);
+	_system("dd if=/dev/urandom of=" IMAGE_SPARSE " bs=4096 count=1 seek=3 conv=notrunc 2>/dev/null", 1);
+	OK_(crypt_init_data_device(&cd, DMDIR H_DEVICE, IMAGE_SPARSE));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "cbc-essiv:sha256", NULL, NULL, 32, &params2));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 32, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	EQ_(crypt_keyslot_add_by_key(cd, 1, NULL, 32, PASSPHRASE, strlen(PASSPHRASE), CRYPT_VOLUME_KEY_NO_SEGMENT), 1);
+	EQ_(crypt_reencrypt_init_by_passphrase(cd, NULL, PASSPHRASE, strlen(PASSPHRASE), 0, 1, "aes", "xts-plain64", &rparams), 2);
+	OK_(crypt_reencrypt_set_sparse(cd, CRYPT_REENCRYPT_SPARSE_SKIP));
+	steps = 0;
+	OK_(crypt_reencrypt_run(cd, test_progress_count, &steps));
+	EQ_(steps, 5); /* hole, data hotzone, hole */
+	EQ_(crypt_reencrypt_status(cd, NULL), CRYPT_REENCRYPT_NONE);
+	EQ_(crypt_keyslot_status(cd, 1), CRYPT_SLOT_ACTIVE_LAST);
+
+	/* backward direction switches holes hotzone by hotzone */
+	EQ_(crypt_keyslot_add_by_key(cd, 2, NULL, 32, PASSPHRASE, strlen(PASSPHRASE), CRYPT_VOLUME_KEY_NO_SEGMENT), 2);
+	rparams.direction = CRYPT_REENCRYPT_BACKWARD;
+	EQ_(crypt_reencrypt_init_by_passphrase(cd, NULL, PASSPHRASE, strlen(PASSPHRASE), 1, 2, "aes", "cbc-essiv:sha256", &rparams), 0);
+	OK_(crypt_reencrypt_set_sparse(cd, CRYPT_REENCRYPT_SPARSE_SKIP));
+	steps = 0;
+	OK_(crypt_reencrypt_run(cd, test_progress_count, &steps));
+	EQ_(steps, 10);
+	EQ_(crypt_reencrypt_status(cd, NULL), CRYPT_REENCRYPT_NONE);
+	EQ_(crypt_keyslot_status(cd, 2), CRYPT_SLOT_ACTIVE_LAST);
+
+	CRYPT_FREE(cd);
+	remove(IMAGE_SPARSE);
+	_cleanup_dmdevices();
+}
+
+struct test_reencrypt_stats {
+	unsigned steps;
+	unsigned errors;
+	uint64_t bytes;
+	uint64_t next_offset;
+};
+
+static void test_reencrypt_stats_sum(const struct crypt_reencrypt_stats *stats, void *usrptr)
+{
+	struct test_reencrypt_stats *sum = usrptr;
+
+	/* forward offline reencryption, hotzones follow each other */
+	if (stats->offset != sum->next_offset || !stats->length ||
+	    stats->suspend_us || stats->resume_us ||
+	    stats->read_us + stats->protect_us + stats->transform_us + stats->write_us +
+	    stats->datasync_us + stats->commit_us > stats->total_us)
+		sum->errors++;
+
+	sum->steps++;
+	sum->bytes += stats->length;
+	sum->next_offset = stats->offset + stats->length;
+}
+
+static uint64_t _time_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void Luks2ReencryptionTuning(void)
+{
+	uint64_t r_header_size, start;
+	unsigned steps;
+	struct test_reencrypt_stats sum;
+	struct crypt_pbkdf_type pbkdf = {
+		.type = CRYPT_KDF_PBKDF2,
+		.hash = "sha256",
+		.iterations = 1000,
+		.flags = CRYPT_PBKDF_NO_BENCHMARK
+	};
+	struct crypt_params_luks2 params2 = {
+		.pbkdf = &pbkdf,
+		.sector_size = 512
+	};
+	struct crypt_params_reencrypt rparams = {
+		.mode = CRYPT_REENCRYPT_REENCRYPT,
+		.direction = CRYPT_REENCRYPT_FORWARD,
+		.resilience = "checksum",
+		.hash = "sha256",
+		.max_hotzone_size = 256,
+		.luks2 = &params2,
+	};
+	struct crypt_params_reencrypt_throttle throttle = {
+		.max_rate = 1024 * 1024,
+	};
+
+	/* reencryption currently depends on kernel keyring support in dm-crypt */
+	if (!t_dm_crypt_keyring_support())
+		return;
+
+	OK_(get_luks2_offsets(1, 0, 0, &r_header_size, NULL));
+	OK_(create_dmdevice_over_loop(H_DEVICE, r_header_size));
+	/* 2 MiB image file, 16 hotzones of 128 KiB */
+	_system("dd if=/dev/urandom of=" IMAGE_REENCRYPT " bs=1M count=2 2>/dev/null", 1);
+
+	OK_(crypt_init_data_device(&cd, DMDIR H_DEVICE, IMAGE_REENCRYPT));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "cbc-essiv:sha256", NULL, NULL, 32, &params2));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 32, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	EQ_(crypt_keyslot_add_by_key(cd, 1, NULL, 32, PASSPHRASE, strlen(PASSPHRASE), CRYPT_VOLUME_KEY_NO_SEGMENT), 1);
+
+	/* tuning requires reencryption context */
+	FAIL_(crypt_reencrypt_set_hotzone_latency(NULL, 100), "No context.");
+	FAIL_(crypt_reencrypt_set_hotzone_latency(cd, 100), "Reencryption context not initialized.");
+	FAIL_(crypt_reencrypt_set_throttle(NULL, &throttle), "No context.");
+	FAIL_(crypt_reencrypt_set_throttle(cd, &throttle), "Reencryption context not initialized.");
+	FAIL_(crypt_reencrypt_set_hotzone_batch(NULL, 4), "No context.");
+	FAIL_(crypt_reencrypt_set_hotzone_batch(cd, 4), "Reencryption context not initialized.");
+	FAIL_(crypt_reencrypt_set_stats_callback(NULL, test_reencrypt_stats_sum, &sum), "No context.");
+	FAIL_(crypt_reencrypt_set_stats_callback(cd, test_reencrypt_stats_sum, &sum), "Reencryption context not initialized.");
+
+	EQ_(crypt_reencrypt_init_by_passphrase(cd, NULL, PASSPHRASE, strlen(PASSPHRASE), 0, 1, "aes", "xts-plain64", &rparams), 2);
+
+	/* latency target, offline reencryption ignores it */
+	FAIL_(crypt_reencrypt_set_hotzone_latency(cd, CRYPT_REENCRYPT_HOTZONE_LATENCY_MAX_MS + 1), "Latency target out of range.");
+	FAIL_(crypt_reencrypt_set_hotzone_latency(cd, UINT32_MAX), "Latency target out of range.");
+	OK_(crypt_reencrypt_set_hotzone_latency(cd, CRYPT_REENCRYPT_HOTZONE_LATENCY_MAX_MS));
+	OK_(crypt_reencrypt_set_hotzone_latency(cd, 0));
+	OK_(crypt_reencrypt_set_hotzone_latency(cd, 1));
+
+	/* stats of every step add up to the device size */
+	memset(&sum, 0, sizeof(sum));
+	OK_(crypt_reencrypt_set_stats_callback(cd, test_reencrypt_stats_sum, &sum));
+	steps = 0;
+	OK_(crypt_reencrypt_run(cd, test_progress_count, &steps));
+	EQ_(steps, 18); /* init, 16 hotzones, finish */
+	EQ_(sum.steps, 16);
+	EQ_(sum.errors, 0);
+	EQ_(sum.bytes, 2 * 1024 * 1024);
+	EQ_(sum.next_offset, 2 * 1024 * 1024);
+	EQ_(crypt_reencrypt_status(cd, NULL), CRYPT_REENCRYPT_NONE);
+	EQ_(crypt_keyslot_status(cd, 1), CRYPT_SLOT_ACTIVE_LAST);
+	OK_(strcmp(crypt_get_cipher_mode(cd), "xts-plain64"));
+
+	/* throttle, one second burst and 1 MiB at 1 MiB/s */
+	EQ_(crypt_keyslot_add_by_key(cd, 2, NULL, 32, PASSPHRASE, strlen(PASSPHRASE), CRYPT_VOLUME_KEY_NO_SEGMENT), 2);
+	EQ_(crypt_reencrypt_init_by_passphrase(cd, NULL, PASSPHRASE, strlen(PASSPHRASE), 1, 2, "aes", "cbc-essiv:sha256", &rparams), 0);
+	throttle.max_rate = UINT64_MAX;
+	FAIL_(crypt_reencrypt_set_throttle(cd, &throttle), "Rate out of range.");
+	throttle.max_rate = 1024 * 1024;
+	throttle.max_latency_ms = 1;
+	throttle.max_in_flight = 1;
+	OK_(crypt_reencrypt_set_throttle(cd, &throttle));
+	OK_(crypt_reencrypt_set_throttle(cd, NULL));
+	OK_(crypt_reencrypt_set_throttle(cd, &throttle));
+	start = _time_ms();
+	steps = 0;
+	OK_(crypt_reencrypt_run(cd, test_progress_count, &steps));
+	GE_(_time_ms() - start, 900);
+	EQ_(steps, 18);
+	EQ_(crypt_reencrypt_status(cd, NULL), CRYPT_REENCRYPT_NONE);
+	EQ_(crypt_keyslot_status(cd, 2), CRYPT_SLOT_ACTIVE_LAST);
+
+	/* batch of 4 hotzones per metadata commit */
+	EQ_(crypt_keyslot_add_by_key(cd, 3, NULL, 32, PASSPHRASE, strlen(PASSPHRASE), CRYPT_VOLUME_KEY_NO_SEGMENT), 3);
+	EQ_(crypt_reencrypt_init_by_passphrase(cd, NULL, PASSPHRASE, strlen(PASSPHRASE), 2, 3, "aes", "xts-plain64", &rparams), 0);
+	FAIL_(crypt_reencrypt_set_hotzone_batch(cd, CRYPT_REENCRYPT_HOTZONE_BATCH_MAX + 1), "Batch out of range.");
+	FAIL_(crypt_reencrypt_set_hotzone_batch(cd, UINT32_MAX), "Batch out of range.");
+	OK_(crypt_reencrypt_set_hotzone_batch(cd, 0));
+	OK_(crypt_reencrypt_set_hotzone_batch(cd, 1));
+	OK_(crypt_reencrypt_set_hotzone_batch(cd, 4));
+	memset(&sum, 0, sizeof(sum));
+	OK_(crypt_reencrypt_set_stats_callback(cd, test_reencrypt_stats_sum, &sum));
+	OK_(crypt_reencrypt_set_stats_callback(cd, NULL, NULL));
+	OK_(crypt_reencrypt_set_stats_callback(cd, test_reencrypt_stats_sum, &sum));
+	steps = 0;
+	OK_(crypt_reencrypt_run(cd, test_progress_count, &steps));
+	EQ_(steps, 6); /* init, 4 batches, finish */
+	EQ_(sum.steps, 4);
+	EQ_(sum.errors, 0);
+	EQ_(sum.bytes, 2 * 1024 * 1024);
+	EQ_(crypt_reencrypt_status(cd, NULL), CRYPT_REENCRYPT_NONE);
+	EQ_(crypt_keyslot_status(cd, 3), CRYPT_SLOT_ACTIVE_LAST);
+	CRYPT_FREE(cd);
+
+	remove(IMAGE_REENCRYPT);
+	_cleanup_dmdevices();
+}
+
 static void Luks2Reencryption(void)
 {
 /* reencryption currently depends on kernel keyring support */
@@ -4886,6 +5291,1018 @@ static void LuksKeyslotAdd(void)
 	_cleanup_dmdevices();
 }
 
+static void Luks2KeyslotParallelUnlock(void)
+{
+	const char *passphrases[4] = { "aaaaaaa0", "aaaaaaa1", "aaaaaaa2", "aaaaaaa3" };
+	uint64_t r_payload_offset;
+	int i;
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, r_payload_offset + 1));
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, 32, NULL));
+	for (i = 0; i < 4; i++)
+		EQ_(crypt_keyslot_add_by_volume_key(cd, i, NULL, 0, passphrases[i], 8), i);
+
+	FAIL_(crypt_set_keyslot_parallel_unlock(NULL, 4), "No context");
+	FAIL_(crypt_set_keyslot_parallel_unlock(cd, crypt_keyslot_max(CRYPT_LUKS2) + 1), "Too many keyslots");
+	OK_(crypt_set_keyslot_parallel_unlock(cd, 4));
+	for (i = 0; i < 4; i++)
+		EQ_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, passphrases[i], 8, 0), i);
+	EQ_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, "wrong", 5, 0), -EPERM);
+	EQ_(crypt_activate_by_passphrase(cd, NULL, 1, passphrases[2], 8, 0), -EPERM);
+
+	/* keyslot priority is respected */
+	OK_(crypt_keyslot_set_priority(cd, 3, CRYPT_SLOT_PRIORITY_IGNORE));
+	EQ_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, passphrases[3], 8, 0), -EPERM);
+	EQ_(crypt_activate_by_passphrase(cd, NULL, 3, passphrases[3], 8, 0), 3);
+	OK_(crypt_keyslot_set_priority(cd, 3, CRYPT_SLOT_PRIORITY_NORMAL));
+	OK_(crypt_set_keyslot_parallel_unlock(cd, 0));
+	EQ_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, passphrases[3], 8, 0), 3);
+	CRYPT_FREE(cd);
+
+	_cleanup_dmdevices();
+}
+
+static void Luks2PassphraseBatch(void)
+{
+	const char *passphrases[4] = { "aaaaaaa0", "aaaaaaa1", "aaaaaaa2", "aaaaaaa3" };
+	const char *candidates[3] = { "wrong", "aaaaaaa2", "aaaaaaa1" };
+	size_t sizes[3] = { 5, 8, 8 }, index;
+	uint64_t r_payload_offset;
+	int i;
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, r_payload_offset + 1));
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, 32, NULL));
+	for (i = 0; i < 4; i++)
+		EQ_(crypt_keyslot_add_by_volume_key(cd, i, NULL, 0, passphrases[i], 8), i);
+
+	/* candidates are tried one after another */
+	EQ_(crypt_keyslot_test_passphrases(cd, CRYPT_ANY_SLOT, candidates, sizes, 3, 0, &index), 2);
+	EQ_(index, 1);
+	EQ_(crypt_keyslot_test_passphrases(cd, 1, candidates, sizes, 3, 0, &index), 1);
+	EQ_(index, 2);
+	EQ_(crypt_keyslot_test_passphrases(cd, 0, candidates, sizes, 3, 0, &index), -EPERM);
+	CRYPT_FREE(cd);
+
+	_cleanup_dmdevices();
+}
+
+static int hdr_cache_hits;
+
+static void hdr_cache_log(int level, const char *msg, void *usrptr)
+{
+	if (level == CRYPT_LOG_DEBUG && strstr(msg, "Using cached LUKS2 header"))
+		hdr_cache_hits++;
+	global_log_callback(level, msg, usrptr);
+}
+
+static void Luks2HeaderCache(void)
+{
+	struct crypt_device *cd2;
+	uint64_t r_payload_offset;
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, r_payload_offset + 1));
+
+	FAIL_(crypt_set_header_cache(NULL, 1), "No context");
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, 32, NULL));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 0, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	CRYPT_FREE(cd);
+
+	/* cached header is used only while on-disk header is unchanged */
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_set_header_cache(cd, 1));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	EQ_(crypt_keyslot_status(cd, 0), CRYPT_SLOT_ACTIVE_LAST);
+	CRYPT_FREE(cd);
+
+	OK_(crypt_init(&cd2, DMDIR L_DEVICE_OK));
+	OK_(crypt_load(cd2, CRYPT_LUKS2, NULL));
+	EQ_(crypt_keyslot_add_by_passphrase(cd2, 1, PASSPHRASE, strlen(PASSPHRASE), PASSPHRASE1, strlen(PASSPHRASE1)), 1);
+	CRYPT_FREE(cd2);
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_set_header_cache(cd, 1));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	EQ_(crypt_keyslot_status(cd, 1), CRYPT_SLOT_ACTIVE);
+	EQ_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, PASSPHRASE1, strlen(PASSPHRASE1), 0), 1);
+	OK_(crypt_keyslot_destroy(cd, 1));
+	CRYPT_FREE(cd);
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_set_header_cache(cd, 1));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	EQ_(crypt_keyslot_status(cd, 1), CRYPT_SLOT_INACTIVE);
+	OK_(crypt_set_header_cache(cd, 0));
+	CRYPT_FREE(cd);
+
+	/* cached headers live only while some context exists */
+	crypt_set_debug_level(CRYPT_DEBUG_ALL);
+	OK_(crypt_init(&cd2, NULL));
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_set_header_cache(cd, 1));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	CRYPT_FREE(cd);
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	crypt_set_log_callback(cd, &hdr_cache_log, NULL);
+	OK_(crypt_set_header_cache(cd, 1));
+	hdr_cache_hits = 0;
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	EQ_(hdr_cache_hits, 1);
+	CRYPT_FREE(cd);
+	CRYPT_FREE(cd2);
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	crypt_set_log_callback(cd, &hdr_cache_log, NULL);
+	OK_(crypt_set_header_cache(cd, 1));
+	hdr_cache_hits = 0;
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	EQ_(hdr_cache_hits, 0);
+	CRYPT_FREE(cd);
+	crypt_set_debug_level(_debug ? CRYPT_DEBUG_ALL : CRYPT_DEBUG_NONE);
+
+	_cleanup_dmdevices();
+}
+
+static void Luks2HeaderTransaction(void)
+{
+	struct crypt_device *cd2;
+	uint64_t r_payload_offset;
+	const char *json = "{\"type\":\"test_token\",\"keyslots\":[]}";
+	const char *token;
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, r_payload_offset + 1));
+
+	FAIL_(crypt_header_transaction_begin(NULL), "No context");
+	FAIL_(crypt_header_transaction_commit(NULL), "No context");
+	FAIL_(crypt_header_transaction_abort(NULL), "No context");
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	FAIL_(crypt_header_transaction_begin(cd), "Not LUKS2 device");
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, 32, NULL));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 0, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	FAIL_(crypt_header_transaction_commit(cd), "No transaction");
+	FAIL_(crypt_header_transaction_abort(cd), "No transaction");
+
+	/* changes are written once on commit */
+	OK_(crypt_header_transaction_begin(cd));
+	EQ_(crypt_header_transaction_begin(cd), -EBUSY);
+	EQ_(crypt_keyslot_add_by_passphrase(cd, 1, PASSPHRASE, strlen(PASSPHRASE), PASSPHRASE1, strlen(PASSPHRASE1)), 1);
+	EQ_(crypt_token_json_set(cd, 3, json), 3);
+	OK_(crypt_persistent_flags_set(cd, CRYPT_FLAGS_ACTIVATION, CRYPT_ACTIVATE_ALLOW_DISCARDS));
+	EQ_(crypt_keyslot_status(cd, 1), CRYPT_SLOT_ACTIVE);
+
+	OK_(crypt_init(&cd2, DMDIR L_DEVICE_OK));
+	OK_(crypt_load(cd2, CRYPT_LUKS2, NULL));
+	EQ_(crypt_keyslot_status(cd2, 1), CRYPT_SLOT_INACTIVE);
+	EQ_(crypt_token_status(cd2, 3, NULL), CRYPT_TOKEN_INACTIVE);
+	CRYPT_FREE(cd2);
+
+	OK_(crypt_header_transaction_commit(cd));
+	FAIL_(crypt_header_transaction_commit(cd), "No transaction");
+
+	OK_(crypt_init(&cd2, DMDIR L_DEVICE_OK));
+	OK_(crypt_load(cd2, CRYPT_LUKS2, NULL));
+	EQ_(crypt_keyslot_status(cd2, 1), CRYPT_SLOT_ACTIVE);
+	EQ_(crypt_token_status(cd2, 3, NULL), CRYPT_TOKEN_EXTERNAL_UNKNOWN);
+	EQ_(crypt_token_json_get(cd2, 3, &token), 3);
+	EQ_(crypt_activate_by_passphrase(cd2, NULL, CRYPT_ANY_SLOT, PASSPHRASE1, strlen(PASSPHRASE1), 0), 1);
+	CRYPT_FREE(cd2);
+
+	/* aborted changes are dropped */
+	OK_(crypt_header_transaction_begin(cd));
+	OK_(crypt_keyslot_destroy(cd, 1));
+	EQ_(crypt_token_json_set(cd, 3, NULL), 3);
+	EQ_(crypt_keyslot_status(cd, 1), CRYPT_SLOT_INACTIVE);
+	OK_(crypt_header_transaction_abort(cd));
+	EQ_(crypt_keyslot_status(cd, 1), CRYPT_SLOT_ACTIVE);
+	EQ_(crypt_token_status(cd, 3, NULL), CRYPT_TOKEN_EXTERNAL_UNKNOWN);
+	EQ_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, PASSPHRASE, strlen(PASSPHRASE), 0), 0);
+
+	/* uncommitted changes are lost on free */
+	OK_(crypt_header_transaction_begin(cd));
+	EQ_(crypt_token_json_set(cd, 3, NULL), 3);
+	CRYPT_FREE(cd);
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	EQ_(crypt_token_status(cd, 3, NULL), CRYPT_TOKEN_EXTERNAL_UNKNOWN);
+	CRYPT_FREE(cd);
+
+	_cleanup_dmdevices();
+}
+
+static void Luks2DumpJsonUnlocked(void)
+{
+	uint64_t r_payload_offset;
+	const char *json;
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, r_payload_offset + 1));
+
+	FAIL_(crypt_dump_json(NULL, &json, CRYPT_DUMP_JSON_UNLOCKED), "No context");
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	FAIL_(crypt_dump_json(cd, &json, CRYPT_DUMP_JSON_UNLOCKED), "No LUKS2 header");
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, 32, NULL));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 0, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	CRYPT_FREE(cd);
+
+	/* unlocked JSON dump without crypt_load */
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	FAIL_(crypt_dump_json(cd, &json, 0), "Not loaded");
+	FAIL_(crypt_dump_json(cd, &json, UINT32_C(1) << 5), "Invalid flags");
+	OK_(crypt_dump_json(cd, &json, CRYPT_DUMP_JSON_UNLOCKED));
+	OK_(!strstr(json, "\"keyslots\""));
+	OK_(!strstr(json, "\"segments\""));
+	NULL_(crypt_get_type(cd));
+	CRYPT_FREE(cd);
+
+	_cleanup_dmdevices();
+}
+
+static void Luks2StagedVolumeKey(void)
+{
+	const char *desc = "cryptsetup:api-test-staged";
+	uint64_t r_payload_offset;
+	char key[32];
+	size_t key_size = sizeof(key);
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, r_payload_offset + 1));
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, key_size, NULL));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 0, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	OK_(crypt_volume_key_get(cd, CRYPT_ANY_SLOT, key, &key_size, PASSPHRASE, strlen(PASSPHRASE)));
+
+	FAIL_(crypt_volume_key_keyring_stage(NULL, key, key_size, desc), "No context");
+	FAIL_(crypt_volume_key_keyring_stage(cd, NULL, key_size, desc), "No key");
+	FAIL_(crypt_volume_key_keyring_stage(cd, key, 0, desc), "No key");
+	FAIL_(crypt_volume_key_keyring_stage(cd, key, key_size, NULL), "No description");
+	FAIL_(crypt_activate_by_staged_volume_key(NULL, CDEVICE_1, NULL, 0), "No context");
+	FAIL_(crypt_activate_by_staged_volume_key(cd, NULL, NULL, 0), "No name");
+	EQ_(crypt_activate_by_staged_volume_key(cd, CDEVICE_1, NULL, 0), -ENOENT);
+	FAIL_(crypt_volume_key_keyring_drop(NULL), "No context");
+	OK_(crypt_volume_key_keyring_drop(cd));
+
+#ifdef KERNEL_KEYRING
+	if (t_dm_crypt_keyring_support()) {
+		const char *desc_wrong = "cryptsetup:api-test-other";
+		struct crypt_active_device cad;
+
+		key[0] = ~key[0];
+		FAIL_(crypt_volume_key_keyring_stage(cd, key, key_size, desc), "Wrong key");
+		key[0] = ~key[0];
+		EQ_(crypt_activate_by_staged_volume_key(cd, CDEVICE_1, NULL, 0), -ENOENT);
+		OK_(crypt_volume_key_keyring_stage(cd, key, key_size, desc));
+		EQ_(crypt_activate_by_staged_volume_key(cd, CDEVICE_1, desc_wrong, 0), -EPERM);
+		OK_(crypt_activate_by_staged_volume_key(cd, CDEVICE_1, desc, 0));
+		OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+		EQ_(CRYPT_ACTIVATE_KEYRING_KEY, cad.flags & CRYPT_ACTIVATE_KEYRING_KEY);
+		FAIL_(crypt_activate_by_staged_volume_key(cd, CDEVICE_1, NULL, 0), "Already active");
+		OK_(crypt_deactivate(cd, CDEVICE_1));
+
+		/* key stays staged until dropped */
+		OK_(crypt_activate_by_staged_volume_key(cd, CDEVICE_1, NULL, CRYPT_ACTIVATE_READONLY));
+		GE_(crypt_status(cd, CDEVICE_1), CRYPT_ACTIVE);
+		OK_(crypt_deactivate(cd, CDEVICE_1));
+		OK_(crypt_volume_key_keyring_drop(cd));
+		EQ_(crypt_activate_by_staged_volume_key(cd, CDEVICE_1, NULL, 0), -ENOENT);
+	}
+#endif
+	CRYPT_FREE(cd);
+
+	/* only LUKS2 */
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	FAIL_(crypt_volume_key_keyring_stage(cd, key, key_size, desc), "Not LUKS2 device");
+	CRYPT_FREE(cd);
+
+	_cleanup_dmdevices();
+}
+
+static void Luks2KeyslotContextKeyCache(void)
+{
+	struct crypt_keyslot_context *kc, *kc_key;
+	uint64_t r_payload_offset, offset, length;
+	char key[32], key2[32], cmd[256];
+	size_t key_size = sizeof(key);
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, r_payload_offset + 1));
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, key_size, NULL));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 0, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	OK_(crypt_volume_key_get(cd, CRYPT_ANY_SLOT, key, &key_size, PASSPHRASE, strlen(PASSPHRASE)));
+
+	OK_(crypt_keyslot_context_init_by_passphrase(cd, PASSPHRASE, strlen(PASSPHRASE), &kc));
+	OK_(crypt_keyslot_context_init_by_volume_key(cd, key, key_size, &kc_key));
+	FAIL_(crypt_keyslot_context_set_key_cache(cd, 1, NULL), "No context");
+	FAIL_(crypt_keyslot_context_set_key_cache(cd, 1, kc_key), "Volume key context");
+	OK_(crypt_keyslot_context_set_key_cache(cd, 1, kc));
+
+	EQ_(crypt_volume_key_get_by_keyslot_context(cd, CRYPT_ANY_SLOT, key2, &key_size, kc), 0);
+	OK_(memcmp(key, key2, key_size));
+
+	/* cached key is used even if keyslot binary area is damaged */
+	OK_(crypt_keyslot_area(cd, 0, &offset, &length));
+	GE_(snprintf(cmd, sizeof(cmd), "dd if=/dev/urandom of=" DMDIR L_DEVICE_OK " bs=1 count=512 seek=%" PRIu64
+		" conv=notrunc 2>/dev/null", offset), 0);
+	OK_(_system(cmd, 1));
+	FAIL_(crypt_activate_by_passphrase(cd, NULL, 0, PASSPHRASE, strlen(PASSPHRASE), 0), "Damaged keyslot");
+	memset(key2, 0, key_size);
+	EQ_(crypt_volume_key_get_by_keyslot_context(cd, CRYPT_ANY_SLOT, key2, &key_size, kc), 0);
+	OK_(memcmp(key, key2, key_size));
+	EQ_(crypt_keyslot_add_by_keyslot_context(cd, 0, kc, 1, kc, 0), 1);
+	EQ_(crypt_activate_by_passphrase(cd, NULL, 1, PASSPHRASE, strlen(PASSPHRASE), 0), 1);
+
+	/* ... but not for a rewritten keyslot */
+	OK_(crypt_keyslot_destroy(cd, 0));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, key, key_size, PASSPHRASE1, strlen(PASSPHRASE1)), 0);
+	FAIL_(crypt_volume_key_get_by_keyslot_context(cd, 0, key2, &key_size, kc), "Keyslot rewritten");
+	EQ_(crypt_volume_key_get_by_keyslot_context(cd, CRYPT_ANY_SLOT, key2, &key_size, kc), 1);
+
+	/* disabled cache wipes the key */
+	OK_(crypt_keyslot_area(cd, 1, &offset, &length));
+	GE_(snprintf(cmd, sizeof(cmd), "dd if=/dev/urandom of=" DMDIR L_DEVICE_OK " bs=1 count=512 seek=%" PRIu64
+		" conv=notrunc 2>/dev/null", offset), 0);
+	OK_(_system(cmd, 1));
+	EQ_(crypt_volume_key_get_by_keyslot_context(cd, CRYPT_ANY_SLOT, key2, &key_size, kc), 1);
+	OK_(crypt_keyslot_context_set_key_cache(cd, 0, kc));
+	FAIL_(crypt_volume_key_get_by_keyslot_context(cd, CRYPT_ANY_SLOT, key2, &key_size, kc), "Damaged keyslot");
+
+	crypt_keyslot_context_free(kc);
+	crypt_keyslot_context_free(kc_key);
+	CRYPT_FREE(cd);
+	_cleanup_dmdevices();
+}
+
+static void Luks2KeyslotHint(void)
+{
+	const char *passphrases[4] = { "aaaaaaa0", "aaaaaaa1", "aaaaaaa2", "aaaaaaa3" };
+	uint64_t r_payload_offset;
+	const char *json;
+	int i;
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, r_payload_offset + 1));
+
+	FAIL_(crypt_set_keyslot_hint(NULL, "user"), "No context");
+	FAIL_(crypt_keyslot_set_hint(NULL, 0, "user"), "No context");
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	FAIL_(crypt_keyslot_set_hint(cd, 0, "user"), "Not LUKS2 device");
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, 32, NULL));
+	for (i = 0; i < 4; i++)
+		EQ_(crypt_keyslot_add_by_volume_key(cd, i, NULL, 0, passphrases[i], 8), i);
+
+	FAIL_(crypt_set_keyslot_hint(cd, ""), "Empty hint");
+	FAIL_(crypt_keyslot_set_hint(cd, 0, ""), "Empty hint");
+	FAIL_(crypt_keyslot_set_hint(cd, -1, "user"), "Invalid keyslot");
+	FAIL_(crypt_keyslot_set_hint(cd, crypt_keyslot_max(CRYPT_LUKS2), "user"), "Invalid keyslot");
+	FAIL_(crypt_keyslot_set_hint(cd, 5, "user"), "Inactive keyslot");
+	OK_(crypt_keyslot_set_hint(cd, 2, "user"));
+	OK_(crypt_keyslot_set_hint(cd, 3, "other"));
+	OK_(crypt_dump_json(cd, &json, 0));
+	OK_(!strstr(json, "\"hint\""));
+	OK_(strstr(json, "user") != NULL);
+	CRYPT_FREE(cd);
+
+	/* hint only changes order of unlock attempts */
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	OK_(crypt_set_keyslot_hint(cd, "user"));
+	for (i = 0; i < 4; i++)
+		EQ_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, passphrases[i], 8, 0), i);
+	OK_(crypt_set_keyslot_parallel_unlock(cd, 4));
+	for (i = 0; i < 4; i++)
+		EQ_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, passphrases[i], 8, 0), i);
+	EQ_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, "wrong", 5, 0), -EPERM);
+	OK_(crypt_set_keyslot_hint(cd, NULL));
+	OK_(crypt_keyslot_set_hint(cd, 2, NULL));
+	OK_(crypt_keyslot_set_hint(cd, 3, NULL));
+	OK_(crypt_dump_json(cd, &json, 0));
+	OK_(strstr(json, "\"hint\"") != NULL);
+	EQ_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, passphrases[2], 8, 0), 2);
+	CRYPT_FREE(cd);
+
+	_cleanup_dmdevices();
+}
+
+static void ActivationBatch(void)
+{
+	struct crypt_device *cd2;
+	uint64_t r_payload_offset;
+
+	FAIL_(crypt_activate_batch_end(NULL), "No batch");
+	OK_(crypt_activate_batch_begin(NULL));
+	EQ_(crypt_activate_batch_begin(NULL), -EBUSY);
+	OK_(crypt_activate_batch_end(NULL));
+	FAIL_(crypt_activate_batch_end(NULL), "No batch");
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, r_payload_offset + 1));
+	OK_(crypt_init(&cd2, DMDIR L_DEVICE_OK));
+	OK_(crypt_set_pbkdf_type(cd2, &min_pbkdf2));
+	OK_(crypt_format(cd2, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, 32, NULL));
+	EQ_(crypt_keyslot_add_by_volume_key(cd2, 0, NULL, 0, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	OK_(crypt_init(&cd, DEVICE_1));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+
+	/* devices activated in batch are available after batch end */
+	OK_(crypt_activate_batch_begin(cd));
+	EQ_(crypt_activate_by_passphrase(cd, CDEVICE_1, CRYPT_ANY_SLOT, KEY1, strlen(KEY1), 0), 0);
+	EQ_(crypt_activate_by_passphrase(cd2, CDEVICE_2, 0, PASSPHRASE, strlen(PASSPHRASE), 0), 0);
+	FAIL_(crypt_activate_by_passphrase(cd2, CDEVICE_2, 0, PASSPHRASE, strlen(PASSPHRASE), 0), "Already active");
+	OK_(crypt_activate_batch_end(cd));
+	GE_(crypt_status(cd, CDEVICE_1), CRYPT_ACTIVE);
+	GE_(crypt_status(cd2, CDEVICE_2), CRYPT_ACTIVE);
+
+	OK_(crypt_deactivate(cd, CDEVICE_1));
+	OK_(crypt_deactivate(cd2, CDEVICE_2));
+	CRYPT_FREE(cd);
+	CRYPT_FREE(cd2);
+	_cleanup_dmdevices();
+}
+
+/* LUKS UUID as used in DM-UUID (without dashes) */
+static const char *_dm_uuid(const char *uuid, char *buf)
+{
+	char *p = buf;
+
+	while (*uuid) {
+		if (*uuid != '-')
+			*p++ = *uuid;
+		uuid++;
+	}
+	*p = '\0';
+	return buf;
+}
+
+static void ActiveDevicesQuery(void)
+{
+	struct crypt_active_device_entry *entries;
+	struct crypt_device *cd2;
+	uint64_t r_payload_offset;
+	char uuid[40];
+	size_t count, i;
+	int found = 0;
+
+	FAIL_(crypt_get_active_devices(NULL, NULL, &count), "No entries");
+	FAIL_(crypt_get_active_devices(NULL, &entries, NULL), "No count");
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, r_payload_offset + 1));
+	OK_(crypt_init(&cd2, DMDIR L_DEVICE_OK));
+	OK_(crypt_set_pbkdf_type(cd2, &min_pbkdf2));
+	OK_(crypt_format(cd2, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, 32, NULL));
+	EQ_(crypt_keyslot_add_by_volume_key(cd2, 0, NULL, 0, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	OK_(crypt_init(&cd, DEVICE_1));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	EQ_(crypt_activate_by_passphrase(cd, CDEVICE_1, CRYPT_ANY_SLOT, KEY1, strlen(KEY1), 0), 0);
+	EQ_(crypt_activate_by_passphrase(cd2, CDEVICE_2, 0, PASSPHRASE, strlen(PASSPHRASE), 0), 0);
+
+	/* all active devices in one query */
+	OK_(crypt_get_active_devices(cd, &entries, &count));
+	GE_(count, 2);
+	for (i = 0; i < count; i++) {
+		if (!strcmp(entries[i].name, CDEVICE_1)) {
+			OK_(strcmp(entries[i].type, CRYPT_LUKS2));
+			OK_(!strstr(entries[i].uuid, _dm_uuid(crypt_get_uuid(cd), uuid)));
+			EQ_(entries[i].info.offset, crypt_get_data_offset(cd));
+			found++;
+		} else if (!strcmp(entries[i].name, CDEVICE_2)) {
+			OK_(strcmp(entries[i].type, CRYPT_LUKS2));
+			OK_(!strstr(entries[i].uuid, _dm_uuid(crypt_get_uuid(cd2), uuid)));
+			found++;
+		}
+	}
+	free(entries);
+	EQ_(found, 2);
+
+	OK_(crypt_deactivate(cd, CDEVICE_1));
+	OK_(crypt_deactivate(cd2, CDEVICE_2));
+	CRYPT_FREE(cd);
+	CRYPT_FREE(cd2);
+	_cleanup_dmdevices();
+}
+
+static void DeactivationBatch(void)
+{
+	const char *names[] = { CDEVICE_1, CDEVICE_2 }, *wrong[] = { CDEVICE_WRONG };
+	struct crypt_device *cd2;
+	uint64_t r_payload_offset;
+
+	FAIL_(crypt_deactivate_batch(NULL, NULL, 2, 0), "No names");
+	FAIL_(crypt_deactivate_batch(NULL, names, 0, 0), "No names");
+	FAIL_(crypt_deactivate_batch(NULL, names, 2, CRYPT_DEACTIVATE_DEFERRED_CANCEL), "Deferred cancel");
+	OK_(crypt_activate_batch_begin(NULL));
+	EQ_(crypt_deactivate_batch(NULL, names, 2, 0), -EBUSY);
+	OK_(crypt_activate_batch_end(NULL));
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, r_payload_offset + 1));
+	OK_(crypt_init(&cd2, DMDIR L_DEVICE_OK));
+	OK_(crypt_set_pbkdf_type(cd2, &min_pbkdf2));
+	OK_(crypt_format(cd2, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, 32, NULL));
+	EQ_(crypt_keyslot_add_by_volume_key(cd2, 0, NULL, 0, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	OK_(crypt_init(&cd, DEVICE_1));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	EQ_(crypt_activate_by_passphrase(cd, CDEVICE_1, CRYPT_ANY_SLOT, KEY1, strlen(KEY1), 0), 0);
+	EQ_(crypt_activate_by_passphrase(cd2, CDEVICE_2, 0, PASSPHRASE, strlen(PASSPHRASE), 0), 0);
+
+	FAIL_(crypt_deactivate_batch(cd, wrong, 1, 0), "No such device");
+	OK_(crypt_deactivate_batch(cd, names, 2, 0));
+	EQ_(crypt_status(cd, CDEVICE_1), CRYPT_INACTIVE);
+	EQ_(crypt_status(cd2, CDEVICE_2), CRYPT_INACTIVE);
+	FAIL_(crypt_deactivate_batch(cd, names, 2, 0), "Not active");
+
+	CRYPT_FREE(cd);
+	CRYPT_FREE(cd2);
+	_cleanup_dmdevices();
+}
+
+static void Luks2OptimisticRead(void)
+{
+	struct crypt_device *cd2;
+	uint64_t r_payload_offset;
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, r_payload_offset + 1));
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, 32, NULL));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 0, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	CRYPT_FREE(cd);
+
+	OK_(crypt_metadata_read_optimistic(NULL, 1));
+
+	/* header changed by other context is read again */
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	EQ_(crypt_keyslot_status(cd, 0), CRYPT_SLOT_ACTIVE_LAST);
+	OK_(crypt_init(&cd2, DMDIR L_DEVICE_OK));
+	OK_(crypt_load(cd2, CRYPT_LUKS2, NULL));
+	EQ_(crypt_keyslot_add_by_passphrase(cd2, 1, PASSPHRASE, strlen(PASSPHRASE), PASSPHRASE1, strlen(PASSPHRASE1)), 1);
+	CRYPT_FREE(cd2);
+	CRYPT_FREE(cd);
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	EQ_(crypt_keyslot_status(cd, 1), CRYPT_SLOT_ACTIVE);
+
+	/* metadata write after optimistic read still respects on-disk header */
+	OK_(crypt_keyslot_destroy(cd, 1));
+	CRYPT_FREE(cd);
+
+	/* damaged secondary header falls back to locked read with recovery */
+	_system("dd if=/dev/urandom of=" DMDIR L_DEVICE_OK " bs=512 count=1 seek=40 conv=notrunc 2>/dev/null", 1);
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	EQ_(crypt_keyslot_status(cd, 0), CRYPT_SLOT_ACTIVE_LAST);
+	EQ_(crypt_keyslot_status(cd, 1), CRYPT_SLOT_INACTIVE);
+	CRYPT_FREE(cd);
+	OK_(_system("cmp -s -n 12288 -i 4096:20480 " DMDIR L_DEVICE_OK " " DMDIR L_DEVICE_OK, 1));
+
+	OK_(crypt_metadata_read_optimistic(NULL, 0));
+
+	_cleanup_dmdevices();
+}
+
+static void Luks2KeyslotDestroyAll(void)
+{
+	uint64_t r_payload_offset;
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, r_payload_offset + 1));
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, 32, NULL));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 0, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 1, NULL, 0, PASSPHRASE1, strlen(PASSPHRASE1)), 1);
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 7, NULL, 0, PASSPHRASE1, strlen(PASSPHRASE1)), 7);
+	EQ_(crypt_keyslot_add_by_key(cd, 3, NULL, 32, PASSPHRASE, strlen(PASSPHRASE), CRYPT_VOLUME_KEY_NO_SEGMENT), 3);
+	EQ_(crypt_keyslot_status(cd, 3), CRYPT_SLOT_UNBOUND);
+
+	/* unbound keyslots are kept */
+	OK_(crypt_keyslot_destroy_all(cd));
+	EQ_(crypt_keyslot_status(cd, 0), CRYPT_SLOT_INACTIVE);
+	EQ_(crypt_keyslot_status(cd, 1), CRYPT_SLOT_INACTIVE);
+	EQ_(crypt_keyslot_status(cd, 7), CRYPT_SLOT_INACTIVE);
+	EQ_(crypt_keyslot_status(cd, 3), CRYPT_SLOT_UNBOUND);
+	FAIL_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, PASSPHRASE, strlen(PASSPHRASE), 0), "No keyslot");
+	OK_(crypt_keyslot_destroy_all(cd));
+	CRYPT_FREE(cd);
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	EQ_(crypt_keyslot_status(cd, 0), CRYPT_SLOT_INACTIVE);
+	EQ_(crypt_keyslot_status(cd, 7), CRYPT_SLOT_INACTIVE);
+	EQ_(crypt_keyslot_status(cd, 3), CRYPT_SLOT_UNBOUND);
+	CRYPT_FREE(cd);
+
+	_cleanup_dmdevices();
+}
+
+static void Luks2MetadataLockHold(void)
+{
+	struct crypt_device *cd2;
+	uint64_t r_payload_offset;
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, r_payload_offset + 1));
+
+	FAIL_(crypt_metadata_lock_hold(NULL, 1), "No context");
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, 32, NULL));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 0, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	CRYPT_FREE(cd);
+
+	/* kept lock handle does not block other context on the same device */
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_metadata_lock_hold(cd, 1));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	OK_(crypt_init(&cd2, DMDIR L_DEVICE_OK));
+	OK_(crypt_load(cd2, CRYPT_LUKS2, NULL));
+	OK_(crypt_set_pbkdf_type(cd2, &min_pbkdf2));
+	EQ_(crypt_keyslot_add_by_passphrase(cd2, 1, PASSPHRASE, strlen(PASSPHRASE), PASSPHRASE1, strlen(PASSPHRASE1)), 1);
+	CRYPT_FREE(cd2);
+
+	/* header changed by the other context is detected on write */
+	FAIL_(crypt_keyslot_destroy(cd, 0), "Header changed on disk");
+	CRYPT_FREE(cd);
+
+	/* kept handle is locked again for a write, also from both contexts in turn */
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_metadata_lock_hold(cd, 1));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	OK_(crypt_init(&cd2, DMDIR L_DEVICE_OK));
+	OK_(crypt_metadata_lock_hold(cd2, 1));
+	OK_(crypt_load(cd2, CRYPT_LUKS2, NULL));
+	EQ_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, PASSPHRASE1, strlen(PASSPHRASE1), 0), 1);
+	OK_(crypt_keyslot_destroy(cd, 1));
+	EQ_(crypt_keyslot_status(cd, 1), CRYPT_SLOT_INACTIVE);
+	FAIL_(crypt_keyslot_destroy(cd2, 0), "Header changed on disk");
+	CRYPT_FREE(cd2);
+	OK_(crypt_init(&cd2, DMDIR L_DEVICE_OK));
+	OK_(crypt_metadata_lock_hold(cd2, 1));
+	OK_(crypt_load(cd2, CRYPT_LUKS2, NULL));
+	EQ_(crypt_keyslot_status(cd2, 1), CRYPT_SLOT_INACTIVE);
+	OK_(crypt_set_pbkdf_type(cd2, &min_pbkdf2));
+	EQ_(crypt_keyslot_add_by_passphrase(cd2, 1, PASSPHRASE, strlen(PASSPHRASE), PASSPHRASE1, strlen(PASSPHRASE1)), 1);
+	OK_(crypt_metadata_lock_hold(cd2, 0));
+	CRYPT_FREE(cd2);
+	OK_(crypt_metadata_lock_hold(cd, 0));
+	CRYPT_FREE(cd);
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	EQ_(crypt_keyslot_status(cd, 1), CRYPT_SLOT_ACTIVE);
+	CRYPT_FREE(cd);
+
+	_cleanup_dmdevices();
+}
+
+static int _read_head(const char *path, char *buf, size_t size)
+{
+	int fd, r;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+
+	r = read(fd, buf, size) == (ssize_t)size ? 0 : -EIO;
+	close(fd);
+	return r;
+}
+
+static void ResizeGrowActive(void)
+{
+	struct crypt_params_plain params_plain = {
+		.hash = NULL,
+		.skip = 0,
+		.offset = 0,
+		.size = 1024,
+	};
+	struct crypt_active_device cad;
+	const char *vk_hex = "bb21158c733229347bd4e681891e213d94c685be6a5b84818afe7a78a6de7a1a";
+	size_t key_size = strlen(vk_hex) / 2;
+	char key[128], data[32*TST_SECTOR_SIZE], data2[32*TST_SECTOR_SIZE];
+	uint64_t r_payload_offset, r_size;
+
+	crypt_decode_key(key, vk_hex, key_size);
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, r_payload_offset + 4096));
+
+	/* plain device, key is always in the table */
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_format(cd, CRYPT_PLAIN, "aes", "cbc-essiv:sha256", NULL, NULL, key_size, &params_plain));
+	OK_(crypt_activate_by_volume_key(cd, CDEVICE_1, key, key_size, 0));
+	OK_(_read_head(DMDIR CDEVICE_1, data, sizeof(data)));
+	OK_(crypt_resize(cd, CDEVICE_1, 2048));
+	OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+	EQ_(cad.size, 2048);
+	if (!t_device_size(DMDIR CDEVICE_1, &r_size))
+		EQ_(2048, r_size >> TST_SECTOR_SHIFT);
+	OK_(_read_head(DMDIR CDEVICE_1, data2, sizeof(data2)));
+	OK_(memcmp(data, data2, sizeof(data)));
+	OK_(crypt_resize(cd, CDEVICE_1, 0));
+	OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+	EQ_(cad.size, r_payload_offset + 4096);
+	OK_(_read_head(DMDIR CDEVICE_1, data2, sizeof(data2)));
+	OK_(memcmp(data, data2, sizeof(data)));
+	OK_(crypt_deactivate(cd, CDEVICE_1));
+	CRYPT_FREE(cd);
+
+	/* LUKS2 device with volume key in the table */
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_volume_key_keyring(cd, 0));
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "xts-plain64", NULL, key, key_size, NULL));
+	OK_(crypt_activate_by_volume_key(cd, CDEVICE_1, key, key_size, 0));
+	OK_(crypt_resize(cd, CDEVICE_1, 1024));
+	OK_(_read_head(DMDIR CDEVICE_1, data, sizeof(data)));
+	OK_(crypt_resize(cd, CDEVICE_1, 2048));
+	OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+	EQ_(cad.size, 2048);
+	EQ_(cad.offset, r_payload_offset);
+	if (!t_device_size(DMDIR CDEVICE_1, &r_size))
+		EQ_(2048, r_size >> TST_SECTOR_SHIFT);
+	OK_(_read_head(DMDIR CDEVICE_1, data2, sizeof(data2)));
+	OK_(memcmp(data, data2, sizeof(data)));
+	FAIL_(crypt_resize(cd, CDEVICE_1, 4097), "Device too small");
+	OK_(crypt_resize(cd, CDEVICE_1, 0));
+	OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+	EQ_(cad.size, 4096);
+	OK_(_read_head(DMDIR CDEVICE_1, data2, sizeof(data2)));
+	OK_(memcmp(data, data2, sizeof(data)));
+	OK_(crypt_deactivate(cd, CDEVICE_1));
+	CRYPT_FREE(cd);
+
+#ifdef KERNEL_KEYRING
+	/* LUKS2 device with volume key in kernel keyring uses the full table reload */
+	if (t_dm_crypt_keyring_support()) {
+		OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+		OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+		OK_(crypt_volume_key_keyring(cd, 1));
+		OK_(crypt_activate_by_volume_key(cd, CDEVICE_1, key, key_size, 0));
+		OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+		EQ_(cad.flags & CRYPT_ACTIVATE_KEYRING_KEY, CRYPT_ACTIVATE_KEYRING_KEY);
+		OK_(crypt_resize(cd, CDEVICE_1, 1024));
+		OK_(_read_head(DMDIR CDEVICE_1, data, sizeof(data)));
+		OK_(crypt_resize(cd, CDEVICE_1, 2048));
+		OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+		EQ_(cad.size, 2048);
+		EQ_(cad.flags & CRYPT_ACTIVATE_KEYRING_KEY, CRYPT_ACTIVATE_KEYRING_KEY);
+		if (!t_device_size(DMDIR CDEVICE_1, &r_size))
+			EQ_(2048, r_size >> TST_SECTOR_SHIFT);
+		OK_(_read_head(DMDIR CDEVICE_1, data2, sizeof(data2)));
+		OK_(memcmp(data, data2, sizeof(data)));
+		/* key dropped from keyring, grow must fail and keep the device */
+		OK_(_drop_keyring_key(cd, 0));
+		FAIL_(crypt_resize(cd, CDEVICE_1, 3072), "Unable to find volume key in keyring");
+		OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+		EQ_(cad.size, 2048);
+		OK_(crypt_deactivate(cd, CDEVICE_1));
+		CRYPT_FREE(cd);
+	}
+#endif
+	_cleanup_dmdevices();
+}
+
+static void ReloadPerformanceFlags(void)
+{
+	const uint32_t perf_flags = CRYPT_ACTIVATE_SAME_CPU_CRYPT | CRYPT_ACTIVATE_SUBMIT_FROM_CRYPT_CPUS;
+	struct crypt_active_device cad;
+	const char *vk_hex = "bb21158c733229347bd4e681891e213d94c685be6a5b84818afe7a78a6de7a1a";
+	size_t key_size = strlen(vk_hex) / 2;
+	char key[128], data[32*TST_SECTOR_SIZE], data2[32*TST_SECTOR_SIZE];
+	uint32_t flags = 0;
+	uint64_t r_payload_offset;
+
+	crypt_decode_key(key, vk_hex, key_size);
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, r_payload_offset + 4096));
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	OK_(crypt_volume_key_keyring(cd, 0));
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "xts-plain64", NULL, key, key_size, NULL));
+
+	FAIL_(crypt_reload_performance_flags(NULL, CDEVICE_1, 0), "No context");
+	FAIL_(crypt_reload_performance_flags(cd, NULL, 0), "No name");
+	FAIL_(crypt_reload_performance_flags(cd, CDEVICE_1, 0), "Not active");
+
+	if (t_dm_crypt_discard_support())
+		flags = CRYPT_ACTIVATE_ALLOW_DISCARDS;
+	OK_(crypt_activate_by_volume_key(cd, CDEVICE_1, key, key_size, flags));
+	OK_(_read_head(DMDIR CDEVICE_1, data, sizeof(data)));
+
+	/* only performance flags can be changed */
+	FAIL_(crypt_reload_performance_flags(cd, CDEVICE_1, CRYPT_ACTIVATE_READONLY), "Not a performance flag");
+	FAIL_(crypt_reload_performance_flags(cd, CDEVICE_1, CRYPT_ACTIVATE_ALLOW_DISCARDS), "Not a performance flag");
+	FAIL_(crypt_reload_performance_flags(cd, L_DEVICE_OK, CRYPT_ACTIVATE_SAME_CPU_CRYPT), "Not a dm-crypt device");
+
+	/* unchanged flags, nothing to reload */
+	OK_(crypt_reload_performance_flags(cd, CDEVICE_1, 0));
+
+	if (t_dm_crypt_cpu_switch_support()) {
+		OK_(crypt_reload_performance_flags(cd, CDEVICE_1, perf_flags));
+		OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+		EQ_(cad.flags & perf_flags, perf_flags);
+		EQ_(cad.flags & CRYPT_ACTIVATE_ALLOW_DISCARDS, flags);
+		OK_(_read_head(DMDIR CDEVICE_1, data2, sizeof(data2)));
+		OK_(memcmp(data, data2, sizeof(data)));
+		OK_(crypt_reload_performance_flags(cd, CDEVICE_1, perf_flags));
+
+		OK_(crypt_reload_performance_flags(cd, CDEVICE_1, CRYPT_ACTIVATE_SAME_CPU_CRYPT));
+		OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+		EQ_(cad.flags & perf_flags, CRYPT_ACTIVATE_SAME_CPU_CRYPT);
+		OK_(crypt_reload_performance_flags(cd, CDEVICE_1, 0));
+		OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+		EQ_(cad.flags & perf_flags, 0);
+		EQ_(cad.flags & CRYPT_ACTIVATE_ALLOW_DISCARDS, flags);
+	}
+	OK_(crypt_deactivate(cd, CDEVICE_1));
+
+#ifdef KERNEL_KEYRING
+	/* volume key stays referenced in keyring */
+	if (t_dm_crypt_keyring_support() && t_dm_crypt_cpu_switch_support()) {
+		OK_(crypt_volume_key_keyring(cd, 1));
+		OK_(crypt_activate_by_volume_key(cd, CDEVICE_1, key, key_size, 0));
+		OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+		EQ_(cad.flags & CRYPT_ACTIVATE_KEYRING_KEY, CRYPT_ACTIVATE_KEYRING_KEY);
+		OK_(crypt_reload_performance_flags(cd, CDEVICE_1, perf_flags));
+		OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+		EQ_(cad.flags & (perf_flags | CRYPT_ACTIVATE_KEYRING_KEY), perf_flags | CRYPT_ACTIVATE_KEYRING_KEY);
+		OK_(_read_head(DMDIR CDEVICE_1, data2, sizeof(data2)));
+		OK_(memcmp(data, data2, sizeof(data)));
+		OK_(crypt_deactivate(cd, CDEVICE_1));
+	}
+#endif
+	CRYPT_FREE(cd);
+
+	_cleanup_dmdevices();
+}
+
+static void MemoryUsage(void)
+{
+	struct crypt_pbkdf_type argon2 = {
+		.type = "argon2id",
+		.iterations = 4,
+		.max_memory_kb = 64,
+		.parallel_threads = 1,
+		.flags = CRYPT_PBKDF_NO_BENCHMARK
+	};
+	struct crypt_memory_usage usage, usage2;
+	uint64_t r_payload_offset;
+	char *safe;
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(L_DEVICE_OK, r_payload_offset + 1));
+
+	OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+	FAIL_(crypt_get_memory_usage(NULL, &usage), "No context");
+	FAIL_(crypt_get_memory_usage(cd, NULL), "No usage");
+	OK_(crypt_get_memory_usage(cd, &usage));
+	EQ_(usage.kdf_peak, 0);
+	EQ_(usage.io_peak, 0);
+	GE_(usage.safe_peak, usage.safe_current);
+
+	/* safe memory is accounted process-wide */
+	safe = crypt_safe_alloc(4096);
+	NOTNULL_(safe);
+	OK_(crypt_get_memory_usage(cd, &usage2));
+	GE_(usage2.safe_current, usage.safe_current + 4096);
+	GE_(usage2.safe_peak, usage2.safe_current);
+	crypt_safe_free(safe);
+	OK_(crypt_get_memory_usage(cd, &usage2));
+	EQ_(usage2.safe_current, usage.safe_current);
+	GE_(usage2.safe_peak, usage.safe_current + 4096);
+
+	/* PBKDF2 has no memory cost */
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, 64, NULL));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 0, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	EQ_(crypt_activate_by_passphrase(cd, NULL, 0, PASSPHRASE, strlen(PASSPHRASE), 0), 0);
+	OK_(crypt_get_memory_usage(cd, &usage));
+	EQ_(usage.kdf_peak, 0);
+	EQ_(usage.io_peak, 0);
+
+	if (!_fips_mode) {
+		OK_(crypt_set_pbkdf_type(cd, &argon2));
+		EQ_(crypt_keyslot_add_by_volume_key(cd, 1, NULL, 0, PASSPHRASE1, strlen(PASSPHRASE1)), 1);
+		OK_(crypt_get_memory_usage(cd, &usage));
+		EQ_(usage.kdf_peak, 64 * 1024);
+		CRYPT_FREE(cd);
+
+		/* peak is per context, it starts from zero */
+		OK_(crypt_init(&cd, DMDIR L_DEVICE_OK));
+		OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+		OK_(crypt_get_memory_usage(cd, &usage));
+		EQ_(usage.kdf_peak, 0);
+		EQ_(crypt_activate_by_passphrase(cd, NULL, 0, PASSPHRASE, strlen(PASSPHRASE), 0), 0);
+		OK_(crypt_get_memory_usage(cd, &usage));
+		EQ_(usage.kdf_peak, 0);
+		EQ_(crypt_activate_by_passphrase(cd, NULL, 1, PASSPHRASE1, strlen(PASSPHRASE1), 0), 1);
+		OK_(crypt_get_memory_usage(cd, &usage));
+		EQ_(usage.kdf_peak, 64 * 1024);
+		EQ_(usage.io_peak, 0);
+	}
+	CRYPT_FREE(cd);
+
+	_cleanup_dmdevices();
+}
+
+static void Luks2KeyslotConvert(void)
+{
+	struct crypt_pbkdf_type pbkdf, conv = {
+		.type = CRYPT_KDF_PBKDF2,
+		.hash = "sha256",
+		.iterations = 2000,
+		.flags = CRYPT_PBKDF_NO_BENCHMARK
+	};
+	struct crypt_params_luks2 params = {
+		.sector_size = 512
+	};
+	int keyslots[3] = { 0, 1, 2 }, dup[2] = { 1, 1 }, inactive[2] = { 0, 5 };
+	const char *passphrases[3] = { PASSPHRASE, PASSPHRASE1, PASSPHRASE };
+	const char *wrong[3] = { PASSPHRASE, PASSPHRASE, PASSPHRASE };
+	size_t sizes[3] = { strlen(PASSPHRASE), strlen(PASSPHRASE1), strlen(PASSPHRASE) };
+	uint64_t r_payload_offset, offset[3], length, new_offset;
+	int i;
+
+	OK_(get_luks2_offsets(0, 0, 0, NULL, &r_payload_offset));
+	OK_(create_dmdevice_over_loop(H_DEVICE, r_payload_offset + 1));
+
+	OK_(crypt_init(&cd, DMDIR H_DEVICE));
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS2, "aes", "xts-plain64", NULL, NULL, 32, &params));
+	for (i = 0; i < 3; i++) {
+		EQ_(crypt_keyslot_add_by_volume_key(cd, i, NULL, 0, passphrases[i], sizes[i]), i);
+		OK_(crypt_keyslot_area(cd, i, &offset[i], &length));
+	}
+	CRYPT_FREE(cd);
+
+	OK_(crypt_init(&cd, DMDIR H_DEVICE));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	OK_(crypt_set_pbkdf_type(cd, &conv));
+
+	/* invalid parameters */
+	FAIL_(crypt_keyslot_convert_by_passphrases(cd, keyslots, passphrases, sizes, 0), "No keyslot");
+	FAIL_(crypt_keyslot_convert_by_passphrases(cd, dup, passphrases, sizes, 2), "Duplicate keyslot");
+	FAIL_(crypt_keyslot_convert_by_passphrases(cd, inactive, passphrases, sizes, 2), "Inactive keyslot");
+
+	/* one wrong passphrase, nothing is converted */
+	FAIL_(crypt_keyslot_convert_by_passphrases(cd, keyslots, wrong, sizes, 3), "Wrong passphrase");
+	for (i = 0; i < 3; i++) {
+		OK_(crypt_keyslot_get_pbkdf(cd, i, &pbkdf));
+		EQ_(pbkdf.iterations, min_pbkdf2.iterations);
+		OK_(crypt_keyslot_area(cd, i, &new_offset, &length));
+		EQ_(new_offset, offset[i]);
+	}
+
+	OK_(crypt_keyslot_convert_by_passphrases(cd, keyslots, passphrases, sizes, 3));
+	CRYPT_FREE(cd);
+
+	/* converted keyslots are moved to free areas and keep their passphrases */
+	OK_(crypt_init(&cd, DMDIR H_DEVICE));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	for (i = 0; i < 3; i++) {
+		OK_(crypt_keyslot_get_pbkdf(cd, i, &pbkdf));
+		EQ_(pbkdf.iterations, conv.iterations);
+		OK_(crypt_keyslot_area(cd, i, &new_offset, &length));
+		OK_(new_offset == offset[i]);
+		EQ_(crypt_activate_by_passphrase(cd, NULL, i, passphrases[i], sizes[i], 0), i);
+	}
+	FAIL_(crypt_activate_by_passphrase(cd, NULL, 1, PASSPHRASE, strlen(PASSPHRASE), 0), "Wrong passphrase");
+	CRYPT_FREE(cd);
+
+	_cleanup_dmdevices();
+}
+
 static void VolumeKeyGet(void)
 {
 	struct crypt_params_luks2 params = {
@@ -5117,6 +6534,7 @@ int main(int argc, char *argv[])
 	RUN_(SuspendDevice, "LUKS2 Suspend/Resume");
 	RUN_(UseTempVolumes, "Format and use temporary encrypted device");
 	RUN_(Tokens, "General tokens API");
+	RUN_(TokensParallel, "Parallel token open");
 	RUN_(TokenActivationByKeyring, "Builtin kernel keyring token");
 	RUN_(LuksConvert, "LUKS1 <-> LUKS2 conversions");
 	RUN_(Pbkdf, "Default PBKDF manipulation routines");
@@ -5129,8 +6547,28 @@ int main(int argc, char *argv[])
 	RUN_(Luks2Flags, "LUKS2 persistent flags");
 #if KERNEL_KEYRING && USE_LUKS2_REENCRYPTION
 	RUN_(Luks2Reencryption, "LUKS2 reencryption");
+	RUN_(Luks2ReencryptionSparse, "LUKS2 sparse reencryption");
+	RUN_(Luks2ReencryptionTuning, "LUKS2 reencryption tuning");
 #endif
 	RUN_(LuksKeyslotAdd, "Adding keyslot via new API");
+	RUN_(Luks2KeyslotConvert, "LUKS2 keyslot conversion");
+	RUN_(Luks2KeyslotParallelUnlock, "LUKS2 parallel keyslot unlock");
+	RUN_(Luks2PassphraseBatch, "LUKS2 passphrase batch test");
+	RUN_(Luks2HeaderCache, "LUKS2 header cache");
+	RUN_(Luks2HeaderTransaction, "LUKS2 header transaction");
+	RUN_(Luks2DumpJsonUnlocked, "LUKS2 unlocked JSON dump");
+	RUN_(Luks2StagedVolumeKey, "Volume key staged in kernel keyring");
+	RUN_(Luks2KeyslotContextKeyCache, "Keyslot context volume key cache");
+	RUN_(Luks2KeyslotHint, "LUKS2 keyslot hints");
+	RUN_(ActivationBatch, "Batch activation with single udev sync");
+	RUN_(ActiveDevicesQuery, "Bulk status query of active devices");
+	RUN_(DeactivationBatch, "Batch deactivation");
+	RUN_(Luks2OptimisticRead, "LUKS2 optimistic metadata read");
+	RUN_(Luks2MetadataLockHold, "LUKS2 metadata lock handle kept by two contexts");
+	RUN_(Luks2KeyslotDestroyAll, "Destroy all LUKS2 keyslots");
+	RUN_(ResizeGrowActive, "Grow active plain and LUKS2 device");
+	RUN_(ReloadPerformanceFlags, "Reload performance flags of active device");
+	RUN_(MemoryUsage, "Memory usage accounting");
 	RUN_(VolumeKeyGet, "Getting volume key via keyslot context API");
 	RUN_(Luks2Repair, "LUKS2 repair"); // test disables metadata locking. Run always last!
 
@@ -26,6 +26,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <signal.h>
+#include <poll.h>
 #include <sys/stat.h>
 #include <inttypes.h>
 #include <sys/types.h>
@@ -58,6 +59,18 @@
 #define BACKUP_FILE "csetup_backup_file"
 #define IMAGE1 "compatimage.img"
 #define IMAGE_EMPTY "empty.img"
+#define IMAGE_VERITY_DATA "verity_data.img"
+#define IMAGE_VERITY_HASH "verity_hash.img"
+#define PBKDF_CACHE "pbkdf_cache"
+#define IMAGE_WIPE "wipe.img"
+#define WIPE_CHECKPOINT "wipe_checkpoint"
+#define BITLK_IMAGE "bitlk-images/bitlk-aes-xts-128.img"
+#define BITLK_RECOVERY "235818-357951-253979-013365-241120-245575-342914-591910"
+#define BITLK_PASSPHRASE "anaconda"
+#define BITLK_SHA256SUM "674e3a976927fd62f3fc26df2c695cac75b8d364e3b45393717efa971f16db0f"
+#define BITLK_DECRYPTED "bitlk_decrypted.img"
+#define HEADER_ADOPT "adopt_header.img"
+#define IMAGE_LOOP "loop_dio.img"
 
 #define KEYFILE1 "key1.file"
 #define KEY1 "compatkey"
@@ -137,6 +150,32 @@ static void _remove_keyfiles(void)
 	remove(KEYFILE2);
 }
 
+/* Returns 1 if file area contains only zeroes, 0 if not */
+static int _zeroed(const char *path, off_t offset, size_t length)
+{
+	char buf[4096];
+	size_t i, len;
+	int fd, r = 1;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -EINVAL;
+
+	while (length && r > 0) {
+		len = length > sizeof(buf) ? sizeof(buf) : length;
+		if (pread(fd, buf, len, offset) != (ssize_t)len)
+			r = -EIO;
+		for (i = 0; r > 0 && i < len; i++)
+			if (buf[i])
+				r = 0;
+		offset += len;
+		length -= len;
+	}
+
+	close(fd);
+	return r;
+}
+
 #if HAVE_DECL_DM_TASK_RETRY_REMOVE
 #define DM_RETRY "--retry "
 #else
@@ -207,6 +246,13 @@ static void _cleanup(void)
 
 	_system("rm -f " IMAGE_EMPTY, 0);
 	_system("rm -f " IMAGE1, 0);
+	_system("rm -f " IMAGE_VERITY_DATA " " IMAGE_VERITY_HASH, 0);
+	_system("rm -f " PBKDF_CACHE, 0);
+	_system("rm -f " IMAGE_WIPE, 0);
+	_system("rm -f " WIPE_CHECKPOINT, 0);
+	_system("rm -f " HEADER_ADOPT, 0);
+	_system("rm -f " BITLK_DECRYPTED, 0);
+	_system("rm -f " IMAGE_LOOP, 0);
 
 	if (test_loop_file)
 		remove(test_loop_file);
@@ -298,6 +344,9 @@ static int _setup(void)
 	/* Prepare tcrypt images */
 	_system("tar xJf tcrypt-images.tar.xz 2>/dev/null", 1);
 
+	/* Prepare BITLK images */
+	_system("tar xJf bitlk-images.tar.xz 2>/dev/null", 1);
+
 	_system("modprobe dm-crypt >/dev/null 2>&1", 0);
 	_system("modprobe dm-verity >/dev/null 2>&1", 0);
 	_system("modprobe dm-integrity >/dev/null 2>&1", 0);
@@ -1752,6 +1801,272 @@ static void VerityTest(void)
 	CRYPT_FREE(cd);
 }
 
+static int prefetch_messages = 0;
+static char prefetch_message[256];
+static void prefetch_log(int level, const char *msg, void *usrptr)
+{
+	if (level == CRYPT_LOG_DEBUG && strstr(msg, "to prefetch hash tree")) {
+		prefetch_messages++;
+		snprintf(prefetch_message, sizeof(prefetch_message), "%s", msg);
+	}
+	global_log_callback(level, msg, usrptr);
+}
+
+static void VerityPrefetchHash(void)
+{
+	const char *salt_hex =  "20c28ffc129c12360ba6ceea2b6cf04e89c2b41cfe6b8439eb53c1897f50df7b";
+	char salt[32], root_hash[32], buf1[4096], buf2[4096];
+	size_t root_hash_size = sizeof(root_hash);
+	struct crypt_active_device cad;
+	struct crypt_params_verity params = {
+		.data_device = IMAGE_VERITY_DATA,
+		.hash_name = "sha256",
+		.salt = salt,
+		.salt_size = sizeof(salt),
+		.data_block_size = 512,
+		.hash_block_size = 512,
+		.hash_type = 1,
+		.flags = CRYPT_VERITY_CREATE_HASH,
+	};
+	int fd, r;
+
+	/*
+	 * 512 byte hash block holds 16 sha256 digests, one level 1 hash block
+	 * covers 256 data blocks: 2048 data blocks need 8 readahead requests.
+	 */
+	crypt_decode_key(salt, salt_hex, sizeof(salt));
+	_system("dd if=/dev/urandom of=" IMAGE_VERITY_DATA " bs=512 count=2048 2>/dev/null", 1);
+	_system("dd if=/dev/zero of=" IMAGE_VERITY_HASH " bs=4096 count=64 2>/dev/null", 1);
+
+	OK_(crypt_init(&cd, IMAGE_VERITY_HASH));
+	OK_(crypt_format(cd, CRYPT_VERITY, NULL, NULL, NULL, NULL, 0, &params));
+	OK_(crypt_volume_key_get(cd, CRYPT_ANY_SLOT, root_hash, &root_hash_size, NULL, 0));
+	CRYPT_FREE(cd);
+
+	OK_(crypt_init(&cd, IMAGE_VERITY_HASH));
+	memset(&params, 0, sizeof(params));
+	params.data_device = IMAGE_VERITY_DATA;
+	params.flags = CRYPT_VERITY_CHECK_HASH | CRYPT_VERITY_PREFETCH_HASH;
+	OK_(crypt_load(cd, CRYPT_VERITY, &params));
+	crypt_set_debug_level(CRYPT_DEBUG_ALL);
+	crypt_set_log_callback(cd, &prefetch_log, NULL);
+
+	/* hash check only, there is no device to prefetch through */
+	prefetch_messages = 0;
+	OK_(crypt_activate_by_volume_key(cd, NULL, root_hash, root_hash_size, 0));
+	EQ_(prefetch_messages, 0);
+
+	prefetch_messages = 0;
+	r = crypt_activate_by_volume_key(cd, CDEVICE_1, root_hash, root_hash_size, CRYPT_ACTIVATE_READONLY);
+	if (r == -ENOTSUP) {
+		printf("WARNING: kernel dm-verity not supported, skipping test.\n");
+		crypt_set_log_callback(cd, NULL, NULL);
+		crypt_set_debug_level(_debug ? CRYPT_DEBUG_ALL : CRYPT_DEBUG_NONE);
+		CRYPT_FREE(cd);
+		_system("rm -f " IMAGE_VERITY_DATA " " IMAGE_VERITY_HASH, 0);
+		return;
+	}
+	OK_(r);
+	EQ_(prefetch_messages, 1);
+	NOTNULL_(strstr(prefetch_message, "readahead of 8 block(s)"));
+	OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+	EQ_(CRYPT_ACTIVATE_READONLY, cad.flags);
+
+	/* prefetch does not change what the mapping returns */
+	fd = open(DMDIR CDEVICE_1, O_RDONLY);
+	GE_(fd, 0);
+	EQ_(read(fd, buf1, sizeof(buf1)), (ssize_t)sizeof(buf1));
+	close(fd);
+	fd = open(IMAGE_VERITY_DATA, O_RDONLY);
+	GE_(fd, 0);
+	EQ_(read(fd, buf2, sizeof(buf2)), (ssize_t)sizeof(buf2));
+	close(fd);
+	OK_(memcmp(buf1, buf2, sizeof(buf1)));
+	OK_(crypt_get_active_device(cd, CDEVICE_1, &cad));
+	EQ_(CRYPT_ACTIVATE_READONLY, cad.flags);
+	OK_(crypt_deactivate(cd, CDEVICE_1));
+
+	/* wrong root hash still fails with prefetch requested */
+	root_hash[0] = ~root_hash[0];
+	FAIL_(crypt_activate_by_volume_key(cd, NULL, root_hash, root_hash_size, 0), "Wrong root hash");
+	root_hash[0] = ~root_hash[0];
+	crypt_set_log_callback(cd, NULL, NULL);
+	CRYPT_FREE(cd);
+
+	/* no prefetch without the flag */
+	OK_(crypt_init(&cd, IMAGE_VERITY_HASH));
+	params.flags = CRYPT_VERITY_CHECK_HASH;
+	OK_(crypt_load(cd, CRYPT_VERITY, &params));
+	crypt_set_log_callback(cd, &prefetch_log, NULL);
+	prefetch_messages = 0;
+	OK_(crypt_activate_by_volume_key(cd, CDEVICE_1, root_hash, root_hash_size, CRYPT_ACTIVATE_READONLY));
+	EQ_(prefetch_messages, 0);
+	OK_(crypt_deactivate(cd, CDEVICE_1));
+	crypt_set_log_callback(cd, NULL, NULL);
+	crypt_set_debug_level(_debug ? CRYPT_DEBUG_ALL : CRYPT_DEBUG_NONE);
+	CRYPT_FREE(cd);
+
+	_system("rm -f " IMAGE_VERITY_DATA " " IMAGE_VERITY_HASH, 0);
+}
+
+static void WaitActiveDeviceFailures(void)
+{
+	const char *salt_hex =  "20c28ffc129c12360ba6ceea2b6cf04e89c2b41cfe6b8439eb53c1897f50df7b";
+	char salt[32], root_hash[32];
+	size_t root_hash_size = sizeof(root_hash);
+	struct crypt_params_verity params = {
+		.data_device = IMAGE_VERITY_DATA,
+		.hash_name = "sha256",
+		.salt = salt,
+		.salt_size = sizeof(salt),
+		.data_block_size = 4096,
+		.hash_block_size = 4096,
+		.hash_type = 1,
+		.flags = CRYPT_VERITY_CREATE_HASH,
+	};
+	uint64_t failures;
+	uint32_t event_nr = 0;
+	int r;
+
+	FAIL_(crypt_wait_active_device_failures(NULL, NULL, &event_nr, &failures), "No name");
+	FAIL_(crypt_wait_active_device_failures(NULL, CDEVICE_1, NULL, &failures), "No event counter");
+	FAIL_(crypt_wait_active_device_failures(NULL, CDEVICE_1, &event_nr, NULL), "No failures");
+	FAIL_(crypt_wait_active_device_failures(NULL, CDEVICE_1, &event_nr, &failures), "Not active");
+
+	crypt_decode_key(salt, salt_hex, sizeof(salt));
+	_system("dd if=/dev/urandom of=" IMAGE_VERITY_DATA " bs=4096 count=256 2>/dev/null", 1);
+	_system("dd if=/dev/zero of=" IMAGE_VERITY_HASH " bs=4096 count=16 2>/dev/null", 1);
+	OK_(crypt_init(&cd, IMAGE_VERITY_HASH));
+	OK_(crypt_format(cd, CRYPT_VERITY, NULL, NULL, NULL, NULL, 0, &params));
+	OK_(crypt_volume_key_get(cd, CRYPT_ANY_SLOT, root_hash, &root_hash_size, NULL, 0));
+	r = crypt_activate_by_volume_key(cd, CDEVICE_1, root_hash, root_hash_size, CRYPT_ACTIVATE_READONLY);
+	if (r == -ENOTSUP) {
+		printf("WARNING: kernel dm-verity not supported, skipping test.\n");
+		CRYPT_FREE(cd);
+		_system("rm -f " IMAGE_VERITY_DATA " " IMAGE_VERITY_HASH, 0);
+		return;
+	}
+	OK_(r);
+
+	/* stale event counter returns at once with the current state */
+	event_nr = UINT32_MAX;
+	failures = UINT64_MAX;
+	OK_(crypt_wait_active_device_failures(cd, CDEVICE_1, &event_nr, &failures));
+	EQ_(failures, 0);
+	EQ_(event_nr == UINT32_MAX, 0);
+	OK_(crypt_deactivate(cd, CDEVICE_1));
+
+	/* detected corruption is reported as one failure */
+	_system("dd if=/dev/urandom of=" IMAGE_VERITY_DATA " bs=4096 count=1 conv=notrunc 2>/dev/null", 1);
+	OK_(crypt_activate_by_volume_key(cd, CDEVICE_1, root_hash, root_hash_size, CRYPT_ACTIVATE_READONLY));
+	_system("blkid " DMDIR CDEVICE_1, 0);
+	event_nr = UINT32_MAX;
+	OK_(crypt_wait_active_device_failures(cd, CDEVICE_1, &event_nr, &failures));
+	EQ_(failures, 1);
+	OK_(crypt_deactivate(cd, CDEVICE_1));
+	CRYPT_FREE(cd);
+
+	_system("rm -f " IMAGE_VERITY_DATA " " IMAGE_VERITY_HASH, 0);
+}
+
+static void VerityUpdate(void)
+{
+	const char *salt_hex =  "20c28ffc129c12360ba6ceea2b6cf04e89c2b41cfe6b8439eb53c1897f50df7b";
+	char salt[32], root_hash[32], root_hash_new[32];
+	size_t root_hash_size = sizeof(root_hash);
+	uint64_t bad_blocks[4];
+	struct crypt_verity_report report = {
+		.bad_blocks = bad_blocks,
+		.bad_blocks_size = 4,
+	};
+	struct crypt_verity_range ranges[] = {
+		{ .offset = 200, .length = 1 },
+		{ .offset = 3,   .length = 1 },
+		{ .offset = 3,   .length = 1 }, /* overlapping */
+	}, range_wrong = { .offset = 255, .length = 2 };
+	struct crypt_params_verity params = {
+		.data_device = IMAGE_VERITY_DATA,
+		.hash_name = "sha256",
+		.salt = salt,
+		.salt_size = sizeof(salt),
+		.data_block_size = 4096,
+		.hash_block_size = 4096,
+		.hash_type = 1,
+		.flags = CRYPT_VERITY_CREATE_HASH,
+	};
+
+	crypt_decode_key(salt, salt_hex, sizeof(salt));
+	_system("dd if=/dev/urandom of=" IMAGE_VERITY_DATA " bs=4096 count=256 2>/dev/null", 1);
+	_system("dd if=/dev/zero of=" IMAGE_VERITY_HASH " bs=4096 count=16 2>/dev/null", 1);
+
+	/* VERITY context is required */
+	FAIL_(crypt_verity_update(NULL, ranges, 1, root_hash_new, sizeof(root_hash_new)), "No context");
+	OK_(crypt_init(&cd, IMAGE_VERITY_HASH));
+	FAIL_(crypt_verity_update(cd, ranges, 1, root_hash_new, sizeof(root_hash_new)), "Not VERITY device");
+	FAIL_(crypt_verity_verify_report(cd, root_hash, sizeof(root_hash), 0, &report), "Not VERITY device");
+	FAIL_(crypt_verity_set_signature_cache(cd, 10), "Not VERITY device");
+
+	OK_(crypt_format(cd, CRYPT_VERITY, NULL, NULL, NULL, NULL, 0, &params));
+	OK_(crypt_volume_key_get(cd, CRYPT_ANY_SLOT, root_hash, &root_hash_size, NULL, 0));
+	EQ_(root_hash_size, sizeof(root_hash));
+
+	/* intact device */
+	FAIL_(crypt_verity_verify_report(cd, root_hash, 16, 0, &report), "Wrong root hash size");
+	FAIL_(crypt_verity_verify_report(cd, root_hash, sizeof(root_hash), 0, NULL), "No report");
+	OK_(crypt_verity_verify_report(cd, root_hash, sizeof(root_hash), 0, &report));
+	EQ_(report.bad_blocks_count, 0);
+
+	/* all corrupted data blocks are reported */
+	_system("dd if=/dev/urandom of=" IMAGE_VERITY_DATA " bs=4096 count=1 seek=3 conv=notrunc 2>/dev/null", 1);
+	_system("dd if=/dev/urandom of=" IMAGE_VERITY_DATA " bs=4096 count=1 seek=200 conv=notrunc 2>/dev/null", 1);
+	EQ_(crypt_verity_verify_report(cd, root_hash, sizeof(root_hash), 0, &report), -EPERM);
+	EQ_(report.bad_blocks_count, 2);
+	EQ_(bad_blocks[0], 3);
+	EQ_(bad_blocks[1], 200);
+	report.bad_blocks_size = 1;
+	bad_blocks[1] = 0;
+	EQ_(crypt_verity_verify_report(cd, root_hash, sizeof(root_hash), 0, &report), -EPERM);
+	EQ_(report.bad_blocks_count, 2);
+	EQ_(bad_blocks[0], 3);
+	EQ_(bad_blocks[1], 0);
+	report.bad_blocks_size = 4;
+
+	/* hash area is still intact */
+	OK_(crypt_verity_verify_report(cd, root_hash, sizeof(root_hash), CRYPT_VERITY_VERIFY_HASH_ONLY, &report));
+	root_hash[0] = ~root_hash[0];
+	EQ_(crypt_verity_verify_report(cd, root_hash, sizeof(root_hash), CRYPT_VERITY_VERIFY_HASH_ONLY, &report), -EFAULT);
+	root_hash[0] = ~root_hash[0];
+
+	/* update of changed blocks */
+	FAIL_(crypt_verity_update(cd, NULL, 1, root_hash_new, sizeof(root_hash_new)), "No ranges");
+	FAIL_(crypt_verity_update(cd, ranges, 1, NULL, sizeof(root_hash_new)), "No root hash buffer");
+	FAIL_(crypt_verity_update(cd, ranges, 1, root_hash_new, 16), "Wrong root hash size");
+	FAIL_(crypt_verity_update(cd, &range_wrong, 1, root_hash_new, sizeof(root_hash_new)), "Outside of data area");
+	OK_(crypt_verity_update(cd, ranges, 3, root_hash_new, sizeof(root_hash_new)));
+	EQ_(!memcmp(root_hash, root_hash_new, sizeof(root_hash)), 0);
+	OK_(crypt_verity_verify_report(cd, root_hash_new, sizeof(root_hash_new), 0, &report));
+	EQ_(report.bad_blocks_count, 0);
+	EQ_(crypt_verity_verify_report(cd, root_hash, sizeof(root_hash), 0, &report), -EFAULT);
+
+	/* nothing changed */
+	OK_(crypt_verity_update(cd, NULL, 0, root_hash, sizeof(root_hash)));
+	OK_(memcmp(root_hash, root_hash_new, sizeof(root_hash)));
+	CRYPT_FREE(cd);
+
+	/* updated hash area is valid for activation check */
+	OK_(crypt_init(&cd, IMAGE_VERITY_HASH));
+	memset(&params, 0, sizeof(params));
+	params.data_device = IMAGE_VERITY_DATA;
+	params.flags = CRYPT_VERITY_CHECK_HASH;
+	OK_(crypt_load(cd, CRYPT_VERITY, &params));
+	OK_(crypt_activate_by_volume_key(cd, NULL, root_hash_new, sizeof(root_hash_new), 0));
+	OK_(crypt_verity_set_signature_cache(cd, 30));
+	OK_(crypt_verity_set_signature_cache(cd, 0));
+	CRYPT_FREE(cd);
+
+	_system("rm -f " IMAGE_VERITY_DATA " " IMAGE_VERITY_HASH, 0);
+}
+
 static void TcryptTest(void)
 {
 	struct crypt_active_device cad;
@@ -2011,6 +2326,98 @@ static void ResizeIntegrityWithKey(void)
 	_cleanup_dmdevices();
 }
 
+static void TcryptAdopt(void)
+{
+	const char *passphrase = "aaaaaaaaaaaa";
+	const char *kf1 = "tcrypt-images/keyfile1";
+	const char *kf2 = "tcrypt-images/keyfile2";
+	const char *keyfiles[] = { kf1, kf2 };
+	struct crypt_params_tcrypt params = {
+		.passphrase = passphrase,
+		.passphrase_size = strlen(passphrase),
+		.keyfiles = keyfiles,
+		.keyfiles_count = 2,
+	};
+	struct crypt_pbkdf_type min_pbkdf2 = {
+		.type = "pbkdf2",
+		.hash = "sha256",
+		.iterations = 1000,
+		.flags = CRYPT_PBKDF_NO_BENCHMARK
+	};
+	const char *tcrypt_dev = "tcrypt-images/tck_5-sha512-xts-aes";
+	const char *tcrypt_dev2 = "tcrypt-images/tc_5-sha512-xts-serpent-twofish-aes";
+	struct crypt_device *cd_src;
+	size_t key_size = 64;
+	char key[64], key2[64];
+	double enc_mbr = 0, dec_mbr = 0;
+	int r;
+
+	r = crypt_benchmark(NULL, "aes", "xts", 512, 16, 1024, &enc_mbr, &dec_mbr);
+	if (r == -ENOTSUP || r == -ENOENT) {
+		printf("WARNING: algif_skcipher interface not present, skipping test.\n");
+		return;
+	}
+
+	_system("dd if=/dev/zero of=" HEADER_ADOPT " bs=1M count=4 2>/dev/null", 1);
+
+	OK_(crypt_init(&cd_src, tcrypt_dev));
+	OK_(crypt_load(cd_src, CRYPT_TCRYPT, &params));
+	OK_(crypt_volume_key_get(cd_src, CRYPT_ANY_SLOT, key, &key_size, NULL, 0));
+
+	/* detached header over the same data device is required */
+	FAIL_(crypt_format_luks2_adopt(NULL, cd_src, key, key_size, NULL), "No context");
+	OK_(crypt_init(&cd, tcrypt_dev));
+	FAIL_(crypt_format_luks2_adopt(cd, cd_src, key, key_size, NULL), "No detached header");
+	CRYPT_FREE(cd);
+	OK_(crypt_init_data_device(&cd, HEADER_ADOPT, tcrypt_dev2));
+	FAIL_(crypt_format_luks2_adopt(cd, cd_src, key, key_size, NULL), "Different data device");
+	CRYPT_FREE(cd);
+
+	OK_(crypt_init_data_device(&cd, HEADER_ADOPT, tcrypt_dev));
+	FAIL_(crypt_format_luks2_adopt(cd, NULL, key, key_size, NULL), "No source device");
+	FAIL_(crypt_format_luks2_adopt(cd, cd_src, NULL, key_size, NULL), "No volume key");
+	FAIL_(crypt_format_luks2_adopt(cd, cd_src, key, 32, NULL), "Wrong volume key size");
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format_luks2_adopt(cd, cd_src, key, key_size, NULL));
+	FAIL_(crypt_format_luks2_adopt(cd, cd_src, key, key_size, NULL), "Already formatted");
+	OK_(strcmp(CRYPT_LUKS2, crypt_get_type(cd)));
+	OK_(strcmp(crypt_get_cipher(cd_src), crypt_get_cipher(cd)));
+	OK_(strcmp(crypt_get_cipher_mode(cd_src), crypt_get_cipher_mode(cd)));
+	EQ_(crypt_get_data_offset(cd), crypt_get_data_offset(cd_src));
+	/* keyslots area is limited by TCRYPT header size */
+	FAIL_(crypt_keyslot_add_by_volume_key(cd, 0, key, key_size, PASSPHRASE, strlen(PASSPHRASE)), "Keyslots area too small");
+	CRYPT_FREE(cd);
+
+	/* LUKS2 header describes the same data with the same volume key */
+	OK_(crypt_init_data_device(&cd, HEADER_ADOPT, tcrypt_dev));
+	OK_(crypt_load(cd, CRYPT_LUKS2, NULL));
+	EQ_(crypt_get_data_offset(cd), crypt_get_data_offset(cd_src));
+	OK_(crypt_activate_by_volume_key(cd, NULL, key, key_size, 0));
+	memset(key2, 0, sizeof(key2));
+	FAIL_(crypt_activate_by_volume_key(cd, NULL, key2, key_size, 0), "Wrong volume key");
+	CRYPT_FREE(cd);
+	CRYPT_FREE(cd_src);
+
+	if (_fips_mode)
+		return;
+
+	/* cipher chains cannot be described by one LUKS2 segment */
+	OK_(crypt_init(&cd_src, tcrypt_dev2));
+	params.keyfiles = NULL;
+	params.keyfiles_count = 0;
+	r = crypt_load(cd_src, CRYPT_TCRYPT, &params);
+	if (r < 0) {
+		printf("WARNING: cannot use non-AES encryption, skipping test.\n");
+		CRYPT_FREE(cd_src);
+		return;
+	}
+	key_size = crypt_get_volume_key_size(cd_src);
+	OK_(crypt_init_data_device(&cd, HEADER_ADOPT, tcrypt_dev2));
+	EQ_(crypt_format_luks2_adopt(cd, cd_src, key, key_size, NULL), -ENOTSUP);
+	CRYPT_FREE(cd);
+	CRYPT_FREE(cd_src);
+}
+
 static void IntegrityTest(void)
 {
 	struct crypt_params_integrity params = {
@@ -2075,6 +2482,189 @@ static void IntegrityTest(void)
 	CRYPT_FREE(cd);
 }
 
+static void IntegrityWipeTags(void)
+{
+	struct crypt_params_integrity params = {
+		.tag_size = 4,
+		.integrity = "crc32c",
+		.sector_size = 4096,
+	}, params_hmac = {
+		.tag_size = 32,
+		.integrity = "hmac(sha256)",
+		.integrity_key_size = 32,
+		.sector_size = 4096,
+	};
+	int ret;
+
+	FAIL_(crypt_wipe_integrity_tags(NULL, 0, NULL, NULL), "No context");
+	OK_(crypt_init(&cd, DEVICE_1));
+	FAIL_(crypt_wipe_integrity_tags(cd, 0, NULL, NULL), "Not INTEGRITY device");
+
+	ret = crypt_format(cd, CRYPT_INTEGRITY, NULL, NULL, NULL, NULL, 0, &params);
+	if (ret < 0) {
+		printf("WARNING: cannot format integrity device, skipping test.\n");
+		CRYPT_FREE(cd);
+		return;
+	}
+	OK_(crypt_wipe_integrity_tags(cd, 0, NULL, NULL));
+	CRYPT_FREE(cd);
+
+	/* keyed algorithm cannot be precomputed without key */
+	OK_(crypt_init(&cd, DEVICE_1));
+	ret = crypt_format(cd, CRYPT_INTEGRITY, NULL, NULL, NULL, NULL, 0, &params_hmac);
+	if (ret < 0) {
+		printf("WARNING: cannot format keyed integrity device, skipping test.\n");
+		CRYPT_FREE(cd);
+		return;
+	}
+	EQ_(crypt_wipe_integrity_tags(cd, 0, NULL, NULL), -ENOTSUP);
+	CRYPT_FREE(cd);
+}
+
+static void IntegrityRecalculateTags(void)
+{
+	struct crypt_params_integrity params = {
+		.tag_size = 4,
+		.integrity = "crc32c",
+		.sector_size = 4096,
+	}, params_hmac = {
+		.tag_size = 32,
+		.integrity = "hmac(sha256)",
+		.integrity_key_size = 32,
+		.sector_size = 4096,
+	};
+	const char *key_hex = "bb21158c733229347bd4e681891e213d94c685be6a5b84818afe7a78a6de7a1a";
+	char key[32];
+	int ret;
+
+	crypt_decode_key(key, key_hex, sizeof(key));
+
+	FAIL_(crypt_recalculate_integrity_tags(NULL, NULL, 0, NULL, NULL), "No context");
+	OK_(crypt_init(&cd, DEVICE_1));
+	FAIL_(crypt_recalculate_integrity_tags(cd, NULL, 0, NULL, NULL), "Not INTEGRITY device");
+
+	ret = crypt_format(cd, CRYPT_INTEGRITY, NULL, NULL, NULL, NULL, 0, &params);
+	if (ret < 0) {
+		printf("WARNING: cannot format integrity device, skipping test.\n");
+		CRYPT_FREE(cd);
+		return;
+	}
+	FAIL_(crypt_recalculate_integrity_tags(cd, NULL, 32, NULL, NULL), "Key size without key");
+	OK_(crypt_recalculate_integrity_tags(cd, NULL, 0, NULL, NULL));
+	CRYPT_FREE(cd);
+
+	OK_(crypt_init(&cd, DEVICE_1));
+	ret = crypt_format(cd, CRYPT_INTEGRITY, NULL, NULL, NULL, NULL, 0, &params_hmac);
+	if (ret < 0) {
+		printf("WARNING: cannot format keyed integrity device, skipping test.\n");
+		CRYPT_FREE(cd);
+		return;
+	}
+	FAIL_(crypt_recalculate_integrity_tags(cd, NULL, 0, NULL, NULL), "Key required");
+	OK_(crypt_recalculate_integrity_tags(cd, key, sizeof(key), NULL, NULL));
+	CRYPT_FREE(cd);
+}
+
+static int integrity_mismatch(uint64_t sector, uint64_t count, void *usrptr)
+{
+	uint64_t *sectors = usrptr;
+
+	*sectors += count;
+	return 0;
+}
+
+static void IntegrityVerifyTags(void)
+{
+	struct crypt_params_integrity params = {
+		.tag_size = 4,
+		.integrity = "crc32c",
+		.sector_size = 4096,
+	}, params_hmac = {
+		.tag_size = 32,
+		.integrity = "hmac(sha256)",
+		.integrity_key_size = 32,
+		.sector_size = 4096,
+	};
+	const char *key_hex = "bb21158c733229347bd4e681891e213d94c685be6a5b84818afe7a78a6de7a1a";
+	char key[32], cmd[256];
+	uint64_t mismatched, sectors;
+	int ret;
+
+	crypt_decode_key(key, key_hex, sizeof(key));
+
+	FAIL_(crypt_verify_integrity_tags(NULL, NULL, 0, NULL, NULL, NULL, &mismatched), "No context");
+	OK_(crypt_init(&cd, DEVICE_1));
+	FAIL_(crypt_verify_integrity_tags(cd, NULL, 0, NULL, NULL, NULL, &mismatched), "Not INTEGRITY device");
+
+	ret = crypt_format(cd, CRYPT_INTEGRITY, NULL, NULL, NULL, NULL, 0, &params);
+	if (ret < 0) {
+		printf("WARNING: cannot format integrity device, skipping test.\n");
+		CRYPT_FREE(cd);
+		return;
+	}
+
+	/* tags precomputed for zeroed data */
+	OK_(crypt_wipe_integrity_tags(cd, 0, NULL, NULL));
+	OK_(crypt_verify_integrity_tags(cd, NULL, 0, NULL, NULL, NULL, &mismatched));
+	EQ_(mismatched, 0);
+
+	/* corrupted data are reported */
+	GE_(snprintf(cmd, sizeof(cmd), "dd if=/dev/urandom of=%s bs=4096 count=4 seek=2048 conv=notrunc 2>/dev/null", DEVICE_1), 0);
+	_system(cmd, 1);
+	sectors = 0;
+	OK_(crypt_verify_integrity_tags(cd, NULL, 0, integrity_mismatch, NULL, &sectors, &mismatched));
+	GE_(mismatched, 8);
+	EQ_(sectors, mismatched);
+
+	/* and fixed by recalculation */
+	FAIL_(crypt_verify_integrity_tags(cd, NULL, 32, NULL, NULL, NULL, &mismatched), "Key size without key");
+	OK_(crypt_recalculate_integrity_tags(cd, NULL, 0, NULL, NULL));
+	OK_(crypt_verify_integrity_tags(cd, NULL, 0, NULL, NULL, NULL, &mismatched));
+	EQ_(mismatched, 0);
+	CRYPT_FREE(cd);
+
+	OK_(crypt_init(&cd, DEVICE_1));
+	ret = crypt_format(cd, CRYPT_INTEGRITY, NULL, NULL, NULL, NULL, 0, &params_hmac);
+	if (ret < 0) {
+		printf("WARNING: cannot format keyed integrity device, skipping test.\n");
+		CRYPT_FREE(cd);
+		return;
+	}
+	FAIL_(crypt_verify_integrity_tags(cd, NULL, 0, NULL, NULL, NULL, &mismatched), "Key required");
+	OK_(crypt_recalculate_integrity_tags(cd, key, sizeof(key), NULL, NULL));
+	OK_(crypt_verify_integrity_tags(cd, key, sizeof(key), NULL, NULL, NULL, &mismatched));
+	EQ_(mismatched, 0);
+	key[0] = ~key[0];
+	OK_(crypt_verify_integrity_tags(cd, key, sizeof(key), NULL, NULL, NULL, &mismatched));
+	GE_(mismatched, 1);
+	CRYPT_FREE(cd);
+}
+
+static void IntegrityMetadataSize(void)
+{
+	struct crypt_params_integrity params = {
+		.tag_size = 4,
+		.integrity = "crc32c",
+		.sector_size = 4096,
+	}, params_nointegrity = {
+		.tag_size = 4,
+	};
+	uint64_t metadata_size, metadata_size2;
+
+	FAIL_(crypt_integrity_metadata_size(NULL, 1024*1024, &metadata_size), "No params");
+	FAIL_(crypt_integrity_metadata_size(&params_nointegrity, 1024*1024, &metadata_size), "No integrity algorithm");
+	FAIL_(crypt_integrity_metadata_size(&params, 1024*1024, NULL), "No size");
+	OK_(crypt_integrity_metadata_size(&params, 1024*1024, &metadata_size));
+	GE_(metadata_size, 256 * params.tag_size);
+
+	/* tags area scales with data size and tag size */
+	OK_(crypt_integrity_metadata_size(&params, 1024*1024*1024, &metadata_size2));
+	GE_(metadata_size2, metadata_size + 1023 * 256 * params.tag_size);
+	params.tag_size = 8;
+	OK_(crypt_integrity_metadata_size(&params, 1024*1024*1024, &metadata_size));
+	GE_(metadata_size, metadata_size2 + 1024 * 256 * 4);
+}
+
 static void WipeTest(void)
 {
 	OK_(crypt_init(&cd, NULL));
@@ -2094,6 +2684,546 @@ static void WipeTest(void)
 	CRYPT_FREE(cd);
 }
 
+static void WipeQueueDepth(void)
+{
+	_system("dd if=/dev/urandom of=" IMAGE_WIPE " bs=1M count=1 2>/dev/null", 1);
+
+	OK_(crypt_init(&cd, NULL));
+	FAIL_(crypt_set_wipe_queue_depth(NULL, 4), "No context");
+	FAIL_(crypt_set_wipe_queue_depth(cd, CRYPT_WIPE_QUEUE_DEPTH_MAX + 1), "Queue depth too large");
+
+	/* several writes in flight */
+	OK_(crypt_set_wipe_queue_depth(cd, 4));
+	OK_(crypt_wipe(cd, IMAGE_WIPE, CRYPT_WIPE_ZERO, 0, 1024*1024, 64*1024, 0, NULL, NULL));
+	EQ_(_zeroed(IMAGE_WIPE, 0, 1024*1024), 1);
+	OK_(crypt_wipe(cd, IMAGE_WIPE, CRYPT_WIPE_RANDOM, 0, 1024*1024, 64*1024, 0, NULL, NULL));
+	EQ_(_zeroed(IMAGE_WIPE, 0, 64*1024), 0);
+	EQ_(_zeroed(IMAGE_WIPE, 1024*1024 - 64*1024, 64*1024), 0);
+	OK_(crypt_set_wipe_queue_depth(cd, 0));
+	OK_(crypt_wipe(cd, IMAGE_WIPE, CRYPT_WIPE_ZERO, 0, 1024*1024, 64*1024, 0, NULL, NULL));
+	EQ_(_zeroed(IMAGE_WIPE, 0, 1024*1024), 1);
+	CRYPT_FREE(cd);
+
+	remove(IMAGE_WIPE);
+}
+
+static void WipeCheckpoint(void)
+{
+	const char *checkpoint = "cryptsetup-wipe 1\ndevice " IMAGE_WIPE "\npattern 0\n"
+				 "range 0 1048576\nblock 65536\ndone 524288\n";
+
+	_system("dd if=/dev/urandom of=" IMAGE_WIPE " bs=1M count=1 2>/dev/null", 1);
+
+	OK_(crypt_init(&cd, NULL));
+	FAIL_(crypt_set_wipe_checkpoint(NULL, WIPE_CHECKPOINT), "No context");
+	OK_(crypt_set_wipe_checkpoint(cd, WIPE_CHECKPOINT));
+
+	/* resume from checkpoint left by interrupted wipe */
+	OK_(prepare_keyfile(WIPE_CHECKPOINT, checkpoint, strlen(checkpoint)));
+	OK_(crypt_wipe(cd, IMAGE_WIPE, CRYPT_WIPE_ZERO, 0, 1024*1024, 64*1024, 0, NULL, NULL));
+	EQ_(_zeroed(IMAGE_WIPE, 0, 64*1024), 0);
+	EQ_(_zeroed(IMAGE_WIPE, 512*1024, 512*1024), 1);
+	FAIL_(access(WIPE_CHECKPOINT, F_OK), "Checkpoint is removed after wipe");
+
+	/* checkpoint of a different wipe is ignored */
+	OK_(crypt_wipe(cd, IMAGE_WIPE, CRYPT_WIPE_RANDOM, 0, 1024*1024, 64*1024, 0, NULL, NULL));
+	OK_(prepare_keyfile(WIPE_CHECKPOINT, checkpoint, strlen(checkpoint)));
+	OK_(crypt_wipe(cd, IMAGE_WIPE, CRYPT_WIPE_ZERO, 0, 1024*1024, 128*1024, 0, NULL, NULL));
+	EQ_(_zeroed(IMAGE_WIPE, 0, 1024*1024), 1);
+	FAIL_(access(WIPE_CHECKPOINT, F_OK), "Checkpoint is removed after wipe");
+	OK_(crypt_set_wipe_checkpoint(cd, NULL));
+	CRYPT_FREE(cd);
+
+	remove(IMAGE_WIPE);
+}
+
+static void LuksPassphraseBatch(void)
+{
+	struct crypt_params_luks1 params = {
+		.hash = "sha256",
+	};
+	struct crypt_pbkdf_type min_pbkdf2 = {
+		.type = "pbkdf2",
+		.hash = "sha256",
+		.iterations = 1000,
+		.flags = CRYPT_PBKDF_NO_BENCHMARK
+	};
+	const char *candidates[] = { "aaablabl", PASSPHRASE1, "bbbblabl", PASSPHRASE };
+	size_t sizes[] = { 8, strlen(PASSPHRASE1), 8, strlen(PASSPHRASE) };
+	size_t index;
+
+	OK_(crypt_init(&cd, DEVICE_2));
+	FAIL_(crypt_keyslot_test_passphrases(cd, CRYPT_ANY_SLOT, candidates, sizes, 4, 0, &index), "Not LUKS device");
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS1, "aes", "cbc-essiv:sha256", NULL, NULL, 32, &params));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 32, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 2, NULL, 32, PASSPHRASE1, strlen(PASSPHRASE1)), 2);
+
+	FAIL_(crypt_keyslot_test_passphrases(cd, CRYPT_ANY_SLOT, NULL, sizes, 4, 0, &index), "No candidates");
+	FAIL_(crypt_keyslot_test_passphrases(cd, CRYPT_ANY_SLOT, candidates, NULL, 4, 0, &index), "No sizes");
+	FAIL_(crypt_keyslot_test_passphrases(cd, CRYPT_ANY_SLOT, candidates, sizes, 4, 0, NULL), "No index");
+
+	/* keyslots are tried in order */
+	EQ_(crypt_keyslot_test_passphrases(cd, CRYPT_ANY_SLOT, candidates, sizes, 4, 0, &index), 0);
+	EQ_(index, 3);
+	EQ_(crypt_keyslot_test_passphrases(cd, 2, candidates, sizes, 4, 2, &index), 2);
+	EQ_(index, 1);
+	EQ_(crypt_keyslot_test_passphrases(cd, CRYPT_ANY_SLOT, candidates, sizes, 3, 1, &index), 2);
+	EQ_(index, 1);
+	EQ_(crypt_keyslot_test_passphrases(cd, 0, candidates, sizes, 3, 3, &index), -EPERM);
+	EQ_(crypt_keyslot_test_passphrases(cd, 5, candidates, sizes, 4, 0, &index), -ENOENT);
+	CRYPT_FREE(cd);
+}
+
+static void LuksDerivedKeyCache(void)
+{
+	struct crypt_params_luks1 params = {
+		.hash = "sha256",
+	};
+	struct crypt_pbkdf_type min_pbkdf2 = {
+		.type = "pbkdf2",
+		.hash = "sha256",
+		.iterations = 1000,
+		.flags = CRYPT_PBKDF_NO_BENCHMARK
+	};
+
+	FAIL_(crypt_set_derived_key_cache(NULL, 1000), "No context");
+	OK_(crypt_init(&cd, DEVICE_2));
+	FAIL_(crypt_set_derived_key_cache(cd, CRYPT_DERIVED_KEY_CACHE_MAX_MS + 1), "Timeout too long");
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS1, "aes", "cbc-essiv:sha256", NULL, NULL, 32, &params));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 32, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 2, NULL, 32, PASSPHRASE1, strlen(PASSPHRASE1)), 2);
+
+	/* derived key cache does not change results */
+	OK_(crypt_set_derived_key_cache(cd, 1000));
+	EQ_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, PASSPHRASE1, strlen(PASSPHRASE1), 0), 2);
+	EQ_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, PASSPHRASE1, strlen(PASSPHRASE1), 0), 2);
+	EQ_(crypt_activate_by_passphrase(cd, NULL, 0, PASSPHRASE1, strlen(PASSPHRASE1), 0), -EPERM);
+	EQ_(crypt_activate_by_passphrase(cd, NULL, 0, PASSPHRASE, strlen(PASSPHRASE), 0), 0);
+	OK_(crypt_set_derived_key_cache(cd, 0));
+	EQ_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, PASSPHRASE1, strlen(PASSPHRASE1), 0), 2);
+	CRYPT_FREE(cd);
+}
+
+static void LuksPbkdfCache(void)
+{
+	struct crypt_params_luks1 params = {
+		.hash = "sha256",
+	};
+	struct crypt_pbkdf_type pbkdf = {
+		.type = CRYPT_KDF_PBKDF2,
+		.hash = "sha256",
+		.time_ms = 1,
+	}, ks_pbkdf;
+	uint32_t iterations;
+	struct stat st;
+
+	remove(PBKDF_CACHE);
+	FAIL_(crypt_set_pbkdf_cache(NULL, PBKDF_CACHE), "No context");
+
+	/* calibration is stored in cache */
+	OK_(crypt_init(&cd, DEVICE_2));
+	OK_(crypt_set_pbkdf_cache(cd, PBKDF_CACHE));
+	OK_(crypt_set_pbkdf_type(cd, &pbkdf));
+	OK_(crypt_format(cd, CRYPT_LUKS1, "aes", "cbc-essiv:sha256", NULL, NULL, 32, &params));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 32, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	OK_(crypt_keyslot_get_pbkdf(cd, 0, &ks_pbkdf));
+	iterations = ks_pbkdf.iterations;
+	CRYPT_FREE(cd);
+	OK_(stat(PBKDF_CACHE, &st));
+	EQ_(st.st_mode & 0777, S_IRUSR | S_IWUSR);
+
+	/* and reused by the next keyslot */
+	OK_(crypt_init(&cd, DEVICE_2));
+	OK_(crypt_load(cd, CRYPT_LUKS1, NULL));
+	OK_(crypt_set_pbkdf_cache(cd, PBKDF_CACHE));
+	OK_(crypt_set_pbkdf_type(cd, &pbkdf));
+	EQ_(crypt_keyslot_add_by_passphrase(cd, 1, PASSPHRASE, strlen(PASSPHRASE), PASSPHRASE1, strlen(PASSPHRASE1)), 1);
+	OK_(crypt_keyslot_get_pbkdf(cd, 1, &ks_pbkdf));
+	EQ_(ks_pbkdf.iterations, iterations);
+
+	/* cache writable by others is not used, but replaced by a safe one */
+	OK_(chmod(PBKDF_CACHE, 0666));
+	OK_(crypt_keyslot_destroy(cd, 1));
+	EQ_(crypt_keyslot_add_by_passphrase(cd, 1, PASSPHRASE, strlen(PASSPHRASE), PASSPHRASE1, strlen(PASSPHRASE1)), 1);
+	OK_(stat(PBKDF_CACHE, &st));
+	EQ_(st.st_mode & 0777, S_IRUSR | S_IWUSR);
+	OK_(crypt_set_pbkdf_cache(cd, NULL));
+	CRYPT_FREE(cd);
+
+	remove(PBKDF_CACHE);
+}
+
+static void BitlkRecoveryKey(void)
+{
+	const char *keys[] = {
+		"111111-111111-111111-111111-111111-111111-111111-111111",
+		"not a recovery password",
+		BITLK_RECOVERY,
+	};
+
+	OK_(crypt_init(&cd, DEVICE_2));
+	FAIL_(crypt_bitlk_find_recovery_key(cd, keys, 3), "Not BITLK device");
+	CRYPT_FREE(cd);
+
+	if (crypt_init(&cd, BITLK_IMAGE) || crypt_load(cd, CRYPT_BITLK, NULL)) {
+		printf("WARNING: cannot load BITLK image, skipping test.\n");
+		CRYPT_FREE(cd);
+		return;
+	}
+	FAIL_(crypt_bitlk_find_recovery_key(NULL, keys, 3), "No context");
+	FAIL_(crypt_bitlk_find_recovery_key(cd, NULL, 3), "No recovery passwords");
+	FAIL_(crypt_bitlk_find_recovery_key(cd, keys, 0), "No recovery passwords");
+	EQ_(crypt_bitlk_find_recovery_key(cd, keys, 2), -EPERM);
+	EQ_(crypt_bitlk_find_recovery_key(cd, keys, 3), 2);
+	EQ_(crypt_bitlk_find_recovery_key(cd, &keys[2], 1), 0);
+
+	/* stretched keys shared through derived key cache */
+	OK_(crypt_set_derived_key_cache(cd, 1000));
+	EQ_(crypt_bitlk_find_recovery_key(cd, keys, 3), 2);
+	EQ_(crypt_bitlk_find_recovery_key(cd, keys, 3), 2);
+	EQ_(crypt_bitlk_find_recovery_key(cd, keys, 2), -EPERM);
+	CRYPT_FREE(cd);
+}
+
+static void VolumeReadDecrypt(void)
+{
+	struct crypt_params_plain params = {
+		.hash = "sha256",
+	};
+	/* NTFS boot sector: OEM ID and volume serial number (little endian) */
+	const char ntfs_oem[] = "NTFS    ";
+	const char ntfs_serial[] = { 0xb4, 0x41, 0x4e, 0x84, 0x71, 0x4e, 0x84, 0x68 };
+	char key[64], *buf;
+	size_t key_size = sizeof(key);
+	uint64_t offset, size;
+	struct stat st;
+	int fd;
+
+	buf = malloc(1024 * 1024);
+	NOTNULL_(buf);
+
+	FAIL_(crypt_volume_read_decrypt(NULL, key, 32, 0, buf, 512), "No context");
+	OK_(crypt_init(&cd, DEVICE_1));
+	OK_(crypt_format(cd, CRYPT_PLAIN, "aes", "xts-plain64", NULL, NULL, 64, &params));
+	EQ_(crypt_volume_read_decrypt(cd, key, 64, 0, buf, 512), -ENOTSUP);
+	CRYPT_FREE(cd);
+
+	if (crypt_init(&cd, BITLK_IMAGE) || crypt_load(cd, CRYPT_BITLK, NULL)) {
+		printf("WARNING: cannot load BITLK image, skipping test.\n");
+		CRYPT_FREE(cd);
+		free(buf);
+		return;
+	}
+	OK_(crypt_volume_key_get(cd, CRYPT_ANY_SLOT, key, &key_size, BITLK_PASSPHRASE, strlen(BITLK_PASSPHRASE)));
+	OK_(stat(BITLK_IMAGE, &st));
+	size = st.st_size;
+
+	FAIL_(crypt_volume_read_decrypt(cd, NULL, key_size, 0, buf, 512), "No key");
+	FAIL_(crypt_volume_read_decrypt(cd, key, 0, 0, buf, 512), "No key");
+	FAIL_(crypt_volume_read_decrypt(cd, key, key_size, 0, NULL, 512), "No buffer");
+	OK_(crypt_volume_read_decrypt(cd, key, key_size, 0, buf, 0));
+	FAIL_(crypt_volume_read_decrypt(cd, key, key_size, 1, buf, 512), "Unaligned offset");
+	FAIL_(crypt_volume_read_decrypt(cd, key, key_size, 0, buf, 100), "Unaligned length");
+	FAIL_(crypt_volume_read_decrypt(cd, key, key_size, size - 512, buf, 1024), "Beyond volume end");
+
+	/* known plaintext in the relocated boot sector */
+	OK_(crypt_volume_read_decrypt(cd, key, key_size, 0, buf, 512));
+	OK_(memcmp(buf + 3, ntfs_oem, 8));
+	OK_(memcmp(buf + 0x48, ntfs_serial, sizeof(ntfs_serial)));
+	OK_(crypt_volume_read_decrypt(cd, key, key_size, size - 512, buf, 512));
+
+	/* wrong key is not detected, it decrypts to garbage */
+	key[0] = ~key[0];
+	OK_(crypt_volume_read_decrypt(cd, key, key_size, 0, buf, 512));
+	EQ_(!memcmp(buf + 3, ntfs_oem, 8), 0);
+	key[0] = ~key[0];
+
+	/* whole volume matches the checksum of dm-crypt mapping */
+	fd = open(BITLK_DECRYPTED, O_CREAT | O_TRUNC | O_WRONLY, S_IRUSR | S_IWUSR);
+	GE_(fd, 0);
+	for (offset = 0; offset < size; offset += 1024 * 1024) {
+		OK_(crypt_volume_read_decrypt(cd, key, key_size, offset, buf, 1024 * 1024));
+		EQ_(write(fd, buf, 1024 * 1024), 1024 * 1024);
+	}
+	close(fd);
+	OK_(_system("sha256sum " BITLK_DECRYPTED " | grep -q " BITLK_SHA256SUM, 1));
+	CRYPT_FREE(cd);
+
+	free(buf);
+	_system("rm -f " BITLK_DECRYPTED, 0);
+}
+
+static void LuksKeyslotDestroyAll(void)
+{
+	struct crypt_params_luks1 params = {
+		.hash = "sha256",
+	};
+	struct crypt_pbkdf_type min_pbkdf2 = {
+		.type = "pbkdf2",
+		.hash = "sha256",
+		.iterations = 1000,
+		.flags = CRYPT_PBKDF_NO_BENCHMARK
+	};
+
+	FAIL_(crypt_keyslot_destroy_all(NULL), "No context");
+	OK_(crypt_init(&cd, DEVICE_2));
+	FAIL_(crypt_keyslot_destroy_all(cd), "Not LUKS device");
+	OK_(crypt_set_pbkdf_type(cd, &min_pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS1, "aes", "cbc-essiv:sha256", NULL, NULL, 32, &params));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 32, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 1, NULL, 32, PASSPHRASE1, strlen(PASSPHRASE1)), 1);
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 5, NULL, 32, PASSPHRASE1, strlen(PASSPHRASE1)), 5);
+	OK_(crypt_keyslot_destroy_all(cd));
+	EQ_(crypt_keyslot_status(cd, 0), CRYPT_SLOT_INACTIVE);
+	EQ_(crypt_keyslot_status(cd, 1), CRYPT_SLOT_INACTIVE);
+	EQ_(crypt_keyslot_status(cd, 5), CRYPT_SLOT_INACTIVE);
+	FAIL_(crypt_activate_by_passphrase(cd, NULL, CRYPT_ANY_SLOT, PASSPHRASE, strlen(PASSPHRASE), 0), "No keyslot");
+	/* nothing to destroy */
+	OK_(crypt_keyslot_destroy_all(cd));
+	CRYPT_FREE(cd);
+
+	OK_(crypt_init(&cd, DEVICE_2));
+	OK_(crypt_load(cd, CRYPT_LUKS1, NULL));
+	EQ_(crypt_keyslot_status(cd, 0), CRYPT_SLOT_INACTIVE);
+	EQ_(crypt_keyslot_status(cd, 5), CRYPT_SLOT_INACTIVE);
+	CRYPT_FREE(cd);
+}
+
+static int _wait_job(struct crypt_activation_job *job)
+{
+	struct pollfd pfd = {
+		.fd = crypt_activation_job_get_fd(job),
+		.events = POLLIN,
+	};
+
+	if (pfd.fd < 0 || poll(&pfd, 1, 60000) != 1)
+		return -EINVAL;
+
+	return crypt_activation_job_result(job);
+}
+
+static void AsyncActivation(void)
+{
+	struct crypt_params_luks1 params = {
+		.hash = "sha256",
+	};
+	struct crypt_pbkdf_type pbkdf2 = {
+		.type = "pbkdf2",
+		.hash = "sha256",
+		.iterations = 1000,
+		.flags = CRYPT_PBKDF_NO_BENCHMARK
+	};
+	struct crypt_activation_job *job;
+
+	EQ_(crypt_activation_job_get_fd(NULL), -EINVAL);
+	EQ_(crypt_activation_job_result(NULL), -EINVAL);
+	crypt_activation_job_cancel(NULL);
+	crypt_activation_job_free(NULL);
+
+	OK_(crypt_init(&cd, DEVICE_2));
+	OK_(crypt_set_pbkdf_type(cd, &pbkdf2));
+	OK_(crypt_format(cd, CRYPT_LUKS1, "aes", "cbc-essiv:sha256", NULL, NULL, 32, &params));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 0, NULL, 32, PASSPHRASE, strlen(PASSPHRASE)), 0);
+	/* slow keyslot for cancel and deadline */
+	pbkdf2.iterations = 1 << 21;
+	OK_(crypt_set_pbkdf_type(cd, &pbkdf2));
+	EQ_(crypt_keyslot_add_by_volume_key(cd, 1, NULL, 32, PASSPHRASE1, strlen(PASSPHRASE1)), 1);
+
+	FAIL_(crypt_activate_by_passphrase_async(NULL, NULL, 0, PASSPHRASE, strlen(PASSPHRASE), 0, 0, &job), "No context");
+	FAIL_(crypt_activate_by_passphrase_async(cd, NULL, 0, NULL, 0, 0, 0, &job), "No passphrase");
+	FAIL_(crypt_activate_by_passphrase_async(cd, NULL, 0, PASSPHRASE, strlen(PASSPHRASE), 0, 0, NULL), "No job");
+	FAIL_(crypt_activate_by_passphrase_async(cd, NULL, 0, PASSPHRASE, strlen(PASSPHRASE), CRYPT_ACTIVATE_REFRESH, 0, &job), "Refresh needs name");
+
+	/* passphrase check */
+	OK_(crypt_activate_by_passphrase_async(cd, NULL, CRYPT_ANY_SLOT, PASSPHRASE, strlen(PASSPHRASE), 0, 0, &job));
+	EQ_(_wait_job(job), 0);
+	crypt_activation_job_free(job);
+	OK_(crypt_activate_by_passphrase_async(cd, NULL, 0, PASSPHRASE1, strlen(PASSPHRASE1), 0, 0, &job));
+	EQ_(_wait_job(job), -EPERM);
+	crypt_activation_job_free(job);
+
+	/* cancel and deadline */
+	OK_(crypt_activate_by_passphrase_async(cd, NULL, 1, PASSPHRASE1, strlen(PASSPHRASE1), 0, 0, &job));
+	crypt_activation_job_cancel(job);
+	EQ_(_wait_job(job), -ECANCELED);
+	crypt_activation_job_free(job);
+	OK_(crypt_activate_by_passphrase_async(cd, NULL, 1, PASSPHRASE1, strlen(PASSPHRASE1), 0, 1, &job));
+	EQ_(_wait_job(job), -ETIMEDOUT);
+	crypt_activation_job_free(job);
+	/* freeing running job cancels it */
+	OK_(crypt_activate_by_passphrase_async(cd, NULL, 1, PASSPHRASE1, strlen(PASSPHRASE1), 0, 0, &job));
+	crypt_activation_job_free(job);
+
+	/* activation */
+	OK_(crypt_activate_by_passphrase_async(cd, CDEVICE_1, 0, PASSPHRASE, strlen(PASSPHRASE), 0, 0, &job));
+	EQ_(_wait_job(job), 0);
+	crypt_activation_job_free(job);
+	EQ_(crypt_status(cd, CDEVICE_1), CRYPT_ACTIVE);
+	OK_(crypt_activate_by_passphrase_async(cd, CDEVICE_1, 0, PASSPHRASE, strlen(PASSPHRASE), 0, 0, &job));
+	EQ_(_wait_job(job), -EEXIST);
+	crypt_activation_job_free(job);
+	OK_(crypt_deactivate(cd, CDEVICE_1));
+	CRYPT_FREE(cd);
+}
+
+static void UdevSync(void)
+{
+	struct crypt_params_plain params = {
+		.hash = "sha256",
+	};
+	struct stat st;
+
+	/* library-wide switch, context is optional */
+	OK_(crypt_set_udev_sync(NULL, 0));
+	OK_(crypt_init(&cd, DEVICE_1));
+	OK_(crypt_format(cd, CRYPT_PLAIN, "aes", "cbc-essiv:sha256", NULL, NULL, 32, &params));
+
+	/* nodes are created and removed without udev */
+	OK_(crypt_activate_by_passphrase(cd, CDEVICE_1, CRYPT_ANY_SLOT, PASSPHRASE, strlen(PASSPHRASE), 0));
+	EQ_(crypt_status(cd, CDEVICE_1), CRYPT_ACTIVE);
+	OK_(stat(DMDIR CDEVICE_1, &st));
+	OK_(crypt_deactivate(cd, CDEVICE_1));
+	EQ_(crypt_status(cd, CDEVICE_1), CRYPT_INACTIVE);
+	FAIL_(stat(DMDIR CDEVICE_1, &st), "Node removed");
+
+	/* any nonzero value enables it again */
+	OK_(crypt_set_udev_sync(cd, 2));
+	OK_(crypt_activate_by_passphrase(cd, CDEVICE_1, CRYPT_ANY_SLOT, PASSPHRASE, strlen(PASSPHRASE), 0));
+	EQ_(crypt_status(cd, CDEVICE_1), CRYPT_ACTIVE);
+	OK_(crypt_deactivate(cd, CDEVICE_1));
+	OK_(crypt_set_udev_sync(cd, 0));
+	OK_(crypt_set_udev_sync(cd, 1));
+	CRYPT_FREE(cd);
+}
+
+static void InlineCryptoSupported(void)
+{
+	struct crypt_params_plain params = {
+		.hash = "sha256",
+	};
+	struct crypt_params_verity params_verity = {
+		.data_device = DEVICE_1,
+		.hash_name = "sha256",
+		.data_block_size = 4096,
+		.hash_block_size = 4096,
+		.hash_type = 1,
+		.salt_size = 32,
+		.flags = CRYPT_VERITY_NO_HEADER,
+	};
+
+	EQ_(crypt_inline_crypto_supported(NULL), -EINVAL);
+
+	/* no cipher without type */
+	OK_(crypt_init(&cd, DEVICE_1));
+	EQ_(crypt_inline_crypto_supported(cd), -EINVAL);
+	CRYPT_FREE(cd);
+
+	/* loop device (or image file) has no inline encryption hardware */
+	OK_(crypt_init(&cd, DEVICE_1));
+	OK_(crypt_format(cd, CRYPT_PLAIN, "aes", "xts-plain64", NULL, NULL, 64, &params));
+	EQ_(crypt_inline_crypto_supported(cd), 0);
+	CRYPT_FREE(cd);
+
+	/* unsupported mode or key size is not even looked up */
+	OK_(crypt_init(&cd, DEVICE_1));
+	OK_(crypt_format(cd, CRYPT_PLAIN, "aes", "xts-plain64", NULL, NULL, 32, &params));
+	EQ_(crypt_inline_crypto_supported(cd), 0);
+	CRYPT_FREE(cd);
+	OK_(crypt_init(&cd, DEVICE_1));
+	OK_(crypt_format(cd, CRYPT_PLAIN, "aes", "cbc-plain64", NULL, NULL, 32, &params));
+	EQ_(crypt_inline_crypto_supported(cd), 0);
+	CRYPT_FREE(cd);
+
+	/* verity has no cipher */
+	OK_(crypt_init(&cd, DEVICE_2));
+	OK_(crypt_format(cd, CRYPT_VERITY, NULL, NULL, NULL, NULL, 0, &params_verity));
+	EQ_(crypt_inline_crypto_supported(cd), -EINVAL);
+	CRYPT_FREE(cd);
+}
+
+static int loop_messages = 0, loop_dio_cached = 0;
+static char loop_message[256];
+static void loop_log(int level, const char *msg, void *usrptr)
+{
+	if (level == CRYPT_LOG_DEBUG && strstr(msg, "Allocating a free loop device")) {
+		loop_messages++;
+		snprintf(loop_message, sizeof(loop_message), "%s", msg);
+	}
+	if (level == CRYPT_LOG_DEBUG && strstr(msg, "Direct-io read test already passed"))
+		loop_dio_cached++;
+	global_log_callback(level, msg, usrptr);
+}
+
+/* direct-io state of attached loop device, -1 if not known */
+static int _loop_dio(const char *path)
+{
+	char sysfs[128], val = 0;
+	const char *name;
+	int fd, r;
+
+	name = strrchr(path, '/');
+	if (!name || snprintf(sysfs, sizeof(sysfs), "/sys/block/%s/loop/dio", name + 1) < 0)
+		return -1;
+
+	fd = open(sysfs, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	r = read(fd, &val, 1);
+	close(fd);
+
+	return r == 1 ? val - '0' : -1;
+}
+
+static void LoopDirectIo(void)
+{
+	struct crypt_params_plain params = {
+		.hash = "sha256",
+	};
+
+	FAIL_(crypt_set_loop_direct_io(NULL, 0), "No context");
+	_system("dd if=/dev/zero of=" IMAGE_LOOP " bs=1M count=4 2>/dev/null", 1);
+
+	crypt_set_debug_level(CRYPT_DEBUG_ALL);
+
+	/* buffered I/O requested */
+	OK_(crypt_init(&cd, IMAGE_LOOP));
+	crypt_set_log_callback(cd, &loop_log, NULL);
+	OK_(crypt_set_loop_direct_io(cd, 0));
+	OK_(crypt_format(cd, CRYPT_PLAIN, "aes", "xts-plain64", NULL, NULL, 64, &params));
+	loop_messages = 0;
+	OK_(crypt_activate_by_passphrase(cd, CDEVICE_1, CRYPT_ANY_SLOT, PASSPHRASE, strlen(PASSPHRASE), 0));
+	EQ_(loop_messages, 1);
+	NOTNULL_(strstr(loop_message, "buffered I/O"));
+	EQ_(_loop_dio(crypt_get_device_name(cd)) == 1, 0);
+	OK_(crypt_deactivate(cd, CDEVICE_1));
+	crypt_set_log_callback(cd, NULL, NULL);
+	CRYPT_FREE(cd);
+
+	/* per context, new context requests direct-io again */
+	OK_(crypt_init(&cd, IMAGE_LOOP));
+	crypt_set_log_callback(cd, &loop_log, NULL);
+	OK_(crypt_format(cd, CRYPT_PLAIN, "aes", "xts-plain64", NULL, NULL, 64, &params));
+	loop_messages = 0;
+	loop_dio_cached = 0;
+	OK_(crypt_activate_by_passphrase(cd, CDEVICE_1, CRYPT_ANY_SLOT, PASSPHRASE, strlen(PASSPHRASE), 0));
+	EQ_(loop_messages, 1);
+	/* released loop was forgotten, reattached one is tested again */
+	EQ_(loop_dio_cached, 0);
+	NOTNULL_(strstr(loop_message, "direct I/O"));
+	OK_(crypt_deactivate(cd, CDEVICE_1));
+
+	/* any nonzero value enables it */
+	OK_(crypt_set_loop_direct_io(cd, 0));
+	OK_(crypt_set_loop_direct_io(cd, 2));
+	crypt_set_log_callback(cd, NULL, NULL);
+	CRYPT_FREE(cd);
+
+	crypt_set_debug_level(_debug ? CRYPT_DEBUG_ALL : CRYPT_DEBUG_NONE);
+	_system("rm -f " IMAGE_LOOP, 0);
+}
+
 static void LuksKeyslotAdd(void)
 {
 	enum { OFFSET_1M = 2048 , OFFSET_2M = 4096, OFFSET_4M = 8192, OFFSET_8M = 16384 };
@@ -2398,11 +3528,31 @@ int main(int argc, char *argv[])
 	RUN_(UseTempVolumes, "Format and use temporary encrypted device");
 	RUN_(CallbacksTest, "API callbacks");
 	RUN_(VerityTest, "DM verity");
+	RUN_(VerityUpdate, "DM verity hash area update and report");
+	RUN_(VerityPrefetchHash, "DM verity hash tree prefetch");
+	RUN_(WaitActiveDeviceFailures, "Wait for integrity and verity failures");
 	RUN_(TcryptTest, "Tcrypt API");
+	RUN_(TcryptAdopt, "LUKS2 header for existing TCRYPT data");
 	RUN_(IntegrityTest, "Integrity API");
 	RUN_(ResizeIntegrity, "Integrity raw resize");
 	RUN_(ResizeIntegrityWithKey, "Integrity raw resize with key");
+	RUN_(IntegrityWipeTags, "Integrity tags initialization");
+	RUN_(IntegrityRecalculateTags, "Integrity tags recalculation");
+	RUN_(IntegrityVerifyTags, "Integrity tags verification");
+	RUN_(IntegrityMetadataSize, "Integrity metadata device size");
 	RUN_(WipeTest, "Wipe device");
+	RUN_(WipeQueueDepth, "Wipe device with several writes in flight");
+	RUN_(WipeCheckpoint, "Resumable wipe with checkpoint");
+	RUN_(LuksPassphraseBatch, "LUKS passphrase batch test");
+	RUN_(LuksDerivedKeyCache, "LUKS derived key cache");
+	RUN_(LuksPbkdfCache, "PBKDF calibration cache");
+	RUN_(BitlkRecoveryKey, "BITLK recovery password search");
+	RUN_(VolumeReadDecrypt, "BITLK userspace decryption");
+	RUN_(LuksKeyslotDestroyAll, "Destroy all LUKS keyslots");
+	RUN_(AsyncActivation, "Asynchronous activation");
+	RUN_(UdevSync, "Device-mapper without udev synchronization");
+	RUN_(InlineCryptoSupported, "Inline encryption hardware capability");
+	RUN_(LoopDirectIo, "Loop device direct-io for image files");
 	RUN_(LuksKeyslotAdd, "Adding keyslot via new API");
 	RUN_(VolumeKeyGet, "Getting volume key via keyslot context API");
 
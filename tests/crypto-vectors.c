@@ -951,6 +951,38 @@ static struct cipher_iv_test_vector cipher_iv_test_vectors[] = {
 		"\xdb\xe7\xd2\x25\xb0\x4f\x5d\x36\x20\xc4\xc2\xb4\xe8\x7e\xae\xe9"
 		"\x95\x10\x45\x5d\xdd\xc4\xcd\x33\xad\xbd\x39\x49\xf2\x85\x82\x4c"
 	},
+}},
+{
+	"aes", "xts",
+	"\x01\x08\x0f\x16\x1d\x24\x2b\x32\x39\x40\x47\x4e\x55\x5c\x63\x6a"
+	"\x71\x78\x7f\x86\x8d\x94\x9b\xa2\xa9\xb0\xb7\xbe\xc5\xcc\xd3\xda"
+	"\xe1\xe8\xef\xf6\xfd\x04\x0b\x12\x19\x20\x27\x2e\x35\x3c\x43\x4a"
+	"\x51\x58\x5f\x66\x6d\x74\x7b\x82\x89\x90\x97\x9e\xa5\xac\xb3\xba", 64,
+	"plain64", 0, 8192,
+	"\x9f\x1d\xcb\xc3\x5c\x35\x0d\x60\x27\xf9\x8b\xe0\xf5\xc8\xb4\x3b"
+	"\x42\xca\x52\xb7\x60\x44\x59\xc0\xc4\x2b\xe3\xaa\x88\x91\x3d\x47", {
+	{	512, false,
+		"\xb4\x3c\x5e\x93\x0a\xcf\x10\x40\x15\x37\x26\x7c\x66\x9e\xfb\x83"
+		"\xcf\x09\xbb\x05\xa4\x42\x53\xd2\x92\xf4\xe9\xd8\xb5\x16\x5a\xd4"
+	},{	1024, false,
+		"\x2d\x8f\x21\xf8\xda\x00\x1c\xb3\x8a\x33\xaf\x20\xfd\x2c\x26\x26"
+		"\xcc\x00\x14\xce\xd0\x19\xfb\x49\x48\x05\xcc\x6a\xa7\x8d\x61\xa6"
+	},{	1024, true,
+		"\xfd\xd7\x6f\x37\xa5\x51\x5f\x45\x5b\x4d\xee\x93\x0a\x6b\xb6\x81"
+		"\xa5\xd7\xdb\x2e\xfd\xec\xbb\xf8\xc8\x4e\xb8\xf9\x9a\xac\xc2\xe9"
+	},{	2048, false,
+		"\xef\x7c\x70\x46\x65\xba\x15\xdb\xf0\x94\x48\x78\xd2\x3d\xfe\xc8"
+		"\x2e\x54\xe4\xca\xa1\x38\x4e\xdd\x20\x38\x83\x61\x64\xd5\x8b\xc3"
+	},{	2048, true,
+		"\x79\x6d\xb5\xe9\x0e\x8d\x34\xbd\xcb\x09\x40\x3b\xdc\x37\x11\x2e"
+		"\x9d\x2f\x50\x0d\x77\x4d\xdd\xac\x7b\x20\x33\x0a\x25\xe5\x68\x9e"
+	},{	4096, false,
+		"\xb9\x7a\xbe\x3b\x3e\x0c\x21\x41\xec\xb6\x08\x7f\xba\x4d\xa5\x09"
+		"\x4a\x90\xaa\x26\x46\x64\x2f\x14\x2c\xbb\x09\x04\xb4\x3a\x0b\x03"
+	},{	4096, true,
+		"\xc5\xaa\xbe\x99\x60\x1a\x89\xb9\x2e\xaa\x01\xab\x0c\x0e\x69\xca"
+		"\xb7\x01\xc5\xa1\x26\x4a\xc8\x7c\x62\x89\xb2\x8a\xf6\x63\xd9\x66"
+	},
 }}};
 
 /* Base64 test vectors */
@@ -1053,6 +1085,56 @@ static int pbkdf_test_vectors(void)
 	return EXIT_SUCCESS;
 }
 
+#define PBKDF2_BATCH_JOBS 11
+
+static int pbkdf2_batch_test(void)
+{
+	struct crypt_pbkdf2_job jobs[PBKDF2_BATCH_JOBS];
+	char keys[PBKDF2_BATCH_JOBS][256], result[256];
+	const struct kdf_test_vector *vec;
+	unsigned int i, j;
+
+	printf("PBKDF2 BATCH:");
+	for (i = 0; i < ARRAY_SIZE(kdf_test_vectors); i++) {
+		vec = &kdf_test_vectors[i];
+		if (strcmp(vec->type, "pbkdf2") || vec->iterations > 5000 ||
+		    crypt_hmac_size(vec->hash) < 0)
+			continue;
+
+		/* different password in every lane, the first one is the vector */
+		for (j = 0; j < PBKDF2_BATCH_JOBS; j++) {
+			jobs[j].password = vec->password;
+			jobs[j].password_length = vec->password_length ? vec->password_length - j % vec->password_length : 0;
+			jobs[j].salt = vec->salt;
+			jobs[j].salt_length = vec->salt_length;
+			jobs[j].key = keys[j];
+		}
+
+		if (crypt_pbkdf2_batch(vec->hash, 2, vec->iterations, vec->output_length,
+				       jobs, PBKDF2_BATCH_JOBS) < 0) {
+			printf("[%s N/A]", vec->hash);
+			continue;
+		}
+
+		for (j = 0; j < PBKDF2_BATCH_JOBS; j++) {
+			if (crypt_pbkdf("pbkdf2", vec->hash, jobs[j].password, jobs[j].password_length,
+					vec->salt, vec->salt_length, result, vec->output_length,
+					vec->iterations, 0, 0) < 0)
+				return EXIT_FAILURE;
+			if (memcmp(keys[j], j ? result : vec->output, vec->output_length)) {
+				printf("[FAILED]\n");
+				printhex(" got", keys[j], vec->output_length);
+				printhex("want", j ? result : vec->output, vec->output_length);
+				return EXIT_FAILURE;
+			}
+		}
+		printf("[%02d %s]", i, vec->hash);
+	}
+	printf("\n");
+
+	return EXIT_SUCCESS;
+}
+
 static int crc32_test(const struct hash_test_vector *vector, unsigned int i)
 {
 	uint32_t crc32;
@@ -1078,9 +1160,9 @@ static int crc32_test(const struct hash_test_vector *vector, unsigned int i)
 static int hash_test(void)
 {
 	const struct hash_test_vector *vector;
-	unsigned int i, j;
+	unsigned int i, j, half;
 	int r;
-	struct crypt_hash *h;
+	struct crypt_hash *h, *h2;
 	char result[64];
 
 	for (i = 0; i < ARRAY_SIZE(hash_test_vectors); i++) {
@@ -1150,6 +1232,43 @@ static int hash_test(void)
 				return EXIT_FAILURE;
 			}
 
+			/*
+			 * Explicit reset drops written data, clone continues from the current state
+			 */
+			half = vector->data_length / 2;
+			r = crypt_hash_write(h, vector->data, vector->data_length);
+			if (!r)
+				r = crypt_hash_reset(h);
+			if (!r)
+				r = crypt_hash_write(h, vector->data, half);
+			if (!r)
+				r = crypt_hash_clone(&h2, h);
+			if (r) {
+				printf("[FAILED (CLONE)]\n");
+				crypt_hash_destroy(h);
+				return EXIT_FAILURE;
+			}
+
+			crypt_backend_memzero(result, sizeof(result));
+			r = crypt_hash_write(h2, vector->data + half, vector->data_length - half);
+			if (!r)
+				r = crypt_hash_final(h2, result, vector->out[j].length);
+			crypt_hash_destroy(h2);
+			if (!r && !memcmp(result, vector->out[j].out, vector->out[j].length)) {
+				crypt_backend_memzero(result, sizeof(result));
+				r = crypt_hash_write(h, vector->data + half, vector->data_length - half);
+				if (!r)
+					r = crypt_hash_final(h, result, vector->out[j].length);
+			}
+
+			if (r || memcmp(result, vector->out[j].out, vector->out[j].length)) {
+				printf("[FAILED (CLONE)]\n");
+				printhex(" got", result, vector->out[j].length);
+				printhex("want", vector->out[j].out, vector->out[j].length);
+				crypt_hash_destroy(h);
+				return EXIT_FAILURE;
+			}
+
 			crypt_hash_destroy(h);
 		}
 		printf("\n");
@@ -1161,8 +1280,8 @@ static int hash_test(void)
 static int hmac_test(void)
 {
 	const struct hmac_test_vector *vector;
-	struct crypt_hmac *hmac;
-	unsigned int i, j;
+	struct crypt_hmac *hmac, *hmac2;
+	unsigned int i, j, half;
 	int r;
 	char result[64];
 
@@ -1222,6 +1341,48 @@ static int hmac_test(void)
 				return EXIT_FAILURE;
 			}
 
+			/*
+			 * Explicit reset drops written data, clone continues from the current state
+			 */
+			half = vector->data_length / 2;
+			r = crypt_hmac_write(hmac, vector->data, vector->data_length);
+			if (!r)
+				r = crypt_hmac_reset(hmac);
+			if (!r)
+				r = crypt_hmac_write(hmac, vector->data, half);
+			if (!r)
+				r = crypt_hmac_clone(&hmac2, hmac);
+			if (r == -ENOTSUP) {
+				printf("[clone N/A]");
+				crypt_hmac_destroy(hmac);
+				continue;
+			}
+			if (r) {
+				printf("[FAILED (CLONE)]\n");
+				crypt_hmac_destroy(hmac);
+				return EXIT_FAILURE;
+			}
+
+			crypt_backend_memzero(result, sizeof(result));
+			r = crypt_hmac_write(hmac2, vector->data + half, vector->data_length - half);
+			if (!r)
+				r = crypt_hmac_final(hmac2, result, vector->out[j].length);
+			crypt_hmac_destroy(hmac2);
+			if (!r && !memcmp(result, vector->out[j].out, vector->out[j].length)) {
+				crypt_backend_memzero(result, sizeof(result));
+				r = crypt_hmac_write(hmac, vector->data + half, vector->data_length - half);
+				if (!r)
+					r = crypt_hmac_final(hmac, result, vector->out[j].length);
+			}
+
+			if (r || memcmp(result, vector->out[j].out, vector->out[j].length)) {
+				printf("[FAILED (CLONE)]\n");
+				printhex(" got", result, vector->out[j].length);
+				printhex("want", vector->out[j].out, vector->out[j].length);
+				crypt_hmac_destroy(hmac);
+				return EXIT_FAILURE;
+			}
+
 			crypt_hmac_destroy(hmac);
 		}
 		printf("\n");
@@ -1298,6 +1459,97 @@ static int cipher_test(void)
 	return EXIT_SUCCESS;
 }
 
+/*
+ * Multi-sector runs with per-sector IVs must match one call per sector.
+ * Separate page aligned output also covers zero-copy kernel cipher input,
+ * run lengths cover partial async queue and IV-less (ECB) batching.
+ */
+static int cipher_sectors_test(void)
+{
+	static const struct {
+		const char *name, *mode;
+		size_t key_length, iv_length, sector_size, sectors;
+	} runs[] = {
+		{ "aes", "cbc", 16, 16,  512, 37 },
+		{ "aes", "cbc", 32, 16, 4096, 19 },
+		{ "aes", "xts", 64, 16, 4096,  3 },
+		{ "aes", "ecb", 16,  0,  512, 300 },
+	};
+	struct crypt_cipher *cipher;
+	unsigned int i;
+	size_t j, length;
+	char key[64], *iv = NULL, *in = NULL, *out = NULL, *ref = NULL;
+	int r = EXIT_FAILURE;
+
+	for (i = 0; i < sizeof(key); i++)
+		key[i] = (char)(i * 11 + 3);
+
+	for (i = 0; i < ARRAY_SIZE(runs); i++) {
+		printf("SECTORS run %02d: [%s-%s,%zux%zu]", i, runs[i].name, runs[i].mode,
+		       runs[i].sectors, runs[i].sector_size);
+
+		if (crypt_cipher_init(&cipher, runs[i].name, runs[i].mode, key, runs[i].key_length)) {
+			printf("[N/A]\n");
+			continue;
+		}
+
+		length = runs[i].sectors * runs[i].sector_size;
+		iv = malloc(runs[i].sectors * 16);
+		if (!iv || posix_memalign((void **)&in, 4096, length) ||
+		    posix_memalign((void **)&out, 4096, length) ||
+		    posix_memalign((void **)&ref, 4096, length)) {
+			crypt_cipher_destroy(cipher);
+			goto out;
+		}
+
+		for (j = 0; j < length; j++)
+			in[j] = (char)(j * 7 + (j >> 9));
+		for (j = 0; j < runs[i].sectors * 16; j++)
+			iv[j] = (char)(j * 3 + i);
+
+		for (j = 0; j < runs[i].sectors; j++)
+			if (crypt_cipher_encrypt(cipher, &in[j * runs[i].sector_size], &ref[j * runs[i].sector_size],
+						 runs[i].sector_size, runs[i].iv_length ? &iv[j * 16] : NULL,
+						 runs[i].iv_length)) {
+				crypt_cipher_destroy(cipher);
+				goto out;
+			}
+
+		if (crypt_cipher_encrypt_sectors(cipher, in, out, runs[i].sector_size, runs[i].sectors,
+						 runs[i].iv_length ? iv : NULL, runs[i].iv_length) ||
+		    memcmp(out, ref, length)) {
+			printf("[ENCRYPTION FAILED]\n");
+			crypt_cipher_destroy(cipher);
+			goto out;
+		}
+
+		/* in-place */
+		if (crypt_cipher_decrypt_sectors(cipher, out, out, runs[i].sector_size, runs[i].sectors,
+						 runs[i].iv_length ? iv : NULL, runs[i].iv_length) ||
+		    memcmp(out, in, length)) {
+			printf("[DECRYPTION FAILED]\n");
+			crypt_cipher_destroy(cipher);
+			goto out;
+		}
+
+		crypt_cipher_destroy(cipher);
+		free(iv);
+		free(in);
+		free(out);
+		free(ref);
+		iv = in = out = ref = NULL;
+		printf("\n");
+	}
+
+	r = EXIT_SUCCESS;
+out:
+	free(iv);
+	free(in);
+	free(out);
+	free(ref);
+	return r;
+}
+
 static void get_sha256(const char *in, size_t length, char out[32])
 {
 	struct crypt_hash *h;
@@ -1380,6 +1632,285 @@ static int cipher_iv_test(void)
 	return EXIT_SUCCESS;
 }
 
+/*
+ * loop-AES multi-key LMK vectors (v2 64 keys, v3 64 keys and seed),
+ * 64 zeroed sectors, key bytes are (i * 13 + 7)
+ */
+static struct {
+	const char *cipher;
+	unsigned int key_length;
+	uint64_t iv_offset;
+	const char in_sha256[32];
+	const char out_sha256[32];
+} lmk_test_vectors[] = {
+{
+	"aes:64", 64 * 16, 0,
+	"\xc3\x50\x20\x47\x3a\xed\x1b\x46\x42\xcd\x72\x6c\xad\x72\x7b\x63"
+	"\xff\xf2\x82\x4a\xd6\x8c\xed\xd7\xff\xb7\x3c\x7c\xbd\x89\x04\x79",
+	"\xa4\x23\x91\x21\xb5\x91\x65\x7e\x3f\x55\x7c\x67\xeb\x81\x1c\x7c"
+	"\x3d\xc7\x4b\x54\x1a\x55\x9f\xd1\x86\x89\x8a\xb4\x05\xef\x03\xb0"
+},{
+	"aes:64", 65 * 32, 0x123456789abcdeefULL,
+	"\xc3\x50\x20\x47\x3a\xed\x1b\x46\x42\xcd\x72\x6c\xad\x72\x7b\x63"
+	"\xff\xf2\x82\x4a\xd6\x8c\xed\xd7\xff\xb7\x3c\x7c\xbd\x89\x04\x79",
+	"\x41\x7c\x49\x45\xe3\xbd\x54\x85\xb8\x07\xd8\x81\x15\x93\x8d\x5d"
+	"\xf7\x4d\xf5\x36\x64\x4e\x6c\xeb\x0e\x1b\x97\xe5\x35\x67\x82\x70"
+}};
+
+static int storage_lmk_test(void)
+{
+	struct crypt_storage *storage;
+	unsigned int i, j;
+	char key[65 * 32], hash[32], *buf;
+	size_t length = 64 * 512;
+	int r = EXIT_FAILURE;
+
+	buf = malloc(length);
+	if (!buf)
+		return EXIT_FAILURE;
+
+	for (i = 0; i < ARRAY_SIZE(lmk_test_vectors); i++) {
+		printf("LMK vector %02d: [%s-cbc-lmk,%u bytes key]", i,
+		       lmk_test_vectors[i].cipher, lmk_test_vectors[i].key_length);
+
+		for (j = 0; j < lmk_test_vectors[i].key_length; j++)
+			key[j] = (char)(j * 13 + 7);
+
+		if (crypt_storage_init(&storage, 512, lmk_test_vectors[i].cipher, "cbc-lmk",
+				       key, lmk_test_vectors[i].key_length, false)) {
+			printf("[N/A]\n");
+			continue;
+		}
+
+		memset(buf, 0, length);
+		if (crypt_storage_encrypt(storage, lmk_test_vectors[i].iv_offset, length, buf)) {
+			crypt_storage_destroy(storage);
+			goto out;
+		}
+
+		get_sha256(buf, length, hash);
+		if (memcmp(lmk_test_vectors[i].out_sha256, hash, sizeof(hash))) {
+			printf("[ENCRYPTION FAILED]\n");
+			crypt_storage_destroy(storage);
+			goto out;
+		}
+
+		if (crypt_storage_decrypt(storage, lmk_test_vectors[i].iv_offset, length, buf)) {
+			crypt_storage_destroy(storage);
+			goto out;
+		}
+
+		get_sha256(buf, length, hash);
+		crypt_storage_destroy(storage);
+		if (memcmp(lmk_test_vectors[i].in_sha256, hash, sizeof(hash))) {
+			printf("[DECRYPTION FAILED]\n");
+			goto out;
+		}
+		printf("[OK]\n");
+	}
+	r = EXIT_SUCCESS;
+out:
+	free(buf);
+	return r;
+}
+
+static int storage_parallel_test(void)
+{
+	const struct cipher_iv_test_vector *vector;
+	struct crypt_storage_parallel *ps;
+	struct crypt_storage *storage;
+	unsigned int i, j;
+	char mode_iv[256];
+	char *buf1, *buf2;
+	size_t length = 1024 * 1024;
+	int r = EXIT_FAILURE;
+
+	buf1 = malloc(length);
+	buf2 = malloc(length);
+	if (!buf1 || !buf2)
+		goto out;
+
+	for (i = 0; i < length; i++)
+		buf1[i] = (char)(i * 7 + (i >> 12));
+
+	for (i = 0; i < ARRAY_SIZE(cipher_iv_test_vectors); i++) {
+		vector = &cipher_iv_test_vectors[i];
+		printf("PARALLEL vector %02d: [%s-%s-%s]", i, vector->cipher_name, vector->cipher_mode, vector->iv_name);
+
+		for (j = 0; j < ARRAY_SIZE(vector->out); j++) {
+			if (snprintf(mode_iv, sizeof(mode_iv)-2, "%s-%s", vector->cipher_mode, vector->iv_name) < 0)
+				goto out;
+
+			if (crypt_storage_init(&storage, vector->out[j].sector_size, vector->cipher_name, mode_iv,
+					       vector->key, vector->key_length, vector->out[j].large_iv)) {
+				printf("[N/A]");
+				continue;
+			}
+
+			if (crypt_storage_parallel_init(&ps, 4, vector->out[j].sector_size, vector->cipher_name, mode_iv,
+					       vector->key, vector->key_length, vector->out[j].large_iv)) {
+				crypt_storage_destroy(storage);
+				goto out;
+			}
+			printf("[%i%s]", (int)vector->out[j].sector_size, vector->out[j].large_iv ? "L" : "");
+
+			memcpy(buf2, buf1, length);
+			if (crypt_storage_encrypt(storage, vector->iv_offset + 8, length, buf1) ||
+			    crypt_storage_parallel_encrypt(ps, vector->iv_offset + 8, length, buf2) ||
+			    memcmp(buf1, buf2, length)) {
+				printf("[ENCRYPTION FAILED]\n");
+				crypt_storage_parallel_destroy(ps);
+				crypt_storage_destroy(storage);
+				goto out;
+			}
+
+			if (crypt_storage_decrypt(storage, vector->iv_offset + 8, length, buf1) ||
+			    crypt_storage_parallel_decrypt(ps, vector->iv_offset + 8, length, buf2) ||
+			    memcmp(buf1, buf2, length)) {
+				printf("[DECRYPTION FAILED]\n");
+				crypt_storage_parallel_destroy(ps);
+				crypt_storage_destroy(storage);
+				goto out;
+			}
+
+			if (crypt_storage_decrypt(storage, vector->iv_offset, length, buf1) ||
+			    crypt_storage_encrypt(storage, vector->iv_offset + 16, length, buf1) ||
+			    crypt_storage_parallel_reencrypt(ps, vector->iv_offset, ps, vector->iv_offset + 16, length, buf2) ||
+			    memcmp(buf1, buf2, length)) {
+				printf("[REENCRYPTION FAILED]\n");
+				crypt_storage_parallel_destroy(ps);
+				crypt_storage_destroy(storage);
+				goto out;
+			}
+
+			crypt_storage_parallel_destroy(ps);
+			crypt_storage_destroy(storage);
+		}
+		printf("\n");
+	}
+
+	r = EXIT_SUCCESS;
+out:
+	free(buf1);
+	free(buf2);
+	return r;
+}
+
+static int hash_blocks_test(void)
+{
+	static const char *hashes[] = { "sha1", "sha256", "sha512" };
+	struct crypt_hash *h;
+	unsigned int i, j, k;
+	char *buf, *digests, digest[64];
+	size_t block_size = 4096, length = 4 * 1024 * 1024, digest_size, salt_size;
+	int r = EXIT_FAILURE;
+
+	buf = malloc(length);
+	digests = malloc(length / block_size * sizeof(digest));
+	if (!buf || !digests)
+		goto out;
+
+	for (i = 0; i < length; i++)
+		buf[i] = (char)(i * 13 + (i >> 10));
+
+	printf("HASH BLOCKS:");
+	for (i = 0; i < ARRAY_SIZE(hashes); i++) {
+		if (crypt_hash_size(hashes[i]) < 0) {
+			printf("[%s N/A]", hashes[i]);
+			continue;
+		}
+		digest_size = crypt_hash_size(hashes[i]);
+		printf("[%s]", hashes[i]);
+
+		if (crypt_hash_blocks(hashes[i], 4, buf, length, block_size, digests, digest_size)) {
+			printf("[FAILED]\n");
+			goto out;
+		}
+
+		for (j = 0; j < length / block_size; j++) {
+			if (crypt_hash_init(&h, hashes[i]))
+				goto out;
+			if (crypt_hash_write(h, buf + j * block_size, block_size) ||
+			    crypt_hash_final(h, digest, digest_size)) {
+				crypt_hash_destroy(h);
+				goto out;
+			}
+			crypt_hash_destroy(h);
+
+			if (memcmp(digest, digests + j * digest_size, digest_size)) {
+				printf("[BLOCK %u MISMATCH]\n", j);
+				goto out;
+			}
+		}
+
+		/* salt before and after block, salt longer than one SHA-256 block, partial lanes */
+		for (k = 0; k < 4; k++) {
+			salt_size = k & 1 ? 80 : 32;
+			if (crypt_hash_salted_blocks(hashes[i], buf + length - salt_size, salt_size, k < 2,
+						     buf, block_size, 13, digests, digest_size)) {
+				printf("[SALTED FAILED]\n");
+				goto out;
+			}
+
+			for (j = 0; j < 13; j++) {
+				if (crypt_hash_init(&h, hashes[i]))
+					goto out;
+				if ((k < 2 && crypt_hash_write(h, buf + length - salt_size, salt_size)) ||
+				    crypt_hash_write(h, buf + j * block_size, block_size) ||
+				    (k >= 2 && crypt_hash_write(h, buf + length - salt_size, salt_size)) ||
+				    crypt_hash_final(h, digest, digest_size)) {
+					crypt_hash_destroy(h);
+					goto out;
+				}
+				crypt_hash_destroy(h);
+
+				if (memcmp(digest, digests + j * digest_size, digest_size)) {
+					printf("[SALTED BLOCK %u MISMATCH]\n", j);
+					goto out;
+				}
+			}
+		}
+
+		/* AF diffuse blocks, index prefix, in place over a copy, partial lanes */
+		memcpy(digests, buf, 13 * digest_size);
+		if (crypt_hash_init(&h, hashes[i]))
+			goto out;
+		if (crypt_hash_indexed_blocks(h, hashes[i], 5, digests, digest_size, 13, digests)) {
+			crypt_hash_destroy(h);
+			printf("[INDEXED FAILED]\n");
+			goto out;
+		}
+		crypt_hash_destroy(h);
+
+		for (j = 0; j < 13; j++) {
+			salt_size = j + 5;
+			digest[0] = (char)(salt_size >> 24); digest[1] = (char)(salt_size >> 16);
+			digest[2] = (char)(salt_size >> 8); digest[3] = (char)salt_size;
+			if (crypt_hash_init(&h, hashes[i]))
+				goto out;
+			if (crypt_hash_write(h, digest, 4) ||
+			    crypt_hash_write(h, buf + j * digest_size, digest_size) ||
+			    crypt_hash_final(h, digest, digest_size)) {
+				crypt_hash_destroy(h);
+				goto out;
+			}
+			crypt_hash_destroy(h);
+
+			if (memcmp(digest, digests + j * digest_size, digest_size)) {
+				printf("[INDEXED BLOCK %u MISMATCH]\n", j);
+				goto out;
+			}
+		}
+	}
+	printf("\n");
+
+	r = EXIT_SUCCESS;
+out:
+	free(buf);
+	free(digests);
+	return r;
+}
+
 static int check_hash(const char *hash)
 {
 	struct crypt_hash *h;
@@ -1394,6 +1925,33 @@ static int check_hash(const char *hash)
 	return EXIT_SUCCESS;
 }
 
+/* Short input uses byte steps, the long one also the accelerated paths */
+static int crc32_long_test(void)
+{
+	unsigned char buf[1000];
+	unsigned int i;
+
+	for (i = 0; i < sizeof(buf); i++)
+		buf[i] = (unsigned char)(i * 7 + 3);
+
+	printf("CRC32 ");
+	if ((crypt_crc32(~0, (const unsigned char *)"123456789", 9) ^ ~0) != 0xcbf43926 ||
+	    (crypt_crc32(~0, buf, sizeof(buf)) ^ ~0) != 0x17bc2a46) {
+		printf("[FAILED]\n");
+		return EXIT_FAILURE;
+	}
+	printf("[crc32]");
+
+	if ((crypt_crc32c(~0, (const unsigned char *)"123456789", 9) ^ ~0) != 0xe3069283 ||
+	    (crypt_crc32c(~0, buf, sizeof(buf)) ^ ~0) != 0xdd2edff7) {
+		printf("[FAILED]\n");
+		return EXIT_FAILURE;
+	}
+	printf("[crc32c]\n");
+
+	return EXIT_SUCCESS;
+}
+
 static int base64_test(void)
 {
 	unsigned int i;
@@ -1527,6 +2085,9 @@ int main(__attribute__ ((unused)) int argc, __attribute__ ((unused))char *argv[]
 	if (pbkdf_test_vectors())
 		exit_test("PBKDF test failed.", EXIT_FAILURE);
 
+	if (pbkdf2_batch_test())
+		exit_test("PBKDF2 batch test failed.", EXIT_FAILURE);
+
 	if (hash_test())
 		exit_test("HASH test failed.", EXIT_FAILURE);
 
@@ -1539,6 +2100,18 @@ int main(__attribute__ ((unused)) int argc, __attribute__ ((unused))char *argv[]
 	if (cipher_iv_test())
 		exit_test("IV test failed.", EXIT_FAILURE);
 
+	if (cipher_sectors_test())
+		exit_test("CIPHER sectors test failed.", EXIT_FAILURE);
+
+	if (storage_parallel_test())
+		exit_test("Parallel storage test failed.", EXIT_FAILURE);
+
+	if (storage_lmk_test())
+		exit_test("LMK storage test failed.", EXIT_FAILURE);
+
+	if (hash_blocks_test())
+		exit_test("Hash blocks test failed.", EXIT_FAILURE);
+
 	if (base64_test())
 		exit_test("BASE64 test failed.", EXIT_FAILURE);
 
@@ -1548,6 +2121,9 @@ int main(__attribute__ ((unused)) int argc, __attribute__ ((unused))char *argv[]
 	if (utf8_16_test())
 		exit_test("UTF8/16 test failed.", EXIT_FAILURE);
 
+	if (crc32_long_test())
+		exit_test("CRC32 test failed.", EXIT_FAILURE);
+
 	if (default_alg_test()) {
 		if (fips_mode())
 			printf("\nDefault compiled-in algorithms test ignored (FIPS mode on).\n");
@@ -26,6 +26,7 @@ extern "C" {
 #include "luks2/luks2.h"
 #include "crypto_backend/crypto_backend.h"
 #include "FuzzerInterface.h"
+#include "fuzz_time_budget.h"
 
 static int calculate_checksum(const uint8_t* data, size_t size) {
 	struct crypt_hash *hd = NULL;
@@ -85,6 +86,7 @@ out:
 int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
 	int fd;
 	struct crypt_device *cd = NULL;
+	struct timespec start;
 	char name[] = "/tmp/test-script-fuzz.XXXXXX";
 
 	if (calculate_checksum(data, size))
@@ -101,8 +103,12 @@ int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
 	if (write_buffer(fd, data, size) != (ssize_t)size)
 		goto out;
 
-	if (crypt_init(&cd, name) == 0)
+	if (crypt_init(&cd, name) == 0) {
+		/* LUKS2_hdr_read() including LUKS2_hdr_validate() of both headers */
+		fuzz_time_start(&start);
 		(void)crypt_load(cd, CRYPT_LUKS2, NULL);
+		fuzz_time_check(&start, "LUKS2 load");
+	}
 	crypt_free(cd);
 out:
 	close(fd);
@@ -23,12 +23,14 @@ extern "C" {
 #include "luks1/luks.h"
 #include "crypto_backend/crypto_backend.h"
 #include "FuzzerInterface.h"
+#include "fuzz_time_budget.h"
 
 void empty_log(int level, const char *msg, void *usrptr) {}
 
 int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
 	int fd, r;
 	struct crypt_device *cd = NULL;
+	struct timespec start;
 	char name[] = "/tmp/test-script-fuzz.XXXXXX";
 
 	fd = mkostemp(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC);
@@ -45,15 +47,21 @@ int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
 	crypt_set_log_callback(NULL, empty_log, NULL);
 
 	if (crypt_init(&cd, name) == 0) {
+		fuzz_time_start(&start);
 		r = crypt_load(cd, CRYPT_LUKS1, NULL);
+		fuzz_time_check(&start, "LUKS1 load");
 		if (r == 0)
 			goto out;
 
+		fuzz_time_start(&start);
 		r = crypt_load(cd, CRYPT_FVAULT2, NULL);
+		fuzz_time_check(&start, "FVAULT2 load");
 		if (r == 0)
 			goto out;
 
+		fuzz_time_start(&start);
 		(void) crypt_load(cd, CRYPT_BITLK, NULL);
+		fuzz_time_check(&start, "BITLK load");
 	}
 out:
 	crypt_free(cd);
@@ -29,10 +29,12 @@ extern "C" {
 #include <err.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include "fuzz_time_budget.h"
 }
 
 DEFINE_PROTO_FUZZER(const json_proto::LUKS2_both_headers &headers) {
   struct crypt_device *cd = NULL;
+  struct timespec start;
   char name[] = "/tmp/test-proto-fuzz.XXXXXX";
   int fd = mkostemp(name, O_RDWR|O_CREAT|O_EXCL|O_CLOEXEC);
 
@@ -42,8 +44,11 @@ DEFINE_PROTO_FUZZER(const json_proto::LUKS2_both_headers &headers) {
   json_proto::LUKS2ProtoConverter converter;
   converter.convert(headers, fd);
 
-  if (crypt_init(&cd, name) == 0)
+  if (crypt_init(&cd, name) == 0) {
+    fuzz_time_start(&start);
     (void)crypt_load(cd, CRYPT_LUKS2, NULL);
+    fuzz_time_check(&start, "LUKS2 load");
+  }
   crypt_free(cd);
 
   close(fd);
@@ -0,0 +1,71 @@
+/*
+ * cryptsetup fuzz targets per-input time budget
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef FUZZ_TIME_BUDGET_H
+#define FUZZ_TIME_BUDGET_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+/*
+ * Header parsing must stay fast even for hostile input (device scanners
+ * run it on every new block device). With CRYPTSETUP_FUZZ_TIME_BUDGET_MS
+ * set, an input exceeding the budget in one measured section aborts,
+ * so libFuzzer stores it as a crash artifact to be added as regression seed.
+ * libFuzzer -timeout is in seconds and intended for hangs only.
+ */
+static unsigned fuzz_time_budget_ms(void)
+{
+	static int budget = -1;
+	const char *env;
+
+	if (budget < 0) {
+		env = getenv("CRYPTSETUP_FUZZ_TIME_BUDGET_MS");
+		budget = env ? atoi(env) : 0;
+		if (budget < 0)
+			budget = 0;
+	}
+
+	return (unsigned)budget;
+}
+
+static void fuzz_time_start(struct timespec *start)
+{
+	if (fuzz_time_budget_ms())
+		clock_gettime(CLOCK_MONOTONIC, start);
+}
+
+static void fuzz_time_check(const struct timespec *start, const char *what)
+{
+	struct timespec end;
+	unsigned budget = fuzz_time_budget_ms();
+	double ms;
+
+	if (!budget)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	ms = (end.tv_sec - start->tv_sec) * 1000.0 + (end.tv_nsec - start->tv_nsec) / 1000000.0;
+	if (ms > budget) {
+		fprintf(stderr, "%s took %.1f ms, time budget is %u ms.\n", what, ms, budget);
+		abort();
+	}
+}
+
+#endif
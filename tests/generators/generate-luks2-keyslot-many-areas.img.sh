@@ -0,0 +1,73 @@
+#!/bin/bash
+
+. lib.sh
+
+#
+# *** Description ***
+#
+# generate valid header with thousands of keyslots (ids beyond
+# LUKS2_KEYSLOTS_MAX) filling 4 MiB metadata, all assigned to one digest.
+#
+# Regression input for header parse time, keyslot validation used
+# to search all digests for every keyslot and area validation used
+# to compare all area pairs.
+#
+
+# $1 full target dir
+# $2 full source luks2 image
+
+function generate()
+{
+	TEST_MDA_SIZE=$LUKS2_HDR_SIZE_4M
+	TEST_MDA_SIZE_BYTES=$((TEST_MDA_SIZE*512))
+	TEST_JSN_SIZE=$((TEST_MDA_SIZE-LUKS2_BIN_HDR_SIZE))
+	JSON_SIZE=$((TEST_JSN_SIZE*512))
+	KEYSLOTS_OFFSET=$((TEST_MDA_SIZE*1024))
+
+	# size of one more keyslot in json
+	KS_LEN=$(jq -c '.keyslots."0" | .area.offset = "18446744073709551615" | .area.size = "4096"' $TMPDIR/json0 | wc -c)
+	BASE_LEN=$(jq -c . $TMPDIR/json0 | wc -c)
+	KEYSLOTS=$(((JSON_SIZE*90/100-BASE_LEN)/(KS_LEN+16)))
+	# 4 KiB keyslot areas, keyslots area rounded to 1MiB
+	KEYSLOTS_SIZE=$(((KEYSLOTS*4096+1048575)/1048576*1048576))
+
+	json_str=$(jq -c --argjson ks $KEYSLOTS --argjson koff $KEYSLOTS_OFFSET \
+		   --argjson jsize $JSON_SIZE --argjson ksize $KEYSLOTS_SIZE \
+		'.keyslots."0" as $k0 |
+		.keyslots = ([range($ks)] | map(. as $i | { key: ($i | tostring),
+			value: ($k0 | .area.offset = (($koff + $i * 4096) | tostring) |
+				.area.size = "4096") }) | from_entries) |
+		.digests."0".keyslots = [range($ks) | tostring] |
+		.segments."0".offset = (($koff + $ksize) | tostring) |
+		.config.json_size = ($jsize | tostring) |
+		.config.keyslots_size = ($ksize | tostring)' $TMPDIR/json0)
+	test -n "$json_str" || exit 2
+	test ${#json_str} -lt $JSON_SIZE || exit 2
+
+	write_luks2_json "$json_str" $TMPDIR/json0 $TEST_JSN_SIZE
+	write_luks2_json "$json_str" $TMPDIR/json1 $TEST_JSN_SIZE
+
+	write_bin_hdr_size $TMPDIR/hdr0 $TEST_MDA_SIZE_BYTES
+	write_bin_hdr_size $TMPDIR/hdr1 $TEST_MDA_SIZE_BYTES
+
+	write_bin_hdr_offset $TMPDIR/hdr1 $TEST_MDA_SIZE_BYTES
+
+	lib_mangle_json_hdr0 $TEST_MDA_SIZE $TEST_JSN_SIZE
+	lib_mangle_json_hdr1 $TEST_MDA_SIZE $TEST_JSN_SIZE
+
+	truncate -s $((KEYSLOTS_OFFSET+KEYSLOTS_SIZE+1048576)) $TGT_IMG
+}
+
+function check()
+{
+	lib_hdr0_checksum || exit 2
+
+	read_luks2_json0 $TGT_IMG $TMPDIR/json_res0 $TEST_JSN_SIZE
+	jq -c --argjson ks $KEYSLOTS 'if .keyslots | length != $ks
+		then error("Unexpected value in result json") else empty end' $TMPDIR/json_res0 || exit 5
+}
+
+lib_prepare $@
+generate
+check
+lib_cleanup
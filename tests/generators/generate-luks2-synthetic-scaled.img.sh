@@ -0,0 +1,108 @@
+#!/bin/bash
+
+. lib.sh
+
+#
+# *** Description ***
+#
+# generate valid header scaled up to many keyslots, tokens and segments
+# with json area filled by token payload. Used for metadata performance
+# tests (see micro-bench -i), defaults produce the largest valid header.
+#
+# Counts can be changed by environment:
+#   LUKS2_GEN_KEYSLOTS (1-32), LUKS2_GEN_TOKENS (0-32),
+#   LUKS2_GEN_SEGMENTS (1-32), LUKS2_GEN_METADATA (metadata size in KiB,
+#   16-4096) and LUKS2_GEN_FILL (percent of json area to fill).
+#
+
+# $1 full target dir
+# $2 full source luks2 image
+
+function generate()
+{
+	KEYSLOTS=${LUKS2_GEN_KEYSLOTS:-32}
+	TOKENS=${LUKS2_GEN_TOKENS:-32}
+	SEGMENTS=${LUKS2_GEN_SEGMENTS:-32}
+	FILL=${LUKS2_GEN_FILL:-90}
+
+	test $KEYSLOTS -ge 1 -a $KEYSLOTS -le 32 || exit 2
+	test $TOKENS -ge 0 -a $TOKENS -le 32 || exit 2
+	test $SEGMENTS -ge 1 -a $SEGMENTS -le 32 || exit 2
+	test $FILL -ge 0 -a $FILL -lt 100 || exit 2
+
+	case ${LUKS2_GEN_METADATA:-4096} in
+	16|32|64|128|256|512|1024|2048|4096) TEST_MDA_SIZE=$((${LUKS2_GEN_METADATA:-4096}*2)) ;;
+	*) exit 2 ;;
+	esac
+
+	TEST_MDA_SIZE_BYTES=$((TEST_MDA_SIZE*512))
+	TEST_JSN_SIZE=$((TEST_MDA_SIZE-LUKS2_BIN_HDR_SIZE))
+	JSON_SIZE=$((TEST_JSN_SIZE*512))
+	KEYSLOTS_OFFSET=$((TEST_MDA_SIZE*1024))
+	# 128KiB keyslot areas, keyslots area rounded to 1MiB
+	KEYSLOTS_SIZE=$(((KEYSLOTS*131072+1048575)/1048576*1048576))
+	DATA_OFFSET=$((KEYSLOTS_OFFSET+KEYSLOTS_SIZE))
+
+	# every segment but last one (dynamic) is 1MiB, all assigned to digest 0
+	JQ_SCALE='.keyslots."0" as $k0 | .segments."0" as $s0 |
+		.keyslots = ([range($ks)] | map(. as $i | { key: ($i | tostring),
+			value: ($k0 | .area.offset = (($koff + $i * 131072) | tostring)) }) | from_entries) |
+		.tokens = ([range($tk)] | map(. as $i | { key: ($i | tostring),
+			value: { type: "synthetic", keyslots: [ ($i % $ks) | tostring ], payload: $pl } }) | from_entries) |
+		.segments = ([range($sg)] | map(. as $i | { key: ($i | tostring),
+			value: ($s0 | .offset = (($doff + $i * 1048576) | tostring) |
+				.iv_tweak = (($i * 2048) | tostring) |
+				.size = (if $i == $sg - 1 then "dynamic" else "1048576" end)) }) | from_entries) |
+		.digests."0".keyslots = [range($ks) | tostring] |
+		.digests."0".segments = [range($sg) | tostring] |
+		.config.json_size = ($jsize | tostring) |
+		.config.keyslots_size = ($ksize | tostring)'
+
+	# first pass without payload to get size of the rest of json
+	: > $TMPDIR/payload
+	json_str=$(jq -c --argjson ks $KEYSLOTS --argjson tk $TOKENS --argjson sg $SEGMENTS \
+		   --argjson koff $KEYSLOTS_OFFSET --argjson doff $DATA_OFFSET \
+		   --argjson jsize $JSON_SIZE --argjson ksize $KEYSLOTS_SIZE \
+		   --rawfile pl $TMPDIR/payload "$JQ_SCALE" $TMPDIR/json0)
+	test -n "$json_str" || exit 2
+
+	if [ $TOKENS -gt 0 ]; then
+		PAYLOAD_SIZE=$(((JSON_SIZE*FILL/100-${#json_str})/TOKENS))
+		test $PAYLOAD_SIZE -gt 0 && head -c $PAYLOAD_SIZE /dev/zero | tr '\0' 'x' > $TMPDIR/payload
+		json_str=$(jq -c --argjson ks $KEYSLOTS --argjson tk $TOKENS --argjson sg $SEGMENTS \
+			   --argjson koff $KEYSLOTS_OFFSET --argjson doff $DATA_OFFSET \
+			   --argjson jsize $JSON_SIZE --argjson ksize $KEYSLOTS_SIZE \
+			   --rawfile pl $TMPDIR/payload "$JQ_SCALE" $TMPDIR/json0)
+		test -n "$json_str" || exit 2
+	fi
+	test ${#json_str} -lt $JSON_SIZE || exit 2
+
+	write_luks2_json "$json_str" $TMPDIR/json0 $TEST_JSN_SIZE
+	write_luks2_json "$json_str" $TMPDIR/json1 $TEST_JSN_SIZE
+
+	write_bin_hdr_size $TMPDIR/hdr0 $TEST_MDA_SIZE_BYTES
+	write_bin_hdr_size $TMPDIR/hdr1 $TEST_MDA_SIZE_BYTES
+
+	write_bin_hdr_offset $TMPDIR/hdr1 $TEST_MDA_SIZE_BYTES
+
+	lib_mangle_json_hdr0 $TEST_MDA_SIZE $TEST_JSN_SIZE
+	lib_mangle_json_hdr1 $TEST_MDA_SIZE $TEST_JSN_SIZE
+
+	truncate -s $((DATA_OFFSET+SEGMENTS*1048576)) $TGT_IMG
+}
+
+function check()
+{
+	lib_hdr0_checksum || exit 2
+
+	read_luks2_json0 $TGT_IMG $TMPDIR/json_res0 $TEST_JSN_SIZE
+	jq -c --argjson ks $KEYSLOTS --argjson tk $TOKENS --argjson sg $SEGMENTS --arg jsize $JSON_SIZE \
+		'if (.keyslots | length != $ks) or (.tokens | length != $tk) or
+		    (.segments | length != $sg) or (.config.json_size != $jsize)
+		then error("Unexpected value in result json") else empty end' $TMPDIR/json_res0 || exit 5
+}
+
+lib_prepare $@
+generate
+check
+lib_cleanup
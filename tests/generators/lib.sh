@@ -53,7 +53,7 @@ function read_luks2_bin_hdr0()
 # 1:from 2:to 3:[json only size (defaults to 12KiB)]
 function read_luks2_json0()
 {
-	local _js=${4:-$LUKS2_JSON_SIZE}
+	local _js=${3:-$LUKS2_JSON_SIZE}
 	local _js=$((_js*512/4096))
 	_dd if=$1 of=$2 bs=4096 skip=1 count=$_js
 }
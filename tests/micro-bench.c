@@ -0,0 +1,591 @@
+/*
+ * micro benchmarks of library hot paths
+ *
+ * Copyright (C) 2023 Red Hat, Inc. All rights reserved.
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+/*
+ * Every benchmark runs for a fixed time (-t) several times (-r), the median
+ * run is printed. Internal library symbols are not exported, so storage
+ * (cipher + IV generator), PBKDF and blockwise I/O are linked from the backend
+ * convenience libraries, metadata paths are measured through the public API.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "libcryptsetup.h"
+#include "crypto_backend/crypto_backend.h"
+#include "utils_io.h"
+
+#define MAX_RUNS	32
+#define DATA_SIZE	(32 * 1024 * 1024)
+#define VERITY_SIZE	(16 * 1024 * 1024)
+
+typedef int (*bench_fn)(void *ctx);
+
+static unsigned bench_msecs = 300;
+static unsigned bench_runs = 5;
+static const char *bench_filter;
+static char bench_dir[256];
+
+static char *data_file, *hash_file, *fec_file, *luks1_file, *luks2_file, *io_file;
+
+static char *bench_path(const char *name)
+{
+	char *path;
+
+	if (asprintf(&path, "%s/%s", bench_dir, name) < 0)
+		return NULL;
+	return path;
+}
+
+static uint64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *)a, y = *(const double *)b;
+
+	return x < y ? -1 : x > y;
+}
+
+static void bench(const char *name, bench_fn fn, void *ctx, size_t bytes)
+{
+	double ns_op[MAX_RUNS];
+	uint64_t start, elapsed, ops;
+	unsigned i;
+	int r;
+
+	if (bench_filter && !strstr(name, bench_filter))
+		return;
+
+	/* warm-up, also checks that the benchmark works at all */
+	if ((r = fn(ctx)) < 0) {
+		printf("%-36s %14s (%s)\n", name, "N/A", strerror(-r));
+		return;
+	}
+
+	for (i = 0; i < bench_runs; i++) {
+		ops = 0;
+		start = now_ns();
+		do {
+			if ((r = fn(ctx)) < 0) {
+				printf("%-36s %14s (%s)\n", name, "FAILED", strerror(-r));
+				return;
+			}
+			ops++;
+			elapsed = now_ns() - start;
+		} while (elapsed < (uint64_t)bench_msecs * 1000000);
+		ns_op[i] = (double)elapsed / ops;
+	}
+
+	qsort(ns_op, bench_runs, sizeof(*ns_op), cmp_double);
+
+	if (bytes)
+		printf("%-36s %14.1f ns/op %10.1f MiB/s\n", name, ns_op[bench_runs / 2],
+		       bytes / ns_op[bench_runs / 2] * 1e9 / (1024 * 1024));
+	else
+		printf("%-36s %14.1f ns/op\n", name, ns_op[bench_runs / 2]);
+}
+
+/*
+ * Sector encryption, cost of IV generator per sector is the difference
+ * between modes with the same cipher.
+ */
+struct storage_ctx {
+	struct crypt_storage *s;
+	char *buf;
+	size_t length;
+};
+
+static int storage_encrypt(void *ctx)
+{
+	struct storage_ctx *c = ctx;
+
+	return crypt_storage_encrypt(c->s, 0, c->length, c->buf);
+}
+
+static void bench_storage(void)
+{
+	static const struct {
+		const char *cipher, *mode;
+		size_t key_size;
+	} modes[] = {
+		{ "aes", "xts-plain64",      64 },
+		{ "aes", "cbc-plain64",      32 },
+		{ "aes", "cbc-essiv:sha256", 32 },
+		{ "aes", "cbc-benbi",        32 },
+		{ "aes", "cbc-eboiv",        32 },
+	};
+	static const size_t sector_sizes[] = { 512, 4096 };
+	struct storage_ctx c = { .length = 64 * 1024 };
+	char key[64] = {}, name[64];
+	unsigned i, j;
+
+	if (posix_memalign((void **)&c.buf, 4096, c.length))
+		return;
+	memset(c.buf, 0xaa, c.length);
+
+	for (i = 0; i < sizeof(modes) / sizeof(*modes); i++)
+		for (j = 0; j < sizeof(sector_sizes) / sizeof(*sector_sizes); j++) {
+			snprintf(name, sizeof(name), "storage %s-%s/%zu", modes[i].cipher,
+				 modes[i].mode, sector_sizes[j]);
+			if (crypt_storage_init(&c.s, sector_sizes[j], modes[i].cipher, modes[i].mode,
+					       key, modes[i].key_size, false)) {
+				printf("%-36s %14s\n", name, "N/A");
+				continue;
+			}
+			bench(name, storage_encrypt, &c, c.length);
+			crypt_storage_destroy(c.s);
+		}
+
+	free(c.buf);
+}
+
+static int pbkdf_argon2id(void *ctx __attribute__((unused)))
+{
+	char key[32];
+
+	return crypt_pbkdf("argon2id", NULL, "password", 8, "saltsaltsaltsalt", 16,
+			   key, sizeof(key), 3, 16 * 1024, 1);
+}
+
+/* blockwise I/O with unaligned length is the read-modify-write path */
+struct io_ctx {
+	int fd;
+	char *buf;
+	size_t length;
+};
+
+static int io_write(void *ctx)
+{
+	struct io_ctx *c = ctx;
+
+	return write_lseek_blockwise(c->fd, 4096, 4096, c->buf, c->length, 4096) < 0 ? -EIO : 0;
+}
+
+static int io_read(void *ctx)
+{
+	struct io_ctx *c = ctx;
+
+	return read_lseek_blockwise(c->fd, 4096, 4096, c->buf, c->length, 4096) < 0 ? -EIO : 0;
+}
+
+static void bench_io(void)
+{
+	struct io_ctx c;
+
+	if (posix_memalign((void **)&c.buf, 4096, 1024 * 1024))
+		return;
+	memset(c.buf, 0x55, 1024 * 1024);
+
+	c.fd = open(io_file, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (c.fd < 0) {
+		free(c.buf);
+		return;
+	}
+
+	c.length = 1024 * 1024;
+	bench("write_blockwise aligned 1M", io_write, &c, c.length);
+	bench("read_blockwise aligned 1M", io_read, &c, c.length);
+	c.length = 1024 * 1024 - 1000;
+	bench("write_blockwise unaligned 1M", io_write, &c, c.length);
+	bench("read_blockwise unaligned 1M", io_read, &c, c.length);
+
+	close(c.fd);
+	free(c.buf);
+}
+
+/*
+ * LUKS metadata through public API, every operation uses a new context
+ * so nothing is cached between runs.
+ */
+static int luks_format(const char *path, const char *type)
+{
+	struct crypt_pbkdf_type pbkdf = {
+		.type = CRYPT_KDF_PBKDF2,
+		.hash = "sha256",
+		.iterations = 1000,
+		.flags = CRYPT_PBKDF_NO_BENCHMARK,
+	};
+	struct crypt_device *cd;
+	int fd, r;
+
+	fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0 || ftruncate(fd, DATA_SIZE)) {
+		if (fd >= 0)
+			close(fd);
+		return -EIO;
+	}
+	close(fd);
+
+	if ((r = crypt_init(&cd, path)))
+		return r;
+
+	r = crypt_set_pbkdf_type(cd, &pbkdf);
+	if (!r)
+		r = crypt_format(cd, type, "aes", "xts-plain64", NULL, NULL, 64, NULL);
+	if (!r)
+		r = crypt_keyslot_add_by_volume_key(cd, 0, NULL, 64, "password", 8);
+
+	crypt_free(cd);
+	return r < 0 ? r : 0;
+}
+
+static int luks_load(void *ctx)
+{
+	struct crypt_device *cd;
+	int r;
+
+	if ((r = crypt_init(&cd, ctx)))
+		return r;
+	r = crypt_load(cd, NULL, NULL);
+	crypt_free(cd);
+	return r;
+}
+
+static int luks2_write(void *ctx)
+{
+	static unsigned count;
+	struct crypt_device *cd;
+	char label[32];
+	int r;
+
+	if ((r = crypt_init(&cd, ctx)))
+		return r;
+
+	snprintf(label, sizeof(label), "bench%u", count++);
+	r = crypt_load(cd, CRYPT_LUKS2, NULL);
+	if (!r)
+		r = crypt_set_label(cd, label, NULL);
+
+	crypt_free(cd);
+	return r;
+}
+
+static void null_log(int level __attribute__((unused)),
+		     const char *msg __attribute__((unused)),
+		     void *usrptr __attribute__((unused)))
+{
+}
+
+static int luks2_dump(void *ctx)
+{
+	struct crypt_device *cd;
+	int r;
+
+	if ((r = crypt_init(&cd, ctx)))
+		return r;
+
+	crypt_set_log_callback(cd, null_log, NULL);
+	r = crypt_load(cd, CRYPT_LUKS2, NULL);
+	if (!r)
+		r = crypt_dump(cd);
+
+	crypt_free(cd);
+	return r;
+}
+
+static int luks2_dump_json(void *ctx)
+{
+	struct crypt_device *cd;
+	const char *json;
+	int r;
+
+	if ((r = crypt_init(&cd, ctx)))
+		return r;
+
+	r = crypt_load(cd, CRYPT_LUKS2, NULL);
+	if (!r)
+		r = crypt_dump_json(cd, &json, 0);
+
+	crypt_free(cd);
+	return r;
+}
+
+/* keyslot with minimal PBKDF2 cost, unlock time is mostly AF merge (4000 stripes) */
+static int luks1_keyslot_open(void *ctx)
+{
+	struct crypt_device *cd;
+	char key[64];
+	size_t key_size = sizeof(key);
+	int r;
+
+	if ((r = crypt_init(&cd, ctx)))
+		return r;
+	r = crypt_load(cd, CRYPT_LUKS1, NULL);
+	if (!r)
+		r = crypt_volume_key_get(cd, 0, key, &key_size, "password", 8);
+	crypt_free(cd);
+	return r < 0 ? r : 0;
+}
+
+static void bench_luks(void)
+{
+	/* if format fails, benchmarks report it as not available */
+	luks_format(luks1_file, CRYPT_LUKS1);
+	bench("LUKS1 header load", luks_load, luks1_file, 0);
+	bench("LUKS1 keyslot open (AF merge)", luks1_keyslot_open, luks1_file, 0);
+
+	luks_format(luks2_file, CRYPT_LUKS2);
+	bench("LUKS2 header read", luks_load, luks2_file, 0);
+	bench("LUKS2 header write", luks2_write, luks2_file, 0);
+}
+
+/*
+ * Header from an image (e.g. generators/generate-luks2-synthetic-scaled.img.sh),
+ * validation is part of both load and write. Write runs on a copy.
+ */
+static int copy_file(const char *from, const char *to)
+{
+	char buf[65536];
+	ssize_t len;
+	int fd_in, fd_out, r = 0;
+
+	if ((fd_in = open(from, O_RDONLY)) < 0)
+		return -errno;
+	if ((fd_out = open(to, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0) {
+		close(fd_in);
+		return -errno;
+	}
+
+	while ((len = read(fd_in, buf, sizeof(buf))) > 0)
+		if (write(fd_out, buf, len) != len) {
+			r = -EIO;
+			break;
+		}
+	if (len < 0)
+		r = -EIO;
+
+	close(fd_in);
+	close(fd_out);
+	return r;
+}
+
+static void bench_image(const char *image)
+{
+	char *copy = bench_path("image.img");
+
+	if (!copy)
+		return;
+
+	if (copy_file(image, copy) < 0)
+		fprintf(stderr, "Cannot copy image %s.\n", image);
+	else {
+		bench("image LUKS2 load", luks_load, copy, 0);
+		bench("image LUKS2 dump", luks2_dump, copy, 0);
+		bench("image LUKS2 dump json", luks2_dump_json, copy, 0);
+		bench("image LUKS2 write", luks2_write, copy, 0);
+	}
+
+	unlink(copy);
+	free(copy);
+}
+
+/* VERITY hash area (and FEC) creation and full userspace verification */
+struct verity_ctx {
+	bool fec;
+	char root_hash[64];
+	size_t root_hash_size;
+};
+
+static int verity_create(void *ctx)
+{
+	struct verity_ctx *c = ctx;
+	struct crypt_params_verity params = {
+		.hash_name = "sha256",
+		.data_device = data_file,
+		.fec_device = c->fec ? fec_file : NULL,
+		.fec_roots = c->fec ? 2 : 0,
+		.salt = "saltsaltsaltsalt",
+		.salt_size = 16,
+		.hash_type = 1,
+		.data_block_size = 4096,
+		.hash_block_size = 4096,
+		.flags = CRYPT_VERITY_CREATE_HASH | CRYPT_VERITY_NO_HEADER,
+	};
+	struct crypt_device *cd;
+	int r;
+
+	if ((r = crypt_init(&cd, hash_file)))
+		return r;
+
+	r = crypt_format(cd, CRYPT_VERITY, NULL, NULL, NULL, NULL, 0, &params);
+	if (!r) {
+		c->root_hash_size = sizeof(c->root_hash);
+		r = crypt_volume_key_get(cd, CRYPT_ANY_SLOT, c->root_hash, &c->root_hash_size, NULL, 0);
+	}
+
+	crypt_free(cd);
+	return r < 0 ? r : 0;
+}
+
+static int verity_verify(void *ctx)
+{
+	struct verity_ctx *c = ctx;
+	struct crypt_verity_report report = {};
+	struct crypt_params_verity params = {
+		.hash_name = "sha256",
+		.data_device = data_file,
+		.salt = "saltsaltsaltsalt",
+		.salt_size = 16,
+		.hash_type = 1,
+		.data_block_size = 4096,
+		.hash_block_size = 4096,
+		.data_size = VERITY_SIZE / 4096,
+		.flags = CRYPT_VERITY_NO_HEADER,
+	};
+	struct crypt_device *cd;
+	int r;
+
+	if ((r = crypt_init(&cd, hash_file)))
+		return r;
+
+	/* without superblock the context is set up by format without hash creation */
+	r = crypt_format(cd, CRYPT_VERITY, NULL, NULL, NULL, NULL, 0, &params);
+	if (!r)
+		r = crypt_verity_verify_report(cd, c->root_hash, c->root_hash_size, 0, &report);
+
+	crypt_free(cd);
+	return r;
+}
+
+static void bench_verity(void)
+{
+	struct verity_ctx c = {};
+	char *buf;
+	int fd;
+
+	fd = open(data_file, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		return;
+
+	buf = malloc(VERITY_SIZE);
+	if (buf) {
+		memset(buf, 0x33, VERITY_SIZE);
+		if (write(fd, buf, VERITY_SIZE) != VERITY_SIZE) {
+			free(buf);
+			buf = NULL;
+		}
+	}
+	close(fd);
+	if (!buf)
+		return;
+	free(buf);
+
+	/* hash and FEC images are created by the library, all must exist */
+	close(open(hash_file, O_RDWR | O_CREAT | O_TRUNC, 0600));
+	close(open(fec_file, O_RDWR | O_CREAT | O_TRUNC, 0600));
+
+	bench("VERITY create hash 16M", verity_create, &c, VERITY_SIZE);
+	bench("VERITY verify 16M", verity_verify, &c, VERITY_SIZE);
+	c.fec = true;
+	bench("VERITY create hash + FEC 16M", verity_create, &c, VERITY_SIZE);
+}
+
+static void usage(void)
+{
+	fprintf(stderr, "Use:\tmicro-bench [-t msecs] [-r runs] [-d dir] [-i luks2 image] [filter]\n");
+}
+
+int main(int argc, char **argv)
+{
+	const char *dir = "/tmp", *image = NULL;
+	int c;
+
+	while ((c = getopt(argc, argv, "t:r:d:i:h")) != -1) {
+		switch (c) {
+		case 't':
+			bench_msecs = atoi(optarg);
+			break;
+		case 'r':
+			bench_runs = atoi(optarg);
+			break;
+		case 'd':
+			dir = optarg;
+			break;
+		case 'i':
+			image = optarg;
+			break;
+		default:
+			usage();
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	if (optind < argc)
+		bench_filter = argv[optind];
+
+	if (!bench_msecs || !bench_runs || bench_runs > MAX_RUNS) {
+		usage();
+		exit(EXIT_FAILURE);
+	}
+
+	snprintf(bench_dir, sizeof(bench_dir), "%s/micro-bench.XXXXXX", dir);
+	if (!mkdtemp(bench_dir)) {
+		fprintf(stderr, "Cannot create directory in %s.\n", dir);
+		exit(EXIT_FAILURE);
+	}
+
+	data_file = bench_path("data.img");
+	hash_file = bench_path("hash.img");
+	fec_file = bench_path("fec.img");
+	luks1_file = bench_path("luks1.img");
+	luks2_file = bench_path("luks2.img");
+	io_file = bench_path("io.img");
+	if (!data_file || !hash_file || !fec_file || !luks1_file || !luks2_file || !io_file)
+		exit(EXIT_FAILURE);
+
+	if (crypt_backend_init(false)) {
+		fprintf(stderr, "Crypto backend initialization failed.\n");
+		exit(EXIT_FAILURE);
+	}
+
+	printf("# %u runs of %u ms, median, backend %s\n", bench_runs, bench_msecs,
+	       crypt_backend_version());
+
+	bench_storage();
+	bench("pbkdf argon2id 16M/3", pbkdf_argon2id, NULL, 0);
+	bench_io();
+	bench_luks();
+	bench_verity();
+	if (image)
+		bench_image(image);
+
+	unlink(data_file);
+	unlink(hash_file);
+	unlink(fec_file);
+	unlink(luks1_file);
+	unlink(luks2_file);
+	unlink(io_file);
+	rmdir(bench_dir);
+
+	crypt_backend_destroy();
+	return EXIT_SUCCESS;
+}
@@ -28,7 +28,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
 #include <errno.h>
+#include <pthread.h>
+#include <time.h>
 #include <json-c/json.h>
 #include "libcryptsetup.h"
 #include "ssh-utils.h"
@@ -44,6 +47,10 @@
 
 #define l_dbg(cd, x...) crypt_logf(cd, CRYPT_LOG_DEBUG, x)
 
+/* Authenticated sessions kept for other devices unlocked by the same process */
+#define SESSION_CACHE_ENTRIES	8
+#define SESSION_CACHE_IDLE	60 /* seconds */
+
 
 const char *cryptsetup_token_version(void);
 int cryptsetup_token_open_pin(struct crypt_device *cd, int token, const char *pin,
@@ -70,12 +77,138 @@ static json_object *get_token_jobj(struct crypt_device *cd, int token)
 	return json_tokener_parse(json_slot);
 }
 
+struct session_cache_entry {
+	char *server, *user, *keypath;
+	ssh_session ssh;
+	time_t last_use;
+	bool busy;
+};
+
+static pthread_mutex_t session_cache_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct session_cache_entry session_cache[SESSION_CACHE_ENTRIES];
+
+static void session_free(ssh_session ssh)
+{
+	ssh_disconnect(ssh);
+	ssh_free(ssh);
+}
+
+/* Called with session_cache_lock held */
+static void session_cache_drop(struct session_cache_entry *e)
+{
+	if (e->ssh)
+		session_free(e->ssh);
+	free(e->server);
+	free(e->user);
+	free(e->keypath);
+	memset(e, 0, sizeof(*e));
+}
+
+static bool session_cache_match(const struct session_cache_entry *e, const char *server,
+	const char *user, const char *keypath)
+{
+	return e->ssh && !strcmp(e->server, server) && !strcmp(e->user, user) &&
+	       !strcmp(e->keypath, keypath);
+}
+
+/* Reserve connected session authenticated with the same key, NULL if there is none */
+static struct session_cache_entry *session_cache_get(const char *server, const char *user,
+	const char *keypath)
+{
+	struct session_cache_entry *e, *found = NULL;
+	time_t now = time(NULL);
+	int i;
+
+	if (!server || !user || !keypath)
+		return NULL;
+
+	pthread_mutex_lock(&session_cache_lock);
+	for (i = 0; i < SESSION_CACHE_ENTRIES; i++) {
+		e = &session_cache[i];
+		if (!e->ssh || e->busy)
+			continue;
+		if (now - e->last_use > SESSION_CACHE_IDLE || !ssh_is_connected(e->ssh)) {
+			session_cache_drop(e);
+			continue;
+		}
+		if (!found && session_cache_match(e, server, user, keypath))
+			found = e;
+	}
+	if (found)
+		found->busy = true;
+	pthread_mutex_unlock(&session_cache_lock);
+
+	return found;
+}
+
+static void session_cache_release(struct session_cache_entry *e, bool keep)
+{
+	pthread_mutex_lock(&session_cache_lock);
+	if (keep) {
+		e->busy = false;
+		e->last_use = time(NULL);
+	} else
+		session_cache_drop(e);
+	pthread_mutex_unlock(&session_cache_lock);
+}
+
+/* Keep new session for later use, replacing the least recently used idle one */
+static void session_cache_store(const char *server, const char *user, const char *keypath,
+	ssh_session ssh)
+{
+	struct session_cache_entry *e, *slot = NULL;
+	int i;
+
+	if (!server || !user || !keypath) {
+		session_free(ssh);
+		return;
+	}
+
+	pthread_mutex_lock(&session_cache_lock);
+	for (i = 0; i < SESSION_CACHE_ENTRIES; i++) {
+		e = &session_cache[i];
+		if (e->busy)
+			continue;
+		if (!slot || (slot->ssh && (!e->ssh || e->last_use < slot->last_use)))
+			slot = e;
+	}
+
+	if (slot) {
+		session_cache_drop(slot);
+		slot->server = strdup(server);
+		slot->user = strdup(user);
+		slot->keypath = strdup(keypath);
+		if (slot->server && slot->user && slot->keypath) {
+			slot->ssh = ssh;
+			slot->last_use = time(NULL);
+			ssh = NULL;
+		} else
+			session_cache_drop(slot);
+	}
+	pthread_mutex_unlock(&session_cache_lock);
+
+	if (ssh)
+		session_free(ssh);
+}
+
+static void __attribute__((destructor)) session_cache_exit(void)
+{
+	int i;
+
+	pthread_mutex_lock(&session_cache_lock);
+	for (i = 0; i < SESSION_CACHE_ENTRIES; i++)
+		session_cache_drop(&session_cache[i]);
+	pthread_mutex_unlock(&session_cache_lock);
+}
+
 int cryptsetup_token_open_pin(struct crypt_device *cd, int token, const char *pin,
 	size_t pin_size __attribute__((unused)), char **password, size_t *password_len,
 	void *usrptr __attribute__((unused)))
 {
 	int r;
 	json_object *jobj_server, *jobj_user, *jobj_path, *jobj_token, *jobj_keypath;
+	struct session_cache_entry *e;
+	const char *server, *user, *keypath;
 	ssh_key pkey;
 	ssh_session ssh;
 
@@ -88,7 +221,12 @@ int cryptsetup_token_open_pin(struct crypt_device *cd, int token, const char *pi
 	json_object_object_get_ex(jobj_token, "ssh_path",   &jobj_path);
 	json_object_object_get_ex(jobj_token, "ssh_keypath",&jobj_keypath);
 
-	r = ssh_pki_import_privkey_file(json_object_get_string(jobj_keypath), pin, NULL, NULL, &pkey);
+	server = json_object_get_string(jobj_server);
+	user = json_object_get_string(jobj_user);
+	keypath = json_object_get_string(jobj_keypath);
+
+	/* private key (and its pin) is verified even if a cached session is used */
+	r = ssh_pki_import_privkey_file(keypath, pin, NULL, NULL, &pkey);
 	if (r != SSH_OK) {
 		json_object_put(jobj_token);
 		if (r == SSH_EOF) {
@@ -99,8 +237,21 @@ int cryptsetup_token_open_pin(struct crypt_device *cd, int token, const char *pi
 		return -EAGAIN;
 	}
 
-	ssh = sshplugin_session_init(cd, json_object_get_string(jobj_server),
-				   json_object_get_string(jobj_user));
+	e = session_cache_get(server, user, keypath);
+	if (e) {
+		l_dbg(cd, "Reusing ssh session to %s.", server);
+		r = sshplugin_download_password(cd, e->ssh, json_object_get_string(jobj_path),
+						password, password_len);
+		session_cache_release(e, !r);
+		if (!r) {
+			ssh_key_free(pkey);
+			json_object_put(jobj_token);
+			return 0;
+		}
+		/* server may have closed it in the meantime, try a new one */
+	}
+
+	ssh = sshplugin_session_init(cd, server, user);
 	if (!ssh) {
 		json_object_put(jobj_token);
 		ssh_key_free(pkey);
@@ -114,8 +265,10 @@ int cryptsetup_token_open_pin(struct crypt_device *cd, int token, const char *pi
 		r = sshplugin_download_password(cd, ssh, json_object_get_string(jobj_path),
 					      password, password_len);
 
-	ssh_disconnect(ssh);
-	ssh_free(ssh);
+	if (!r)
+		session_cache_store(server, user, keypath, ssh);
+	else
+		session_free(ssh);
 	json_object_put(jobj_token);
 
 	return r ? -EINVAL : r;